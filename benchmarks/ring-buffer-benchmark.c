@@ -0,0 +1,150 @@
+/* ring-buffer-benchmark.c
+ *
+ * Copyright 2025 EricLin
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+/* Microbenchmark of the RingBuffer */
+/*
+  * write/read: copy chunks of a line length in and out, the positions keep moving so the copies wrap around the boundary
+  * take_lines: fill the buffer through `ring_buffer_write_space()` like the scan output is read, then take the lines
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "ring-buffer.h"
+
+#define BENCHMARK_BYTES ((size_t)256 << 20) // Bytes moved by each case
+#define TAKE_LINES_BATCH 64
+
+static const size_t line_lengths[] = { 16, 64, 256, 1024, 2047 };
+
+static RingBuffer ring;
+static char source[RING_BUFFER_SIZE * 2];
+static char sink[RING_BUFFER_SIZE];
+static volatile size_t checksum = 0; // Keep the results used, so the loops aren't optimized out
+
+static unsigned long long
+now_ns(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (unsigned long long)now.tv_sec * 1000000000ULL + (unsigned long long)now.tv_nsec;
+}
+
+static void
+print_result(const char *name, size_t line_length, size_t ops, size_t bytes, unsigned long long elapsed_ns)
+{
+    const double seconds = elapsed_ns / 1e9;
+
+    printf("%-12s %8zu %14.0f %10.2f %10.1f\n",
+           name, line_length, ops / seconds, (double)elapsed_ns / ops, bytes / seconds / 1048576.0);
+}
+
+/* Fill `source` with lines of `line_length` bytes, including the newline character */
+static void
+fill_lines(size_t line_length)
+{
+    for (size_t i = 0; i < sizeof(source); i++)
+    {
+        source[i] = (i + 1) % line_length == 0 ? '\n' : (char)('a' + i % 26);
+    }
+}
+
+static void
+benchmark_write_read(size_t line_length)
+{
+    ring_buffer_init(&ring);
+
+    size_t ops = 0;
+    size_t moved = 0;
+    unsigned long long start = now_ns();
+
+    while (moved < BENCHMARK_BYTES)
+    {
+        /* Keep the buffer half full, so every copy happens against a moving head and tail */
+        while (ring.count < RING_BUFFER_SIZE / 2)
+        {
+            ring_buffer_write(&ring, source, line_length);
+            ops++;
+        }
+
+        size_t read = ring_buffer_read(&ring, sink, line_length);
+        checksum += (unsigned char)sink[read - 1];
+        moved += read;
+        ops++;
+    }
+
+    print_result("write/read", line_length, ops, moved, now_ns() - start);
+}
+
+static void
+benchmark_take_lines(size_t line_length)
+{
+    ring_buffer_init(&ring);
+
+    RingBufferLine lines[TAKE_LINES_BATCH];
+    size_t ops = 0;
+    size_t moved = 0;
+    size_t source_offset = 0;
+    const size_t source_period = (RING_BUFFER_SIZE / line_length) * line_length; // Wrap at a line boundary
+    unsigned long long start = now_ns();
+
+    while (moved < BENCHMARK_BYTES)
+    {
+        /* Read the "pipe" into the free space, like `read()` does */
+        size_t space;
+        char *destination = ring_buffer_write_space(&ring, &space);
+        if (space > 0)
+        {
+            memcpy(destination, source + source_offset, space);
+            ring_buffer_commit(&ring, space);
+            source_offset = (source_offset + space) % source_period; // `source` holds two buffers, so this never overruns
+        }
+
+        size_t num_lines;
+        while ((num_lines = ring_buffer_take_lines(&ring, lines, TAKE_LINES_BATCH)) > 0)
+        {
+            for (size_t i = 0; i < num_lines; i++)
+            {
+                checksum += lines[i].length;
+                moved += lines[i].length + 1;
+            }
+            ops += num_lines;
+        }
+    }
+
+    print_result("take_lines", line_length, ops, moved, now_ns() - start);
+}
+
+int
+main(void)
+{
+    printf("%-12s %8s %14s %10s %10s\n", "case", "line", "ops/s", "ns/op", "MiB/s");
+
+    for (size_t i = 0; i < sizeof(line_lengths) / sizeof(line_lengths[0]); i++)
+    {
+        fill_lines(line_lengths[i]);
+        benchmark_write_read(line_lengths[i]);
+        benchmark_take_lines(line_lengths[i]);
+    }
+
+    return checksum == 0; // Never 0 in practice
+}
@@ -0,0 +1,279 @@
+#!/usr/bin/env python3
+#
+# scan-benchmark.py
+#
+# Copyright 2025 EricLin
+#
+# This program is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <https://www.gnu.org/licenses/>.
+#
+# SPDX-License-Identifier: GPL-3.0-or-later
+
+# End-to-end scan benchmark
+#
+# Generate reproducible synthetic trees and scan them with the available backends
+# (clamscanc, clamdscan and clamscan), report files/s, MiB/s, the time to the first
+# result, the peak RSS and the CPU time of each run.
+#
+# The trees are generated once and reused while `--seed` and `--scale` are unchanged.
+
+import argparse
+import io
+import json
+import os
+import random
+import selectors
+import shutil
+import subprocess
+import sys
+import tarfile
+import time
+import zipfile
+
+TREE_FORMAT_VERSION = 1 # Bump it when the generated trees change
+
+# Split, so the script itself is never detected
+EICAR = ('X5O!P%@AP[4\\PZX54(P^)7CC)7}$' + 'EICAR-STANDARD-ANTIVIRUS-TEST-FILE!$H+H*').encode()
+
+
+def random_bytes(rng, size):
+    return rng.randbytes(size) if hasattr(rng, 'randbytes') else bytes(rng.getrandbits(8) for _ in range(size))
+
+
+def write_file(path, data):
+    os.makedirs(os.path.dirname(path), exist_ok=True)
+    with open(path, 'wb') as file:
+        file.write(data)
+
+
+def write_random_file(path, rng, size):
+    """Write `size` bytes of incompressible data in 1 MiB chunks"""
+    os.makedirs(os.path.dirname(path), exist_ok=True)
+    chunk = random_bytes(rng, 1 << 20)
+    with open(path, 'wb') as file:
+        written = 0
+        while written < size:
+            length = min(len(chunk), size - written)
+            file.write(chunk[:length])
+            written += length
+            chunk = chunk[1:] + chunk[:1] # Keep the chunks different without generating new data
+
+
+def generate_tiny(root, rng, scale):
+    """Many tiny files, the per-file overhead dominates"""
+    for i in range(int(20000 * scale)):
+        write_file(os.path.join(root, f'd{i % 200:03d}', f'f{i:06d}.txt'), random_bytes(rng, rng.randint(0, 4096)))
+
+
+def generate_huge(root, rng, scale):
+    """Few huge files, the engine throughput dominates"""
+    for i in range(4):
+        write_random_file(os.path.join(root, f'huge{i}.bin'), rng, int(128 * scale) << 20)
+
+
+def generate_deep(root, rng, scale):
+    """Deep nesting, the traversal dominates"""
+    for branch in range(int(32 * scale) or 1):
+        path = os.path.join(root, f'b{branch:02d}')
+        for depth in range(64):
+            path = os.path.join(path, f'l{depth:02d}')
+            write_file(os.path.join(path, 'leaf.dat'), random_bytes(rng, rng.randint(64, 2048)))
+
+
+def generate_archives(root, rng, scale):
+    """Archives, the unpacking dominates"""
+    for i in range(int(200 * scale) or 1):
+        buffer = io.BytesIO()
+        if i % 2 == 0:
+            with zipfile.ZipFile(buffer, 'w', zipfile.ZIP_DEFLATED) as archive:
+                for j in range(20):
+                    archive.writestr(f'member{j}.txt', random_bytes(rng, rng.randint(256, 16384)))
+            write_file(os.path.join(root, f'a{i:04d}.zip'), buffer.getvalue())
+        else:
+            with tarfile.open(fileobj=buffer, mode='w:gz') as archive:
+                for j in range(20):
+                    data = random_bytes(rng, rng.randint(256, 16384))
+                    info = tarfile.TarInfo(f'member{j}.txt')
+                    info.size = len(data)
+                    info.mtime = 0 # Reproducible
+                    archive.addfile(info, io.BytesIO(data))
+            write_file(os.path.join(root, f'a{i:04d}.tar.gz'), buffer.getvalue())
+
+
+def generate_mixed(root, rng, scale):
+    """A bit of everything, with EICAR samples in plain files and in archives"""
+    for i in range(int(5000 * scale)):
+        kind = rng.random()
+        directory = os.path.join(root, f'd{i % 50:02d}', f's{i % 7}')
+        if kind < 0.01:
+            write_file(os.path.join(directory, f'eicar{i}.com'), EICAR)
+        elif kind < 0.02:
+            buffer = io.BytesIO()
+            with zipfile.ZipFile(buffer, 'w') as archive:
+                archive.writestr('eicar.com', EICAR)
+            write_file(os.path.join(directory, f'eicar{i}.zip'), buffer.getvalue())
+        elif kind < 0.95:
+            write_file(os.path.join(directory, f'f{i:05d}.dat'), random_bytes(rng, rng.randint(0, 65536)))
+        else:
+            write_file(os.path.join(directory, f'm{i:05d}.bin'), random_bytes(rng, rng.randint(1 << 20, 4 << 20)))
+
+
+TREES = {
+    'tiny': generate_tiny,
+    'huge': generate_huge,
+    'deep': generate_deep,
+    'archives': generate_archives,
+    'mixed': generate_mixed,
+}
+
+
+def tree_summary(root):
+    count = size = 0
+    for directory, _, files in os.walk(root):
+        for name in files:
+            count += 1
+            size += os.lstat(os.path.join(directory, name)).st_size
+    return count, size
+
+
+def prepare_tree(tree_dir, name, seed, scale):
+    """Generate the tree unless the same one is already there"""
+    root = os.path.join(tree_dir, name)
+    stamp_path = root + '.json'
+    stamp = {'version': TREE_FORMAT_VERSION, 'seed': seed, 'scale': scale}
+
+    try:
+        with open(stamp_path) as file:
+            saved = json.load(file)
+        if all(saved.get(key) == value for key, value in stamp.items()) and os.path.isdir(root):
+            return root, saved['files'], saved['bytes']
+    except (OSError, ValueError, KeyError):
+        pass
+
+    print(f'Generating the {name} tree...', file=sys.stderr)
+    shutil.rmtree(root, ignore_errors=True)
+    TREES[name](root, random.Random(f'{seed}-{name}'), scale)
+
+    stamp['files'], stamp['bytes'] = tree_summary(root)
+    with open(stamp_path, 'w') as file:
+        json.dump(stamp, file)
+    return root, stamp['files'], stamp['bytes']
+
+
+def run_scanner(command):
+    """Run the scanner, return (wall time, time to the first result, peak RSS in KiB, CPU seconds, exit status)"""
+    start = time.monotonic()
+    process = subprocess.Popen(command, stdout=subprocess.PIPE, stderr=subprocess.DEVNULL)
+
+    first_result = None
+    with selectors.DefaultSelector() as selector:
+        selector.register(process.stdout, selectors.EVENT_READ)
+        while True:
+            selector.select()
+            data = os.read(process.stdout.fileno(), 1 << 16)
+            if not data:
+                break
+            if first_result is None:
+                first_result = time.monotonic() - start
+    process.stdout.close()
+
+    # The usage covers the waited children too, e.g. the workers of clamscanc
+    _, status, usage = os.wait4(process.pid, 0)
+    process.returncode = os.waitstatus_to_exitcode(status) if hasattr(os, 'waitstatus_to_exitcode') else status
+    wall = time.monotonic() - start
+
+    return wall, first_result, usage.ru_maxrss, usage.ru_utime + usage.ru_stime, process.returncode
+
+
+def find_scanners(args):
+    """List the backends to be benchmarked, as (name, workers, command builder)"""
+    scanners = []
+
+    if args.clamscanc and os.access(args.clamscanc, os.X_OK):
+        for workers in args.workers:
+            scanners.append(('clamscanc', workers, lambda root, w=workers: [args.clamscanc, root, str(w)]))
+
+    clamdscan = shutil.which('clamdscan')
+    if clamdscan and subprocess.run([clamdscan, '--ping', '1'], stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL).returncode == 0:
+        scanners.append(('clamdscan', 0, lambda root: [clamdscan, '--multiscan', '--fdpass', root])) # The daemon decides the concurrency
+
+    clamscan = shutil.which('clamscan')
+    if clamscan and not args.skip_clamscan:
+        scanners.append(('clamscan', 1, lambda root: [clamscan, '-r', '--no-summary', root]))
+
+    return scanners
+
+
+def parse_workers(value):
+    return [int(item) for item in value.split(',') if item]
+
+
+def main():
+    parser = argparse.ArgumentParser(description='End-to-end scan benchmark')
+    parser.add_argument('--tree-dir', default='benchmark-trees', help='where the synthetic trees are generated')
+    parser.add_argument('--clamscanc', help='the clamscanc executable')
+    parser.add_argument('--workers', type=parse_workers, default=[1, 2, 4, os.cpu_count() or 1],
+                        help='comma separated worker counts for clamscanc')
+    parser.add_argument('--trees', default=','.join(TREES), help='comma separated trees to scan')
+    parser.add_argument('--seed', type=int, default=1)
+    parser.add_argument('--scale', type=float, default=1.0, help='multiply the size of the trees')
+    parser.add_argument('--repeat', type=int, default=1, help='keep the fastest of N runs')
+    parser.add_argument('--skip-clamscan', action='store_true', help="don't run clamscan, it loads the database for every run")
+    parser.add_argument('--json', help='also write the results to this file')
+    args = parser.parse_args()
+
+    args.workers = sorted(set(args.workers))
+    os.makedirs(args.tree_dir, exist_ok=True)
+
+    scanners = find_scanners(args)
+    if not scanners:
+        print('No scanner found, nothing to benchmark', file=sys.stderr)
+        return 77 # Skipped
+
+    results = []
+    header = f'{"tree":<9} {"scanner":<10} {"workers":>7} {"files/s":>10} {"MiB/s":>9} {"first(s)":>9} {"RSS(MiB)":>9} {"CPU(s)":>8} {"wall(s)":>8}'
+    print(header)
+    print('-' * len(header))
+
+    for tree in args.trees.split(','):
+        if tree not in TREES:
+            print(f'Unknown tree: {tree}', file=sys.stderr)
+            return 1
+        root, num_files, num_bytes = prepare_tree(args.tree_dir, tree, args.seed, args.scale)
+
+        for name, workers, build_command in scanners:
+            runs = [run_scanner(build_command(root)) for _ in range(max(args.repeat, 1))]
+            wall, first_result, rss, cpu, status = min(runs, key=lambda run: run[0])
+
+            result = {
+                'tree': tree, 'scanner': name, 'workers': workers,
+                'files': num_files, 'bytes': num_bytes,
+                'wall_s': wall, 'first_result_s': first_result,
+                'files_per_s': num_files / wall, 'mib_per_s': num_bytes / wall / (1 << 20),
+                'peak_rss_kib': rss, 'cpu_s': cpu, 'exit_status': status,
+            }
+            results.append(result)
+
+            first = f'{first_result:9.3f}' if first_result is not None else f'{"-":>9}'
+            print(f'{tree:<9} {name:<10} {workers or "-":>7} {result["files_per_s"]:10.1f} {result["mib_per_s"]:9.2f} '
+                  f'{first} {rss / 1024:9.1f} {cpu:8.2f} {wall:8.2f}', flush=True)
+
+    if args.json:
+        with open(args.json, 'w') as file:
+            json.dump({'seed': args.seed, 'scale': args.scale, 'results': results}, file, indent=2)
+
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
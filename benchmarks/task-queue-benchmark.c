@@ -0,0 +1,148 @@
+/* task-queue-benchmark.c
+ *
+ * Copyright 2025 EricLin
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+*/
+
+/* Microbenchmark of the TaskQueue */
+/*
+  * Every process adds `MAX_GET_TASKS` tasks, then gets the same number of tasks back (not necessarily its own ones), and repeats
+  * The queue is shared by 1 to `MAX_PROCESSES` processes, so the cost of the contention on the lock can be compared
+  * Build it with a different `-DMAX_GET_TASKS` to compare the batch sizes
+*/
+
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+#include "manager.h"
+
+#define BENCHMARK_TASKS (1 << 21) // Tasks added by all the processes in each case
+
+static const size_t process_counts[] = { 1, 2, 4, 8, 16, 32, 64 };
+
+/* Lives in the shared mapping */
+typedef struct {
+    TaskQueue queue;
+    _Atomic size_t ready;
+    _Atomic bool go;
+    _Atomic uint64_t ops;
+} BenchmarkShared;
+
+_Static_assert(64 <= MAX_PROCESSES, "process_counts exceeds MAX_PROCESSES");
+
+static unsigned long long now_ns(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (unsigned long long)now.tv_sec * 1000000000ULL + (unsigned long long)now.tv_nsec;
+}
+
+/* Add and get `rounds` batches of tasks */
+static void benchmark_process(BenchmarkShared *shared, size_t rounds) {
+    Task tasks[MAX_GET_TASKS];
+    Task task = { .type = TASK_SCAN_FILE, .path = 1 }; // Any valid handle, the path is never read
+    uint64_t ops = 0;
+
+    atomic_fetch_add(&shared->ready, 1);
+    while (!atomic_load(&shared->go)) sched_yield(); // Start together
+
+    for (size_t round = 0; round < rounds; round++) {
+        for (size_t i = 0; i < MAX_GET_TASKS; i++) task_queue_add(&shared->queue, task);
+        ops += MAX_GET_TASKS;
+
+        /* Every process gets as many tasks as it added, so the queue never runs dry for a process still waiting */
+        size_t got = 0;
+        while (got < MAX_GET_TASKS) {
+            size_t count = task_queue_get(&shared->queue, tasks);
+            if (count == 0) {
+                sched_yield(); // Another process took them, it's giving the surplus back
+                continue;
+            }
+            ops += count;
+            got += count;
+        }
+
+        /* Give the surplus back */
+        for (; got > MAX_GET_TASKS; got--) {
+            task_queue_add(&shared->queue, task);
+            ops++;
+        }
+    }
+
+    atomic_fetch_add(&shared->ops, ops);
+}
+
+static bool run_case(BenchmarkShared *shared, size_t num_processes) {
+    task_queue_init(&shared->queue);
+    atomic_store(&shared->ready, 0);
+    atomic_store(&shared->go, false);
+    atomic_store(&shared->ops, 0);
+
+    size_t rounds = BENCHMARK_TASKS / MAX_GET_TASKS / num_processes;
+    if (rounds == 0) rounds = 1;
+
+    pid_t pids[MAX_PROCESSES];
+    for (size_t i = 0; i < num_processes; i++) {
+        pids[i] = fork();
+        if (pids[i] == -1) {
+            perror("fork");
+            atomic_store(&shared->go, true); // Let the spawned ones finish
+            for (size_t j = 0; j < i; j++) waitpid(pids[j], NULL, 0);
+            return false;
+        }
+        if (pids[i] == 0) {
+            benchmark_process(shared, rounds);
+            _exit(0);
+        }
+    }
+
+    while (atomic_load(&shared->ready) < num_processes) sched_yield();
+    unsigned long long start = now_ns();
+    atomic_store(&shared->go, true);
+
+    for (size_t i = 0; i < num_processes; i++) waitpid(pids[i], NULL, 0);
+    unsigned long long elapsed_ns = now_ns() - start;
+
+    uint64_t ops = atomic_load(&shared->ops);
+    printf("%6d %6zu %14.0f %10.2f\n", MAX_GET_TASKS, num_processes, ops / (elapsed_ns / 1e9), (double)elapsed_ns / ops);
+    fflush(stdout);
+
+    task_queue_clear(&shared->queue);
+    return true;
+}
+
+int main(void) {
+    BenchmarkShared *shared = mmap(NULL, sizeof(BenchmarkShared), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (shared == MAP_FAILED) {
+        perror("mmap");
+        return 1;
+    }
+
+    printf("%6s %6s %14s %10s\n", "batch", "procs", "ops/s", "ns/op");
+
+    bool success = true;
+    for (size_t i = 0; i < sizeof(process_counts) / sizeof(process_counts[0]) && success; i++) {
+        success = run_case(shared, process_counts[i]);
+    }
+
+    munmap(shared, sizeof(BenchmarkShared));
+    return success ? 0 : 1;
+}
@@ -0,0 +1,113 @@
+/* arena.c
+ *
+ * Copyright 2025 EricLin
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+*/
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "arena.h"
+
+#ifndef MAP_NORESERVE
+#define MAP_NORESERVE 0
+#endif
+
+#define HANDLE_OF(head) ((PathHandle)((head) & UINT32_MAX)) // Get the handle from the free list head
+#define TAG_OF(head) ((uint32_t)((head) >> 32)) // Get the tag from the free list head
+#define MAKE_HEAD(tag, handle) (((uint64_t)(tag) << 32) | (uint64_t)(handle))
+
+/* Get the size class which can hold `size` bytes, -1 if it's too large */
+static inline int get_size_class(size_t size) {
+    for (int class = 0; class < PATH_SIZE_CLASSES; class++) {
+        if (size <= ((size_t)PATH_BLOCK_UNIT << class)) return class;
+    }
+    return -1;
+}
+
+/* Get the `next` link stored in the first bytes of a free block */
+static inline _Atomic uint32_t *get_next_link(PathArena *arena, PathHandle handle) {
+    return (_Atomic uint32_t *)path_arena_get(arena, handle);
+}
+
+/* Initialize the PathArena */
+bool path_arena_init(PathArena *arena) {
+    if (arena == NULL) return false;
+
+    arena->base = mmap(NULL, PATH_ARENA_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (arena->base == MAP_FAILED) {
+        fprintf(stderr, "[ERROR] path_arena_init: Failed to map the path arena: %s\n", strerror(errno));
+        arena->base = NULL;
+        return false;
+    }
+    arena->capacity = (uint32_t)(PATH_ARENA_SIZE / PATH_BLOCK_UNIT);
+
+    atomic_init(&arena->bump, 1); // Unit 0 is reserved for `INVALID_PATH_HANDLE`
+    for (int class = 0; class < PATH_SIZE_CLASSES; class++) {
+        atomic_init(&arena->free_lists[class], MAKE_HEAD(0, INVALID_PATH_HANDLE));
+    }
+
+    return true;
+}
+
+/* Clear the PathArena */
+void path_arena_clear(PathArena *arena) {
+    if (arena == NULL || arena->base == NULL) return;
+
+    munmap(arena->base, PATH_ARENA_SIZE);
+    arena->base = NULL;
+    arena->capacity = 0;
+}
+
+/* Allocate a block from the PathArena */
+PathHandle path_arena_alloc(PathArena *arena, size_t size) {
+    if (arena == NULL || arena->base == NULL || size == 0) return INVALID_PATH_HANDLE; // Invalid arguments
+
+    int class = get_size_class(size);
+    if (class < 0) return INVALID_PATH_HANDLE; // Too large for any size class
+
+    /* Reuse a released block first */
+    _Atomic uint64_t *free_list = &arena->free_lists[class];
+    uint64_t head = atomic_load(free_list);
+    while (HANDLE_OF(head) != INVALID_PATH_HANDLE) {
+        uint32_t next = atomic_load_explicit(get_next_link(arena, HANDLE_OF(head)), memory_order_relaxed); // The block may be reused meanwhile, then the tag makes the CAS fail
+        if (atomic_compare_exchange_weak(free_list, &head, MAKE_HEAD(TAG_OF(head) + 1, next))) return HANDLE_OF(head);
+    }
+
+    /* Carve a new block */
+    uint32_t units = 1U << class;
+    uint32_t offset = atomic_fetch_add(&arena->bump, units);
+    if (offset > arena->capacity - units) {
+        fprintf(stderr, "[ERROR] path_arena_alloc: The path arena is exhausted\n");
+        return INVALID_PATH_HANDLE;
+    }
+
+    return ((PathHandle)class << PATH_HANDLE_CLASS_SHIFT) | offset;
+}
+
+/* Release a block allocated by `path_arena_alloc()` */
+void path_arena_free(PathArena *arena, PathHandle handle) {
+    if (arena == NULL || arena->base == NULL || handle == INVALID_PATH_HANDLE) return; // Invalid arguments
+
+    _Atomic uint64_t *free_list = &arena->free_lists[handle >> PATH_HANDLE_CLASS_SHIFT];
+    uint64_t head = atomic_load(free_list);
+    do {
+        atomic_store_explicit(get_next_link(arena, handle), HANDLE_OF(head), memory_order_relaxed); // Link the block to the current head
+    } while (!atomic_compare_exchange_weak(free_list, &head, MAKE_HEAD(TAG_OF(head) + 1, handle)));
+}
@@ -0,0 +1,93 @@
+/* arena.h
+ *
+ * Copyright 2025 EricLin
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+*/
+
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdatomic.h>
+
+#define PATH_ARENA_SIZE ((size_t)1 << 30) // Reserved address space of the arena, pages are only backed when they are used
+#define PATH_BLOCK_UNIT 64 // The smallest block size, also the alignment of every block
+#define PATH_SIZE_CLASSES 7 // Block sizes from 64 bytes to 4096 bytes, each class doubles the previous one
+
+#define PATH_HANDLE_CLASS_SHIFT 28
+#define PATH_HANDLE_UNIT_MASK ((1U << PATH_HANDLE_CLASS_SHIFT) - 1)
+#define INVALID_PATH_HANDLE 0
+
+_Static_assert(PATH_ARENA_SIZE / PATH_BLOCK_UNIT <= PATH_HANDLE_UNIT_MASK, "PATH_ARENA_SIZE is too large for PathHandle");
+_Static_assert((PATH_BLOCK_UNIT << (PATH_SIZE_CLASSES - 1)) >= 4096, "The largest size class must hold a full path");
+
+/* Path handle */
+/*
+  * The size class is stored in the upper 4 bits, the block offset (in `PATH_BLOCK_UNIT`) in the rest
+  * 0 is never a valid block, so it's used as `INVALID_PATH_HANDLE`
+*/
+typedef uint32_t PathHandle;
+
+/* Path arena */
+/*
+  * A string allocator living in a separate shared mapping, so a task only carries a small handle instead of the whole path
+  * `base` is mapped before forking, so it's the same address in every process
+  * `bump` is the next never used unit, blocks are carved from it when the free list of the size class is empty
+  * `free_lists` are lock-free stacks of released blocks, the upper 32 bits of the head are a tag against the ABA problem
+*/
+typedef struct {
+	char *base;
+	uint32_t capacity; // In `PATH_BLOCK_UNIT`
+
+	_Atomic uint32_t bump;
+	_Atomic uint64_t free_lists[PATH_SIZE_CLASSES];
+} PathArena;
+
+/* Initialize the PathArena */
+/*
+  * @return
+  * `true` if the initialization is successful, `false` otherwise
+  *
+  * @warning
+  * This function MUST be called before forking, the mapping is shared with the child processes
+*/
+bool path_arena_init(PathArena *arena);
+
+/* Clear the PathArena */
+void path_arena_clear(PathArena *arena);
+
+/* Allocate a block from the PathArena */
+/*
+  * @param size
+  * The number of bytes needed, including the null terminator
+  *
+  * @return
+  * The handle of the block, `INVALID_PATH_HANDLE` if the size is too large or the arena is exhausted
+*/
+PathHandle path_arena_alloc(PathArena *arena, size_t size);
+
+/* Release a block allocated by `path_arena_alloc()` */
+void path_arena_free(PathArena *arena, PathHandle handle);
+
+/* Get the address of the block */
+static inline char *path_arena_get(const PathArena *arena, PathHandle handle) {
+	return arena->base + (size_t)(handle & PATH_HANDLE_UNIT_MASK) * PATH_BLOCK_UNIT;
+}
+
+#endif // ARENA_H
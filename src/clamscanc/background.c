@@ -0,0 +1,114 @@
+/* background.c
+ *
+ * Copyright 2025 EricLin
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+*/
+
+#define _GNU_SOURCE // For `SCHED_IDLE`
+#include <errno.h>
+#include <sched.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+
+#include "background.h"
+
+/* Not exported by glibc, see `ioprio_set(2)` */
+#define IOPRIO_WHO_PROCESS 1
+#define IOPRIO_CLASS_IDLE 3
+#define IOPRIO_CLASS_SHIFT 13
+
+#define BACKGROUND_NICE_VALUE 19
+
+static uint64_t now_ns(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000ULL + (uint64_t)now.tv_nsec;
+}
+
+/* Lower the CPU and the I/O priority of the calling process */
+unsigned int apply_background_priority(void) {
+    unsigned int applied = 0;
+
+    if (setpriority(PRIO_PROCESS, 0, BACKGROUND_NICE_VALUE) == 0) applied |= BACKGROUND_NICE;
+
+#ifdef SCHED_IDLE
+    struct sched_param param = { .sched_priority = 0 };
+    if (sched_setscheduler(0, SCHED_IDLE, &param) == 0) applied |= BACKGROUND_SCHED_IDLE;
+#endif
+
+#ifdef SYS_ioprio_set
+    if (syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0, IOPRIO_CLASS_IDLE << IOPRIO_CLASS_SHIFT) == 0) applied |= BACKGROUND_IOPRIO_IDLE;
+#endif
+
+    return applied;
+}
+
+/* Initialize the ScanThrottle */
+void scan_throttle_init(ScanThrottle *throttle, uint64_t bytes_per_second, uint64_t files_per_second) {
+    if (throttle == NULL) return;
+
+    atomic_store(&throttle->bytes_ready_ns, 0);
+    atomic_store(&throttle->files_ready_ns, 0);
+    throttle->ns_per_byte = bytes_per_second > 0 ? 1e9 / (double)bytes_per_second : 0;
+    throttle->ns_per_file = files_per_second > 0 ? 1e9 / (double)files_per_second : 0;
+    throttle->is_enabled = bytes_per_second > 0 || files_per_second > 0;
+}
+
+/* Move a ready time forward by `cost` */
+/*
+  * @return
+  * The time the caller may start at
+*/
+static uint64_t reserve_turn(_Atomic uint64_t *ready_ns, uint64_t cost, uint64_t now) {
+    uint64_t earliest = now > THROTTLE_BURST_NS ? now - THROTTLE_BURST_NS : 0; // An idle period only builds up a short burst
+    uint64_t ready = atomic_load(ready_ns);
+    uint64_t start;
+    do {
+        start = ready > earliest ? ready : earliest;
+    } while (!atomic_compare_exchange_weak(ready_ns, &ready, start + cost));
+
+    return start;
+}
+
+/* Reserve a turn for a file of `size` bytes */
+uint64_t scan_throttle_reserve(ScanThrottle *throttle, uint64_t size) {
+    if (throttle == NULL || !throttle->is_enabled) return 0;
+
+    uint64_t now = now_ns();
+    uint64_t start = 0;
+    if (throttle->ns_per_byte > 0) start = reserve_turn(&throttle->bytes_ready_ns, (uint64_t)(size * throttle->ns_per_byte), now);
+    if (throttle->ns_per_file > 0) {
+        uint64_t file_start = reserve_turn(&throttle->files_ready_ns, (uint64_t)throttle->ns_per_file, now);
+        if (file_start > start) start = file_start;
+    }
+
+    return start;
+}
+
+/* Reserve a turn for a file of `size` bytes and sleep until it comes */
+void scan_throttle_wait(ScanThrottle *throttle, uint64_t size) {
+    uint64_t start = scan_throttle_reserve(throttle, size);
+    if (start == 0) return;
+
+    struct timespec deadline = {
+        .tv_sec = (time_t)(start / 1000000000ULL),
+        .tv_nsec = (long)(start % 1000000000ULL),
+    };
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL) == EINTR);
+}
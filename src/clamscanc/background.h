@@ -0,0 +1,92 @@
+/* background.h
+ *
+ * Copyright 2025 EricLin
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+*/
+
+/* Low impact background scans */
+/*
+  * The background priority puts the process in the idle CPU and I/O classes, the children inherit it when they are forked
+  * The ScanThrottle limits the bytes and the files scanned per second by all the processes sharing it
+  * Both are also used by the GUI for the scanners it spawns and the files it hands to the ClamAV daemon
+*/
+
+#ifndef BACKGROUND_H
+#define BACKGROUND_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdatomic.h>
+
+#define BACKGROUND_OPTION "--background"
+#define MAX_RATE_OPTION "--max-rate=" // Bytes per second, with an optional K, M or G suffix
+#define MAX_FILES_RATE_OPTION "--max-files-rate=" // Files per second
+#define THROTTLE_BURST_NS 100000000ULL // How far the throttle lets the processes run ahead of the rate
+
+/* The priorities lowered by `apply_background_priority()` */
+typedef enum {
+    BACKGROUND_NICE = 1 << 0, // The lowest nice value
+    BACKGROUND_SCHED_IDLE = 1 << 1, // Only runs on the CPUs nothing else wants
+    BACKGROUND_IOPRIO_IDLE = 1 << 2, // Only reads the disks when nothing else does
+    BACKGROUND_ALL = BACKGROUND_NICE | BACKGROUND_SCHED_IDLE | BACKGROUND_IOPRIO_IDLE,
+} BackgroundPriority;
+
+/* Rate limit shared by the processes */
+/*
+  * `bytes_ready_ns` and `files_ready_ns` are the `CLOCK_MONOTONIC` times the next file may start at for each limit
+  * Each file moves them forward by its cost, so the processes take turns without a lock
+  * A limit is off if its cost is 0
+*/
+typedef struct {
+    _Atomic uint64_t bytes_ready_ns;
+    _Atomic uint64_t files_ready_ns;
+    double ns_per_byte;
+    double ns_per_file;
+    bool is_enabled;
+} ScanThrottle;
+
+/* Lower the CPU and the I/O priority of the calling process */
+/*
+  * @return
+  * The `BackgroundPriority` flags which were applied
+  *
+  * @note
+  * It's async-signal-safe, so a forked child of a multi-threaded process can call it before `execv()`
+*/
+unsigned int apply_background_priority(void);
+
+/* Initialize the ScanThrottle */
+/*
+  * @param bytes_per_second
+  * 0 for no limit
+  *
+  * @param files_per_second
+  * 0 for no limit
+*/
+void scan_throttle_init(ScanThrottle *throttle, uint64_t bytes_per_second, uint64_t files_per_second);
+
+/* Reserve a turn for a file of `size` bytes */
+/*
+  * @return
+  * The `CLOCK_MONOTONIC` time in nanoseconds the file may start at, 0 if the throttle is off
+*/
+uint64_t scan_throttle_reserve(ScanThrottle *throttle, uint64_t size);
+
+/* Reserve a turn for a file of `size` bytes and sleep until it comes */
+void scan_throttle_wait(ScanThrottle *throttle, uint64_t size);
+
+#endif // BACKGROUND_H
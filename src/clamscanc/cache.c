@@ -0,0 +1,301 @@
+/* cache.c
+ *
+ * Copyright 2025 EricLin
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+*/
+
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+
+#include "cache.h"
+#include "database.h"
+
+#define VERDICT_CACHE_MAGIC "WMVCACHE"
+#define VERDICT_CACHE_FORMAT 1
+#define VERDICT_ENTRY_BUSY 1 // Never a valid tag, see `make_tag()`
+#define VERDICT_CACHE_NAME "clamscanc/verdicts"
+
+#if defined(__APPLE__) || defined(__MACH__)
+#define STAT_MTIME(status) ((status)->st_mtimespec)
+#define STAT_CTIME(status) ((status)->st_ctimespec)
+#else
+#define STAT_MTIME(status) ((status)->st_mtim)
+#define STAT_CTIME(status) ((status)->st_ctim)
+#endif
+
+_Static_assert(sizeof(VerdictCacheHeader) == 64, "VerdictCacheHeader must fill a cache line");
+
+/* Convert a timestamp to nanoseconds */
+static inline int64_t timespec_to_ns(struct timespec time) {
+    return (int64_t)time.tv_sec * 1000000000LL + time.tv_nsec;
+}
+
+/* Hash the identity of a file, the result is never 0 or `VERDICT_ENTRY_BUSY` */
+static inline uint64_t make_tag(uint64_t dev, uint64_t ino) {
+    uint64_t hash = dev * 0x9E3779B97F4A7C15ULL ^ ino; // splitmix64 finalizer over (dev, ino)
+    hash ^= hash >> 30;
+    hash *= 0xBF58476D1CE4E5B9ULL;
+    hash ^= hash >> 27;
+    hash *= 0x94D049BB133111EBULL;
+    hash ^= hash >> 31;
+    return hash | 2;
+}
+
+/* Hash the scan options and the profile of the engine, the functionality level is included since a newer libclamav may detect more */
+/*
+  * A file clean under the small limits of a quick scan, or without the PUA signatures, may not be clean under the others
+  * The same goes for the excluded databases (see `database_exclusions_hash()`)
+*/
+static uint64_t hash_options(const struct cl_engine *engine, const struct cl_scan_options *options) {
+    uint64_t hash = 0xCBF29CE484222325ULL; // FNV-1a
+    const unsigned char *bytes = (const unsigned char *)options;
+    for (size_t i = 0; i < sizeof(*options); i++) {
+        hash ^= bytes[i];
+        hash *= 0x100000001B3ULL;
+    }
+
+    const enum cl_engine_field fields[] = { CL_ENGINE_DB_OPTIONS, CL_ENGINE_MAX_FILESIZE, CL_ENGINE_MAX_SCANSIZE, CL_ENGINE_MAX_RECURSION, CL_ENGINE_MAX_FILES };
+    for (size_t i = 0; i < sizeof(fields) / sizeof(fields[0]); i++) {
+        hash ^= (uint64_t)cl_engine_get_num(engine, fields[i], NULL);
+        hash *= 0x100000001B3ULL;
+    }
+
+    unsigned int flevel = cl_retflevel();
+    hash ^= flevel;
+    hash *= 0x100000001B3ULL;
+
+    uint64_t exclusions = database_exclusions_hash();
+    for (size_t i = 0; i < sizeof(exclusions); i++) {
+        hash ^= (exclusions >> (i * 8)) & 0xFF;
+        hash *= 0x100000001B3ULL;
+    }
+    return hash;
+}
+
+/* Check whether the cache was filled by the same engine and options */
+static bool is_header_matched(const VerdictCacheHeader *header, const struct cl_engine *engine, const struct cl_scan_options *options) {
+    return memcmp(header->magic, VERDICT_CACHE_MAGIC, sizeof(header->magic)) == 0 &&
+           header->format == VERDICT_CACHE_FORMAT &&
+           header->capacity == VERDICT_CACHE_CAPACITY &&
+           header->db_version == (uint32_t)cl_engine_get_num(engine, CL_ENGINE_DB_VERSION, NULL) &&
+           header->db_time == (uint64_t)cl_engine_get_num(engine, CL_ENGINE_DB_TIME, NULL) &&
+           header->options_hash == hash_options(engine, options);
+}
+
+/* Drop all the entries and write a new header */
+/*
+  * @warning
+  * The caller MUST hold the exclusive lock of the cache file
+*/
+static bool reset_cache(VerdictCache *cache, const struct cl_engine *engine, const struct cl_scan_options *options) {
+    /* Truncating gives back zeroed (empty) pages without touching every entry */
+    if (ftruncate(cache->fd, 0) == -1 || ftruncate(cache->fd, (off_t)cache->mapping_size) == -1) {
+        fprintf(stderr, "[ERROR] verdict_cache: Failed to reset the cache: %s\n", strerror(errno));
+        return false;
+    }
+
+    VerdictCacheHeader *header = cache->header;
+    memcpy(header->magic, VERDICT_CACHE_MAGIC, sizeof(header->magic));
+    header->format = VERDICT_CACHE_FORMAT;
+    header->db_version = (uint32_t)cl_engine_get_num(engine, CL_ENGINE_DB_VERSION, NULL);
+    header->db_time = (uint64_t)cl_engine_get_num(engine, CL_ENGINE_DB_TIME, NULL);
+    header->options_hash = hash_options(engine, options);
+    header->capacity = VERDICT_CACHE_CAPACITY;
+    return true;
+}
+
+/* Create the parent directories of the path */
+void make_parent_directories(const char *path) {
+    char directory[4096];
+    if (strlen(path) >= sizeof(directory)) return;
+    memcpy(directory, path, strlen(path) + 1);
+
+    for (char *slash = strchr(directory + 1, '/'); slash != NULL; slash = strchr(slash + 1, '/')) {
+        *slash = '\0';
+        mkdir(directory, 0700); // Fails harmlessly if it exists
+        *slash = '/';
+    }
+}
+
+/* Get the default path of a file kept between runs */
+bool state_file_default_path(const char *env_name, const char *name, char *path, size_t size) {
+    if (env_name == NULL || name == NULL || path == NULL || size == 0) return false;
+
+    const char *env_path = getenv(env_name);
+    const char *cache_home = getenv("XDG_CACHE_HOME");
+    const char *home = getenv("HOME");
+    int length;
+
+    if (env_path != NULL && env_path[0] != '\0') length = snprintf(path, size, "%s", env_path);
+    else if (geteuid() == 0) length = snprintf(path, size, "/var/cache/%s", name);
+    else if (cache_home != NULL && cache_home[0] != '\0') length = snprintf(path, size, "%s/%s", cache_home, name);
+    else if (home != NULL && home[0] != '\0') length = snprintf(path, size, "%s/.cache/%s", home, name);
+    else return false;
+
+    return length > 0 && (size_t)length < size;
+}
+
+/* Get the default path of the cache file */
+bool verdict_cache_default_path(char *path, size_t size) {
+    return state_file_default_path(VERDICT_CACHE_ENV, VERDICT_CACHE_NAME, path, size);
+}
+
+/* Open the cache file */
+bool verdict_cache_open(VerdictCache *cache, const char *path, const struct cl_engine *engine, const struct cl_scan_options *options) {
+    if (cache == NULL || path == NULL || engine == NULL || options == NULL) return false; // Invalid arguments
+
+    atomic_init(&cache->is_enabled, false);
+    cache->header = NULL;
+    cache->entries = NULL;
+    cache->mapping_size = sizeof(VerdictCacheHeader) + VERDICT_CACHE_CAPACITY * sizeof(VerdictCacheEntry);
+
+    make_parent_directories(path);
+    cache->fd = open(path, O_RDWR | O_CREAT | O_NOFOLLOW | O_CLOEXEC, 0600);
+    if (cache->fd == -1) {
+        fprintf(stderr, "[ERROR] verdict_cache_open: Failed to open %s: %s\n", path, strerror(errno));
+        return false;
+    }
+
+    /* Only the first user may reset the cache, the others share it as long as it matches */
+    bool is_exclusive = flock(cache->fd, LOCK_EX | LOCK_NB) == 0;
+    if (!is_exclusive) flock(cache->fd, LOCK_SH);
+
+    struct stat status;
+    bool is_sized = fstat(cache->fd, &status) == 0 && (size_t)status.st_size == cache->mapping_size;
+    if (!is_sized && (!is_exclusive || ftruncate(cache->fd, (off_t)cache->mapping_size) == -1)) {
+        fprintf(stderr, "[ERROR] verdict_cache_open: The cache %s is not usable now, scanning without it\n", path);
+        verdict_cache_close(cache);
+        return false;
+    }
+
+    void *mapping = mmap(NULL, cache->mapping_size, PROT_READ | PROT_WRITE, MAP_SHARED, cache->fd, 0);
+    if (mapping == MAP_FAILED) {
+        fprintf(stderr, "[ERROR] verdict_cache_open: Failed to map %s: %s\n", path, strerror(errno));
+        verdict_cache_close(cache);
+        return false;
+    }
+    cache->header = (VerdictCacheHeader *)mapping;
+    cache->entries = (VerdictCacheEntry *)(cache->header + 1);
+
+    if (!is_header_matched(cache->header, engine, options)) {
+        if (!is_exclusive) {
+            fprintf(stderr, "[ERROR] verdict_cache_open: The cache %s is in use with other signatures, scanning without it\n", path);
+            verdict_cache_close(cache);
+            return false;
+        }
+        if (!reset_cache(cache, engine, options)) {
+            verdict_cache_close(cache);
+            return false;
+        }
+    }
+
+    if (is_exclusive) flock(cache->fd, LOCK_SH); // Let the other runs share the cache
+    atomic_store(&cache->is_enabled, true);
+    return true;
+}
+
+/* Close the cache file */
+void verdict_cache_close(VerdictCache *cache) {
+    if (cache == NULL) return;
+
+    atomic_store(&cache->is_enabled, false);
+    if (cache->header != NULL) munmap(cache->header, cache->mapping_size);
+    cache->header = NULL;
+    cache->entries = NULL;
+
+    if (cache->fd != -1) close(cache->fd); // Also releases the lock
+    cache->fd = -1;
+}
+
+/* Check the cache against a new engine, drop the entries if the database has changed */
+void verdict_cache_validate(VerdictCache *cache, const struct cl_engine *engine, const struct cl_scan_options *options) {
+    if (cache == NULL || !atomic_load(&cache->is_enabled)) return;
+    if (is_header_matched(cache->header, engine, options)) return; // Still valid
+
+    atomic_store(&cache->is_enabled, false); // Never return the verdicts of the old database
+    if (flock(cache->fd, LOCK_EX | LOCK_NB) != 0) {
+        fprintf(stderr, "[ERROR] verdict_cache_validate: The cache is in use with the old signatures, scanning without it\n");
+        return;
+    }
+
+    bool is_reset = reset_cache(cache, engine, options);
+    flock(cache->fd, LOCK_SH);
+    atomic_store(&cache->is_enabled, is_reset);
+}
+
+/* Check whether the file is known to be clean */
+bool verdict_cache_lookup(VerdictCache *cache, const struct stat *status) {
+    if (cache == NULL || status == NULL || !atomic_load_explicit(&cache->is_enabled, memory_order_relaxed)) return false;
+
+    uint64_t tag = make_tag((uint64_t)status->st_dev, (uint64_t)status->st_ino);
+    for (uint64_t i = 0; i < VERDICT_CACHE_MAX_PROBES; i++) {
+        VerdictCacheEntry *entry = &cache->entries[(tag + i) & (VERDICT_CACHE_CAPACITY - 1)];
+
+        uint64_t entry_tag = atomic_load_explicit(&entry->tag, memory_order_acquire);
+        if (entry_tag == 0) return false; // End of the probe sequence
+        if (entry_tag != tag) continue;
+
+        VerdictCacheEntry copy = {
+            .dev = entry->dev,
+            .ino = entry->ino,
+            .size = entry->size,
+            .mtime_ns = entry->mtime_ns,
+            .ctime_ns = entry->ctime_ns,
+        };
+        atomic_thread_fence(memory_order_acquire);
+        if (atomic_load_explicit(&entry->tag, memory_order_relaxed) != entry_tag) return false; // Rewritten meanwhile, treat as unknown
+
+        if (copy.dev != (uint64_t)status->st_dev || copy.ino != (uint64_t)status->st_ino) continue; // Hash collision
+
+        /* The change time can't be set by the users, so a file modified with its mtime restored is still rescanned */
+        return copy.size == (uint64_t)status->st_size &&
+               copy.mtime_ns == timespec_to_ns(STAT_MTIME(status)) &&
+               copy.ctime_ns == timespec_to_ns(STAT_CTIME(status));
+    }
+    return false;
+}
+
+/* Remember the file as clean */
+void verdict_cache_insert(VerdictCache *cache, const struct stat *status) {
+    if (cache == NULL || status == NULL || !atomic_load_explicit(&cache->is_enabled, memory_order_relaxed)) return;
+
+    uint64_t tag = make_tag((uint64_t)status->st_dev, (uint64_t)status->st_ino);
+    for (uint64_t i = 0; i < VERDICT_CACHE_MAX_PROBES; i++) {
+        VerdictCacheEntry *entry = &cache->entries[(tag + i) & (VERDICT_CACHE_CAPACITY - 1)];
+
+        /* Claim an empty entry, or the outdated entry of the same file */
+        uint64_t entry_tag = atomic_load_explicit(&entry->tag, memory_order_acquire);
+        bool is_same_file = entry_tag == tag && entry->dev == (uint64_t)status->st_dev && entry->ino == (uint64_t)status->st_ino;
+        if (entry_tag != 0 && !is_same_file) continue;
+        if (!atomic_compare_exchange_strong(&entry->tag, &entry_tag, VERDICT_ENTRY_BUSY)) continue; // Another process won the entry
+
+        entry->dev = (uint64_t)status->st_dev;
+        entry->ino = (uint64_t)status->st_ino;
+        entry->size = (uint64_t)status->st_size;
+        entry->mtime_ns = timespec_to_ns(STAT_MTIME(status));
+        entry->ctime_ns = timespec_to_ns(STAT_CTIME(status));
+        atomic_store_explicit(&entry->tag, tag, memory_order_release); // Publish the entry
+        return;
+    }
+    // The probe sequence is full, the file will simply be scanned next time
+}
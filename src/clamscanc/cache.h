@@ -0,0 +1,134 @@
+/* cache.h
+ *
+ * Copyright 2025 EricLin
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+*/
+
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <sys/stat.h>
+#include <clamav.h>
+
+#define VERDICT_CACHE_ENV "CLAMSCANC_CACHE" // Override the cache file path
+#define VERDICT_CACHE_CAPACITY ((uint64_t)1 << 22) // Number of entries, the file is sparse so only the used pages take disk space
+#define VERDICT_CACHE_MAX_PROBES 32 // Give up after probing this many entries
+
+_Static_assert((VERDICT_CACHE_CAPACITY & (VERDICT_CACHE_CAPACITY - 1)) == 0, "VERDICT_CACHE_CAPACITY must be power of 2");
+
+/* Verdict cache header */
+/*
+  * `db_version`, `db_time` and `options_hash` describe the engine which produced the verdicts, the entries are dropped when any of them changes
+*/
+typedef struct {
+	char magic[8];
+	uint32_t format;
+	uint32_t db_version;
+	uint64_t db_time;
+	uint64_t options_hash;
+	uint64_t capacity;
+	uint8_t reserved[24]; // Keep the entries aligned to the cache line
+} VerdictCacheHeader;
+
+/* Verdict cache entry */
+/*
+  * Only clean verdicts are stored, an infected file is always scanned again so its report is complete
+  * `tag` is 0 for an empty entry, `VERDICT_ENTRY_BUSY` while it's being written, otherwise the hash of (`dev`, `ino`)
+*/
+typedef struct {
+	_Atomic uint64_t tag;
+	uint64_t dev;
+	uint64_t ino;
+	uint64_t size;
+	int64_t mtime_ns;
+	int64_t ctime_ns;
+} VerdictCacheEntry;
+
+/* Verdict cache */
+/*
+  * A hash table in a memory-mapped file, shared by the worker processes and by later runs
+  * The mapping is created before forking, so the pointers are valid in every process
+*/
+typedef struct {
+	int fd;
+	VerdictCacheHeader *header;
+	VerdictCacheEntry *entries;
+	size_t mapping_size;
+
+	_Atomic bool is_enabled;
+} VerdictCache;
+
+/* Get the default path of a file kept between runs */
+/*
+  * @param env_name
+  * The environment variable overriding the path
+  *
+  * @param name
+  * The path relative to the cache directory, e.g. "clamscanc/verdicts"
+  *
+  * @note
+  * `$<env_name>` if set, `/var/cache/<name>` for root, otherwise `$XDG_CACHE_HOME/<name>` (or `~/.cache`)
+*/
+bool state_file_default_path(const char *env_name, const char *name, char *path, size_t size);
+
+/* Create the parent directories of the path */
+void make_parent_directories(const char *path);
+
+/* Get the default path of the cache file */
+/*
+  * @note
+  * `$CLAMSCANC_CACHE` if set, `/var/cache/clamscanc/verdicts` for root, otherwise `$XDG_CACHE_HOME/clamscanc/verdicts` (or `~/.cache`)
+*/
+bool verdict_cache_default_path(char *path, size_t size);
+
+/* Open the cache file */
+/*
+  * @param path
+  * The cache file, its parent directory is created if needed
+  *
+  * @param engine
+  * The current engine, the cache is reset if it was filled by another database version
+  *
+  * @param options
+  * The current scan options, the cache is reset if they were different
+  *
+  * @return
+  * `true` if the cache is usable, `false` otherwise (scan without the cache)
+*/
+bool verdict_cache_open(VerdictCache *cache, const char *path, const struct cl_engine *engine, const struct cl_scan_options *options);
+
+/* Close the cache file */
+void verdict_cache_close(VerdictCache *cache);
+
+/* Check the cache against a new engine, drop the entries if the database has changed */
+/*
+  * @note
+  * If another process is using the cache with the old database, the cache is disabled instead
+*/
+void verdict_cache_validate(VerdictCache *cache, const struct cl_engine *engine, const struct cl_scan_options *options);
+
+/* Check whether the file is known to be clean */
+bool verdict_cache_lookup(VerdictCache *cache, const struct stat *status);
+
+/* Remember the file as clean */
+void verdict_cache_insert(VerdictCache *cache, const struct stat *status);
+
+#endif // CACHE_H
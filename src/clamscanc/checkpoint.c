@@ -0,0 +1,254 @@
+/* checkpoint.c
+ *
+ * Copyright 2025 EricLin
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+*/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/random.h>
+#include <sys/stat.h>
+
+#include "cache.h"
+#include "checkpoint.h"
+
+#define HASH_SEED 0xCBF29CE484222325ULL // FNV-1a
+
+static uint64_t local_records[CHECKPOINT_BUFFER_RECORDS]; // The records of the calling process, not written yet
+static size_t local_count = 0;
+
+/* FNV-1a over the pieces of a path */
+static inline uint64_t hash_bytes(uint64_t hash, const char *bytes, size_t length) {
+    for (size_t i = 0; i < length; i++) {
+        hash ^= (unsigned char)bytes[i];
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+/* Hash a path, the result is never 0 */
+static inline uint64_t finish_hash(uint64_t hash) {
+    return hash != 0 ? hash : 1;
+}
+
+/* Pick the seed of a new checkpoint */
+static uint64_t make_seed(void) {
+    uint64_t seed;
+    if (getrandom(&seed, sizeof(seed), 0) == (ssize_t)sizeof(seed)) return seed;
+
+    struct timespec now; // Only without `getrandom()`, still unknown ahead of the scan
+    clock_gettime(CLOCK_REALTIME, &now);
+    return ((uint64_t)now.tv_sec << 32) ^ (uint64_t)now.tv_nsec ^ ((uint64_t)getpid() << 16);
+}
+
+/* Size of the header and the padded root */
+static inline size_t header_size(size_t root_length) {
+    return (sizeof(CheckpointHeader) + root_length + 7) & ~(size_t)7;
+}
+
+/* Write the whole buffer */
+static bool write_fully(int fd, const void *buffer, size_t size) {
+    const char *bytes = buffer;
+    while (size > 0) {
+        ssize_t written = write(fd, bytes, size);
+        if (written == -1 && errno == EINTR) continue;
+        if (written <= 0) return false;
+        bytes += written;
+        size -= (size_t)written;
+    }
+    return true;
+}
+
+/* Load the records into the CompletedSet */
+static bool completed_set_load(CompletedSet *set, const uint64_t *records, size_t count) {
+    size_t capacity = 16;
+    while (capacity < count * 2) capacity <<= 1; // At most half full
+
+    set->slots = calloc(capacity, sizeof(uint64_t));
+    if (set->slots == NULL) return false;
+    set->mask = capacity - 1;
+    set->count = 0;
+
+    for (size_t i = 0; i < count; i++) {
+        uint64_t hash = records[i];
+        if (hash == 0) continue; // Never written, a hole of a torn write
+
+        size_t index = (size_t)hash & set->mask;
+        while (set->slots[index] != 0 && set->slots[index] != hash) index = (index + 1) & set->mask;
+        if (set->slots[index] == 0) {
+            set->slots[index] = hash;
+            set->count++;
+        }
+    }
+    return true;
+}
+
+/* Initialize the Checkpoint, disabled */
+void checkpoint_init(Checkpoint *checkpoint) {
+    if (checkpoint == NULL) return;
+
+    checkpoint->fd = -1;
+    checkpoint->path = NULL;
+    checkpoint->seed = 0;
+    checkpoint->completed = (CompletedSet){ .slots = NULL, .mask = 0, .count = 0 };
+}
+
+/* Read the records of a checkpoint of `root`, cut off a torn record */
+/*
+  * @return
+  * `true` if the file is a checkpoint of `root`
+*/
+static bool checkpoint_load(Checkpoint *checkpoint, const char *root) {
+    struct stat status;
+    CheckpointHeader header;
+    size_t root_length = strlen(root);
+    if (fstat(checkpoint->fd, &status) != 0 || pread(checkpoint->fd, &header, sizeof(header), 0) != (ssize_t)sizeof(header)) {
+        fprintf(stderr, "[ERROR] checkpoint_open: Failed to read %s\n", checkpoint->path);
+        return false;
+    }
+    if (memcmp(header.magic, CHECKPOINT_MAGIC, CHECKPOINT_MAGIC_SIZE) != 0 || header.version != CHECKPOINT_VERSION) {
+        fprintf(stderr, "[ERROR] checkpoint_open: %s is not a checkpoint\n", checkpoint->path);
+        return false;
+    }
+
+    if (header.root_length != root_length) {
+        fprintf(stderr, "[ERROR] checkpoint_open: %s belongs to another scan\n", checkpoint->path);
+        return false;
+    }
+    char recorded_root[root_length + 1];
+    if (pread(checkpoint->fd, recorded_root, root_length, sizeof(header)) != (ssize_t)root_length || memcmp(recorded_root, root, root_length) != 0) {
+        fprintf(stderr, "[ERROR] checkpoint_open: %s belongs to another scan\n", checkpoint->path);
+        return false;
+    }
+
+    checkpoint->seed = header.seed;
+
+    size_t offset = header_size(root_length);
+    size_t count = status.st_size > (off_t)offset ? ((size_t)status.st_size - offset) / sizeof(uint64_t) : 0;
+    if (ftruncate(checkpoint->fd, (off_t)(offset + count * sizeof(uint64_t))) != 0) { // The new records must stay aligned
+        fprintf(stderr, "[ERROR] checkpoint_open: Failed to truncate %s: %s\n", checkpoint->path, strerror(errno));
+        return false;
+    }
+    if (count == 0) return true;
+
+    uint64_t *records = malloc(count * sizeof(uint64_t));
+    bool is_loaded = records != NULL && pread(checkpoint->fd, records, count * sizeof(uint64_t), (off_t)offset) == (ssize_t)(count * sizeof(uint64_t)) &&
+                     completed_set_load(&checkpoint->completed, records, count);
+    free(records);
+    if (!is_loaded) fprintf(stderr, "[ERROR] checkpoint_open: Failed to load the records of %s\n", checkpoint->path);
+    return is_loaded;
+}
+
+/* Open the checkpoint file of a scan */
+bool checkpoint_open(Checkpoint *checkpoint, const char *path, const char *root, bool is_resume) {
+    if (checkpoint == NULL || path == NULL || root == NULL) return false;
+
+    checkpoint_init(checkpoint);
+    checkpoint->path = strdup(path);
+    if (checkpoint->path == NULL) return false;
+
+    make_parent_directories(path);
+    int flags = O_RDWR | O_APPEND | O_CLOEXEC | (is_resume ? 0 : O_CREAT | O_TRUNC);
+    checkpoint->fd = open(path, flags, 0600);
+    if (checkpoint->fd == -1) {
+        fprintf(stderr, "[ERROR] checkpoint_open: Failed to open %s: %s\n", path, strerror(errno));
+        checkpoint_close(checkpoint, false);
+        return false;
+    }
+
+    if (is_resume) {
+        if (!checkpoint_load(checkpoint, root)) {
+            checkpoint_close(checkpoint, false);
+            return false;
+        }
+        return true;
+    }
+
+    /* A new checkpoint starts with the header */
+    size_t root_length = strlen(root);
+    size_t size = header_size(root_length);
+    char *header = calloc(1, size);
+    bool is_written = header != NULL;
+    if (is_written) {
+        CheckpointHeader *fields = (CheckpointHeader*)header;
+        memcpy(fields->magic, CHECKPOINT_MAGIC, CHECKPOINT_MAGIC_SIZE);
+        fields->version = CHECKPOINT_VERSION;
+        fields->root_length = (uint32_t)root_length;
+        fields->seed = checkpoint->seed = make_seed();
+        memcpy(header + sizeof(CheckpointHeader), root, root_length);
+        is_written = write_fully(checkpoint->fd, header, size);
+    }
+    free(header);
+
+    if (!is_written) {
+        fprintf(stderr, "[ERROR] checkpoint_open: Failed to write %s\n", path);
+        checkpoint_close(checkpoint, true);
+        return false;
+    }
+    return true;
+}
+
+/* Close the Checkpoint */
+void checkpoint_close(Checkpoint *checkpoint, bool is_finished) {
+    if (checkpoint == NULL) return;
+
+    if (checkpoint->fd != -1) {
+        checkpoint_flush(checkpoint);
+        close(checkpoint->fd);
+        if (is_finished && checkpoint->path != NULL) unlink(checkpoint->path);
+    }
+    free(checkpoint->path);
+    free(checkpoint->completed.slots);
+    checkpoint_init(checkpoint);
+}
+
+/* Check whether a file was recorded by the resumed scan */
+bool checkpoint_is_completed(const Checkpoint *checkpoint, const char *dir, const char *name) {
+    if (checkpoint == NULL || checkpoint->completed.count == 0) return false;
+
+    const CompletedSet *set = &checkpoint->completed;
+    uint64_t hash = hash_bytes(HASH_SEED ^ checkpoint->seed, dir, strlen(dir));
+    hash = finish_hash(hash_bytes(hash_bytes(hash, "/", 1), name, strlen(name))); // The same path as `build_task()`
+
+    for (size_t index = (size_t)hash & set->mask; set->slots[index] != 0; index = (index + 1) & set->mask) {
+        if (set->slots[index] == hash) return true;
+    }
+    return false;
+}
+
+/* Record a file found clean */
+void checkpoint_record(Checkpoint *checkpoint, const char *path) {
+    if (checkpoint == NULL || checkpoint->fd == -1 || path == NULL) return;
+
+    if (local_count == CHECKPOINT_BUFFER_RECORDS) checkpoint_flush(checkpoint);
+    local_records[local_count++] = finish_hash(hash_bytes(HASH_SEED ^ checkpoint->seed, path, strlen(path)));
+}
+
+/* Write the buffered records of the calling process */
+void checkpoint_flush(Checkpoint *checkpoint) {
+    if (checkpoint == NULL || checkpoint->fd == -1 || local_count == 0) return;
+
+    if (!write_fully(checkpoint->fd, local_records, local_count * sizeof(uint64_t))) { // `O_APPEND`, so the batches of the processes never overlap
+        fprintf(stderr, "[WARNING] checkpoint_flush: Failed to write %s: %s\n", checkpoint->path, strerror(errno));
+    }
+    local_count = 0;
+}
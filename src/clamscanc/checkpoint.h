@@ -0,0 +1,122 @@
+/* checkpoint.h
+ *
+ * Copyright 2025 EricLin
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+*/
+
+/* Checkpoint of a scan */
+/*
+  * Every file found clean is recorded as the 64-bit hash of its path, appended to the checkpoint file in batches
+  * The threats and the errors aren't recorded, a resumed scan reports them again, but a file a worker died on is (it would get stuck on it again)
+  * A resumed scan traverses the same root again and skips the recorded files, so only the traversal and the last batches are redone
+  * The file is removed after the scan is finished, an interrupted scan leaves it for `--resume=`
+  *
+  * File layout: `CheckpointHeader`, the root padded to 8 bytes, then the records
+  * A record torn by a crash is cut off when the checkpoint is resumed
+  *
+  * The hash isn't cryptographic, a path colliding with a recorded one is skipped by a resumed scan
+  * It's seeded with the random `seed` of the header, so the names can't be crafted to collide ahead of the scan
+*/
+
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define CHECKPOINT_OPTION "--checkpoint=" // Record the finished files to the file, start from scratch
+#define RESUME_OPTION "--resume=" // Skip the files recorded in the file, keep recording to it
+#define CHECKPOINT_MAGIC "CLAMCKPT"
+#define CHECKPOINT_MAGIC_SIZE 8
+#define CHECKPOINT_VERSION 2
+#define CHECKPOINT_BUFFER_RECORDS 512 // Records buffered by a process before they are written
+
+/* Header of the checkpoint file */
+typedef struct {
+	char magic[CHECKPOINT_MAGIC_SIZE];
+	uint32_t version;
+	uint32_t root_length; // Without the null terminator
+	uint64_t seed; // Of the path hashes
+} CheckpointHeader;
+
+/* Set of the recorded path hashes */
+/*
+  * Open addressing with linear probing, a slot is 0 when it's empty
+  * Filled before forking, read-only afterwards
+*/
+typedef struct {
+	uint64_t *slots;
+	size_t mask;
+	size_t count;
+} CompletedSet;
+
+/* Checkpoint */
+/*
+  * `fd` is opened with `O_APPEND` before forking and shared by all the processes, a batch is a single `write()`
+  * `completed` is only filled for a resumed scan
+*/
+typedef struct {
+	int fd; // -1 if the scan isn't checkpointed
+	char *path;
+	uint64_t seed;
+	CompletedSet completed;
+} Checkpoint;
+
+/* Initialize the Checkpoint, disabled */
+void checkpoint_init(Checkpoint *checkpoint);
+
+/* Open the checkpoint file of a scan */
+/*
+  * @param root
+  * The scanned directory, it MUST match the recorded one when resuming
+  *
+  * @param is_resume
+  * `true` to load the recorded files and keep appending, `false` to start a new checkpoint
+  *
+  * @return
+  * `true` on success, `false` if the file can't be created, or isn't a checkpoint of `root` when resuming
+*/
+bool checkpoint_open(Checkpoint *checkpoint, const char *path, const char *root, bool is_resume);
+
+/* Close the Checkpoint */
+/*
+  * @param is_finished
+  * `true` if the scan is finished, the file is removed
+*/
+void checkpoint_close(Checkpoint *checkpoint, bool is_finished);
+
+/* Check whether a file was recorded by the resumed scan */
+/*
+  * @param dir
+  * The directory being traversed
+  *
+  * @param name
+  * The name of the file in `dir`
+*/
+bool checkpoint_is_completed(const Checkpoint *checkpoint, const char *dir, const char *name);
+
+/* Record a file found clean */
+/*
+  * The records are buffered per process, `checkpoint_flush()` writes them
+*/
+void checkpoint_record(Checkpoint *checkpoint, const char *path);
+
+/* Write the buffered records of the calling process */
+void checkpoint_flush(Checkpoint *checkpoint);
+
+#endif // CHECKPOINT_H
@@ -18,21 +18,128 @@
  * SPDX-License-Identifier: GPL-3.0-or-later
 */
 
+#include <errno.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
 #include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
 
+#include "background.h"
+#include "checkpoint.h"
+#include "coordinator.h"
+#include "daemon.h"
+#include "database.h"
+#include "exclusion.h"
+#include "journal.h"
+#include "json-lines.h"
 #include "manager.h"
+#include "placement.h"
+#include "priority.h"
+#include "profile.h"
+#include "roots.h"
+#include "sizing.h"
+#include "stream.h"
+#include "tarball.h"
 
 #define CLAMP(x, low, high) ((x) < (low) ? (low) : ((x) > (high) ? (high) : (x))) // Use for clamping the number of processes
+#define DAEMON_OPTION "--daemon"
+#define CACHE_OPTION "--cache"
+#define CONTENT_CACHE_OPTION "--content-cache"
+#define JOURNAL_OPTION "--journal"
+#define INCREMENTAL_OPTION "--incremental"
+#define BINARY_OPTION "--binary"
+#define STATS_OPTION "--stats"
+#define ONE_FILESYSTEM_OPTION "--one-file-system"
+#define FILE_TIMEOUT_OPTION "--file-timeout="
+#define WORKER_CHECK_INTERVAL_MS 250 // How often the watchdog checks the workers when nothing else needs a faster tick
+#define LARGE_LANE_SHARE 4 // One of this many active workers prefers the large file lane
+
+/* Command line options */
+/*
+  * The options come before the positional arguments
+*/
+typedef struct {
+	bool is_daemon;
+	bool is_journal; // Record the changes under `roots`
+	bool is_incremental; // Scan the recorded changes
+	bool use_cache;
+	bool use_content_cache; // Share the verdicts of the same content between the workers
+	ResultFormat result_format; // The text lines, a binary stream (see `result-protocol.h`) or JSON Lines (see `json-lines.h`)
+	bool show_stats; // Print the counters periodically and a summary at the end, only for the scans using the task pools
+	bool is_infected_only; // Don't output the clean files (see `result-protocol.h`)
+	uint64_t progress_interval_ms; // Output the cumulative counts this often, 0 for no progress, a single file or stream only has the final record
+	const char *trace_path; // Export the spans of the pipeline as a Chrome trace, NULL for no tracing (see `trace.h`)
+	bool is_one_filesystem; // Don't leave the file system of the scanned path
+	bool has_exclusions; // `exclusion_rules` isn't empty
+	bool is_background; // Run with the idle CPU and I/O priority (see `background.h`)
+	uint64_t max_rate; // Bytes per second scanned by all the workers, 0 for no limit
+	uint64_t max_files_rate; // Files per second scanned by all the workers, 0 for no limit
+	const char *checkpoint_path; // Record the finished files for resuming, NULL for no checkpoint
+	bool is_resume; // Skip the files recorded in `checkpoint_path`
+	bool is_prioritized; // Scan the risky and recent files first (see `priority.h`)
+	bool is_pinned; // Pin the processes to the CPUs, spread over the NUMA nodes (see `placement.h`)
+	bool is_tarball; // The roots are tarballs, their members are scanned from memory (see `tarball.h`)
+	const char *coordinator_address; // Serve the file tasks to the nodes instead of scanning them, NULL for a local scan (see `coordinator.h`)
+	const char *pull_address; // Scan the units of the coordinator, NULL in the other modes
+	ScanProfile profile; // The options and the limits of the engine (see `profile.h`)
+	const char *num_of_processes; // A number or `AUTO_SIZING_ARGUMENT`, NULL for the automatic sizing
+	const char *const *roots; // The directories and files to be scanned, or recorded by the journal, NULL in the other modes
+	size_t num_roots;
+} CommandOptions;
 
 SharedMemory *shm;
 pid_t parent_pid;
+ChangeJournal change_journal;
+volatile sig_atomic_t stop_journal = 0;
+struct timespec scan_start_time;
+size_t large_lane_workers = 1; // The workers below this index take the large files before the small ones
+ExclusionRules exclusion_rules; // Compiled before forking, the children only read it
+uint64_t file_timeout_ns = 0; // A worker spending longer on a file is killed and respawned, 0 to wait forever
+Checkpoint checkpoint; // Opened before forking, every process appends its finished files
+CpuPlacement cpu_placement; // Read before forking if the processes are pinned
+
+/* The state of the periodic watchdog tick */
+/*
+  * `is_auto_sizing` adjusts `worker_limit` of the SharedMemory, `show_stats` prints the snapshots
+  * `progress_interval` writes the progress records, 0 if disabled
+*/
+struct {
+    bool is_auto_sizing;
+    bool show_stats;
+    double progress_interval; // Seconds
+    double last_progress;
+    size_t cpu_budget;
+    size_t num_producers;
+    size_t num_workers;
+    IowaitSampler iowait;
+    double last_snapshot; // Seconds since the scan started
+} watchdog_tick;
+DaemonContext daemon_context = {
+    .listen_fd = -1,
+    .result_pipe = { -1, -1 },
+    .job_done_pipe = { -1, -1 },
+};
+CoordinatorContext coordinator_context = { .listen_fd = -1 }; // Opened before forking, the only worker serves the units
+
+/* Stop all the processes as soon as possible */
+static void force_quit(void) {
+    set_status(&shm->current_status, STATUS_FORCE_QUIT);
+
+    /* Wake up the idle processes so they can quit */
+    task_pool_wake_all(&shm->dir_tasks);
+    task_pool_wake_all(&shm->file_tasks);
+    wakeup_event_notify(&shm->worker_limit_event, INT_MAX);
+}
 
 /* Signal handler for terminating the scan */
-void shutdown_handler(int sig) {
+static void shutdown_handler(int sig) {
     if (getpid() != parent_pid) return; // Only the parent process can handle the signal
 
     write(STDERR_FILENO, "\n[INFO] Terminating the scan, shutting down...\n", 48);
-    set_status(&shm->current_status, STATUS_FORCE_QUIT);
+    force_quit();
 }
 
 /* The exit signal handler */
@@ -40,11 +147,16 @@ static void exit_signal(int sig) {
     _exit(EXIT_SUCCESS);
 }
 
+/* Move the status forward, only the first process reaching the new status will succeed */
+static inline bool advance_status(CurrentStatus expected, CurrentStatus new_status) {
+    return atomic_compare_exchange_strong(&shm->current_status, &expected, new_status);
+}
+
 /* The exit condition for the producer process */
-static inline void is_producer_done(TaskQueue *dir_tasks) {
-    if (is_task_queue_empty_assumption(dir_tasks)) {
-        notify_watchdog(&shm->producer_observer); // Notify the watchdog that the producer is done
-        set_status(&shm->current_status, STATUS_PRODUCER_DONE); // Set the status to producer done
+static inline void is_producer_done(TaskPool *dir_tasks) {
+    if (is_task_pool_idle(dir_tasks) && advance_status(STATUS_UNFINISHED, STATUS_PRODUCER_DONE)) {
+        task_pool_wake_all(&shm->file_tasks); // Let the idle workers recheck their exit condition, do it first since the watchdog may terminate the producers right after the notification
+        if (!is_daemon_context_active(&daemon_context)) notify_watchdog(&shm->producer_observer); // Notify the watchdog that the producer is done, the daemon keeps the producers for the next job
     }
 }
 
@@ -52,127 +164,872 @@ static inline void is_producer_done(TaskQueue *dir_tasks) {
 /*
   * WARNING: This function MUST be called by a producer process
 */
-static void producer_main(void *args) {
+static void producer_main(void *args, size_t process_index) {
     if (args == NULL) return; // Check if the argument is valid
-    TaskQueue *queue = (TaskQueue*)args; // Get the task queue from the argument
+    TaskPool *pool = (TaskPool*)args; // Get the task pool from the argument
+    scan_stats_attach(&shm->stats, STATS_PRODUCER_SLOT(process_index));
+    scan_trace_attach(&shm->trace, STATS_PRODUCER_SLOT(process_index), "producer", process_index);
+    task_pool_attach_node(cpu_placement_node(shm->producer_observer.placement, process_index));
 
-    Task task[MAX_GET_TASKS]; // Initialize tasks array to get tasks from the task queue
+    Task task[MAX_GET_TASKS]; // Initialize tasks array to get tasks from the task pool
     while (get_status(&shm->current_status) != STATUS_FORCE_QUIT) {
-        size_t tasks_to_get = task_queue_get(queue, task); // Get tasks from the task queue
+        uint32_t token = task_pool_wakeup_token(pool); // Take the token before checking the pool, so no wakeup is lost
+        size_t tasks_to_get = task_pool_get(pool, process_index, true, task); // Pop from the own deque first, then steal from the others
+        if (tasks_to_get == 0 && task_pool_has_spilled(pool)) { // The arena is exhausted, the workers release the paths soon
+            nanosleep(&(struct timespec){ .tv_nsec = SPILL_RETRY_NS }, NULL);
+            continue;
+        }
         if (tasks_to_get == 0) {
-            is_producer_done(queue); // Check if the producer is done
-            continue; // If there is no task to get, continue
+            is_producer_done(pool); // Check if the producer is done
+            task_pool_wait(pool, token); // Sleep until new tasks are added or the status is changed
+            continue;
         }
 
-        atomic_fetch_add(&queue->in_progress, 1);
         for (size_t i = 0; i < tasks_to_get; i++) {
-            if (task[i].type != TASK_SCAN_DIR) continue; // Skip invalid tasks type
-            traverse_directory(task[i].path, &shm->dir_tasks, &shm->file_tasks); // Traverse the directory and add tasks to the task queue
+            if (!atomic_load(&shm->cancel_job)) { // Skip the cancelled job
+                if (task[i].type == TASK_SCAN_DIR) {
+                    traverse_directory(task_path(&shm->arena, &task[i]), &shm->arena, &shm->dir_tasks, &shm->file_tasks, process_index, &shm->traversal_filter); // Traverse the directory and push the new tasks to the own deques
+                }
+                else if (task[i].type == TASK_REPLAY_JOURNAL) {
+                    replay_journal(task_path(&shm->arena, &task[i]), &shm->arena, &shm->dir_tasks, &shm->file_tasks, process_index); // Push the recorded changes to the own deques
+                }
+                else if (task[i].type == TASK_SCAN_TARBALL) {
+                    traverse_tarball(task_path(&shm->arena, &task[i]), &shm->arena, &shm->file_tasks, &shm->members, &shm->essentials, process_index); // Push the members to the own deques
+                }
+            }
+            task_release(&shm->arena, &task[i]);
         }
-        atomic_fetch_sub(&queue->in_progress, 1);
+        task_pool_task_done(pool, tasks_to_get);
     }
 }
 
 /* The exit condition for worker processes */
-static inline void is_all_task_done(TaskQueue *file_tasks) {
+static inline void is_all_task_done(TaskPool *file_tasks) {
     if (get_status(&shm->current_status) == STATUS_PRODUCER_DONE) { // First check if the producer is done
-        if (is_task_queue_empty_assumption(file_tasks)) { // Then check if the task queue is empty and all tasks are done
-            notify_watchdog(&shm->worker_observer); // Notify the watchdog that all tasks are done
-            set_status(&shm->current_status, STATUS_ALL_TASKS_DONE); // Set the status to all tasks done
+        if (is_task_pool_idle(file_tasks) && advance_status(STATUS_PRODUCER_DONE, STATUS_ALL_TASKS_DONE)) { // Then check if the task queue is empty and all tasks are done
+            if (is_daemon_context_active(&daemon_context)) daemon_notify_job_done(&daemon_context); // Tell the daemon the job is finished, the workers wait for the next one
+            else notify_watchdog(&shm->worker_observer); // Notify the watchdog that all tasks are done
         }
     }
 }
 
+/* Prefetch a task of the worker's batch */
+static inline void prefetch_worker_task(const Task *task, DirFdCache *cache, PrefetchedFile *file) {
+    file->fd = -1;
+    if (task->type == TASK_SCAN_FILE && !atomic_load(&shm->cancel_job)) prefetch_file(task_path(&shm->arena, task), cache, file);
+}
+
 /* Worker function for scanning files */
 /*
   * WARNING: This function MUST be called by comsumer processes
 */
-static void worker_main(void *args) {
+static void worker_main(void *args, size_t process_index) {
     if (args == NULL) return; // Check if the argument is valid
-    TaskQueue *queue = (TaskQueue*)args; // Get the task queue from the argument
+    TaskPool *pool = (TaskPool*)args; // Get the task pool from the argument
+    scan_stats_attach(&shm->stats, STATS_WORKER_SLOT(process_index));
+    scan_trace_attach(&shm->trace, STATS_WORKER_SLOT(process_index), "worker", process_index);
+    scan_heartbeat_attach(&shm->worker_observer.heartbeats[process_index]);
+    task_pool_attach_node(cpu_placement_node(shm->worker_observer.placement, process_index)); // Steal from the producers of the same node first
+    result_output_attach(process_index);
+    WorkerBatch *batch = &shm->worker_batches[process_index]; // Lets the watchdog recover the tasks if this process dies
+
+    DirFdCache cache; // Keep the parent directory of the last file opened
+    dir_fd_cache_init(&cache);
 
-    Task task[MAX_GET_TASKS]; // Initialize task array to get tasks from the task queue
+    Task task[MAX_GET_TASKS]; // Initialize task array to get tasks from the task pool
     while (get_status(&shm->current_status) != STATUS_FORCE_QUIT) {
-        size_t tasks_to_get = task_queue_get(queue, task); // Get tasks from the task queue
+        if (process_index >= atomic_load(&shm->worker_limit)) { // Parked by the automatic sizing, the active workers check the exit condition
+            uint32_t limit_token = wakeup_event_token(&shm->worker_limit_event);
+            if (process_index >= atomic_load(&shm->worker_limit) && get_status(&shm->current_status) != STATUS_FORCE_QUIT) {
+                wakeup_event_wait(&shm->worker_limit_event, limit_token);
+            }
+            continue;
+        }
+
+        uint32_t token = task_pool_wakeup_token(pool); // Take the token before checking the pool, so no wakeup is lost
+
+        /* The large file lane starts the biggest files early on its own workers, the other workers only help once the small files run out */
+        bool prefers_large = process_index < large_lane_workers;
+        size_t tasks_to_get = prefers_large ? task_pool_get_large(pool, task) : 0;
+        if (tasks_to_get == 0) tasks_to_get = task_pool_get(pool, process_index, false, task); // Steal a group of tasks from the producers' deques
+        if (tasks_to_get == 0 && !prefers_large) tasks_to_get = task_pool_get_large(pool, task);
         if (tasks_to_get == 0) {
-            is_all_task_done(queue); // Check if all tasks are done
-            continue; // If there is no task to get, continue
+            is_all_task_done(pool); // Check if all tasks are done
+            task_pool_wait(pool, token); // Sleep until new tasks are added or the status is changed
+            continue;
         }
 
-        atomic_fetch_add(&queue->in_progress, 1);
+        memcpy(batch->tasks, task, tasks_to_get * sizeof(Task));
+        atomic_store(&batch->current, 0);
+        atomic_store(&batch->num_reported, 0);
+        atomic_store(&batch->count, tasks_to_get);
+
+        /* Open the next files of the batch ahead, so their reads overlap the scan of the current one */
+        PrefetchedFile prefetched[MAX_GET_TASKS];
         for (size_t i = 0; i < tasks_to_get; i++) {
-            if (task[i].type != TASK_SCAN_FILE) continue; // Skip invalid tasks type
-            process_file(task[i].path, &shm->essentials); // Scan the file
+            prefetched[i].fd = -1;
+            if (i < PREFETCH_DEPTH) prefetch_worker_task(&task[i], &cache, &prefetched[i]);
         }
-        atomic_fetch_sub(&queue->in_progress, 1);
+
+        for (size_t i = 0; i < tasks_to_get; i++) {
+            if (i + PREFETCH_DEPTH < tasks_to_get) prefetch_worker_task(&task[i + PREFETCH_DEPTH], &cache, &prefetched[i + PREFETCH_DEPTH]);
+
+            if (task[i].type == TASK_SCAN_FILE && !atomic_load(&shm->cancel_job)) { // Skip invalid tasks type and the cancelled job
+                cl_error_t verdict = process_file(task_path(&shm->arena, &task[i]), &shm->essentials, &cache, &prefetched[i]); // Scan the file
+                if (verdict == CL_CLEAN) checkpoint_record(&checkpoint, task_path(&shm->arena, &task[i])); // A resumed scan reports the threats and the errors again
+            }
+            else if (task[i].type == TASK_SCAN_MEMBER && !atomic_load(&shm->cancel_job)) {
+                process_member(&task[i], task_path(&shm->arena, &task[i]), &shm->members, &shm->essentials); // Scan the member from memory
+            }
+            atomic_store(&batch->num_reported, i + 1);
+            prefetched_file_clear(&prefetched[i]); // Not scanned
+            member_pool_release(&shm->members, task[i].member); // Nothing for the files
+            task_release(&shm->arena, &task[i]);
+            atomic_store(&batch->current, i + 1); // Only once it's released, the watchdog would release it again
+        }
+        checkpoint_flush(&checkpoint); // An interruption only loses the current batch
+        atomic_store(&batch->count, 0); // Before the tasks are done, a death in between would otherwise finish them twice
+        task_pool_task_done(pool, tasks_to_get);
     }
+    dir_fd_cache_clear(&cache);
 }
 
-/* Scan a single file directly without creating a task queue */
-static void scan_file_directly(const char *path) {
-    ClamavEssentials essentials;
-    if (!clamav_essentials_init(&essentials)) {
-        fprintf(stderr, "Failed to initialize ClamAV essentials\n");
+/* The producer process of the daemon */
+static void daemon_producer_main(void *args, size_t process_index) {
+    daemon_redirect_output(&daemon_context);
+    producer_main(args, process_index);
+}
+
+/* The worker process of the daemon */
+static void daemon_worker_main(void *args, size_t process_index) {
+    daemon_redirect_output(&daemon_context);
+    worker_main(args, process_index);
+}
+
+/* The worker process of the coordinator, it serves the file tasks to the nodes instead of scanning them */
+static void coordinator_worker_main(void *args, size_t process_index) {
+    scan_stats_attach(&shm->stats, STATS_WORKER_SLOT(process_index));
+    scan_trace_attach(&shm->trace, STATS_WORKER_SLOT(process_index), "coordinator", process_index);
+    coordinator_main(&coordinator_context, shm);
+}
+
+/* Switch the workers of the daemon to the new engine */
+/*
+  * The engine is inherited when forking, so the idle workers are replaced by new ones
+  * @return
+  * The old engine, no worker uses it anymore, the daemon frees it unless it keeps it for another profile
+*/
+static struct cl_engine *respawn_workers(void) {
+    send_signal_to_all_processes(&shm->worker_observer); // Terminate the old workers, they are idle between jobs
+    atomic_store(&shm->file_tasks.queue.wakeup.waiters, 0); // The terminated workers can't leave the wakeup event by themselves
+
+    struct cl_engine *old_engine = clamav_essentials_swap(&shm->essentials);
+    if (shm->essentials.verdict_cache != NULL) verdict_cache_validate(shm->essentials.verdict_cache, shm->essentials.engine, &shm->essentials.scan_options); // The verdicts of the old database are no longer valid
+
+    fflush(stdout); // Don't let the children inherit the pending output
+    if (!spawn_new_process(&shm->worker_observer, daemon_worker_main, (void*)&shm->file_tasks)) {
+        fprintf(stderr, "[ERROR] Failed to respawn the workers, aborting...\n");
+        set_status(&shm->current_status, STATUS_FORCE_QUIT);
+    }
+    else fprintf(stderr, "[INFO] Switched to the new engine (generation %u, %s profile)\n", shm->essentials.generation, shm->essentials.profile.name);
+
+    return old_engine;
+}
+
+/* Parse a decimal number no larger than `max` */
+static bool parse_unsigned(const char *text, uint64_t max, uint64_t *value) {
+    if (text[0] < '0' || text[0] > '9') return false; // No sign or spaces
+
+    char *end = NULL;
+    errno = 0;
+    unsigned long long parsed = strtoull(text, &end, 10);
+    if (*end != '\0' || errno == ERANGE || parsed > max) return false;
+
+    *value = (uint64_t)parsed;
+    return true;
+}
+
+/* Check whether an argument is the number of processes */
+static bool is_num_of_processes(const char *text) {
+    if (strcmp(text, AUTO_SIZING_ARGUMENT) == 0) return true;
+    if (*text == '\0') return false;
+
+    for (; *text != '\0'; text++) {
+        if (*text < '0' || *text > '9') return false;
+    }
+    return true;
+}
+
+/* Parse the command line options */
+/*
+  * @return
+  * `true` if the arguments are valid, `false` otherwise (print the usage)
+*/
+static bool parse_command_options(int argc, const char *argv[], CommandOptions *options) {
+    *options = (CommandOptions){0};
+    exclusion_rules_init(&exclusion_rules);
+    checkpoint_init(&checkpoint);
+    scan_profile_init(&options->profile, SCAN_PROFILE_DEFAULT, 0);
+
+    int index = 1;
+    for (; index < argc && strncmp(argv[index], "--", 2) == 0; index++) {
+        if (strcmp(argv[index], DAEMON_OPTION) == 0) options->is_daemon = true;
+        else if (strcmp(argv[index], JOURNAL_OPTION) == 0) options->is_journal = true;
+        else if (strcmp(argv[index], INCREMENTAL_OPTION) == 0) options->is_incremental = true;
+        else if (strcmp(argv[index], CACHE_OPTION) == 0) options->use_cache = true;
+        else if (strcmp(argv[index], CONTENT_CACHE_OPTION) == 0) options->use_content_cache = true;
+        else if (strcmp(argv[index], BINARY_OPTION) == 0) options->result_format = RESULT_FORMAT_BINARY;
+        else if (strcmp(argv[index], JSON_OPTION) == 0) options->result_format = RESULT_FORMAT_JSON;
+        else if (strcmp(argv[index], STATS_OPTION) == 0) options->show_stats = true;
+        else if (strcmp(argv[index], INFECTED_ONLY_OPTION) == 0) options->is_infected_only = true;
+        else if (strncmp(argv[index], PROGRESS_OPTION, strlen(PROGRESS_OPTION)) == 0) {
+            if (!parse_unsigned(argv[index] + strlen(PROGRESS_OPTION), UINT32_MAX, &options->progress_interval_ms) || options->progress_interval_ms == 0) {
+                fprintf(stderr, "Invalid interval: %s\n", argv[index] + strlen(PROGRESS_OPTION));
+                return false;
+            }
+        }
+        else if (strncmp(argv[index], TRACE_OPTION, strlen(TRACE_OPTION)) == 0) options->trace_path = argv[index] + strlen(TRACE_OPTION);
+        else if (strcmp(argv[index], ONE_FILESYSTEM_OPTION) == 0) options->is_one_filesystem = true;
+        else if (strncmp(argv[index], EXCLUSION_OPTION, strlen(EXCLUSION_OPTION)) == 0) {
+            if (!exclusion_rules_add(&exclusion_rules, argv[index] + strlen(EXCLUSION_OPTION))) {
+                fprintf(stderr, "Invalid exclusion rule: %s\n", argv[index] + strlen(EXCLUSION_OPTION));
+                return false;
+            }
+        }
+        else if (strncmp(argv[index], EXCLUSION_FILE_OPTION, strlen(EXCLUSION_FILE_OPTION)) == 0) {
+            if (!exclusion_rules_add_file(&exclusion_rules, argv[index] + strlen(EXCLUSION_FILE_OPTION))) return false;
+        }
+        else if (strcmp(argv[index], BACKGROUND_OPTION) == 0) options->is_background = true;
+        else if (strcmp(argv[index], PRIORITY_OPTION) == 0) options->is_prioritized = true;
+        else if (strcmp(argv[index], PIN_CPUS_OPTION) == 0) options->is_pinned = true;
+        else if (strcmp(argv[index], TARBALL_OPTION) == 0) options->is_tarball = true;
+        else if (strncmp(argv[index], COORDINATOR_OPTION, strlen(COORDINATOR_OPTION)) == 0) options->coordinator_address = argv[index] + strlen(COORDINATOR_OPTION);
+        else if (strncmp(argv[index], PULL_OPTION, strlen(PULL_OPTION)) == 0) options->pull_address = argv[index] + strlen(PULL_OPTION);
+        else if (strncmp(argv[index], PROFILE_OPTION, strlen(PROFILE_OPTION)) == 0) {
+            if (!scan_profile_parse(&options->profile, argv[index] + strlen(PROFILE_OPTION))) {
+                fprintf(stderr, "Invalid profile: %s\n", argv[index] + strlen(PROFILE_OPTION));
+                return false;
+            }
+        }
+        else if (strncmp(argv[index], EXCLUDE_DB_OPTION, strlen(EXCLUDE_DB_OPTION)) == 0) {
+            if (!database_exclude(argv[index] + strlen(EXCLUDE_DB_OPTION))) { // `argv` outlives the engines
+                fprintf(stderr, "Invalid or too many excluded databases: %s\n", argv[index] + strlen(EXCLUDE_DB_OPTION));
+                return false;
+            }
+        }
+        else if (strncmp(argv[index], FILE_TIMEOUT_OPTION, strlen(FILE_TIMEOUT_OPTION)) == 0) {
+            uint64_t seconds;
+            if (!parse_unsigned(argv[index] + strlen(FILE_TIMEOUT_OPTION), UINT32_MAX, &seconds)) {
+                fprintf(stderr, "Invalid timeout: %s\n", argv[index] + strlen(FILE_TIMEOUT_OPTION));
+                return false;
+            }
+            file_timeout_ns = seconds * 1000000000ULL;
+        }
+        else if (strncmp(argv[index], CHECKPOINT_OPTION, strlen(CHECKPOINT_OPTION)) == 0) {
+            options->checkpoint_path = argv[index] + strlen(CHECKPOINT_OPTION);
+            options->is_resume = false;
+        }
+        else if (strncmp(argv[index], RESUME_OPTION, strlen(RESUME_OPTION)) == 0) {
+            options->checkpoint_path = argv[index] + strlen(RESUME_OPTION);
+            options->is_resume = true;
+        }
+        else if (strncmp(argv[index], MAX_RATE_OPTION, strlen(MAX_RATE_OPTION)) == 0) {
+            if (!parse_file_size(argv[index] + strlen(MAX_RATE_OPTION), &options->max_rate)) {
+                fprintf(stderr, "Invalid rate: %s\n", argv[index] + strlen(MAX_RATE_OPTION));
+                return false;
+            }
+        }
+        else if (strncmp(argv[index], MAX_FILES_RATE_OPTION, strlen(MAX_FILES_RATE_OPTION)) == 0) {
+            if (!parse_unsigned(argv[index] + strlen(MAX_FILES_RATE_OPTION), UINT32_MAX, &options->max_files_rate)) {
+                fprintf(stderr, "Invalid rate: %s\n", argv[index] + strlen(MAX_FILES_RATE_OPTION));
+                return false;
+            }
+        }
+        else if (strncmp(argv[index], MAX_FILE_SIZE_OPTION, strlen(MAX_FILE_SIZE_OPTION)) == 0) {
+            if (!parse_file_size(argv[index] + strlen(MAX_FILE_SIZE_OPTION), &exclusion_rules.max_file_size)) {
+                fprintf(stderr, "Invalid size: %s\n", argv[index] + strlen(MAX_FILE_SIZE_OPTION));
+                return false;
+            }
+        }
+        else {
+            fprintf(stderr, "Unknown option: %s\n", argv[index]);
+            return false;
+        }
+    }
+
+    bool is_pull = options->pull_address != NULL;
+    if (options->is_daemon + options->is_journal + options->is_incremental + is_pull > 1) return false; // Only one mode at a time
+    if (options->checkpoint_path != NULL && (options->is_daemon || options->is_journal || options->is_incremental || is_pull)) return false; // Only a directory scan has a root to resume
+    if (options->coordinator_address != NULL && (options->is_daemon || options->is_journal || options->is_incremental || is_pull || options->checkpoint_path != NULL)) return false; // The coordinator only serves a directory scan, the nodes don't record the checkpoint
+    if (options->is_tarball && (options->is_daemon || options->is_journal || options->is_incremental || is_pull || options->checkpoint_path != NULL || options->coordinator_address != NULL)) return false; // The members only exist in the memory of this scan
+    if ((options->is_infected_only || options->progress_interval_ms > 0) && (options->is_daemon || options->is_journal || is_pull || options->coordinator_address != NULL)) return false; // The jobs and the nodes choose their own output
+    if (options->progress_interval_ms > 0 && options->result_format == RESULT_FORMAT_TEXT) return false; // A text line can't be told apart from a path
+    if (options->checkpoint_path != NULL && options->checkpoint_path[0] == '\0') return false;
+    if (options->trace_path != NULL && options->trace_path[0] == '\0') return false;
+    if (!exclusion_rules_compile(&exclusion_rules)) return false;
+    options->has_exclusions = !exclusion_rules.is_empty;
+    if (options->is_journal) { // All the remaining arguments are the roots
+        options->roots = argv + index;
+        options->num_roots = (size_t)(argc - index);
+        return options->num_roots > 0;
+    }
+
+    if (!options->is_daemon && !options->is_incremental && !is_pull) { // The roots, then the number of processes if there are several arguments
+        if (index >= argc) return false; // Missing the path
+        int end = argc - index > 1 && is_num_of_processes(argv[argc - 1]) ? argc - 1 : argc; // A directory named like a number needs a `./` then
+        options->roots = argv + index;
+        options->num_roots = (size_t)(end - index);
+        index = end;
+
+        for (size_t i = 0; i < options->num_roots; i++) {
+            if (strcmp(options->roots[i], STREAM_ARGUMENT) != 0) continue;
+            if (options->num_roots > 1 || options->checkpoint_path != NULL || options->coordinator_address != NULL) return false; // The standard input is scanned alone, it has no file to resume or serve
+        }
+    }
+    if (index < argc) options->num_of_processes = argv[index++];
+
+    return index == argc;
+}
+
+/* Open the verdict cache for the shared engine */
+/*
+  * The scan goes on without the cache if it can't be opened
+*/
+static void open_verdict_cache(void) {
+    char path[MAX_PATH];
+    if (!verdict_cache_default_path(path, sizeof(path))) {
+        fprintf(stderr, "[WARNING] The cache path is too long, scanning without the cache\n");
         return;
     }
-    process_file(path, &essentials);
-    clamav_essentials_clear(&essentials);
+
+    if (verdict_cache_open(&shm->verdict_cache, path, shm->essentials.engine, &shm->essentials.scan_options)) {
+        shm->essentials.verdict_cache = &shm->verdict_cache;
+    }
+    else fprintf(stderr, "[WARNING] Failed to open the cache %s, scanning without the cache\n", path);
 }
 
-int main(int argc, const char *argv[]) {
-    if (argc < 2) {
-        printf("Usage: %s <directory> [num_of_processes]\n", argv[0]);
-        return 1;
+/* Map the content cache shared by the workers */
+static void enable_content_cache(void) {
+    if (content_cache_enable(&shm->content_cache)) shm->essentials.content_cache = &shm->content_cache;
+    else fprintf(stderr, "[WARNING] Scanning without the content cache\n");
+}
+
+/* Map the trace rings, a ring per stats slot */
+static void enable_trace(const CommandOptions *options) {
+    if (options->trace_path == NULL) return;
+
+    if (!scan_trace_enable(&shm->trace, STATS_MAX_SLOTS)) fprintf(stderr, "[WARNING] Scanning without tracing\n");
+}
+
+/* Export the spans of all the processes, they have exited */
+static void export_trace(const CommandOptions *options) {
+    if (options->trace_path == NULL || shm->trace.rings == NULL) return;
+
+    if (scan_trace_export(&shm->trace, options->trace_path, (int)getpid(), "clamscanc", false)) {
+        fprintf(stderr, "[INFO] The trace is written to %s\n", options->trace_path);
     }
+}
 
-    char *real_path = realpath(argv[1], NULL);
-    if (real_path == NULL) {
-        fprintf(stderr, "Failed to get real path of %s\n", argv[1]);
-        return 1;
+/* Limit the rate of all the workers */
+static void enable_throttle(const CommandOptions *options) {
+    if (options->max_rate == 0 && options->max_files_rate == 0) return;
+
+    scan_throttle_init(&shm->throttle, options->max_rate, options->max_files_rate);
+    shm->essentials.throttle = &shm->throttle;
+}
+
+/* Pin the processes and give each NUMA node the deques of its producers */
+/*
+  * The producer `i` and the workers `i`, `i + num_nodes`, ... share a node, the workers take the CPUs after the producers of the node
+  * The processes run anywhere if the CPUs can't be read
+*/
+static void enable_placement(size_t num_producers, size_t num_workers) {
+    if (!cpu_placement_init(&cpu_placement)) {
+        fprintf(stderr, "[WARNING] Failed to read the CPUs, the processes aren't pinned\n");
+        return;
     }
 
-    if (!is_directory(real_path)) {
-        if (!is_regular_file(real_path)) {
-            fprintf(stderr, "%s is not a directory or a regular file\n", real_path);
-            free(real_path);
-            return 1;
+    size_t producers_per_node = (num_producers + cpu_placement.num_nodes - 1) / cpu_placement.num_nodes;
+    observer_set_placement(&shm->producer_observer, &cpu_placement, 0);
+    observer_set_placement(&shm->worker_observer, &cpu_placement, producers_per_node);
+
+    for (size_t i = 0; i < num_producers && i < MAX_PRODUCERS; i++) {
+        size_t node = cpu_placement_node(&cpu_placement, i);
+        task_pool_set_deque_node(&shm->dir_tasks, i, node);
+        task_pool_set_deque_node(&shm->file_tasks, i, node);
+
+        /* The deques were touched by the parent when they were initialized, move them to their owners */
+        cpu_placement_bind_memory(&cpu_placement, &shm->dir_tasks.deques[i], sizeof(WorkDeque), node);
+        cpu_placement_bind_memory(&cpu_placement, &shm->file_tasks.deques[i], sizeof(WorkDeque), node);
+    }
+
+    fprintf(stderr, "[INFO] Pinning %zu producers and %zu workers to %zu CPUs on %zu NUMA nodes\n",
+            num_producers, num_workers, cpu_placement.num_cpus, cpu_placement.num_nodes);
+}
+
+/* Get the number of producer and worker processes from the argument */
+/*
+  * @param cpu_budget
+  * The CPUs to be used [OUT], only set for the automatic sizing
+  *
+  * @return
+  * `true` for the automatic sizing (no argument or `AUTO_SIZING_ARGUMENT`), `false` if the number is given
+*/
+static bool get_num_of_processes(const char *arg, size_t *num_workers, size_t *num_producers, size_t *cpu_budget) {
+    bool is_auto = arg == NULL || strcmp(arg, AUTO_SIZING_ARGUMENT) == 0;
+    if (is_auto) *cpu_budget = get_cpu_budget();
+
+    *num_workers = is_auto ? CLAMP(*cpu_budget, 1, MAX_PROCESSES) : CLAMP(atoi(arg), 1, MAX_PROCESSES); // Get the number of worker processes from the argument or the CPU budget
+    *num_producers = *num_workers >= 8 ? 4 : 2; // Set the number of producers to 4 if the number of worker processes is greater or equal to 8, otherwise set it to 2
+    return is_auto;
+}
+
+/* Sum the counters of all the processes */
+static void collect_stats(StatsSnapshot *snapshot) {
+    scan_stats_collect(&shm->stats, snapshot);
+    snapshot->dir_tasks = atomic_load(&shm->dir_tasks.outstanding);
+    snapshot->file_tasks = atomic_load(&shm->file_tasks.outstanding);
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    snapshot->elapsed = (double)(now.tv_sec - scan_start_time.tv_sec) + (now.tv_nsec - scan_start_time.tv_nsec) / 1e9;
+
+    uint64_t start_ns = (uint64_t)scan_start_time.tv_sec * 1000000000ULL + (uint64_t)scan_start_time.tv_nsec;
+    snapshot->first_threat = snapshot->first_threat_ns > start_ns ? (snapshot->first_threat_ns - start_ns) / 1e9 : -1;
+}
+
+/* Recalculate how many workers should be active */
+static void update_worker_limit(const StatsSnapshot *snapshot) {
+    PoolPressure pressure = {
+        .cpu_budget = watchdog_tick.cpu_budget,
+        .num_producers = watchdog_tick.num_producers,
+        .num_workers = watchdog_tick.num_workers,
+        .batch_size = MAX_GET_TASKS,
+        .is_producer_done = get_status(&shm->current_status) >= STATUS_PRODUCER_DONE,
+        .dir_tasks = snapshot != NULL ? snapshot->dir_tasks : 1,
+        .file_tasks = snapshot != NULL ? snapshot->file_tasks : 0,
+        .iowait = snapshot != NULL ? iowait_sampler_sample(&watchdog_tick.iowait) : 0,
+    };
+
+    size_t limit = calculate_worker_limit(&pressure);
+    size_t old_limit = atomic_exchange(&shm->worker_limit, limit);
+    if (limit > old_limit) wakeup_event_notify(&shm->worker_limit_event, INT_MAX); // Unpark the workers, the ones still above the limit park again
+}
+
+/* Take back the batch of a worker which was killed or has crashed */
+/*
+  * The file being processed is reported as failed with `error`, the rest of the batch goes back to the pool
+*/
+static void recover_worker_batch(size_t index, cl_error_t error, uint64_t elapsed_ns) {
+    WorkerBatch *batch = &shm->worker_batches[index];
+    size_t count = atomic_load(&batch->count);
+    if (count == 0) return; // Died between the batches
+
+    size_t current = atomic_load(&batch->current);
+    for (size_t i = current; i < count; i++) {
+        if (i == current) {
+            if (atomic_load(&batch->num_reported) <= current) { // Died after writing the result otherwise
+                report_scan_failure(task_path(&shm->arena, &batch->tasks[i]), error, &shm->essentials, elapsed_ns, index);
+                checkpoint_record(&checkpoint, task_path(&shm->arena, &batch->tasks[i])); // A resumed scan would get stuck on it again
+                checkpoint_flush(&checkpoint);
+            }
+            member_pool_release(&shm->members, batch->tasks[i].member);
+            task_release(&shm->arena, &batch->tasks[i]);
         }
-        // process single file
-        printf("%s is a regular file, try scanning it directly\n", real_path);
-        scan_file_directly(real_path);
-        free(real_path);
-        return 0;
+        else task_pool_add(&shm->file_tasks, NO_DEQUE_OWNER, batch->tasks[i]); // Counted as a new task, the whole batch is done below
+    }
+
+    atomic_store(&batch->count, 0);
+    task_pool_task_done(&shm->file_tasks, count);
+}
+
+/* Stop a worker which looks stuck, and check it's still on the file it started at `busy_since` */
+/*
+  * @return
+  * `true` if it's stopped on that file, ready for `kill_process()`, `false` if it has finished the file or exited in the meantime
+*/
+static bool stop_stuck_worker(Observer *observer, size_t index, uint64_t busy_since, uint64_t beats) {
+    if (!stop_process(observer, index)) return false; // Exited, reaped on the next tick
+
+    const ProcessHeartbeat *heartbeat = &observer->heartbeats[index];
+    if (atomic_load(&heartbeat->busy_since_ns) == busy_since && atomic_load(&heartbeat->beats) == beats) return true;
+
+    continue_process(observer, index);
+    return false;
+}
+
+/* Replace the workers which crashed or spent longer than `file_timeout_ns` on a file */
+static void check_workers(void) {
+    if (get_status(&shm->current_status) == STATUS_FORCE_QUIT) return; // The workers are exiting anyway
+
+    Observer *observer = &shm->worker_observer;
+    uint64_t now = monotonic_ns();
+    for (size_t i = 0; i < observer->num_of_processes; i++) {
+        if (observer->pids[i] <= 0) continue;
+
+        uint64_t busy_since = atomic_load(&observer->heartbeats[i].busy_since_ns);
+        uint64_t beats = atomic_load(&observer->heartbeats[i].beats);
+        bool is_timeout = file_timeout_ns > 0 && busy_since != 0 && now > busy_since && now - busy_since > file_timeout_ns;
+        if (is_timeout && !stop_stuck_worker(observer, i, busy_since, beats)) continue; // Exited or moved on in between, checked on the next tick
+
+        pid_t pid = observer->pids[i];
+        int status = 0;
+        if (is_timeout) kill_process(observer, i);
+        else if (!reap_process(observer, i, &status)) continue; // Still running
+        else if (WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS) continue; // Quitting, the status changed after the check above
+        else if (WIFSIGNALED(status) && WTERMSIG(status) == SIGPIPE) { // Nobody reads the results anymore (e.g. `clamscanc | head`)
+            fprintf(stderr, "[INFO] The output is closed, shutting down...\n");
+            force_quit();
+            return;
+        }
+
+        if (is_coordinator_context_active(&coordinator_context)) { // The leases of the nodes were lost with it
+            fprintf(stderr, "[ERROR] The process serving the units died, aborting...\n");
+            force_quit();
+            return;
+        }
+
+        if (result_output_recover_lock(&shm->result_output, pid)) fprintf(stderr, "[WARNING] Worker %zu died holding the output, its last result may be torn\n", i);
+
+        WorkerBatch *batch = &shm->worker_batches[i];
+        size_t current = atomic_load(&batch->current);
+        const char *path = current < atomic_load(&batch->count) ? task_path(&shm->arena, &batch->tasks[current]) : "(no file)";
+        if (is_timeout) {
+            fprintf(stderr, "[WARNING] Worker %zu spent longer than %llu s on %s, respawning\n", i, (unsigned long long)(file_timeout_ns / 1000000000ULL), path);
+            stats_add(STAT_TIMEOUTS, 1);
+        }
+        else if (WIFSIGNALED(status)) fprintf(stderr, "[WARNING] Worker %zu was killed by signal %d on %s, respawning\n", i, WTERMSIG(status), path);
+        else fprintf(stderr, "[WARNING] Worker %zu exited with status %d on %s, respawning\n", i, WEXITSTATUS(status), path);
+
+        recover_worker_batch(i, is_timeout ? CL_ETIMEOUT : CL_ERROR, is_timeout ? now - busy_since : 0);
+        if (respawn_process(observer, i)) stats_add(STAT_WORKERS_RESPAWNED, 1);
+        else { // The remaining workers can still finish the scan, unless none is left
+            fprintf(stderr, "[ERROR] Failed to respawn worker %zu\n", i);
+        }
+    }
+}
+
+/* Write the cumulative counts of the scan */
+static void write_progress(const StatsSnapshot *snapshot) {
+    result_output_write_progress(STDOUT_FILENO, &shm->result_output, snapshot->counters[STAT_FILES_SCANNED], snapshot->counters[STAT_BYTES_SCANNED]);
+}
+
+/* Called periodically by the watchdog */
+static void on_watchdog_tick(void *args) {
+    check_workers();
+    if (!watchdog_tick.is_auto_sizing && !watchdog_tick.show_stats && watchdog_tick.progress_interval == 0) return;
+
+    StatsSnapshot snapshot;
+    collect_stats(&snapshot);
+
+    if (watchdog_tick.is_auto_sizing) update_worker_limit(&snapshot);
+
+    if (watchdog_tick.progress_interval > 0 && snapshot.elapsed - watchdog_tick.last_progress >= watchdog_tick.progress_interval) {
+        watchdog_tick.last_progress = snapshot.elapsed;
+        write_progress(&snapshot);
+    }
+
+    if (watchdog_tick.show_stats && snapshot.elapsed - watchdog_tick.last_snapshot >= STATS_SNAPSHOT_INTERVAL_MS / 1000.0) {
+        watchdog_tick.last_snapshot = snapshot.elapsed;
+        stats_snapshot_print_json(stderr, &snapshot);
+    }
+}
+
+/* Keep the engine and the processes alive, serve the scan jobs from the socket */
+static int run_daemon(const CommandOptions *options) {
+    size_t num_workers, num_producers, cpu_budget;
+    get_num_of_processes(options->num_of_processes, &num_workers, &num_producers, &cpu_budget); // The daemon keeps all the workers active
+    large_lane_workers = CLAMP(num_workers / LARGE_LANE_SHARE, 1, num_workers);
+    parent_pid = getpid();
+
+    if (!daemon_context_init(&daemon_context)) return 1;
+    daemon_context.respawn_workers = respawn_workers;
+    daemon_context.default_profile = options->profile; // For the jobs which don't ask for a profile
+    daemon_context.file_timeout_ns = file_timeout_ns; // For the streams, scanned in a child of the daemon process
+
+    if (!shared_memory_init(&shm, num_producers, &options->profile)) {
+        fprintf(stderr, "Failed to initialize shared memory\n");
+        daemon_context_clear(&daemon_context);
+        return 1;
+    }
+    set_status(&shm->current_status, STATUS_ALL_TASKS_DONE); // Stay idle until the first job arrives
+    if (options->has_exclusions) shm->traversal_filter.exclusions = &exclusion_rules;
+    if (options->use_cache) open_verdict_cache();
+    if (options->use_content_cache) enable_content_cache();
+    enable_trace(options);
+    enable_throttle(options);
+    if (options->is_prioritized) task_pool_enable_priority_lane(&shm->file_tasks);
+
+    // Set the signal handlers
+    register_signal_handler(SIGINT, shutdown_handler);
+    register_signal_handler(SIGTERM, shutdown_handler);
+
+    /* Spawn the persistent producer and worker processes */
+    fflush(stdout); // Don't let the children inherit the pending output
+    bool spawn_result = true;
+    observer_init(&shm->producer_observer, num_producers, SIGUSR1, exit_signal);
+    observer_init(&shm->worker_observer, num_workers, SIGUSR2, exit_signal);
+    if (options->is_pinned) enable_placement(num_producers, num_workers);
+
+    spawn_result &= spawn_new_process(&shm->producer_observer,
+                            daemon_producer_main, (void*)&shm->dir_tasks);
+
+    spawn_result &= spawn_new_process(&shm->worker_observer,
+                            daemon_worker_main, (void*)&shm->file_tasks);
+
+    if (!spawn_result) {
+        fprintf(stderr, "[ERROR] Failed to spawn processes, aborting...\n");
+        set_status(&shm->current_status, STATUS_FORCE_QUIT);
+    }
+    else {
+        fprintf(stderr, "[INFO] Listening on %s with %zu workers\n", daemon_context.socket_path, num_workers);
+        daemon_main(&daemon_context, shm);
     }
 
-    size_t num_workers = argc > 2 ? CLAMP(atoi(argv[2]), 1, MAX_PROCESSES) : 1; // Get the number of worker processes from the argument or default to 1
-    size_t num_producers = num_workers >= 8 ? 4 : 2; // Set the number of producers to 4 if the number of worker processes is greater or equal to 8, otherwise set it to 2
+    // Terminate all child processes, the status is `STATUS_FORCE_QUIT` here so the watchdog doesn't wait
+    watchdog_main(&shm->producer_observer, &shm->current_status, STATUS_FORCE_QUIT);
+    watchdog_main(&shm->worker_observer, &shm->current_status, STATUS_FORCE_QUIT);
+    export_trace(options);
+
+    daemon_context_clear(&daemon_context);
+    shared_memory_clear(&shm);
+    return 0;
+}
+
+/* Scan the units of a coordinator with the persistent workers */
+/*
+  * The coordinator traverses, so no producer is spawned
+*/
+static int run_pull(const CommandOptions *options) {
+    size_t num_workers, num_producers, cpu_budget;
+    get_num_of_processes(options->num_of_processes, &num_workers, &num_producers, &cpu_budget); // All the workers stay active like the daemon
+    large_lane_workers = CLAMP(num_workers / LARGE_LANE_SHARE, 1, num_workers);
+    parent_pid = getpid();
+
+    if (!daemon_context_init_relay(&daemon_context)) return 1;
 
-    if (!shared_memory_init(&shm)) {
+    if (!shared_memory_init(&shm, num_producers, &options->profile)) {
         fprintf(stderr, "Failed to initialize shared memory\n");
-        free(real_path);
+        daemon_context_clear(&daemon_context);
         return 1;
     }
+    set_status(&shm->current_status, STATUS_ALL_TASKS_DONE); // Stay idle until the first unit arrives
+    if (options->use_cache) open_verdict_cache();
+    if (options->use_content_cache) enable_content_cache();
+    enable_trace(options);
+    enable_throttle(options);
 
     // Set the signal handlers
     register_signal_handler(SIGINT, shutdown_handler);
     register_signal_handler(SIGTERM, shutdown_handler);
 
-    /* Add initial tasks to the task queue */
-    Task task = build_task(TASK_SCAN_DIR, real_path);
-    task_queue_add(&shm->dir_tasks, task);
-    free(real_path);
+    fflush(stdout); // Don't let the children inherit the pending output
+    observer_init(&shm->worker_observer, num_workers, SIGUSR2, exit_signal);
+    if (options->is_pinned) enable_placement(0, num_workers);
+
+    int result = 1;
+    if (!spawn_new_process(&shm->worker_observer, daemon_worker_main, (void*)&shm->file_tasks)) {
+        fprintf(stderr, "[ERROR] Failed to spawn processes, aborting...\n");
+    }
+    else result = coordinator_pull_main(&daemon_context, shm, options->pull_address, num_workers);
+
+    // Terminate the workers, they are idle or their unit is abandoned
+    set_status(&shm->current_status, STATUS_FORCE_QUIT);
+    watchdog_main(&shm->worker_observer, &shm->current_status, STATUS_FORCE_QUIT);
+    export_trace(options);
+
+    daemon_context_clear(&daemon_context);
+    shared_memory_clear(&shm);
+    return result;
+}
+
+/* Join the roots into the one recorded by the checkpoint */
+/*
+  * @return
+  * The roots separated by newlines, NULL if out of memory
+*/
+static char *join_roots(const char *const *paths, size_t num_paths) {
+    size_t length = 1;
+    for (size_t i = 0; i < num_paths; i++) length += strlen(paths[i]) + 1;
+
+    char *joined = malloc(length);
+    if (joined == NULL) return NULL;
+
+    char *end = joined;
+    for (size_t i = 0; i < num_paths; i++) {
+        if (i > 0) *end++ = '\n';
+        size_t path_length = strlen(paths[i]);
+        memcpy(end, paths[i], path_length);
+        end += path_length;
+    }
+    *end = '\0';
+    return joined;
+}
+
+/* Open the checkpoint of the roots */
+static bool open_checkpoint(const char *const *paths, size_t num_paths, const CommandOptions *options) {
+    char *root = join_roots(paths, num_paths);
+    if (root == NULL) {
+        fprintf(stderr, "[ERROR] Failed to allocate the root of the checkpoint\n");
+        return false;
+    }
+
+    bool is_opened = checkpoint_open(&checkpoint, options->checkpoint_path, root, options->is_resume);
+    free(root);
+    return is_opened;
+}
+
+/* Add the task of a root to its pool */
+/*
+  * A regular file root of a directory scan goes straight to the file tasks, like a file found by the traversal
+  *
+  * @return
+  * `false` if the task can't be built
+*/
+static bool add_root_task(const char *path, TaskType type) {
+    TaskPool *pool = &shm->dir_tasks;
+    uint64_t size = 0;
+
+    struct stat status;
+    if (type == TASK_SCAN_DIR && lstat(path, &status) == 0 && S_ISREG(status.st_mode)) {
+        TraversalFilter *filter = &shm->traversal_filter;
+        const char *slash = strrchr(path, '/');
+        char dir[MAX_PATH];
+        snprintf(dir, sizeof(dir), "%.*s", slash != NULL ? (int)(slash - path) : 0, path);
+        if (slash != NULL && traversal_filter_is_completed(filter, dir, slash + 1)) return true;
+        if (!traversal_filter_accept_file(filter, &status)) return true; // A hard link of another root
+
+        type = TASK_SCAN_FILE;
+        pool = &shm->file_tasks;
+        size = (uint64_t)status.st_size;
+    }
+
+    Task task;
+    if (!build_task(&shm->arena, type, path, NULL, &task)) {
+        fprintf(stderr, "Failed to build the initial task for %s\n", path);
+        return false;
+    }
+    task.size = size;
+    task_pool_add(pool, NO_DEQUE_OWNER, task);
+    if (type == TASK_SCAN_FILE) stats_add(STAT_FILES_ENQUEUED, 1);
+    return true;
+}
+
+/* Scan from the initial tasks with the producer and worker processes */
+/*
+  * @param paths
+  * The roots (`TASK_SCAN_DIR`, the files among them are scanned directly), the tarballs (`TASK_SCAN_TARBALL`) or the taken journal (`TASK_REPLAY_JOURNAL`)
+  *
+  * @param num_paths
+  * Number of `paths`, they must not overlap (see `scan_roots_normalize()`)
+  *
+  * @return
+  * `true` if all the tasks are done, `false` if the scan failed or was terminated
+*/
+static bool run_scan(const char *const *paths, size_t num_paths, TaskType type, const CommandOptions *options) {
+    size_t num_workers, num_producers, cpu_budget = 0;
+    bool is_auto_sizing = get_num_of_processes(options->num_of_processes, &num_workers, &num_producers, &cpu_budget);
+    large_lane_workers = CLAMP(num_workers / LARGE_LANE_SHARE, 1, num_workers); // Before the spare workers are added, the low indexes are the last ones parked
+    if (is_auto_sizing) num_workers = CLAMP(cpu_budget * 2, 1, MAX_PROCESSES); // Spare workers for the I/O bound phases, parked by default
+
+    bool is_coordinator = options->coordinator_address != NULL;
+    if (is_coordinator) { // The nodes scan, a single worker serves them the units
+        num_workers = 1;
+        is_auto_sizing = false;
+    }
+
+    if (!shared_memory_init(&shm, num_producers, &options->profile)) {
+        fprintf(stderr, "Failed to initialize shared memory\n");
+        return false;
+    }
+    if (options->use_cache) open_verdict_cache();
+    if (options->use_content_cache) enable_content_cache();
+    enable_trace(options);
+    enable_throttle(options);
+    if (options->is_prioritized) task_pool_enable_priority_lane(&shm->file_tasks);
+    if (type == TASK_SCAN_TARBALL && !member_pool_enable(&shm->members, num_producers)) {
+        shared_memory_clear(&shm);
+        return false;
+    }
+
+    /* A scan takes every inode once, the daemon only skips the pseudo file systems since its jobs may cover the same files again */
+    traversal_filter_enable_dedup(&shm->traversal_filter);
+    for (size_t i = 0; options->is_one_filesystem && type == TASK_SCAN_DIR && i < num_paths; i++) {
+        if (!traversal_filter_add_root(&shm->traversal_filter, paths[i])) {
+            fprintf(stderr, "[WARNING] Failed to get the file system of %s, scanning across the file systems\n", paths[i]);
+            shm->traversal_filter.is_one_filesystem = false;
+            break;
+        }
+    }
+    if (options->has_exclusions) shm->traversal_filter.exclusions = &exclusion_rules;
+
+    if (options->checkpoint_path != NULL && type == TASK_SCAN_DIR) {
+        if (!open_checkpoint(paths, num_paths, options)) {
+            shared_memory_clear(&shm);
+            return false;
+        }
+        if (options->is_resume) {
+            shm->traversal_filter.checkpoint = &checkpoint;
+            fprintf(stderr, "[INFO] Resuming from %s, %zu files were already finished\n", options->checkpoint_path, checkpoint.completed.count);
+        }
+    }
+
+    if (is_coordinator && !coordinator_context_init(&coordinator_context, options->coordinator_address, &shm->essentials, options->result_format)) {
+        shared_memory_clear(&shm);
+        return false;
+    }
+
+    atomic_store(&shm->result_output.format, options->result_format);
+    atomic_store(&shm->result_output.is_infected_only, options->is_infected_only);
+    if (options->result_format == RESULT_FORMAT_BINARY) {
+        write_all(STDOUT_FILENO, SCAN_RESULT_STREAM_MAGIC, SCAN_RESULT_STREAM_MAGIC_SIZE); // Before forking, so it always comes first
+    }
+
+    // Set the signal handlers
+    register_signal_handler(SIGINT, shutdown_handler);
+    register_signal_handler(SIGTERM, shutdown_handler);
+
+    /* Add initial tasks to the task pools, all the roots are seeded together */
+    scan_stats_attach(&shm->stats, STATS_PARENT_SLOT);
+    clock_gettime(CLOCK_MONOTONIC, &scan_start_time);
+    for (size_t i = 0; i < num_paths; i++) {
+        if (!add_root_task(paths[i], type)) {
+            coordinator_context_clear(&coordinator_context);
+            shared_memory_clear(&shm);
+            return false;
+        }
+    }
     parent_pid = getpid();
 
     /* Spawn the producer and worker processes */
     bool spawn_result = true;
     observer_init(&shm->producer_observer, num_producers, SIGUSR1, exit_signal);
     observer_init(&shm->worker_observer, num_workers, SIGUSR2, exit_signal);
+    if (options->is_pinned) enable_placement(num_producers, num_workers);
+
+    watchdog_tick.is_auto_sizing = is_auto_sizing;
+    watchdog_tick.show_stats = options->show_stats;
+    watchdog_tick.cpu_budget = cpu_budget;
+    watchdog_tick.num_producers = num_producers;
+    watchdog_tick.num_workers = num_workers;
+    watchdog_tick.last_snapshot = 0;
+    watchdog_tick.progress_interval = options->progress_interval_ms / 1000.0;
+    watchdog_tick.last_progress = 0;
+    if (is_auto_sizing) {
+        iowait_sampler_init(&watchdog_tick.iowait);
+        update_worker_limit(NULL); // The scan starts with traversing
+        fprintf(stderr, "[INFO] Automatic sizing: %zu CPUs, %zu producers, up to %zu workers\n", cpu_budget, num_producers, num_workers);
+    }
+    int interval = is_auto_sizing ? AUTO_SIZING_INTERVAL_MS : WORKER_CHECK_INTERVAL_MS; // The workers are always checked, the snapshots are throttled by themselves
+    if (options->progress_interval_ms > 0 && options->progress_interval_ms < (uint64_t)interval) interval = (int)options->progress_interval_ms;
+    observer_set_tick(&shm->producer_observer, interval, on_watchdog_tick, NULL);
+    observer_set_tick(&shm->worker_observer, interval, on_watchdog_tick, NULL);
 
     spawn_result &= spawn_new_process(&shm->producer_observer,
                             producer_main, (void*)&shm->dir_tasks);
 
     spawn_result &= spawn_new_process(&shm->worker_observer,
-                            worker_main, (void*)&shm->file_tasks);
+                            is_coordinator ? coordinator_worker_main : worker_main, (void*)&shm->file_tasks);
 
     if (!spawn_result) {
         fprintf(stderr, "[ERROR] Failed to spawn processes, aborting...\n");
@@ -182,4 +1039,300 @@ int main(int argc, const char *argv[]) {
     // Wait for all child processes to exit
     watchdog_main(&shm->producer_observer, &shm->current_status, STATUS_PRODUCER_DONE);
     watchdog_main(&shm->worker_observer, &shm->current_status, STATUS_ALL_TASKS_DONE);
-}
\ No newline at end of file
+    export_trace(options);
+
+    if (options->show_stats || options->progress_interval_ms > 0) {
+        StatsSnapshot snapshot;
+        collect_stats(&snapshot);
+        if (options->progress_interval_ms > 0) write_progress(&snapshot); // The last record always has the totals
+        if (options->show_stats) {
+            stats_snapshot_print_json(stderr, &snapshot); // The final snapshot, so the last line always has the totals
+            stats_snapshot_print_summary(stderr, &snapshot);
+        }
+    }
+
+    coordinator_context_clear(&coordinator_context);
+    bool is_finished = get_status(&shm->current_status) == STATUS_ALL_TASKS_DONE;
+    if (checkpoint.fd != -1) {
+        if (!is_finished) fprintf(stderr, "[INFO] The checkpoint is kept, continue with %s%s\n", RESUME_OPTION, checkpoint.path);
+        checkpoint_close(&checkpoint, is_finished);
+    }
+
+    return is_finished;
+}
+
+/* Signal handler for stopping the change journal */
+static void stop_journal_handler(int sig) {
+    stop_journal = 1;
+}
+
+/* Record the changes under the roots until terminated */
+static int run_journal(const CommandOptions *options) {
+    char path[MAX_PATH];
+    if (!change_journal_default_path(path, sizeof(path))) {
+        fprintf(stderr, "Failed to get the journal path\n");
+        return 1;
+    }
+
+    if (!change_journal_init(&change_journal, path, options->roots, options->num_roots)) return 1;
+
+    register_signal_handler(SIGINT, stop_journal_handler);
+    register_signal_handler(SIGTERM, stop_journal_handler);
+
+    change_journal_main(&change_journal, &stop_journal);
+    change_journal_clear(&change_journal);
+    return 0;
+}
+
+/* Scan only the paths recorded by the change journal */
+static int run_incremental(const CommandOptions *options) {
+    char path[MAX_PATH];
+    char pending_path[MAX_PATH];
+    if (!change_journal_default_path(path, sizeof(path)) ||
+        snprintf(pending_path, sizeof(pending_path), "%s%s", path, CHANGE_JOURNAL_PENDING_SUFFIX) >= (int)sizeof(pending_path)) {
+        fprintf(stderr, "Failed to get the journal path\n");
+        return 1;
+    }
+
+    size_t num_changes;
+    if (!change_journal_take(path, pending_path, &num_changes)) return 1;
+    if (num_changes == 0) {
+        fprintf(stderr, "No changes recorded in %s\n", path);
+        unlink(pending_path);
+        return 0;
+    }
+    fprintf(stderr, "Scanning %zu changed paths recorded in %s\n", num_changes, path);
+
+    if (!run_scan((const char *[]){ pending_path }, 1, TASK_REPLAY_JOURNAL, options)) return 1; // Keep the pending changes for the next run
+    unlink(pending_path);
+    return 0;
+}
+
+/* Free the real paths of the roots */
+static void free_scan_roots(char **paths, size_t num_paths) {
+    for (size_t i = 0; i < num_paths; i++) free(paths[i]);
+    free(paths);
+}
+
+/* Resolve the roots of the scan to real paths */
+/*
+  * The excluded roots are dropped, then the duplicated and nested ones (see `scan_roots_normalize()`)
+  *
+  * @param num_paths
+  * Number of the returned paths [OUT], free them with `free_scan_roots()`
+  *
+  * @param num_kept
+  * Number of the paths to be scanned [OUT], they come first
+  *
+  * @return
+  * NULL if a root doesn't exist or isn't a directory or a regular file (a regular file or `STREAM_ARGUMENT` for `TARBALL_OPTION`)
+*/
+static char **resolve_scan_roots(const CommandOptions *options, size_t *num_paths, size_t *num_kept) {
+    char **paths = calloc(options->num_roots, sizeof(char *));
+    if (paths == NULL) {
+        fprintf(stderr, "Failed to allocate the roots\n");
+        return NULL;
+    }
+
+    size_t count = 0;
+    for (size_t i = 0; i < options->num_roots; i++) {
+        if (options->is_tarball && strcmp(options->roots[i], STREAM_ARGUMENT) == 0) { // The tarball is read from the standard input
+            paths[count] = strdup(STREAM_ARGUMENT);
+            if (paths[count] == NULL) {
+                fprintf(stderr, "Failed to allocate the roots\n");
+                free_scan_roots(paths, count);
+                return NULL;
+            }
+            count++;
+            continue;
+        }
+
+        char *real_path = realpath(options->roots[i], NULL);
+        if (real_path == NULL) {
+            fprintf(stderr, "Failed to get real path of %s\n", options->roots[i]);
+            free_scan_roots(paths, count);
+            return NULL;
+        }
+
+        bool is_dir = is_directory(real_path);
+        if ((!is_dir || options->is_tarball) && !is_regular_file(real_path)) {
+            fprintf(stderr, "%s is not %s\n", real_path, options->is_tarball ? "a tarball" : "a directory or a regular file");
+            free(real_path);
+            free_scan_roots(paths, count);
+            return NULL;
+        }
+
+        if (exclusion_rules_match_path(&exclusion_rules, real_path, is_dir)) {
+            fprintf(stderr, "[INFO] %s is excluded, nothing to scan\n", real_path);
+            free(real_path);
+            continue;
+        }
+        paths[count++] = real_path;
+    }
+
+    *num_paths = count;
+    *num_kept = scan_roots_normalize(paths, count);
+    if (*num_kept < count) fprintf(stderr, "[INFO] %zu roots are inside the others or repeated, skipping them\n", count - *num_kept);
+    return paths;
+}
+
+static ScanStats direct_stats; // The counters of a scan without the shared memory
+
+/* Write the final progress record of a scan without the task pools */
+static void write_direct_progress(ResultOutput *output, const CommandOptions *options) {
+    if (options->progress_interval_ms == 0) return;
+
+    StatsSnapshot snapshot;
+    scan_stats_collect(&direct_stats, &snapshot);
+    result_output_write_progress(STDOUT_FILENO, output, snapshot.counters[STAT_FILES_SCANNED], snapshot.counters[STAT_BYTES_SCANNED]);
+}
+
+/* Scan a single file directly without creating a task queue */
+static void scan_file_directly(const char *path, const CommandOptions *options) {
+    ClamavEssentials essentials;
+    if (!clamav_essentials_init(&essentials, &options->profile)) {
+        fprintf(stderr, "Failed to initialize ClamAV essentials\n");
+        return;
+    }
+
+    ResultOutput output;
+    result_output_init(&output, false);
+    essentials.output = &output;
+    atomic_store(&output.format, options->result_format);
+    atomic_store(&output.is_infected_only, options->is_infected_only);
+    if (options->result_format == RESULT_FORMAT_BINARY) {
+        write_all(STDOUT_FILENO, SCAN_RESULT_STREAM_MAGIC, SCAN_RESULT_STREAM_MAGIC_SIZE);
+    }
+
+    VerdictCache cache = { .fd = -1 };
+    char cache_path[MAX_PATH];
+    if (options->use_cache && verdict_cache_default_path(cache_path, sizeof(cache_path)) &&
+        verdict_cache_open(&cache, cache_path, essentials.engine, &essentials.scan_options)) {
+        essentials.verdict_cache = &cache;
+    }
+
+    scan_stats_attach(&direct_stats, STATS_PARENT_SLOT);
+    process_file(path, &essentials, NULL, NULL);
+    write_direct_progress(&output, options);
+    verdict_cache_close(&cache);
+    result_output_clear(&output);
+    clamav_essentials_clear(&essentials);
+}
+
+/* Scan the standard input from memory */
+/*
+  * The daemon takes the stream if there is one, otherwise the whole stream is read before the engine is compiled
+  *
+  * @return
+  * 0 if the stream is scanned, 1 otherwise
+*/
+static int scan_stream(const CommandOptions *options) {
+    bool can_use_daemon = !options->is_background && options->max_rate == 0 && options->max_files_rate == 0 && // Like a path, it doesn't run at the priority and the rate of the caller
+                          options->trace_path == NULL && !options->show_stats && // Its spans and its counters aren't exported by the caller
+                          database_exclusions_hash() == 0; // It loads all the databases
+    DaemonJobOutput output_options = { .is_infected_only = options->is_infected_only, .progress_interval_ms = options->progress_interval_ms };
+    int result = can_use_daemon ? daemon_client_scan_stream(STDIN_FILENO, STREAM_NAME, options->result_format, &options->profile, &output_options) : -1;
+    if (result != -1) return result;
+
+    StreamBuffer buffer;
+    stream_buffer_init(&buffer);
+    cl_error_t error = stream_buffer_read_fd(&buffer, STDIN_FILENO);
+    if (error == CL_EREAD || error == CL_EMEM) {
+        fprintf(stderr, "Failed to read the standard input: %s\n", error == CL_EREAD ? strerror(errno) : cl_strerror(error));
+        stream_buffer_clear(&buffer);
+        return 1;
+    }
+
+    ClamavEssentials essentials;
+    if (!clamav_essentials_init(&essentials, &options->profile)) {
+        fprintf(stderr, "Failed to initialize ClamAV essentials\n");
+        stream_buffer_clear(&buffer);
+        return 1;
+    }
+
+    ResultOutput output;
+    result_output_init(&output, false);
+    essentials.output = &output;
+    atomic_store(&output.format, options->result_format);
+    atomic_store(&output.is_infected_only, options->is_infected_only);
+    if (options->result_format == RESULT_FORMAT_BINARY) {
+        write_all(STDOUT_FILENO, SCAN_RESULT_STREAM_MAGIC, SCAN_RESULT_STREAM_MAGIC_SIZE);
+    }
+
+    scan_stats_attach(&direct_stats, STATS_PARENT_SLOT);
+    process_stream(&buffer, error, STREAM_NAME, &essentials, STDOUT_FILENO); // A stream over `STREAM_MAX_SIZE` is reported as its result
+    write_direct_progress(&output, options);
+    result_output_clear(&output);
+    clamav_essentials_clear(&essentials);
+    stream_buffer_clear(&buffer);
+    return 0;
+}
+
+int main(int argc, const char *argv[]) {
+    CommandOptions options;
+    if (!parse_command_options(argc, argv, &options)) {
+        printf("Usage: %s [%s] [%s] [%s|%s] [%s] [%s] [%s] [%sRULE]... [%sFILE] [%sSIZE] [%sSECONDS] [PROFILE] [LIMITS] <path>... [num_of_processes|%s]\n", argv[0], CACHE_OPTION, CONTENT_CACHE_OPTION, BINARY_OPTION, JSON_OPTION, STATS_OPTION, ONE_FILESYSTEM_OPTION, PRIORITY_OPTION, EXCLUSION_OPTION, EXCLUSION_FILE_OPTION, MAX_FILE_SIZE_OPTION, FILE_TIMEOUT_OPTION, AUTO_SIZING_ARGUMENT);
+        printf("       %s %s [%s] [%s] [%s] [%sRULE]... [%sFILE] [%sSIZE] [PROFILE] [LIMITS] [num_of_processes|%s]\n", argv[0], DAEMON_OPTION, CACHE_OPTION, CONTENT_CACHE_OPTION, PRIORITY_OPTION, EXCLUSION_OPTION, EXCLUSION_FILE_OPTION, MAX_FILE_SIZE_OPTION, AUTO_SIZING_ARGUMENT);
+        printf("       %s [%sFILE|%sFILE] [%sFILE] [OPTIONS]... <path>... [num_of_processes|%s]\n", argv[0], CHECKPOINT_OPTION, RESUME_OPTION, TRACE_OPTION, AUTO_SIZING_ARGUMENT);
+        printf("       %s [%s|%s] [PROFILE] [LIMITS] %s (the standard input)\n", argv[0], BINARY_OPTION, JSON_OPTION, STREAM_ARGUMENT);
+        printf("       %s %s [OPTIONS]... <tarball|%s>... [num_of_processes|%s]\n", argv[0], TARBALL_OPTION, STREAM_ARGUMENT, AUTO_SIZING_ARGUMENT);
+        printf("       %s %s[HOST:]PORT [OPTIONS]... <path>... [num_of_processes]\n", argv[0], COORDINATOR_OPTION);
+        printf("       %s %sHOST:PORT [%s] [%s] [PROFILE] [LIMITS] [num_of_processes|%s]\n", argv[0], PULL_OPTION, CACHE_OPTION, CONTENT_CACHE_OPTION, AUTO_SIZING_ARGUMENT);
+        printf("       %s %s <directory>...\n", argv[0], JOURNAL_OPTION);
+        printf("       %s %s [%s] [%s] [%s|%s] [%s] [%sSECONDS] [PROFILE] [LIMITS] [num_of_processes|%s]\n", argv[0], INCREMENTAL_OPTION, CACHE_OPTION, CONTENT_CACHE_OPTION, BINARY_OPTION, JSON_OPTION, STATS_OPTION, FILE_TIMEOUT_OPTION, AUTO_SIZING_ARGUMENT);
+        printf("LIMITS: [%s] [%sBYTES] [%sFILES] (per second) [%s]\n", BACKGROUND_OPTION, MAX_RATE_OPTION, MAX_FILES_RATE_OPTION, PIN_CPUS_OPTION);
+        printf("OUTPUT: [%s] [%sMILLISECONDS] (with %s or %s)\n", INFECTED_ONLY_OPTION, PROGRESS_OPTION, BINARY_OPTION, JSON_OPTION);
+        printf("PROFILE: [%s<%s|%s|%s|%s>[:<extra options>]] (default %s) [%sDATABASE]...\n", PROFILE_OPTION, SCAN_PROFILE_QUICK, SCAN_PROFILE_FULL, SCAN_PROFILE_ARCHIVE_DEEP, SCAN_PROFILE_PUA, SCAN_PROFILE_DEFAULT, EXCLUDE_DB_OPTION);
+        return 1;
+    }
+
+    /* One `write()` per result line even if the output is a pipe, so the lines don't interleave and aren't lost when a worker is terminated */
+    setvbuf(stdout, NULL, _IOLBF, 0);
+
+    /* Before anything is forked, so every process inherits it (the engine is compiled at the low priority too) */
+    if (options.is_background && apply_background_priority() != BACKGROUND_ALL) {
+        fprintf(stderr, "[WARNING] Some of the background priorities couldn't be applied\n");
+    }
+
+    if (options.is_daemon) return run_daemon(&options);
+    if (options.pull_address != NULL) return run_pull(&options);
+    if (options.is_journal) return run_journal(&options);
+    if (options.is_incremental) return run_incremental(&options);
+
+    if (options.num_roots == 1 && strcmp(options.roots[0], STREAM_ARGUMENT) == 0 && !options.is_tarball) return scan_stream(&options);
+
+    size_t num_paths, num_kept;
+    char **real_paths = resolve_scan_roots(&options, &num_paths, &num_kept);
+    if (real_paths == NULL) return 1;
+    if (num_kept == 0) { // All of them are excluded
+        free_scan_roots(real_paths, num_paths);
+        return 0;
+    }
+
+    if (options.is_tarball) { // Only the producers read the tarballs, neither the daemon nor `cl_scandesc()` get them
+        int tarball_result = run_scan((const char *const *)real_paths, num_kept, TASK_SCAN_TARBALL, &options) ? 0 : 1;
+        free_scan_roots(real_paths, num_paths);
+        return tarball_result;
+    }
+
+    /* Let the daemon scan it if there is one, its engine is already loaded */
+    bool can_use_daemon = num_kept == 1 && options.coordinator_address == NULL && // A job of the daemon has a single root, the coordinator always serves the nodes
+                          !options.is_one_filesystem && !options.has_exclusions && options.checkpoint_path == NULL && // The daemon crosses the file systems, has its own rules and no checkpoint
+                          !options.is_background && options.max_rate == 0 && options.max_files_rate == 0 && // It doesn't run at the priority and the rate of the caller
+                          options.trace_path == NULL && !options.show_stats && // Its spans and its counters aren't exported by the caller
+                          !options.use_content_cache && file_timeout_ns == 0 && !options.is_prioritized && !options.is_pinned && // The job uses the settings of the daemon
+                          database_exclusions_hash() == 0; // It loads all the databases
+    DaemonJobOutput output_options = { .is_infected_only = options.is_infected_only, .progress_interval_ms = options.progress_interval_ms };
+    int result = can_use_daemon ? daemon_client_scan(real_paths[0], options.result_format, &options.profile, &output_options) : -1;
+
+    if (result == -1 && num_kept == 1 && !is_directory(real_paths[0]) && options.coordinator_address == NULL) {
+        // process single file
+        fprintf(stderr, "%s is a regular file, try scanning it directly\n", real_paths[0]);
+        scan_file_directly(real_paths[0], &options);
+        result = 0;
+    }
+    if (result == -1) result = run_scan((const char *const *)real_paths, num_kept, TASK_SCAN_DIR, &options) ? 0 : 1;
+
+    free_scan_roots(real_paths, num_paths);
+    return result;
+}
@@ -0,0 +1,172 @@
+/* content-cache.c
+ *
+ * Copyright 2025 EricLin
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+*/
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "content-cache.h"
+#include "database.h"
+
+#ifndef MAP_NORESERVE
+#define MAP_NORESERVE 0
+#endif
+
+#define CONTENT_ENTRY_BUSY UINT64_MAX
+#define DIGEST_CHUNK_SIZE (256 * 1024)
+
+static uint8_t digest_buffer[DIGEST_CHUNK_SIZE]; // Each process has its own copy after forking
+
+/* Initialize the ContentCache, disabled */
+void content_cache_init(ContentCache *cache) {
+    if (cache == NULL) return;
+
+    cache->entries = NULL;
+}
+
+/* Map the table of the ContentCache */
+bool content_cache_enable(ContentCache *cache) {
+    if (cache == NULL) return false;
+    if (cache->entries != NULL) return true; // Already enabled
+
+    void *entries = mmap(NULL, CONTENT_CACHE_SLOTS * sizeof(ContentCacheEntry), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (entries == MAP_FAILED) {
+        fprintf(stderr, "[ERROR] content_cache_enable: Failed to map the content cache: %s\n", strerror(errno));
+        return false;
+    }
+
+    cache->entries = entries;
+    return true;
+}
+
+/* Clear the ContentCache */
+void content_cache_clear(ContentCache *cache) {
+    if (cache == NULL || cache->entries == NULL) return;
+
+    munmap(cache->entries, CONTENT_CACHE_SLOTS * sizeof(ContentCacheEntry));
+    cache->entries = NULL;
+}
+
+/* Compute the digest of an opened file */
+bool content_digest_compute(int fd, uint64_t size, ContentDigest *digest) {
+    if (fd < 0 || digest == NULL || size > CONTENT_CACHE_MAX_FILE_SIZE) return false;
+
+    void *context = cl_hash_init("sha256");
+    if (context == NULL) return false;
+
+    uint64_t offset = 0;
+    while (offset < size) {
+        size_t length = size - offset < sizeof(digest_buffer) ? (size_t)(size - offset) : sizeof(digest_buffer);
+        ssize_t bytes = pread(fd, digest_buffer, length, (off_t)offset);
+        if (bytes < 0 && errno == EINTR) continue;
+        if (bytes <= 0) break; // Truncated while reading, or an I/O error
+        cl_update_hash(context, digest_buffer, (size_t)bytes);
+        offset += (uint64_t)bytes;
+    }
+
+    cl_finish_hash(context, digest->bytes); // Also frees the context
+    digest->size = size;
+    return offset == size;
+}
+
+/* Get the tag of a digest, never 0 or `CONTENT_ENTRY_BUSY` */
+static inline uint64_t make_tag(const ContentDigest *digest) {
+    uint64_t tag;
+    memcpy(&tag, digest->bytes, sizeof(tag));
+    tag ^= digest->size;
+    return (tag == 0 || tag == CONTENT_ENTRY_BUSY) ? 1 : tag;
+}
+
+static inline bool is_entry_matched(const ContentCacheEntry *entry, const ContentDigest *digest) {
+    return entry->size == digest->size && memcmp(entry->digest, digest->bytes, CONTENT_DIGEST_SIZE) == 0;
+}
+
+/* Look up the verdict of the content */
+bool content_cache_lookup(ContentCache *cache, const ContentDigest *digest, unsigned int generation, cl_error_t *verdict, char virname[CONTENT_VIRNAME_SIZE]) {
+    if (cache == NULL || cache->entries == NULL || digest == NULL || verdict == NULL) return false;
+
+    uint64_t tag = make_tag(digest);
+    uint32_t exclusions = (uint32_t)database_exclusions_hash();
+    for (size_t i = 0; i < CONTENT_CACHE_MAX_PROBES; i++) {
+        ContentCacheEntry *entry = &cache->entries[(tag + i) & (CONTENT_CACHE_SLOTS - 1)];
+
+        uint32_t seq = atomic_load_explicit(&entry->seq, memory_order_acquire);
+        uint64_t entry_tag = atomic_load_explicit(&entry->tag, memory_order_acquire);
+        if (entry_tag == 0) return false; // End of the probe sequence
+        if (entry_tag != tag || (seq & 1) != 0) continue;
+
+        ContentCacheEntry copy;
+        memcpy(&copy, entry, sizeof(copy));
+        atomic_thread_fence(memory_order_acquire);
+        if (atomic_load_explicit(&entry->seq, memory_order_relaxed) != seq) continue; // Rewritten while copying
+
+        if (!is_entry_matched(&copy, digest) || copy.generation != generation || copy.exclusions != exclusions) continue;
+
+        *verdict = (cl_error_t)copy.verdict;
+        if (virname != NULL) {
+            memcpy(virname, copy.virname, CONTENT_VIRNAME_SIZE);
+            virname[CONTENT_VIRNAME_SIZE - 1] = '\0';
+        }
+        return true;
+    }
+    return false;
+}
+
+/* Publish the verdict of the content */
+void content_cache_publish(ContentCache *cache, const ContentDigest *digest, unsigned int generation, cl_error_t verdict, const char *virname) {
+    if (cache == NULL || cache->entries == NULL || digest == NULL) return;
+    if (verdict != CL_CLEAN && verdict != CL_VIRUS) return;
+
+    size_t virname_length = (verdict == CL_VIRUS && virname != NULL) ? strlen(virname) : 0;
+    if (verdict == CL_VIRUS && (virname == NULL || virname_length >= CONTENT_VIRNAME_SIZE)) return;
+
+    uint64_t tag = make_tag(digest);
+    uint32_t exclusions = (uint32_t)database_exclusions_hash();
+    for (size_t i = 0; i < CONTENT_CACHE_MAX_PROBES; i++) {
+        ContentCacheEntry *entry = &cache->entries[(tag + i) & (CONTENT_CACHE_SLOTS - 1)];
+
+        uint64_t entry_tag = atomic_load_explicit(&entry->tag, memory_order_acquire);
+        if (entry_tag == CONTENT_ENTRY_BUSY) continue;
+
+        /* Take an empty entry, or replace the verdict of another engine */
+        bool is_stale = entry_tag != 0 && (entry->generation != generation || entry->exclusions != exclusions);
+        if (entry_tag == tag && !is_stale && is_entry_matched(entry, digest)) return; // Published by another worker
+        if (entry_tag != 0 && !is_stale) continue;
+
+        if (!atomic_compare_exchange_strong_explicit(&entry->tag, &entry_tag, CONTENT_ENTRY_BUSY, memory_order_acquire, memory_order_relaxed)) continue;
+
+        uint32_t seq = atomic_load_explicit(&entry->seq, memory_order_relaxed); // Only changed by the holder of `CONTENT_ENTRY_BUSY`
+        atomic_store_explicit(&entry->seq, seq + 1, memory_order_relaxed);
+        atomic_thread_fence(memory_order_release); // Odd before any field is written
+        entry->size = digest->size;
+        entry->generation = generation;
+        entry->exclusions = exclusions;
+        entry->verdict = (uint32_t)verdict;
+        memcpy(entry->digest, digest->bytes, CONTENT_DIGEST_SIZE);
+        memset(entry->virname, 0, CONTENT_VIRNAME_SIZE);
+        if (virname_length > 0) memcpy(entry->virname, virname, virname_length);
+
+        atomic_store_explicit(&entry->seq, seq + 2, memory_order_release);
+        atomic_store_explicit(&entry->tag, tag, memory_order_release);
+        return;
+    }
+}
@@ -0,0 +1,124 @@
+/* content-cache.h
+ *
+ * Copyright 2025 EricLin
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+*/
+
+/* Content cache */
+/*
+  * The verdicts of the files scanned during this run, keyed by the SHA-256 of the content and the size
+  * It's a lock-free hash table in a shared mapping, a verdict published by a worker is reused by every other worker
+  * So the same bytes under many paths (vendored libraries, copied installers, ...) are only scanned once
+  * The entries carry the engine generation and the hash of the excluded databases, the verdicts of another engine are never reused
+  *
+  * A cryptographic digest is used on purpose, a crafted file must not be able to borrow the clean verdict of another one
+*/
+
+#ifndef CONTENT_CACHE_H
+#define CONTENT_CACHE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <clamav.h>
+
+#define CONTENT_CACHE_SLOTS ((size_t)1 << 18) // Reserved address space, pages are only backed when they are used
+#define CONTENT_CACHE_MAX_PROBES 16 // Give up after probing this many entries
+#define CONTENT_CACHE_MAX_FILE_SIZE ((uint64_t)256 << 20) // Larger files are scanned directly, the digest would cost another full read
+#define CONTENT_DIGEST_SIZE 32 // SHA-256
+#define CONTENT_VIRNAME_SIZE 64 // Longer names aren't published, the report must stay exact
+
+_Static_assert((CONTENT_CACHE_SLOTS & (CONTENT_CACHE_SLOTS - 1)) == 0, "CONTENT_CACHE_SLOTS must be power of 2");
+
+/* Digest of a file */
+typedef struct {
+	uint8_t bytes[CONTENT_DIGEST_SIZE];
+	uint64_t size;
+} ContentDigest;
+
+/* Content cache entry */
+/*
+  * `tag` is 0 for an empty entry, `CONTENT_ENTRY_BUSY` while it's being written, otherwise the first 8 bytes of the digest
+  * `seq` is odd while the entry is being written, the readers retry if it's odd or changed while copying
+  * The tag alone isn't enough, an entry may be rewritten with the same tag (e.g. the same content of a newer engine) during the copy
+*/
+typedef struct {
+	_Atomic uint64_t tag;
+	uint64_t size;
+	uint32_t generation;
+	uint32_t verdict; // `CL_CLEAN` or `CL_VIRUS`
+	uint8_t digest[CONTENT_DIGEST_SIZE];
+	char virname[CONTENT_VIRNAME_SIZE];
+	uint32_t exclusions; // The low bits of `database_exclusions_hash()`
+	_Atomic uint32_t seq;
+} ContentCacheEntry;
+
+_Static_assert(sizeof(ContentCacheEntry) == 128, "ContentCacheEntry must fill 2 cache lines");
+
+typedef struct {
+	ContentCacheEntry *entries; // NULL if the cache isn't used
+} ContentCache;
+
+/* Initialize the ContentCache, disabled */
+void content_cache_init(ContentCache *cache);
+
+/* Map the table of the ContentCache */
+/*
+  * @return
+  * `true` if the table is mapped, `false` otherwise (scan without the cache)
+  *
+  * @warning
+  * This function MUST be called before forking, the mapping is shared with the child processes
+*/
+bool content_cache_enable(ContentCache *cache);
+
+/* Clear the ContentCache */
+void content_cache_clear(ContentCache *cache);
+
+/* Compute the digest of an opened file */
+/*
+  * @param size
+  * The size from `fstat()`, the files larger than `CONTENT_CACHE_MAX_FILE_SIZE` aren't digested
+  *
+  * @return
+  * `true` if the digest is computed, `false` otherwise (the file is too large, can't be read, or changed its size)
+  *
+  * @note
+  * The file is read with `pread()`, its offset isn't moved and the pages stay cached for the scan
+*/
+bool content_digest_compute(int fd, uint64_t size, ContentDigest *digest);
+
+/* Look up the verdict of the content */
+/*
+  * @param virname
+  * Receives the name of the virus if the verdict is `CL_VIRUS`
+  *
+  * @return
+  * `true` if a verdict of the same engine generation is found
+*/
+bool content_cache_lookup(ContentCache *cache, const ContentDigest *digest, unsigned int generation, cl_error_t *verdict, char virname[CONTENT_VIRNAME_SIZE]);
+
+/* Publish the verdict of the content */
+/*
+  * @note
+  * Only `CL_CLEAN` and `CL_VIRUS` are published, the errors are retried by the next copy
+  * Nothing happens if the probe sequence is full, the cache never blocks a worker
+*/
+void content_cache_publish(ContentCache *cache, const ContentDigest *digest, unsigned int generation, cl_error_t verdict, const char *virname);
+
+#endif // CONTENT_CACHE_H
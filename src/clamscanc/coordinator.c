@@ -0,0 +1,1066 @@
+/* coordinator.c
+ *
+ * Copyright 2025 EricLin
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+*/
+
+#define _GNU_SOURCE // For `ppoll()` and `accept4()`
+#include <endian.h>
+#include <errno.h>
+#include <netdb.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+
+#include "coordinator.h"
+#include "stats.h"
+#include "watchdog.h"
+
+#define COORDINATOR_HOST_SIZE 256
+#define COORDINATOR_PORT_SIZE 16
+#define COORDINATOR_NAME_SIZE (COORDINATOR_HOST_SIZE + COORDINATOR_PORT_SIZE + 1) // "<host>:<port>"
+#define COORDINATOR_HELLO_SIZE (COORDINATOR_TOKEN_SIZE + COORDINATOR_VERSION_SIZE + 64)
+#define COORDINATOR_REASON_SIZE (COORDINATOR_VERSION_SIZE + 64)
+#define COORDINATOR_RELAY_SIZE (64 * 1024) // The size of each read from the sockets and the result pipe
+#define COORDINATOR_IDLE_POLL_MS 50 // How often the pool is checked while a node waits for a unit, the producers add the tasks meanwhile
+#define COORDINATOR_LEASE_CHECK_MS 1000 // How often the leases are checked otherwise
+#define COORDINATOR_RETRY_TASKS (COORDINATOR_MAX_NODES * COORDINATOR_MAX_UNIT_TASKS) // Every node may lose its unit
+#define COORDINATOR_MAX_RESULT_SIZE JSON_RESULT_LINE_SIZE(MAX_PATH, SCAN_RESULT_MAX_VIRNAME) // The longest result of a file in any format
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+#define CLAMP(x, low, high) ((x) < (low) ? (low) : ((x) > (high) ? (high) : (x)))
+
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define HOST_BYTE_ORDER "le"
+#else
+#define HOST_BYTE_ORDER "be"
+#endif
+
+/* Growable buffer of the received bytes */
+typedef struct {
+    char *data;
+    size_t length;
+    size_t capacity;
+} MessageBuffer;
+
+/* A unit leased to a node */
+/*
+  * `count` is 0 if the node has no unit, the tasks stay outstanding in the pool until the unit is done
+  * `results` collects the output of the unit, it's written when the unit is done
+  * `checked` is the length of the complete results checked so far, `num_threats` and `num_errors` are counted from them
+*/
+typedef struct {
+    uint64_t id;
+    Task tasks[COORDINATOR_MAX_UNIT_TASKS];
+    size_t count;
+    MessageBuffer results;
+    size_t checked;
+    size_t num_results;
+    uint64_t num_threats;
+    uint64_t num_errors;
+} Lease;
+
+/* A node connected to the coordinator */
+/*
+  * `deadline_ns` is renewed by every message, it only applies during the handshake and while the node has a unit
+  * `output` holds the messages the socket didn't take yet, `output_sent` bytes of it are already sent
+*/
+typedef struct {
+    int fd; // -1 if the slot is free
+    bool is_welcomed;
+    bool wants_unit;
+    size_t unit_tasks;
+    uint64_t deadline_ns;
+    char name[COORDINATOR_NAME_SIZE];
+    MessageBuffer input;
+    MessageBuffer output;
+    size_t output_sent;
+    Lease lease;
+} CoordinatorNode;
+
+/* The state of the worker process serving the units */
+/*
+  * `retry_tasks` are the tasks of the lost units, they are served before the pool
+*/
+static struct {
+    CoordinatorNode nodes[COORDINATOR_MAX_NODES];
+    Task retry_tasks[COORDINATOR_RETRY_TASKS];
+    size_t num_retry_tasks;
+    uint64_t last_unit_id;
+    uint64_t units_done;
+    uint64_t leases_expired;
+} server;
+
+/* Split "[HOST:]PORT", HOST may be a bracketed IPv6 address */
+static bool parse_address(const char *address, char host[COORDINATOR_HOST_SIZE], char port[COORDINATOR_PORT_SIZE]) {
+    const char *colon = strrchr(address, ':');
+    const char *port_text = colon != NULL ? colon + 1 : address;
+    size_t host_length = colon != NULL ? (size_t)(colon - address) : 0;
+    size_t port_length = strlen(port_text);
+
+    if (host_length >= COORDINATOR_HOST_SIZE || port_length == 0 || port_length >= COORDINATOR_PORT_SIZE) return false;
+    if (strspn(port_text, "0123456789") != port_length) return false;
+
+    if (host_length >= 2 && address[0] == '[' && address[host_length - 1] == ']') {
+        address++;
+        host_length -= 2;
+    }
+    memcpy(host, address, host_length);
+    host[host_length] = '\0';
+    memcpy(port, port_text, port_length + 1);
+    return true;
+}
+
+/* Describe the signatures and the profile of the engine */
+static void format_version(const ClamavEssentials *essentials, char *version, size_t size) {
+    char spec[SCAN_PROFILE_SPEC_SIZE];
+    if (!scan_profile_format(&essentials->profile, spec, sizeof(spec))) spec[0] = '\0';
+
+    snprintf(version, size, "%u %llu %s",
+             (unsigned int)cl_engine_get_num(essentials->engine, CL_ENGINE_DB_VERSION, NULL),
+             (unsigned long long)cl_engine_get_num(essentials->engine, CL_ENGINE_DB_TIME, NULL), spec);
+}
+
+/* Get the token shared by the coordinator and the nodes */
+/*
+  * @return
+  * `false` if it's too long or contains a space, `token` is NULL if it isn't set
+*/
+static bool get_token(const char **token) {
+    *token = getenv(COORDINATOR_TOKEN_ENV);
+    if (*token == NULL || (*token)[0] == '\0') {
+        *token = NULL;
+        return true;
+    }
+
+    if (strlen(*token) >= COORDINATOR_TOKEN_SIZE || strpbrk(*token, " \t\n") != NULL) {
+        fprintf(stderr, "[ERROR] $%s must be shorter than %d bytes without spaces\n", COORDINATOR_TOKEN_ENV, COORDINATOR_TOKEN_SIZE);
+        return false;
+    }
+    return true;
+}
+
+/* Compare the tokens without leaking the length of the common prefix */
+static bool is_token_equal(const char *token, const char *expected) {
+    size_t length = strlen(token);
+    size_t expected_length = strlen(expected);
+    unsigned char difference = length != expected_length;
+
+    for (size_t i = 0; i < expected_length; i++) difference |= (unsigned char)(expected[i] ^ token[i < length ? i : 0]);
+    return difference == 0;
+}
+
+/* Write the whole buffer, return `false` if the peer is gone */
+static bool send_bytes(int fd, const void *buffer, size_t size, int flags) {
+    const char *bytes = buffer;
+    while (size > 0) {
+        ssize_t sent = send(fd, bytes, size, flags | MSG_NOSIGNAL); // Never raise `SIGPIPE`, a peer may leave at any time
+        if (sent == -1) {
+            if (errno == EINTR) continue;
+            return false; // Including the timeout of a peer which stopped reading
+        }
+        bytes += sent;
+        size -= (size_t)sent;
+    }
+    return true;
+}
+
+/* Build the header of a message in the network byte order */
+static CoordinatorMessageHeader make_header(CoordinatorMessageType type, uint64_t unit_id, size_t length) {
+    return (CoordinatorMessageHeader){
+        .type = htonl((uint32_t)type),
+        .length = htonl((uint32_t)length),
+        .unit_id = htobe64(unit_id),
+    };
+}
+
+/* Send a message, return `false` if the peer is gone */
+static bool send_message(int fd, CoordinatorMessageType type, uint64_t unit_id, const void *payload, size_t length) {
+    CoordinatorMessageHeader header = make_header(type, unit_id, length);
+    return send_bytes(fd, &header, sizeof(header), length > 0 ? MSG_MORE : 0) && send_bytes(fd, payload, length, 0);
+}
+
+/* Append the bytes to the buffer, return `false` if it can't grow */
+static bool message_buffer_append(MessageBuffer *buffer, const void *data, size_t length) {
+    if (buffer->length + length > buffer->capacity) {
+        size_t capacity = buffer->capacity > 0 ? buffer->capacity : COORDINATOR_RELAY_SIZE;
+        while (capacity < buffer->length + length) capacity *= 2;
+
+        char *data_grown = realloc(buffer->data, capacity);
+        if (data_grown == NULL) return false;
+        buffer->data = data_grown;
+        buffer->capacity = capacity;
+    }
+
+    memcpy(buffer->data + buffer->length, data, length);
+    buffer->length += length;
+    return true;
+}
+
+/* Free the buffer */
+static void message_buffer_clear(MessageBuffer *buffer) {
+    free(buffer->data);
+    *buffer = (MessageBuffer){0};
+}
+
+/* Send the queued messages of a node as far as the socket takes them, never blocks */
+/*
+  * @return
+  * `false` if the node is gone
+*/
+static bool flush_node(CoordinatorNode *node) {
+    MessageBuffer *output = &node->output;
+    while (node->output_sent < output->length) {
+        ssize_t sent = send(node->fd, output->data + node->output_sent, output->length - node->output_sent, MSG_DONTWAIT | MSG_NOSIGNAL);
+        if (sent == -1) {
+            if (errno == EINTR) continue;
+            return errno == EAGAIN || errno == EWOULDBLOCK; // The rest is sent once the socket is writable
+        }
+        node->output_sent += (size_t)sent;
+    }
+
+    output->length = 0; // Keep the buffer for the next messages
+    node->output_sent = 0;
+    return true;
+}
+
+/* Queue a message for a node and send what the socket takes, the coordinator never waits for a slow node */
+/*
+  * @return
+  * `false` if the node is gone or the message can't be queued
+*/
+static bool send_to_node(CoordinatorNode *node, CoordinatorMessageType type, uint64_t unit_id, const void *payload, size_t length) {
+    CoordinatorMessageHeader header = make_header(type, unit_id, length);
+    if (!message_buffer_append(&node->output, &header, sizeof(header))) return false;
+    if (length > 0 && !message_buffer_append(&node->output, payload, length)) return false;
+    return flush_node(node);
+}
+
+/* Read the bytes the peer has sent so far */
+/*
+  * @return
+  * `false` if the peer is gone or the buffer can't grow
+*/
+static bool receive_pending(int fd, MessageBuffer *buffer) {
+    static char chunk[COORDINATOR_RELAY_SIZE];
+
+    while (buffer->length <= sizeof(CoordinatorMessageHeader) + COORDINATOR_MAX_MESSAGE) { // Parse before reading more, a flooding peer is dropped by `peek_message()`
+        ssize_t bytes = recv(fd, chunk, sizeof(chunk), MSG_DONTWAIT);
+        if (bytes == -1 && errno == EINTR) continue;
+        if (bytes == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) return true;
+        if (bytes <= 0) return false;
+
+        if (!message_buffer_append(buffer, chunk, (size_t)bytes)) return false;
+    }
+    return true;
+}
+
+/* Get the next complete message of the buffer */
+/*
+  * @param payload
+  * Points into the buffer [OUT], valid until `drop_message()`
+  *
+  * @return
+  * 1 if a message is complete, 0 if more bytes are needed, -1 if it's too large
+*/
+static int peek_message(const MessageBuffer *buffer, CoordinatorMessageHeader *header, const char **payload) {
+    if (buffer->length < sizeof(*header)) return 0;
+
+    memcpy(header, buffer->data, sizeof(*header));
+    header->type = ntohl(header->type);
+    header->length = ntohl(header->length);
+    header->unit_id = be64toh(header->unit_id);
+
+    if (header->length > COORDINATOR_MAX_MESSAGE) return -1;
+    if (buffer->length < sizeof(*header) + header->length) return 0;
+
+    *payload = buffer->data + sizeof(*header);
+    return 1;
+}
+
+/* Drop the message returned by `peek_message()` */
+static void drop_message(MessageBuffer *buffer, const CoordinatorMessageHeader *header) {
+    size_t size = sizeof(*header) + header->length;
+    memmove(buffer->data, buffer->data + size, buffer->length - size);
+    buffer->length -= size;
+}
+
+/* Initialize the CoordinatorContext and start listening */
+bool coordinator_context_init(CoordinatorContext *context, const char *address, const ClamavEssentials *essentials, ResultFormat format) {
+    if (context == NULL || address == NULL || essentials == NULL) return false;
+
+    context->listen_fd = -1;
+    context->format = format;
+    format_version(essentials, context->version, sizeof(context->version));
+    if (!get_token(&context->token)) return false;
+
+    char host[COORDINATOR_HOST_SIZE], port[COORDINATOR_PORT_SIZE];
+    if (!parse_address(address, host, port)) {
+        fprintf(stderr, "[ERROR] coordinator_context_init: Invalid address %s, expected [HOST:]PORT\n", address);
+        return false;
+    }
+
+    struct addrinfo hints = { .ai_family = AF_UNSPEC, .ai_socktype = SOCK_STREAM, .ai_flags = AI_PASSIVE };
+    struct addrinfo *addresses;
+    int result = getaddrinfo(host[0] != '\0' ? host : NULL, port, &hints, &addresses);
+    if (result != 0) {
+        fprintf(stderr, "[ERROR] coordinator_context_init: Failed to resolve %s: %s\n", address, gai_strerror(result));
+        return false;
+    }
+
+    int saved_errno = 0;
+    for (struct addrinfo *entry = addresses; entry != NULL && context->listen_fd == -1; entry = entry->ai_next) {
+        int fd = socket(entry->ai_family, entry->ai_socktype | SOCK_CLOEXEC, entry->ai_protocol);
+        if (fd == -1) continue;
+
+        int enable = 1;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable)); // Restarting the coordinator must not wait for the old connections
+        if (bind(fd, entry->ai_addr, entry->ai_addrlen) == 0 && listen(fd, COORDINATOR_MAX_NODES) == 0) context->listen_fd = fd;
+        else {
+            saved_errno = errno;
+            close(fd);
+        }
+    }
+    freeaddrinfo(addresses);
+
+    if (context->listen_fd == -1) {
+        fprintf(stderr, "[ERROR] coordinator_context_init: Failed to listen on %s: %s\n", address, strerror(saved_errno));
+        return false;
+    }
+
+    if (context->token == NULL) fprintf(stderr, "[WARNING] $%s isn't set, any host reaching %s can take the units\n", COORDINATOR_TOKEN_ENV, address);
+    fprintf(stderr, "[INFO] Serving the units on %s (signatures %s)\n", address, context->version);
+    return true;
+}
+
+/* Stop listening */
+void coordinator_context_clear(CoordinatorContext *context) {
+    if (context == NULL || context->listen_fd == -1) return;
+
+    close(context->listen_fd);
+    context->listen_fd = -1;
+}
+
+/* Check the HELLO of a node */
+/*
+  * @param reason
+  * Why the node is rejected [OUT]
+  *
+  * @return
+  * `true` if the node is accepted
+*/
+static bool check_hello(const CoordinatorContext *context, const char *payload, size_t length, size_t *num_workers, char reason[COORDINATOR_REASON_SIZE]) {
+    char hello[COORDINATOR_HELLO_SIZE];
+    if (length >= sizeof(hello)) {
+        snprintf(reason, COORDINATOR_REASON_SIZE, "Invalid hello");
+        return false;
+    }
+    memcpy(hello, payload, length);
+    hello[length] = '\0';
+
+    char magic[8], byte_order[4], token[COORDINATOR_TOKEN_SIZE];
+    unsigned int protocol;
+    int offset = -1;
+    if (sscanf(hello, "%7s %u %3s %zu %255s %n", magic, &protocol, byte_order, num_workers, token, &offset) != 5 || offset == -1) { // 255 is `COORDINATOR_TOKEN_SIZE - 1`
+        snprintf(reason, COORDINATOR_REASON_SIZE, "Invalid hello");
+        return false;
+    }
+
+    if (strcmp(magic, COORDINATOR_MAGIC) != 0 || protocol != COORDINATOR_PROTOCOL_VERSION) {
+        snprintf(reason, COORDINATOR_REASON_SIZE, "Unsupported protocol, expected %s %d", COORDINATOR_MAGIC, COORDINATOR_PROTOCOL_VERSION);
+        return false;
+    }
+    if (!is_token_equal(token, context->token != NULL ? context->token : "-")) {
+        snprintf(reason, COORDINATOR_REASON_SIZE, "Invalid token");
+        return false;
+    }
+    if (context->format == RESULT_FORMAT_BINARY && strcmp(byte_order, HOST_BYTE_ORDER) != 0) { // The frames are in the host byte order
+        snprintf(reason, COORDINATOR_REASON_SIZE, "The binary results need the same byte order");
+        return false;
+    }
+    if (strcmp(hello + offset, context->version) != 0) {
+        snprintf(reason, COORDINATOR_REASON_SIZE, "Different signatures or profile, expected %s", context->version);
+        return false;
+    }
+    return true;
+}
+
+/* Take the tasks of the next unit of a node */
+/*
+  * The tasks of the lost units come first, then the biggest file (the longest one of the unit), then the batches of the pool
+  *
+  * @return
+  * Number of the tasks, 0 if there is nothing to scan yet
+*/
+static size_t take_unit(SharedMemory *shm, CoordinatorNode *node) {
+    Lease *lease = &node->lease;
+    size_t limit = node->unit_tasks;
+
+    lease->count = 0;
+    while (lease->count < limit && server.num_retry_tasks > 0) lease->tasks[lease->count++] = server.retry_tasks[--server.num_retry_tasks];
+    if (lease->count < limit) lease->count += task_pool_get_large(&shm->file_tasks, &lease->tasks[lease->count]);
+
+    while (lease->count + MAX_GET_TASKS <= limit) {
+        size_t tasks_to_get = task_pool_get(&shm->file_tasks, 0, false, &lease->tasks[lease->count]);
+        if (tasks_to_get == 0) break;
+        lease->count += tasks_to_get;
+    }
+    return lease->count;
+}
+
+/* Send the unit taken by `take_unit()` */
+static bool send_unit(SharedMemory *shm, CoordinatorNode *node) {
+    Lease *lease = &node->lease;
+
+    size_t length = 0;
+    for (size_t i = 0; i < lease->count; i++) length += strlen(task_path(&shm->arena, &lease->tasks[i])) + 1;
+
+    char *payload = malloc(length);
+    if (payload == NULL) return false;
+
+    char *end = payload;
+    for (size_t i = 0; i < lease->count; i++) {
+        const char *path = task_path(&shm->arena, &lease->tasks[i]);
+        size_t path_length = strlen(path) + 1; // Including '\0'
+        memcpy(end, path, path_length);
+        end += path_length;
+    }
+
+    lease->id = ++server.last_unit_id;
+    lease->results.length = 0;
+    lease->checked = 0;
+    lease->num_results = 0;
+    lease->num_threats = 0;
+    lease->num_errors = 0;
+    node->wants_unit = false;
+    node->deadline_ns = monotonic_ns() + (uint64_t)COORDINATOR_LEASE_TIMEOUT_SEC * 1000000000ULL;
+
+    bool is_sent = send_to_node(node, COORDINATOR_UNIT, lease->id, payload, length);
+    free(payload);
+    return is_sent;
+}
+
+/* Write the output of the finished unit and mark its tasks as done */
+static void finish_lease(SharedMemory *shm, CoordinatorNode *node) {
+    Lease *lease = &node->lease;
+
+    write_all(STDOUT_FILENO, lease->results.data, lease->results.length); // A closed output kills this process with `SIGPIPE`, the watchdog shuts down then
+    for (size_t i = 0; i < lease->count; i++) task_release(&shm->arena, &lease->tasks[i]);
+
+    stats_add(STAT_FILES_SCANNED, lease->count);
+    for (uint64_t i = 0; i < lease->num_threats; i++) stats_record_threat(); // The first one is timed
+    stats_add(STAT_ERRORS, lease->num_errors);
+    task_pool_task_done(&shm->file_tasks, lease->count);
+    lease->count = 0;
+    lease->results.length = 0; // Keep the buffer for the next unit
+    server.units_done++;
+}
+
+/* Check a text line of the results */
+/*
+  * A path may contain a newline, so a line isn't always a whole result and the lines aren't counted
+*/
+static void check_text_result(Lease *lease, const char *line, size_t length) {
+    static const char found[] = " FOUND";
+    static const char error[] = ": SCAN ERROR: ";
+
+    if (length >= sizeof(found) - 1 && memcmp(line + length - (sizeof(found) - 1), found, sizeof(found) - 1) == 0) lease->num_threats++;
+    else if (memmem(line, length, error, sizeof(error) - 1) != NULL) lease->num_errors++;
+}
+
+/* Check a JSON line of the results */
+/*
+  * The quotes of the path are escaped, so the first `"verdict":` is the field
+  *
+  * @return
+  * `false` if it isn't the result of a file
+*/
+static bool check_json_result(Lease *lease, const char *line, size_t length) {
+    static const char start[] = "{\"path\":";
+    static const char verdict[] = ",\"verdict\":\"";
+
+    if (length < sizeof(start) - 1 || memcmp(line, start, sizeof(start) - 1) != 0 || line[length - 1] != '}') return false;
+
+    const char *field = memmem(line, length, verdict, sizeof(verdict) - 1);
+    if (field == NULL) return false;
+    const char *value = field + sizeof(verdict) - 1;
+    size_t value_length = length - (size_t)(value - line);
+
+    if (value_length > strlen(JSON_VERDICT_INFECTED) && strncmp(value, JSON_VERDICT_INFECTED "\"", strlen(JSON_VERDICT_INFECTED) + 1) == 0) lease->num_threats++;
+    else if (value_length > strlen(JSON_VERDICT_ERROR) && strncmp(value, JSON_VERDICT_ERROR "\"", strlen(JSON_VERDICT_ERROR) + 1) == 0) lease->num_errors++;
+    else if (value_length <= strlen(JSON_VERDICT_CLEAN) || strncmp(value, JSON_VERDICT_CLEAN "\"", strlen(JSON_VERDICT_CLEAN) + 1) != 0) return false;
+    return true;
+}
+
+/* Check the results received since the last call */
+/*
+  * Every complete frame or line must be the result of a file, the results of a unit are at most one per file
+  * A frame or a line may be split over the messages, the incomplete rest is checked by the next call
+  *
+  * @return
+  * `false` if the results are corrupted
+*/
+static bool check_unit_results(const CoordinatorContext *context, Lease *lease) {
+    const char *data = lease->results.data;
+    size_t length = lease->results.length;
+
+    while (lease->checked < length) {
+        const char *record = data + lease->checked;
+        size_t available = length - lease->checked;
+        size_t consumed;
+
+        if (context->format == RESULT_FORMAT_BINARY) {
+            ScanResult result;
+            int parsed = scan_result_parse(record, available, &result, &consumed);
+            if (parsed == 0) break;
+            if (parsed == -1 || result.status == SCAN_RESULT_PROGRESS) return false; // The nodes never write the progress
+
+            if (result.status == SCAN_RESULT_INFECTED) lease->num_threats++;
+            else if (result.status == SCAN_RESULT_ERROR) lease->num_errors++;
+            lease->num_results++;
+        }
+        else {
+            const char *newline = memchr(record, '\n', available);
+            if (newline == NULL) break;
+            consumed = (size_t)(newline - record) + 1;
+            if (memchr(record, '\0', consumed) != NULL) return false;
+
+            if (context->format == RESULT_FORMAT_TEXT) check_text_result(lease, record, consumed - 1);
+            else if (check_json_result(lease, record, consumed - 1)) lease->num_results++;
+            else return false;
+        }
+
+        if (lease->num_results > lease->count) return false;
+        lease->checked += consumed;
+    }
+    return length - lease->checked <= COORDINATOR_MAX_RESULT_SIZE; // No result is longer, the rest never completes
+}
+
+/* Add the results of the unit of a node */
+/*
+  * @return
+  * `false` if the node must be dropped
+*/
+static bool add_unit_results(const CoordinatorContext *context, CoordinatorNode *node, const char *payload, size_t length) {
+    Lease *lease = &node->lease;
+    if (lease->results.length + length > lease->count * COORDINATOR_MAX_RESULT_SIZE) {
+        fprintf(stderr, "[WARNING] Node %s sent more results than its %zu files can have\n", node->name, lease->count);
+        return false;
+    }
+    if (!message_buffer_append(&lease->results, payload, length)) return false;
+
+    if (!check_unit_results(context, lease)) {
+        fprintf(stderr, "[WARNING] Node %s sent corrupted results\n", node->name);
+        return false;
+    }
+    return true;
+}
+
+/* Disconnect a node, its unit is scanned again by the others */
+static void drop_node(SharedMemory *shm, CoordinatorNode *node) {
+    Lease *lease = &node->lease;
+    if (lease->count > 0) {
+        fprintf(stderr, "[WARNING] Node %s left with an unfinished unit, its %zu files are scanned again\n", node->name, lease->count);
+
+        size_t num_retry = MIN(lease->count, COORDINATOR_RETRY_TASKS - server.num_retry_tasks);
+        memcpy(&server.retry_tasks[server.num_retry_tasks], lease->tasks, num_retry * sizeof(Task)); // Still outstanding, the pool can't finish without them
+        server.num_retry_tasks += num_retry;
+
+        size_t num_spilled = lease->count - num_retry;
+        for (size_t i = num_retry; i < lease->count; i++) task_pool_add(&shm->file_tasks, NO_DEQUE_OWNER, lease->tasks[i]); // No room left, counted as new tasks and the old ones are done below
+        if (num_spilled > 0) task_pool_task_done(&shm->file_tasks, num_spilled);
+        lease->count = 0;
+    }
+    else if (node->is_welcomed) fprintf(stderr, "[INFO] Node %s left\n", node->name);
+
+    flush_node(node); // Best effort, e.g. the REJECT or the FINISHED
+    message_buffer_clear(&lease->results);
+    message_buffer_clear(&node->input);
+    message_buffer_clear(&node->output);
+    node->output_sent = 0;
+    close(node->fd);
+    node->fd = -1;
+}
+
+/* Handle a message of a node */
+/*
+  * @return
+  * `false` if the node must be dropped
+*/
+static bool handle_message(const CoordinatorContext *context, SharedMemory *shm, CoordinatorNode *node, const CoordinatorMessageHeader *header, const char *payload) {
+    node->deadline_ns = monotonic_ns() + (uint64_t)COORDINATOR_LEASE_TIMEOUT_SEC * 1000000000ULL; // Any message shows the node is alive
+
+    if (!node->is_welcomed) {
+        if (header->type != COORDINATOR_HELLO) return false;
+
+        size_t num_workers = 0;
+        char reason[COORDINATOR_REASON_SIZE];
+        if (!check_hello(context, payload, header->length, &num_workers, reason)) {
+            fprintf(stderr, "[WARNING] Rejected node %s: %s\n", node->name, reason);
+            send_to_node(node, COORDINATOR_REJECT, 0, reason, strlen(reason));
+            return false;
+        }
+
+        node->is_welcomed = true;
+        node->unit_tasks = CLAMP(num_workers * MAX_GET_TASKS * COORDINATOR_UNIT_BATCHES, MAX_GET_TASKS, COORDINATOR_MAX_UNIT_TASKS);
+        fprintf(stderr, "[INFO] Node %s joined with %zu workers\n", node->name, num_workers);
+
+        char welcome[16];
+        int length = snprintf(welcome, sizeof(welcome), "%d", (int)context->format);
+        return send_to_node(node, COORDINATOR_WELCOME, 0, welcome, (size_t)length);
+    }
+
+    bool is_current_unit = node->lease.count > 0 && header->unit_id == node->lease.id;
+    switch (header->type) {
+        case COORDINATOR_REQUEST:
+            node->wants_unit = node->lease.count == 0; // One unit at a time
+            return node->wants_unit;
+        case COORDINATOR_HEARTBEAT:
+            return true;
+        case COORDINATOR_RESULTS:
+            return is_current_unit && add_unit_results(context, node, payload, header->length);
+        case COORDINATOR_DONE:
+            if (!is_current_unit || node->lease.checked != node->lease.results.length) return false; // A result is incomplete
+            finish_lease(shm, node);
+            return true;
+        default:
+            return false;
+    }
+}
+
+/* Accept a new node */
+static void accept_node(const CoordinatorContext *context) {
+    struct sockaddr_storage address;
+    socklen_t address_length = sizeof(address);
+    int fd = accept4(context->listen_fd, (struct sockaddr *)&address, &address_length, SOCK_CLOEXEC);
+    if (fd == -1) return;
+
+    CoordinatorNode *node = NULL;
+    for (size_t i = 0; i < COORDINATOR_MAX_NODES && node == NULL; i++) {
+        if (server.nodes[i].fd == -1) node = &server.nodes[i];
+    }
+    if (node == NULL) {
+        fprintf(stderr, "[WARNING] Too many nodes, refusing the new one\n");
+        close(fd);
+        return;
+    }
+
+    int enable = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(enable));
+
+    *node = (CoordinatorNode){ .fd = fd, .deadline_ns = monotonic_ns() + (uint64_t)COORDINATOR_LEASE_TIMEOUT_SEC * 1000000000ULL };
+    char host[COORDINATOR_HOST_SIZE], port[COORDINATOR_PORT_SIZE];
+    if (getnameinfo((struct sockaddr *)&address, address_length, host, sizeof(host), port, sizeof(port), NI_NUMERICHOST | NI_NUMERICSERV) == 0) {
+        snprintf(node->name, sizeof(node->name), "%s:%s", host, port);
+    }
+    else snprintf(node->name, sizeof(node->name), "(unknown)");
+}
+
+/* Read and handle the messages of a node */
+static void receive_from_node(const CoordinatorContext *context, SharedMemory *shm, CoordinatorNode *node) {
+    bool is_alive = receive_pending(node->fd, &node->input);
+
+    CoordinatorMessageHeader header;
+    const char *payload;
+    int parsed;
+    while ((parsed = peek_message(&node->input, &header, &payload)) == 1) { // The messages sent before leaving still count (e.g. the last DONE)
+        if (!handle_message(context, shm, node, &header, payload)) {
+            if (node->is_welcomed) fprintf(stderr, "[WARNING] Unexpected message %u from node %s\n", (unsigned int)header.type, node->name);
+            drop_node(shm, node);
+            return;
+        }
+        drop_message(&node->input, &header);
+    }
+
+    if (parsed == -1 || !is_alive) drop_node(shm, node);
+}
+
+/* Send the units to the nodes waiting for one */
+/*
+  * @return
+  * `true` if a node is still waiting since the pool has no task yet
+*/
+static bool serve_units(SharedMemory *shm) {
+    for (size_t i = 0; i < COORDINATOR_MAX_NODES; i++) {
+        CoordinatorNode *node = &server.nodes[i];
+        if (node->fd == -1 || !node->wants_unit) continue;
+
+        if (take_unit(shm, node) == 0) return true;
+        if (!send_unit(shm, node)) drop_node(shm, node);
+    }
+    return false;
+}
+
+/* Drop the nodes which didn't answer in time */
+static void expire_nodes(SharedMemory *shm) {
+    uint64_t now = monotonic_ns();
+    for (size_t i = 0; i < COORDINATOR_MAX_NODES; i++) {
+        CoordinatorNode *node = &server.nodes[i];
+        bool has_deadline = !node->is_welcomed || node->lease.count > 0; // An idle node waiting for a unit never times out
+        if (node->fd == -1 || !has_deadline || now <= node->deadline_ns) continue;
+
+        fprintf(stderr, "[WARNING] Node %s didn't answer for %d s, dropping it\n", node->name, COORDINATOR_LEASE_TIMEOUT_SEC);
+        if (node->lease.count > 0) {
+            server.leases_expired++;
+            stats_add(STAT_LEASES_EXPIRED, 1);
+        }
+        drop_node(shm, node);
+    }
+}
+
+/* Check whether all the units are done, no task can be added once the producers are done */
+static bool is_scan_finished(SharedMemory *shm) {
+    return get_status(&shm->current_status) == STATUS_PRODUCER_DONE && is_task_pool_idle(&shm->file_tasks);
+}
+
+/* Serve the file tasks to the nodes */
+void coordinator_main(CoordinatorContext *context, SharedMemory *shm) {
+    if (context == NULL || shm == NULL || !is_coordinator_context_active(context)) return;
+
+    for (size_t i = 0; i < COORDINATOR_MAX_NODES; i++) server.nodes[i].fd = -1;
+
+    struct pollfd fds[COORDINATOR_MAX_NODES + 1];
+    bool is_finished = false;
+    while (get_status(&shm->current_status) != STATUS_FORCE_QUIT) {
+        bool is_waiting = serve_units(shm);
+        if ((is_finished = is_scan_finished(shm))) break;
+
+        fds[0] = (struct pollfd){ .fd = context->listen_fd, .events = POLLIN };
+        for (size_t i = 0; i < COORDINATOR_MAX_NODES; i++) { // Ignored by `poll()` if the fd is -1
+            CoordinatorNode *node = &server.nodes[i];
+            fds[i + 1] = (struct pollfd){ .fd = node->fd, .events = POLLIN | (node->output.length > 0 ? POLLOUT : 0) };
+        }
+
+        int poll_result = poll(fds, COORDINATOR_MAX_NODES + 1, is_waiting ? COORDINATOR_IDLE_POLL_MS : COORDINATOR_LEASE_CHECK_MS);
+        if (poll_result == -1) {
+            if (errno == EINTR) continue;
+            fprintf(stderr, "[ERROR] coordinator_main: Failed to poll the nodes: %s\n", strerror(errno));
+            set_status(&shm->current_status, STATUS_FORCE_QUIT); // The units can't be served anymore
+            break;
+        }
+
+        if (fds[0].revents & POLLIN) accept_node(context);
+        for (size_t i = 0; i < COORDINATOR_MAX_NODES; i++) {
+            CoordinatorNode *node = &server.nodes[i];
+            if (fds[i + 1].fd == -1 || fds[i + 1].revents == 0 || node->fd != fds[i + 1].fd) continue; // Dropped or replaced meanwhile
+
+            if (fds[i + 1].revents & POLLOUT) {
+                if (!flush_node(node)) {
+                    drop_node(shm, node);
+                    continue;
+                }
+            }
+            if (fds[i + 1].revents & ~POLLOUT) receive_from_node(context, shm, node);
+        }
+        expire_nodes(shm);
+    }
+
+    for (size_t i = 0; i < COORDINATOR_MAX_NODES; i++) {
+        CoordinatorNode *node = &server.nodes[i];
+        if (node->fd == -1) continue;
+        if (is_finished && node->is_welcomed) send_to_node(node, COORDINATOR_FINISHED, 0, NULL, 0); // The nodes wait for the next scan
+        node->is_welcomed = false; // Leaving quietly
+        drop_node(shm, node);
+    }
+
+    fprintf(stderr, "[INFO] %llu units were scanned by the nodes, %llu leases expired\n",
+            (unsigned long long)server.units_done, (unsigned long long)server.leases_expired);
+
+    /* Last, the watchdog terminates this process right after the notification */
+    CurrentStatus expected = STATUS_PRODUCER_DONE;
+    if (is_finished && atomic_compare_exchange_strong(&shm->current_status, &expected, STATUS_ALL_TASKS_DONE)) notify_watchdog(&shm->worker_observer);
+}
+
+/* The end of a connection to the coordinator */
+typedef enum {
+    PULL_LOST, // The connection is lost, connect again
+    PULL_FINISHED, // The scan is finished, wait for the next one
+    PULL_REJECTED, // The node can't join
+} PullResult;
+
+/* Connect to the coordinator, return the socket or -1 */
+/*
+  * @note
+  * `connect()` gives up after `COORDINATOR_RETRY_SEC`, so a termination signal waits at most that long
+*/
+static int connect_to_coordinator(const char *host, const char *port) {
+    struct addrinfo hints = { .ai_family = AF_UNSPEC, .ai_socktype = SOCK_STREAM };
+    struct addrinfo *addresses;
+    if (getaddrinfo(host, port, &hints, &addresses) != 0) return -1;
+
+    int socket_fd = -1;
+    for (struct addrinfo *entry = addresses; entry != NULL && socket_fd == -1; entry = entry->ai_next) {
+        socket_fd = socket(entry->ai_family, entry->ai_socktype | SOCK_CLOEXEC, entry->ai_protocol);
+        if (socket_fd == -1) continue;
+
+        struct timeval timeout = { .tv_sec = COORDINATOR_RETRY_SEC, .tv_usec = 0 };
+        setsockopt(socket_fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+        if (connect(socket_fd, entry->ai_addr, entry->ai_addrlen) == -1) {
+            close(socket_fd);
+            socket_fd = -1;
+        }
+    }
+    freeaddrinfo(addresses);
+    if (socket_fd == -1) return -1;
+
+    int enable = 1;
+    struct timeval timeout = { .tv_sec = COORDINATOR_LEASE_TIMEOUT_SEC, .tv_usec = 0 };
+    setsockopt(socket_fd, IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(enable));
+    setsockopt(socket_fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout)); // The coordinator drops us after that anyway
+    return socket_fd;
+}
+
+/* Start scanning a unit, the persistent workers pick it up */
+/*
+  * @return
+  * Number of the files added, 0 if the unit has no valid path
+*/
+static size_t start_unit(SharedMemory *shm, const char *payload, size_t length) {
+    atomic_store(&shm->cancel_job, false);
+
+    size_t count = 0;
+    const char *end = payload + length;
+    for (const char *path = payload; path < end; path += strlen(path) + 1) {
+        if (memchr(path, '\0', (size_t)(end - path)) == NULL) break; // Not terminated
+
+        Task task;
+        if (path[0] != '/' || !build_task(&shm->arena, TASK_SCAN_FILE, path, NULL, &task)) {
+            fprintf(stderr, "[WARNING] Skipping the invalid path of the unit: %s\n", path);
+            continue;
+        }
+        task_pool_add(&shm->file_tasks, NO_DEQUE_OWNER, task);
+        count++;
+    }
+    if (count == 0) return 0;
+
+    /* There is nothing to traverse, the worker finishing the last file ends the job (after the tasks are added, so the pool never looks finished in between) */
+    set_status(&shm->current_status, STATUS_PRODUCER_DONE);
+    task_pool_wake_all(&shm->file_tasks);
+    return count;
+}
+
+/* Relay the pending output of the workers to the coordinator */
+/*
+  * @return
+  * `false` if the coordinator is gone
+*/
+static bool relay_results(DaemonContext *context, int socket_fd, uint64_t unit_id, bool is_connected) {
+    static char buffer[COORDINATOR_RELAY_SIZE];
+
+    while (true) {
+        ssize_t bytes = read(context->result_pipe[0], buffer, sizeof(buffer));
+        if (bytes == -1 && errno == EINTR) continue;
+        if (bytes <= 0) break; // Drained (`EAGAIN`)
+
+        if (is_connected) is_connected = send_message(socket_fd, COORDINATOR_RESULTS, unit_id, buffer, (size_t)bytes); // Keep draining after the coordinator left, the workers must never block on a full pipe
+    }
+    return is_connected;
+}
+
+/* Drain the notification of the finished job */
+static bool take_job_done(DaemonContext *context) {
+    char done[16];
+    bool is_done = false;
+    while (read(context->job_done_pipe[0], done, sizeof(done)) > 0) is_done = true;
+    return is_done;
+}
+
+/* Drop the rest of the unit and wait until the workers are idle again */
+static void abandon_unit(DaemonContext *context, SharedMemory *shm, const sigset_t *orig_mask) {
+    atomic_store(&shm->cancel_job, true);
+
+    struct pollfd fds[] = {
+        { .fd = context->result_pipe[0], .events = POLLIN },
+        { .fd = context->job_done_pipe[0], .events = POLLIN },
+    };
+    while (get_status(&shm->current_status) != STATUS_FORCE_QUIT) {
+        if (ppoll(fds, 2, NULL, orig_mask) == -1 && errno != EINTR) break;
+
+        relay_results(context, -1, 0, false);
+        if ((fds[1].revents & POLLIN) && take_job_done(context)) break;
+    }
+}
+
+/* Handle a message of the coordinator */
+/*
+  * @param unit_id
+  * The unit being scanned [IN/OUT], 0 if the workers are idle
+  *
+  * @return
+  * `false` if the connection ends, `result` tells why
+*/
+static bool handle_coordinator_message(DaemonContext *context, SharedMemory *shm, int socket_fd,
+                                       const CoordinatorMessageHeader *header, const char *payload, uint64_t *unit_id, PullResult *result) {
+    switch (header->type) {
+        case COORDINATOR_WELCOME: {
+            char text[16];
+            if (header->length == 0 || header->length >= sizeof(text)) return false;
+            memcpy(text, payload, header->length);
+            text[header->length] = '\0';
+
+            int format = atoi(text);
+            if (format < RESULT_FORMAT_TEXT || format > RESULT_FORMAT_JSON) return false;
+
+            atomic_store(&shm->result_output.format, (ResultFormat)format); // The workers are idle, the format applies from the first result
+            fprintf(stderr, "[INFO] Joined the coordinator\n");
+            return send_message(socket_fd, COORDINATOR_REQUEST, 0, NULL, 0);
+        }
+        case COORDINATOR_REJECT:
+            fprintf(stderr, "[ERROR] The coordinator rejected this node: %.*s\n", (int)header->length, payload);
+            *result = PULL_REJECTED;
+            return false;
+        case COORDINATOR_UNIT:
+            if (*unit_id != 0 || header->unit_id == 0) return false; // One unit at a time
+
+            if (start_unit(shm, payload, header->length) > 0) *unit_id = header->unit_id;
+            else return send_message(socket_fd, COORDINATOR_DONE, header->unit_id, NULL, 0) &&
+                        send_message(socket_fd, COORDINATOR_REQUEST, 0, NULL, 0);
+            return true;
+        case COORDINATOR_FINISHED:
+            *result = PULL_FINISHED;
+            return false;
+        default:
+            return false;
+    }
+}
+
+/* Scan the units of a connected coordinator */
+static PullResult serve_coordinator(DaemonContext *context, SharedMemory *shm, int socket_fd, const char *hello, const sigset_t *orig_mask) {
+    PullResult result = PULL_LOST;
+    if (!send_message(socket_fd, COORDINATOR_HELLO, 0, hello, strlen(hello))) return result;
+
+    MessageBuffer input = {0};
+    uint64_t unit_id = 0; // The unit being scanned, 0 if none
+    bool is_connected = true;
+
+    struct pollfd fds[] = {
+        { .fd = context->result_pipe[0], .events = POLLIN },
+        { .fd = context->job_done_pipe[0], .events = POLLIN },
+        { .fd = socket_fd, .events = POLLIN },
+    };
+    struct timespec heartbeat = { .tv_sec = COORDINATOR_HEARTBEAT_SEC, .tv_nsec = 0 };
+
+    while (is_connected && get_status(&shm->current_status) != STATUS_FORCE_QUIT) {
+        int poll_result = ppoll(fds, 3, unit_id != 0 ? &heartbeat : NULL, orig_mask);
+        if (get_status(&shm->current_status) == STATUS_FORCE_QUIT) break; // Shutting down, the workers will be terminated
+
+        if (poll_result == -1) {
+            if (errno == EINTR) continue;
+            fprintf(stderr, "[ERROR] coordinator_pull_main: Failed to poll: %s\n", strerror(errno));
+            break;
+        }
+        if (poll_result == 0) { // A file takes long, tell the coordinator we are alive
+            is_connected = send_message(socket_fd, COORDINATOR_HEARTBEAT, unit_id, NULL, 0);
+            continue;
+        }
+
+        if (fds[0].revents & POLLIN) is_connected = relay_results(context, socket_fd, unit_id, is_connected);
+
+        if ((fds[1].revents & POLLIN) && take_job_done(context) && unit_id != 0) {
+            is_connected = relay_results(context, socket_fd, unit_id, is_connected) && // The results are written before the last task is marked as done, so this drains all of them
+                           send_message(socket_fd, COORDINATOR_DONE, unit_id, NULL, 0) &&
+                           send_message(socket_fd, COORDINATOR_REQUEST, 0, NULL, 0);
+            unit_id = 0;
+        }
+
+        if (is_connected && fds[2].revents) {
+            bool is_alive = receive_pending(socket_fd, &input);
+
+            CoordinatorMessageHeader header;
+            const char *payload;
+            int parsed = 0;
+            while (is_connected && (parsed = peek_message(&input, &header, &payload)) == 1) { // The messages sent before leaving still count (e.g. FINISHED)
+                is_connected = handle_coordinator_message(context, shm, socket_fd, &header, payload, &unit_id, &result);
+                drop_message(&input, &header);
+            }
+            if (parsed == -1 || !is_alive) is_connected = false;
+        }
+    }
+
+    if (unit_id != 0 && get_status(&shm->current_status) != STATUS_FORCE_QUIT) {
+        fprintf(stderr, "[WARNING] Lost the coordinator, dropping the unit\n");
+        abandon_unit(context, shm, orig_mask);
+    }
+    message_buffer_clear(&input);
+    return result;
+}
+
+/* Sleep before connecting again, return early if a signal arrives */
+static void wait_for_retry(const sigset_t *orig_mask) {
+    struct timespec timeout = { .tv_sec = COORDINATOR_RETRY_SEC, .tv_nsec = 0 };
+    ppoll(NULL, 0, &timeout, orig_mask);
+}
+
+/* Scan the units of a coordinator */
+int coordinator_pull_main(DaemonContext *context, SharedMemory *shm, const char *address, size_t num_workers) {
+    if (context == NULL || shm == NULL || address == NULL || !is_daemon_context_active(context)) return 1;
+
+    char host[COORDINATOR_HOST_SIZE], port[COORDINATOR_PORT_SIZE];
+    if (!parse_address(address, host, port) || host[0] == '\0') {
+        fprintf(stderr, "[ERROR] coordinator_pull_main: Invalid address %s, expected HOST:PORT\n", address);
+        return 1;
+    }
+
+    const char *token;
+    if (!get_token(&token)) return 1;
+
+    char version[COORDINATOR_VERSION_SIZE];
+    char hello[COORDINATOR_HELLO_SIZE];
+    format_version(&shm->essentials, version, sizeof(version));
+    snprintf(hello, sizeof(hello), "%s %d %s %zu %s %s", COORDINATOR_MAGIC, COORDINATOR_PROTOCOL_VERSION, HOST_BYTE_ORDER, num_workers, token != NULL ? token : "-", version);
+
+    /* Block the termination signals while checking the status, `ppoll()` unblocks them atomically so no signal can be missed */
+    sigset_t blocked_mask, orig_mask;
+    sigemptyset(&blocked_mask);
+    sigaddset(&blocked_mask, SIGINT);
+    sigaddset(&blocked_mask, SIGTERM);
+    sigprocmask(SIG_BLOCK, &blocked_mask, &orig_mask);
+
+    fprintf(stderr, "[INFO] Pulling the units from %s with %zu workers (signatures %s)\n", address, num_workers, version);
+
+    int exit_status = 0;
+    bool is_waiting = false; // Report an unreachable coordinator once
+    while (get_status(&shm->current_status) != STATUS_FORCE_QUIT) {
+        int socket_fd = connect_to_coordinator(host, port);
+        if (socket_fd == -1) {
+            if (!is_waiting) fprintf(stderr, "[INFO] Waiting for the coordinator on %s\n", address);
+            is_waiting = true;
+            wait_for_retry(&orig_mask);
+            continue;
+        }
+        is_waiting = false;
+
+        PullResult result = serve_coordinator(context, shm, socket_fd, hello, &orig_mask);
+        close(socket_fd);
+
+        if (result == PULL_REJECTED) {
+            exit_status = 1;
+            break;
+        }
+        if (result == PULL_FINISHED) fprintf(stderr, "[INFO] The coordinator finished the scan, waiting for the next one\n");
+        wait_for_retry(&orig_mask); // The coordinator of the next scan may not be listening yet
+    }
+
+    sigprocmask(SIG_SETMASK, &orig_mask, NULL); // Restore the signal mask
+    return exit_status;
+}
@@ -0,0 +1,154 @@
+/* coordinator.h
+ *
+ * Copyright 2025 EricLin
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+*/
+
+/* Distributed scan over several hosts */
+/*
+  * The coordinator (`--coordinator=HOST:PORT`) traverses the roots with its producers, its single worker serves the file tasks as leased units over TCP
+  * A node (`--pull=HOST:PORT`) scans the units with its own engine and workers like a daemon job, and streams the output back
+  * The output of a unit is written when the node reports it's done, so a unit scanned again after its lease expired is never reported twice
+  * A lease expires if the node sends nothing for `COORDINATOR_LEASE_TIMEOUT_SEC`, the node is dropped and its unit goes back to the pool
+  * A node is only accepted with the same signatures and profile as the coordinator, and the same token if `$CLAMSCANC_COORDINATOR_TOKEN` is set
+  *
+  * The nodes must see the files under the same paths (e.g. the same NFS or Ceph mount), the coordinator never sends the content
+  * The connection isn't encrypted, only use it on a trusted network
+  *
+  * Every message is a CoordinatorMessageHeader followed by `length` bytes:
+  * HELLO (node): "<magic> <protocol> <byte order> <workers> <token or -> <signatures>", the token can't contain spaces
+  * WELCOME (coordinator): "<ResultFormat>", REJECT (coordinator): the reason
+  * REQUEST (node): ask for the next unit, it's answered by UNIT once the pool has tasks, or FINISHED at the end of the scan
+  * UNIT (coordinator): the paths of the unit, each terminated by '\0'
+  * RESULTS (node): the output of the unit so far, HEARTBEAT (node): still scanning, DONE (node): the unit is finished
+*/
+
+#ifndef COORDINATOR_H
+#define COORDINATOR_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "daemon.h"
+#include "manager.h"
+
+#define COORDINATOR_OPTION "--coordinator=" // Serve the units on "[HOST:]PORT"
+#define PULL_OPTION "--pull=" // Scan the units of the coordinator on "HOST:PORT"
+#define COORDINATOR_TOKEN_ENV "CLAMSCANC_COORDINATOR_TOKEN" // Shared by the coordinator and the nodes
+#define COORDINATOR_MAGIC "WMCO"
+#define COORDINATOR_PROTOCOL_VERSION 1
+#define COORDINATOR_MAX_NODES 64 // Further connections are refused
+#define COORDINATOR_UNIT_BATCHES 4 // A unit holds this many batches per worker of the node, so the workers rarely wait for the last file of a unit
+#define COORDINATOR_MAX_UNIT_TASKS 1024
+#define COORDINATOR_MAX_MESSAGE ((uint32_t)4 << 20) // Larger messages drop the connection
+#define COORDINATOR_LEASE_TIMEOUT_SEC 30 // A node silent for this long is dropped, its unit is scanned by another node
+#define COORDINATOR_HEARTBEAT_SEC 5 // How often a busy node reports it's alive
+#define COORDINATOR_RETRY_SEC 5 // How long a node waits before connecting again
+#define COORDINATOR_TOKEN_SIZE 256
+#define COORDINATOR_VERSION_SIZE 96 // "<db version> <db time> <profile>"
+
+/* Message types */
+typedef enum {
+	COORDINATOR_HELLO = 1,
+	COORDINATOR_WELCOME,
+	COORDINATOR_REJECT,
+	COORDINATOR_REQUEST,
+	COORDINATOR_UNIT,
+	COORDINATOR_RESULTS,
+	COORDINATOR_HEARTBEAT,
+	COORDINATOR_DONE,
+	COORDINATOR_FINISHED
+} CoordinatorMessageType;
+
+/* Message header, all the fields are in the network byte order */
+/*
+  * `unit_id` is the unit of UNIT, RESULTS and DONE, 0 for the other messages
+*/
+typedef struct {
+	uint32_t type;
+	uint32_t length;
+	uint64_t unit_id;
+} CoordinatorMessageHeader;
+
+_Static_assert(sizeof(CoordinatorMessageHeader) == 16, "CoordinatorMessageHeader must be 16 bytes");
+
+/* Coordinator context */
+/*
+  * `listen_fd` is opened before forking, the worker process serving the units inherits it
+  * `version` is compared with the HELLO of every node
+*/
+typedef struct {
+	int listen_fd;
+	ResultFormat format;
+	char version[COORDINATOR_VERSION_SIZE];
+	const char *token; // NULL if `$CLAMSCANC_COORDINATOR_TOKEN` isn't set
+} CoordinatorContext;
+
+/* Check whether the coordinator is serving the units */
+static inline bool is_coordinator_context_active(const CoordinatorContext *context) {
+	return context->listen_fd != -1;
+}
+
+/* Initialize the CoordinatorContext and start listening */
+/*
+  * @param address
+  * "[HOST:]PORT", all the addresses if HOST is omitted
+  *
+  * @param essentials
+  * The engine and the profile the nodes must match
+  *
+  * @param format
+  * The format of the output, the nodes write it in the same format
+  *
+  * @return
+  * `true` if the socket is listening, `false` otherwise (e.g. the port is used)
+*/
+bool coordinator_context_init(CoordinatorContext *context, const char *address, const ClamavEssentials *essentials, ResultFormat format);
+
+/* Stop listening */
+void coordinator_context_clear(CoordinatorContext *context);
+
+/* Serve the file tasks to the nodes */
+/*
+  * Return when all the tasks are done (the status is moved to `STATUS_ALL_TASKS_DONE`) or `STATUS_FORCE_QUIT` is set
+  *
+  * @warning
+  * This function MUST be called by the only worker process of the coordinator
+*/
+void coordinator_main(CoordinatorContext *context, SharedMemory *shm);
+
+/* Scan the units of a coordinator */
+/*
+  * Keep connecting to the coordinator, a finished or lost coordinator is waited for again
+  * Return when `STATUS_FORCE_QUIT` is set (e.g. `SIGINT` or `SIGTERM`) or the coordinator rejects the node
+  *
+  * @param context
+  * Initialized with `daemon_context_init_relay()`, the workers write their output to its result pipe
+  *
+  * @param num_workers
+  * Number of the workers, the coordinator sizes the units for them
+  *
+  * @return
+  * 0 if terminated, 1 if rejected
+  *
+  * @warning
+  * This function should be called in the main process (parent process), after spawning the worker processes
+*/
+int coordinator_pull_main(DaemonContext *context, SharedMemory *shm, const char *address, size_t num_workers);
+
+#endif // COORDINATOR_H
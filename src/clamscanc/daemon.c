@@ -0,0 +1,930 @@
+/* daemon.c
+ *
+ * Copyright 2025 EricLin
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+*/
+
+#define _GNU_SOURCE // For `ppoll()`, `accept4()` and `struct ucred`
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include "daemon.h"
+
+#define RELAY_BUFFER_SIZE (64 * 1024) // The size of each read from the result pipe
+#define REQUEST_BUFFER_SIZE (MAX_PATH + sizeof(DAEMON_REQUEST_STREAM_BINARY) + SCAN_PROFILE_SPEC_SIZE + 1) // "BSTREAM " + profile + ' ' + path + '\n'
+#define ERROR_PREFIX "[ERROR]"
+#define MIN(a, b) ((a) < (b) ? (a) : (b)) // For calculating the minimum value
+
+/* Get the path of the daemon socket */
+bool daemon_socket_path(char *path, size_t size) {
+    if (path == NULL || size == 0) return false;
+
+    const char *env_path = getenv(DAEMON_SOCKET_ENV);
+    const char *runtime_dir = getenv("XDG_RUNTIME_DIR");
+    int length;
+
+    if (env_path != NULL && env_path[0] != '\0') length = snprintf(path, size, "%s", env_path);
+    else if (runtime_dir != NULL && runtime_dir[0] != '\0') length = snprintf(path, size, "%s/%s", runtime_dir, DAEMON_SOCKET_NAME);
+    else length = snprintf(path, size, "/tmp/clamscanc-%u.sock", (unsigned int)getuid());
+
+    return length > 0 && (size_t)length < size;
+}
+
+/* Build the socket address of the daemon */
+static bool build_socket_address(const char *path, struct sockaddr_un *address) {
+    memset(address, 0, sizeof(*address));
+    address->sun_family = AF_UNIX;
+
+    if (strlen(path) >= sizeof(address->sun_path)) return false;
+    memcpy(address->sun_path, path, strlen(path) + 1);
+    return true;
+}
+
+/* Connect to the daemon socket, return the socket or -1 */
+static int connect_to_daemon(const char *path) {
+    struct sockaddr_un address;
+    if (!build_socket_address(path, &address)) return -1;
+
+    int socket_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (socket_fd == -1) return -1;
+
+    if (connect(socket_fd, (struct sockaddr *)&address, sizeof(address)) == -1) {
+        close(socket_fd);
+        return -1;
+    }
+    return socket_fd;
+}
+
+/* Write the whole buffer, return `false` if the peer is gone */
+static bool send_all(int fd, const char *buffer, size_t size) {
+    while (size > 0) {
+        ssize_t sent = send(fd, buffer, size, MSG_NOSIGNAL); // Never raise `SIGPIPE`, a client may leave at any time
+        if (sent == -1) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        buffer += sent;
+        size -= (size_t)sent;
+    }
+    return true;
+}
+
+/* Send an error line to the client */
+static void send_error(int client_fd, const char *message, const char *path) {
+    char line[REQUEST_BUFFER_SIZE + 64];
+    int length = snprintf(line, sizeof(line), ERROR_PREFIX " %s%s%s\n", message, path != NULL ? ": " : "", path != NULL ? path : "");
+    if (length > 0) send_all(client_fd, line, MIN((size_t)length, sizeof(line) - 1));
+}
+
+/* Create a pipe whose read end doesn't block */
+static bool create_pipe(int *pipe_fd) {
+    if (pipe(pipe_fd) == -1) return false;
+
+    fcntl(pipe_fd[0], F_SETFD, FD_CLOEXEC);
+    fcntl(pipe_fd[1], F_SETFD, FD_CLOEXEC);
+    fcntl(pipe_fd[0], F_SETFL, fcntl(pipe_fd[0], F_GETFL) | O_NONBLOCK);
+    return true;
+}
+
+/* Close both ends of a pipe */
+static void close_pipe(int *pipe_fd) {
+    for (int i = 0; i < 2; i++) {
+        if (pipe_fd[i] != -1) close(pipe_fd[i]);
+        pipe_fd[i] = -1;
+    }
+}
+
+/* Reset the DaemonContext, nothing is opened */
+static void reset_context(DaemonContext *context) {
+    context->listen_fd = -1;
+    context->client_fd = -1;
+    context->result_pipe[0] = context->result_pipe[1] = -1;
+    context->job_done_pipe[0] = context->job_done_pipe[1] = -1;
+    context->reloader.inotify_fd = -1;
+    context->reloader.done_pipe[0] = context->reloader.done_pipe[1] = -1;
+    context->reloader.is_compiling = false;
+    memset(context->engines, 0, sizeof(context->engines));
+    context->db_generation = 0;
+    context->use_clock = 0;
+    context->file_timeout_ns = 0;
+    if (context->default_profile.name[0] == '\0') scan_profile_init(&context->default_profile, SCAN_PROFILE_DEFAULT, 0);
+}
+
+/* Initialize the DaemonContext and start listening */
+bool daemon_context_init(DaemonContext *context) {
+    if (context == NULL) return false;
+    reset_context(context);
+
+    struct sockaddr_un address;
+    if (!daemon_socket_path(context->socket_path, sizeof(context->socket_path)) ||
+        !build_socket_address(context->socket_path, &address)) {
+        fprintf(stderr, "[ERROR] daemon_context_init: The socket path is too long\n");
+        context->socket_path[0] = '\0';
+        return false;
+    }
+
+    /* Remove the stale socket left by a crashed daemon, but never steal a living one */
+    int running_fd = connect_to_daemon(context->socket_path);
+    if (running_fd != -1) {
+        close(running_fd);
+        fprintf(stderr, "[ERROR] daemon_context_init: Another daemon is listening on %s\n", context->socket_path);
+        context->socket_path[0] = '\0';
+        return false;
+    }
+    unlink(context->socket_path);
+
+    context->listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (context->listen_fd == -1) {
+        fprintf(stderr, "[ERROR] daemon_context_init: Failed to create the socket: %s\n", strerror(errno));
+        daemon_context_clear(context);
+        return false;
+    }
+
+    mode_t orig_umask = umask(0077); // Only the owner can submit jobs
+    int bind_result = bind(context->listen_fd, (struct sockaddr *)&address, sizeof(address));
+    umask(orig_umask);
+
+    if (bind_result == -1 || listen(context->listen_fd, 16) == -1) {
+        fprintf(stderr, "[ERROR] daemon_context_init: Failed to listen on %s: %s\n", context->socket_path, strerror(errno));
+        daemon_context_clear(context);
+        return false;
+    }
+
+    if (!create_pipe(context->result_pipe) || !create_pipe(context->job_done_pipe)) {
+        fprintf(stderr, "[ERROR] daemon_context_init: Failed to create the pipes: %s\n", strerror(errno));
+        daemon_context_clear(context);
+        return false;
+    }
+
+    if (!engine_reloader_init(&context->reloader)) {
+        fprintf(stderr, "[INFO] Hot-reload is disabled, restart the daemon after updating the signatures\n");
+    }
+
+    return true;
+}
+
+/* Initialize the DaemonContext without the socket */
+bool daemon_context_init_relay(DaemonContext *context) {
+    if (context == NULL) return false;
+    reset_context(context);
+    context->socket_path[0] = '\0';
+
+    if (!create_pipe(context->result_pipe) || !create_pipe(context->job_done_pipe)) {
+        fprintf(stderr, "[ERROR] daemon_context_init_relay: Failed to create the pipes: %s\n", strerror(errno));
+        daemon_context_clear(context);
+        return false;
+    }
+    return true;
+}
+
+/* Clear the DaemonContext and remove the socket */
+void daemon_context_clear(DaemonContext *context) {
+    if (context == NULL) return;
+
+    if (context->listen_fd != -1) {
+        close(context->listen_fd);
+        context->listen_fd = -1;
+        if (context->socket_path[0] != '\0') unlink(context->socket_path); // Only the daemon which bound the socket removes it
+    }
+    close_pipe(context->result_pipe);
+    close_pipe(context->job_done_pipe);
+    engine_reloader_clear(&context->reloader);
+}
+
+/* Redirect the standard output of a worker process to the result pipe */
+void daemon_redirect_output(DaemonContext *context) {
+    if (context == NULL || !is_daemon_context_active(context)) return;
+
+    /* The child never accepts connections or reads the pipes */
+    if (context->listen_fd != -1) close(context->listen_fd);
+    context->listen_fd = -1;
+    close(context->result_pipe[0]);
+    close(context->job_done_pipe[0]);
+    if (context->reloader.inotify_fd != -1) close(context->reloader.inotify_fd);
+    if (context->client_fd != -1) close(context->client_fd); // Respawned while serving a job, the client must see the end of the output
+
+    dup2(context->result_pipe[1], STDOUT_FILENO);
+    setvbuf(stdout, NULL, _IOLBF, 0); // One `write()` per result line, so the lines of different workers don't interleave
+}
+
+/* Tell the daemon that the current job is finished */
+void daemon_notify_job_done(DaemonContext *context) {
+    if (context == NULL || !is_daemon_context_active(context)) return;
+
+    while (write(context->job_done_pipe[1], "d", 1) == -1 && errno == EINTR);
+}
+
+/* Check whether the client is allowed to submit jobs */
+static bool is_client_allowed(int client_fd) {
+#ifdef SO_PEERCRED
+    struct ucred credentials;
+    socklen_t length = sizeof(credentials);
+    if (getsockopt(client_fd, SOL_SOCKET, SO_PEERCRED, &credentials, &length) == -1) return false;
+
+    return credentials.uid == geteuid() || credentials.uid == 0; // A daemon running as root must not scan paths for other users
+#else
+    return true; // The socket is only accessible by the owner
+#endif
+}
+
+/* Read the request line from the client */
+/*
+  * Nothing after the newline is taken, the data of a stream follows the line
+  *
+  * @return
+  * `true` if a complete line is received, the newline is replaced by '\0'
+*/
+static bool read_request(int client_fd, char *request, size_t size) {
+    struct timeval timeout = { .tv_sec = DAEMON_REQUEST_TIMEOUT_SEC, .tv_usec = 0 };
+    setsockopt(client_fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)); // A silent client must not block the daemon
+
+    size_t received = 0;
+    while (received < size - 1) {
+        ssize_t bytes = recv(client_fd, request + received, size - 1 - received, MSG_PEEK);
+        if (bytes == -1 && errno == EINTR) continue;
+        if (bytes <= 0) return false; // Timeout, error or the client left
+
+        /* Take the bytes up to the newline, the peeked ones are still queued */
+        char *newline = memchr(request + received, '\n', (size_t)bytes);
+        size_t length = newline != NULL ? (size_t)(newline - (request + received)) + 1 : (size_t)bytes;
+        while ((bytes = recv(client_fd, request + received, length, 0)) == -1 && errno == EINTR);
+        if (bytes != (ssize_t)length) return false;
+
+        received += length;
+        if (newline != NULL) {
+            *newline = '\0';
+            return true;
+        }
+    }
+    return false; // The request is too long
+}
+
+/* Receive exactly `size` bytes */
+static bool recv_all(int fd, void *buffer, size_t size) {
+    char *bytes = buffer;
+    while (size > 0) {
+        ssize_t received = recv(fd, bytes, size, 0);
+        if (received == -1 && errno == EINTR) continue;
+        if (received <= 0) return false; // Timeout, error or the client left
+
+        bytes += received;
+        size -= (size_t)received;
+    }
+    return true;
+}
+
+/* Receive the chunks of a stream */
+/*
+  * @return
+  * `CL_SUCCESS`, `CL_EMAXSIZE` if the stream exceeds `STREAM_MAX_SIZE`, `CL_EARG` if a chunk is invalid or `CL_EREAD` if the client left
+*/
+static cl_error_t receive_stream(int client_fd, StreamBuffer *buffer) {
+    while (true) {
+        uint32_t length;
+        if (!recv_all(client_fd, &length, sizeof(length))) return CL_EREAD;
+        length = ntohl(length);
+        if (length == 0) return CL_SUCCESS; // The end of the stream
+        if (length > STREAM_MAX_CHUNK) return CL_EARG;
+
+        char *space = stream_buffer_reserve(buffer, length);
+        if (space == NULL) return buffer->size + length > STREAM_MAX_SIZE ? CL_EMAXSIZE : CL_EMEM;
+        if (!recv_all(client_fd, space, length)) return CL_EREAD;
+        stream_buffer_commit(buffer, length);
+    }
+}
+
+/* Relay the pending output of the workers to the client */
+/*
+  * @return
+  * `false` if the client is gone
+*/
+static bool relay_output(DaemonContext *context, int client_fd, bool client_alive) {
+    static char buffer[RELAY_BUFFER_SIZE];
+
+    while (true) {
+        ssize_t bytes = read(context->result_pipe[0], buffer, sizeof(buffer));
+        if (bytes == -1 && errno == EINTR) continue;
+        if (bytes <= 0) break; // Drained (`EAGAIN`)
+
+        if (client_alive) client_alive = send_all(client_fd, buffer, (size_t)bytes); // Keep draining after the client left, the workers must never block on a full pipe
+    }
+    return client_alive;
+}
+
+/* Drop the remaining tasks of the current job */
+static void cancel_job(SharedMemory *shm) {
+    atomic_store(&shm->cancel_job, true);
+}
+
+/* Start a scan job, the persistent producers and workers pick it up */
+static bool start_job(SharedMemory *shm, const char *path, bool is_dir) {
+    Task task;
+    if (!build_task(&shm->arena, is_dir ? TASK_SCAN_DIR : TASK_SCAN_FILE, path, NULL, &task)) return false;
+
+    atomic_store(&shm->cancel_job, false);
+
+    /* Add the task before leaving the idle status, so the pools never look finished in between */
+    task_pool_add(is_dir ? &shm->dir_tasks : &shm->file_tasks, NO_DEQUE_OWNER, task);
+    set_status(&shm->current_status, STATUS_UNFINISHED);
+
+    /* Let the idle processes recheck the exit condition, a single file job finishes the producer stage immediately */
+    task_pool_wake_all(&shm->dir_tasks);
+    task_pool_wake_all(&shm->file_tasks);
+    return true;
+}
+
+/* Find the engine prepared for the database options */
+/*
+  * @return
+  * NULL if there is none loaded from the current signatures
+*/
+static CachedEngine *find_cached_engine(DaemonContext *context, uint32_t db_options) {
+    for (size_t i = 0; i < DAEMON_ENGINE_CACHE_SIZE; i++) {
+        CachedEngine *entry = &context->engines[i];
+        if (entry->engine != NULL && entry->db_options == db_options && entry->db_generation == context->db_generation) return entry;
+    }
+    return NULL;
+}
+
+/* Check whether the engine is kept in the cache */
+static bool is_engine_cached(const DaemonContext *context, const struct cl_engine *engine) {
+    for (size_t i = 0; i < DAEMON_ENGINE_CACHE_SIZE; i++) {
+        if (context->engines[i].engine == engine) return true;
+    }
+    return false;
+}
+
+/* Free an engine no worker uses anymore, unless it's kept in the cache */
+static void release_engine(DaemonContext *context, struct cl_engine *engine) {
+    if (engine != NULL && !is_engine_cached(context, engine)) cl_engine_free(engine);
+}
+
+/* Take a slot for a new engine, the least recently used one is evicted */
+/*
+  * @param current_engine
+  * Used by the workers, never freed here (the slot is only forgotten)
+*/
+static CachedEngine *take_engine_slot(DaemonContext *context, const struct cl_engine *current_engine) {
+    CachedEngine *oldest = &context->engines[0];
+    for (size_t i = 0; i < DAEMON_ENGINE_CACHE_SIZE; i++) {
+        CachedEngine *entry = &context->engines[i];
+        if (entry->engine == NULL) return entry;
+        if (entry->last_used < oldest->last_used) oldest = entry;
+    }
+
+    if (oldest->engine != current_engine) cl_engine_free(oldest->engine);
+    *oldest = (CachedEngine){0};
+    return oldest;
+}
+
+/* Forget the engines of the old signatures, the current one is freed after the workers are switched */
+static void drop_stale_engines(DaemonContext *context, const struct cl_engine *current_engine) {
+    for (size_t i = 0; i < DAEMON_ENGINE_CACHE_SIZE; i++) {
+        CachedEngine *entry = &context->engines[i];
+        if (entry->engine == NULL || entry->db_generation == context->db_generation) continue;
+
+        if (entry->engine != current_engine) cl_engine_free(entry->engine);
+        *entry = (CachedEngine){0};
+    }
+}
+
+/* Switch the workers to the profile of the next job */
+/*
+  * A cached engine is reused with the limits of the profile, only the workers are respawned
+  * Otherwise the database is loaded with the options of the profile, which blocks the daemon as long as a restart would
+  *
+  * @return
+  * `false` if the engine of the profile can't be prepared, the workers keep the current one
+*/
+static bool use_profile(DaemonContext *context, SharedMemory *shm, const ScanProfile *profile) {
+    CachedEngine *entry = find_cached_engine(context, profile->db_options);
+    bool is_current = entry != NULL && entry->engine == shm->essentials.engine;
+    if (is_current && scan_profile_is_equal(&shm->essentials.profile, profile)) {
+        entry->last_used = ++context->use_clock;
+        return true;
+    }
+    if (context->respawn_workers == NULL) return false;
+
+    if (entry == NULL) {
+        fprintf(stderr, "[INFO] Preparing the engine of the %s profile\n", profile->name);
+
+        struct cl_engine *engine = NULL;
+        cl_engine_load(&engine, profile);
+        if (engine == NULL) return false;
+
+        entry = take_engine_slot(context, shm->essentials.engine);
+        *entry = (CachedEngine){ .engine = engine, .db_options = profile->db_options, .db_generation = context->db_generation };
+    }
+    else if (!scan_profile_has_same_limits(&shm->essentials.profile, profile) || !is_current) {
+        if (!scan_profile_apply_limits(profile, entry->engine)) return false; // Only the workers forked afterwards see them
+    }
+    entry->last_used = ++context->use_clock;
+
+    /* The workers are idle between jobs, the new ones read the options from the shared memory */
+    shm->essentials.profile = *profile;
+    scan_profile_get_scan_options(profile, &shm->essentials.scan_options);
+    shm->essentials.next_engine = entry->engine;
+    release_engine(context, context->respawn_workers());
+    return true;
+}
+
+/* Take the engine compiled after the signatures are updated */
+static void collect_reloaded_engine(DaemonContext *context, SharedMemory *shm) {
+    struct cl_engine *engine = engine_reloader_collect(&context->reloader);
+    if (engine == NULL) return;
+    if (context->respawn_workers == NULL) {
+        cl_engine_free(engine);
+        return;
+    }
+
+    context->db_generation++;
+    drop_stale_engines(context, shm->essentials.engine);
+
+    CachedEngine *entry = take_engine_slot(context, shm->essentials.engine);
+    *entry = (CachedEngine){ .engine = engine, .db_options = context->reloader.profile.db_options, .db_generation = context->db_generation };
+
+    /* Switch now, the current engine is stale (if the profile changed meanwhile, its database is loaded again) */
+    if (!use_profile(context, shm, &shm->essentials.profile)) {
+        fprintf(stderr, "[WARNING] Failed to switch to the new engine, keep scanning with the old signatures\n");
+    }
+}
+
+/* Take an output option from the start of the request */
+/*
+  * @return
+  * `false` if the option is unknown or invalid
+*/
+static bool take_job_option(const char **request, DaemonJobOutput *output) {
+    size_t length = strcspn(*request, " ");
+    if ((*request)[length] != ' ') return false;
+
+    if (length == strlen(INFECTED_ONLY_OPTION) && strncmp(*request, INFECTED_ONLY_OPTION, length) == 0) output->is_infected_only = true;
+    else if (length > strlen(PROGRESS_OPTION) && strncmp(*request, PROGRESS_OPTION, strlen(PROGRESS_OPTION)) == 0) {
+        char *end;
+        unsigned long long interval = strtoull(*request + strlen(PROGRESS_OPTION), &end, 10);
+        if (end != *request + length || interval == 0 || interval > UINT32_MAX) return false;
+        output->progress_interval_ms = interval;
+    }
+    else return false;
+
+    *request += length + 1;
+    return true;
+}
+
+/* Send the counts of the job since `base` to the client */
+/*
+  * @return
+  * `false` if the client left
+*/
+static bool send_job_progress(SharedMemory *shm, int client_fd, const StatsSnapshot *base) {
+    StatsSnapshot snapshot;
+    scan_stats_collect(&shm->stats, &snapshot);
+
+    char buffer[JSON_PROGRESS_LINE_SIZE];
+    size_t length = result_output_format_progress(&shm->result_output, snapshot.counters[STAT_FILES_SCANNED] - base->counters[STAT_FILES_SCANNED],
+                                                  snapshot.counters[STAT_BYTES_SCANNED] - base->counters[STAT_BYTES_SCANNED], buffer);
+    return length == 0 || send_all(client_fd, buffer, length);
+}
+
+#define STREAM_WAIT_NS 10000000 // 10 ms between the checks of the scanning child
+
+/* Wait for the child scanning a stream, kill it after `file_timeout_ns` */
+/*
+  * @return
+  * `CL_SUCCESS` if it has written the result, otherwise the error to report for the stream
+*/
+static cl_error_t wait_stream_child(const DaemonContext *context, pid_t pid, uint64_t start_ns) {
+    int status = 0;
+    while (true) {
+        pid_t result = waitpid(pid, &status, context->file_timeout_ns > 0 ? WNOHANG : 0);
+        if (result == pid) break;
+        if (result == -1 && errno != EINTR) return CL_ERROR;
+
+        if (context->file_timeout_ns > 0 && monotonic_ns() - start_ns > context->file_timeout_ns) {
+            kill(pid, SIGKILL);
+            while (waitpid(pid, NULL, 0) == -1 && errno == EINTR);
+            fprintf(stderr, "[WARNING] serve_stream: The scan took longer than %llu s, killed\n", (unsigned long long)(context->file_timeout_ns / 1000000000ULL));
+            return CL_ETIMEOUT;
+        }
+        if (result == 0) nanosleep(&(struct timespec){ .tv_nsec = STREAM_WAIT_NS }, NULL);
+    }
+
+    if (WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS) return CL_SUCCESS;
+    if (WIFSIGNALED(status)) fprintf(stderr, "[WARNING] serve_stream: The scan was killed by signal %d\n", WTERMSIG(status));
+    return CL_ERROR;
+}
+
+/* Scan a received stream in a child process */
+/*
+  * The child inherits the engine, a stream crashing or hanging libclamav only takes the child with it
+*/
+static void scan_stream_in_child(DaemonContext *context, SharedMemory *shm, StreamBuffer *buffer, cl_error_t error, const char *name) {
+    uint64_t start_ns = monotonic_ns();
+    pid_t pid = fork();
+    if (pid == 0) {
+        scan_stats_attach(&shm->stats, STATS_PARENT_SLOT); // Counted for the progress of the job
+        process_stream(buffer, error, name, &shm->essentials, context->result_pipe[1]); // An oversized stream is reported as its result
+        _exit(EXIT_SUCCESS);
+    }
+
+    cl_error_t failure = CL_ERROR;
+    if (pid == -1) fprintf(stderr, "[ERROR] serve_stream: Failed to fork: %s\n", strerror(errno));
+    else failure = wait_stream_child(context, pid, start_ns);
+    if (failure == CL_SUCCESS) return;
+
+    if (pid > 0 && result_output_recover_lock(&shm->result_output, pid)) fprintf(stderr, "[WARNING] serve_stream: The scan died holding the output, its result may be torn\n");
+    write_scan_result(context->result_pipe[1], name, failure, NULL, &shm->essentials, (int64_t)buffer->size, 0, monotonic_ns() - start_ns);
+}
+
+/* Receive a stream and scan it in a child of the daemon process */
+/*
+  * The workers stay idle, a stream is a single scan with the engine they would use
+  * The result goes through the result pipe like the ones of the workers, so a client leaving never raises `SIGPIPE`
+*/
+static void serve_stream(DaemonContext *context, SharedMemory *shm, int client_fd, const char *name, ResultFormat format, const ScanProfile *profile,
+                         const DaemonJobOutput *output) {
+    if (name[0] == '\0') {
+        send_error(client_fd, "Invalid request", NULL);
+        return;
+    }
+
+    StreamBuffer buffer;
+    stream_buffer_init(&buffer);
+    cl_error_t error = receive_stream(client_fd, &buffer);
+    if (error == CL_EREAD || error == CL_EARG) { // Nobody waits for the result, or the data can't be trusted
+        if (error == CL_EARG) send_error(client_fd, "Invalid stream chunk", name);
+        stream_buffer_clear(&buffer);
+        return;
+    }
+
+    if (!use_profile(context, shm, profile)) {
+        send_error(client_fd, "Failed to prepare the profile", profile->name);
+        stream_buffer_clear(&buffer);
+        return;
+    }
+
+    atomic_store(&shm->result_output.format, format);
+    atomic_store(&shm->result_output.is_infected_only, output->is_infected_only);
+    if (format == RESULT_FORMAT_BINARY && !send_all(client_fd, SCAN_RESULT_STREAM_MAGIC, SCAN_RESULT_STREAM_MAGIC_SIZE)) {
+        stream_buffer_clear(&buffer);
+        return;
+    }
+
+    StatsSnapshot base;
+    scan_stats_collect(&shm->stats, &base);
+    scan_stream_in_child(context, shm, &buffer, error, name);
+    stream_buffer_clear(&buffer);
+    bool client_alive = relay_output(context, client_fd, true);
+    if (client_alive && output->progress_interval_ms > 0) send_job_progress(shm, client_fd, &base); // Only the final record
+}
+
+/* Serve a single client, return after its job is finished */
+static void serve_client(DaemonContext *context, SharedMemory *shm, int client_fd, const sigset_t *orig_mask) {
+    if (!is_client_allowed(client_fd)) {
+        send_error(client_fd, "Permission denied", NULL);
+        return;
+    }
+
+    char request[REQUEST_BUFFER_SIZE];
+    if (!read_request(client_fd, request, sizeof(request))) {
+        send_error(client_fd, "Invalid request", NULL);
+        return;
+    }
+
+    static const struct {
+        const char *command;
+        ResultFormat format;
+        bool is_stream;
+    } commands[] = {
+        { DAEMON_REQUEST_SCAN, RESULT_FORMAT_TEXT, false },
+        { DAEMON_REQUEST_SCAN_BINARY, RESULT_FORMAT_BINARY, false },
+        { DAEMON_REQUEST_SCAN_JSON, RESULT_FORMAT_JSON, false },
+        { DAEMON_REQUEST_STREAM, RESULT_FORMAT_TEXT, true },
+        { DAEMON_REQUEST_STREAM_BINARY, RESULT_FORMAT_BINARY, true },
+        { DAEMON_REQUEST_STREAM_JSON, RESULT_FORMAT_JSON, true },
+    };
+    size_t command = 0;
+    while (command < sizeof(commands) / sizeof(commands[0]) && strncmp(request, commands[command].command, strlen(commands[command].command)) != 0) command++;
+    if (command == sizeof(commands) / sizeof(commands[0])) {
+        send_error(client_fd, "Invalid request", NULL);
+        return;
+    }
+    ResultFormat format = commands[command].format;
+    const char *request_path = request + strlen(commands[command].command);
+    bool is_stream = commands[command].is_stream;
+
+    /* The output options come first, they all start with "--" unlike a profile and a path */
+    DaemonJobOutput output = { .is_infected_only = false, .progress_interval_ms = 0 };
+    while (strncmp(request_path, "--", 2) == 0) {
+        if (!take_job_option(&request_path, &output)) {
+            send_error(client_fd, "Invalid request", NULL);
+            return;
+        }
+    }
+    if (output.progress_interval_ms > 0 && format == RESULT_FORMAT_TEXT) { // A text line can't be told apart from a path
+        send_error(client_fd, "Invalid request", NULL);
+        return;
+    }
+
+    /* The path is absolute, so anything else first is the profile, a stream always has one since its name can be anything */
+    ScanProfile profile = context->default_profile;
+    if (request_path[0] != '/' || is_stream) {
+        char spec[SCAN_PROFILE_SPEC_SIZE];
+        size_t spec_length = strcspn(request_path, " ");
+        if (spec_length >= sizeof(spec) || request_path[spec_length] != ' ') {
+            send_error(client_fd, "Invalid request", NULL);
+            return;
+        }
+        memcpy(spec, request_path, spec_length);
+        spec[spec_length] = '\0';
+
+        if (!scan_profile_parse(&profile, spec)) {
+            send_error(client_fd, "Unknown profile", spec);
+            return;
+        }
+        request_path += spec_length + 1;
+    }
+
+    if (is_stream) {
+        serve_stream(context, shm, client_fd, request_path, format, &profile, &output);
+        return;
+    }
+
+    char *real_path = realpath(request_path, NULL);
+    if (real_path == NULL) {
+        send_error(client_fd, "Failed to get real path of", request_path);
+        return;
+    }
+
+    bool is_dir = is_directory(real_path);
+    if (!is_dir && !is_regular_file(real_path)) {
+        send_error(client_fd, "Not a directory or a regular file", real_path);
+        free(real_path);
+        return;
+    }
+
+    if (!use_profile(context, shm, &profile)) {
+        send_error(client_fd, "Failed to prepare the profile", profile.name);
+        free(real_path);
+        return;
+    }
+
+    /* The errors above are text lines, a binary stream always starts with the magic */
+    atomic_store(&shm->result_output.format, format); // The workers are idle, the format applies from the first result of the job
+    atomic_store(&shm->result_output.is_infected_only, output.is_infected_only);
+    if (format == RESULT_FORMAT_BINARY && !send_all(client_fd, SCAN_RESULT_STREAM_MAGIC, SCAN_RESULT_STREAM_MAGIC_SIZE)) {
+        free(real_path);
+        return;
+    }
+
+    StatsSnapshot base;
+    scan_stats_collect(&shm->stats, &base); // The counters of the daemon keep growing across the jobs
+    bool is_started = start_job(shm, real_path, is_dir);
+    free(real_path);
+    if (!is_started) {
+        send_error(client_fd, "Failed to start the scan", request_path);
+        return;
+    }
+
+    struct pollfd fds[] = {
+        { .fd = context->result_pipe[0], .events = POLLIN },
+        { .fd = context->job_done_pipe[0], .events = POLLIN },
+        { .fd = client_fd, .events = POLLIN }, // Readable means the client left (or sent garbage)
+    };
+
+    bool client_alive = true;
+    bool job_done = false;
+    uint64_t progress_interval_ns = output.progress_interval_ms * 1000000ULL;
+    uint64_t next_progress_ns = monotonic_ns() + progress_interval_ns;
+    while (!job_done) {
+        struct timespec timeout = { .tv_sec = 0, .tv_nsec = 0 };
+        if (progress_interval_ns > 0) {
+            uint64_t now = monotonic_ns();
+            uint64_t wait_ns = next_progress_ns > now ? next_progress_ns - now : 0;
+            timeout = (struct timespec){ .tv_sec = (time_t)(wait_ns / 1000000000ULL), .tv_nsec = (long)(wait_ns % 1000000000ULL) };
+        }
+        int poll_result = ppoll(fds, 3, progress_interval_ns > 0 ? &timeout : NULL, orig_mask);
+        if (get_status(&shm->current_status) == STATUS_FORCE_QUIT) return; // Shutting down, the processes will be terminated
+
+        if (poll_result == -1) {
+            if (errno == EINTR) continue;
+            fprintf(stderr, "[ERROR] daemon_main: Failed to poll: %s\n", strerror(errno));
+            cancel_job(shm);
+            continue;
+        }
+
+        if (fds[0].revents & POLLIN) client_alive = relay_output(context, client_fd, client_alive);
+
+        if (fds[1].revents & POLLIN) {
+            char done[16];
+            while (read(context->job_done_pipe[0], done, sizeof(done)) > 0); // Drain the notification
+            job_done = true;
+        }
+
+        if (fds[2].revents) {
+            char garbage;
+            ssize_t bytes = recv(client_fd, &garbage, 1, MSG_DONTWAIT);
+            if (bytes == 0 || (bytes == -1 && errno != EAGAIN && errno != EINTR)) client_alive = false;
+        }
+
+        if (client_alive && progress_interval_ns > 0 && monotonic_ns() >= next_progress_ns) {
+            client_alive = relay_output(context, client_fd, client_alive) && send_job_progress(shm, client_fd, &base); // After the results it counts
+            next_progress_ns = monotonic_ns() + progress_interval_ns;
+        }
+
+        if (!client_alive) {
+            cancel_job(shm); // Nobody is waiting for the result, finish the job as soon as possible
+            fds[2].fd = -1;
+        }
+    }
+
+    client_alive = relay_output(context, client_fd, client_alive); // The results are written before the last task is marked as done, so this drains all of them
+    if (client_alive && progress_interval_ns > 0) send_job_progress(shm, client_fd, &base); // The last record always has the totals
+}
+
+/* The main loop of the daemon */
+void daemon_main(DaemonContext *context, SharedMemory *shm) {
+    if (context == NULL || shm == NULL || !is_daemon_context_active(context)) return;
+
+    /* Block the termination signals while checking the status, `ppoll()` unblocks them atomically so no signal can be missed */
+    sigset_t blocked_mask, orig_mask;
+    sigemptyset(&blocked_mask);
+    sigaddset(&blocked_mask, SIGINT);
+    sigaddset(&blocked_mask, SIGTERM);
+    sigprocmask(SIG_BLOCK, &blocked_mask, &orig_mask);
+
+    struct pollfd fds[] = {
+        { .fd = context->listen_fd, .events = POLLIN },
+        { .fd = context->reloader.inotify_fd, .events = POLLIN }, // Ignored by `ppoll()` if it's -1
+        { .fd = context->reloader.done_pipe[0], .events = POLLIN },
+    };
+
+    /* The engine of the startup profile is the first cached one */
+    context->engines[0] = (CachedEngine){
+        .engine = shm->essentials.engine,
+        .db_options = shm->essentials.profile.db_options,
+        .db_generation = context->db_generation,
+        .last_used = ++context->use_clock,
+    };
+
+    while (get_status(&shm->current_status) != STATUS_FORCE_QUIT) {
+        struct timespec timeout;
+        bool has_timeout = engine_reloader_get_timeout(&context->reloader, &timeout);
+
+        int poll_result = ppoll(fds, 3, has_timeout ? &timeout : NULL, &orig_mask);
+        if (poll_result == -1) {
+            if (errno == EINTR) continue; // Interrupted by a signal, recheck the status
+            fprintf(stderr, "[ERROR] daemon_main: Failed to poll the socket: %s\n", strerror(errno));
+            break;
+        }
+
+        /* Handle the signature updates first, we are between jobs here */
+        if (fds[1].revents & POLLIN) engine_reloader_handle_events(&context->reloader);
+        if (fds[2].revents & POLLIN) collect_reloaded_engine(context, shm);
+        engine_reloader_tick(&context->reloader, &shm->essentials.profile);
+
+        if (!(fds[0].revents & POLLIN)) continue;
+
+        int client_fd = accept4(context->listen_fd, NULL, NULL, SOCK_CLOEXEC);
+        if (client_fd == -1) continue;
+
+        context->client_fd = client_fd;
+        serve_client(context, shm, client_fd, &orig_mask); // The new engine may be compiling meanwhile
+        close(client_fd);
+        context->client_fd = -1;
+    }
+
+    /* The current engine is freed with the shared memory */
+    for (size_t i = 0; i < DAEMON_ENGINE_CACHE_SIZE; i++) {
+        if (context->engines[i].engine != shm->essentials.engine) cl_engine_free(context->engines[i].engine);
+        context->engines[i] = (CachedEngine){0};
+    }
+
+    sigprocmask(SIG_SETMASK, &orig_mask, NULL); // Restore the signal mask
+}
+
+/* Print the response of the daemon until it closes the connection */
+/*
+  * @return
+  * 1 if the request was rejected, 0 otherwise
+*/
+static int relay_response(int socket_fd) {
+    static char buffer[RELAY_BUFFER_SIZE];
+    bool is_first_chunk = true;
+    int exit_status = 0;
+    while (true) {
+        ssize_t bytes = recv(socket_fd, buffer, sizeof(buffer), 0);
+        if (bytes == -1 && errno == EINTR) continue;
+        if (bytes <= 0) break;
+
+        bool is_error = is_first_chunk && (size_t)bytes >= strlen(ERROR_PREFIX) && memcmp(buffer, ERROR_PREFIX, strlen(ERROR_PREFIX)) == 0;
+        if (is_error) exit_status = 1; // The job was rejected
+        is_first_chunk = false;
+
+        if (!write_all(is_error ? STDERR_FILENO : STDOUT_FILENO, buffer, (size_t)bytes)) break;
+    }
+    return exit_status;
+}
+
+/* Format the output options of a job for the request, an empty string without them */
+static bool format_job_output(const DaemonJobOutput *output, char *buffer, size_t size) {
+    const char *infected_only = output != NULL && output->is_infected_only ? INFECTED_ONLY_OPTION " " : "";
+    uint64_t interval = output != NULL ? output->progress_interval_ms : 0;
+    int length = interval > 0 ? snprintf(buffer, size, "%s%s%llu ", infected_only, PROGRESS_OPTION, (unsigned long long)interval)
+                              : snprintf(buffer, size, "%s", infected_only);
+    return length >= 0 && (size_t)length < size;
+}
+
+/* Submit a scan job to a running daemon */
+int daemon_client_scan(const char *path, ResultFormat format, const ScanProfile *profile, const DaemonJobOutput *output) {
+    if (path == NULL || profile == NULL) return -1;
+
+    char spec[SCAN_PROFILE_SPEC_SIZE], options[64];
+    if (!scan_profile_format(profile, spec, sizeof(spec)) || !format_job_output(output, options, sizeof(options))) return -1;
+
+    char socket_path[sizeof(((struct sockaddr_un *)0)->sun_path)];
+    if (!daemon_socket_path(socket_path, sizeof(socket_path))) return -1;
+
+    int socket_fd = connect_to_daemon(socket_path);
+    if (socket_fd == -1) return -1; // No daemon, scan by ourselves
+
+    char request[REQUEST_BUFFER_SIZE];
+    const char *command = format == RESULT_FORMAT_BINARY ? DAEMON_REQUEST_SCAN_BINARY : (format == RESULT_FORMAT_JSON ? DAEMON_REQUEST_SCAN_JSON : DAEMON_REQUEST_SCAN);
+    int length = snprintf(request, sizeof(request), "%s%s%s %s\n", command, options, spec, path);
+    if (length <= 0 || (size_t)length >= sizeof(request) || !send_all(socket_fd, request, (size_t)length)) {
+        close(socket_fd);
+        return -1;
+    }
+
+    int exit_status = relay_response(socket_fd);
+    close(socket_fd);
+    return exit_status;
+}
+
+/* Submit a stream to a running daemon */
+int daemon_client_scan_stream(int fd, const char *name, ResultFormat format, const ScanProfile *profile, const DaemonJobOutput *output) {
+    if (fd < 0 || name == NULL || profile == NULL) return -1;
+
+    char spec[SCAN_PROFILE_SPEC_SIZE], options[64];
+    if (!scan_profile_format(profile, spec, sizeof(spec)) || !format_job_output(output, options, sizeof(options))) return -1;
+
+    char socket_path[sizeof(((struct sockaddr_un *)0)->sun_path)];
+    if (!daemon_socket_path(socket_path, sizeof(socket_path))) return -1;
+
+    int socket_fd = connect_to_daemon(socket_path);
+    if (socket_fd == -1) return -1; // No daemon, scan by ourselves
+
+    char request[REQUEST_BUFFER_SIZE];
+    const char *command = format == RESULT_FORMAT_BINARY ? DAEMON_REQUEST_STREAM_BINARY : (format == RESULT_FORMAT_JSON ? DAEMON_REQUEST_STREAM_JSON : DAEMON_REQUEST_STREAM);
+    int length = snprintf(request, sizeof(request), "%s%s%s %s\n", command, options, spec, name);
+    if (length <= 0 || (size_t)length >= sizeof(request) || !send_all(socket_fd, request, (size_t)length)) {
+        close(socket_fd);
+        return -1;
+    }
+
+    /* Each read becomes a chunk, the daemon may stop taking them (e.g. the stream is too large), its answer is read below */
+    static char chunk[sizeof(uint32_t) + STREAM_READ_SIZE];
+    bool is_sent = true;
+    while (is_sent) {
+        ssize_t bytes = read(fd, chunk + sizeof(uint32_t), STREAM_READ_SIZE);
+        if (bytes == -1 && errno == EINTR) continue;
+        if (bytes == -1) {
+            fprintf(stderr, "[ERROR] daemon_client_scan_stream: Failed to read %s: %s\n", name, strerror(errno));
+            close(socket_fd); // The daemon drops an unfinished stream
+            return 1;
+        }
+
+        uint32_t chunk_length = htonl((uint32_t)bytes);
+        memcpy(chunk, &chunk_length, sizeof(chunk_length));
+        is_sent = send_all(socket_fd, chunk, sizeof(uint32_t) + (size_t)bytes) && bytes > 0; // The empty chunk ends the stream
+    }
+
+    int exit_status = relay_response(socket_fd);
+    close(socket_fd);
+    return exit_status;
+}
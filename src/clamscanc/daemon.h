@@ -0,0 +1,190 @@
+/* daemon.h
+ *
+ * Copyright 2025 EricLin
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+*/
+
+#ifndef DAEMON_H
+#define DAEMON_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/un.h>
+
+#include "manager.h"
+#include "reload.h"
+#include "stream.h"
+
+#define DAEMON_SOCKET_ENV "CLAMSCANC_SOCKET" // Override the socket path
+#define DAEMON_SOCKET_NAME "clamscanc.sock"
+#define DAEMON_REQUEST_SCAN "SCAN " // Request: "SCAN [<output options> ][<profile> ]<absolute path>\n", the response is the scan output until the connection is closed
+#define DAEMON_REQUEST_SCAN_BINARY "BSCAN " // Same as "SCAN ", but the response is a binary result stream (see `result-protocol.h`)
+#define DAEMON_REQUEST_SCAN_JSON "JSCAN " // Same as "SCAN ", but the response is JSON Lines (see `json-lines.h`)
+#define DAEMON_REQUEST_STREAM "STREAM " // Request: "STREAM <profile> <name>\n" and the chunks of the data, the response is the result of `name` (see `stream.h`)
+#define DAEMON_REQUEST_STREAM_BINARY "BSTREAM " // Same as "STREAM ", but the response is a binary result stream
+#define DAEMON_REQUEST_STREAM_JSON "JSTREAM " // Same as "STREAM ", but the response is a JSON line
+#define DAEMON_REQUEST_TIMEOUT_SEC 5 // A client must send its request within this time
+#define DAEMON_ENGINE_CACHE_SIZE 2 // Prepared engines kept for the profiles, each holds a whole database (about 1 GiB), so two profiles alternate without reloading
+
+typedef struct cl_engine *(*respawn_callback)(void); // Respawn the workers, so they inherit the engine in `next_engine`, return the old engine
+
+/* An engine prepared for the profiles with the same database options */
+/*
+  * `db_generation` is the `DaemonContext` generation of the signatures it was loaded from, it's stale after the next reload
+*/
+typedef struct {
+	struct cl_engine *engine; // NULL if the slot is free
+	uint32_t db_options;
+	unsigned int db_generation;
+	uint64_t last_used;
+} CachedEngine;
+
+/* Output options of a job */
+/*
+  * Sent before the profile, e.g. "BSCAN --infected --progress=100 quick /home\n" (see `INFECTED_ONLY_OPTION` and `PROGRESS_OPTION`)
+  * The progress records count the files of the job only, the text lines have none
+*/
+typedef struct {
+	bool is_infected_only;
+	uint64_t progress_interval_ms; // 0 for no progress
+} DaemonJobOutput;
+
+/* Daemon context */
+/*
+  * `listen_fd` is the Unix socket accepting the scan jobs, `client_fd` is the connection being served (-1 between jobs)
+  * `result_pipe` collects the output of the workers, the parent relays it to the client of the current job
+  * `job_done_pipe` is written by the worker which finishes the last task of the current job
+  * `reloader` compiles a new engine after the signatures are updated, `respawn_workers` switches the workers to it between jobs
+  * `default_profile` is used by the jobs which don't ask for a profile
+  * `engines` keeps the prepared engines, switching to a profile with a cached engine only respawns the workers instead of loading the database again
+  * `file_timeout_ns` bounds the scan of a stream like the one of a file, 0 to wait forever
+*/
+typedef struct {
+	int listen_fd;
+	int client_fd;
+	int result_pipe[2];
+	int job_done_pipe[2];
+	char socket_path[sizeof(((struct sockaddr_un *)0)->sun_path)];
+
+	EngineReloader reloader;
+	respawn_callback respawn_workers;
+
+	ScanProfile default_profile;
+	CachedEngine engines[DAEMON_ENGINE_CACHE_SIZE];
+	unsigned int db_generation; // Bumped every time the signatures are reloaded
+	uint64_t use_clock; // Orders the uses of `engines`
+	uint64_t file_timeout_ns;
+} DaemonContext;
+
+/* Get the path of the daemon socket */
+/*
+  * @note
+  * `$CLAMSCANC_SOCKET` if set, otherwise `$XDG_RUNTIME_DIR/clamscanc.sock`, otherwise `/tmp/clamscanc-<uid>.sock`
+  *
+  * @return
+  * `true` if the path fits in `path`, `false` otherwise
+*/
+bool daemon_socket_path(char *path, size_t size);
+
+/* Initialize the DaemonContext and start listening */
+/*
+  * @return
+  * `true` if the initialization is successful, `false` otherwise (e.g. another daemon is already running)
+  *
+  * @warning
+  * This function MUST be called before spawning the producer and worker processes, they inherit the pipes
+*/
+bool daemon_context_init(DaemonContext *context);
+
+/* Initialize the DaemonContext without the socket */
+/*
+  * Only the pipes are created, the jobs come from elsewhere (e.g. a coordinator, see `coordinator.h`)
+  *
+  * @warning
+  * This function MUST be called before spawning the worker processes, they inherit the pipes
+*/
+bool daemon_context_init_relay(DaemonContext *context);
+
+/* Clear the DaemonContext and remove the socket */
+void daemon_context_clear(DaemonContext *context);
+
+/* Check whether the process is serving the daemon jobs */
+static inline bool is_daemon_context_active(const DaemonContext *context) {
+	return context->job_done_pipe[1] != -1;
+}
+
+/* Redirect the standard output of a worker process to the result pipe */
+/*
+  * @warning
+  * This function MUST be called in the child process, before any output is written
+*/
+void daemon_redirect_output(DaemonContext *context);
+
+/* Tell the daemon that the current job is finished */
+/*
+  * @warning
+  * This function should be called in the child process (producer or worker process)
+*/
+void daemon_notify_job_done(DaemonContext *context);
+
+/* The main loop of the daemon */
+/*
+  * Accept the scan jobs one by one, feed them to the persistent task pools and relay the output to the client
+  * When a new engine is compiled, it's swapped in before the next job, the files of the running job finish on the old one
+  * Return when `STATUS_FORCE_QUIT` is set (e.g. `SIGINT` or `SIGTERM`)
+  *
+  * @warning
+  * This function should be called in the main process (parent process), after spawning the producer and worker processes
+*/
+void daemon_main(DaemonContext *context, SharedMemory *shm);
+
+/* Submit a scan job to a running daemon */
+/*
+  * @param path
+  * The absolute path to be scanned
+  *
+  * @param format
+  * The format of the results written to the standard output
+  *
+  * @param profile
+  * The profile of the scan, the daemon switches to it before the job
+  *
+  * @param output
+  * The output options of the job [OPTIONAL]
+  *
+  * @return
+  * The exit status of the scan, -1 if no daemon is available (the caller should scan by itself)
+*/
+int daemon_client_scan(const char *path, ResultFormat format, const ScanProfile *profile, const DaemonJobOutput *output);
+
+/* Submit a stream to a running daemon */
+/*
+  * The stream is sent while it's being read, the chunks are a 4 byte length in network byte order followed by the data
+  * A zero length ends the stream, it's scanned with the engine of the profile in a child of the daemon process
+  *
+  * @param fd
+  * The stream to be scanned, read until the end of file
+  *
+  * @param name
+  * Shown as the path in the result
+  *
+  * @return
+  * The exit status of the scan, -1 if no daemon is available (nothing is read from `fd` then)
+*/
+int daemon_client_scan_stream(int fd, const char *name, ResultFormat format, const ScanProfile *profile, const DaemonJobOutput *output);
+
+#endif // DAEMON_H
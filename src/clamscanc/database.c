@@ -0,0 +1,213 @@
+/* database.c
+ *
+ * Copyright 2025 EricLin
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+*/
+
+#include <dirent.h>
+#include <errno.h>
+#include <fnmatch.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "database.h"
+
+#define DATABASE_PATH_SIZE 4096
+#define MAX_DATABASE_FILES 1024
+
+/* The extensions libclamav loads from a database directory */
+static const char *database_extensions[] = {
+    ".cvd", ".cld", ".cud", // Official databases
+    ".db", ".hdb", ".hdu", ".hsb", ".hsu", ".mdb", ".mdu", ".msb", ".msu", ".ndb", ".ndu", ".ldb", ".ldu", ".sdb", ".zmd", ".rmd",
+    ".pdb", ".gdb", ".wdb", ".cbc", ".ftm", ".cfg", ".cdb", ".cat", ".crb", ".idb", ".ioc", ".yar", ".yara", ".pwdb",
+    ".fp", ".sfp", ".ign", ".ign2", ".imp",
+};
+
+/* Loaded first, they configure or allow-list the signatures of the others */
+static const char *early_database_extensions[] = { ".cfg", ".ign", ".ign2", ".fp", ".sfp" };
+
+static const char *excluded_databases[MAX_EXCLUDED_DATABASES];
+static size_t num_excluded_databases = 0;
+static uint64_t excluded_databases_hash = 0; // 0 without exclusions
+
+/* Check whether the name ends with the extension */
+static bool has_extension(const char *name, const char *extension) {
+    size_t name_length = strlen(name);
+    size_t extension_length = strlen(extension);
+    return name_length > extension_length && strcmp(name + name_length - extension_length, extension) == 0;
+}
+
+/* Check whether the file name belongs to a signature database */
+bool is_database_file(const char *name) {
+    for (size_t i = 0; i < sizeof(database_extensions) / sizeof(database_extensions[0]); i++) {
+        if (has_extension(name, database_extensions[i])) return true;
+    }
+    return false;
+}
+
+/* Exclude the databases matching a pattern from the engines loaded afterwards */
+bool database_exclude(const char *pattern) {
+    if (pattern == NULL || pattern[0] == '\0' || num_excluded_databases >= MAX_EXCLUDED_DATABASES) return false;
+
+    excluded_databases[num_excluded_databases++] = pattern;
+
+    uint64_t hash = excluded_databases_hash != 0 ? excluded_databases_hash : 0xCBF29CE484222325ULL; // FNV-1a
+    for (const char *c = pattern; ; c++) { // The terminator separates the patterns
+        hash ^= (unsigned char)*c;
+        hash *= 0x100000001B3ULL;
+        if (*c == '\0') break;
+    }
+    excluded_databases_hash = hash | 1;
+    return true;
+}
+
+/* Hash the excluded database patterns, in the order they were given */
+uint64_t database_exclusions_hash(void) {
+    return excluded_databases_hash;
+}
+
+/* Check whether a database is excluded */
+bool is_database_excluded(const char *name) {
+    char base_name[256];
+    const char *dot = strrchr(name, '.');
+    size_t base_length = dot != NULL && dot != name ? (size_t)(dot - name) : strlen(name);
+    if (base_length >= sizeof(base_name)) base_length = sizeof(base_name) - 1;
+    memcpy(base_name, name, base_length);
+    base_name[base_length] = '\0';
+
+    for (size_t i = 0; i < num_excluded_databases; i++) {
+        if (fnmatch(excluded_databases[i], name, 0) == 0 || fnmatch(excluded_databases[i], base_name, 0) == 0) return true;
+    }
+    return false;
+}
+
+/* Check whether the database is the early one */
+static bool is_early_database(const char *name) {
+    if (strncmp(name, "daily.", strlen("daily.")) == 0) return true; // Holds the configuration of the engine
+
+    for (size_t i = 0; i < sizeof(early_database_extensions) / sizeof(early_database_extensions[0]); i++) {
+        if (has_extension(name, early_database_extensions[i])) return true;
+    }
+    return false;
+}
+
+/* Get the version in the header of a `.cvd` or `.cld`, 0 if it can't be read */
+static unsigned int get_database_version(const char *db_dir, const char *base_name, int base_length, const char *extension) {
+    char path[DATABASE_PATH_SIZE];
+    int length = snprintf(path, sizeof(path), "%s/%.*s%s", db_dir, base_length, base_name, extension);
+    if (length <= 0 || (size_t)length >= sizeof(path)) return 0;
+
+    struct cl_cvd *header = cl_cvdhead(path);
+    if (header == NULL) return 0;
+    unsigned int version = header->version;
+    cl_cvdfree(header);
+    return version;
+}
+
+/* Check whether the database is superseded by its `.cvd` or `.cld` twin, freshclam keeps both only while updating */
+/*
+  * @note
+  * Like libclamav, the newer version is loaded, the `.cld` if they are the same
+*/
+static bool is_superseded_database(const char *db_dir, const char *name) {
+    bool is_cvd = has_extension(name, ".cvd");
+    if (!is_cvd && !has_extension(name, ".cld")) return false;
+
+    int base_length = (int)(strlen(name) - strlen(".cvd"));
+    const char *twin_extension = is_cvd ? ".cld" : ".cvd";
+    unsigned int twin_version = get_database_version(db_dir, name, base_length, twin_extension);
+    if (twin_version == 0) return false; // No twin, or a broken one
+
+    unsigned int version = get_database_version(db_dir, name, base_length, is_cvd ? ".cvd" : ".cld");
+    return is_cvd ? twin_version >= version : twin_version > version;
+}
+
+static int compare_names(const void *a, const void *b) {
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+/* Load the signature databases of a directory into the engine */
+/*
+  * @note
+  * The early databases are loaded before the others, like libclamav does for a whole directory
+*/
+cl_error_t database_load(struct cl_engine *engine, const char *db_dir, unsigned int db_options, unsigned int *signatures) {
+    if (engine == NULL || db_dir == NULL || signatures == NULL) return CL_ENULLARG;
+    if (num_excluded_databases == 0) return cl_load(db_dir, engine, signatures, db_options);
+
+    DIR *dir = opendir(db_dir);
+    if (dir == NULL) {
+        fprintf(stderr, "[ERROR] database_load: Failed to open %s: %s\n", db_dir, strerror(errno));
+        return CL_EOPEN;
+    }
+
+    char *names[MAX_DATABASE_FILES];
+    size_t num_names = 0;
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        if (entry->d_name[0] == '.' || !is_database_file(entry->d_name)) continue;
+        if (is_database_excluded(entry->d_name)) {
+            fprintf(stderr, "[INFO] Skipping the excluded database %s\n", entry->d_name);
+            continue;
+        }
+        if (is_superseded_database(db_dir, entry->d_name)) continue;
+        if (num_names >= MAX_DATABASE_FILES) {
+            fprintf(stderr, "[WARNING] database_load: More than %d databases in %s, skipping %s\n", MAX_DATABASE_FILES, db_dir, entry->d_name);
+            continue;
+        }
+
+        names[num_names] = strdup(entry->d_name);
+        if (names[num_names] != NULL) num_names++;
+    }
+    closedir(dir);
+    qsort(names, num_names, sizeof(names[0]), compare_names); // The same order on every load
+
+    cl_error_t result = CL_SUCCESS;
+    for (int pass = 0; pass < 2 && result == CL_SUCCESS; pass++) {
+        for (size_t i = 0; i < num_names && result == CL_SUCCESS; i++) {
+            if (is_early_database(names[i]) != (pass == 0)) continue;
+
+            char path[DATABASE_PATH_SIZE];
+            if (snprintf(path, sizeof(path), "%s/%s", db_dir, names[i]) >= (int)sizeof(path)) {
+                fprintf(stderr, "[WARNING] database_load: The path of %s is too long, skipping it\n", names[i]);
+                continue;
+            }
+
+            result = cl_load(path, engine, signatures, db_options);
+            if (result != CL_SUCCESS) fprintf(stderr, "[ERROR] database_load: Failed to load %s: %s\n", path, cl_strerror(result));
+        }
+    }
+
+    for (size_t i = 0; i < num_names; i++) free(names[i]);
+    return result;
+}
+
+/* Get the resident memory of the process in bytes, 0 if it's not available */
+size_t get_resident_memory(void) {
+    FILE *file = fopen("/proc/self/statm", "re");
+    if (file == NULL) return 0;
+
+    unsigned long long size = 0, resident = 0;
+    int fields = fscanf(file, "%llu %llu", &size, &resident);
+    fclose(file);
+    if (fields != 2) return 0;
+
+    long page_size = sysconf(_SC_PAGESIZE);
+    return page_size > 0 ? (size_t)(resident * (unsigned long long)page_size) : 0;
+}
@@ -0,0 +1,73 @@
+/* database.h
+ *
+ * Copyright 2025 EricLin
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+*/
+
+/* Selective loading of the signature databases */
+/*
+  * Without exclusions the whole database directory is loaded by libclamav at once
+  * With `--exclude-db` (matched against the file name with and without its extension), the databases are loaded one by one and the excluded ones are skipped, e.g. a large third-party `.ndb` on a small host
+  * The `CL_DB_*` options of the profile still apply (see `profile.h`), e.g. `bytecode.cvd` is skipped without `CL_DB_BYTECODE`
+*/
+
+#ifndef DATABASE_H
+#define DATABASE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <clamav.h>
+
+#include "profile.h" // For `EXCLUDE_DB_OPTION`
+
+#define MAX_EXCLUDED_DATABASES 32
+
+/* Check whether the file name belongs to a signature database */
+bool is_database_file(const char *name);
+
+/* Exclude the databases matching a pattern from the engines loaded afterwards */
+/*
+  * @param pattern
+  * A glob (see `fnmatch()`), e.g. `daily`, `main.cvd` or `*.ndb`, it must outlive the engines
+  *
+  * @return
+  * `false` if there are already `MAX_EXCLUDED_DATABASES` patterns
+*/
+bool database_exclude(const char *pattern);
+
+/* Check whether a database is excluded */
+bool is_database_excluded(const char *name);
+
+/* Hash the excluded database patterns, in the order they were given */
+/*
+  * @return
+  * 0 without exclusions, the caches key their verdicts on it since they depend on the loaded signatures
+*/
+uint64_t database_exclusions_hash(void);
+
+/* Load the signature databases of a directory into the engine */
+/*
+  * @param signatures
+  * Incremented by the number of the loaded signatures
+*/
+cl_error_t database_load(struct cl_engine *engine, const char *db_dir, unsigned int db_options, unsigned int *signatures);
+
+/* Get the resident memory of the process in bytes, 0 if it's not available */
+size_t get_resident_memory(void);
+
+#endif // DATABASE_H
@@ -0,0 +1,308 @@
+/* exclusion.c
+ *
+ * Copyright 2025 EricLin
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+*/
+
+#include <ctype.h>
+#include <errno.h>
+#include <fnmatch.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "exclusion.h"
+
+#define EXCLUSION_PATH_SIZE 4096 // Only the path globs need the whole path, the longer paths never match them
+
+/* The kinds of the rules */
+enum {
+    RULE_PATH,
+    RULE_NAME,
+    RULE_EXTENSION,
+    RULE_PATH_GLOB,
+    RULE_NAME_GLOB,
+};
+
+/* FNV-1a over the pieces of a string */
+static inline uint64_t hash_bytes(uint64_t hash, const char *bytes, size_t length) {
+    for (size_t i = 0; i < length; i++) {
+        hash ^= (unsigned char)bytes[i];
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+#define HASH_SEED 0xcbf29ce484222325ULL
+
+static bool string_list_add(StringList *list, const char *text, size_t length) {
+    if (list->count == list->capacity) {
+        size_t capacity = list->capacity > 0 ? list->capacity * 2 : 8;
+        char **items = realloc(list->items, capacity * sizeof(char *));
+        if (items == NULL) return false;
+        list->items = items;
+        list->capacity = capacity;
+    }
+
+    char *item = strndup(text, length);
+    if (item == NULL) return false;
+    list->items[list->count++] = item;
+    return true;
+}
+
+static void string_list_clear(StringList *list) {
+    for (size_t i = 0; i < list->count; i++) free(list->items[i]);
+    free(list->items);
+    *list = (StringList){0};
+}
+
+/* Build a StringSet of the strings, the set borrows them */
+static bool string_set_build(StringSet *set, const StringList *list) {
+    free(set->slots);
+    *set = (StringSet){0};
+    if (list->count == 0) return true;
+
+    size_t size = 16;
+    while (size < list->count * 2) size <<= 1; // Keep the load under 50%
+
+    set->slots = calloc(size, sizeof(char *));
+    if (set->slots == NULL) return false;
+    set->mask = size - 1;
+
+    for (size_t i = 0; i < list->count; i++) {
+        const char *item = list->items[i];
+        size_t index = (size_t)hash_bytes(HASH_SEED, item, strlen(item)) & set->mask;
+        while (set->slots[index] != NULL && strcmp(set->slots[index], item) != 0) index = (index + 1) & set->mask;
+        set->slots[index] = (char *)item;
+    }
+    return true;
+}
+
+/* Look up the concatenation `prefix` + `separator` + `suffix` without building it */
+/*
+  * @param separator
+  * '\0' for no separator
+*/
+static bool string_set_contains(const StringSet *set, const char *prefix, size_t prefix_length, char separator, const char *suffix, size_t suffix_length) {
+    if (set->slots == NULL) return false;
+
+    size_t separator_length = separator != '\0' ? 1 : 0;
+    uint64_t hash = hash_bytes(HASH_SEED, prefix, prefix_length);
+    if (separator_length > 0) hash = hash_bytes(hash, &separator, 1);
+    hash = hash_bytes(hash, suffix, suffix_length);
+
+    for (size_t index = (size_t)hash & set->mask; set->slots[index] != NULL; index = (index + 1) & set->mask) {
+        const char *item = set->slots[index];
+        if (strncmp(item, prefix, prefix_length) != 0) continue;
+        item += prefix_length;
+        if (separator_length > 0 && *item++ != separator) continue;
+        if (strncmp(item, suffix, suffix_length) == 0 && item[suffix_length] == '\0') return true;
+    }
+    return false;
+}
+
+/* Initialize the ExclusionRules */
+void exclusion_rules_init(ExclusionRules *rules) {
+    if (rules == NULL) return;
+
+    *rules = (ExclusionRules){0};
+    rules->is_empty = true;
+}
+
+/* Clear the ExclusionRules */
+void exclusion_rules_clear(ExclusionRules *rules) {
+    if (rules == NULL) return;
+
+    for (size_t i = 0; i < sizeof(rules->rules) / sizeof(rules->rules[0]); i++) string_list_clear(&rules->rules[i]);
+    free(rules->paths.slots);
+    free(rules->names.slots);
+    free(rules->extensions.slots);
+    exclusion_rules_init(rules);
+}
+
+static inline bool has_glob(const char *text) {
+    return strpbrk(text, "*?[") != NULL;
+}
+
+/* Add a rule */
+bool exclusion_rules_add(ExclusionRules *rules, const char *rule) {
+    if (rules == NULL || rule == NULL) return false;
+
+    /* Trim the spaces and the trailing slashes */
+    while (isspace((unsigned char)*rule)) rule++;
+    size_t length = strlen(rule);
+    while (length > 0 && isspace((unsigned char)rule[length - 1])) length--;
+    while (length > 1 && rule[length - 1] == '/') length--;
+    if (length == 0) return false;
+
+    char text[EXCLUSION_PATH_SIZE];
+    if (length >= sizeof(text)) return false;
+    memcpy(text, rule, length);
+    text[length] = '\0';
+
+    int kind;
+    if (strchr(text, '/') != NULL) {
+        if (text[0] != '/') {
+            fprintf(stderr, "[ERROR] exclusion_rules_add: A rule with '/' must be an absolute path: %s\n", text);
+            return false;
+        }
+        kind = has_glob(text) ? RULE_PATH_GLOB : RULE_PATH;
+    }
+    else if (text[0] == '*' && text[1] == '.' && text[2] != '\0' && !has_glob(text + 2)) {
+        kind = RULE_EXTENSION;
+        memmove(text, text + 2, length - 1); // Drop `*.`, including the null terminator
+        length -= 2;
+        for (size_t i = 0; i < length; i++) text[i] = (char)tolower((unsigned char)text[i]);
+    }
+    else kind = has_glob(text) ? RULE_NAME_GLOB : RULE_NAME;
+
+    if (!string_list_add(&rules->rules[kind], text, length)) {
+        fprintf(stderr, "[ERROR] exclusion_rules_add: Out of memory\n");
+        return false;
+    }
+    return true;
+}
+
+/* Add the rules from a file, one rule per line */
+bool exclusion_rules_add_file(ExclusionRules *rules, const char *path) {
+    if (rules == NULL || path == NULL) return false;
+
+    FILE *file = fopen(path, "re");
+    if (file == NULL) {
+        fprintf(stderr, "[ERROR] exclusion_rules_add_file: Failed to open %s: %s\n", path, strerror(errno));
+        return false;
+    }
+
+    bool success = true;
+    char line[EXCLUSION_PATH_SIZE];
+    while (fgets(line, sizeof(line), file) != NULL) {
+        const char *rule = line;
+        while (isspace((unsigned char)*rule)) rule++;
+        if (*rule == '\0' || *rule == '#') continue;
+
+        line[strcspn(line, "\n")] = '\0';
+        success &= exclusion_rules_add(rules, rule);
+    }
+
+    fclose(file);
+    return success;
+}
+
+/* Build the hash sets of the added rules */
+bool exclusion_rules_compile(ExclusionRules *rules) {
+    if (rules == NULL) return false;
+
+    bool success = string_set_build(&rules->paths, &rules->rules[RULE_PATH]) &&
+                   string_set_build(&rules->names, &rules->rules[RULE_NAME]) &&
+                   string_set_build(&rules->extensions, &rules->rules[RULE_EXTENSION]);
+    if (!success) fprintf(stderr, "[ERROR] exclusion_rules_compile: Out of memory\n");
+
+    rules->path_globs = rules->rules[RULE_PATH_GLOB]; // Borrowed, the globs are tried one by one anyway
+    rules->name_globs = rules->rules[RULE_NAME_GLOB];
+
+    rules->is_empty = rules->max_file_size == 0;
+    for (size_t i = 0; i < sizeof(rules->rules) / sizeof(rules->rules[0]); i++) {
+        if (rules->rules[i].count > 0) rules->is_empty = false;
+    }
+    return success;
+}
+
+/* Check whether an entry is excluded */
+bool exclusion_rules_match(const ExclusionRules *rules, const char *dir, size_t dir_length, const char *name, bool is_dir) {
+    if (rules == NULL || rules->is_empty || dir == NULL || name == NULL) return false;
+
+    while (dir_length > 0 && dir[dir_length - 1] == '/') dir_length--; // The entries of `/`
+    size_t name_length = strlen(name);
+
+    if (string_set_contains(&rules->names, "", 0, '\0', name, name_length)) return true;
+
+    if (!is_dir && rules->extensions.slots != NULL) {
+        const char *dot = strrchr(name, '.');
+        if (dot != NULL && dot != name && dot[1] != '\0') {
+            char extension[256];
+            size_t length = name_length - (size_t)(dot + 1 - name);
+            if (length < sizeof(extension)) {
+                for (size_t i = 0; i < length; i++) extension[i] = (char)tolower((unsigned char)dot[1 + i]);
+                if (string_set_contains(&rules->extensions, "", 0, '\0', extension, length)) return true;
+            }
+        }
+    }
+
+    if (string_set_contains(&rules->paths, dir, dir_length, '/', name, name_length)) return true;
+
+    for (size_t i = 0; i < rules->name_globs.count; i++) {
+        if (fnmatch(rules->name_globs.items[i], name, FNM_PERIOD) == 0) return true;
+    }
+
+    if (rules->path_globs.count > 0 && dir_length + 1 + name_length < EXCLUSION_PATH_SIZE) {
+        char path[EXCLUSION_PATH_SIZE];
+        memcpy(path, dir, dir_length);
+        path[dir_length] = '/';
+        memcpy(path + dir_length + 1, name, name_length + 1);
+        for (size_t i = 0; i < rules->path_globs.count; i++) {
+            if (fnmatch(rules->path_globs.items[i], path, FNM_PATHNAME | FNM_PERIOD) == 0) return true;
+        }
+    }
+
+    return false;
+}
+
+/* Check whether a path or any of its parent directories is excluded */
+bool exclusion_rules_match_path(const ExclusionRules *rules, const char *path, bool is_dir) {
+    if (rules == NULL || rules->is_empty || path == NULL) return false;
+
+    char name[EXCLUSION_PATH_SIZE];
+    const char *start = path;
+    while (*start != '\0') {
+        while (*start == '/') start++;
+        if (*start == '\0') break;
+
+        const char *end = start + strcspn(start, "/");
+        size_t length = (size_t)(end - start);
+        if (length >= sizeof(name)) return false;
+        memcpy(name, start, length);
+        name[length] = '\0';
+
+        bool is_last = *end == '\0' || end[strspn(end, "/")] == '\0';
+        if (exclusion_rules_match(rules, path, (size_t)(start - path), name, is_last ? is_dir : true)) return true;
+        start = end;
+    }
+    return false;
+}
+
+/* Parse a size with an optional `K`, `M` or `G` suffix (powers of 1024) */
+bool parse_file_size(const char *text, uint64_t *size) {
+    if (text == NULL || size == NULL || !isdigit((unsigned char)*text)) return false;
+
+    char *end;
+    errno = 0;
+    unsigned long long value = strtoull(text, &end, 10);
+    if (errno != 0) return false;
+
+    int shift = 0;
+    switch (toupper((unsigned char)*end)) {
+        case '\0': break;
+        case 'K': shift = 10; end++; break;
+        case 'M': shift = 20; end++; break;
+        case 'G': shift = 30; end++; break;
+        default: return false;
+    }
+    if (*end != '\0' || value > (UINT64_MAX >> shift)) return false;
+
+    *size = (uint64_t)value << shift;
+    return true;
+}
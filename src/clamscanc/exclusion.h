@@ -0,0 +1,136 @@
+/* exclusion.h
+ *
+ * Copyright 2025 EricLin
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+*/
+
+/* Exclusion rules */
+/*
+  * A rule is one of:
+  *   an absolute path `/var/cache`: the path and everything under it
+  *   an absolute glob `/home/ * /.cache`: matched against the whole path, `*` doesn't match `/`
+  *   a name `.git`, `node_modules`: any file or directory with this name, a directory takes its whole subtree
+  *   an extension `*.iso`: any file with this extension, case-insensitive
+  *   any other glob `cache-*`: matched against the name
+  * The paths, the names and the extensions are compiled into hash sets, so checking an entry doesn't depend on the number of rules
+  * Only the globs are tried one by one
+  *
+  * The rules are plain C without GLib, the GUI links this file too so both apply the same rules
+*/
+
+#ifndef EXCLUSION_H
+#define EXCLUSION_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define EXCLUSION_OPTION "--exclude="
+#define EXCLUSION_FILE_OPTION "--exclude-from="
+#define MAX_FILE_SIZE_OPTION "--max-filesize="
+
+/* Hash set of strings */
+typedef struct {
+    char **slots; // NULL if nothing is added
+    size_t mask;
+} StringSet;
+
+/* List of strings */
+typedef struct {
+    char **items;
+    size_t count;
+    size_t capacity;
+} StringList;
+
+typedef struct {
+    StringList rules[5]; // The rules added, by kind, compiled by `exclusion_rules_compile()`
+
+    StringSet paths; // Without the trailing `/`
+    StringSet names;
+    StringSet extensions; // Lower case, without the dot
+    StringList path_globs;
+    StringList name_globs;
+
+    uint64_t max_file_size; // The larger files are skipped, 0 for no limit
+    bool is_empty; // No rule and no size limit, every check is skipped
+} ExclusionRules;
+
+/* Initialize the ExclusionRules */
+void exclusion_rules_init(ExclusionRules *rules);
+
+/* Clear the ExclusionRules */
+void exclusion_rules_clear(ExclusionRules *rules);
+
+/* Add a rule */
+/*
+  * @return
+  * `true` if the rule is added, `false` if it's invalid (empty or a relative path) or out of memory
+  *
+  * @note
+  * Call `exclusion_rules_compile()` after adding all the rules and setting `max_file_size`
+*/
+bool exclusion_rules_add(ExclusionRules *rules, const char *rule);
+
+/* Add the rules from a file, one rule per line */
+/*
+  * @note
+  * The blank lines and the lines starting with `#` are skipped
+*/
+bool exclusion_rules_add_file(ExclusionRules *rules, const char *path);
+
+/* Build the hash sets of the added rules */
+/*
+  * @return
+  * `false` if out of memory
+*/
+bool exclusion_rules_compile(ExclusionRules *rules);
+
+/* Check whether an entry is excluded */
+/*
+  * @param dir
+  * The parent directory, not necessarily null-terminated
+  *
+  * @param dir_length
+  * The length of `dir`
+  *
+  * @param name
+  * The name of the entry
+  *
+  * @param is_dir
+  * The extensions only apply to the files
+  *
+  * @warning
+  * The ExclusionRules MUST be compiled
+*/
+bool exclusion_rules_match(const ExclusionRules *rules, const char *dir, size_t dir_length, const char *name, bool is_dir);
+
+/* Check whether a path or any of its parent directories is excluded */
+/*
+  * @note
+  * Use it for the roots, the traversal never reaches the entries under an excluded directory
+*/
+bool exclusion_rules_match_path(const ExclusionRules *rules, const char *path, bool is_dir);
+
+/* Check whether a file is larger than `max_file_size` */
+static inline bool exclusion_rules_exceeds_size(const ExclusionRules *rules, uint64_t size) {
+    return rules != NULL && rules->max_file_size > 0 && size > rules->max_file_size;
+}
+
+/* Parse a size with an optional `K`, `M` or `G` suffix (powers of 1024) */
+bool parse_file_size(const char *text, uint64_t *size);
+
+#endif // EXCLUSION_H
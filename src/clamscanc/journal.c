@@ -0,0 +1,703 @@
+/* journal.c
+ *
+ * Copyright 2025 EricLin
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+*/
+
+#define _GNU_SOURCE // For `open_by_handle_at()`
+
+#include <string.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#ifdef __linux__
+#include <sys/fanotify.h>
+#include <sys/inotify.h>
+#include <sys/statfs.h>
+#endif
+
+#include "journal.h"
+
+#define CHANGE_JOURNAL_NAME "clamscanc/journal"
+#define NOTIFY_BUFFER_SIZE (64 * 1024)
+#define PATH_SET_INITIAL_CAPACITY 1024
+#define PATH_SET_MAX_CAPACITY ((size_t)1 << 24) // Stop dropping the duplicates beyond this, the records are still kept
+
+#ifdef __linux__
+#define FANOTIFY_EVENTS (FAN_CLOSE_WRITE | FAN_MOVED_TO | FAN_CREATE | FAN_ONDIR)
+#define INOTIFY_EVENTS (IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE | IN_ONLYDIR | IN_DONT_FOLLOW | IN_EXCL_UNLINK)
+#endif
+
+/* Hash a path, the result is never 0 */
+/*
+  * @note
+  * Two paths with the same hash are treated as duplicates, at 64 bits this is negligible even for millions of records
+*/
+static inline uint64_t hash_path(const char *path, size_t length) {
+    uint64_t hash = 0xCBF29CE484222325ULL; // FNV-1a
+    for (size_t i = 0; i < length; i++) {
+        hash ^= (unsigned char)path[i];
+        hash *= 0x100000001B3ULL;
+    }
+    return hash != 0 ? hash : 1;
+}
+
+/* Double the capacity of the PathSet */
+static bool path_set_grow(PathSet *set) {
+    size_t capacity = set->capacity == 0 ? PATH_SET_INITIAL_CAPACITY : set->capacity * 2;
+    if (capacity > PATH_SET_MAX_CAPACITY) return false;
+
+    uint64_t *slots = calloc(capacity, sizeof(uint64_t));
+    if (slots == NULL) return false;
+
+    for (size_t i = 0; i < set->capacity; i++) { // Rehash the old slots
+        if (set->slots[i] == 0) continue;
+        size_t index = set->slots[i] & (capacity - 1);
+        while (slots[index] != 0) index = (index + 1) & (capacity - 1);
+        slots[index] = set->slots[i];
+    }
+
+    free(set->slots);
+    set->slots = slots;
+    set->capacity = capacity;
+    return true;
+}
+
+/* Add a path to the PathSet */
+/*
+  * @return
+  * `true` if the path is new (or the set is full), `false` if it's a duplicate
+*/
+static bool path_set_insert(PathSet *set, const char *path) {
+    if ((set->count + 1) * 2 > set->capacity && !path_set_grow(set)) return true; // Too many paths, keep the duplicates rather than dropping a change
+
+    uint64_t hash = hash_path(path, strlen(path));
+    size_t index = hash & (set->capacity - 1);
+    while (set->slots[index] != 0) {
+        if (set->slots[index] == hash) return false;
+        index = (index + 1) & (set->capacity - 1);
+    }
+
+    set->slots[index] = hash;
+    set->count++;
+    return true;
+}
+
+/* Check whether the first `length` bytes of the path are in the PathSet */
+static bool path_set_contains(const PathSet *set, const char *path, size_t length) {
+    if (set->count == 0) return false;
+
+    uint64_t hash = hash_path(path, length);
+    for (size_t index = hash & (set->capacity - 1); set->slots[index] != 0; index = (index + 1) & (set->capacity - 1)) {
+        if (set->slots[index] == hash) return true;
+    }
+    return false;
+}
+
+/* Forget all the paths in the PathSet */
+static void path_set_reset(PathSet *set) {
+    if (set->slots != NULL) memset(set->slots, 0, set->capacity * sizeof(uint64_t));
+    set->count = 0;
+}
+
+/* Free the PathSet */
+static void path_set_clear(PathSet *set) {
+    free(set->slots);
+    set->slots = NULL;
+    set->capacity = 0;
+    set->count = 0;
+}
+
+/* Lock a file, retry if interrupted by a signal */
+static inline void lock_file(int fd, int operation) {
+    while (flock(fd, operation) == -1 && errno == EINTR);
+}
+
+/* Join a directory and a name, return `false` if the result doesn't fit in `path` */
+static bool join_path(char *path, size_t size, const char *dir, const char *name) {
+    int length = snprintf(path, size, "%s%s%s", dir, strcmp(dir, "/") == 0 ? "" : "/", name);
+    return length > 0 && (size_t)length < size;
+}
+
+/* Get the default path of the journal file */
+bool change_journal_default_path(char *path, size_t size) {
+    return state_file_default_path(CHANGE_JOURNAL_ENV, CHANGE_JOURNAL_NAME, path, size);
+}
+
+/* Check whether the path is under one of the watched roots */
+static bool is_under_roots(const ChangeJournal *journal, const char *path) {
+    for (size_t i = 0; i < journal->num_roots; i++) {
+        size_t length = strlen(journal->roots[i]);
+        if (strncmp(path, journal->roots[i], length) != 0) continue;
+        if (length == 1 || path[length] == '/' || path[length] == '\0') return true; // "/" covers everything, otherwise stop at a component boundary
+    }
+    return false;
+}
+
+/* Forget the recorded paths if an incremental scan has taken them, so their next changes are recorded again */
+/*
+  * @note
+  * The recorder is the only writer appending to the journal, so a smaller file means it was truncated by `change_journal_take()`
+*/
+static void check_taken(ChangeJournal *journal) {
+    struct stat status;
+    if (fstat(journal->journal_fd, &status) == -1 || status.st_size >= journal->journal_size) return;
+
+    path_set_reset(&journal->recorded);
+    journal->journal_size = status.st_size;
+}
+
+/* Append the buffered records to the journal file */
+static void flush_records(ChangeJournal *journal) {
+    if (journal->buffer_length == 0) return;
+
+    lock_file(journal->journal_fd, LOCK_EX); // Don't interleave with `change_journal_take()`
+    check_taken(journal);
+    if (!write_all(journal->journal_fd, journal->buffer, journal->buffer_length)) {
+        fprintf(stderr, "[ERROR] change_journal: Failed to write the journal: %s\n", strerror(errno));
+    }
+
+    struct stat status;
+    if (fstat(journal->journal_fd, &status) == 0) journal->journal_size = status.st_size;
+    lock_file(journal->journal_fd, LOCK_UN);
+
+    journal->buffer_length = 0;
+}
+
+/* Record a changed path */
+static void record_path(ChangeJournal *journal, const char *path) {
+    if (!is_under_roots(journal, path) || !path_set_insert(&journal->recorded, path)) return; // Not watched or already waiting for the next scan
+
+    size_t length = strlen(path) + 1; // Keep the '\0' as the separator
+    if (journal->buffer_length + length > sizeof(journal->buffer)) flush_records(journal);
+
+    memcpy(journal->buffer + journal->buffer_length, path, length);
+    journal->buffer_length += length;
+}
+
+/* Record all the roots, used when the kernel has dropped some events */
+static void record_roots(ChangeJournal *journal) {
+    fprintf(stderr, "[WARNING] change_journal: The event queue overflowed, the whole roots will be scanned\n");
+    for (size_t i = 0; i < journal->num_roots; i++) record_path(journal, journal->roots[i]);
+}
+
+#ifdef __linux__
+/* Find the root on the filesystem reported by fanotify */
+static int find_root_fd(const ChangeJournal *journal, const void *fsid) {
+    for (size_t i = 0; i < journal->num_roots; i++) {
+        if (memcmp(&journal->root_fsids[i], fsid, sizeof(journal->root_fsids[i])) == 0) return journal->root_fds[i];
+    }
+    return -1;
+}
+
+/* Start watching the roots with fanotify */
+/*
+  * A filesystem mark reports the changes everywhere on the filesystem without walking the tree,
+  * the events carry the file handle of the parent directory and the name, resolved with `open_by_handle_at()`
+*/
+static bool fanotify_backend_init(ChangeJournal *journal) {
+#ifdef FAN_REPORT_DFID_NAME
+    int fd = fanotify_init(FAN_CLASS_NOTIF | FAN_CLOEXEC | FAN_NONBLOCK | FAN_REPORT_DFID_NAME, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) return false; // Not permitted or the kernel is too old (< 5.9)
+
+    for (size_t i = 0; i < journal->num_roots; i++) {
+        struct statfs status;
+        journal->root_fds[i] = open(journal->roots[i], O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (journal->root_fds[i] == -1 || fstatfs(journal->root_fds[i], &status) == -1 ||
+            fanotify_mark(fd, FAN_MARK_ADD | FAN_MARK_FILESYSTEM, FANOTIFY_EVENTS, AT_FDCWD, journal->roots[i]) == -1) {
+            close(fd);
+            return false;
+        }
+        memcpy(&journal->root_fsids[i], &status.f_fsid, sizeof(journal->root_fsids[i]));
+    }
+
+    journal->notify_fd = fd;
+    journal->backend = JOURNAL_BACKEND_FANOTIFY;
+    return true;
+#else
+    return false;
+#endif
+}
+
+/* Resolve a fanotify event to a path and record it */
+static void handle_fanotify_event(ChangeJournal *journal, const struct fanotify_event_metadata *event) {
+#ifdef FAN_REPORT_DFID_NAME
+    if (event->event_len < sizeof(*event) + sizeof(struct fanotify_event_info_fid)) return;
+
+    struct fanotify_event_info_fid *info = (struct fanotify_event_info_fid *)(event + 1);
+    if (info->hdr.info_type != FAN_EVENT_INFO_TYPE_DFID_NAME) return;
+
+    struct file_handle *handle = (struct file_handle *)info->handle;
+    const char *name = (const char *)(handle->f_handle + handle->handle_bytes);
+
+    int mount_fd = find_root_fd(journal, &info->fsid);
+    if (mount_fd == -1) return;
+
+    int dir_fd = open_by_handle_at(mount_fd, handle, O_PATH | O_CLOEXEC);
+    if (dir_fd == -1) return; // The directory is already removed
+
+    char link[32];
+    char dir[MAX_PATH];
+    snprintf(link, sizeof(link), "/proc/self/fd/%d", dir_fd);
+    ssize_t length = readlink(link, dir, sizeof(dir) - 1);
+    close(dir_fd);
+    if (length <= 0) return;
+    dir[length] = '\0';
+
+    char path[MAX_PATH];
+    if (strcmp(name, ".") == 0) record_path(journal, dir); // The event is about the directory itself
+    else if (join_path(path, sizeof(path), dir, name)) record_path(journal, path);
+#endif
+}
+
+/* Read the events from fanotify */
+static void handle_fanotify_events(ChangeJournal *journal) {
+    static _Alignas(struct fanotify_event_metadata) char buffer[NOTIFY_BUFFER_SIZE];
+
+    while (true) {
+        ssize_t bytes = read(journal->notify_fd, buffer, sizeof(buffer));
+        if (bytes == -1 && errno == EINTR) continue;
+        if (bytes <= 0) break; // Drained (`EAGAIN`)
+
+        check_taken(journal); // Must be after the read, so a change made after the last scan is never dropped as a duplicate
+
+        struct fanotify_event_metadata *event = (struct fanotify_event_metadata *)buffer;
+        for (; FAN_EVENT_OK(event, bytes); event = FAN_EVENT_NEXT(event, bytes)) {
+            if (event->vers != FANOTIFY_METADATA_VERSION) continue;
+            if (event->mask & FAN_Q_OVERFLOW) record_roots(journal);
+            else handle_fanotify_event(journal, event);
+            if (event->fd >= 0) close(event->fd); // Only set without `FAN_REPORT_FID`, just in case
+        }
+    }
+}
+
+/* Remember the directory of an inotify watch */
+static void set_watch_path(ChangeJournal *journal, int wd, const char *path) {
+    if ((size_t)wd >= journal->watch_capacity) {
+        size_t capacity = journal->watch_capacity == 0 ? PATH_SET_INITIAL_CAPACITY : journal->watch_capacity;
+        while (capacity <= (size_t)wd) capacity *= 2;
+
+        char **watch_paths = realloc(journal->watch_paths, capacity * sizeof(char *));
+        if (watch_paths == NULL) return;
+        memset(watch_paths + journal->watch_capacity, 0, (capacity - journal->watch_capacity) * sizeof(char *));
+        journal->watch_paths = watch_paths;
+        journal->watch_capacity = capacity;
+    }
+
+    free(journal->watch_paths[wd]); // The watch is reused when a directory is moved inside the roots
+    journal->watch_paths[wd] = strdup(path);
+}
+
+/* Watch a directory and all its subdirectories with inotify */
+/*
+  * @param path
+  * The directory, the subdirectories are appended to it while walking, so it MUST hold `MAX_PATH` bytes
+*/
+static void watch_tree(ChangeJournal *journal, char *path, size_t length) {
+    int wd = inotify_add_watch(journal->notify_fd, path, INOTIFY_EVENTS);
+    if (wd == -1) {
+        if (errno == ENOSPC) fprintf(stderr, "[WARNING] change_journal: Out of inotify watches at %s, raise fs.inotify.max_user_watches\n", path);
+        return;
+    }
+    set_watch_path(journal, wd, path);
+
+    DIR *dir = opendir(path);
+    if (dir == NULL) return;
+
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) continue;
+
+        bool is_dir = entry->d_type == DT_DIR;
+        if (entry->d_type == DT_UNKNOWN) { // Some filesystems don't report the type
+            struct stat status;
+            is_dir = fstatat(dirfd(dir), entry->d_name, &status, AT_SYMLINK_NOFOLLOW) == 0 && S_ISDIR(status.st_mode);
+        }
+        if (!is_dir) continue;
+
+        size_t name_length = strlen(entry->d_name);
+        size_t separator = path[length - 1] == '/' ? 0 : 1;
+        if (length + separator + name_length >= MAX_PATH) continue; // Too long, skip it
+
+        if (separator) path[length] = '/';
+        memcpy(path + length + separator, entry->d_name, name_length + 1);
+        watch_tree(journal, path, length + separator + name_length);
+        path[length] = '\0';
+    }
+    closedir(dir);
+}
+
+/* Start watching the roots with inotify */
+static bool inotify_backend_init(ChangeJournal *journal) {
+    journal->notify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (journal->notify_fd == -1) {
+        fprintf(stderr, "[ERROR] change_journal_init: Failed to initialize inotify: %s\n", strerror(errno));
+        return false;
+    }
+    journal->backend = JOURNAL_BACKEND_INOTIFY;
+
+    static char path[MAX_PATH];
+    for (size_t i = 0; i < journal->num_roots; i++) {
+        size_t length = strlen(journal->roots[i]);
+        if (length >= sizeof(path)) continue;
+        memcpy(path, journal->roots[i], length + 1);
+        watch_tree(journal, path, length);
+    }
+    return true;
+}
+
+/* Read the events from inotify */
+static void handle_inotify_events(ChangeJournal *journal) {
+    static _Alignas(struct inotify_event) char buffer[NOTIFY_BUFFER_SIZE];
+    static char path[MAX_PATH];
+
+    while (true) {
+        ssize_t bytes = read(journal->notify_fd, buffer, sizeof(buffer));
+        if (bytes == -1 && errno == EINTR) continue;
+        if (bytes <= 0) break; // Drained (`EAGAIN`)
+
+        check_taken(journal); // Must be after the read, so a change made after the last scan is never dropped as a duplicate
+
+        for (ssize_t offset = 0; offset < bytes;) {
+            struct inotify_event *event = (struct inotify_event *)(buffer + offset);
+            offset += sizeof(struct inotify_event) + event->len;
+
+            if (event->mask & IN_Q_OVERFLOW) {
+                record_roots(journal);
+                continue;
+            }
+
+            if (event->wd < 0 || (size_t)event->wd >= journal->watch_capacity || journal->watch_paths[event->wd] == NULL) continue;
+            if (event->mask & IN_IGNORED) { // The directory is removed
+                free(journal->watch_paths[event->wd]);
+                journal->watch_paths[event->wd] = NULL;
+                continue;
+            }
+            if (event->len == 0 || !join_path(path, sizeof(path), journal->watch_paths[event->wd], event->name)) continue;
+
+            /* A new directory may already have files before it's watched, so it's recorded as a whole */
+            if ((event->mask & IN_ISDIR) && (event->mask & (IN_CREATE | IN_MOVED_TO))) watch_tree(journal, path, strlen(path));
+            record_path(journal, path);
+        }
+    }
+}
+#endif
+
+/* Initialize the ChangeJournal and start watching the roots */
+bool change_journal_init(ChangeJournal *journal, const char *path, const char *const *roots, size_t num_roots) {
+    if (journal == NULL || path == NULL || roots == NULL || num_roots == 0) return false;
+
+    memset(journal, 0, offsetof(ChangeJournal, buffer)); // The buffer doesn't need to be zeroed
+    journal->journal_fd = -1;
+    journal->notify_fd = -1;
+    for (size_t i = 0; i < CHANGE_JOURNAL_MAX_ROOTS; i++) journal->root_fds[i] = -1;
+
+    if (num_roots > CHANGE_JOURNAL_MAX_ROOTS) {
+        fprintf(stderr, "[ERROR] change_journal_init: Too many roots, at most %d\n", CHANGE_JOURNAL_MAX_ROOTS);
+        return false;
+    }
+
+    for (size_t i = 0; i < num_roots; i++) {
+        journal->roots[i] = realpath(roots[i], NULL); // The events are reported with the resolved paths
+        if (journal->roots[i] == NULL) {
+            fprintf(stderr, "[ERROR] change_journal_init: Failed to get real path of %s: %s\n", roots[i], strerror(errno));
+            change_journal_clear(journal);
+            return false;
+        }
+        journal->num_roots++;
+    }
+
+    make_parent_directories(path);
+    journal->journal_fd = open(path, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0600);
+    struct stat status;
+    if (journal->journal_fd == -1 || fstat(journal->journal_fd, &status) == -1) {
+        fprintf(stderr, "[ERROR] change_journal_init: Failed to open %s: %s\n", path, strerror(errno));
+        change_journal_clear(journal);
+        return false;
+    }
+    journal->journal_size = status.st_size;
+
+#ifdef __linux__
+    if (fanotify_backend_init(journal)) {
+        fprintf(stderr, "[INFO] Recording the changes with fanotify into %s\n", path);
+        return true;
+    }
+    for (size_t i = 0; i < journal->num_roots; i++) { // Not used by inotify
+        if (journal->root_fds[i] != -1) close(journal->root_fds[i]);
+        journal->root_fds[i] = -1;
+    }
+
+    if (inotify_backend_init(journal)) {
+        fprintf(stderr, "[INFO] Recording the changes with inotify into %s\n", path);
+        return true;
+    }
+#else
+    fprintf(stderr, "[ERROR] change_journal_init: The change journal is only supported on Linux\n");
+#endif
+
+    change_journal_clear(journal);
+    return false;
+}
+
+/* Clear the ChangeJournal, the buffered records are flushed */
+void change_journal_clear(ChangeJournal *journal) {
+    if (journal == NULL) return;
+
+    if (journal->journal_fd != -1) {
+        flush_records(journal);
+        close(journal->journal_fd);
+    }
+    journal->journal_fd = -1;
+
+    if (journal->notify_fd != -1) close(journal->notify_fd);
+    journal->notify_fd = -1;
+
+    for (size_t i = 0; i < journal->num_roots; i++) {
+        if (journal->root_fds[i] != -1) close(journal->root_fds[i]);
+        journal->root_fds[i] = -1;
+        free(journal->roots[i]);
+        journal->roots[i] = NULL;
+    }
+    journal->num_roots = 0;
+
+    for (size_t i = 0; i < journal->watch_capacity; i++) free(journal->watch_paths[i]);
+    free(journal->watch_paths);
+    journal->watch_paths = NULL;
+    journal->watch_capacity = 0;
+
+    path_set_clear(&journal->recorded);
+}
+
+/* Get the current time in milliseconds */
+static inline int64_t monotonic_ms(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (int64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+/* Record the changes until `stop` is set */
+void change_journal_main(ChangeJournal *journal, volatile sig_atomic_t *stop) {
+    if (journal == NULL || journal->notify_fd == -1) return;
+
+    struct pollfd poll_fd = { .fd = journal->notify_fd, .events = POLLIN };
+    int64_t last_flush = monotonic_ms();
+
+    while (!*stop) {
+        int ready = poll(&poll_fd, 1, CHANGE_JOURNAL_FLUSH_MS);
+        if (ready == -1) {
+            if (errno == EINTR) continue; // Recheck `stop`
+            fprintf(stderr, "[ERROR] change_journal_main: Failed to poll: %s\n", strerror(errno));
+            break;
+        }
+
+#ifdef __linux__
+        if (ready > 0) {
+            if (journal->backend == JOURNAL_BACKEND_FANOTIFY) handle_fanotify_events(journal);
+            else handle_inotify_events(journal);
+        }
+#endif
+
+        /* Batch the writes while the changes keep coming, flush when it's quiet or the batch is old enough */
+        int64_t now = monotonic_ms();
+        if (ready == 0 || now - last_flush >= CHANGE_JOURNAL_FLUSH_MS) {
+            flush_records(journal);
+            last_flush = now;
+        }
+    }
+
+    flush_records(journal);
+}
+
+/* Read the whole file into a buffer */
+/*
+  * @return
+  * The length of the content, the buffer is grown as needed; -1 on failure
+*/
+static ssize_t read_whole_file(int fd, char **buffer, size_t *capacity, size_t offset) {
+    while (true) {
+        if (offset == *capacity) {
+            size_t new_capacity = *capacity == 0 ? CHANGE_JOURNAL_BUFFER_SIZE : *capacity * 2;
+            char *new_buffer = realloc(*buffer, new_capacity);
+            if (new_buffer == NULL) return -1;
+            *buffer = new_buffer;
+            *capacity = new_capacity;
+        }
+
+        ssize_t bytes = read(fd, *buffer + offset, *capacity - offset);
+        if (bytes == -1) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        if (bytes == 0) return (ssize_t)offset;
+        offset += (size_t)bytes;
+    }
+}
+
+/* Check whether a parent directory of the record is also recorded, it's traversed as a whole so the record is redundant */
+static bool is_covered_by_parent(const PathSet *recorded, const char *record, size_t length) {
+    for (size_t i = length - 1; i > 0; i--) {
+        if (record[i] == '/' && path_set_contains(recorded, record, i)) return true;
+    }
+    return length > 1 && path_set_contains(recorded, "/", 1); // The root directory itself
+}
+
+/* Drop the duplicated and the redundant records in place */
+/*
+  * @return
+  * The new length of the records
+*/
+static size_t compact_records(char *records, size_t length, size_t *count) {
+    PathSet recorded = {0};
+    size_t output = 0;
+    *count = 0;
+
+    /* Drop the duplicates first, the remaining records are all in `recorded` */
+    for (size_t offset = 0; offset < length;) {
+        char *record = records + offset;
+        size_t record_length = strnlen(record, length - offset);
+        offset += record_length + 1;
+        if (record_length == 0 || offset > length) continue; // Empty or truncated (e.g. the recorder was killed while writing)
+
+        if (!path_set_insert(&recorded, record)) continue;
+        memmove(records + output, record, record_length + 1);
+        output += record_length + 1;
+    }
+
+    /* Then drop the paths inside a recorded directory, e.g. the files created in a new directory */
+    length = output;
+    output = 0;
+    for (size_t offset = 0; offset < length;) {
+        char *record = records + offset;
+        size_t record_length = strlen(record);
+        offset += record_length + 1;
+
+        if (is_covered_by_parent(&recorded, record, record_length)) continue;
+        memmove(records + output, record, record_length + 1);
+        output += record_length + 1;
+        (*count)++;
+    }
+
+    path_set_clear(&recorded);
+    return output;
+}
+
+/* Take the recorded changes for an incremental scan */
+bool change_journal_take(const char *path, const char *pending_path, size_t *count) {
+    if (path == NULL || pending_path == NULL || count == NULL) return false;
+    *count = 0;
+
+    make_parent_directories(path);
+    int journal_fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (journal_fd == -1) {
+        fprintf(stderr, "[ERROR] change_journal_take: Failed to open %s: %s\n", path, strerror(errno));
+        return false;
+    }
+    lock_file(journal_fd, LOCK_EX); // The recorder waits until the records are moved
+
+    char *records = NULL;
+    size_t capacity = 0;
+    ssize_t length = 0;
+    bool result = false;
+
+    /* The records left by an interrupted scan first, then the new ones */
+    int pending_fd = open(pending_path, O_RDONLY | O_CLOEXEC);
+    if (pending_fd != -1) {
+        length = read_whole_file(pending_fd, &records, &capacity, 0);
+        close(pending_fd);
+    }
+    if (length != -1) length = read_whole_file(journal_fd, &records, &capacity, (size_t)length);
+    if (length == -1) {
+        fprintf(stderr, "[ERROR] change_journal_take: Failed to read the journal: %s\n", strerror(errno));
+        goto cleanup;
+    }
+
+    length = (ssize_t)compact_records(records, (size_t)length, count);
+
+    /* Replace the pending file atomically, so the records survive a crash at any point */
+    char temp_path[MAX_PATH];
+    if (snprintf(temp_path, sizeof(temp_path), "%s.tmp", pending_path) >= (int)sizeof(temp_path)) goto cleanup;
+
+    int temp_fd = open(temp_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (temp_fd == -1 || !write_all(temp_fd, records, (size_t)length) || fsync(temp_fd) == -1) {
+        fprintf(stderr, "[ERROR] change_journal_take: Failed to write %s: %s\n", temp_path, strerror(errno));
+        if (temp_fd != -1) close(temp_fd);
+        unlink(temp_path);
+        goto cleanup;
+    }
+    close(temp_fd);
+
+    if (rename(temp_path, pending_path) == -1 || ftruncate(journal_fd, 0) == -1) {
+        fprintf(stderr, "[ERROR] change_journal_take: Failed to move the records: %s\n", strerror(errno));
+        goto cleanup;
+    }
+    result = true;
+
+cleanup:
+    free(records);
+    lock_file(journal_fd, LOCK_UN);
+    close(journal_fd);
+    return result;
+}
+
+/* Replay the paths taken by `change_journal_take()` */
+void replay_journal(const char *pending_path, PathArena *arena, TaskPool *dir_tasks, TaskPool *file_tasks, size_t owner) {
+    int fd = open(pending_path, O_RDONLY | O_CLOEXEC);
+    struct stat status;
+    if (fd == -1 || fstat(fd, &status) == -1 || status.st_size == 0) {
+        if (fd != -1) close(fd);
+        return;
+    }
+
+    size_t length = (size_t)status.st_size;
+    const char *records = mmap(NULL, length, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (records == MAP_FAILED) {
+        fprintf(stderr, "[ERROR] replay_journal: Failed to map %s: %s\n", pending_path, strerror(errno));
+        return;
+    }
+
+    for (size_t offset = 0; offset < length;) {
+        const char *record = records + offset;
+        size_t record_length = strnlen(record, length - offset);
+        offset += record_length + 1;
+        if (record_length == 0 || offset > length) continue;
+
+        struct stat entry;
+        if (lstat(record, &entry) == -1) continue; // Removed after being recorded
+
+        Task task;
+        TaskPool *pool = NULL;
+        if (S_ISREG(entry.st_mode) && build_task(arena, TASK_SCAN_FILE, record, NULL, &task)) {
+            task.size = (uint64_t)entry.st_size; // For the large file lane
+            pool = file_tasks;
+        }
+        else if (S_ISDIR(entry.st_mode) && build_task(arena, TASK_SCAN_DIR, record, NULL, &task)) pool = dir_tasks;
+        if (pool != NULL) task_pool_add(pool, owner, task); // Symbolic links and special files are skipped like the full scan does
+        if (pool == file_tasks) stats_add(STAT_FILES_ENQUEUED, 1);
+    }
+
+    munmap((void *)records, length);
+}
@@ -0,0 +1,132 @@
+/* journal.h
+ *
+ * Copyright 2025 EricLin
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+*/
+
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <signal.h>
+#include <sys/types.h>
+
+#include "manager.h"
+
+#define CHANGE_JOURNAL_ENV "CLAMSCANC_JOURNAL" // Override the journal file path
+#define CHANGE_JOURNAL_PENDING_SUFFIX ".pending" // The changes taken by an incremental scan, removed after the scan is finished
+#define CHANGE_JOURNAL_MAX_ROOTS 16
+#define CHANGE_JOURNAL_BUFFER_SIZE (64 * 1024) // Records are flushed in batches of this size
+#define CHANGE_JOURNAL_FLUSH_MS 1000 // Flush the buffered records at least this often
+
+/* Path set */
+/*
+  * An open addressing set of path hashes, used for dropping the duplicated records
+  * A slot is 0 when it's empty
+*/
+typedef struct {
+	uint64_t *slots;
+	size_t capacity;
+	size_t count;
+} PathSet;
+
+/* Journal backends */
+typedef enum {
+	JOURNAL_BACKEND_FANOTIFY, // A single mark per filesystem, needs `CAP_SYS_ADMIN` and `CAP_DAC_READ_SEARCH`
+	JOURNAL_BACKEND_INOTIFY // A watch per directory, limited by `fs.inotify.max_user_watches`
+} JournalBackend;
+
+/* Change journal */
+/*
+  * Record the created and modified paths under the watched roots, an incremental scan takes them later
+  * A record is an absolute path terminated by '\0'
+  * `journal_size` is the size after the last flush, a smaller size means the records were taken by an incremental scan
+  * `root_fds` and `root_fsids` are used for resolving the file handles reported by fanotify
+  * Only one recorder should append to a journal file
+  * `watch_paths` maps an inotify watch descriptor to its directory
+*/
+typedef struct {
+	int journal_fd;
+	int notify_fd;
+	JournalBackend backend;
+	off_t journal_size;
+
+	char *roots[CHANGE_JOURNAL_MAX_ROOTS];
+	int root_fds[CHANGE_JOURNAL_MAX_ROOTS];
+	uint64_t root_fsids[CHANGE_JOURNAL_MAX_ROOTS];
+	size_t num_roots;
+
+	char **watch_paths;
+	size_t watch_capacity;
+
+	PathSet recorded; // The paths recorded since the last incremental scan
+	char buffer[CHANGE_JOURNAL_BUFFER_SIZE];
+	size_t buffer_length;
+} ChangeJournal;
+
+/* Get the default path of the journal file */
+/*
+  * @note
+  * `$CLAMSCANC_JOURNAL` if set, otherwise `clamscanc/journal` in the cache directory (see `state_file_default_path()`)
+*/
+bool change_journal_default_path(char *path, size_t size);
+
+/* Initialize the ChangeJournal and start watching the roots */
+/*
+  * @param path
+  * The journal file, its parent directory is created if needed
+  *
+  * @param roots
+  * The absolute paths of the directories to be watched
+  *
+  * @note
+  * fanotify is used when it's permitted, otherwise inotify
+*/
+bool change_journal_init(ChangeJournal *journal, const char *path, const char *const *roots, size_t num_roots);
+
+/* Clear the ChangeJournal, the buffered records are flushed */
+void change_journal_clear(ChangeJournal *journal);
+
+/* Record the changes until `stop` is set (e.g. by `SIGINT` or `SIGTERM`) */
+void change_journal_main(ChangeJournal *journal, volatile sig_atomic_t *stop);
+
+/* Take the recorded changes for an incremental scan */
+/*
+  * The records are moved from the journal to `pending_path` without the duplicates, the recorder keeps appending to the empty journal
+  * The records left by an interrupted scan are kept, so no change is lost
+  *
+  * @param count
+  * The number of the paths waiting in `pending_path` [OUT]
+  *
+  * @return
+  * `true` on success, `false` otherwise
+*/
+bool change_journal_take(const char *path, const char *pending_path, size_t *count);
+
+/* Replay the paths taken by `change_journal_take()` */
+/*
+  * The regular files are added as file tasks, the directories (e.g. moved into a root) are traversed as usual
+  * The paths removed after being recorded are skipped
+  *
+  * @warning
+  * This function MUST be called by a producer process
+*/
+void replay_journal(const char *pending_path, PathArena *arena, TaskPool *dir_tasks, TaskPool *file_tasks, size_t owner);
+
+#endif // JOURNAL_H
@@ -0,0 +1,157 @@
+/* json-lines.c
+ *
+ * Copyright 2025 EricLin
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+*/
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "json-lines.h"
+
+/* Appends to a fixed buffer, `is_full` is set once something doesn't fit */
+typedef struct {
+    char *data;
+    size_t size;
+    size_t length;
+    bool is_full;
+} LineWriter;
+
+static void line_writer_append(LineWriter *writer, const char *text, size_t length) {
+    if (writer->is_full || length > writer->size - writer->length) {
+        writer->is_full = true;
+        return;
+    }
+    memcpy(writer->data + writer->length, text, length);
+    writer->length += length;
+}
+
+/* Get the length of the UTF-8 sequence at `text`, 0 if it's invalid */
+static size_t utf8_sequence_length(const unsigned char *text, size_t length) {
+    size_t expected;
+    uint32_t min;
+    if (text[0] < 0x80) return 1;
+    else if ((text[0] & 0xE0) == 0xC0) { expected = 2; min = 0x80; }
+    else if ((text[0] & 0xF0) == 0xE0) { expected = 3; min = 0x800; }
+    else if ((text[0] & 0xF8) == 0xF0) { expected = 4; min = 0x10000; }
+    else return 0;
+    if (expected > length) return 0;
+
+    uint32_t code_point = text[0] & (0x7F >> expected);
+    for (size_t i = 1; i < expected; i++) {
+        if ((text[i] & 0xC0) != 0x80) return 0;
+        code_point = (code_point << 6) | (text[i] & 0x3F);
+    }
+
+    bool is_valid = code_point >= min && code_point <= 0x10FFFF && (code_point < 0xD800 || code_point > 0xDFFF); // No overlong form or surrogate
+    return is_valid ? expected : 0;
+}
+
+/* Append a JSON string, `null` if `text` is NULL */
+static void line_writer_append_string(LineWriter *writer, const char *text, size_t length) {
+    if (text == NULL) {
+        line_writer_append(writer, "null", 4);
+        return;
+    }
+
+    line_writer_append(writer, "\"", 1);
+
+    const unsigned char *bytes = (const unsigned char *)text;
+    size_t start = 0; // The bytes since `start` are copied as they are
+    for (size_t i = 0; i < length;) {
+        unsigned char byte = bytes[i];
+        size_t sequence_length = byte >= 0x20 && byte != '"' && byte != '\\' ? utf8_sequence_length(bytes + i, length - i) : 0;
+        if (sequence_length > 0) {
+            i += sequence_length;
+            continue;
+        }
+
+        line_writer_append(writer, text + start, i - start);
+
+        char escape[8];
+        switch (byte) {
+            case '"': line_writer_append(writer, "\\\"", 2); break;
+            case '\\': line_writer_append(writer, "\\\\", 2); break;
+            case '\n': line_writer_append(writer, "\\n", 2); break;
+            case '\r': line_writer_append(writer, "\\r", 2); break;
+            case '\t': line_writer_append(writer, "\\t", 2); break;
+            default:
+                snprintf(escape, sizeof(escape), "\\u%04x", byte); // A control character or a byte of invalid UTF-8
+                line_writer_append(writer, escape, 6);
+                break;
+        }
+        start = ++i;
+    }
+    line_writer_append(writer, text + start, length - start);
+
+    line_writer_append(writer, "\"", 1);
+}
+
+/* Append a number, `null` if it's negative */
+static void line_writer_append_number(LineWriter *writer, int64_t value) {
+    if (value < 0) {
+        line_writer_append(writer, "null", 4);
+        return;
+    }
+
+    char number[24];
+    int length = snprintf(number, sizeof(number), "%" PRId64, value);
+    line_writer_append(writer, number, (size_t)length);
+}
+
+/* Format a result as a JSON line, including the newline character */
+size_t json_result_format(const JsonResult *result, char *buffer, size_t size) {
+    if (result == NULL || result->path == NULL || result->verdict == NULL || buffer == NULL) return 0;
+
+    LineWriter writer = { .data = buffer, .size = size, .length = 0, .is_full = false };
+
+    line_writer_append(&writer, "{\"path\":", 8);
+    line_writer_append_string(&writer, result->path, result->path_length);
+    line_writer_append(&writer, ",\"verdict\":", 11);
+    line_writer_append_string(&writer, result->verdict, strlen(result->verdict));
+    line_writer_append(&writer, ",\"virus\":", 9);
+    line_writer_append_string(&writer, result->virus, result->virus_length);
+    line_writer_append(&writer, ",\"error\":", 9);
+    line_writer_append_string(&writer, result->error, result->error_length);
+    line_writer_append(&writer, ",\"size\":", 8);
+    line_writer_append_number(&writer, result->size);
+    line_writer_append(&writer, ",\"bytes_scanned\":", 17);
+    line_writer_append_number(&writer, result->bytes_scanned);
+    line_writer_append(&writer, ",\"duration_ns\":", 15);
+    line_writer_append_number(&writer, result->duration_ns);
+    line_writer_append(&writer, ",\"worker\":", 10);
+    line_writer_append_number(&writer, result->worker);
+    line_writer_append(&writer, "}\n", 2);
+
+    return writer.is_full ? 0 : writer.length;
+}
+
+/* Format the cumulative counts as a progress line, including the newline character */
+size_t json_progress_format(uint64_t files, uint64_t bytes_scanned, char *buffer, size_t size) {
+    if (buffer == NULL) return 0;
+
+    LineWriter writer = { .data = buffer, .size = size, .length = 0, .is_full = false };
+
+    line_writer_append(&writer, "{\"progress\":{\"files\":", 21);
+    line_writer_append_number(&writer, (int64_t)files);
+    line_writer_append(&writer, ",\"bytes_scanned\":", 17);
+    line_writer_append_number(&writer, (int64_t)bytes_scanned);
+    line_writer_append(&writer, "}}\n", 3);
+
+    return writer.is_full ? 0 : writer.length;
+}
@@ -0,0 +1,85 @@
+/* json-lines.h
+ *
+ * Copyright 2025 EricLin
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+*/
+
+/* JSON Lines results */
+/*
+  * One JSON object per line, e.g.
+  *   {"path":"/home/a.com","verdict":"infected","virus":"Eicar-Test-Signature","error":null,"size":68,"bytes_scanned":68,"duration_ns":51200,"worker":3}
+  * `verdict` is `clean`, `infected` or `error`, the unknown numbers are `null`
+  * A byte of the path which isn't valid UTF-8 is written as `\u00XX`, so the line stays valid JSON
+  * The line is formatted into a caller's buffer, the writers need no memory per result
+  *
+  * A progress line carries the cumulative counts instead of a result, e.g.
+  *   {"progress":{"files":1200,"bytes_scanned":73400320}}
+  *
+  * The format is plain C without GLib, the GUI links this file too so both write the same lines
+*/
+
+#ifndef JSON_LINES_H
+#define JSON_LINES_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define JSON_OPTION "--json" // Write the results as JSON Lines
+
+/* The size of a line holding strings of these lengths, even if every byte is escaped */
+#define JSON_RESULT_LINE_SIZE(path_length, detail_length) (((path_length) + (detail_length)) * 6 + 256)
+
+/* A result to be written */
+typedef struct {
+	const char *path;
+	size_t path_length;
+	const char *verdict; // `JSON_VERDICT_*`
+	const char *virus; // NULL unless infected
+	size_t virus_length;
+	const char *error; // NULL unless the scan failed
+	size_t error_length;
+	int64_t size; // The file size, -1 if unknown
+	int64_t bytes_scanned; // -1 if unknown
+	int64_t duration_ns; // -1 if unknown
+	int64_t worker; // The worker process, -1 if unknown
+} JsonResult;
+
+#define JSON_VERDICT_CLEAN "clean"
+#define JSON_VERDICT_INFECTED "infected"
+#define JSON_VERDICT_ERROR "error"
+
+/* Format a result as a JSON line, including the newline character */
+/*
+  * @param size
+  * At least `JSON_RESULT_LINE_SIZE(path_length, virus_length + error_length)` to always fit
+  *
+  * @return
+  * The length of the line, 0 if it doesn't fit (the buffer is left incomplete)
+*/
+size_t json_result_format(const JsonResult *result, char *buffer, size_t size);
+
+#define JSON_PROGRESS_LINE_SIZE 96 // Fits the largest counts
+
+/* Format the cumulative counts as a progress line, including the newline character */
+/*
+  * @return
+  * The length of the line, 0 if it doesn't fit
+*/
+size_t json_progress_format(uint64_t files, uint64_t bytes_scanned, char *buffer, size_t size);
+
+#endif // JSON_LINES_H
@@ -18,16 +18,49 @@
  * SPDX-License-Identifier: GPL-3.0-or-later
 */
 
+#define _GNU_SOURCE // For `preadv2()` and `RWF_NOWAIT`
 #include <dirent.h>
 #include <fcntl.h>
+#include <limits.h>
+#include <stdarg.h>
+#include <time.h>
 #include <unistd.h>
 #include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
 
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#endif
+
+#include "database.h"
 #include "manager.h"
+#include "spill.h"
 
 #define FILE_OPEN_FLAGS (O_RDONLY | O_NOFOLLOW | O_CLOEXEC) // Secure file open flags
+#define DIR_OPEN_FLAGS (O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC) // Secure directory open flags
+#define GETDENTS_BUFFER_SIZE (64 * 1024) // Large enough to read hundreds of entries per syscall
 #define MIN(a, b) ((a) < (b) ? (a) : (b)) // For calculating the minimum value
 
+static SpillStack local_spill = SPILL_STACK_INITIALIZER; // The spilled directory tasks of the calling producer, each process has its own copy after forking
+static size_t local_node = NO_NUMA_NODE; // The NUMA node of the calling process, see `task_pool_attach_node()`
+
+/* Write the whole buffer to a file descriptor which is not a socket, retry if interrupted by a signal */
+bool write_all(int fd, const void *buffer, size_t size) {
+    const char *bytes = (const char *)buffer;
+    while (size > 0) {
+        ssize_t written = write(fd, bytes, size);
+        if (written == -1) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        bytes += written;
+        size -= (size_t)written;
+    }
+    return true;
+}
+
 /* Get file stat */
 static inline bool get_file_stat(const char *path, struct stat *statbuf) {
 	if (lstat(path, statbuf) != 0) {
@@ -50,71 +83,112 @@ bool is_regular_file(const char *path) {
 }
 
 /* Build a task from the given path */
-Task build_task(TaskType type, const char *path) {
-    Task task;
-    task.type = type;
-    memset(task.path, 0, MAX_PATH);
+bool build_task(PathArena *arena, TaskType type, const char *dir, const char *name, Task *task) {
+    if (arena == NULL || dir == NULL || task == NULL) return false; // Invalid arguments
+
+    size_t dir_length = strlen(dir);
+    size_t name_length = name != NULL ? strlen(name) + 1 : 0; // Including the separator
+    size_t size = dir_length + name_length + 1; // Including the null terminator
+    if (size > MAX_PATH) {
+        fprintf(stderr, "[ERROR] build_task: Path too long: %s/%s\n", dir, name != NULL ? name : "");
+        return false;
+    }
+
+    PathHandle handle = path_arena_alloc(arena, size);
+    if (handle == INVALID_PATH_HANDLE) return false;
 
-    if (path != NULL && strlen(path) < MAX_PATH) {
-        memcpy(task.path, path, strlen(path) + 1);
+    /* Write the path directly into the arena */
+    char *path = path_arena_get(arena, handle);
+    memcpy(path, dir, dir_length);
+    if (name != NULL) {
+        path[dir_length] = '/';
+        memcpy(path + dir_length + 1, name, name_length - 1);
     }
-    return task;
+    path[size - 1] = '\0';
+
+    task->type = type;
+    task->path = handle;
+    task->size = 0;
+    task->member = INVALID_MEMBER;
+    return true;
 }
 
-/* Initialize the `cl_scan_options` */
-void clamav_options_init(struct cl_scan_options *options) {
-    if (options == NULL) return;
+/* Release the path of the task */
+void task_release(PathArena *arena, Task *task) {
+    if (arena == NULL || task == NULL) return;
 
-	options->heuristic |= CL_SCAN_GENERAL_HEURISTICS;
-    options->general |= CL_SCAN_GENERAL_ALLMATCHES;
+    path_arena_free(arena, task->path);
+    task->path = INVALID_PATH_HANDLE;
 }
 
 /* Clear the `cl_engine` */
-void cl_engine_clear(struct cl_engine **engine) {
+static void cl_engine_clear(struct cl_engine **engine) {
     if (engine == NULL || *engine == NULL) return;
 
     cl_engine_free(*engine);
     *engine = NULL;
 }
 
-/* Initialize the `cl_engine` */
-void cl_engine_init(struct cl_engine **engine) {
-    if (engine == NULL) return;
+/* Load and compile a new `cl_engine` from the database directory */
+void cl_engine_load(struct cl_engine **engine, const ScanProfile *profile) {
+    if (engine == NULL || profile == NULL) return;
 
     unsigned int signatures = 0;
     cl_error_t result; // Initialize result
-
-	// Initialize ClamAV engine
-	result = cl_init(CL_INIT_DEFAULT);
-	if (result != CL_SUCCESS) {
-		fprintf(stderr, "[ERROR] cl_engine_init: cl_init failed: %s\n", cl_strerror(result));
-		return;
-	}
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    size_t start_memory = get_resident_memory();
 
     *engine = cl_engine_new(); // Create a new ClamAV engine
     if (*engine == NULL) {
-        fprintf(stderr, "[ERROR] cl_engine_init: cl_engine_new failed\n");
+        fprintf(stderr, "[ERROR] cl_engine_load: cl_engine_new failed\n");
         return;
     }
 
     // Load signatures from database directory
 	const char *db_dir = cl_retdbdir(); // Get the database directory
-    result = cl_load(db_dir, *engine, &signatures, CL_DB_STDOPT);
+    result = database_load(*engine, db_dir, profile->db_options, &signatures); // Skips the excluded databases
     if (result != CL_SUCCESS) {
-		fprintf(stderr, "[ERROR] cl_engine_init: cl_load failed: %s\n", cl_strerror(result));
+		fprintf(stderr, "[ERROR] cl_engine_load: Failed to load the databases: %s\n", cl_strerror(result));
         cl_engine_clear(engine);
         return;
 	}
 
+    if (!scan_profile_apply_limits(profile, *engine)) {
+        cl_engine_clear(engine);
+        return;
+    }
+
     // Compile the signatures
     result = cl_engine_compile(*engine);
     if (result != CL_SUCCESS) {
-		fprintf(stderr, "[ERROR] cl_engine_init: cl_engine_compile failed: %s\n", cl_strerror(result));
+		fprintf(stderr, "[ERROR] cl_engine_load: cl_engine_compile failed: %s\n", cl_strerror(result));
         cl_engine_clear(engine);
         return;
 	}
 
-    printf("[INFO] ClamAV engine initialized with %u signatures\n", signatures);
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double seconds = (double)(end.tv_sec - start.tv_sec) + (double)(end.tv_nsec - start.tv_nsec) / 1e9;
+    size_t end_memory = get_resident_memory();
+    double memory_mib = end_memory > start_memory ? (double)(end_memory - start_memory) / 1048576.0 : 0; // Other engines may be freed meanwhile by the daemon
+
+    fprintf(stderr, "[INFO] ClamAV engine initialized with %u signatures (%s profile) in %.1f s, %.1f MiB\n",
+            signatures, profile->name, seconds, memory_mib); // Keep the standard output for the results
+}
+
+/* Initialize the `cl_engine` */
+static void cl_engine_init(struct cl_engine **engine, const ScanProfile *profile) {
+    if (engine == NULL) return;
+
+	// Initialize ClamAV engine
+	cl_error_t result = cl_init(CL_INIT_DEFAULT);
+	if (result != CL_SUCCESS) {
+		fprintf(stderr, "[ERROR] cl_engine_init: cl_init failed: %s\n", cl_strerror(result));
+		return;
+	}
+
+    cl_engine_load(engine, profile);
 }
 
 /* Initialize the ClamAV Essentials */
@@ -125,15 +199,18 @@ void cl_engine_init(struct cl_engine **engine) {
   * @return
   * `true` if the initialization is successful, `false` otherwise.
 */
-bool clamav_essentials_init(ClamavEssentials *essentials) {
-    if (essentials == NULL) {
+bool clamav_essentials_init(ClamavEssentials *essentials, const ScanProfile *profile) {
+    if (essentials == NULL || profile == NULL) {
         fprintf(stderr, "[ERROR] clamav_essentials_init: Invalid argument\n");
         return false;
     }
 
+    memset(essentials, 0, sizeof(ClamavEssentials));
+
     /* Initialize ClamAV engine */
-    clamav_options_init(&essentials->scan_options);
-    cl_engine_init(&essentials->engine);
+    essentials->profile = *profile;
+    scan_profile_get_scan_options(profile, &essentials->scan_options);
+    cl_engine_init(&essentials->engine, profile);
 
     if (essentials->engine == NULL) {
         fprintf(stderr, "[ERROR] clamav_essentials_init: ClamAV engine initialization failed\n");
@@ -147,7 +224,73 @@ bool clamav_essentials_init(ClamavEssentials *essentials) {
 void clamav_essentials_clear(ClamavEssentials *essentials) {
     if (essentials == NULL) return;
 
-    cl_engine_clear(&essentials->engine);   
+    cl_engine_clear(&essentials->engine);
+    cl_engine_clear(&essentials->next_engine);
+}
+
+/* Make `next_engine` the current engine */
+struct cl_engine *clamav_essentials_swap(ClamavEssentials *essentials) {
+    if (essentials == NULL || essentials->next_engine == NULL) return NULL;
+
+    struct cl_engine *old_engine = essentials->engine;
+    essentials->engine = essentials->next_engine;
+    essentials->next_engine = NULL;
+    essentials->generation++;
+
+    return old_engine;
+}
+
+/* Sleep on the futex word while it still equals `expected` */
+static inline void futex_wait(_Atomic uint32_t *word, uint32_t expected) {
+#ifdef __linux__
+    syscall(SYS_futex, (uint32_t *)word, FUTEX_WAIT, expected, NULL, NULL, 0); // No `FUTEX_PRIVATE_FLAG`, the word lives in shared memory
+#else
+    if (atomic_load(word) == expected) usleep(1000); // No futex, fallback to a short sleep
+#endif
+}
+
+/* Wake up to `count` processes sleeping on the futex word */
+static inline void futex_wake(_Atomic uint32_t *word, int count) {
+#ifdef __linux__
+    syscall(SYS_futex, (uint32_t *)word, FUTEX_WAKE, count, NULL, NULL, 0);
+#else
+    (void)word;
+    (void)count;
+#endif
+}
+
+/* Initialize the wakeup event */
+void wakeup_event_init(WakeupEvent *event) {
+    if (event == NULL) return;
+
+    atomic_init(&event->sequence, 0);
+    atomic_init(&event->waiters, 0);
+}
+
+/* Get the token to be passed to `wakeup_event_wait()` */
+uint32_t wakeup_event_token(WakeupEvent *event) {
+    return atomic_load(&event->sequence);
+}
+
+/* Sleep until the event is notified after `token` was taken */
+void wakeup_event_wait(WakeupEvent *event, uint32_t token) {
+    if (event == NULL) return;
+
+    atomic_fetch_add(&event->waiters, 1);
+    while (atomic_load(&event->sequence) == token) {
+        futex_wait(&event->sequence, token); // Returns immediately if the sequence has been changed, also handles `EINTR`
+    }
+    atomic_fetch_sub(&event->waiters, 1);
+}
+
+/* Notify the event and wake up to `count` sleeping processes */
+void wakeup_event_notify(WakeupEvent *event, int count) {
+    if (event == NULL) return;
+
+    atomic_fetch_add(&event->sequence, 1);
+    if (atomic_load(&event->waiters) == 0) return; // Nobody is sleeping, skip the syscall
+
+    futex_wake(&event->sequence, count);
 }
 
 /* Initialize the TaskQueue */
@@ -158,11 +301,10 @@ void task_queue_init(TaskQueue *queue) {
     sem_init(&queue->mutex, 1, 1);
     sem_init(&queue->empty, 1, QUEUE_SIZE);
     sem_init(&queue->full, 1, 0);
+    wakeup_event_init(&queue->wakeup);
 
-    /* Initialize the tasks */
-    memset(queue->tasks, 0, sizeof(queue->tasks));
+    /* Initialize the tasks, the slots are left untouched since the mapping is already zeroed and only the used pages get backed */
     atomic_init(&queue->tasks_count, 0);
-    atomic_init(&queue->in_progress, 0);
     queue->front = 0;
     queue->rear = 0;
 }
@@ -175,19 +317,28 @@ void task_queue_clear(TaskQueue *queue) {
     sem_destroy(&queue->full);
 }
 
-/* Check whether the task queue is empty, assume the queue is not empty if failed to get the lock */
-bool is_task_queue_empty_assumption(TaskQueue *queue) {
-    if (queue == NULL) return true;
+/* Lock the TaskQueue, retry if interrupted by a signal */
+static inline void task_queue_lock(TaskQueue *queue) {
+    if (sem_trywait(&queue->mutex) == 0) return; // Uncontended, nothing to trace
+
+    uint64_t trace_start = trace_begin(TRACE_QUEUE_LOCK_WAIT);
+    while (sem_wait(&queue->mutex) == -1 && errno == EINTR);
+    trace_end(TRACE_QUEUE_LOCK_WAIT, trace_start);
+}
+
+/* Store the task in the empty slot taken from `empty` */
+static void task_queue_insert(TaskQueue *queue, Task task) {
+    task_queue_lock(queue);
 
-    if (sem_trywait(&queue->mutex) == -1 && errno == EAGAIN) return false; // Failed to get the lock, assume the queue is not empty
+    queue->tasks[queue->rear] = task; // Add the task to the queue
+    queue->rear = (queue->rear + 1) & MASK; // Update the head pointer
 
-    bool is_empty = true;
-    is_empty &= (atomic_load(&queue->tasks_count)) == 0;
-    is_empty &= (atomic_load(&queue->in_progress)) == 0;
+    atomic_fetch_add(&queue->tasks_count, 1); // Increment the task count
 
-    sem_post(&queue->mutex); // Release the lock
+    sem_post(&queue->full); // Release the full slot
+    sem_post(&queue->mutex);
 
-    return is_empty;
+    wakeup_event_notify(&queue->wakeup, 1); // Wake up one idle process to handle the task
 }
 
 /* Add a task to the TaskQueue */
@@ -199,18 +350,46 @@ bool is_task_queue_empty_assumption(TaskQueue *queue) {
   * The task to be added to the TaskQueue
 */
 void task_queue_add(TaskQueue *queue, Task task) {
-    if (queue == NULL && memcmp(task.path, "\0", 1) == 0) return;
+    if (queue == NULL || task.path == INVALID_PATH_HANDLE) return;
+
+    if (sem_trywait(&queue->empty) == -1) { // The queue is full, count the time blocked for an empty slot
+        struct timespec start, end;
+        uint64_t trace_start = trace_begin(TRACE_QUEUE_ADD_WAIT);
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        while (sem_wait(&queue->empty) == -1 && errno == EINTR); // Wait for an empty slot
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        trace_end(TRACE_QUEUE_ADD_WAIT, trace_start);
+        stats_add(STAT_QUEUE_BLOCKED_NS, (uint64_t)((end.tv_sec - start.tv_sec) * 1000000000LL + (end.tv_nsec - start.tv_nsec)));
+    }
+    task_queue_insert(queue, task);
+}
 
-    sem_wait(&queue->empty); // Wait for an empty slot
-    sem_wait(&queue->mutex);
+/* Add a task to the TaskQueue if there is an empty slot */
+bool task_queue_try_add(TaskQueue *queue, Task task) {
+    if (queue == NULL || task.path == INVALID_PATH_HANDLE) return false;
 
-    queue->tasks[queue->rear] = task; // Add the task to the queue
-    queue->rear = (queue->rear + 1) & MASK; // Update the head pointer
+    if (sem_trywait(&queue->empty) == -1) return false; // The queue is full
+    task_queue_insert(queue, task);
+    return true;
+}
 
-    atomic_fetch_add(&queue->tasks_count, 1); // Increment the task count
+/* Get the wakeup token of the TaskQueue, take it before calling `task_queue_get()` */
+uint32_t task_queue_wakeup_token(TaskQueue *queue) {
+    return wakeup_event_token(&queue->wakeup);
+}
 
-    sem_post(&queue->full); // Release the full slot
-    sem_post(&queue->mutex);
+/* Sleep until a task is added or the TaskQueue is woken up after `token` was taken */
+void task_queue_wait(TaskQueue *queue, uint32_t token) {
+    if (queue == NULL) return;
+
+    wakeup_event_wait(&queue->wakeup, token);
+}
+
+/* Wake up all processes waiting on the TaskQueue, use it when the exit condition may have changed */
+void task_queue_wake_all(TaskQueue *queue) {
+    if (queue == NULL) return;
+
+    wakeup_event_notify(&queue->wakeup, INT_MAX);
 }
 
 /* Calculate the task to get number */
@@ -234,12 +413,12 @@ static inline size_t calculate_task_to_get_number(TaskQueue *queue) {
   * Number of tasks retrieved from the queue, 0 if no task is retrieved
   *
   * @warning
-  * This function use non-blocking semaphore to avoid busy waiting, so it may need loops to wait for the task to be available
+  * This function never blocks on an empty queue, use `task_queue_wait()` to sleep until the task is available
 */
 size_t task_queue_get(TaskQueue *queue, Task *tasks) {
     if (queue == NULL || tasks == NULL) return 0; // Invalid arguments
 
-    if (sem_trywait(&queue->mutex) != 0) return 0; // Failed to get the lock, assume no task is available
+    task_queue_lock(queue); // The lock is only held for copying the tasks, so waiting for it is cheap and a caller never goes to sleep while tasks are available
 
     size_t tasks_to_get = calculate_task_to_get_number(queue); // Calculate the number of tasks to get
     if (tasks_to_get == 0) {
@@ -268,15 +447,421 @@ size_t task_queue_get(TaskQueue *queue, Task *tasks) {
     return tasks_to_get;
 }
 
+/* Initialize the WorkDeque */
+void work_deque_init(WorkDeque *deque) {
+    if (deque == NULL) return;
+
+    /* The slots are not cleared, they are always written before being read */
+    atomic_init(&deque->top, 0);
+    atomic_init(&deque->bottom, 0);
+}
+
+/* Push a task to the bottom of the WorkDeque */
+/*
+  * @warning
+  * This function MUST only be called by the owner of the deque
+*/
+bool work_deque_push(WorkDeque *deque, const Task *task) {
+    if (deque == NULL || task == NULL) return false; // Invalid arguments
+
+    int64_t bottom = atomic_load_explicit(&deque->bottom, memory_order_relaxed);
+    int64_t top = atomic_load_explicit(&deque->top, memory_order_acquire);
+    if (bottom - top >= DEQUE_SIZE) return false; // The deque is full, the slot at `top` may still be read by a thief
+
+    deque->tasks[bottom & DEQUE_MASK] = *task;
+    atomic_store_explicit(&deque->bottom, bottom + 1, memory_order_release); // Publish the task to the thieves
+
+    return true;
+}
+
+/* Pop the newest task from the bottom of the WorkDeque */
+/*
+  * @warning
+  * This function MUST only be called by the owner of the deque
+*/
+bool work_deque_pop(WorkDeque *deque, Task *task) {
+    if (deque == NULL || task == NULL) return false; // Invalid arguments
+
+    int64_t bottom = atomic_load_explicit(&deque->bottom, memory_order_relaxed) - 1;
+    atomic_store_explicit(&deque->bottom, bottom, memory_order_relaxed); // Reserve the last task
+    atomic_thread_fence(memory_order_seq_cst); // The reservation must be visible before reading `top`
+    int64_t top = atomic_load_explicit(&deque->top, memory_order_relaxed);
+
+    if (top > bottom) { // The deque is empty
+        atomic_store_explicit(&deque->bottom, bottom + 1, memory_order_relaxed);
+        return false;
+    }
+
+    *task = deque->tasks[bottom & DEQUE_MASK];
+    if (top < bottom) return true; // More than one task left, no thief can reach this one
+
+    /* Only one task left, race against the thieves for it */
+    bool won = atomic_compare_exchange_strong_explicit(&deque->top, &top, top + 1,
+                                                       memory_order_seq_cst, memory_order_relaxed);
+    atomic_store_explicit(&deque->bottom, bottom + 1, memory_order_relaxed);
+
+    return won;
+}
+
+/* Steal the oldest tasks from the top of the WorkDeque */
+/*
+  * @warning
+  * Stealing more than one task is only safe if the owner never calls `work_deque_pop()` on this deque
+*/
+size_t work_deque_steal(WorkDeque *deque, Task *tasks, size_t max_tasks) {
+    if (deque == NULL || tasks == NULL || max_tasks == 0) return 0; // Invalid arguments
+
+    while (true) {
+        int64_t top = atomic_load_explicit(&deque->top, memory_order_acquire);
+        atomic_thread_fence(memory_order_seq_cst); // Pair with the fence in `work_deque_pop()`
+        int64_t bottom = atomic_load_explicit(&deque->bottom, memory_order_acquire);
+        if (top >= bottom) return 0; // The deque is empty
+
+        size_t tasks_to_steal = MIN((size_t)(bottom - top), max_tasks);
+        for (size_t i = 0; i < tasks_to_steal; i++) {
+            tasks[i] = deque->tasks[(top + (int64_t)i) & DEQUE_MASK]; // Copy before claiming, the owner can't reuse the slots until `top` moves
+        }
+
+        /* Claim the copied tasks, retry if another process won the race, the caller may go to sleep after an empty result */
+        if (atomic_compare_exchange_strong_explicit(&deque->top, &top, top + (int64_t)tasks_to_steal,
+                                                    memory_order_seq_cst, memory_order_relaxed)) return tasks_to_steal;
+    }
+}
+
+/* Initialize the TaskHeap */
+static void task_heap_init(TaskHeap *heap, size_t capacity) {
+    sem_init(&heap->mutex, 1, 1);
+    atomic_init(&heap->count, 0);
+    heap->capacity = MIN(capacity, PRIORITY_HEAP_SIZE);
+}
+
+/* Lock the TaskHeap, retry if interrupted by a signal */
+static inline void task_heap_lock(TaskHeap *heap) {
+    while (sem_wait(&heap->mutex) == -1 && errno == EINTR);
+}
+
+/* Push a task to the TaskHeap */
+/*
+  * @return
+  * `true` if the task is pushed, `false` if the heap is full
+*/
+static bool task_heap_push(TaskHeap *heap, uint64_t key, const Task *task) {
+    task_heap_lock(heap);
+
+    size_t index = atomic_load_explicit(&heap->count, memory_order_relaxed);
+    if (index >= heap->capacity) {
+        sem_post(&heap->mutex);
+        return false;
+    }
+
+    /* Sift up */
+    while (index > 0) {
+        size_t parent = (index - 1) / 2;
+        if (heap->entries[parent].key >= key) break;
+        heap->entries[index] = heap->entries[parent];
+        index = parent;
+    }
+    heap->entries[index] = (TaskHeapEntry){ .key = key, .task = *task };
+    atomic_fetch_add(&heap->count, 1);
+
+    sem_post(&heap->mutex);
+    return true;
+}
+
+/* Pop up to `max_tasks` tasks with the highest keys from the TaskHeap */
+/*
+  * @return
+  * Number of tasks popped, 0 if the heap is empty
+*/
+static size_t task_heap_pop(TaskHeap *heap, Task *tasks, size_t max_tasks) {
+    if (atomic_load(&heap->count) == 0) return 0; // Avoid taking the lock if the heap is empty
+    task_heap_lock(heap);
+
+    size_t count = atomic_load_explicit(&heap->count, memory_order_relaxed);
+    size_t popped = 0;
+    for (; popped < max_tasks && count > 0; popped++) {
+        tasks[popped] = heap->entries[0].task;
+        TaskHeapEntry last = heap->entries[--count];
+
+        /* Sift the last entry down from the root */
+        size_t index = 0;
+        while (true) {
+            size_t child = index * 2 + 1;
+            if (child >= count) break;
+            if (child + 1 < count && heap->entries[child + 1].key > heap->entries[child].key) child++;
+            if (last.key >= heap->entries[child].key) break;
+            heap->entries[index] = heap->entries[child];
+            index = child;
+        }
+        if (count > 0) heap->entries[index] = last;
+    }
+    atomic_store(&heap->count, count);
+
+    sem_post(&heap->mutex);
+    return popped;
+}
+
+/* Initialize the TaskPool */
+void task_pool_init(TaskPool *pool, size_t num_deques) {
+    if (pool == NULL) return;
+
+    task_queue_init(&pool->queue);
+
+    pool->num_deques = MIN(num_deques, MAX_PRODUCERS);
+    for (size_t i = 0; i < pool->num_deques; i++) {
+        work_deque_init(&pool->deques[i]);
+        pool->deque_nodes[i] = NO_NUMA_NODE;
+    }
+    pool->is_node_local = false;
+
+    atomic_init(&pool->outstanding, 0);
+    pool->spill_arena = NULL;
+
+    pool->large_file_threshold = 0;
+    task_heap_init(&pool->large_files, LARGE_FILE_HEAP_SIZE);
+
+    pool->is_prioritized = false;
+    task_heap_init(&pool->priority_files, PRIORITY_HEAP_SIZE);
+}
+
+/* Set the NUMA node of the owner of a deque */
+void task_pool_set_deque_node(TaskPool *pool, size_t deque, size_t node) {
+    if (pool == NULL || deque >= pool->num_deques) return;
+
+    pool->deque_nodes[deque] = node;
+    pool->is_node_local = node != NO_NUMA_NODE;
+}
+
+/* Let the calling process steal from the deques of its NUMA node first */
+void task_pool_attach_node(size_t node) {
+    local_node = node;
+}
+
+/* Spill the tasks of the owners instead of blocking when the pool is full */
+void task_pool_enable_spill(TaskPool *pool, PathArena *arena) {
+    if (pool == NULL) return;
+
+    pool->spill_arena = arena;
+}
+
+/* Clear the TaskPool */
+void task_pool_clear(TaskPool *pool) {
+    if (pool == NULL) return;
+
+    task_queue_clear(&pool->queue);
+    sem_destroy(&pool->large_files.mutex);
+    sem_destroy(&pool->priority_files.mutex);
+}
+
+/* Route the file tasks from `threshold` in size to the large file lane */
+void task_pool_enable_large_lane(TaskPool *pool, uint64_t threshold) {
+    if (pool == NULL) return;
+
+    pool->large_file_threshold = threshold;
+}
+
+/* Let `task_pool_add_prioritized()` route the file tasks to the priority lane */
+void task_pool_enable_priority_lane(TaskPool *pool) {
+    if (pool == NULL) return;
+
+    pool->is_prioritized = true;
+}
+
+/* Add a task to the TaskPool */
+/*
+  * @param pool
+  * The TaskPool to which the task is added
+  *
+  * @param owner
+  * The index of the calling producer, or `NO_DEQUE_OWNER`
+  *
+  * @param task
+  * The task to be added to the TaskPool
+*/
+void task_pool_add(TaskPool *pool, size_t owner, Task task) {
+    if (pool == NULL) return;
+
+    atomic_fetch_add(&pool->outstanding, 1); // Count the task before it's visible, so the pool never looks idle while the task is waiting
+
+    if (pool->large_file_threshold > 0 && task.type == TASK_SCAN_FILE && task.size >= pool->large_file_threshold &&
+        task_heap_push(&pool->large_files, task.size, &task)) {
+        wakeup_event_notify(&pool->queue.wakeup, 1); // Wake up one idle process to take the file
+        return;
+    }
+
+    if (owner < pool->num_deques && work_deque_push(&pool->deques[owner], &task)) {
+        wakeup_event_notify(&pool->queue.wakeup, 1); // Wake up one idle process to steal the task
+        return;
+    }
+
+    if (owner < pool->num_deques && pool->spill_arena != NULL && task.type == TASK_SCAN_DIR) { // The owners would wait for themselves on a full queue
+        if (task_queue_try_add(&pool->queue, task)) return;
+
+        if (spill_stack_push(&local_spill, task_path(pool->spill_arena, &task))) {
+            task_release(pool->spill_arena, &task); // Still counted in `outstanding` until it's taken back and finished
+            stats_add(STAT_DIRS_SPILLED, 1);
+            return;
+        }
+    }
+
+    task_queue_add(&pool->queue, task); // No deque or the deque is full, fall back to the shared queue
+}
+
+/* Add a file task to the priority lane of the TaskPool */
+void task_pool_add_prioritized(TaskPool *pool, size_t owner, Task task, uint64_t priority_key) {
+    if (pool == NULL) return;
+
+    if (priority_key > 0 && pool->is_prioritized && task.type == TASK_SCAN_FILE) {
+        atomic_fetch_add(&pool->outstanding, 1); // Like `task_pool_add()`, before the task is visible
+        if (task_heap_push(&pool->priority_files, priority_key, &task)) {
+            stats_add(STAT_FILES_PRIORITIZED, 1);
+            wakeup_event_notify(&pool->queue.wakeup, 1); // Wake up one idle process to take the file
+            return;
+        }
+        atomic_fetch_sub(&pool->outstanding, 1); // The lane is full, `task_pool_add()` counts it again
+    }
+
+    task_pool_add(pool, owner, task);
+}
+
+/* Move the spilled tasks of the calling process back to its deque */
+/*
+  * @return
+  * Number of tasks moved, 0 if nothing is spilled or the PathArena is exhausted
+*/
+static size_t task_pool_refill(TaskPool *pool, size_t self) {
+    size_t refilled = 0;
+    while (refilled < SPILL_REFILL_TASKS && !is_spill_stack_empty(&local_spill)) {
+        const char *path = spill_stack_top(&local_spill);
+        if (path == NULL) { // The spill file is broken, give up the spilled tasks so the pool can still become idle
+            size_t dropped = spill_stack_clear(&local_spill);
+            stats_add(STAT_ERRORS, dropped);
+            task_pool_task_done(pool, dropped);
+            break;
+        }
+
+        Task task;
+        if (!build_task(pool->spill_arena, TASK_SCAN_DIR, path, NULL, &task)) break; // The arena is exhausted, retry once the workers release some paths
+        if (!work_deque_push(&pool->deques[self], &task)) {
+            task_release(pool->spill_arena, &task);
+            break;
+        }
+
+        spill_stack_drop(&local_spill);
+        refilled++;
+    }
+
+    if (refilled > 0) wakeup_event_notify(&pool->queue.wakeup, (int)MIN(refilled, INT_MAX)); // Let the idle owners steal them
+    return refilled;
+}
+
+/* Get a group of tasks from the TaskPool */
+/*
+  * @note
+  * The order is: priority lane -> own deque (newest first) -> own spilled tasks -> shared queue -> other deques (oldest first)
+  * The owners pop their own deque, so they only steal one task at a time from the others
+  * Non-owners (workers) steal a whole group, since the file deques are never popped by the producers
+*/
+size_t task_pool_get(TaskPool *pool, size_t self, bool is_owner, Task *tasks) {
+    if (pool == NULL || tasks == NULL) return 0; // Invalid arguments
+
+    if (pool->is_prioritized) {
+        size_t prioritized = task_heap_pop(&pool->priority_files, tasks, is_owner ? 1 : MAX_GET_TASKS);
+        if (prioritized > 0) return prioritized;
+    }
+
+    if (is_owner && self < pool->num_deques) {
+        if (work_deque_pop(&pool->deques[self], tasks)) return 1;
+        if (pool->spill_arena != NULL && task_pool_refill(pool, self) > 0 && work_deque_pop(&pool->deques[self], tasks)) return 1; // The own spilled tasks before the shared ones
+    }
+
+    size_t tasks_to_get = 0;
+    if (atomic_load(&pool->queue.tasks_count) > 0) { // Avoid taking the lock if the shared queue is empty
+        tasks_to_get = task_queue_get(&pool->queue, tasks);
+        if (tasks_to_get > 0) return tasks_to_get;
+    }
+
+    if (pool->num_deques == 0) return 0;
+
+    size_t start = is_owner ? self + 1 : self; // Owners start from their neighbours, workers spread over the deques by index
+    size_t max_tasks = is_owner ? 1 : MAX_GET_TASKS;
+    bool is_node_local = pool->is_node_local && local_node != NO_NUMA_NODE;
+    for (int pass = is_node_local ? 0 : 1; pass < 2; pass++) { // The deques of the own node first, the other nodes only when they're empty
+        for (size_t i = 0; i < pool->num_deques; i++) {
+            size_t victim = (start + i) % pool->num_deques;
+            if (is_owner && victim == self) continue; // Already checked
+            if (is_node_local && (pool->deque_nodes[victim] == local_node) != (pass == 0)) continue; // Not in this pass
+
+            tasks_to_get = work_deque_steal(&pool->deques[victim], tasks, max_tasks);
+            if (tasks_to_get > 0) {
+                if (is_node_local && pass == 1) stats_add(STAT_REMOTE_STEALS, tasks_to_get);
+                return tasks_to_get;
+            }
+        }
+    }
+
+    return 0;
+}
+
+/* Get the biggest task of the large file lane */
+size_t task_pool_get_large(TaskPool *pool, Task *task) {
+    if (pool == NULL || task == NULL || pool->large_file_threshold == 0) return 0; // Invalid arguments or no large file lane
+
+    return task_heap_pop(&pool->large_files, task, 1);
+}
+
+/* Mark tasks retrieved by `task_pool_get()` as finished */
+void task_pool_task_done(TaskPool *pool, size_t count) {
+    if (pool == NULL || count == 0) return;
+
+    if (atomic_fetch_sub(&pool->outstanding, count) == count) task_pool_wake_all(pool); // The last task is finished, let the idle processes recheck the exit condition
+}
+
+/* Check whether the calling process has spilled tasks of the TaskPool */
+bool task_pool_has_spilled(TaskPool *pool) {
+    return pool != NULL && pool->spill_arena != NULL && !is_spill_stack_empty(&local_spill);
+}
+
+/* Check whether all the tasks added to the TaskPool are finished */
+bool is_task_pool_idle(TaskPool *pool) {
+    if (pool == NULL) return true;
+
+    return atomic_load(&pool->outstanding) == 0;
+}
+
+/* Get the wakeup token of the TaskPool, take it before calling `task_pool_get()` */
+uint32_t task_pool_wakeup_token(TaskPool *pool) {
+    return task_queue_wakeup_token(&pool->queue);
+}
+
+/* Sleep until a task is added or the TaskPool is woken up after `token` was taken */
+void task_pool_wait(TaskPool *pool, uint32_t token) {
+    if (pool == NULL) return;
+
+    uint64_t trace_start = trace_begin(TRACE_POOL_WAIT);
+    task_queue_wait(&pool->queue, token);
+    trace_end(TRACE_POOL_WAIT, trace_start);
+}
+
+/* Wake up all processes waiting on the TaskPool */
+void task_pool_wake_all(TaskPool *pool) {
+    if (pool == NULL) return;
+
+    task_queue_wake_all(&pool->queue);
+}
+
 /* Initialize the shared memory */
 /*
   * @param shared_memory
   * The shared memory to be initialized
+  *
+  * @param num_producers
+  * The number of producer processes, each of them owns a deque in both pools
   * 
   * @warning
   * This function will use `mmap` to allocate the shared memory
 */
-bool shared_memory_init(SharedMemory **shared_memory) {
+bool shared_memory_init(SharedMemory **shared_memory, size_t num_producers, const ScanProfile *profile) {
     if (shared_memory == NULL || *shared_memory != NULL) return false; // Invalid arguments or already initialized
 
     *shared_memory = mmap(NULL, sizeof(SharedMemory), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
@@ -286,16 +871,41 @@ bool shared_memory_init(SharedMemory **shared_memory) {
     }
 
     /* Initialize the ClamAV Essentials */
-    if (!clamav_essentials_init(&(*shared_memory)->essentials)) {
+    if (!clamav_essentials_init(&(*shared_memory)->essentials, profile)) {
         fprintf(stderr, "[ERROR] shared_memory_init: ClamAV Essentials initialization failed\n");
         munmap(*shared_memory, sizeof(SharedMemory));
         *shared_memory = NULL;
         return false;
     }
 
-    /* Initialize the TaskQueues */
-    task_queue_init(&(*shared_memory)->dir_tasks);
-    task_queue_init(&(*shared_memory)->file_tasks);
+    /* Initialize the PathArena */
+    if (!path_arena_init(&(*shared_memory)->arena)) {
+        fprintf(stderr, "[ERROR] shared_memory_init: PathArena initialization failed\n");
+        clamav_essentials_clear(&(*shared_memory)->essentials);
+        munmap(*shared_memory, sizeof(SharedMemory));
+        *shared_memory = NULL;
+        return false;
+    }
+
+    (*shared_memory)->verdict_cache.fd = -1; // Opened on demand by `clamscanc --cache`
+    content_cache_init(&(*shared_memory)->content_cache); // Mapped on demand by `clamscanc --content-cache`
+    scan_trace_init(&(*shared_memory)->trace); // Mapped on demand by `clamscanc --trace=`
+    member_pool_init(&(*shared_memory)->members); // Mapped on demand by `clamscanc --tarball`
+    scan_throttle_init(&(*shared_memory)->throttle, 0, 0); // Set by `clamscanc --max-rate=` and `--max-files-rate=`
+    result_output_init(&(*shared_memory)->result_output, true);
+    (*shared_memory)->essentials.output = &(*shared_memory)->result_output;
+
+    traversal_filter_init(&(*shared_memory)->traversal_filter);
+
+    /* Initialize the TaskPools */
+    task_pool_init(&(*shared_memory)->dir_tasks, num_producers);
+    task_pool_init(&(*shared_memory)->file_tasks, num_producers);
+    task_pool_enable_spill(&(*shared_memory)->dir_tasks, &(*shared_memory)->arena); // Only the producers take the directory tasks
+    task_pool_enable_large_lane(&(*shared_memory)->file_tasks, LARGE_FILE_THRESHOLD);
+
+    /* All the workers are active unless the automatic sizing limits them */
+    atomic_init(&(*shared_memory)->worker_limit, MAX_PROCESSES);
+    wakeup_event_init(&(*shared_memory)->worker_limit_event);
 
     return true;
 }
@@ -307,86 +917,601 @@ void shared_memory_clear(SharedMemory **shared_memory) {
     /* Clear the ClamAV Essentials */
     clamav_essentials_clear(&(*shared_memory)->essentials);
 
-    /* Clear the TaskQueues */
-    task_queue_clear(&(*shared_memory)->dir_tasks);
-    task_queue_clear(&(*shared_memory)->file_tasks);
+    /* Clear the PathArena and the verdict cache */
+    path_arena_clear(&(*shared_memory)->arena);
+    verdict_cache_close(&(*shared_memory)->verdict_cache);
+    content_cache_clear(&(*shared_memory)->content_cache);
+    scan_trace_clear(&(*shared_memory)->trace);
+    member_pool_clear(&(*shared_memory)->members);
+    traversal_filter_clear(&(*shared_memory)->traversal_filter);
+    result_output_clear(&(*shared_memory)->result_output);
+
+    /* Clear the TaskPools */
+    task_pool_clear(&(*shared_memory)->dir_tasks);
+    task_pool_clear(&(*shared_memory)->file_tasks);
 
     /* Unmap the shared memory */
     munmap(*shared_memory, sizeof(SharedMemory));
     *shared_memory = NULL;
 }
 
-/* Process scan result */
-static void process_scan_result(const char *path, cl_error_t error, const char *virname) {
+/* Initialize the ResultOutput */
+void result_output_init(ResultOutput *output, bool is_shared) {
+    if (output == NULL) return;
+
+    atomic_init(&output->format, RESULT_FORMAT_TEXT);
+    atomic_init(&output->is_infected_only, false);
+    sem_init(&output->lock, is_shared ? 1 : 0, 1);
+    atomic_init(&output->lock_owner, 0);
+}
+
+/* Clear the ResultOutput */
+void result_output_clear(ResultOutput *output) {
+    if (output == NULL) return;
+
+    sem_destroy(&output->lock);
+}
+
+/* Serialize the records of all the processes, so a record written in several `write()`s is never split by another one */
+static void result_output_lock(ResultOutput *output) {
+    while (sem_wait(&output->lock) == -1 && errno == EINTR);
+    atomic_store(&output->lock_owner, getpid());
+}
+
+static void result_output_unlock(ResultOutput *output) {
+    atomic_store(&output->lock_owner, 0);
+    sem_post(&output->lock);
+}
+
+/* Release the lock of the ResultOutput if it's held by a process which has died */
+bool result_output_recover_lock(ResultOutput *output, pid_t pid) {
+    if (output == NULL || pid <= 0) return false;
+
+    pid_t owner = pid;
+    if (!atomic_compare_exchange_strong(&output->lock_owner, &owner, 0)) return false;
+    sem_post(&output->lock);
+    return true;
+}
+
+/* Write a result frame to the standard output */
+static void write_result_frame(int fd, ResultOutput *output, const char *path, cl_error_t error, const char *virname,
+                               uint64_t bytes_scanned, uint64_t scan_time_ns) {
+    static char buffer[sizeof(ScanResultFrame) + MAX_PATH + SCAN_RESULT_MAX_VIRNAME]; // Each process is single threaded
+
+    ScanResultStatus status = error == CL_CLEAN ? SCAN_RESULT_CLEAN : (error == CL_VIRUS ? SCAN_RESULT_INFECTED : SCAN_RESULT_ERROR);
+    const char *detail = status == SCAN_RESULT_INFECTED ? virname : (status == SCAN_RESULT_ERROR ? cl_strerror(error) : NULL);
+
+    size_t path_length = strnlen(path, MAX_PATH);
+    size_t virname_length = detail != NULL ? strnlen(detail, SCAN_RESULT_MAX_VIRNAME) : 0;
+
+    ScanResultFrame frame = {
+        .frame_length = (uint32_t)(sizeof(frame) + path_length + virname_length),
+        .status = (uint8_t)status,
+        .virname_length = (uint16_t)virname_length,
+        .path_length = (uint32_t)path_length,
+        .bytes_scanned = bytes_scanned,
+        .scan_time_ns = scan_time_ns,
+    };
+    memcpy(buffer, &frame, sizeof(frame));
+    memcpy(buffer + sizeof(frame), path, path_length);
+    if (virname_length > 0) memcpy(buffer + sizeof(frame) + path_length, detail, virname_length);
+
+    result_output_lock(output);
+    if (!write_all(fd, buffer, frame.frame_length)) {
+        fprintf(stderr, "[ERROR] write_result_frame: Failed to write the result of %s: %s\n", path, strerror(errno));
+    }
+    result_output_unlock(output);
+}
+
+_Static_assert(sizeof(ScanResultFrame) + sizeof(uint64_t) <= JSON_PROGRESS_LINE_SIZE, "The progress frame must fit the buffer");
+
+/* Format the cumulative counts of the scan */
+size_t result_output_format_progress(ResultOutput *output, uint64_t files, uint64_t bytes_scanned, char buffer[JSON_PROGRESS_LINE_SIZE]) {
+    if (output == NULL || buffer == NULL) return 0;
+
+    ResultFormat format = (ResultFormat)atomic_load(&output->format);
+    if (format == RESULT_FORMAT_BINARY) {
+        ScanResultFrame frame = {
+            .frame_length = (uint32_t)(sizeof(frame) + sizeof(files)),
+            .status = SCAN_RESULT_PROGRESS,
+            .bytes_scanned = bytes_scanned,
+        };
+        memcpy(buffer, &frame, sizeof(frame));
+        memcpy(buffer + sizeof(frame), &files, sizeof(files));
+        return frame.frame_length;
+    }
+    if (format == RESULT_FORMAT_JSON) return json_progress_format(files, bytes_scanned, buffer, JSON_PROGRESS_LINE_SIZE);
+    return 0;
+}
+
+/* Write the cumulative counts of the scan to `fd` */
+void result_output_write_progress(int fd, ResultOutput *output, uint64_t files, uint64_t bytes_scanned) {
+    char buffer[JSON_PROGRESS_LINE_SIZE];
+    size_t length = result_output_format_progress(output, files, bytes_scanned, buffer);
+    if (length == 0) return;
+
+    result_output_lock(output);
+    if (!write_all(fd, buffer, length)) {
+        fprintf(stderr, "[ERROR] result_output_write_progress: Failed to write the progress: %s\n", strerror(errno));
+    }
+    result_output_unlock(output);
+}
+
+static int64_t local_worker_index = -1; // The worker index of the calling process, -1 for the parent process
+
+/* Let the calling process tag its results with its worker index */
+void result_output_attach(size_t worker_index) {
+    local_worker_index = (int64_t)worker_index;
+}
+
+/* Write a result as a JSON line to the standard output */
+static void write_result_line(int fd, ResultOutput *output, const char *path, cl_error_t error, const char *virname,
+                              int64_t file_size, uint64_t bytes_scanned, uint64_t scan_time_ns, int64_t worker_index) {
+    static char buffer[JSON_RESULT_LINE_SIZE(MAX_PATH, SCAN_RESULT_MAX_VIRNAME)]; // Each process is single threaded
+
+    const char *detail = error == CL_CLEAN ? NULL : (error == CL_VIRUS ? virname : cl_strerror(error));
+    size_t detail_length = detail != NULL ? strnlen(detail, SCAN_RESULT_MAX_VIRNAME) : 0;
+
+    JsonResult result = {
+        .path = path,
+        .path_length = strnlen(path, MAX_PATH),
+        .verdict = error == CL_CLEAN ? JSON_VERDICT_CLEAN : (error == CL_VIRUS ? JSON_VERDICT_INFECTED : JSON_VERDICT_ERROR),
+        .virus = error == CL_VIRUS ? detail : NULL,
+        .virus_length = detail_length,
+        .error = error != CL_CLEAN && error != CL_VIRUS ? detail : NULL,
+        .error_length = detail_length,
+        .size = file_size,
+        .bytes_scanned = (int64_t)bytes_scanned,
+        .duration_ns = (int64_t)scan_time_ns,
+        .worker = worker_index,
+    };
+    size_t length = json_result_format(&result, buffer, sizeof(buffer));
+    if (length == 0) { // The buffer fits the longest strings, but don't lose the file if it ever doesn't
+        static const char too_long[] = "Result too long";
+        result.verdict = JSON_VERDICT_ERROR;
+        result.virus = NULL;
+        result.error = too_long;
+        result.error_length = sizeof(too_long) - 1;
+        size_t max_path_length = (sizeof(buffer) - JSON_RESULT_LINE_SIZE(0, sizeof(too_long))) / 6; // Even if every byte is escaped
+        if (result.path_length > max_path_length) result.path_length = max_path_length;
+        length = json_result_format(&result, buffer, sizeof(buffer));
+
+        fprintf(stderr, "[ERROR] write_result_line: The result of %s doesn't fit the line\n", path);
+        stats_add(STAT_ERRORS, 1);
+        if (length == 0) return;
+    }
+
+    result_output_lock(output);
+    if (!write_all(fd, buffer, length)) {
+        fprintf(stderr, "[ERROR] write_result_line: Failed to write the result of %s: %s\n", path, strerror(errno));
+    }
+    result_output_unlock(output);
+}
+
+/* Print a text line, the standard output is line buffered so it's a single `write()` too */
+static void print_result_line(int fd, const char *format, ...) {
+    va_list args;
+    va_start(args, format);
+    if (fd == STDOUT_FILENO) vprintf(format, args);
+    else vdprintf(fd, format, args);
+    va_end(args);
+}
+
+/* Output a scan result to `fd` */
+/*
+  * @param file_size
+  * -1 if unknown
+*/
+static void output_scan_result(int fd, const char *path, cl_error_t error, const char *virname, ClamavEssentials *essentials,
+                               int64_t file_size, uint64_t bytes_scanned, uint64_t scan_time_ns, int64_t worker_index) {
+    if (error == CL_CLEAN && essentials->output != NULL && atomic_load(&essentials->output->is_infected_only)) return; // Counted by the progress
+
+    ResultFormat format = essentials->output != NULL ? (ResultFormat)atomic_load(&essentials->output->format) : RESULT_FORMAT_TEXT;
+    if (format == RESULT_FORMAT_BINARY) {
+        write_result_frame(fd, essentials->output, path, error, virname, bytes_scanned, scan_time_ns);
+        return;
+    }
+    if (format == RESULT_FORMAT_JSON) {
+        write_result_line(fd, essentials->output, path, error, virname, file_size, bytes_scanned, scan_time_ns, worker_index);
+        return;
+    }
+
 	switch (error) {
 		case CL_CLEAN:
-			printf("%s: OK\n", path);
+			print_result_line(fd, "%s: OK\n", path);
 			break;
 		case CL_VIRUS:
-			printf("%s: %s FOUND\n", path, virname);
+			print_result_line(fd, "%s: %s FOUND\n", path, virname);
 			break;
 		default:
-			printf("%s: SCAN ERROR: %s\n", path, cl_strerror(error));
+			print_result_line(fd, "%s: SCAN ERROR: %s\n", path, cl_strerror(error));
             break;
 	}
 }
 
-/* Process a file */
-void process_file(const char *path, ClamavEssentials *essentials) {
-    if (path == NULL || essentials == NULL) return; // Invalid arguments
+/* Process scan result */
+/*
+  * @param file_size
+  * -1 if unknown
+*/
+static inline void process_scan_result(const char *path, cl_error_t error, const char *virname, ClamavEssentials *essentials,
+                                       int64_t file_size, uint64_t bytes_scanned, uint64_t scan_time_ns, int64_t worker_index) {
+    output_scan_result(STDOUT_FILENO, path, error, virname, essentials, file_size, bytes_scanned, scan_time_ns, worker_index);
+}
+
+/* Write the result of a scan which didn't come from a task */
+void write_scan_result(int fd, const char *path, cl_error_t error, const char *virname, ClamavEssentials *essentials,
+                       int64_t file_size, uint64_t bytes_scanned, uint64_t scan_time_ns) {
+    if (path == NULL || essentials == NULL) return;
+
+    output_scan_result(fd, path, error, virname, essentials, file_size, bytes_scanned, scan_time_ns, local_worker_index);
+}
+
+static ProcessHeartbeat *local_heartbeat = NULL; // The heartbeat of the calling process, NULL if not watched
+
+/* Let the calling process mark its `cl_scandesc()` calls on `heartbeat` */
+void scan_heartbeat_attach(ProcessHeartbeat *heartbeat) {
+    local_heartbeat = heartbeat;
+}
+
+/* Get the heartbeat attached by `scan_heartbeat_attach()`, NULL if none */
+ProcessHeartbeat *scan_heartbeat_get(void) {
+    return local_heartbeat;
+}
+
+/* Report a file which couldn't be scanned */
+void report_scan_failure(const char *path, cl_error_t error, ClamavEssentials *essentials, uint64_t scan_time_ns, size_t worker_index) {
+    if (path == NULL || essentials == NULL) return;
+
+    stats_add(STAT_FILES_SCANNED, 1);
+    stats_add(STAT_ERRORS, 1);
+    process_scan_result(path, error, NULL, essentials, -1, 0, scan_time_ns, (int64_t)worker_index);
+}
+
+/* Initialize the DirFdCache */
+void dir_fd_cache_init(DirFdCache *cache) {
+    if (cache == NULL) return;
+
+    cache->fd = -1;
+    cache->length = 0;
+    cache->path[0] = '\0';
+}
+
+/* Clear the DirFdCache */
+void dir_fd_cache_clear(DirFdCache *cache) {
+    if (cache == NULL) return;
+
+    if (cache->fd != -1) close(cache->fd);
+    dir_fd_cache_init(cache);
+}
+
+/* Open the file to be scanned, relative to the cached parent directory if possible */
+static int open_scan_target(const char *path, DirFdCache *cache) {
+    const char *slash = strrchr(path, '/');
+    if (cache == NULL || slash == NULL || slash == path) return open(path, FILE_OPEN_FLAGS); // No cache or the parent is the root directory
+
+    size_t dir_length = (size_t)(slash - path);
+    if (cache->fd == -1 || cache->length != dir_length || memcmp(cache->path, path, dir_length) != 0) { // Another parent directory, reopen the cache
+        dir_fd_cache_clear(cache);
+
+        memcpy(cache->path, path, dir_length);
+        cache->path[dir_length] = '\0';
+        cache->fd = open(cache->path, DIR_OPEN_FLAGS);
+        if (cache->fd == -1) {
+            dir_fd_cache_init(cache);
+            return open(path, FILE_OPEN_FLAGS); // Fallback to the full path, so the error is reported for the file
+        }
+        cache->length = dir_length;
+    }
+
+    return openat(cache->fd, slash + 1, FILE_OPEN_FLAGS);
+}
+
+/* Check whether the first page of the file is in the page cache, without reading it from the disk */
+/*
+  * @return
+  * `false` if it isn't cached or it can't be told (e.g. `RWF_NOWAIT` isn't supported), so the pages are dropped after the scan
+*/
+static bool is_file_cached(int fd) {
+#if defined(__linux__) && defined(RWF_NOWAIT)
+    char byte;
+    struct iovec vector = { .iov_base = &byte, .iov_len = sizeof(byte) };
+    return preadv2(fd, &vector, 1, 0, RWF_NOWAIT) >= 0;
+#else
+    (void)fd;
+    return false;
+#endif
+}
+
+/* Open a file and start reading it ahead */
+void prefetch_file(const char *path, DirFdCache *cache, PrefetchedFile *file) {
+    if (file == NULL) return;
+
+    uint64_t trace_start = trace_begin(TRACE_PREFETCH_FILE);
+    file->fd = path != NULL ? open_scan_target(path, cache) : -1;
+    file->is_cold = true;
+    if (file->fd != -1) {
+        file->is_cold = !is_file_cached(file->fd);
+        if (file->is_cold) posix_fadvise(file->fd, 0, PREFETCH_BYTES, POSIX_FADV_WILLNEED); // Asynchronous, the reads are queued while the current file is scanned
+    }
+    trace_end(TRACE_PREFETCH_FILE, trace_start);
+}
+
+/* Close a prefetched file which won't be scanned */
+void prefetched_file_clear(PrefetchedFile *file) {
+    if (file == NULL || file->fd == -1) return;
+
+    close(file->fd);
+    file->fd = -1;
+}
+
+/* Close the scanned file, drop its pages if it wasn't cached before */
+static inline void close_scan_target(int fd, bool is_cold) {
+    if (is_cold) posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED); // A full disk scan would evict the whole page cache of the host otherwise
+    close(fd);
+}
+
+/* Check whether the file is still the one described by `status` */
+static bool is_file_unchanged(int fd, const struct stat *status) {
+    struct stat current;
+    if (fstat(fd, &current) != 0) return false;
+
+    return current.st_size == status->st_size &&
+           current.st_mtim.tv_sec == status->st_mtim.tv_sec && current.st_mtim.tv_nsec == status->st_mtim.tv_nsec &&
+           current.st_ctim.tv_sec == status->st_ctim.tv_sec && current.st_ctim.tv_nsec == status->st_ctim.tv_nsec;
+}
+
+/* Scan a file, its span is recorded by `process_file()` */
+static cl_error_t scan_file(const char *path, ClamavEssentials *essentials, DirFdCache *cache, PrefetchedFile *prefetched) {
 
 	cl_error_t error;
-    int fd = open(path, FILE_OPEN_FLAGS); // Open the file
+    bool is_prefetched = prefetched != NULL && prefetched->fd != -1;
+    int fd = is_prefetched ? prefetched->fd : open_scan_target(path, cache); // Open the file
+    bool is_cold = is_prefetched ? prefetched->is_cold : (fd != -1 && !is_file_cached(fd));
+    if (prefetched != NULL) prefetched->fd = -1; // Owned by this function from now on
     if (fd == -1) {
         fprintf(stderr, "[ERROR] process_file: Failed to open %s: %s\n", path, strerror(errno));
-        return;
+        stats_add(STAT_ERRORS, 1);
+        return CL_EOPEN;
     }
     
+    /* Skip the scan if the file is unchanged since it was found clean */
+    struct stat status;
+    bool is_json = essentials->output != NULL && atomic_load(&essentials->output->format) == RESULT_FORMAT_JSON; // The lines have the file size
+    bool has_status = (essentials->verdict_cache != NULL || essentials->content_cache != NULL || essentials->throttle != NULL || is_json) && fstat(fd, &status) == 0;
+    if (has_status && verdict_cache_lookup(essentials->verdict_cache, &status)) {
+        close_scan_target(fd, is_cold); // A prefetched file may have started its readahead
+        stats_add(STAT_FILES_SCANNED, 1);
+        stats_add(STAT_FILES_CACHED, 1);
+        process_scan_result(path, CL_CLEAN, NULL, essentials, (int64_t)status.st_size, (uint64_t)status.st_size, 0, local_worker_index);
+        return CL_CLEAN;
+    }
+
+    /* Reuse the verdict of the same content if any worker has already scanned it */
+    ContentDigest digest;
+    bool has_digest = has_status && essentials->content_cache != NULL && content_digest_compute(fd, (uint64_t)status.st_size, &digest);
+    if (has_digest) {
+        cl_error_t verdict;
+        char cached_virname[CONTENT_VIRNAME_SIZE];
+        if (content_cache_lookup(essentials->content_cache, &digest, essentials->generation, &verdict, cached_virname)) {
+            close_scan_target(fd, is_cold);
+            if (verdict == CL_CLEAN) verdict_cache_insert(essentials->verdict_cache, &status);
+            stats_add(STAT_FILES_SCANNED, 1);
+            stats_add(STAT_CONTENT_HITS, 1);
+            if (verdict == CL_VIRUS) stats_record_threat();
+            process_scan_result(path, verdict, verdict == CL_VIRUS ? cached_virname : NULL, essentials,
+                                (int64_t)status.st_size, (uint64_t)status.st_size, 0, local_worker_index);
+            return verdict;
+        }
+        stats_add(STAT_CONTENT_MISSES, 1);
+    }
+
+    if (essentials->throttle != NULL) scan_throttle_wait(essentials->throttle, has_status ? (uint64_t)status.st_size : 0); // Only the files really scanned take a turn
+
     const char *virname = NULL;
     unsigned long scanned = 0;
+    struct timespec start, end;
+    uint64_t trace_start = trace_begin(TRACE_SCANDESC);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    process_heartbeat_begin(local_heartbeat);
     error = cl_scandesc(fd, NULL, &virname, &scanned, essentials->engine, &essentials->scan_options); // Scan the file
-    close(fd);
+    process_heartbeat_end(local_heartbeat);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    trace_end(TRACE_SCANDESC, trace_start);
+
+    /* A file changed after it was digested may have been scanned with other content, its verdict doesn't belong to the digest */
+    bool can_publish = has_digest && (error == CL_CLEAN || error == CL_VIRUS) && is_file_unchanged(fd, &status);
+    if (can_publish) content_cache_publish(essentials->content_cache, &digest, essentials->generation, error, virname);
+    close_scan_target(fd, is_cold);
 
-    process_scan_result(path, error, virname);
+    if (has_status && error == CL_CLEAN) verdict_cache_insert(essentials->verdict_cache, &status); // A change during the scan updates the ctime, so it won't hit next time
+
+    uint64_t scan_time_ns = (uint64_t)((end.tv_sec - start.tv_sec) * 1000000000LL + (end.tv_nsec - start.tv_nsec));
+    uint64_t bytes_scanned = (uint64_t)scanned * CL_COUNT_PRECISION; // `scanned` is counted in `CL_COUNT_PRECISION` blocks
+
+    stats_add(STAT_FILES_SCANNED, 1);
+    stats_add(STAT_BYTES_SCANNED, bytes_scanned);
+    if (error == CL_VIRUS) stats_record_threat();
+    else if (error != CL_CLEAN) stats_add(STAT_ERRORS, 1);
+    stats_record_scan(scan_time_ns);
+
+    process_scan_result(path, error, virname, essentials, has_status ? (int64_t)status.st_size : -1, bytes_scanned, scan_time_ns, local_worker_index);
+    return error;
 }
 
-/* Process a directory */
+/* Scan a file and output the result */
+cl_error_t process_file(const char *path, ClamavEssentials *essentials, DirFdCache *cache, PrefetchedFile *prefetched) {
+    if (path == NULL || essentials == NULL) return CL_ENULLARG; // Invalid arguments
+
+    uint64_t trace_start = trace_begin(TRACE_PROCESS_FILE);
+    cl_error_t verdict = scan_file(path, essentials, cache, prefetched);
+    trace_end(TRACE_PROCESS_FILE, trace_start);
+    return verdict;
+}
+
+#ifdef __linux__
+/* The record returned by `getdents64`, glibc only exposes it since 2.30 */
+struct linux_dirent64 {
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+#endif
+
+/* Directory being traversed */
+typedef struct {
+    int dir_fd;
+    const char *path;
+    PathArena *arena;
+    TaskPool *dir_tasks;
+    TaskPool *file_tasks;
+    size_t owner;
+    TraversalFilter *filter;
+    bool is_risky_directory; // Only checked if the file tasks are prioritized
+    time_t now;
+} DirectoryContext;
+
+/* Classify a directory entry and add it to the matching task pool */
+/*
+  * @param type
+  * The `d_type` of the entry, it's trusted unless it's `DT_UNKNOWN` (some file systems don't fill it)
+*/
+static void process_directory_entry(DirectoryContext *context, const char *name, unsigned char type) {
+    if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'))) return; // Skip the current and parent directory
+
+    if (type == DT_DIR && traversal_filter_is_excluded(context->filter, context->path, name, true, 0)) return; // Never opened
+
+    uint64_t size = 0;
+    uint64_t priority_key = 0;
+    if (type == DT_UNKNOWN || type == DT_REG) { // The size of the files is needed for the large file lane
+        struct stat status;
+        if (fstatat(context->dir_fd, name, &status, AT_SYMLINK_NOFOLLOW) != 0) {
+            fprintf(stderr, "[ERROR] traverse_directory: Failed to stat %s/%s: %s\n", context->path, name, strerror(errno));
+            stats_add(STAT_ERRORS, 1);
+            return;
+        }
+
+        if (S_ISDIR(status.st_mode)) type = DT_DIR;
+        else if (S_ISREG(status.st_mode)) type = DT_REG;
+        else return; // Skip other types of files
+        size = (uint64_t)status.st_size;
+
+        if (traversal_filter_is_excluded(context->filter, context->path, name, type == DT_DIR, size)) return;
+        if (type == DT_REG && traversal_filter_is_completed(context->filter, context->path, name)) return;
+        if (type == DT_REG && !traversal_filter_accept_file(context->filter, &status)) return;
+        if (type == DT_REG && context->file_tasks->is_prioritized) priority_key = get_file_priority_key(name, &status, context->is_risky_directory, context->now);
+    }
+
+    TaskPool *pool = NULL;
+    TaskType task_type;
+    switch (type) {
+        case DT_DIR:
+            pool = context->dir_tasks; // Traverse the directory
+            task_type = TASK_SCAN_DIR;
+            break;
+        case DT_REG:
+            pool = context->file_tasks; // Scan the file
+            task_type = TASK_SCAN_FILE;
+            break;
+        default:
+            return; // Skip other types of files
+    }
+
+    Task new_task;
+    if (!build_task(context->arena, task_type, context->path, name, &new_task)) return; // Build the full path in the arena
+    new_task.size = size;
+    task_pool_add_prioritized(pool, context->owner, new_task, priority_key); // Add the task to the task pool, the directories never have a key
+    if (task_type == TASK_SCAN_FILE) stats_add(STAT_FILES_ENQUEUED, 1);
+}
+
+/* Classify the entries of a directory, its span is recorded by `traverse_directory()` */
 /*
   * @param path
   * The directory to be processed
+  *
+  * @param arena
+  * The PathArena in which the new paths are stored
   * 
   * @param dir_tasks
-  * The TaskQueue to which the directory tasks are added
+  * The TaskPool to which the directory tasks are added
   * 
   * @param file_tasks
-  * The TaskQueue to which the file tasks are added
+  * The TaskPool to which the file tasks are added
+  *
+  * @param owner
+  * The index of the calling producer, the new tasks are pushed to its own deques
+  *
+  * @param filter
+  * Decides which directories and files get a task [OPTIONAL]
 */
-void traverse_directory(const char *path, TaskQueue *dir_tasks, TaskQueue *file_tasks) {
-    if (path == NULL || dir_tasks == NULL || file_tasks == NULL) return; // Invalid arguments
+static void read_directory(const char *path, PathArena *arena, TaskPool *dir_tasks, TaskPool *file_tasks, size_t owner, TraversalFilter *filter) {
+    int dir_fd = open(path, DIR_OPEN_FLAGS); // Open the directory, the entries are classified relative to it
+    if (dir_fd == -1) {
+        fprintf(stderr, "[ERROR] traverse_directory: Failed to open %s: %s\n", path, strerror(errno));
+        stats_add(STAT_ERRORS, 1);
+        return;
+    }
+    if (!traversal_filter_enter_directory(filter, dir_fd)) { // A pseudo file system, another file system or already traversed
+        close(dir_fd);
+        return;
+    }
+    stats_add(STAT_DIRS_TRAVERSED, 1);
+
+    DirectoryContext context = {
+        .dir_fd = dir_fd,
+        .path = path,
+        .arena = arena,
+        .dir_tasks = dir_tasks,
+        .file_tasks = file_tasks,
+        .owner = owner,
+        .filter = filter,
+        .is_risky_directory = file_tasks->is_prioritized && is_risky_directory(path),
+        .now = file_tasks->is_prioritized ? time(NULL) : 0,
+    };
+
+#ifdef __linux__
+    static _Alignas(struct linux_dirent64) char buffer[GETDENTS_BUFFER_SIZE]; // Each process has its own copy after forking
+
+    while (true) {
+        long bytes = syscall(SYS_getdents64, dir_fd, buffer, sizeof(buffer)); // Read a batch of entries
+        if (bytes == -1) {
+            if (errno == EINTR) continue;
+            fprintf(stderr, "[ERROR] traverse_directory: Failed to read %s: %s\n", path, strerror(errno));
+            stats_add(STAT_ERRORS, 1);
+            break;
+        }
+        if (bytes == 0) break; // End of the directory
 
-    DIR *dir = opendir(path); // Open the directory
+        for (long offset = 0; offset < bytes;) {
+            struct linux_dirent64 *entry = (struct linux_dirent64 *)(buffer + offset);
+            offset += entry->d_reclen;
+            process_directory_entry(&context, entry->d_name, entry->d_type);
+        }
+    }
+    close(dir_fd); // Close the directory
+#else
+    DIR *dir = fdopendir(dir_fd); // The stream takes the ownership of `dir_fd`
     if (dir == NULL) {
         fprintf(stderr, "[ERROR] traverse_directory: Failed to open %s: %s\n", path, strerror(errno));
+        close(dir_fd);
         return;
     }
 
     struct dirent *entry;
     while ((entry = readdir(dir))) { // Traverse the directory
-        if (memcmp(entry->d_name, ".", MIN(strlen(entry->d_name), 2)) == 0 ||
-            memcmp(entry->d_name, "..", MIN(strlen(entry->d_name), 3)) == 0) continue; // Skip the current and parent directory
-
-        char fullpath[MAX_PATH]; // Initialize a full path
-        snprintf(fullpath, MAX_PATH, "%s/%s", path, entry->d_name); // Build the full path
-
-        if (is_directory(fullpath)) {
-            Task new_dir_task = build_task(TASK_SCAN_DIR, fullpath); // Build a new task for traversing the directory
-            task_queue_add(dir_tasks, new_dir_task); // Add the task to the task queue
-        }
-        else if (is_regular_file(fullpath)) {
-            Task new_file_task = build_task(TASK_SCAN_FILE, fullpath); // Build a new task for scanning the file
-            task_queue_add(file_tasks, new_file_task); // Add the task to the task queue
-        }
-        else continue; // Skip other types of files
+        process_directory_entry(&context, entry->d_name, entry->d_type);
     }
     closedir(dir); // Close the directory
-}
\ No newline at end of file
+#endif
+}
+
+/* Process a directory */
+void traverse_directory(const char *path, PathArena *arena, TaskPool *dir_tasks, TaskPool *file_tasks, size_t owner, TraversalFilter *filter) {
+    if (path == NULL || arena == NULL || dir_tasks == NULL || file_tasks == NULL) return; // Invalid arguments
+
+    uint64_t trace_start = trace_begin(TRACE_TRAVERSE_DIRECTORY);
+    read_directory(path, arena, dir_tasks, file_tasks, owner, filter);
+    trace_end(TRACE_TRAVERSE_DIRECTORY, trace_start);
+}
@@ -22,10 +22,23 @@
 #define MANAGER_H
 
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdatomic.h>
 #include <semaphore.h>
 #include <clamav.h>
 
+#include "arena.h"
+#include "background.h"
+#include "cache.h"
+#include "content-cache.h"
+#include "json-lines.h"
+#include "member-pool.h"
+#include "priority.h"
+#include "profile.h"
+#include "result-protocol.h"
+#include "stats.h"
+#include "trace.h"
+#include "traversal-filter.h"
 #include "watchdog.h"
 
 #ifdef __linux__
@@ -37,29 +50,108 @@
 #endif
 
 #define MAX_PROCESSES 64
+#define MAX_PRODUCERS 8 // Maximum number of producer processes, each of them owns a pair of deques
 
-#define QUEUE_SIZE 4096
+#define QUEUE_SIZE (1 << 18)
 #define MASK (QUEUE_SIZE - 1)
+#ifndef MAX_GET_TASKS // Overridden by the queue benchmark
 #define MAX_GET_TASKS 20
+#endif
+
+#define DEQUE_SIZE 4096
+#define DEQUE_MASK (DEQUE_SIZE - 1)
+#define NO_DEQUE_OWNER SIZE_MAX // Use for adding tasks from a process that doesn't own a deque (e.g. the parent process)
+#define SPILL_REFILL_TASKS (DEQUE_SIZE / 2) // Spilled tasks moved back to the deque at once, the rest of the deque is left for the new ones
+#define PREFETCH_DEPTH 2 // Files of the batch opened ahead of the one being scanned
+#define PREFETCH_BYTES ((off_t)2 << 20) // Bytes read ahead of each prefetched file, libclamav starts with the headers anyway
+#define LARGE_FILE_THRESHOLD ((uint64_t)16 << 20) // Files from this size go to the large file lane of the file tasks
+#define LARGE_FILE_HEAP_SIZE 4096 // The large files beyond it are queued like the small ones
+#define SPILL_RETRY_NS 1000000 // How long a producer sleeps before retrying to take the spilled tasks back from an exhausted arena
 
 _Static_assert((QUEUE_SIZE & (MASK)) == 0, "QUEUE_SIZE must be power of 2");
+_Static_assert((DEQUE_SIZE & (DEQUE_MASK)) == 0, "DEQUE_SIZE must be power of 2");
+
+/* The slots of ScanStats, also the rings of ScanTrace */
+#define STATS_PRODUCER_SLOT(index) (index)
+#define STATS_WORKER_SLOT(index) (MAX_PRODUCERS + (index))
+#define STATS_PARENT_SLOT (MAX_PRODUCERS + MAX_PROCESSES)
+
+_Static_assert(STATS_PARENT_SLOT < STATS_MAX_SLOTS, "STATS_MAX_SLOTS is too small");
+
+/* Formats of the results */
+typedef enum {
+	RESULT_FORMAT_TEXT, // "<path>: OK" lines
+	RESULT_FORMAT_BINARY, // Frames, see `result-protocol.h`
+	RESULT_FORMAT_JSON // JSON Lines, see `json-lines.h`
+} ResultFormat;
+
+/* Result output */
+/*
+  * The results are written to the standard output in `format`
+  * Each process formats a frame or a JSON line into its own buffer, so the results need no memory however many files are scanned
+  * `lock` is held around every frame and line, a `write()` may be split on a pipe above `PIPE_BUF` and on a file or a socket at any length
+  * `lock_owner` is the process holding `lock`, so it can be released if the process dies with it (see `result_output_recover_lock()`)
+  * `is_infected_only` drops the clean results, the progress is written by the parent process instead (see `result-protocol.h`)
+*/
+typedef struct {
+	_Atomic int format; // ResultFormat
+	_Atomic bool is_infected_only;
+	sem_t lock;
+	_Atomic pid_t lock_owner; // 0 if `lock` is free
+} ResultOutput;
 
 /* ClamAV Essentials */
+/*
+  * `engine` is the engine used for scanning, the child processes inherit it when they are forked
+  * `next_engine` is compiled in the background after the signatures are updated, `clamav_essentials_swap()` makes it current
+  * `generation` is bumped every time the engine is swapped
+  * `profile` is the profile of `engine` and `scan_options`, it's also used for compiling `next_engine`
+  * `verdict_cache` skips the files known to be clean [OPTIONAL]
+  * `content_cache` reuses the verdicts of the same content scanned by any worker [OPTIONAL]
+  * `throttle` limits the bytes and the files scanned per second by all the workers [OPTIONAL]
+  * `output` selects the format of the results, NULL for the text lines [OPTIONAL]
+*/
 typedef struct {
 	struct cl_engine *engine;
+	struct cl_engine *next_engine;
+	unsigned int generation;
+	ScanProfile profile;
 	struct cl_scan_options scan_options;
+	VerdictCache *verdict_cache;
+	ContentCache *content_cache;
+	ScanThrottle *throttle;
+	ResultOutput *output;
 } ClamavEssentials;
 
+/* Wakeup event */
+/*
+  * A futex based event shared between processes, used to let idle processes sleep instead of spinning
+  * `sequence` is bumped every time the event is notified, sleepers wait until it differs from the token they observed
+  * `waiters` is the number of processes sleeping on `sequence`, so the notifier can skip the syscall if nobody is waiting
+*/
+typedef struct {
+	_Atomic uint32_t sequence;
+	_Atomic uint32_t waiters;
+} WakeupEvent;
+
 /* Task types */
 typedef enum {
 	TASK_SCAN_DIR,
-	TASK_SCAN_FILE
+	TASK_SCAN_FILE,
+	TASK_REPLAY_JOURNAL, // The path is a file of changed paths, see `replay_journal()`
+	TASK_SCAN_TARBALL, // The path is a tarball, its members become `TASK_SCAN_MEMBER` tasks, see `traverse_tarball()`
+	TASK_SCAN_MEMBER // The path is the name of a member, its data is in the MemberPool
 } TaskType;
 
 /* Task structure */
+/*
+  * The path is stored in the PathArena, use `task_path()` to read it
+*/
 typedef struct {
 	TaskType type;
-	char path[MAX_PATH];
+	PathHandle path;
+	uint64_t size; // The size of the file when it was found, 0 if unknown or not a file
+	uint32_t member; // The data of a `TASK_SCAN_MEMBER` task, `INVALID_MEMBER` for the other types
 } Task;
 
 /* Task queue */
@@ -67,32 +159,189 @@ typedef struct {
   * `mutex` is a semaphore used to protect the TaskQueue
   * `empty` is a semaphore used to indicate how many empty slots are in the TaskQueue
   * `full` is a semaphore used to indicate how many tasks are in the TaskQueue
+  * `wakeup` is notified when a task is added or the exit condition may have changed
 */
 typedef struct {
 	sem_t mutex;
 	sem_t empty;
 	sem_t full;
+	WakeupEvent wakeup;
 
 	Task tasks[QUEUE_SIZE];
 	_Atomic size_t tasks_count;
-	_Atomic size_t in_progress;
 	size_t front;
 	size_t rear;
 } TaskQueue;
 
+/* Work-stealing deque (Chase-Lev) */
+/*
+  * Only the owner process pushes to `bottom` and pops from `bottom` (newest tasks first)
+  * Other processes steal from `top` (oldest tasks first), without taking any lock
+*/
+typedef struct {
+	_Atomic int64_t top;
+	_Atomic int64_t bottom;
+	Task tasks[DEQUE_SIZE];
+} WorkDeque;
+
+/* Entry of a TaskHeap */
+typedef struct {
+	uint64_t key;
+	Task task;
+} TaskHeapEntry;
+
+/* Lane of the file tasks */
+/*
+  * A max-heap of the file tasks by `key`, protected by `mutex`, holding up to `capacity` tasks
+  * The large file lane is keyed by `size`: the biggest file is always scanned first (longest-processing-time-first), so it doesn't end up alone at the end of the scan
+  * The priority lane is keyed by `get_file_priority_key()`: the files most likely to be a threat are scanned first
+*/
+typedef struct {
+	sem_t mutex;
+	_Atomic size_t count;
+	size_t capacity;
+	TaskHeapEntry entries[PRIORITY_HEAP_SIZE];
+} TaskHeap;
+
+_Static_assert(LARGE_FILE_HEAP_SIZE <= PRIORITY_HEAP_SIZE, "The large file lane doesn't fit in a TaskHeap");
+
+/* Task pool */
+/*
+  * `queue` is the shared TaskQueue, it holds the initial tasks and the tasks that don't fit in the deques
+  * `deques` are the per-producer deques, the producer `i` owns `deques[i]`
+  * `outstanding` is the number of tasks added to the pool but not finished yet, the pool is idle when it reaches 0
+  * `spill_arena` is set if the owners never block on a full pool, see `task_pool_enable_spill()`
+  * `large_files` holds the tasks from `large_file_threshold` in size, 0 if the pool has no large file lane
+  * `priority_files` holds the tasks added with a priority key if `is_prioritized`, see `priority.h`
+  * `deque_nodes` is the NUMA node of the owner of each deque if `is_node_local`, the deques of a node are its partition of the pool
+*/
+typedef struct {
+	TaskQueue queue;
+
+	WorkDeque deques[MAX_PRODUCERS];
+	size_t num_deques;
+	size_t deque_nodes[MAX_PRODUCERS];
+	bool is_node_local;
+
+	_Atomic size_t outstanding;
+	PathArena *spill_arena;
+
+	uint64_t large_file_threshold;
+	TaskHeap large_files;
+
+	bool is_prioritized;
+	TaskHeap priority_files;
+} TaskPool;
+
+/* Parent directory cache */
+/*
+  * Workers steal files in batches from the same producer, so consecutive files usually share the parent directory
+  * Keeping the parent directory opened lets `process_file()` use `openat()` with the base name instead of resolving the whole path again
+*/
+typedef struct {
+	int fd;
+	size_t length; // The length of `path`
+	char path[MAX_PATH];
+} DirFdCache;
+
+/* Prefetched file */
+/*
+  * The worker opens the next files of its batch and asks the kernel to read their first `PREFETCH_BYTES` in the background
+  * `is_cold` means the first page wasn't cached before, so the pages are dropped after the scan instead of evicting the cache of the host
+*/
+typedef struct {
+	int fd; // -1 if the file isn't prefetched
+	bool is_cold;
+} PrefetchedFile;
+
+/* The batch of tasks a worker is processing */
+/*
+  * The tasks before `current` are finished and released, the watchdog recovers the others if the worker dies or is killed
+  * `num_reported` is `current + 1` once the result of `current` is written, only its release is left
+  * `count` is 0 while the worker holds no task
+*/
+typedef struct {
+	Task tasks[MAX_GET_TASKS];
+	_Atomic size_t count;
+	_Atomic size_t current;
+	_Atomic size_t num_reported;
+} WorkerBatch;
+
 /* Shared memory */
+/*
+  * `stats` is always counted, `clamscanc --stats` prints it
+  * `trace` is only mapped by `clamscanc --trace=`, see `trace.h`
+  * `members` is only mapped by `clamscanc --tarball`, see `tarball.h`
+  * `traversal_filter` only skips the pseudo file systems unless the scan enables more, see `traversal-filter.h`
+  * The workers whose index is not below `worker_limit` stay parked on `worker_limit_event` (see `sizing.h`)
+  * `worker_batches` has a slot per worker, see `WorkerBatch`
+*/
 typedef struct {
 	ClamavEssentials essentials;
+	PathArena arena;
+	VerdictCache verdict_cache;
+	ContentCache content_cache;
+	ScanThrottle throttle;
+	ResultOutput result_output;
+	ScanStats stats;
+	ScanTrace trace;
+	MemberPool members;
+	TraversalFilter traversal_filter;
 
   _Atomic CurrentStatus current_status;
+  _Atomic bool cancel_job; // Drop the remaining tasks of the current job (daemon mode)
 
   Observer producer_observer;
-	TaskQueue dir_tasks;
+	TaskPool dir_tasks;
 
   Observer worker_observer;
-	TaskQueue file_tasks;
+	TaskPool file_tasks;
+	WorkerBatch worker_batches[MAX_PROCESSES];
+
+	_Atomic size_t worker_limit;
+	WakeupEvent worker_limit_event;
 } SharedMemory;
 
+/* Write the whole buffer to a file descriptor which is not a socket, retry if interrupted by a signal */
+bool write_all(int fd, const void *buffer, size_t size);
+
+/* Initialize the ResultOutput */
+/*
+  * @param is_shared
+  * `true` if the ResultOutput is in the shared memory and used by several processes
+*/
+void result_output_init(ResultOutput *output, bool is_shared);
+
+/* Clear the ResultOutput */
+void result_output_clear(ResultOutput *output);
+
+/* Release the lock of the ResultOutput if it's held by a process which has died */
+/*
+  * @param pid
+  * The process which has died, it MUST have been reaped
+  *
+  * @return
+  * `true` if the lock was held by it, the frame or the line it was writing may be torn
+*/
+bool result_output_recover_lock(ResultOutput *output, pid_t pid);
+
+/* Format the cumulative counts of the scan */
+/*
+  * @note
+  * For writing them somewhere else than a file descriptor, e.g. the connection of a daemon client
+  *
+  * @return
+  * The length of the record, 0 for the text lines
+*/
+size_t result_output_format_progress(ResultOutput *output, uint64_t files, uint64_t bytes_scanned, char buffer[JSON_PROGRESS_LINE_SIZE]);
+
+/* Write the cumulative counts of the scan to `fd` */
+/*
+  * @note
+  * Only the binary stream and JSON Lines have a progress record, nothing is written for the text lines
+*/
+void result_output_write_progress(int fd, ResultOutput *output, uint64_t files, uint64_t bytes_scanned);
+
 /* Check if the given path is a directory */
 bool is_directory(const char *path);
 
@@ -100,30 +349,98 @@ bool is_directory(const char *path);
 bool is_regular_file(const char *path);
 
 /* Build a task from the given path */
-Task build_task(TaskType type, const char *path);
+/*
+  * @param arena
+  * The PathArena in which the path is stored
+  *
+  * @param dir
+  * The path, or the parent directory if `name` is given
+  *
+  * @param name
+  * The entry name to be appended to `dir` [OPTIONAL]
+  *
+  * @param task
+  * The task to be built
+  *
+  * @return
+  * `true` if the task is built, `false` if the path is too long or the arena is exhausted
+  *
+  * @warning
+  * The path MUST be released with `task_release()` after the task is processed
+*/
+bool build_task(PathArena *arena, TaskType type, const char *dir, const char *name, Task *task);
+
+/* Get the path of the task */
+static inline const char *task_path(const PathArena *arena, const Task *task) {
+	return path_arena_get(arena, task->path);
+}
+
+/* Release the path of the task */
+void task_release(PathArena *arena, Task *task);
 
 /* Initialize the ClamAV Essentials */
 /*
   * @param essentials
   * The ClamAV Essentials to be initialized
+  *
+  * @param profile
+  * The profile of the engine and the scan options
   * 
   * @return
   * `true` if the initialization is successful, `false` otherwise.
 */
-bool clamav_essentials_init(ClamavEssentials *essentials);
+bool clamav_essentials_init(ClamavEssentials *essentials, const ScanProfile *profile);
+
+/* Load and compile a new `cl_engine` from the database directory */
+/*
+  * @param engine
+  * Set to the compiled engine, or `NULL` on failure
+  *
+  * @param profile
+  * Selects the databases to be loaded and sets the limits of the engine
+  *
+  * @warning
+  * `cl_init()` MUST have been called, e.g. by `clamav_essentials_init()`
+  * It takes tens of seconds for the official databases, so the daemon calls it off the main loop
+*/
+void cl_engine_load(struct cl_engine **engine, const ScanProfile *profile);
+
+/* Make `next_engine` the current engine */
+/*
+  * @return
+  * The previous engine, the caller frees it once no process is using it anymore, `NULL` if there is no `next_engine`
+*/
+struct cl_engine *clamav_essentials_swap(ClamavEssentials *essentials);
 
 /* Clear the ClamAV Essentials */
 void clamav_essentials_clear(ClamavEssentials *essentials);
 
+/* Initialize the wakeup event */
+void wakeup_event_init(WakeupEvent *event);
+
+/* Get the token to be passed to `wakeup_event_wait()` */
+/*
+  * @note
+  * Take the token BEFORE checking the condition you want to wait for, otherwise the notification may be lost
+*/
+uint32_t wakeup_event_token(WakeupEvent *event);
+
+/* Sleep until the event is notified after `token` was taken */
+void wakeup_event_wait(WakeupEvent *event, uint32_t token);
+
+/* Notify the event and wake up to `count` sleeping processes */
+/*
+  * @note
+  * This function is async-signal-safe
+*/
+void wakeup_event_notify(WakeupEvent *event, int count);
+
 /* Initialize the TaskQueue */
 void task_queue_init(TaskQueue *queue);
 
 /* Clear the TaskQueue */
 void task_queue_clear(TaskQueue *queue);
 
-/* Check whether the task queue is empty, assume the queue is not empty if failed to get the lock */
-bool is_task_queue_empty_assumption(TaskQueue *queue);
-
 /* Add a task to the TaskQueue */
 /*
   * @param queue
@@ -131,9 +448,28 @@ bool is_task_queue_empty_assumption(TaskQueue *queue);
   * 
   * @param task
   * The task to be added to the TaskQueue
+  *
+  * @note
+  * This function will wake up one process waiting in `task_queue_wait()`
 */
 void task_queue_add(TaskQueue *queue, Task task);
 
+/* Add a task to the TaskQueue if there is an empty slot */
+/*
+  * @return
+  * `true` if the task is added, `false` if the queue is full
+*/
+bool task_queue_try_add(TaskQueue *queue, Task task);
+
+/* Get the wakeup token of the TaskQueue, take it before calling `task_queue_get()` */
+uint32_t task_queue_wakeup_token(TaskQueue *queue);
+
+/* Sleep until a task is added or the TaskQueue is woken up after `token` was taken */
+void task_queue_wait(TaskQueue *queue, uint32_t token);
+
+/* Wake up all processes waiting on the TaskQueue, use it when the exit condition may have changed */
+void task_queue_wake_all(TaskQueue *queue);
+
 /* Get a group of tasks from the task queue */
 /*
   * @param queue
@@ -146,37 +482,283 @@ void task_queue_add(TaskQueue *queue, Task task);
   * Number of tasks retrieved from the queue, 0 if no task is retrieved
   *
   * @warning
-  * This function use non-blocking semaphore to avoid busy waiting, so it may need loops to wait for the task to be available
+  * This function never blocks on an empty queue, use `task_queue_wait()` to sleep until the task is available
 */
 size_t task_queue_get(TaskQueue *queue, Task *tasks);
 
+/* Initialize the WorkDeque */
+void work_deque_init(WorkDeque *deque);
+
+/* Push a task to the bottom of the WorkDeque */
+/*
+  * @return
+  * `true` if the task is pushed, `false` if the deque is full
+  *
+  * @warning
+  * This function MUST only be called by the owner of the deque
+*/
+bool work_deque_push(WorkDeque *deque, const Task *task);
+
+/* Pop the newest task from the bottom of the WorkDeque */
+/*
+  * @return
+  * `true` if a task is popped, `false` if the deque is empty
+  *
+  * @warning
+  * This function MUST only be called by the owner of the deque
+*/
+bool work_deque_pop(WorkDeque *deque, Task *task);
+
+/* Steal the oldest tasks from the top of the WorkDeque */
+/*
+  * @param max_tasks
+  * The maximum number of tasks to steal
+  *
+  * @return
+  * Number of tasks stolen, 0 if the deque is empty
+  *
+  * @warning
+  * Stealing more than one task is only safe if the owner never calls `work_deque_pop()` on this deque
+*/
+size_t work_deque_steal(WorkDeque *deque, Task *tasks, size_t max_tasks);
+
+/* Initialize the TaskPool */
+/*
+  * @param num_deques
+  * The number of producers owning a deque in this pool, clamped to `MAX_PRODUCERS`
+*/
+void task_pool_init(TaskPool *pool, size_t num_deques);
+
+/* Clear the TaskPool */
+void task_pool_clear(TaskPool *pool);
+
+/* Set the NUMA node of the owner of a deque */
+/*
+  * @param node
+  * The index of the node in the `CpuPlacement`, see `placement.h`
+  *
+  * @note
+  * Once a node is set, the processes attached to a node steal from the deques of the same node first
+*/
+void task_pool_set_deque_node(TaskPool *pool, size_t deque, size_t node);
+
+/* Let the calling process steal from the deques of its NUMA node first */
+/*
+  * @note
+  * Call it once in every process after forking, `NO_NUMA_NODE` steals from all the deques in turn
+*/
+void task_pool_attach_node(size_t node);
+
+/* Spill the tasks of the owners instead of blocking when the pool is full */
+/*
+  * @param arena
+  * The PathArena of the tasks, the spilled paths are copied out of it and the tasks are rebuilt in it
+  *
+  * @note
+  * Use it when the owners are the only consumers of the pool (the directory tasks), so waiting for an empty slot could never end
+  * Only the `TASK_SCAN_DIR` tasks are spilled, to a stack of the calling process (see `spill.h`), and only that process takes them back
+*/
+void task_pool_enable_spill(TaskPool *pool, PathArena *arena);
+
+/* Add a task to the TaskPool */
+/*
+  * @param owner
+  * The index of the calling producer, the task is pushed to its own deque
+  * Use `NO_DEQUE_OWNER` if the caller doesn't own a deque, the task will be added to the shared TaskQueue instead
+  *
+  * @note
+  * A file from `large_file_threshold` in size goes to the large file lane if it has room
+  * If the deque is full, the task goes to the shared TaskQueue, then to the spill stack if the pool spills
+  * Otherwise this function blocks until the TaskQueue has an empty slot
+*/
+void task_pool_add(TaskPool *pool, size_t owner, Task task);
+
+/* Add a file task to the priority lane of the TaskPool */
+/*
+  * @param priority_key
+  * The `get_file_priority_key()` of the file
+  *
+  * @note
+  * The task is added by `task_pool_add()` instead if the key is 0, the pool has no priority lane or the lane is full
+*/
+void task_pool_add_prioritized(TaskPool *pool, size_t owner, Task task, uint64_t priority_key);
+
+/* Get a group of tasks from the TaskPool */
+/*
+  * @param self
+  * The index of the calling process, used for choosing its own deque and the first victim to steal from
+  *
+  * @param is_owner
+  * Whether the caller owns `deques[self]` (producers) or only steals from the deques (workers)
+  *
+  * @return
+  * Number of tasks retrieved, 0 if the pool looks empty
+  *
+  * @note
+  * The priority lane comes before everything else
+  *
+  * @warning
+  * This function never blocks, use `task_pool_wait()` to sleep until the task is available
+  * `task_pool_task_done()` MUST be called for every retrieved task after processing it
+*/
+size_t task_pool_get(TaskPool *pool, size_t self, bool is_owner, Task *tasks);
+
+/* Route the file tasks from `threshold` in size to the large file lane */
+void task_pool_enable_large_lane(TaskPool *pool, uint64_t threshold);
+
+/* Let `task_pool_add_prioritized()` route the file tasks to the priority lane */
+void task_pool_enable_priority_lane(TaskPool *pool);
+
+/* Get the biggest task of the large file lane */
+/*
+  * @return
+  * 1 if a task is retrieved, 0 if the lane is empty
+  *
+  * @note
+  * The large files are taken one at a time, `task_pool_get()` never returns them
+  * `task_pool_task_done()` MUST be called after processing the task, like for `task_pool_get()`
+*/
+size_t task_pool_get_large(TaskPool *pool, Task *task);
+
+/* Check whether the calling process has spilled tasks of the TaskPool */
+/*
+  * @note
+  * If it's `true` but `task_pool_get()` returns 0, the PathArena is exhausted, retry later instead of waiting for a wakeup
+*/
+bool task_pool_has_spilled(TaskPool *pool);
+
+/* Mark tasks retrieved by `task_pool_get()` as finished */
+/*
+  * @note
+  * When the last outstanding task is finished, all waiting processes will be woken up to recheck the exit condition
+*/
+void task_pool_task_done(TaskPool *pool, size_t count);
+
+/* Check whether all the tasks added to the TaskPool are finished */
+bool is_task_pool_idle(TaskPool *pool);
+
+/* Get the wakeup token of the TaskPool, take it before calling `task_pool_get()` */
+uint32_t task_pool_wakeup_token(TaskPool *pool);
+
+/* Sleep until a task is added or the TaskPool is woken up after `token` was taken */
+void task_pool_wait(TaskPool *pool, uint32_t token);
+
+/* Wake up all processes waiting on the TaskPool */
+void task_pool_wake_all(TaskPool *pool);
+
 /* Initialize the shared memory */
 /*
   * @param shared_memory
   * The shared memory to be initialized
+  *
+  * @param num_producers
+  * The number of producer processes, each of them owns a deque in both pools
+  *
+  * @param profile
+  * The profile of the shared engine
   * 
   * @warning
   * This function will use `mmap` to allocate the shared memory
 */
-bool shared_memory_init(SharedMemory **shared_memory);
+bool shared_memory_init(SharedMemory **shared_memory, size_t num_producers, const ScanProfile *profile);
 
 /* Clear the shared memory */
 void shared_memory_clear(SharedMemory **shared_memory);
 
+/* Initialize the DirFdCache */
+void dir_fd_cache_init(DirFdCache *cache);
+
+/* Clear the DirFdCache */
+void dir_fd_cache_clear(DirFdCache *cache);
+
+/* Open a file and start reading it ahead */
+/*
+  * @param cache
+  * The cache of the parent directory, used for opening the file relative to it [OPTIONAL]
+  *
+  * @note
+  * `file->fd` is -1 if the file can't be opened, `process_file()` opens it again and reports the error
+*/
+void prefetch_file(const char *path, DirFdCache *cache, PrefetchedFile *file);
+
+/* Close a prefetched file which won't be scanned */
+void prefetched_file_clear(PrefetchedFile *file);
+
 /* Process a file */
-void process_file(const char *path, ClamavEssentials *essentials);
+/*
+  * @param path
+  * The file to be scanned
+  *
+  * @param essentials
+  * The ClamAV Essentials used for scanning
+  *
+  * @param cache
+  * The cache of the parent directory, used for opening the file relative to it [OPTIONAL]
+  *
+  * @param prefetched
+  * The file opened by `prefetch_file()`, it's closed here [OPTIONAL]
+  *
+  * @return
+  * The verdict, `CL_CLEAN`, `CL_VIRUS` or the error, it's already reported
+*/
+cl_error_t process_file(const char *path, ClamavEssentials *essentials, DirFdCache *cache, PrefetchedFile *prefetched);
+
+/* Let the calling process mark its `cl_scandesc()` calls on `heartbeat` */
+/*
+  * @note
+  * Only the time inside `cl_scandesc()` is marked busy, so a worker killed for a deadline never holds a lock of the shared memory
+*/
+void scan_heartbeat_attach(ProcessHeartbeat *heartbeat);
+
+/* Get the heartbeat attached by `scan_heartbeat_attach()`, NULL if none */
+ProcessHeartbeat *scan_heartbeat_get(void);
+
+/* Let the calling process tag its results with its worker index (see `json-lines.h`) */
+void result_output_attach(size_t worker_index);
+
+/* Write the result of a scan which didn't come from a task */
+/*
+  * The result is formatted like the ones of `process_file()`, the counters aren't touched
+  *
+  * @param fd
+  * Where the result is written, e.g. the connection of a daemon client
+  *
+  * @param file_size
+  * -1 if unknown
+*/
+void write_scan_result(int fd, const char *path, cl_error_t error, const char *virname, ClamavEssentials *essentials,
+                       int64_t file_size, uint64_t bytes_scanned, uint64_t scan_time_ns);
+
+/* Report a file which couldn't be scanned */
+/*
+  * @note
+  * Used by the watchdog for the files whose worker was killed or has crashed
+  *
+  * @param worker_index
+  * The worker which was scanning the file
+*/
+void report_scan_failure(const char *path, cl_error_t error, ClamavEssentials *essentials, uint64_t scan_time_ns, size_t worker_index);
 
 /* Process a directory */
 /*
   * @param path
   * The directory to be processed
+  *
+  * @param arena
+  * The PathArena in which the new paths are stored
   * 
   * @param dir_tasks
-  * The TaskQueue to which the directory tasks are added
+  * The TaskPool to which the directory tasks are added
   * 
   * @param file_tasks
-  * The TaskQueue to which the file tasks are added
+  * The TaskPool to which the file tasks are added
+  *
+  * @param owner
+  * The index of the calling producer, the new tasks are pushed to its own deques
+  *
+  * @param filter
+  * Decides which directories and files get a task [OPTIONAL]
 */
-void traverse_directory(const char *path, TaskQueue *dir_tasks, TaskQueue *file_tasks);
+void traverse_directory(const char *path, PathArena *arena, TaskPool *dir_tasks, TaskPool *file_tasks, size_t owner, TraversalFilter *filter);
 
 #endif /* MANAGER_H */
\ No newline at end of file
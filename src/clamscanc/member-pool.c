@@ -0,0 +1,121 @@
+/* member-pool.c
+ *
+ * Copyright 2025 EricLin
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+*/
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "member-pool.h"
+
+#define MEMBER_INDEX(ring, slot) ((uint32_t)((ring) * MEMBER_RING_SLOTS + (slot)))
+
+/* The size of the mapping of `num_rings` rings, the slots come first */
+static size_t mapping_size(size_t num_rings) {
+    return num_rings * (sizeof(MemberRing) + MEMBER_RING_SIZE);
+}
+
+/* Initialize the MemberPool, disabled */
+void member_pool_init(MemberPool *pool) {
+    if (pool == NULL) return;
+
+    pool->rings = NULL;
+    pool->data = NULL;
+    pool->num_rings = 0;
+}
+
+/* Map a ring for each producer */
+bool member_pool_enable(MemberPool *pool, size_t num_rings) {
+    if (pool == NULL || num_rings == 0 || num_rings * MEMBER_RING_SLOTS > INVALID_MEMBER) return false;
+    if (pool->rings != NULL) return true; // Already enabled
+
+    void *rings = mmap(NULL, mapping_size(num_rings), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (rings == MAP_FAILED) {
+        fprintf(stderr, "[ERROR] member_pool_enable: Failed to map the member pool: %s\n", strerror(errno));
+        return false;
+    }
+
+    pool->rings = rings;
+    pool->data = (char *)rings + num_rings * sizeof(MemberRing);
+    pool->num_rings = num_rings;
+    return true;
+}
+
+/* Clear the MemberPool */
+void member_pool_clear(MemberPool *pool) {
+    if (pool == NULL || pool->rings == NULL) return;
+
+    munmap(pool->rings, mapping_size(pool->num_rings));
+    member_pool_init(pool);
+}
+
+/* Take the space of the released members back, in order */
+static void reclaim_ring(MemberRing *ring) {
+    while (ring->tail != ring->head && !atomic_load_explicit(&ring->slots[ring->tail % MEMBER_RING_SLOTS].is_used, memory_order_acquire)) ring->tail++;
+    if (ring->tail == ring->head) ring->write_offset = 0; // Empty, start over so the largest members fit again
+}
+
+/* Take the space of a member from a ring */
+uint32_t member_pool_take(MemberPool *pool, size_t ring_index, uint64_t size, char **data) {
+    if (pool == NULL || pool->rings == NULL || ring_index >= pool->num_rings || size > MEMBER_MAX_SIZE || data == NULL) return INVALID_MEMBER;
+
+    MemberRing *ring = &pool->rings[ring_index];
+    reclaim_ring(ring);
+    if (ring->head - ring->tail == MEMBER_RING_SLOTS) return INVALID_MEMBER; // No slot left
+
+    /* The live data is [`free_offset`, `write_offset`), or wraps around the end of the ring if `write_offset` is below `free_offset` */
+    bool is_empty = ring->tail == ring->head;
+    uint64_t free_offset = is_empty ? 0 : ring->slots[ring->tail % MEMBER_RING_SLOTS].offset;
+    uint64_t offset;
+    if (is_empty || ring->write_offset >= free_offset) {
+        if (size <= MEMBER_RING_SIZE - ring->write_offset) offset = ring->write_offset;
+        else if (size < free_offset) offset = 0; // Wrap, `write_offset` never catches up with `free_offset`
+        else return INVALID_MEMBER;
+    }
+    else if (size < free_offset - ring->write_offset) offset = ring->write_offset;
+    else return INVALID_MEMBER;
+
+    size_t slot = ring->head % MEMBER_RING_SLOTS;
+    ring->slots[slot].offset = offset;
+    ring->slots[slot].size = size;
+    atomic_store_explicit(&ring->slots[slot].is_used, true, memory_order_relaxed); // Published to the workers with the task
+    ring->head++;
+    ring->write_offset = offset + size;
+
+    *data = pool->data + ring_index * MEMBER_RING_SIZE + offset;
+    return MEMBER_INDEX(ring_index, slot);
+}
+
+/* Get the data of a member */
+const char *member_pool_get(const MemberPool *pool, uint32_t member, uint64_t *size) {
+    if (pool == NULL || pool->rings == NULL || member / MEMBER_RING_SLOTS >= pool->num_rings) return NULL;
+
+    size_t ring_index = member / MEMBER_RING_SLOTS;
+    const MemberSlot *slot = &pool->rings[ring_index].slots[member % MEMBER_RING_SLOTS];
+    if (size != NULL) *size = slot->size;
+    return pool->data + ring_index * MEMBER_RING_SIZE + slot->offset;
+}
+
+/* Release a member after it's scanned, the owner of its ring takes its space back */
+void member_pool_release(MemberPool *pool, uint32_t member) {
+    if (pool == NULL || pool->rings == NULL || member / MEMBER_RING_SLOTS >= pool->num_rings) return;
+
+    atomic_store_explicit(&pool->rings[member / MEMBER_RING_SLOTS].slots[member % MEMBER_RING_SLOTS].is_used, false, memory_order_release);
+}
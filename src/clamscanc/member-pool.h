@@ -0,0 +1,108 @@
+/* member-pool.h
+ *
+ * Copyright 2025 EricLin
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+*/
+
+/* Member pool */
+/*
+  * The data of the tarball members waiting for the workers, in a shared mapping (see `tarball.h`)
+  * Each producer owns a ring: only it takes the space, from `head`, the workers release the slots in any order
+  * The space of the released slots is taken back from `tail` in order, so a slow member holds the space behind it
+  * The rings reserve `MEMBER_RING_SIZE` of address space each, only the pages written are backed
+*/
+
+#ifndef MEMBER_POOL_H
+#define MEMBER_POOL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdatomic.h>
+
+#define MEMBER_RING_SIZE ((uint64_t)256 << 20) // Bytes of the members of a producer waiting for the workers
+#define MEMBER_RING_SLOTS 4096 // Members of a producer waiting for the workers
+#define MEMBER_MAX_SIZE (MEMBER_RING_SIZE / 2) // A larger member isn't scanned, so a member always fits once the ring drains
+#define MEMBER_RETRY_NS 1000000 // How long a producer sleeps before retrying to take the space of a full ring
+#define INVALID_MEMBER UINT32_MAX
+
+_Static_assert((MEMBER_RING_SLOTS & (MEMBER_RING_SLOTS - 1)) == 0, "MEMBER_RING_SLOTS must be power of 2");
+
+/* Slot of a member */
+/*
+  * `offset` is relative to the data of the ring, `is_used` is cleared by the worker which scanned the member
+*/
+typedef struct {
+	uint64_t offset;
+	uint64_t size;
+	_Atomic bool is_used;
+} MemberSlot;
+
+/* Ring of a producer */
+/*
+  * `head` and `tail` only grow, the slot of an index is `index % MEMBER_RING_SLOTS`
+  * `write_offset` is where the next member is written, it goes back to 0 when the end of the ring is reached
+*/
+typedef struct {
+	MemberSlot slots[MEMBER_RING_SLOTS];
+	size_t head;
+	size_t tail;
+	uint64_t write_offset;
+} MemberRing;
+
+typedef struct {
+	MemberRing *rings; // NULL if the pool isn't used
+	char *data;
+	size_t num_rings;
+} MemberPool;
+
+/* Initialize the MemberPool, disabled */
+void member_pool_init(MemberPool *pool);
+
+/* Map a ring for each producer */
+/*
+  * @return
+  * `true` if the rings are mapped, `false` otherwise
+  *
+  * @warning
+  * This function MUST be called before forking, the mapping is shared with the child processes
+*/
+bool member_pool_enable(MemberPool *pool, size_t num_rings);
+
+/* Clear the MemberPool */
+void member_pool_clear(MemberPool *pool);
+
+/* Take the space of a member from a ring */
+/*
+  * @param data
+  * Receives the space of the member, where its `size` bytes are written [OUT]
+  *
+  * @return
+  * The member, `INVALID_MEMBER` if the ring is full (retry after `MEMBER_RETRY_NS`) or `size` exceeds `MEMBER_MAX_SIZE`
+  *
+  * @warning
+  * Only the owner of the ring may call this function
+*/
+uint32_t member_pool_take(MemberPool *pool, size_t ring, uint64_t size, char **data);
+
+/* Get the data of a member */
+const char *member_pool_get(const MemberPool *pool, uint32_t member, uint64_t *size);
+
+/* Release a member after it's scanned, the owner of its ring takes its space back */
+void member_pool_release(MemberPool *pool, uint32_t member);
+
+#endif // MEMBER_POOL_H
@@ -0,0 +1,197 @@
+/* placement.c
+ *
+ * Copyright 2025 EricLin
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+*/
+
+#define _GNU_SOURCE // For `sched_setaffinity()`
+#include <dirent.h>
+#include <errno.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <linux/mempolicy.h>
+#include <sys/syscall.h>
+#endif
+
+#include "placement.h"
+
+#define NODE_SYSFS_PATH "/sys/devices/system/node"
+#define NODE_PATH_SIZE 128
+#define NODE_MASK_BITS 1024 // Nodes with a larger number are never bound
+#define NODE_MASK_LONGS (NODE_MASK_BITS / (8 * sizeof(unsigned long)))
+
+static int compare_ints(const void *a, const void *b) {
+    int left = *(const int *)a, right = *(const int *)b;
+    return (left > right) - (left < right);
+}
+
+/* Add the allowed CPUs of a `cpulist` like `0-3,8-11` to the last node */
+static void read_node_cpus(CpuPlacement *placement, int node, const cpu_set_t *allowed, bool *is_placed) {
+    char path[NODE_PATH_SIZE];
+    snprintf(path, sizeof(path), "%s/node%d/cpulist", NODE_SYSFS_PATH, node);
+
+    FILE *file = fopen(path, "re");
+    if (file == NULL) return;
+
+    char list[4096];
+    bool has_list = fgets(list, sizeof(list), file) != NULL;
+    fclose(file);
+    if (!has_list) return;
+
+    const char *cursor = list;
+    while (*cursor >= '0' && *cursor <= '9') {
+        char *end;
+        long first = strtol(cursor, &end, 10), last = first;
+        if (*end == '-') last = strtol(end + 1, &end, 10);
+
+        for (long cpu = first; cpu <= last && cpu < PLACEMENT_MAX_CPUS; cpu++) {
+            if (!CPU_ISSET(cpu, allowed) || is_placed[cpu]) continue;
+
+            is_placed[cpu] = true;
+            placement->cpus[placement->num_cpus++] = (int)cpu;
+        }
+
+        cursor = *end == ',' ? end + 1 : end;
+    }
+}
+
+/* Read the CPUs allowed for the process and their nodes */
+bool cpu_placement_init(CpuPlacement *placement) {
+    if (placement == NULL) return false;
+    memset(placement, 0, sizeof(*placement));
+
+    cpu_set_t allowed;
+    CPU_ZERO(&allowed);
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) == -1) {
+        fprintf(stderr, "[ERROR] cpu_placement_init: Failed to get the CPU affinity: %s\n", strerror(errno));
+        return false;
+    }
+
+    /* The nodes in their order, so the slots are dealt the same way on every run */
+    int node_numbers[NODE_MASK_BITS];
+    size_t num_node_numbers = 0;
+    DIR *dir = opendir(NODE_SYSFS_PATH);
+    if (dir != NULL) {
+        struct dirent *entry;
+        while ((entry = readdir(dir)) != NULL && num_node_numbers < NODE_MASK_BITS) {
+            int node;
+            char rest;
+            if (sscanf(entry->d_name, "node%d%c", &node, &rest) == 1 && node >= 0) node_numbers[num_node_numbers++] = node;
+        }
+        closedir(dir);
+    }
+    qsort(node_numbers, num_node_numbers, sizeof(int), compare_ints);
+
+    bool is_placed[PLACEMENT_MAX_CPUS] = {false};
+    for (size_t i = 0; i < num_node_numbers && placement->num_nodes < PLACEMENT_MAX_NODES; i++) {
+        size_t first = placement->num_cpus;
+        read_node_cpus(placement, node_numbers[i], &allowed, is_placed);
+        if (placement->num_cpus == first) continue; // A memory-only node, or none of its CPUs is allowed
+
+        placement->nodes[placement->num_nodes] = node_numbers[i];
+        placement->node_first[placement->num_nodes] = first;
+        placement->node_count[placement->num_nodes] = placement->num_cpus - first;
+        placement->num_nodes++;
+    }
+
+    if (placement->num_nodes > 0) return true;
+
+    /* No NUMA information, all the allowed CPUs are one node */
+    for (int cpu = 0; cpu < PLACEMENT_MAX_CPUS; cpu++) {
+        if (CPU_ISSET(cpu, &allowed)) placement->cpus[placement->num_cpus++] = cpu;
+    }
+    if (placement->num_cpus == 0) return false;
+
+    placement->num_nodes = 1;
+    placement->nodes[0] = 0;
+    placement->node_first[0] = 0;
+    placement->node_count[0] = placement->num_cpus;
+    return true;
+}
+
+/* Get the node of a slot */
+size_t cpu_placement_node(const CpuPlacement *placement, size_t slot) {
+    if (placement == NULL || placement->num_nodes == 0) return NO_NUMA_NODE;
+
+    return slot % placement->num_nodes;
+}
+
+#ifdef __linux__
+/* Build the mask of a single node */
+static bool build_node_mask(int node, unsigned long *mask) {
+    if (node < 0 || node >= NODE_MASK_BITS) return false;
+
+    memset(mask, 0, NODE_MASK_LONGS * sizeof(unsigned long));
+    mask[node / (8 * sizeof(unsigned long))] |= 1UL << (node % (8 * sizeof(unsigned long)));
+    return true;
+}
+#endif
+
+/* Pin the calling process to the CPU of a slot and prefer the memory of its node */
+bool cpu_placement_pin(const CpuPlacement *placement, size_t slot, size_t cpu_offset) {
+    size_t node = cpu_placement_node(placement, slot);
+    if (node == NO_NUMA_NODE) return false;
+
+    size_t cpu_index = (cpu_offset + slot / placement->num_nodes) % placement->node_count[node]; // Wraps around if there are more processes than CPUs
+    int cpu = placement->cpus[placement->node_first[node] + cpu_index];
+
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    if (sched_setaffinity(0, sizeof(set), &set) == -1) {
+        fprintf(stderr, "[WARNING] cpu_placement_pin: Failed to pin the process to CPU %d: %s\n", cpu, strerror(errno));
+        return false;
+    }
+
+#ifdef __linux__
+    unsigned long mask[NODE_MASK_LONGS];
+    if (placement->num_nodes > 1 && build_node_mask(placement->nodes[node], mask)) {
+        syscall(SYS_set_mempolicy, MPOL_PREFERRED, mask, NODE_MASK_BITS + 1); // The kernel takes one bit less than `maxnode`
+    }
+#endif
+
+    return true;
+}
+
+/* Move the pages fully inside a range to a node and keep them there */
+void cpu_placement_bind_memory(const CpuPlacement *placement, void *address, size_t size, size_t node) {
+#ifdef __linux__
+    if (placement == NULL || placement->num_nodes <= 1 || node >= placement->num_nodes || address == NULL) return;
+
+    unsigned long mask[NODE_MASK_LONGS];
+    if (!build_node_mask(placement->nodes[node], mask)) return;
+
+    /* The pages on the edges may be shared with the neighbours, leave them */
+    uintptr_t page_size = (uintptr_t)sysconf(_SC_PAGESIZE);
+    uintptr_t start = ((uintptr_t)address + page_size - 1) & ~(page_size - 1);
+    uintptr_t end = ((uintptr_t)address + size) & ~(page_size - 1);
+    if (end <= start) return;
+
+    syscall(SYS_mbind, (void *)start, end - start, MPOL_PREFERRED, mask, NODE_MASK_BITS + 1, MPOL_MF_MOVE);
+#else
+    (void)placement;
+    (void)address;
+    (void)size;
+    (void)node;
+#endif
+}
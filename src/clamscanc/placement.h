@@ -0,0 +1,86 @@
+/* placement.h
+ *
+ * Copyright 2025 EricLin
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+*/
+
+/* Placement of the processes on the CPUs and the NUMA nodes */
+/*
+  * The CPUs of the affinity mask are grouped by their NUMA node (`/sys/devices/system/node`), a machine without it is one node
+  * A process is pinned to one CPU, the slots are dealt to the nodes in turn so each pool spreads over all of them
+  * The pinned process prefers the memory of its node, so its copy-on-write pages and the pages it reads into the page cache stay local
+*/
+
+#ifndef PLACEMENT_H
+#define PLACEMENT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#define PIN_CPUS_OPTION "--pin-cpus"
+#define PLACEMENT_MAX_CPUS 1024 // `CPU_SETSIZE`
+#define PLACEMENT_MAX_NODES 16 // The CPUs of the further nodes are left out
+#define NO_NUMA_NODE ((size_t)-1)
+
+/* The CPUs grouped by their node */
+/*
+  * The CPUs of `nodes[i]` are `cpus[node_first[i]]` to `cpus[node_first[i] + node_count[i] - 1]`
+*/
+typedef struct {
+    size_t num_nodes;
+    size_t num_cpus;
+    int nodes[PLACEMENT_MAX_NODES]; // The node numbers of the kernel
+    size_t node_first[PLACEMENT_MAX_NODES];
+    size_t node_count[PLACEMENT_MAX_NODES];
+    int cpus[PLACEMENT_MAX_CPUS];
+} CpuPlacement;
+
+/* Read the CPUs allowed for the process and their nodes */
+/*
+  * @return
+  * `false` if the affinity mask can't be read
+*/
+bool cpu_placement_init(CpuPlacement *placement);
+
+/* Get the node of a slot */
+/*
+  * @return
+  * The index in `nodes`, `NO_NUMA_NODE` if `placement` is NULL
+*/
+size_t cpu_placement_node(const CpuPlacement *placement, size_t slot);
+
+/* Pin the calling process to the CPU of a slot and prefer the memory of its node */
+/*
+  * @param cpu_offset
+  * The CPUs of each node skipped before the slots are dealt, so two pools can be placed on different CPUs
+  *
+  * @return
+  * `false` if the affinity can't be set, the memory policy is best effort
+*/
+bool cpu_placement_pin(const CpuPlacement *placement, size_t slot, size_t cpu_offset);
+
+/* Move the pages fully inside a range to a node and keep them there */
+/*
+  * @param node
+  * The index in `nodes`
+  *
+  * @note
+  * Best effort, the range is left where it is if the kernel has no NUMA support
+*/
+void cpu_placement_bind_memory(const CpuPlacement *placement, void *address, size_t size, size_t node);
+
+#endif // PLACEMENT_H
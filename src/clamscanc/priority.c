@@ -0,0 +1,89 @@
+/* priority.c
+ *
+ * Copyright 2025 EricLin
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+*/
+
+#include <stddef.h>
+#include <string.h>
+#include <strings.h>
+
+#include "priority.h"
+
+#define MAX_EXTENSION_LENGTH 8
+
+/* Names of the download and temporary directories, compared without case */
+static const char *risky_directories[] = {
+    "Downloads", "Download", "tmp", "temp", ".tmp", "shm", // `/dev/shm`
+};
+
+/* Executables, scripts and documents with macros */
+static const char *executable_extensions[] = {
+    "exe", "dll", "scr", "com", "pif", "cpl", "sys", "msi", "ocx", "lnk", "hta",
+    "bat", "cmd", "ps1", "psm1", "vbs", "vbe", "js", "jse", "wsf", "jar",
+    "sh", "bash", "py", "pl", "rb", "php", "elf", "bin", "run", "so", "ko",
+    "appimage", "apk", "deb", "rpm", "dmg", "pkg",
+    "docm", "xlsm", "pptm", "doc", "xls", "ppt", "rtf", "pdf",
+};
+
+/* Archives and disk images */
+static const char *archive_extensions[] = {
+    "zip", "rar", "7z", "tar", "gz", "tgz", "bz2", "xz", "zst", "lz", "lzma",
+    "cab", "arj", "lzh", "iso", "img", "vhd",
+};
+
+/* Check whether `name` equals one of the `count` words, without case */
+static bool is_in_list(const char *name, size_t length, const char *const *list, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        if (strlen(list[i]) == length && strncasecmp(name, list[i], length) == 0) return true;
+    }
+    return false;
+}
+
+/* Check whether a directory is a download or a temporary directory, or lies under one */
+bool is_risky_directory(const char *path) {
+    if (path == NULL) return false;
+
+    const char *component = path;
+    while (*component != '\0') {
+        while (*component == '/') component++;
+        size_t length = strcspn(component, "/");
+        if (length > 0 && is_in_list(component, length, risky_directories, sizeof(risky_directories) / sizeof(risky_directories[0]))) return true;
+        component += length;
+    }
+    return false;
+}
+
+/* Get the key of a file in the priority lane */
+uint64_t get_file_priority_key(const char *name, const struct stat *status, bool is_in_risky_directory, time_t now) {
+    if (name == NULL || status == NULL) return 0;
+
+    uint32_t priority = is_in_risky_directory ? PRIORITY_POINTS_RISKY_DIRECTORY : 0;
+    if (status->st_mtime <= now && now - status->st_mtime < PRIORITY_RECENT_SECONDS) priority += PRIORITY_POINTS_RECENT;
+
+    const char *dot = strrchr(name, '.');
+    size_t length = dot != NULL && dot != name ? strlen(dot + 1) : 0; // A leading dot hides the file, it's not an extension
+    bool is_executable = (status->st_mode & (S_IXUSR | S_IXGRP | S_IXOTH)) != 0;
+    if (length > 0 && length <= MAX_EXTENSION_LENGTH) {
+        if (!is_executable) is_executable = is_in_list(dot + 1, length, executable_extensions, sizeof(executable_extensions) / sizeof(executable_extensions[0]));
+        if (is_in_list(dot + 1, length, archive_extensions, sizeof(archive_extensions) / sizeof(archive_extensions[0]))) priority += PRIORITY_POINTS_ARCHIVE;
+    }
+    if (is_executable) priority += PRIORITY_POINTS_EXECUTABLE;
+
+    if (priority == 0) return 0;
+    return ((uint64_t)priority << 32) | (uint32_t)(status->st_mtime > 0 ? status->st_mtime : 0); // The newest first among equals
+}
@@ -0,0 +1,75 @@
+/* priority.h
+ *
+ * Copyright 2025 EricLin
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+*/
+
+/* Priority of the files */
+/*
+  * With `--priority`, the files most likely to hold a fresh threat are scanned before the others, so the first threat is found sooner
+  * A file gets points for being recently modified, lying under a download or a temporary directory, being executable and being an archive
+  * The files with points go to the priority lane of the file tasks (see `TaskPool`), the highest first and the newest first among equals
+  * The others and the ones beyond the lane's room keep the traversal order
+*/
+
+#ifndef PRIORITY_H
+#define PRIORITY_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+#include <sys/stat.h>
+
+#define PRIORITY_OPTION "--priority"
+#define PRIORITY_RECENT_SECONDS (3 * 24 * 60 * 60) // Files modified since this long ago count as recent
+#define PRIORITY_HEAP_SIZE 16384 // The prioritized files beyond it are queued like the others
+
+/* Points of a file, the sum is its priority */
+typedef enum {
+    PRIORITY_POINTS_ARCHIVE = 1, // May hide anything inside, and unpacking takes long
+    PRIORITY_POINTS_EXECUTABLE = 2, // The executable bit, a binary or script extension, or a document with macros
+    PRIORITY_POINTS_RISKY_DIRECTORY = 2, // Under a download or a temporary directory
+    PRIORITY_POINTS_RECENT = 3, // Modified in the last `PRIORITY_RECENT_SECONDS`
+} PriorityPoints;
+
+/* Check whether a directory is a download or a temporary directory, or lies under one */
+/*
+  * @note
+  * Call it once per traversed directory, the result holds for all its files
+*/
+bool is_risky_directory(const char *path);
+
+/* Get the key of a file in the priority lane */
+/*
+  * @param name
+  * The name of the file, used for the extension
+  *
+  * @param status
+  * The `lstat()` of the file, already taken by the traversal
+  *
+  * @param is_in_risky_directory
+  * The `is_risky_directory()` of the parent directory
+  *
+  * @param now
+  * The current time, taken once per directory
+  *
+  * @return
+  * The priority in the upper 32 bits and the modification time in the lower ones, 0 if the file has no points
+*/
+uint64_t get_file_priority_key(const char *name, const struct stat *status, bool is_in_risky_directory, time_t now);
+
+#endif // PRIORITY_H
@@ -0,0 +1,177 @@
+/* profile.c
+ *
+ * Copyright 2025 EricLin
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+*/
+
+#include <clamav.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "profile.h"
+
+/* The defaults of libclamav, set explicitly so a cached engine never keeps the limits of another profile */
+#define DEFAULT_MAX_FILE_SIZE ((uint64_t)100 << 20)
+#define DEFAULT_MAX_SCAN_SIZE ((uint64_t)400 << 20)
+#define DEFAULT_MAX_RECURSION 17
+#define DEFAULT_MAX_FILES 10000
+
+#define PARSE_ALL (~(uint32_t)0)
+#define DB_QUICK CL_DB_BYTECODE // No phishing signatures, they are a large part of the engine memory and only match mail and HTML
+#define PARSE_QUICK (CL_SCAN_PARSE_PE | CL_SCAN_PARSE_ELF | CL_SCAN_PARSE_OLE2 | CL_SCAN_PARSE_PDF | CL_SCAN_PARSE_HTML) // Where the threats usually are, no archive or mail
+
+/* Definition of the profiles */
+typedef struct {
+    const char *name;
+    uint32_t general;
+    uint32_t parse;
+    uint32_t db_options;
+    uint64_t max_file_size;
+    uint64_t max_scan_size;
+    uint32_t max_recursion;
+    uint32_t max_files;
+} ProfileDefinition;
+
+static const ProfileDefinition profile_definitions[] = {
+    { SCAN_PROFILE_QUICK, CL_SCAN_GENERAL_HEURISTICS, PARSE_QUICK, DB_QUICK, (uint64_t)25 << 20, (uint64_t)100 << 20, 4, 1000 }, // Stop at the first match
+    { SCAN_PROFILE_FULL, CL_SCAN_GENERAL_HEURISTICS | CL_SCAN_GENERAL_ALLMATCHES, PARSE_ALL, CL_DB_STDOPT,
+      DEFAULT_MAX_FILE_SIZE, DEFAULT_MAX_SCAN_SIZE, DEFAULT_MAX_RECURSION, DEFAULT_MAX_FILES },
+    { SCAN_PROFILE_ARCHIVE_DEEP, CL_SCAN_GENERAL_HEURISTICS | CL_SCAN_GENERAL_ALLMATCHES, PARSE_ALL, CL_DB_STDOPT,
+      (uint64_t)512 << 20, (uint64_t)4000 << 20, 32, 100000 },
+    { SCAN_PROFILE_PUA, CL_SCAN_GENERAL_HEURISTICS | CL_SCAN_GENERAL_ALLMATCHES, PARSE_ALL, CL_DB_STDOPT | CL_DB_PUA,
+      DEFAULT_MAX_FILE_SIZE, DEFAULT_MAX_SCAN_SIZE, DEFAULT_MAX_RECURSION, DEFAULT_MAX_FILES },
+};
+
+/* Initialize a ScanProfile */
+bool scan_profile_init(ScanProfile *profile, const char *name, uint32_t extra_options) {
+    if (profile == NULL || name == NULL || (extra_options & ~SCAN_OPTIONS_ALL) != 0) return false;
+
+    const ProfileDefinition *definition = NULL;
+    for (size_t i = 0; i < sizeof(profile_definitions) / sizeof(profile_definitions[0]); i++) {
+        if (strcmp(profile_definitions[i].name, name) == 0) {
+            definition = &profile_definitions[i];
+            break;
+        }
+    }
+    if (definition == NULL) return false;
+
+    *profile = (ScanProfile){
+        .extra_options = extra_options,
+        .general = definition->general,
+        .parse = definition->parse,
+        .db_options = definition->db_options,
+        .max_file_size = definition->max_file_size,
+        .max_scan_size = definition->max_scan_size,
+        .max_recursion = definition->max_recursion,
+        .max_files = definition->max_files,
+    };
+    snprintf(profile->name, sizeof(profile->name), "%s", definition->name);
+
+    /* The extra options only add to the profile */
+    if (extra_options & SCAN_OPTIONS_ENABLE_LARGE_FILE) {
+        if (profile->max_file_size < SCAN_LARGE_FILE_SIZE) profile->max_file_size = SCAN_LARGE_FILE_SIZE;
+        if (profile->max_scan_size < SCAN_LARGE_FILE_SIZE) profile->max_scan_size = SCAN_LARGE_FILE_SIZE;
+    }
+    if (extra_options & SCAN_OPTIONS_ENABLE_PUA) profile->db_options |= CL_DB_PUA;
+    if (extra_options & SCAN_OPTIONS_SCAN_ARCHIVE) profile->parse |= CL_SCAN_PARSE_ARCHIVE;
+    if (extra_options & SCAN_OPTIONS_SCAN_MAIL) profile->parse |= CL_SCAN_PARSE_MAIL;
+    if (extra_options & SCAN_OPTIONS_ALERT_EXCEED_MAX) profile->heuristic |= CL_SCAN_HEURISTIC_EXCEEDS_MAX;
+    if (extra_options & SCAN_OPTIONS_ALERT_ENCRYPTED) profile->heuristic |= CL_SCAN_HEURISTIC_ENCRYPTED_ARCHIVE | CL_SCAN_HEURISTIC_ENCRYPTED_DOC;
+
+    return true;
+}
+
+/* Parse a ScanProfile from "<name>[:<extra options>]" */
+bool scan_profile_parse(ScanProfile *profile, const char *spec) {
+    if (profile == NULL || spec == NULL) return false;
+
+    char name[SCAN_PROFILE_NAME_SIZE];
+    size_t name_length = strcspn(spec, ":");
+    if (name_length == 0 || name_length >= sizeof(name)) return false;
+    memcpy(name, spec, name_length);
+    name[name_length] = '\0';
+
+    unsigned long extra_options = 0;
+    if (spec[name_length] == ':') {
+        const char *text = spec + name_length + 1;
+        if (text[0] < '0' || text[0] > '9') return false; // No sign or spaces
+
+        char *end = NULL;
+        errno = 0;
+        extra_options = strtoul(text, &end, 10);
+        if (*end != '\0' || errno == ERANGE || extra_options > SCAN_OPTIONS_ALL) return false;
+    }
+
+    return scan_profile_init(profile, name, (uint32_t)extra_options);
+}
+
+/* Format a ScanProfile as "<name>:<extra options>" */
+bool scan_profile_format(const ScanProfile *profile, char *spec, size_t size) {
+    if (profile == NULL || spec == NULL) return false;
+
+    int length = snprintf(spec, size, "%s:%u", profile->name, (unsigned int)profile->extra_options);
+    return length > 0 && (size_t)length < size;
+}
+
+/* Check whether two profiles scan the same way */
+bool scan_profile_is_equal(const ScanProfile *a, const ScanProfile *b) {
+    return strcmp(a->name, b->name) == 0 && a->extra_options == b->extra_options;
+}
+
+/* Check whether two profiles share the limits of the engine */
+bool scan_profile_has_same_limits(const ScanProfile *a, const ScanProfile *b) {
+    return a->max_file_size == b->max_file_size && a->max_scan_size == b->max_scan_size &&
+           a->max_recursion == b->max_recursion && a->max_files == b->max_files;
+}
+
+/* Fill the `cl_scan_options` of a profile */
+void scan_profile_get_scan_options(const ScanProfile *profile, struct cl_scan_options *options) {
+    if (profile == NULL || options == NULL) return;
+
+    *options = (struct cl_scan_options){
+        .general = profile->general,
+        .parse = profile->parse,
+        .heuristic = profile->heuristic,
+        .mail = profile->mail,
+    };
+}
+
+/* Set the limits of a profile on an engine */
+bool scan_profile_apply_limits(const ScanProfile *profile, struct cl_engine *engine) {
+    if (profile == NULL || engine == NULL) return false;
+
+    const struct {
+        enum cl_engine_field field;
+        long long value;
+    } limits[] = {
+        { CL_ENGINE_MAX_FILESIZE, (long long)profile->max_file_size },
+        { CL_ENGINE_MAX_SCANSIZE, (long long)profile->max_scan_size },
+        { CL_ENGINE_MAX_RECURSION, (long long)profile->max_recursion },
+        { CL_ENGINE_MAX_FILES, (long long)profile->max_files },
+    };
+
+    for (size_t i = 0; i < sizeof(limits) / sizeof(limits[0]); i++) {
+        cl_error_t result = cl_engine_set_num(engine, limits[i].field, limits[i].value);
+        if (result != CL_SUCCESS) {
+            fprintf(stderr, "[ERROR] scan_profile_apply_limits: cl_engine_set_num failed: %s\n", cl_strerror(result));
+            return false;
+        }
+    }
+    return true;
+}
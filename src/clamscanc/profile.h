@@ -0,0 +1,124 @@
+/* profile.h
+ *
+ * Copyright 2025 EricLin
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+*/
+
+/* Scan profiles */
+/*
+  * A profile maps a kind of scan onto the `cl_scan_options`, the engine limits and the database options
+  * The extra options chosen in the GUI (`SCAN_OPTIONS_*`) are added on top of the profile
+  * The profiles with the same database options can share a loaded database, they only differ in the limits of the engine
+  * Shared with the GUI, which only needs the names and the extra options, so no ClamAV type is used here
+*/
+
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define PROFILE_OPTION "--profile=" // `--profile=<name>[:<extra options>]`
+#define EXCLUDE_DB_OPTION "--exclude-db=" // `--exclude-db=<pattern>`, a database left out of the engines of every profile (see `database.h`)
+#define SCAN_PROFILE_QUICK "quick" // Executables and documents only, small limits
+#define SCAN_PROFILE_FULL "full" // Every format with the default limits
+#define SCAN_PROFILE_ARCHIVE_DEEP "archive-deep" // Every format, the archives are unpacked much deeper
+#define SCAN_PROFILE_PUA "pua" // Like `full`, with the signatures of the potentially unwanted applications
+#define SCAN_PROFILE_DEFAULT SCAN_PROFILE_FULL
+#define SCAN_PROFILE_NAME_SIZE 16
+#define SCAN_PROFILE_SPEC_SIZE (SCAN_PROFILE_NAME_SIZE + 12) // "<name>:<extra options>" and '\0'
+
+/* The extra options, the bits of the `scan-options-bitmask` setting */
+#define SCAN_OPTIONS_ENABLE_LARGE_FILE 0x01
+#define SCAN_OPTIONS_ENABLE_PUA 0x02
+#define SCAN_OPTIONS_SCAN_ARCHIVE 0x04
+#define SCAN_OPTIONS_SCAN_MAIL 0x08
+#define SCAN_OPTIONS_ALERT_EXCEED_MAX 0x10
+#define SCAN_OPTIONS_ALERT_ENCRYPTED 0x20
+#define SCAN_OPTIONS_ALL 0x3F
+
+#define SCAN_LARGE_FILE_SIZE ((uint64_t)2048 << 20) // Same as `clamscan --max-filesize=2048M`
+
+struct cl_scan_options;
+struct cl_engine;
+
+/* Scan profile */
+/*
+  * `name` and `extra_options` identify the profile, the other fields are derived from them
+*/
+typedef struct {
+	char name[SCAN_PROFILE_NAME_SIZE];
+	uint32_t extra_options;
+
+	uint32_t general; // `CL_SCAN_GENERAL_*`
+	uint32_t parse; // `CL_SCAN_PARSE_*`
+	uint32_t heuristic; // `CL_SCAN_HEURISTIC_*`
+	uint32_t mail; // `CL_SCAN_MAIL_*`
+	uint32_t db_options; // `CL_DB_*` passed to `cl_load()`, another value needs another engine
+
+	uint64_t max_file_size; // `CL_ENGINE_MAX_FILESIZE`
+	uint64_t max_scan_size; // `CL_ENGINE_MAX_SCANSIZE`
+	uint32_t max_recursion; // `CL_ENGINE_MAX_RECURSION`
+	uint32_t max_files; // `CL_ENGINE_MAX_FILES`
+} ScanProfile;
+
+/* Initialize a ScanProfile */
+/*
+  * @return
+  * `false` if the name is unknown or the extra options have unknown bits
+*/
+bool scan_profile_init(ScanProfile *profile, const char *name, uint32_t extra_options);
+
+/* Parse a ScanProfile from "<name>[:<extra options>]" */
+/*
+  * @note
+  * The extra options are the decimal bitmask of `SCAN_OPTIONS_*`
+*/
+bool scan_profile_parse(ScanProfile *profile, const char *spec);
+
+/* Format a ScanProfile as "<name>:<extra options>" */
+/*
+  * @return
+  * `true` if it fits in `size` bytes
+*/
+bool scan_profile_format(const ScanProfile *profile, char *spec, size_t size);
+
+/* Check whether two profiles scan the same way */
+bool scan_profile_is_equal(const ScanProfile *a, const ScanProfile *b);
+
+/* Check whether two profiles share the limits of the engine */
+bool scan_profile_has_same_limits(const ScanProfile *a, const ScanProfile *b);
+
+/* Fill the `cl_scan_options` of a profile */
+/*
+  * @warning
+  * Only available with libclamav
+*/
+void scan_profile_get_scan_options(const ScanProfile *profile, struct cl_scan_options *options);
+
+/* Set the limits of a profile on an engine */
+/*
+  * @note
+  * The limits of a compiled engine can be changed, only the processes forked afterwards see them
+  *
+  * @warning
+  * Only available with libclamav
+*/
+bool scan_profile_apply_limits(const ScanProfile *profile, struct cl_engine *engine);
+
+#endif // PROFILE_H
@@ -0,0 +1,180 @@
+/* reload.c
+ *
+ * Copyright 2025 EricLin
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+*/
+
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <sys/inotify.h>
+#endif
+
+#include "database.h"
+#include "reload.h"
+
+#define INOTIFY_BUFFER_SIZE 4096
+#define WATCH_EVENTS (IN_CLOSE_WRITE | IN_MOVED_TO | IN_DELETE) // freshclam writes a temporary file and renames it
+
+/* Initialize the EngineReloader */
+bool engine_reloader_init(EngineReloader *reloader) {
+    if (reloader == NULL) return false;
+
+    reloader->inotify_fd = -1;
+    reloader->done_pipe[0] = reloader->done_pipe[1] = -1;
+    reloader->is_compiling = false;
+    reloader->compiled_engine = NULL;
+    reloader->has_deadline = false;
+
+#ifdef __linux__
+    if (pipe(reloader->done_pipe) == -1) {
+        fprintf(stderr, "[ERROR] engine_reloader_init: Failed to create the pipe: %s\n", strerror(errno));
+        return false;
+    }
+    fcntl(reloader->done_pipe[0], F_SETFD, FD_CLOEXEC);
+    fcntl(reloader->done_pipe[1], F_SETFD, FD_CLOEXEC);
+
+    reloader->inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (reloader->inotify_fd == -1 || inotify_add_watch(reloader->inotify_fd, cl_retdbdir(), WATCH_EVENTS) == -1) {
+        fprintf(stderr, "[ERROR] engine_reloader_init: Failed to watch %s: %s\n", cl_retdbdir(), strerror(errno));
+        engine_reloader_clear(reloader);
+        return false;
+    }
+
+    return true;
+#else
+    return false; // No inotify, restart the daemon to use the new signatures
+#endif
+}
+
+/* Clear the EngineReloader, wait for the compilation in progress */
+void engine_reloader_clear(EngineReloader *reloader) {
+    if (reloader == NULL) return;
+
+    if (reloader->is_compiling) {
+        struct cl_engine *engine = engine_reloader_collect(reloader);
+        if (engine != NULL) cl_engine_free(engine); // The engine is no longer needed
+    }
+
+    if (reloader->inotify_fd != -1) close(reloader->inotify_fd);
+    reloader->inotify_fd = -1;
+
+    for (int i = 0; i < 2; i++) {
+        if (reloader->done_pipe[i] != -1) close(reloader->done_pipe[i]);
+        reloader->done_pipe[i] = -1;
+    }
+    reloader->has_deadline = false;
+}
+
+/* Get the time left before the next compilation should start */
+bool engine_reloader_get_timeout(EngineReloader *reloader, struct timespec *timeout) {
+    if (reloader == NULL || timeout == NULL || !reloader->has_deadline || reloader->is_compiling) return false; // Recheck the schedule after the compilation in progress
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    timeout->tv_sec = reloader->deadline.tv_sec - now.tv_sec;
+    timeout->tv_nsec = reloader->deadline.tv_nsec - now.tv_nsec;
+    if (timeout->tv_nsec < 0) {
+        timeout->tv_sec--;
+        timeout->tv_nsec += 1000000000L;
+    }
+    if (timeout->tv_sec < 0) timeout->tv_sec = timeout->tv_nsec = 0; // Already reached
+
+    return true;
+}
+
+/* Read the changes from `inotify_fd` and schedule a compilation if a database file is changed */
+void engine_reloader_handle_events(EngineReloader *reloader) {
+#ifdef __linux__
+    if (reloader == NULL || reloader->inotify_fd == -1) return;
+
+    static _Alignas(struct inotify_event) char buffer[INOTIFY_BUFFER_SIZE];
+    bool is_changed = false;
+
+    while (true) {
+        ssize_t bytes = read(reloader->inotify_fd, buffer, sizeof(buffer));
+        if (bytes == -1 && errno == EINTR) continue;
+        if (bytes <= 0) break; // Drained (`EAGAIN`)
+
+        for (ssize_t offset = 0; offset < bytes;) {
+            struct inotify_event *event = (struct inotify_event *)(buffer + offset);
+            offset += sizeof(struct inotify_event) + event->len;
+            if (event->len > 0 && is_database_file(event->name)) is_changed = true;
+        }
+    }
+
+    if (!is_changed) return;
+
+    /* Push back the schedule, so a burst of changes only causes a single compilation */
+    clock_gettime(CLOCK_MONOTONIC, &reloader->deadline);
+    reloader->deadline.tv_sec += RELOAD_DELAY_SEC;
+    reloader->has_deadline = true;
+#else
+    (void)reloader;
+#endif
+}
+
+/* The thread compiling the new engine */
+static void *compile_engine_thread(void *args) {
+    EngineReloader *reloader = (EngineReloader *)args;
+
+    cl_engine_load(&reloader->compiled_engine, &reloader->profile);
+
+    while (write(reloader->done_pipe[1], "d", 1) == -1 && errno == EINTR); // Wake up the daemon
+    return NULL;
+}
+
+/* Start the compilation if the schedule is reached */
+void engine_reloader_tick(EngineReloader *reloader, const ScanProfile *profile) {
+    if (reloader == NULL || profile == NULL || !reloader->has_deadline || reloader->is_compiling) return;
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    if (now.tv_sec < reloader->deadline.tv_sec ||
+        (now.tv_sec == reloader->deadline.tv_sec && now.tv_nsec < reloader->deadline.tv_nsec)) return; // Not yet
+
+    reloader->has_deadline = false;
+    reloader->compiled_engine = NULL;
+    reloader->profile = *profile; // Only read by the thread until it's collected
+
+    fprintf(stderr, "[INFO] Signatures updated, compiling a new engine in the background\n");
+    int result = pthread_create(&reloader->thread, NULL, compile_engine_thread, reloader);
+    if (result != 0) {
+        fprintf(stderr, "[ERROR] engine_reloader_tick: Failed to create the thread: %s\n", strerror(result));
+        return;
+    }
+    reloader->is_compiling = true;
+}
+
+/* Collect the engine compiled by the thread after `done_pipe` becomes readable */
+struct cl_engine *engine_reloader_collect(EngineReloader *reloader) {
+    if (reloader == NULL || !reloader->is_compiling) return NULL;
+
+    char done;
+    while (read(reloader->done_pipe[0], &done, 1) == -1 && errno == EINTR); // Blocks until the thread is finished
+    pthread_join(reloader->thread, NULL);
+    reloader->is_compiling = false;
+
+    struct cl_engine *engine = reloader->compiled_engine;
+    reloader->compiled_engine = NULL;
+    return engine;
+}
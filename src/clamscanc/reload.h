@@ -0,0 +1,87 @@
+/* reload.h
+ *
+ * Copyright 2025 EricLin
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+*/
+
+#ifndef RELOAD_H
+#define RELOAD_H
+
+#include <stdbool.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "manager.h"
+
+#define RELOAD_DELAY_SEC 3 // Wait until the database directory stays quiet, freshclam replaces several files in a row
+
+/* Engine reloader */
+/*
+  * Watch the database directory and compile a new engine in a background thread after the signatures are updated
+  * `inotify_fd` reports the changes of the database directory, -1 if watching is not available
+  * `done_pipe` is written by the thread when the compilation is finished
+  * `deadline` is the time to start compiling, it's pushed back by every new change
+  * `profile` is the profile of the engine being compiled
+*/
+typedef struct {
+	int inotify_fd;
+	int done_pipe[2];
+
+	pthread_t thread;
+	bool is_compiling;
+	struct cl_engine *compiled_engine; // Only accessed by the thread until `done_pipe` is written
+	ScanProfile profile;
+
+	bool has_deadline;
+	struct timespec deadline;
+} EngineReloader;
+
+/* Initialize the EngineReloader */
+/*
+  * @return
+  * `true` if the database directory is watched, `false` otherwise (the daemon keeps working without hot-reload)
+*/
+bool engine_reloader_init(EngineReloader *reloader);
+
+/* Clear the EngineReloader, wait for the compilation in progress */
+void engine_reloader_clear(EngineReloader *reloader);
+
+/* Get the time left before the next compilation should start */
+/*
+  * @return
+  * `true` if a compilation is scheduled and `timeout` is set, `false` if the caller can wait forever
+*/
+bool engine_reloader_get_timeout(EngineReloader *reloader, struct timespec *timeout);
+
+/* Read the changes from `inotify_fd` and schedule a compilation if a database file is changed */
+void engine_reloader_handle_events(EngineReloader *reloader);
+
+/* Start the compilation if the schedule is reached */
+/*
+  * @param profile
+  * The profile of the engine to be compiled, usually the current one
+*/
+void engine_reloader_tick(EngineReloader *reloader, const ScanProfile *profile);
+
+/* Collect the engine compiled by the thread after `done_pipe` becomes readable */
+/*
+  * @return
+  * The new engine, `NULL` if the compilation failed
+*/
+struct cl_engine *engine_reloader_collect(EngineReloader *reloader);
+
+#endif // RELOAD_H
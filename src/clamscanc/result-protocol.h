@@ -0,0 +1,143 @@
+/* result-protocol.h
+ *
+ * Copyright 2025 EricLin
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+*/
+
+/* The binary result stream written by `clamscanc --binary` */
+/*
+  * This header doesn't depend on libclamav, so the GUI can include it to decode the stream
+  *
+  * The stream starts with `SCAN_RESULT_STREAM_MAGIC` (8 bytes), then a ScanResultFrame per file:
+  * [ScanResultFrame][path (path_length bytes)][virname (virname_length bytes)]
+  * The strings are NOT terminated by '\0', so a path may contain any byte except '\0' (including ':' and newlines)
+  * All the fields are in the host byte order, the stream never leaves the machine
+  *
+  * With `INFECTED_ONLY_OPTION` the clean files have no frame, `PROGRESS_OPTION` adds a progress frame every few milliseconds instead:
+  * [ScanResultFrame][files scanned (uint64_t)], `status` is `SCAN_RESULT_PROGRESS` and `bytes_scanned` is the total so far
+  * The counts are cumulative, so a reader only keeps the latest one
+*/
+
+#ifndef RESULT_PROTOCOL_H
+#define RESULT_PROTOCOL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#define SCAN_RESULT_STREAM_MAGIC "WMRS\x00\x00\x00\x01" // "WMRS" followed by the version
+#define SCAN_RESULT_STREAM_MAGIC_SIZE 8
+#define SCAN_RESULT_MAX_VIRNAME 1024 // Longer virnames are truncated
+
+#define INFECTED_ONLY_OPTION "--infected" // Only output the infected files and the errors, same as `clamscan --infected`
+#define PROGRESS_OPTION "--progress=" // Output the cumulative counts every N milliseconds, needs `--binary` or `--json`
+
+/* Scan result status */
+typedef enum {
+	SCAN_RESULT_CLEAN = 0,
+	SCAN_RESULT_INFECTED = 1, // `virname` is the signature name
+	SCAN_RESULT_ERROR = 2, // `virname` is the error message
+	SCAN_RESULT_PROGRESS = 3 // No strings, `files_scanned` and `bytes_scanned` are the totals of the scan so far
+} ScanResultStatus;
+
+/* Scan result frame header */
+/*
+  * `frame_length` is the length of the whole frame, including this header and the strings
+  * `bytes_scanned` includes the data extracted from the archives
+  * `scan_time_ns` is the wall time spent in libclamav, 0 if the verdict came from the cache
+*/
+typedef struct {
+	uint32_t frame_length;
+	uint8_t status; // ScanResultStatus
+	uint8_t reserved;
+	uint16_t virname_length;
+	uint32_t path_length;
+	uint32_t reserved2;
+	uint64_t bytes_scanned;
+	uint64_t scan_time_ns;
+} ScanResultFrame;
+
+_Static_assert(sizeof(ScanResultFrame) == 32, "ScanResultFrame must be 32 bytes");
+
+/* Decoded scan result, the strings point into the buffer passed to `scan_result_parse()` */
+typedef struct {
+	ScanResultStatus status;
+	const char *path;
+	size_t path_length;
+	const char *virname; // NULL if `virname_length` is 0
+	size_t virname_length;
+	uint64_t bytes_scanned;
+	uint64_t scan_time_ns;
+	uint64_t files_scanned; // Only set for `SCAN_RESULT_PROGRESS`
+} ScanResult;
+
+/* Check whether the buffer starts with the stream magic */
+/*
+  * @return
+  * `true` if the stream is valid, call it once with the first `SCAN_RESULT_STREAM_MAGIC_SIZE` bytes
+*/
+static inline bool scan_result_check_magic(const void *buffer, size_t length) {
+	return length >= SCAN_RESULT_STREAM_MAGIC_SIZE && memcmp(buffer, SCAN_RESULT_STREAM_MAGIC, SCAN_RESULT_STREAM_MAGIC_SIZE) == 0;
+}
+
+/* Decode a frame from the buffer */
+/*
+  * @param consumed
+  * The length of the decoded frame [OUT], drop it from the buffer before decoding the next one
+  *
+  * @return
+  * 1 if a frame is decoded, 0 if more bytes are needed, -1 if the stream is corrupted
+*/
+static inline int scan_result_parse(const void *buffer, size_t length, ScanResult *result, size_t *consumed) {
+	if (length < sizeof(ScanResultFrame)) return 0;
+
+	ScanResultFrame frame;
+	memcpy(&frame, buffer, sizeof(frame)); // The buffer may not be aligned
+
+	if (frame.status == SCAN_RESULT_PROGRESS) {
+		if (frame.frame_length != sizeof(frame) + sizeof(uint64_t) || frame.path_length != 0 || frame.virname_length != 0) return -1;
+		if (length < frame.frame_length) return 0;
+
+		memset(result, 0, sizeof(*result));
+		result->status = SCAN_RESULT_PROGRESS;
+		memcpy(&result->files_scanned, (const char *)buffer + sizeof(frame), sizeof(uint64_t));
+		result->bytes_scanned = frame.bytes_scanned;
+
+		*consumed = frame.frame_length;
+		return 1;
+	}
+
+	if (frame.frame_length != sizeof(frame) + (uint64_t)frame.path_length + frame.virname_length ||
+		frame.status > SCAN_RESULT_ERROR || frame.path_length == 0) return -1;
+	if (length < frame.frame_length) return 0;
+
+	const char *strings = (const char *)buffer + sizeof(frame);
+	result->status = (ScanResultStatus)frame.status;
+	result->path = strings;
+	result->path_length = frame.path_length;
+	result->virname = frame.virname_length > 0 ? strings + frame.path_length : NULL;
+	result->virname_length = frame.virname_length;
+	result->bytes_scanned = frame.bytes_scanned;
+	result->scan_time_ns = frame.scan_time_ns;
+	result->files_scanned = 0;
+
+	*consumed = frame.frame_length;
+	return 1;
+}
+
+#endif // RESULT_PROTOCOL_H
@@ -0,0 +1,58 @@
+/* roots.c
+ *
+ * Copyright 2025 EricLin
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+*/
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "roots.h"
+
+/* Check whether `path` is `root` or lies inside it */
+bool is_path_under_root(const char *path, const char *root) {
+    if (path == NULL || root == NULL) return false;
+
+    size_t length = strlen(root);
+    if (strncmp(path, root, length) != 0) return false;
+
+    /* `/a` covers `/a/b` but not `/ab`, `/` covers everything */
+    return path[length] == '\0' || path[length] == '/' || (length > 0 && root[length - 1] == '/');
+}
+
+static int compare_roots(const void *a, const void *b) {
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+/* Sort the roots and drop the duplicated and nested ones */
+size_t scan_roots_normalize(char **roots, size_t num_roots) {
+    if (roots == NULL || num_roots == 0) return 0;
+
+    qsort(roots, num_roots, sizeof(char *), compare_roots); // A parent sorts before its children, the unrelated `/a-b` may come in between
+
+    size_t num_kept = 0;
+    for (size_t i = 0; i < num_roots; i++) {
+        bool is_covered = false;
+        for (size_t j = 0; j < num_kept && !is_covered; j++) is_covered = is_path_under_root(roots[i], roots[j]);
+        if (is_covered) continue;
+
+        char *kept = roots[i]; // Swap, so the dropped root stays in the array
+        roots[i] = roots[num_kept];
+        roots[num_kept++] = kept;
+    }
+    return num_kept;
+}
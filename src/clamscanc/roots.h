@@ -0,0 +1,54 @@
+/* roots.h
+ *
+ * Copyright 2025 EricLin
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+*/
+
+/* Roots of a scan session */
+/*
+  * A scan may cover several roots with one engine and one pool of processes
+  * The roots are real paths, a root equal to or inside another one is dropped, so no subtree is traversed twice
+  * Shared with the GUI, which does the same for the files it hands to the ClamAV daemon
+*/
+
+#ifndef ROOTS_H
+#define ROOTS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/* Check whether `path` is `root` or lies inside it */
+/*
+  * @note
+  * Both are real paths without a trailing slash, except the root directory itself
+*/
+bool is_path_under_root(const char *path, const char *root);
+
+/* Sort the roots and drop the duplicated and nested ones */
+/*
+  * @param roots
+  * The real paths, reordered in place
+  *
+  * @return
+  * Number of the kept roots, they come first
+  *
+  * @note
+  * The dropped roots are moved behind the kept ones, so the caller still frees all of them
+*/
+size_t scan_roots_normalize(char **roots, size_t num_roots);
+
+#endif // ROOTS_H
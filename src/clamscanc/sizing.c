@@ -0,0 +1,186 @@
+/* sizing.c
+ *
+ * Copyright 2025 EricLin
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+*/
+
+#define _GNU_SOURCE // For `sched_getaffinity()` and `CPU_COUNT()`
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "sizing.h"
+
+#define CGROUP_ROOT "/sys/fs/cgroup"
+#define CGROUP_PATH_SIZE 4096
+
+/* Get the number of CPUs in the affinity mask */
+static size_t get_affinity_cpus(void) {
+#ifdef __linux__
+    cpu_set_t set;
+    if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+        int count = CPU_COUNT(&set);
+        if (count > 0) return (size_t)count;
+    }
+#endif
+    long online = sysconf(_SC_NPROCESSORS_ONLN);
+    return online > 0 ? (size_t)online : 1;
+}
+
+/* Read the quota of a cgroup, rounded up to whole CPUs */
+/*
+  * @return
+  * 0 if there is no quota (`max`) or `cpu.max` can't be read
+*/
+static size_t read_cpu_max(const char *cgroup_dir) {
+    char path[CGROUP_PATH_SIZE];
+    if (snprintf(path, sizeof(path), "%s/cpu.max", cgroup_dir) >= (int)sizeof(path)) return 0;
+
+    FILE *file = fopen(path, "re");
+    if (file == NULL) return 0;
+
+    char quota[32];
+    unsigned long long period = 0;
+    int fields = fscanf(file, "%31s %llu", quota, &period);
+    fclose(file);
+
+    if (fields != 2 || period == 0 || strcmp(quota, "max") == 0) return 0;
+
+    unsigned long long quota_us = strtoull(quota, NULL, 10);
+    if (quota_us == 0) return 0;
+
+    return (size_t)((quota_us + period - 1) / period);
+}
+
+/* Get the smallest quota of the cgroup v2 of the process and its ancestors */
+/*
+  * @return
+  * 0 if there is no quota
+*/
+static size_t get_cgroup_cpus(void) {
+    FILE *file = fopen("/proc/self/cgroup", "re");
+    if (file == NULL) return 0;
+
+    char line[CGROUP_PATH_SIZE];
+    char cgroup[CGROUP_PATH_SIZE] = "";
+    while (fgets(line, sizeof(line), file) != NULL) {
+        if (strncmp(line, "0::", 3) != 0) continue; // Only the unified hierarchy
+
+        line[strcspn(line, "\n")] = '\0';
+        if (snprintf(cgroup, sizeof(cgroup), "%s%s", CGROUP_ROOT, line + 3) >= (int)sizeof(cgroup)) cgroup[0] = '\0';
+        break;
+    }
+    fclose(file);
+    if (cgroup[0] == '\0') return 0;
+
+    /* A parent's quota limits the children too, walk up to the root (the root of a cgroup namespace may have one) */
+    size_t cpus = 0;
+    size_t root_length = strlen(CGROUP_ROOT);
+    while (true) {
+        size_t quota = read_cpu_max(cgroup);
+        if (quota > 0 && (cpus == 0 || quota < cpus)) cpus = quota;
+
+        size_t length = strlen(cgroup);
+        if (length <= root_length) break;
+
+        char *slash = strrchr(cgroup, '/');
+        if (slash == NULL || (size_t)(slash - cgroup) < root_length) break;
+        *slash = '\0';
+    }
+
+    return cpus;
+}
+
+/* Get the number of CPUs the process is allowed to use */
+size_t get_cpu_budget(void) {
+    size_t cpus = get_affinity_cpus();
+    size_t quota = get_cgroup_cpus();
+
+    if (quota > 0 && quota < cpus) cpus = quota;
+    return cpus > 0 ? cpus : 1;
+}
+
+/* Read the total and the I/O wait time from `/proc/stat` */
+static bool read_cpu_times(uint64_t *total, uint64_t *iowait) {
+    FILE *file = fopen("/proc/stat", "re");
+    if (file == NULL) return false;
+
+    unsigned long long times[8] = {0}; // user nice system idle iowait irq softirq steal
+    int fields = fscanf(file, "cpu %llu %llu %llu %llu %llu %llu %llu %llu",
+                        &times[0], &times[1], &times[2], &times[3], &times[4], &times[5], &times[6], &times[7]);
+    fclose(file);
+    if (fields < 5) return false;
+
+    *total = 0;
+    for (int i = 0; i < fields; i++) *total += times[i];
+    *iowait = times[4];
+    return true;
+}
+
+/* Start sampling the I/O wait */
+void iowait_sampler_init(IowaitSampler *sampler) {
+    if (sampler == NULL) return;
+
+    if (!read_cpu_times(&sampler->total, &sampler->iowait)) {
+        sampler->total = 0;
+        sampler->iowait = 0;
+    }
+}
+
+/* Get the share of the CPU time spent waiting for I/O since the last call */
+double iowait_sampler_sample(IowaitSampler *sampler) {
+    if (sampler == NULL) return 0;
+
+    uint64_t total, iowait;
+    if (!read_cpu_times(&total, &iowait)) return 0;
+
+    bool is_valid = total > sampler->total && iowait >= sampler->iowait; // The I/O wait may go backwards on some kernels
+    uint64_t total_delta = total - sampler->total;
+    uint64_t iowait_delta = iowait - sampler->iowait;
+    sampler->total = total;
+    sampler->iowait = iowait;
+
+    if (!is_valid || iowait_delta > total_delta) return 0;
+    return (double)iowait_delta / (double)total_delta;
+}
+
+/* Calculate how many workers should be active */
+/*
+  * @note
+  * Traversal-bound: leave a CPU for each producer, the files arrive slower than they are scanned
+  * Scan-bound (many batches waiting) or no directory left: all the CPUs scan
+  * Waiting for I/O: oversubscribe, the blocked workers don't use their CPUs
+*/
+size_t calculate_worker_limit(const PoolPressure *pressure) {
+    if (pressure == NULL || pressure->num_workers == 0) return 1;
+
+    size_t limit = pressure->cpu_budget;
+    size_t waiting_batches = pressure->file_tasks / (pressure->batch_size > 0 ? pressure->batch_size : 1);
+    bool is_scan_bound = pressure->is_producer_done || pressure->dir_tasks == 0 ||
+                         waiting_batches >= pressure->cpu_budget * AUTO_SIZING_QUEUE_FACTOR;
+
+    if (!is_scan_bound) limit = pressure->cpu_budget > pressure->num_producers ? pressure->cpu_budget - pressure->num_producers : 1;
+
+    if (pressure->iowait > AUTO_SIZING_IOWAIT_THRESHOLD) {
+        limit += (size_t)(limit * pressure->iowait * 2) + 1; // The more waiting, the more workers
+    }
+
+    if (limit > pressure->num_workers) limit = pressure->num_workers;
+    return limit > 0 ? limit : 1;
+}
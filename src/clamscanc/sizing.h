@@ -0,0 +1,82 @@
+/* sizing.h
+ *
+ * Copyright 2025 EricLin
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+*/
+
+/* Automatic sizing of the process pools */
+/*
+  * The CPU budget is the number of CPUs the process may run on, limited by the cgroup v2 quota (`cpu.max`)
+  * More workers than the budget are spawned, the ones above `worker_limit` stay parked
+  * The limit is raised while the scan is scan-bound or waiting for I/O, and lowered while the traversal needs the CPUs
+*/
+
+#ifndef SIZING_H
+#define SIZING_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define AUTO_SIZING_ARGUMENT "auto" // `num_of_processes` for the automatic sizing
+#define AUTO_SIZING_INTERVAL_MS 100 // How often the worker limit is recalculated
+#define AUTO_SIZING_IOWAIT_THRESHOLD 0.2 // Above this share of the CPU time waiting for I/O, the workers get oversubscribed
+#define AUTO_SIZING_QUEUE_FACTOR 4 // The scan is scan-bound if at least this many batches are waiting per active worker
+
+/* The pressure on the pools, sampled by the parent process */
+typedef struct {
+    size_t cpu_budget;
+    size_t num_producers;
+    size_t num_workers; // Spawned workers, the upper bound of the limit
+    size_t batch_size; // Tasks taken by a worker at once
+    bool is_producer_done; // No directory is left, all CPUs can scan
+    size_t dir_tasks;
+    size_t file_tasks;
+    double iowait; // Share of the CPU time waiting for I/O since the last sample
+} PoolPressure;
+
+/* Sampler of the system wide I/O wait */
+typedef struct {
+    uint64_t total;
+    uint64_t iowait;
+} IowaitSampler;
+
+/* Get the number of CPUs the process is allowed to use */
+/*
+  * @return
+  * min(CPUs in the affinity mask, cgroup v2 `cpu.max` quota rounded up), at least 1
+*/
+size_t get_cpu_budget(void);
+
+/* Start sampling the I/O wait */
+void iowait_sampler_init(IowaitSampler *sampler);
+
+/* Get the share of the CPU time spent waiting for I/O since the last call */
+/*
+  * @return
+  * A value in [0, 1], 0 if `/proc/stat` can't be read
+*/
+double iowait_sampler_sample(IowaitSampler *sampler);
+
+/* Calculate how many workers should be active */
+/*
+  * @return
+  * A value in [1, `num_workers`]
+*/
+size_t calculate_worker_limit(const PoolPressure *pressure);
+
+#endif // SIZING_H
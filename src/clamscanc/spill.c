@@ -0,0 +1,195 @@
+/* spill.c
+ *
+ * Copyright 2025 EricLin
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+*/
+
+#define _GNU_SOURCE // For `O_TMPFILE`
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "spill.h"
+
+#define SPILL_LENGTH_SIZE sizeof(uint16_t)
+#define SPILL_CHUNK_SIZE sizeof(uint32_t)
+
+_Static_assert(SPILL_BUFFER_SIZE <= UINT32_MAX, "SPILL_BUFFER_SIZE is too large for the chunk size");
+
+/* Open an unlinked temporary file, it's removed by the kernel when the process exits */
+static int open_spill_file(void) {
+    const char *dir = getenv("TMPDIR");
+    if (dir == NULL || dir[0] == '\0') dir = "/tmp";
+
+    int fd;
+#ifdef O_TMPFILE
+    fd = open(dir, O_TMPFILE | O_RDWR | O_CLOEXEC, 0600);
+    if (fd != -1) return fd;
+#endif
+
+    /* The file system doesn't support `O_TMPFILE`, create and unlink it */
+    char path[4096];
+    if (snprintf(path, sizeof(path), "%s/clamscanc-spill-XXXXXX", dir) >= (int)sizeof(path)) return -1;
+
+    fd = mkstemp(path);
+    if (fd == -1) return -1;
+    unlink(path);
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+    return fd;
+}
+
+/* Write the whole buffer at `offset`, retry if interrupted by a signal */
+static bool pwrite_all(int fd, const void *buffer, size_t size, off_t offset) {
+    const char *data = buffer;
+    while (size > 0) {
+        ssize_t written = pwrite(fd, data, size, offset);
+        if (written == -1) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        data += written;
+        offset += written;
+        size -= (size_t)written;
+    }
+    return true;
+}
+
+/* Read the whole buffer at `offset`, retry if interrupted by a signal */
+static bool pread_all(int fd, void *buffer, size_t size, off_t offset) {
+    char *data = buffer;
+    while (size > 0) {
+        ssize_t bytes = pread(fd, data, size, offset);
+        if (bytes == -1) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        if (bytes == 0) return false; // Truncated
+        data += bytes;
+        offset += bytes;
+        size -= (size_t)bytes;
+    }
+    return true;
+}
+
+/* Move the buffer to the end of the temporary file as a chunk */
+static bool spill_stack_flush(SpillStack *stack) {
+    if (stack->fd == -1) {
+        stack->fd = open_spill_file();
+        if (stack->fd == -1) {
+            fprintf(stderr, "[ERROR] spill_stack_flush: Failed to create the spill file: %s\n", strerror(errno));
+            return false;
+        }
+    }
+
+    uint32_t chunk_size = (uint32_t)stack->used;
+    if (!pwrite_all(stack->fd, stack->buffer, stack->used, stack->file_size) ||
+        !pwrite_all(stack->fd, &chunk_size, SPILL_CHUNK_SIZE, stack->file_size + (off_t)stack->used)) {
+        fprintf(stderr, "[ERROR] spill_stack_flush: Failed to write the spill file: %s\n", strerror(errno));
+        return false;
+    }
+
+    stack->file_size += (off_t)(stack->used + SPILL_CHUNK_SIZE);
+    stack->used = 0;
+    return true;
+}
+
+/* Move the last chunk of the temporary file back to the buffer */
+static bool spill_stack_load(SpillStack *stack) {
+    uint32_t chunk_size;
+    if (stack->file_size < (off_t)SPILL_CHUNK_SIZE ||
+        !pread_all(stack->fd, &chunk_size, SPILL_CHUNK_SIZE, stack->file_size - (off_t)SPILL_CHUNK_SIZE) ||
+        chunk_size == 0 || chunk_size > SPILL_BUFFER_SIZE || (off_t)(chunk_size + SPILL_CHUNK_SIZE) > stack->file_size) {
+        fprintf(stderr, "[ERROR] spill_stack_load: The spill file is corrupted\n");
+        return false;
+    }
+
+    off_t offset = stack->file_size - (off_t)(chunk_size + SPILL_CHUNK_SIZE);
+    if (!pread_all(stack->fd, stack->buffer, chunk_size, offset)) {
+        fprintf(stderr, "[ERROR] spill_stack_load: Failed to read the spill file: %s\n", strerror(errno));
+        return false;
+    }
+
+    stack->used = chunk_size;
+    stack->file_size = offset;
+    if (ftruncate(stack->fd, offset) != 0) { // Only the disk space isn't given back, the chunk is read anyway
+        fprintf(stderr, "[WARNING] spill_stack_load: Failed to truncate the spill file: %s\n", strerror(errno));
+    }
+    return true;
+}
+
+/* Push a path to the SpillStack */
+bool spill_stack_push(SpillStack *stack, const char *path) {
+    if (stack == NULL || path == NULL) return false; // Invalid arguments
+
+    size_t length = strlen(path) + 1; // Including the null terminator
+    size_t record_size = length + SPILL_LENGTH_SIZE;
+    if (length > UINT16_MAX || record_size > SPILL_BUFFER_SIZE) return false;
+
+    if (stack->buffer == NULL) {
+        stack->buffer = malloc(SPILL_BUFFER_SIZE);
+        if (stack->buffer == NULL) {
+            fprintf(stderr, "[ERROR] spill_stack_push: Failed to allocate the spill buffer\n");
+            return false;
+        }
+    }
+
+    if (stack->used + record_size > SPILL_BUFFER_SIZE && !spill_stack_flush(stack)) return false; // Make room for the path
+
+    uint16_t record_length = (uint16_t)length;
+    memcpy(stack->buffer + stack->used, path, length);
+    memcpy(stack->buffer + stack->used + length, &record_length, SPILL_LENGTH_SIZE);
+    stack->used += record_size;
+    stack->count++;
+    return true;
+}
+
+/* Get the newest path without removing it */
+const char *spill_stack_top(SpillStack *stack) {
+    if (is_spill_stack_empty(stack)) return NULL;
+
+    if (stack->used == 0 && !spill_stack_load(stack)) return NULL; // The newest paths are on disk
+
+    uint16_t length;
+    memcpy(&length, stack->buffer + stack->used - SPILL_LENGTH_SIZE, SPILL_LENGTH_SIZE);
+    return stack->buffer + stack->used - SPILL_LENGTH_SIZE - length;
+}
+
+/* Remove the path returned by `spill_stack_top()` */
+void spill_stack_drop(SpillStack *stack) {
+    if (is_spill_stack_empty(stack) || stack->used == 0) return; // `spill_stack_top()` wasn't called
+
+    uint16_t length;
+    memcpy(&length, stack->buffer + stack->used - SPILL_LENGTH_SIZE, SPILL_LENGTH_SIZE);
+    stack->used -= length + SPILL_LENGTH_SIZE;
+    stack->count--;
+}
+
+/* Drop all the paths and release the memory and the temporary file */
+size_t spill_stack_clear(SpillStack *stack) {
+    if (stack == NULL) return 0;
+
+    size_t dropped = stack->count;
+    free(stack->buffer);
+    if (stack->fd != -1) close(stack->fd);
+
+    *stack = (SpillStack)SPILL_STACK_INITIALIZER;
+    return dropped;
+}
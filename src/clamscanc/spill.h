@@ -0,0 +1,76 @@
+/* spill.h
+ *
+ * Copyright 2025 EricLin
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+*/
+
+/* Spill stack */
+/*
+  * A process private LIFO of paths, used when a producer's deque and the shared TaskQueue of the directory tasks are both full
+  * The producers are the only consumers of the directory tasks, so blocking on a full queue could stall all of them at once
+  * The newest paths stay in `buffer`, the older ones are written to an unlinked temporary file in chunks of at most `SPILL_BUFFER_SIZE`
+  * Each path in `buffer` is followed by its length (`uint16_t`), each chunk in the file by its size (`uint32_t`), so both are read backwards
+*/
+
+#ifndef SPILL_H
+#define SPILL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+#define SPILL_BUFFER_SIZE ((size_t)1 << 20) // The in-memory part of each spill stack
+#define SPILL_STACK_INITIALIZER { .buffer = NULL, .used = 0, .fd = -1, .file_size = 0, .count = 0 }
+
+typedef struct {
+    char *buffer; // Allocated on the first push
+    size_t used;
+    int fd; // Opened on the first flush, -1 if not opened yet
+    off_t file_size;
+    size_t count; // Paths in the stack, in memory and on disk
+} SpillStack;
+
+/* Push a path to the SpillStack */
+/*
+  * @return
+  * `true` if the path is pushed, `false` if the buffer can't be allocated or the temporary file can't be written
+*/
+bool spill_stack_push(SpillStack *stack, const char *path);
+
+/* Get the newest path without removing it */
+/*
+  * @return
+  * The path, valid until the next call on the stack, NULL if the stack is empty or the temporary file can't be read
+*/
+const char *spill_stack_top(SpillStack *stack);
+
+/* Remove the path returned by `spill_stack_top()` */
+void spill_stack_drop(SpillStack *stack);
+
+/* Check whether the SpillStack is empty */
+static inline bool is_spill_stack_empty(const SpillStack *stack) {
+    return stack == NULL || stack->count == 0;
+}
+
+/* Drop all the paths and release the memory and the temporary file */
+/*
+  * @return
+  * Number of the paths dropped
+*/
+size_t spill_stack_clear(SpillStack *stack);
+
+#endif // SPILL_H
@@ -0,0 +1,194 @@
+/* stats.c
+ *
+ * Copyright 2025 EricLin
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+*/
+
+#include <time.h>
+
+#include "stats.h"
+
+static ProcessStats *local_stats = NULL; // The slot of the calling process, each process has its own copy after forking
+
+static const char *counter_names[STAT_NUM_COUNTERS] = {
+    "dirs_traversed",
+    "files_enqueued",
+    "files_scanned",
+    "files_cached",
+    "threats_found",
+    "bytes_scanned",
+    "errors",
+    "queue_blocked_ns",
+    "dirs_spilled",
+    "dirs_skipped",
+    "hardlinks_skipped",
+    "excluded",
+    "content_hits",
+    "content_misses",
+    "timeouts",
+    "workers_respawned",
+    "resumed",
+    "files_prioritized",
+    "remote_steals",
+    "leases_expired",
+    "scan_time_ns",
+};
+
+/* Increase a counter owned by the calling process */
+static inline void slot_add(_Atomic uint64_t *counter, uint64_t value) {
+    atomic_store_explicit(counter, atomic_load_explicit(counter, memory_order_relaxed) + value, memory_order_relaxed);
+}
+
+/* Let the calling process count into `slot` */
+void scan_stats_attach(ScanStats *stats, size_t slot) {
+    local_stats = (stats != NULL && slot < STATS_MAX_SLOTS) ? &stats->slots[slot] : NULL;
+}
+
+/* Add to a counter of the calling process */
+void stats_add(StatCounter counter, uint64_t value) {
+    if (local_stats == NULL || counter >= STAT_NUM_COUNTERS) return;
+
+    slot_add(&local_stats->counters[counter], value);
+}
+
+/* Count a `cl_scandesc()` call */
+void stats_record_scan(uint64_t scan_time_ns) {
+    if (local_stats == NULL) return;
+
+    size_t bucket = scan_time_ns == 0 ? 0 : (size_t)(64 - __builtin_clzll(scan_time_ns)); // The bit length of the latency
+    if (bucket >= STATS_LATENCY_BUCKETS) bucket = STATS_LATENCY_BUCKETS - 1;
+
+    slot_add(&local_stats->latency[bucket], 1);
+    slot_add(&local_stats->counters[STAT_SCAN_TIME_NS], scan_time_ns);
+}
+
+/* Count a threat, the first one of the process is timed */
+void stats_record_threat(void) {
+    if (local_stats == NULL) return;
+
+    slot_add(&local_stats->counters[STAT_THREATS_FOUND], 1);
+    if (atomic_load_explicit(&local_stats->first_threat_ns, memory_order_relaxed) == 0) {
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        atomic_store_explicit(&local_stats->first_threat_ns, (uint64_t)now.tv_sec * 1000000000ULL + (uint64_t)now.tv_nsec, memory_order_relaxed);
+    }
+}
+
+/* Sum the slots into the snapshot */
+void scan_stats_collect(ScanStats *stats, StatsSnapshot *snapshot) {
+    if (stats == NULL || snapshot == NULL) return;
+
+    for (size_t i = 0; i < STAT_NUM_COUNTERS; i++) snapshot->counters[i] = 0;
+    for (size_t i = 0; i < STATS_LATENCY_BUCKETS; i++) snapshot->latency[i] = 0;
+    snapshot->first_threat_ns = 0;
+
+    for (size_t slot = 0; slot < STATS_MAX_SLOTS; slot++) {
+        for (size_t i = 0; i < STAT_NUM_COUNTERS; i++) {
+            snapshot->counters[i] += atomic_load_explicit(&stats->slots[slot].counters[i], memory_order_relaxed);
+        }
+        for (size_t i = 0; i < STATS_LATENCY_BUCKETS; i++) {
+            snapshot->latency[i] += atomic_load_explicit(&stats->slots[slot].latency[i], memory_order_relaxed);
+        }
+
+        uint64_t first_threat_ns = atomic_load_explicit(&stats->slots[slot].first_threat_ns, memory_order_relaxed);
+        if (first_threat_ns != 0 && (snapshot->first_threat_ns == 0 || first_threat_ns < snapshot->first_threat_ns)) snapshot->first_threat_ns = first_threat_ns;
+    }
+}
+
+/* Print the snapshot as a single JSON line */
+void stats_snapshot_print_json(FILE *stream, const StatsSnapshot *snapshot) {
+    if (stream == NULL || snapshot == NULL) return;
+
+    fprintf(stream, "[STATS] {\"elapsed\":%.3f", snapshot->elapsed);
+    for (size_t i = 0; i < STAT_NUM_COUNTERS; i++) {
+        fprintf(stream, ",\"%s\":%llu", counter_names[i], (unsigned long long)snapshot->counters[i]);
+    }
+    if (snapshot->first_threat >= 0) fprintf(stream, ",\"first_threat\":%.3f", snapshot->first_threat);
+    fprintf(stream, ",\"dir_tasks\":%zu,\"file_tasks\":%zu,\"latency_log2_ns\":[", snapshot->dir_tasks, snapshot->file_tasks);
+
+    /* Trailing empty buckets are dropped */
+    size_t num_buckets = STATS_LATENCY_BUCKETS;
+    while (num_buckets > 0 && snapshot->latency[num_buckets - 1] == 0) num_buckets--;
+    for (size_t i = 0; i < num_buckets; i++) {
+        fprintf(stream, i == 0 ? "%llu" : ",%llu", (unsigned long long)snapshot->latency[i]);
+    }
+    fprintf(stream, "]}\n");
+    fflush(stream);
+}
+
+/* Get the upper bound of the bucket holding the percentile */
+static uint64_t latency_percentile(const StatsSnapshot *snapshot, uint64_t total, unsigned int percent) {
+    uint64_t target = (total * percent + 99) / 100; // Round up, so p99 of 10 scans is the slowest one
+    uint64_t seen = 0;
+
+    for (size_t i = 0; i < STATS_LATENCY_BUCKETS; i++) {
+        seen += snapshot->latency[i];
+        if (seen >= target && seen > 0) return i == 0 ? 0 : ((uint64_t)1 << i);
+    }
+    return 0;
+}
+
+/* Print the human readable summary of the snapshot */
+void stats_snapshot_print_summary(FILE *stream, const StatsSnapshot *snapshot) {
+    if (stream == NULL || snapshot == NULL) return;
+
+    const uint64_t *counters = snapshot->counters;
+    const double elapsed = snapshot->elapsed > 0 ? snapshot->elapsed : 1e-9;
+    const uint64_t num_scans = counters[STAT_FILES_SCANNED] - counters[STAT_FILES_CACHED] - counters[STAT_CONTENT_HITS];
+    const uint64_t num_lookups = counters[STAT_CONTENT_HITS] + counters[STAT_CONTENT_MISSES];
+
+    fprintf(stream, "\n----------- SCAN STATISTICS -----------\n");
+    fprintf(stream, "Elapsed time:        %.3f s\n", snapshot->elapsed);
+    fprintf(stream, "Directories:         %llu (%llu spilled, %llu skipped)\n",
+            (unsigned long long)counters[STAT_DIRS_TRAVERSED], (unsigned long long)counters[STAT_DIRS_SPILLED],
+            (unsigned long long)counters[STAT_DIRS_SKIPPED]);
+    fprintf(stream, "Files enqueued:      %llu (%llu hard links skipped)\n",
+            (unsigned long long)counters[STAT_FILES_ENQUEUED], (unsigned long long)counters[STAT_HARDLINKS_SKIPPED]);
+    fprintf(stream, "Excluded:            %llu\n", (unsigned long long)counters[STAT_EXCLUDED]);
+    if (counters[STAT_FILES_PRIORITIZED] > 0) fprintf(stream, "Prioritized:         %llu\n", (unsigned long long)counters[STAT_FILES_PRIORITIZED]);
+    if (counters[STAT_RESUMED] > 0) fprintf(stream, "Resumed:             %llu (finished before the interruption)\n", (unsigned long long)counters[STAT_RESUMED]);
+    fprintf(stream, "Files scanned:       %llu (%llu from the cache, %.1f files/s)\n",
+            (unsigned long long)counters[STAT_FILES_SCANNED], (unsigned long long)counters[STAT_FILES_CACHED],
+            counters[STAT_FILES_SCANNED] / elapsed);
+    if (num_lookups > 0) {
+        fprintf(stream, "Content cache:       %llu hits, %llu misses (%.1f%% hit rate)\n",
+                (unsigned long long)counters[STAT_CONTENT_HITS], (unsigned long long)counters[STAT_CONTENT_MISSES],
+                counters[STAT_CONTENT_HITS] * 100.0 / num_lookups);
+    }
+    if (snapshot->first_threat >= 0) {
+        fprintf(stream, "Threats found:       %llu (the first after %.3f s)\n", (unsigned long long)counters[STAT_THREATS_FOUND], snapshot->first_threat);
+    }
+    else fprintf(stream, "Threats found:       %llu\n", (unsigned long long)counters[STAT_THREATS_FOUND]);
+    fprintf(stream, "Data scanned:        %.2f MiB (%.2f MiB/s)\n",
+            counters[STAT_BYTES_SCANNED] / 1048576.0, counters[STAT_BYTES_SCANNED] / 1048576.0 / elapsed);
+    fprintf(stream, "Errors:              %llu\n", (unsigned long long)counters[STAT_ERRORS]);
+    if (counters[STAT_TIMEOUTS] > 0 || counters[STAT_WORKERS_RESPAWNED] > 0) {
+        fprintf(stream, "Timed out:           %llu (%llu workers respawned)\n",
+                (unsigned long long)counters[STAT_TIMEOUTS], (unsigned long long)counters[STAT_WORKERS_RESPAWNED]);
+    }
+    fprintf(stream, "Blocked on queue:    %.3f s\n", counters[STAT_QUEUE_BLOCKED_NS] / 1e9);
+    if (counters[STAT_REMOTE_STEALS] > 0) fprintf(stream, "Remote steals:       %llu (from another NUMA node)\n", (unsigned long long)counters[STAT_REMOTE_STEALS]);
+    if (counters[STAT_LEASES_EXPIRED] > 0) fprintf(stream, "Leases expired:      %llu (scanned again by another node)\n", (unsigned long long)counters[STAT_LEASES_EXPIRED]);
+    fprintf(stream, "Time in libclamav:   %.3f s\n", counters[STAT_SCAN_TIME_NS] / 1e9);
+
+    if (num_scans > 0) {
+        fprintf(stream, "Scan latency:        p50 < %.3f ms, p90 < %.3f ms, p99 < %.3f ms\n",
+                latency_percentile(snapshot, num_scans, 50) / 1e6,
+                latency_percentile(snapshot, num_scans, 90) / 1e6,
+                latency_percentile(snapshot, num_scans, 99) / 1e6);
+    }
+}
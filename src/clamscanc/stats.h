@@ -0,0 +1,119 @@
+/* stats.h
+ *
+ * Copyright 2025 EricLin
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+*/
+
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdatomic.h>
+
+#define STATS_MAX_SLOTS 80 // A slot per producer, per worker and one for the parent process
+#define STATS_LATENCY_BUCKETS 40 // log2 buckets of nanoseconds, the last one holds everything longer than ~9 minutes
+#define STATS_SNAPSHOT_INTERVAL_MS 1000 // How often `clamscanc --stats` prints a snapshot
+
+/* Counters */
+typedef enum {
+    STAT_DIRS_TRAVERSED,
+    STAT_FILES_ENQUEUED,
+    STAT_FILES_SCANNED, // Including the verdicts from the cache
+    STAT_FILES_CACHED,
+    STAT_THREATS_FOUND,
+    STAT_BYTES_SCANNED, // The `scanned` of `cl_scandesc()`, including the data extracted from the archives
+    STAT_ERRORS,
+    STAT_QUEUE_BLOCKED_NS, // Time spent waiting for an empty slot in `task_queue_add()`
+    STAT_DIRS_SPILLED, // Directory tasks moved to a spill stack, see `task_pool_enable_spill()`
+    STAT_DIRS_SKIPPED, // Pseudo file systems, other file systems and the directories already traversed, see `traversal-filter.h`
+    STAT_HARDLINKS_SKIPPED, // Files already taken through another hard link
+    STAT_EXCLUDED, // Directories and files matching an exclusion rule or larger than the size limit, see `exclusion.h`
+    STAT_CONTENT_HITS, // Verdicts reused from the content cache, see `content-cache.h`
+    STAT_CONTENT_MISSES, // Digested files without a verdict in the content cache
+    STAT_TIMEOUTS, // Files whose worker was killed for exceeding `--file-timeout=`
+    STAT_WORKERS_RESPAWNED, // Workers replaced after they were killed or crashed
+    STAT_RESUMED, // Files skipped since the resumed checkpoint recorded them, see `checkpoint.h`
+    STAT_FILES_PRIORITIZED, // Files queued in the priority lane, see `priority.h`
+    STAT_REMOTE_STEALS, // Tasks stolen from the deques of another NUMA node, see `placement.h`
+    STAT_LEASES_EXPIRED, // Units of the nodes which stopped answering, see `coordinator.h`
+    STAT_SCAN_TIME_NS, // Time spent in `cl_scandesc()`
+    STAT_NUM_COUNTERS
+} StatCounter;
+
+/* Counters of a process */
+/*
+  * Each slot is only written by its own process, so no atomic read-modify-write is needed
+  * The slots are aligned to the cache line, so the processes never share a line
+*/
+typedef struct {
+    _Alignas(64) _Atomic uint64_t counters[STAT_NUM_COUNTERS];
+    _Atomic uint64_t latency[STATS_LATENCY_BUCKETS]; // `latency[i]` counts the scans taking [2^(i-1), 2^i) ns
+    _Atomic uint64_t first_threat_ns; // `CLOCK_MONOTONIC` of the first threat found by the process, 0 if none
+} ProcessStats;
+
+/* Counters of all the processes, lives in the SharedMemory */
+typedef struct {
+    ProcessStats slots[STATS_MAX_SLOTS];
+} ScanStats;
+
+/* Sum of all the slots */
+/*
+  * `dir_tasks`, `file_tasks`, `elapsed` and `first_threat` are filled by the caller
+*/
+typedef struct {
+    uint64_t counters[STAT_NUM_COUNTERS];
+    uint64_t latency[STATS_LATENCY_BUCKETS];
+    size_t dir_tasks;
+    size_t file_tasks;
+    uint64_t first_threat_ns; // The earliest `first_threat_ns` of the slots, 0 if no threat is found
+    double elapsed; // Seconds since the scan started
+    double first_threat; // Seconds from the start to the first threat, the time to detection, negative if none
+} StatsSnapshot;
+
+/* Let the calling process count into `slot` */
+/*
+  * @warning
+  * Call it once in every process after forking, the counters are dropped before it's called
+*/
+void scan_stats_attach(ScanStats *stats, size_t slot);
+
+/* Add to a counter of the calling process */
+void stats_add(StatCounter counter, uint64_t value);
+
+/* Count a `cl_scandesc()` call */
+void stats_record_scan(uint64_t scan_time_ns);
+
+/* Count a threat, the first one of the process is timed */
+void stats_record_threat(void);
+
+/* Sum the slots into the snapshot */
+void scan_stats_collect(ScanStats *stats, StatsSnapshot *snapshot);
+
+/* Print the snapshot as a single JSON line */
+/*
+  * @note
+  * The line starts with `[STATS] `, so it can be told apart from the other messages on stderr
+*/
+void stats_snapshot_print_json(FILE *stream, const StatsSnapshot *snapshot);
+
+/* Print the human readable summary of the snapshot */
+void stats_snapshot_print_summary(FILE *stream, const StatsSnapshot *snapshot);
+
+#endif // STATS_H
@@ -0,0 +1,171 @@
+/* stream.c
+ *
+ * Copyright 2025 EricLin
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+*/
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "stream.h"
+
+/* Initialize the StreamBuffer, empty */
+void stream_buffer_init(StreamBuffer *buffer) {
+    if (buffer == NULL) return;
+
+    *buffer = (StreamBuffer){0};
+}
+
+/* Clear the StreamBuffer */
+void stream_buffer_clear(StreamBuffer *buffer) {
+    if (buffer == NULL) return;
+
+    if (buffer->data != NULL) munmap(buffer->data, buffer->mapping_size);
+    stream_buffer_init(buffer);
+}
+
+/* Take the space for the next `length` bytes of the stream */
+char *stream_buffer_reserve(StreamBuffer *buffer, size_t length) {
+    if (buffer == NULL || buffer->is_file || length > STREAM_MAX_SIZE - buffer->size) return NULL;
+
+    if (buffer->data == NULL) { // Reserve the address space once, so the data never moves
+        void *data = mmap(NULL, STREAM_MAX_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (data == MAP_FAILED) {
+            fprintf(stderr, "[ERROR] stream_buffer_reserve: Failed to map the stream buffer: %s\n", strerror(errno));
+            return NULL;
+        }
+        buffer->data = data;
+        buffer->mapping_size = STREAM_MAX_SIZE;
+    }
+
+    return buffer->data + buffer->size;
+}
+
+/* Keep the bytes written into the space from `stream_buffer_reserve()` */
+void stream_buffer_commit(StreamBuffer *buffer, size_t length) {
+    if (buffer == NULL || buffer->is_file || length > buffer->mapping_size - buffer->size) return;
+
+    buffer->size += length;
+}
+
+/* Map a regular file, it's never copied */
+static cl_error_t map_file(StreamBuffer *buffer, int fd, const struct stat *status) {
+    if ((uint64_t)status->st_size > STREAM_MAX_SIZE) return CL_EMAXSIZE;
+    if (status->st_size == 0) return CL_SUCCESS; // Nothing to map, an empty stream is still scanned
+
+    void *data = mmap(NULL, (size_t)status->st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED) return CL_EMAP;
+
+    madvise(data, (size_t)status->st_size, MADV_SEQUENTIAL);
+    buffer->data = data;
+    buffer->size = (size_t)status->st_size;
+    buffer->mapping_size = (size_t)status->st_size;
+    buffer->is_file = true;
+    return CL_SUCCESS;
+}
+
+/* Read a whole stream until the end of file */
+cl_error_t stream_buffer_read_fd(StreamBuffer *buffer, int fd) {
+    if (buffer == NULL || fd < 0) return CL_ENULLARG;
+
+    /* Only a regular file read from its start is mapped, an inherited offset means the data starts elsewhere */
+    struct stat status;
+    if (buffer->data == NULL && fstat(fd, &status) == 0 && S_ISREG(status.st_mode) && lseek(fd, 0, SEEK_CUR) == 0) {
+        cl_error_t error = map_file(buffer, fd, &status);
+        if (error != CL_EMAP) return error; // Some file systems can't be mapped, read them below
+    }
+
+    while (true) {
+        size_t length = STREAM_MAX_SIZE - buffer->size < STREAM_READ_SIZE ? STREAM_MAX_SIZE - buffer->size : STREAM_READ_SIZE;
+        if (length == 0) { // The limit is reached, the stream is only accepted if it ends right here
+            char byte;
+            ssize_t bytes;
+            while ((bytes = read(fd, &byte, 1)) == -1 && errno == EINTR);
+            return bytes == 0 ? CL_SUCCESS : (bytes == -1 ? CL_EREAD : CL_EMAXSIZE);
+        }
+
+        char *space = stream_buffer_reserve(buffer, length);
+        if (space == NULL) return CL_EMEM;
+
+        ssize_t bytes = read(fd, space, length);
+        if (bytes == -1 && errno == EINTR) continue;
+        if (bytes == -1) return CL_EREAD;
+        if (bytes == 0) return CL_SUCCESS;
+
+        stream_buffer_commit(buffer, (size_t)bytes);
+    }
+}
+
+/* Scan a memory buffer */
+cl_error_t scan_buffer(const void *data, size_t size, const char *name, ClamavEssentials *essentials,
+                       const char **virname, uint64_t *bytes_scanned, uint64_t *scan_time_ns) {
+    *virname = NULL;
+    *bytes_scanned = 0;
+    *scan_time_ns = 0;
+    if (essentials == NULL || (data == NULL && size > 0)) return CL_ENULLARG;
+
+    static const char empty = 0;
+    cl_fmap_t *map = cl_fmap_open_memory(data != NULL ? data : &empty, size); // libclamav rejects a NULL buffer, even an empty one
+    if (map == NULL) return CL_EMEM;
+
+    if (essentials->throttle != NULL) scan_throttle_wait(essentials->throttle, size);
+
+    unsigned long scanned = 0;
+    struct timespec start, end;
+    uint64_t trace_start = trace_begin(TRACE_SCANDESC);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    process_heartbeat_begin(scan_heartbeat_get()); // A worker stuck on a member is killed like on a file
+    cl_error_t error = cl_scanmap_callback(map, name, virname, &scanned, essentials->engine, &essentials->scan_options, NULL);
+    process_heartbeat_end(scan_heartbeat_get());
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    trace_end(TRACE_SCANDESC, trace_start);
+    cl_fmap_close(map);
+
+    *bytes_scanned = (uint64_t)scanned * CL_COUNT_PRECISION; // `scanned` is counted in `CL_COUNT_PRECISION` blocks
+    *scan_time_ns = (uint64_t)((end.tv_sec - start.tv_sec) * 1000000000LL + (end.tv_nsec - start.tv_nsec));
+    return error;
+}
+
+/* Scan a memory buffer and write its result to `fd` */
+void process_buffer(const void *data, size_t size, cl_error_t error, const char *name, ClamavEssentials *essentials, int fd) {
+    if (name == NULL || essentials == NULL) return;
+
+    const char *virname = NULL;
+    uint64_t bytes_scanned = 0;
+    uint64_t scan_time_ns = 0;
+    if (error == CL_SUCCESS) error = scan_buffer(data, size, name, essentials, &virname, &bytes_scanned, &scan_time_ns);
+
+    stats_add(STAT_FILES_SCANNED, 1);
+    stats_add(STAT_BYTES_SCANNED, bytes_scanned);
+    if (error == CL_VIRUS) stats_record_threat();
+    else if (error != CL_CLEAN) stats_add(STAT_ERRORS, 1);
+    if (scan_time_ns > 0) stats_record_scan(scan_time_ns);
+
+    write_scan_result(fd, name, error, virname, essentials, (int64_t)size, bytes_scanned, scan_time_ns);
+}
+
+/* Scan a StreamBuffer and write its result to `fd` */
+void process_stream(const StreamBuffer *buffer, cl_error_t error, const char *name, ClamavEssentials *essentials, int fd) {
+    if (buffer == NULL) return;
+
+    process_buffer(buffer->data, buffer->size, error, name, essentials, fd);
+}
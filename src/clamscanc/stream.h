@@ -0,0 +1,107 @@
+/* stream.h
+ *
+ * Copyright 2025 EricLin
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+*/
+
+/* Scanning of streams and memory buffers */
+/*
+  * The data is scanned from memory with `cl_fmap_open_memory()` and `cl_scanmap_callback()`, it never goes through a temporary file
+  * A regular file given as a stream (e.g. `clamscanc - < file`) is mapped instead of being read
+  * A pipe or a socket is read into an anonymous mapping reserved for `STREAM_MAX_SIZE`, only the pages written are backed
+  *
+  * The daemon takes the streams as length-prefixed chunks, see `DAEMON_REQUEST_STREAM`
+*/
+
+#ifndef STREAM_H
+#define STREAM_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "manager.h"
+
+#define STREAM_ARGUMENT "-" // The path for scanning the standard input
+#define STREAM_NAME "stdin" // Shown as the path of the standard input in the results
+#define STREAM_MAX_SIZE ((size_t)1 << 30) // A longer stream isn't scanned, like the `StreamMaxLength` of clamd
+#define STREAM_READ_SIZE (64 * 1024) // Bytes read from a pipe at once
+#define STREAM_MAX_CHUNK ((uint32_t)1 << 20) // The largest chunk of a daemon stream, see `DAEMON_REQUEST_STREAM`
+
+/* Data to be scanned */
+/*
+  * `mapping_size` is the size of the whole mapping, the first `size` bytes are the data
+  * `is_file` is set if a regular file is mapped, its size is fixed
+*/
+typedef struct {
+	char *data;
+	size_t size;
+	size_t mapping_size;
+	bool is_file;
+} StreamBuffer;
+
+/* Initialize the StreamBuffer, empty */
+void stream_buffer_init(StreamBuffer *buffer);
+
+/* Clear the StreamBuffer */
+void stream_buffer_clear(StreamBuffer *buffer);
+
+/* Take the space for the next `length` bytes of the stream */
+/*
+  * Call `stream_buffer_commit()` with the bytes actually written
+  *
+  * @return
+  * NULL if the stream would exceed `STREAM_MAX_SIZE` or the buffer can't be mapped
+*/
+char *stream_buffer_reserve(StreamBuffer *buffer, size_t length);
+
+/* Keep the bytes written into the space from `stream_buffer_reserve()` */
+void stream_buffer_commit(StreamBuffer *buffer, size_t length);
+
+/* Read a whole stream until the end of file */
+/*
+  * @return
+  * `CL_SUCCESS`, `CL_EMAXSIZE` if the stream exceeds `STREAM_MAX_SIZE` or `CL_EREAD` (`errno` is set)
+*/
+cl_error_t stream_buffer_read_fd(StreamBuffer *buffer, int fd);
+
+/* Scan a memory buffer */
+/*
+  * @param name
+  * The name of the data, libclamav uses it for the type detection and the logs [OPTIONAL]
+  *
+  * @param bytes_scanned
+  * The bytes scanned, including the data extracted from the archives
+*/
+cl_error_t scan_buffer(const void *data, size_t size, const char *name, ClamavEssentials *essentials,
+                       const char **virname, uint64_t *bytes_scanned, uint64_t *scan_time_ns);
+
+/* Scan a memory buffer and write its result to `fd` */
+/*
+  * @param error
+  * The error of receiving the data, the data is only scanned if it's `CL_SUCCESS`
+*/
+void process_buffer(const void *data, size_t size, cl_error_t error, const char *name, ClamavEssentials *essentials, int fd);
+
+/* Scan a StreamBuffer and write its result to `fd` */
+/*
+  * @param error
+  * The error of receiving the stream, the stream is only scanned if it's `CL_SUCCESS`
+*/
+void process_stream(const StreamBuffer *buffer, cl_error_t error, const char *name, ClamavEssentials *essentials, int fd);
+
+#endif // STREAM_H
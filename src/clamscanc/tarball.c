@@ -0,0 +1,675 @@
+/* tarball.c
+ *
+ * Copyright 2025 EricLin
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+*/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <zlib.h>
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+#include "stream.h"
+#include "tarball.h"
+
+#define TAR_BLOCK_SIZE 512
+#define TAR_MAX_PAX_SIZE (64 * 1024) // A longer pax header is skipped, with the names in it
+#define SKIP_BUFFER_SIZE (64 * 1024)
+
+static const unsigned char zstd_magic[] = { 0x28, 0xb5, 0x2f, 0xfd };
+
+/* Source of the bytes of a Decoder */
+/*
+  * `read` returns the bytes read, 0 at the end or -1 on error
+*/
+typedef struct {
+    ssize_t (*read)(void *context, void *buffer, size_t size);
+    void *context;
+} ByteSource;
+
+typedef enum {
+    DECODER_NONE, // The bytes are passed through
+    DECODER_GZIP,
+    DECODER_ZSTD
+} DecoderType;
+
+/* Decompressor of a stream, the format is detected from the first bytes */
+typedef struct {
+    ByteSource source;
+    DecoderType type;
+    unsigned char input[TARBALL_READ_SIZE];
+    size_t input_start;
+    size_t input_end;
+    bool is_source_done;
+    bool is_frame_end; // The last compressed frame is complete, the stream may end here
+    z_stream zlib;
+#ifdef HAVE_ZSTD
+    ZSTD_DStream *zstd;
+#endif
+} Decoder;
+
+/* Reader of the members of a tarball */
+/*
+  * `block` is the next header if `has_block`, it was read ahead to tell if the data is a tarball
+  * `long_name` is the name of the next member from a GNU long name or a pax header
+*/
+typedef struct {
+    Decoder *decoder;
+    uint64_t remaining; // The data of the current member not read yet
+    uint64_t padding; // Up to the next block
+    unsigned char block[TAR_BLOCK_SIZE];
+    bool has_block;
+    char name[MAX_PATH];
+    char long_name[MAX_PATH];
+} TarReader;
+
+/* The tarball being traversed by the producer */
+typedef struct {
+    PathArena *arena;
+    TaskPool *file_tasks;
+    MemberPool *members;
+    ClamavEssentials *essentials;
+    size_t owner;
+} TarballContext;
+
+static char skip_buffer[SKIP_BUFFER_SIZE]; // Each producer is single threaded
+static char pax_buffer[TAR_MAX_PAX_SIZE + 1];
+
+/* Bytes in memory, as the source of a Decoder */
+typedef struct {
+    const char *data;
+    size_t size;
+    size_t offset;
+} MemorySource;
+
+/* Read a file descriptor */
+static ssize_t read_fd(void *context, void *buffer, size_t size) {
+    ssize_t bytes;
+    while ((bytes = read(*(int *)context, buffer, size)) == -1 && errno == EINTR);
+    return bytes;
+}
+
+/* Read the bytes in memory */
+static ssize_t read_memory(void *context, void *buffer, size_t size) {
+    MemorySource *memory = context;
+    size_t length = memory->size - memory->offset < size ? memory->size - memory->offset : size;
+    if (length > 0) memcpy(buffer, memory->data + memory->offset, length);
+    memory->offset += length;
+    return (ssize_t)length;
+}
+
+/* Read more compressed bytes once the input is consumed */
+static bool fill_input(Decoder *decoder) {
+    if (decoder->input_start == decoder->input_end) decoder->input_start = decoder->input_end = 0;
+    if (decoder->is_source_done || decoder->input_end == sizeof(decoder->input)) return true;
+
+    ssize_t bytes = decoder->source.read(decoder->source.context, decoder->input + decoder->input_end, sizeof(decoder->input) - decoder->input_end);
+    if (bytes < 0) return false;
+    if (bytes == 0) decoder->is_source_done = true;
+    decoder->input_end += (size_t)bytes;
+    return true;
+}
+
+/* Open a Decoder on `source` */
+/*
+  * @param is_detected
+  * Detect the compression from the first bytes, otherwise the bytes are passed through
+*/
+static bool decoder_open(Decoder *decoder, ByteSource source, bool is_detected) {
+    decoder->source = source;
+    decoder->type = DECODER_NONE;
+    decoder->input_start = decoder->input_end = 0;
+    decoder->is_source_done = false;
+    decoder->is_frame_end = false;
+    if (!is_detected) return true;
+
+    while (decoder->input_end < sizeof(zstd_magic) && !decoder->is_source_done) {
+        if (!fill_input(decoder)) return false;
+    }
+
+    if (decoder->input_end >= 2 && decoder->input[0] == 0x1f && decoder->input[1] == 0x8b) {
+        memset(&decoder->zlib, 0, sizeof(decoder->zlib));
+        if (inflateInit2(&decoder->zlib, 16 + MAX_WBITS) != Z_OK) return false; // gzip only, not the zlib header
+        decoder->type = DECODER_GZIP;
+    }
+    else if (decoder->input_end >= sizeof(zstd_magic) && memcmp(decoder->input, zstd_magic, sizeof(zstd_magic)) == 0) {
+#ifdef HAVE_ZSTD
+        decoder->zstd = ZSTD_createDStream();
+        if (decoder->zstd == NULL) return false;
+        ZSTD_initDStream(decoder->zstd);
+        decoder->type = DECODER_ZSTD;
+#else
+        fprintf(stderr, "[WARNING] decoder_open: zstd isn't supported by this build, the data is read compressed\n");
+#endif
+    }
+    return true;
+}
+
+/* Close the Decoder */
+static void decoder_close(Decoder *decoder) {
+    if (decoder->type == DECODER_GZIP) inflateEnd(&decoder->zlib);
+#ifdef HAVE_ZSTD
+    if (decoder->type == DECODER_ZSTD) ZSTD_freeDStream(decoder->zstd);
+#endif
+    decoder->type = DECODER_NONE;
+}
+
+/* Read the decompressed bytes */
+/*
+  * @return
+  * The bytes read, 0 at the end or -1 if the data is corrupted, truncated or can't be read
+*/
+static ssize_t decoder_read(Decoder *decoder, void *buffer, size_t size) {
+    if (size == 0) return 0;
+    if (size > INT_MAX) size = INT_MAX; // zlib counts in `unsigned int`
+
+    while (true) {
+        if (decoder->type == DECODER_NONE) {
+            if (decoder->input_start < decoder->input_end) { // The bytes read for the detection come first
+                size_t length = decoder->input_end - decoder->input_start < size ? decoder->input_end - decoder->input_start : size;
+                memcpy(buffer, decoder->input + decoder->input_start, length);
+                decoder->input_start += length;
+                return (ssize_t)length;
+            }
+            if (decoder->is_source_done) return 0;
+
+            ssize_t bytes = decoder->source.read(decoder->source.context, buffer, size); // Straight into the buffer
+            if (bytes == 0) decoder->is_source_done = true;
+            return bytes;
+        }
+        if (decoder->type == DECODER_GZIP && decoder->is_frame_end) return 0; // The bytes after the gzip stream are ignored
+
+        if (decoder->input_start == decoder->input_end) {
+            if (!fill_input(decoder)) return -1;
+            if (decoder->input_start == decoder->input_end) return decoder->is_frame_end ? 0 : -1; // Truncated inside a frame
+        }
+
+        size_t available = decoder->input_end - decoder->input_start;
+        size_t consumed, produced;
+        if (decoder->type == DECODER_GZIP) {
+            decoder->zlib.next_in = decoder->input + decoder->input_start;
+            decoder->zlib.avail_in = (unsigned int)available;
+            decoder->zlib.next_out = buffer;
+            decoder->zlib.avail_out = (unsigned int)size;
+            int result = inflate(&decoder->zlib, Z_NO_FLUSH);
+            consumed = available - decoder->zlib.avail_in;
+            produced = size - decoder->zlib.avail_out;
+            if (result == Z_STREAM_END) decoder->is_frame_end = true;
+            else if (result != Z_OK && !(result == Z_BUF_ERROR && (consumed > 0 || produced > 0))) return -1;
+        }
+        else {
+#ifdef HAVE_ZSTD
+            ZSTD_inBuffer in = { decoder->input + decoder->input_start, available, 0 };
+            ZSTD_outBuffer out = { buffer, size, 0 };
+            size_t result = ZSTD_decompressStream(decoder->zstd, &out, &in);
+            if (ZSTD_isError(result)) return -1;
+            consumed = in.pos;
+            produced = out.pos;
+            decoder->is_frame_end = result == 0; // Another frame may follow
+#else
+            return -1; // Never opened
+#endif
+        }
+
+        decoder->input_start += consumed;
+        if (produced > 0) return (ssize_t)produced;
+    }
+}
+
+/* Read until `size` bytes are read or the stream ends */
+static ssize_t decoder_read_full(Decoder *decoder, void *buffer, size_t size) {
+    size_t total = 0;
+    while (total < size) {
+        ssize_t bytes = decoder_read(decoder, (char *)buffer + total, size - total);
+        if (bytes < 0) return -1;
+        if (bytes == 0) break;
+        total += (size_t)bytes;
+    }
+    return (ssize_t)total;
+}
+
+/* Initialize the TarReader */
+static void tar_reader_init(TarReader *reader, Decoder *decoder) {
+    reader->decoder = decoder;
+    reader->remaining = 0;
+    reader->padding = 0;
+    reader->has_block = false;
+    reader->name[0] = '\0';
+    reader->long_name[0] = '\0';
+}
+
+/* Read the data of the current member */
+/*
+  * @return
+  * The bytes read, 0 at the end of the member or -1 if the tarball is truncated
+*/
+static ssize_t tar_read(TarReader *reader, void *buffer, size_t size) {
+    if (reader->remaining == 0) return 0;
+    if (size > reader->remaining) size = (size_t)reader->remaining;
+
+    ssize_t bytes = decoder_read(reader->decoder, buffer, size);
+    if (bytes <= 0) return -1; // The member isn't complete
+    reader->remaining -= (uint64_t)bytes;
+    return bytes;
+}
+
+/* Read the data of the current member, as the source of a Decoder */
+static ssize_t read_member(void *context, void *buffer, size_t size) {
+    return tar_read(context, buffer, size);
+}
+
+/* Skip the bytes of the tarball */
+static bool tar_skip(TarReader *reader, uint64_t size) {
+    while (size > 0) {
+        size_t length = size < sizeof(skip_buffer) ? (size_t)size : sizeof(skip_buffer);
+        if (decoder_read_full(reader->decoder, skip_buffer, length) != (ssize_t)length) return false;
+        size -= length;
+    }
+    return true;
+}
+
+/* Parse a number of a header, octal or base-256 (GNU) */
+static bool parse_number(const unsigned char *field, size_t size, uint64_t *value) {
+    *value = 0;
+    if (field[0] & 0x80) { // Base-256, for the sizes from 8 GiB
+        if (field[0] != 0x80) return false; // Negative or beyond 64 bits
+        for (size_t i = 1; i < size; i++) {
+            if (*value >> 56) return false;
+            *value = (*value << 8) | field[i];
+        }
+        return true;
+    }
+
+    size_t i = 0;
+    while (i < size && field[i] == ' ') i++;
+    for (; i < size && field[i] >= '0' && field[i] <= '7'; i++) *value = (*value << 3) | (uint64_t)(field[i] - '0');
+    return i == size || field[i] == ' ' || field[i] == '\0';
+}
+
+/* Check if the block is the header of a tarball, by its checksum */
+static bool is_tar_header(const unsigned char *block) {
+    uint64_t checksum;
+    if (!parse_number(block + 148, 8, &checksum)) return false;
+
+    uint64_t sum = 0;
+    for (size_t i = 0; i < TAR_BLOCK_SIZE; i++) sum += i >= 148 && i < 156 ? ' ' : block[i]; // The checksum counts itself as spaces
+    return sum == checksum && sum != 8 * ' '; // Not a block of zeros
+}
+
+/* Check if the block is made of zeros, the end of a tarball */
+static bool is_zero_block(const unsigned char *block) {
+    for (size_t i = 0; i < TAR_BLOCK_SIZE; i++) {
+        if (block[i] != 0) return false;
+    }
+    return true;
+}
+
+/* Take the path from the records of a pax header, e.g. `30 path=usr/lib/libfoo.so.1.2.3\n` */
+static void parse_pax_header(TarReader *reader, char *data, size_t size) {
+    size_t offset = 0;
+    while (offset < size) {
+        char *end;
+        unsigned long length = strtoul(data + offset, &end, 10);
+        if (length == 0 || length > size - offset || *end != ' ' || data[offset + length - 1] != '\n') return;
+
+        char *key = end + 1;
+        char *record_end = data + offset + length - 1;
+        char *equals = memchr(key, '=', (size_t)(record_end - key));
+        if (equals != NULL && (size_t)(equals - key) == 4 && memcmp(key, "path", 4) == 0) {
+            size_t value_length = (size_t)(record_end - (equals + 1));
+            if (value_length < sizeof(reader->long_name)) {
+                memcpy(reader->long_name, equals + 1, value_length);
+                reader->long_name[value_length] = '\0';
+            }
+        }
+        offset += length;
+    }
+}
+
+/* Read the name of the next member from a GNU long name or a pax header */
+static bool read_long_name(TarReader *reader, bool is_pax) {
+    uint64_t size = reader->remaining;
+    bool is_kept = size < (is_pax ? sizeof(pax_buffer) : sizeof(reader->long_name));
+    if (!is_kept) {
+        if (!tar_skip(reader, size)) return false;
+        reader->remaining = 0; // Skipped already, only the padding is left
+        return true;
+    }
+
+    char *data = is_pax ? pax_buffer : reader->long_name;
+    if (decoder_read_full(reader->decoder, data, (size_t)size) != (ssize_t)size) return false;
+    reader->remaining = 0;
+    data[size] = '\0';
+    if (is_pax) parse_pax_header(reader, data, (size_t)size);
+    return true;
+}
+
+/* Build the name of the current member, without the leading `./` and `/` */
+static void build_member_name(TarReader *reader) {
+    const char *block = (const char *)reader->block;
+    char name[MAX_PATH];
+    if (reader->long_name[0] != '\0') snprintf(name, sizeof(name), "%s", reader->long_name);
+    else if (memcmp(block + 257, "ustar", 5) == 0 && block[345] != '\0') { // The ustar prefix
+        snprintf(name, sizeof(name), "%.*s/%.*s", (int)strnlen(block + 345, 155), block + 345, (int)strnlen(block, 100), block);
+    }
+    else snprintf(name, sizeof(name), "%.*s", (int)strnlen(block, 100), block);
+    reader->long_name[0] = '\0'; // Only for this member
+
+    const char *start = name;
+    while (start[0] == '/' || (start[0] == '.' && start[1] == '/')) start += start[0] == '/' ? 1 : 2;
+    snprintf(reader->name, sizeof(reader->name), "%s", start);
+}
+
+/* Go to the next regular file of the tarball */
+/*
+  * @return
+  * 1 if `name` and `remaining` are the ones of the next member, 0 at the end of the tarball or -1 if it's corrupted or truncated
+*/
+static int tar_next(TarReader *reader) {
+    while (true) {
+        if (!tar_skip(reader, reader->remaining + reader->padding)) return -1; // The rest of the last member
+        reader->remaining = 0;
+        reader->padding = 0;
+
+        if (!reader->has_block) {
+            ssize_t bytes = decoder_read_full(reader->decoder, reader->block, TAR_BLOCK_SIZE);
+            if (bytes == 0) return 0; // Without the blocks of zeros, some writers leave them out
+            if (bytes != TAR_BLOCK_SIZE) return -1;
+        }
+        reader->has_block = false;
+        if (is_zero_block(reader->block)) return 0;
+        if (!is_tar_header(reader->block)) return -1;
+
+        uint64_t size;
+        if (!parse_number(reader->block + 124, 12, &size)) return -1;
+        reader->remaining = size;
+        reader->padding = (TAR_BLOCK_SIZE - size % TAR_BLOCK_SIZE) % TAR_BLOCK_SIZE;
+
+        char type = (char)reader->block[156];
+        if (type == 'L' || type == 'x') { // The name of the next member
+            if (!read_long_name(reader, type == 'x')) return -1;
+            continue;
+        }
+        if (type == 'g') continue; // Global pax header, nothing to scan
+        if (type != '0' && type != '\0' && type != '7') { // Directories, links and devices have no data to scan
+            reader->long_name[0] = '\0';
+            continue;
+        }
+
+        build_member_name(reader);
+        return 1;
+    }
+}
+
+/* Report a member which can't be scanned, as its result */
+static void report_member_failure(const TarballContext *context, const char *name, cl_error_t error, uint64_t size) {
+    process_buffer(NULL, (size_t)size, error, name, context->essentials, STDOUT_FILENO); // Not scanned with an error
+}
+
+/* Add a task for a member written into the MemberPool */
+static void add_member_task(const TarballContext *context, const char *name, uint32_t member, uint64_t size) {
+    Task task;
+    if (!build_task(context->arena, TASK_SCAN_MEMBER, name, NULL, &task)) {
+        member_pool_release(context->members, member);
+        stats_add(STAT_ERRORS, 1);
+        return;
+    }
+    task.size = size;
+    task.member = member;
+    task_pool_add(context->file_tasks, context->owner, task);
+    stats_add(STAT_FILES_ENQUEUED, 1);
+}
+
+/* Take the space of a member, wait while the ring of the producer is full */
+static uint32_t take_member(const TarballContext *context, uint64_t size, char **data) {
+    uint32_t member;
+    while ((member = member_pool_take(context->members, context->owner, size, data)) == INVALID_MEMBER) {
+        nanosleep(&(struct timespec){ .tv_nsec = MEMBER_RETRY_NS }, NULL); // The workers release the members soon
+    }
+    return member;
+}
+
+/* Copy a member of a known size into the MemberPool */
+/*
+  * @param head
+  * The first bytes of the member, read ahead to tell if it's a tarball
+  *
+  * @return
+  * `false` if the member is truncated
+*/
+static bool copy_member(const TarballContext *context, Decoder *decoder, const char *name, uint64_t size, const void *head, size_t head_size) {
+    if (size > MEMBER_MAX_SIZE) {
+        report_member_failure(context, name, CL_EMAXSIZE, size);
+        return true; // The data is skipped with the member
+    }
+
+    char *data;
+    uint32_t member = take_member(context, size, &data);
+    memcpy(data, head, head_size);
+    if (decoder_read_full(decoder, data + head_size, (size_t)(size - head_size)) != (ssize_t)(size - head_size)) {
+        member_pool_release(context->members, member);
+        return false;
+    }
+    add_member_task(context, name, member, size);
+    return true;
+}
+
+/* Read a compressed member as it is, with the bytes `decoder_open()` read to detect the compression */
+/*
+  * @return
+  * `false` if the member is truncated
+*/
+static bool read_raw_member(TarReader *reader, const Decoder *decoder, StreamBuffer *raw) {
+    size_t head_size = decoder->input_end - decoder->input_start;
+    char *space = stream_buffer_reserve(raw, head_size + (size_t)reader->remaining); // Already reserved by the caller
+    if (space == NULL) return false;
+
+    memcpy(space, decoder->input + decoder->input_start, head_size);
+    size_t size = head_size;
+    while (reader->remaining > 0) {
+        ssize_t bytes = tar_read(reader, space + size, (size_t)reader->remaining);
+        if (bytes < 0) return false;
+        size += (size_t)bytes;
+    }
+    stream_buffer_commit(raw, size);
+    return true;
+}
+
+/* Add a task for the raw bytes of a member which doesn't decompress, libclamav scans it as it is */
+static void add_raw_member(const TarballContext *context, const char *name, const StreamBuffer *raw) {
+    char *data;
+    uint32_t member = take_member(context, raw->size, &data);
+    if (raw->size > 0) memcpy(data, raw->data, raw->size);
+    add_member_task(context, name, member, raw->size);
+}
+
+/* Decompress a member of an unknown size into the MemberPool */
+/*
+  * It goes through a StreamBuffer first, the size of the space in the ring must be known
+  *
+  * @param raw
+  * The compressed bytes, scanned instead if the member can't be decompressed [OPTIONAL]
+*/
+static void decompress_member(const TarballContext *context, Decoder *decoder, const char *name, const void *head, size_t head_size, const StreamBuffer *raw) {
+    StreamBuffer buffer;
+    stream_buffer_init(&buffer);
+
+    cl_error_t error = CL_SUCCESS;
+    char *space = stream_buffer_reserve(&buffer, head_size);
+    if (space == NULL) error = CL_EMEM;
+    else {
+        memcpy(space, head, head_size);
+        stream_buffer_commit(&buffer, head_size);
+    }
+    while (error == CL_SUCCESS) {
+        space = stream_buffer_reserve(&buffer, STREAM_READ_SIZE);
+        if (space == NULL) {
+            error = CL_EMEM;
+            break;
+        }
+
+        ssize_t bytes = decoder_read(decoder, space, STREAM_READ_SIZE);
+        if (bytes < 0) error = CL_EFORMAT;
+        else if (bytes == 0) break;
+        else stream_buffer_commit(&buffer, (size_t)bytes);
+
+        if (buffer.size > MEMBER_MAX_SIZE) error = CL_EMAXSIZE;
+    }
+
+    if (error == CL_SUCCESS) {
+        char *data;
+        uint32_t member = take_member(context, buffer.size, &data);
+        if (buffer.size > 0) memcpy(data, buffer.data, buffer.size);
+        add_member_task(context, name, member, buffer.size);
+    }
+    else if (raw != NULL && raw->size > 0) add_raw_member(context, name, raw);
+    else report_member_failure(context, name, error, buffer.size);
+    stream_buffer_clear(&buffer);
+}
+
+static bool traverse_members(const TarballContext *context, TarReader *reader, const char *prefix, size_t depth);
+
+/* Add the current member of `reader` as a task, or traverse it if it's a tarball itself */
+/*
+  * @note
+  * A compressed member which fits `MEMBER_MAX_SIZE` is read into memory first, its raw bytes are scanned if it doesn't decompress (e.g. a `.gz` which isn't one)
+  *
+  * @return
+  * `false` if `reader` is truncated, a corrupted inner tarball is reported as its result
+*/
+static bool read_current_member(const TarballContext *context, TarReader *reader, const char *name, size_t depth) {
+    uint64_t size = reader->remaining;
+    bool can_be_tarball = depth + 1 < TARBALL_MAX_DEPTH;
+
+    Decoder decoder;
+    if (!decoder_open(&decoder, (ByteSource){ read_member, reader }, can_be_tarball)) return false; // The member is truncated, or the decompressor can't be allocated
+
+    StreamBuffer raw;
+    stream_buffer_init(&raw);
+    MemorySource memory = { NULL, 0, 0 };
+    if (decoder.type != DECODER_NONE && size <= MEMBER_MAX_SIZE && stream_buffer_reserve(&raw, (size_t)size) != NULL) { // Streamed otherwise
+        bool is_read = read_raw_member(reader, &decoder, &raw);
+        decoder_close(&decoder);
+        memory = (MemorySource){ raw.data, raw.size, 0 };
+        if (!is_read || !decoder_open(&decoder, (ByteSource){ read_memory, &memory }, true)) {
+            stream_buffer_clear(&raw);
+            return false;
+        }
+    }
+    const StreamBuffer *fallback = raw.size > 0 ? &raw : NULL;
+
+    if (!can_be_tarball) {
+        bool is_copied = copy_member(context, &decoder, name, size, NULL, 0);
+        decoder_close(&decoder);
+        return is_copied;
+    }
+
+    /* A member whose first block is a header is a tarball (e.g. a layer of an image) */
+    TarReader inner;
+    tar_reader_init(&inner, &decoder);
+    ssize_t head_size = decoder_read_full(&decoder, inner.block, TAR_BLOCK_SIZE);
+    bool is_intact = true;
+    if (head_size < 0) {
+        if (decoder.type == DECODER_NONE) is_intact = false; // The outer tarball is truncated
+        else if (fallback != NULL) add_raw_member(context, name, fallback);
+        else report_member_failure(context, name, CL_EFORMAT, size);
+    }
+    else if (head_size == TAR_BLOCK_SIZE && is_tar_header(inner.block)) {
+        inner.has_block = true;
+        if (!traverse_members(context, &inner, name, depth + 1)) {
+            fprintf(stderr, "[WARNING] traverse_tarball: %s is corrupted or truncated, its remaining members are skipped\n", name);
+            report_member_failure(context, name, CL_EFORMAT, size);
+        }
+    }
+    else if (decoder.type == DECODER_NONE) is_intact = copy_member(context, &decoder, name, size, inner.block, (size_t)head_size);
+    else decompress_member(context, &decoder, name, inner.block, (size_t)head_size, fallback); // Scanned decompressed, libclamav would decompress it anyway
+    decoder_close(&decoder);
+    stream_buffer_clear(&raw);
+    return is_intact;
+}
+
+/* Traverse the members of a tarball */
+/*
+  * @param prefix
+  * The name of the tarball, the members are named `prefix:member`
+  *
+  * @return
+  * `false` if the tarball is corrupted or truncated
+*/
+static bool traverse_members(const TarballContext *context, TarReader *reader, const char *prefix, size_t depth) {
+    while (true) {
+        int result = tar_next(reader);
+        if (result <= 0) return result == 0;
+
+        char name[MAX_PATH];
+        if (snprintf(name, sizeof(name), "%s%c%s", prefix, TARBALL_NAME_SEPARATOR, reader->name) >= (int)sizeof(name)) {
+            fprintf(stderr, "[ERROR] traverse_tarball: Name too long: %s%c%s\n", prefix, TARBALL_NAME_SEPARATOR, reader->name);
+            stats_add(STAT_ERRORS, 1);
+            continue; // The data is skipped with the member
+        }
+        if (!read_current_member(context, reader, name, depth)) return false;
+    }
+}
+
+/* Stream the members of a tarball to the workers */
+void traverse_tarball(const char *path, PathArena *arena, TaskPool *file_tasks, MemberPool *members, ClamavEssentials *essentials, size_t owner) {
+    if (path == NULL || arena == NULL || file_tasks == NULL || members == NULL || essentials == NULL) return; // Invalid arguments
+
+    bool is_stdin = strcmp(path, STREAM_ARGUMENT) == 0;
+    int fd = is_stdin ? STDIN_FILENO : open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        fprintf(stderr, "[ERROR] traverse_tarball: Failed to open %s: %s\n", path, strerror(errno));
+        stats_add(STAT_ERRORS, 1);
+        return;
+    }
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL); // Read once from the start
+
+    const char *name = is_stdin ? STREAM_NAME : path;
+    TarballContext context = { arena, file_tasks, members, essentials, owner };
+    Decoder decoder;
+    TarReader reader;
+    bool is_traversed = decoder_open(&decoder, (ByteSource){ read_fd, &fd }, true);
+    if (is_traversed) {
+        tar_reader_init(&reader, &decoder);
+        is_traversed = traverse_members(&context, &reader, name, 0);
+    }
+    decoder_close(&decoder);
+    if (!is_stdin) close(fd);
+
+    if (!is_traversed) {
+        fprintf(stderr, "[ERROR] traverse_tarball: %s is not a tarball, or is corrupted or truncated\n", name);
+        report_member_failure(&context, name, CL_EFORMAT, 0);
+    }
+}
+
+/* Scan a member and output the result */
+void process_member(const Task *task, const char *name, MemberPool *members, ClamavEssentials *essentials) {
+    if (task == NULL || name == NULL || essentials == NULL) return; // Invalid arguments
+
+    uint64_t size = 0;
+    const char *data = member_pool_get(members, task->member, &size);
+    uint64_t trace_start = trace_begin(TRACE_PROCESS_FILE);
+    process_buffer(data, (size_t)size, data != NULL ? CL_SUCCESS : CL_ENULLARG, name, essentials, STDOUT_FILENO);
+    trace_end(TRACE_PROCESS_FILE, trace_start);
+}
@@ -0,0 +1,65 @@
+/* tarball.h
+ *
+ * Copyright 2025 EricLin
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+*/
+
+/* Scanning of tarballs without extracting them */
+/*
+  * A producer reads the tarball once from its start (`TASK_SCAN_TARBALL`), copies each member into its ring of the MemberPool
+  * and adds a `TASK_SCAN_MEMBER` task, the workers scan the members from memory, nothing is written to the disk
+  * The tarball and the tarballs in it may be compressed with gzip or zstd, so a saved container image (`docker save`,
+  * `podman save`, an OCI archive) is read layer by layer, the results are named `image:layer:path`
+  *
+  * A member larger than `MEMBER_MAX_SIZE` isn't scanned, it's reported as `CL_EMAXSIZE`
+  * A tarball deeper than `TARBALL_MAX_DEPTH` is scanned as a member, libclamav unpacks it by itself
+  * The zstd layers need a build with libzstd (`HAVE_ZSTD`), otherwise they are scanned as they are
+*/
+
+#ifndef TARBALL_H
+#define TARBALL_H
+
+#include <stddef.h>
+
+#include "manager.h"
+
+#define TARBALL_OPTION "--tarball"
+#define TARBALL_MAX_DEPTH 2 // The image and its layers
+#define TARBALL_NAME_SEPARATOR ':' // Between the names of a tarball and its member
+#define TARBALL_READ_SIZE (128 * 1024) // Compressed bytes read at once
+
+/* Stream the members of a tarball to the workers */
+/*
+  * @param path
+  * The tarball, or `STREAM_ARGUMENT` for the standard input
+  *
+  * @param owner
+  * The producer, its ring of `members` holds the data and its deques take the tasks
+  *
+  * @warning
+  * This function MUST be called by a producer process, it waits while its ring is full
+*/
+void traverse_tarball(const char *path, PathArena *arena, TaskPool *file_tasks, MemberPool *members, ClamavEssentials *essentials, size_t owner);
+
+/* Scan a member and output the result */
+/*
+  * @note
+  * The member isn't released, the caller does it even if the member isn't scanned
+*/
+void process_member(const Task *task, const char *name, MemberPool *members, ClamavEssentials *essentials);
+
+#endif // TARBALL_H
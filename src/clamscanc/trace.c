@@ -0,0 +1,222 @@
+/* trace.c
+ *
+ * Copyright 2025 EricLin
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+*/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "trace.h"
+
+#if defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define TRACE_PROBE(name, span) DTRACE_PROBE2(wuming, name, (int)(span), span_names[span])
+#endif
+#endif
+
+#ifndef TRACE_PROBE
+#define TRACE_PROBE(name, span) ((void)0) // Built without the USDT probes
+#endif
+
+#define TRACE_END_MARKER "\n]\n" // The closing of the array, replaced when another process appends
+
+static TraceRing *local_ring = NULL; // The ring of the calling process, each process has its own copy after forking
+
+static const char *span_names[TRACE_NUM_SPANS] = {
+    "traverse_directory",
+    "task_queue_add_wait",
+    "task_queue_lock_wait",
+    "task_pool_wait",
+    "process_file",
+    "prefetch_file",
+    "cl_scandesc",
+    "read_scan_output",
+    "handle_scan_result",
+};
+
+static inline uint64_t now_ns(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000ULL + (uint64_t)now.tv_nsec;
+}
+
+/* Initialize the ScanTrace, disabled */
+void scan_trace_init(ScanTrace *trace) {
+    if (trace == NULL) return;
+
+    trace->rings = NULL;
+    trace->num_rings = 0;
+}
+
+/* Map the rings of the ScanTrace */
+bool scan_trace_enable(ScanTrace *trace, size_t num_rings) {
+    if (trace == NULL || num_rings == 0) return false;
+    if (trace->rings != NULL) return true; // Already enabled
+
+    void *rings = mmap(NULL, num_rings * sizeof(TraceRing), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (rings == MAP_FAILED) {
+        fprintf(stderr, "[ERROR] scan_trace_enable: Failed to map the trace rings: %s\n", strerror(errno));
+        return false;
+    }
+
+    trace->rings = rings;
+    trace->num_rings = num_rings;
+    return true;
+}
+
+/* Clear the ScanTrace */
+void scan_trace_clear(ScanTrace *trace) {
+    if (trace == NULL || trace->rings == NULL) return;
+
+    if (local_ring >= trace->rings && local_ring < trace->rings + trace->num_rings) local_ring = NULL; // Stop recording into the unmapped ring
+    munmap(trace->rings, trace->num_rings * sizeof(TraceRing));
+    trace->rings = NULL;
+    trace->num_rings = 0;
+}
+
+/* Let the calling process record into the ring `index` */
+void scan_trace_attach(ScanTrace *trace, size_t index, const char *name, size_t number) {
+    local_ring = (trace != NULL && trace->rings != NULL && index < trace->num_rings) ? &trace->rings[index] : NULL;
+    if (local_ring == NULL) return;
+
+    snprintf(local_ring->name, sizeof(local_ring->name), "%s %zu", name != NULL ? name : "process", number);
+}
+
+/* Begin a span of the calling process */
+uint64_t trace_begin(TraceSpan span) {
+    TRACE_PROBE(span__begin, span);
+
+    return local_ring != NULL ? now_ns() : 0;
+}
+
+/* End a span begun by `trace_begin()` */
+void trace_end(TraceSpan span, uint64_t begin_ns) {
+    TRACE_PROBE(span__end, span);
+    if (local_ring == NULL || begin_ns == 0 || span >= TRACE_NUM_SPANS) return;
+
+    /* Only this process writes the ring, the exporter reads it after the process is gone */
+    uint64_t head = atomic_load_explicit(&local_ring->head, memory_order_relaxed);
+    local_ring->events[head & (TRACE_RING_EVENTS - 1)] = (TraceEvent){
+        .begin_ns = begin_ns,
+        .end_ns = now_ns(),
+        .span = (uint32_t)span,
+    };
+    atomic_store_explicit(&local_ring->head, head + 1, memory_order_release);
+}
+
+/* Open the trace file, positioned where the events are written */
+/*
+  * @param is_continued
+  * Set to `true` if the file already has events, the next one needs a separator
+*/
+static FILE *open_trace_file(const char *path, bool is_append, bool *is_continued) {
+    *is_continued = false;
+
+    int fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd == -1) return NULL;
+
+    /* Continue the array if it's closed by `TRACE_END_MARKER`, otherwise start a new one */
+    const size_t marker_size = strlen(TRACE_END_MARKER);
+    struct stat status;
+    char marker[8] = "";
+    if (is_append && fstat(fd, &status) == 0 && status.st_size > (off_t)marker_size &&
+        pread(fd, marker, marker_size, status.st_size - (off_t)marker_size) == (ssize_t)marker_size &&
+        memcmp(marker, TRACE_END_MARKER, marker_size) == 0 && ftruncate(fd, status.st_size - (off_t)marker_size) == 0) {
+        *is_continued = true;
+    }
+    else if (ftruncate(fd, 0) != 0) {
+        close(fd);
+        return NULL;
+    }
+
+    FILE *file = fdopen(fd, "a");
+    if (file == NULL) {
+        close(fd);
+        return NULL;
+    }
+    if (!*is_continued) fputc('[', file);
+    return file;
+}
+
+/* Write an event, separated from the previous one */
+static void write_event(FILE *file, bool *is_continued, const char *format, ...) {
+    fputs(*is_continued ? ",\n" : "\n", file);
+    *is_continued = true;
+
+    va_list args;
+    va_start(args, format);
+    vfprintf(file, format, args);
+    va_end(args);
+}
+
+/* Export the rings as a Chrome trace */
+bool scan_trace_export(ScanTrace *trace, const char *path, int pid, const char *process_name, bool is_append) {
+    if (trace == NULL || trace->rings == NULL || path == NULL) return false;
+
+    bool is_continued;
+    FILE *file = open_trace_file(path, is_append, &is_continued);
+    if (file == NULL) {
+        fprintf(stderr, "[ERROR] scan_trace_export: Failed to open %s: %s\n", path, strerror(errno));
+        return false;
+    }
+
+    write_event(file, &is_continued, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,\"args\":{\"name\":\"%s\"}}", pid, process_name);
+
+    uint64_t overwritten = 0;
+    for (size_t i = 0; i < trace->num_rings; i++) {
+        TraceRing *ring = &trace->rings[i];
+        if (ring->name[0] == '\0') continue; // Never attached, its pages were never touched
+
+        ring->name[TRACE_NAME_SIZE - 1] = '\0';
+        write_event(file, &is_continued, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%zu,\"args\":{\"name\":\"%s\"}}", pid, i, ring->name);
+
+        /* The thread names are sorted by the ring, so the producers come before the workers */
+        write_event(file, &is_continued, "{\"name\":\"thread_sort_index\",\"ph\":\"M\",\"pid\":%d,\"tid\":%zu,\"args\":{\"sort_index\":%zu}}", pid, i, i);
+
+        uint64_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+        uint64_t first = head > TRACE_RING_EVENTS ? head - TRACE_RING_EVENTS : 0;
+        overwritten += first;
+        for (uint64_t index = first; index < head; index++) {
+            const TraceEvent *event = &ring->events[index & (TRACE_RING_EVENTS - 1)];
+            if (event->span >= TRACE_NUM_SPANS || event->end_ns < event->begin_ns) continue; // Torn by a process killed while writing it
+
+            /* The timestamps are in microseconds */
+            uint64_t duration_ns = event->end_ns - event->begin_ns;
+            write_event(file, &is_continued, "{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"pid\":%d,\"tid\":%zu,\"ts\":%llu.%03llu,\"dur\":%llu.%03llu}",
+                        span_names[event->span], process_name, pid, i,
+                        (unsigned long long)(event->begin_ns / 1000), (unsigned long long)(event->begin_ns % 1000),
+                        (unsigned long long)(duration_ns / 1000), (unsigned long long)(duration_ns % 1000));
+        }
+    }
+
+    fputs(TRACE_END_MARKER, file);
+    bool is_written = !ferror(file);
+    if (fclose(file) != 0) is_written = false;
+
+    if (!is_written) fprintf(stderr, "[ERROR] scan_trace_export: Failed to write %s\n", path);
+    else if (overwritten > 0) fprintf(stderr, "[WARNING] scan_trace_export: %llu of the oldest spans were overwritten\n", (unsigned long long)overwritten);
+    return is_written;
+}
@@ -0,0 +1,134 @@
+/* trace.h
+ *
+ * Copyright 2025 EricLin
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+*/
+
+/* Pipeline tracing */
+/*
+  * The spans of the pipeline are recorded into a ring per process, the rings live in a shared mapping like the stats slots
+  * Each ring is only written by its own process, the oldest spans are overwritten when it's full
+  * The parent exports all the rings as a Chrome trace (JSON Array Format) at the end, Perfetto and `chrome://tracing` open it
+  * The GUI records its own spans the same way and appends them to the file, the timestamps are `CLOCK_MONOTONIC` for both
+  *
+  * Every span also fires the USDT probes `wuming:span__begin` and `wuming:span__end` (span id, span name) if `<sys/sdt.h>` is available
+  * They are nops until a tracer attaches, e.g. `bpftrace -e 'usdt:clamscanc:wuming:span__end { @[str(arg1)] = count(); }'`
+*/
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdatomic.h>
+
+#define TRACE_OPTION "--trace=" // Export the spans of the scan to this file
+#define TRACE_ENV "WUMING_TRACE" // The GUI passes it to `clamscanc` as `--trace=` and appends its own spans
+#define TRACE_RING_EVENTS ((size_t)1 << 16) // Spans kept per process, pages are only backed when they are used
+#define TRACE_NAME_SIZE 24
+
+_Static_assert((TRACE_RING_EVENTS & (TRACE_RING_EVENTS - 1)) == 0, "TRACE_RING_EVENTS must be power of 2");
+
+/* Traced spans */
+typedef enum {
+    TRACE_TRAVERSE_DIRECTORY,
+    TRACE_QUEUE_ADD_WAIT, // Blocked for an empty slot in `task_queue_add()`
+    TRACE_QUEUE_LOCK_WAIT, // Blocked for the lock of a contended TaskQueue
+    TRACE_POOL_WAIT, // Idle in `task_pool_wait()` until new tasks arrive
+    TRACE_PROCESS_FILE, // Including the cache lookups and the result output
+    TRACE_PREFETCH_FILE,
+    TRACE_SCANDESC, // `cl_scandesc()` alone
+    TRACE_READ_OUTPUT, // The GUI reading and decoding the output of the scanner
+    TRACE_HANDLE_RESULT, // The GUI updating the pages for a result
+    TRACE_NUM_SPANS
+} TraceSpan;
+
+/* Span recorded in a ring */
+typedef struct {
+	uint64_t begin_ns;
+	uint64_t end_ns;
+	uint32_t span;
+	uint32_t reserved;
+} TraceEvent;
+
+/* Ring of a process */
+/*
+  * `head` counts every span recorded, `events[head % TRACE_RING_EVENTS]` is the next one to be written
+  * `name` is shown as the thread name, a respawned process continues the ring of the one it replaces
+*/
+typedef struct {
+	_Alignas(64) _Atomic uint64_t head;
+	char name[TRACE_NAME_SIZE];
+	TraceEvent events[TRACE_RING_EVENTS];
+} TraceRing;
+
+typedef struct {
+	TraceRing *rings; // NULL if tracing isn't enabled
+	size_t num_rings;
+} ScanTrace;
+
+/* Initialize the ScanTrace, disabled */
+void scan_trace_init(ScanTrace *trace);
+
+/* Map the rings of the ScanTrace */
+/*
+  * @return
+  * `true` if the rings are mapped, `false` otherwise (scan without tracing)
+  *
+  * @warning
+  * This function MUST be called before forking, the mapping is shared with the child processes
+*/
+bool scan_trace_enable(ScanTrace *trace, size_t num_rings);
+
+/* Clear the ScanTrace */
+void scan_trace_clear(ScanTrace *trace);
+
+/* Let the calling process record into the ring `index` */
+/*
+  * @param name
+  * The role of the process, the thread name is `name` followed by `number`
+  *
+  * @warning
+  * Call it once in every process after forking, nothing is recorded before it's called (the probes still fire)
+*/
+void scan_trace_attach(ScanTrace *trace, size_t index, const char *name, size_t number);
+
+/* Begin a span of the calling process */
+/*
+  * @return
+  * The begin time for `trace_end()`, 0 if the process doesn't record
+*/
+uint64_t trace_begin(TraceSpan span);
+
+/* End a span begun by `trace_begin()` */
+void trace_end(TraceSpan span, uint64_t begin_ns);
+
+/* Export the rings as a Chrome trace */
+/*
+  * @param pid
+  * The process id of the events, the rings are its threads
+  *
+  * @param is_append
+  * Append to the trace already in `path` (written by another process) instead of replacing it
+  *
+  * @return
+  * `true` if the file is written
+*/
+bool scan_trace_export(ScanTrace *trace, const char *path, int pid, const char *process_name, bool is_append);
+
+#endif // TRACE_H
@@ -0,0 +1,250 @@
+/* traversal-filter.c
+ *
+ * Copyright 2025 EricLin
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+*/
+
+#include <errno.h>
+#include <sched.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#ifdef __linux__
+#include <linux/magic.h>
+#include <sys/vfs.h>
+#endif
+
+#include "stats.h"
+#include "traversal-filter.h"
+
+#ifndef MAP_NORESERVE
+#define MAP_NORESERVE 0
+#endif
+
+#define DEVICE_CACHE_SIZE 64 // The file systems already checked by the calling process
+#define PUBLISH_SPIN_LIMIT (1 << 20) // Give up waiting for `dev` of a claimed slot, the inserting process was probably killed
+
+#ifdef __linux__
+/* The pseudo file systems, some of them aren't in older `linux/magic.h` */
+static const unsigned long pseudo_filesystems[] = {
+    PROC_SUPER_MAGIC, SYSFS_MAGIC, DEBUGFS_MAGIC, SECURITYFS_MAGIC, DEVPTS_SUPER_MAGIC,
+    CGROUP_SUPER_MAGIC, CGROUP2_SUPER_MAGIC, BPF_FS_MAGIC, PSTOREFS_MAGIC, HUGETLBFS_MAGIC,
+    SELINUX_MAGIC, SMACK_MAGIC, EFIVARFS_MAGIC, NSFS_MAGIC,
+#ifdef TRACEFS_MAGIC
+    TRACEFS_MAGIC,
+#endif
+    0x62656570, // configfs
+    0x65735543, // fusectl
+    0x19800202, // mqueue
+    0x42494e4d, // binfmt_misc
+};
+#endif
+
+/* A file system checked by the calling process */
+typedef struct {
+    dev_t dev;
+    bool is_allowed;
+} DeviceVerdict;
+
+static DeviceVerdict device_cache[DEVICE_CACHE_SIZE]; // Each process has its own copy after forking
+static size_t device_cache_count = 0;
+static size_t device_cache_next = 0; // The entry replaced next once the cache is full
+
+/* Initialize the TraversalFilter, only skipping the pseudo file systems */
+void traversal_filter_init(TraversalFilter *filter) {
+    if (filter == NULL) return;
+
+    filter->is_one_filesystem = false;
+    filter->num_root_devices = 0;
+    filter->seen.slots = NULL;
+    filter->exclusions = NULL;
+    filter->checkpoint = NULL;
+    atomic_init(&filter->seen.count, 0);
+    atomic_init(&filter->seen.is_full, false);
+}
+
+/* Clear the TraversalFilter */
+void traversal_filter_clear(TraversalFilter *filter) {
+    if (filter == NULL || filter->seen.slots == NULL) return;
+
+    munmap(filter->seen.slots, INODE_SET_SLOTS * sizeof(InodeSlot));
+    filter->seen.slots = NULL;
+}
+
+/* Map the seen-set of the inodes */
+bool traversal_filter_enable_dedup(TraversalFilter *filter) {
+    if (filter == NULL) return false;
+    if (filter->seen.slots != NULL) return true; // Already enabled
+
+    void *slots = mmap(NULL, INODE_SET_SLOTS * sizeof(InodeSlot), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (slots == MAP_FAILED) {
+        fprintf(stderr, "[ERROR] traversal_filter_enable_dedup: Failed to map the inode set: %s\n", strerror(errno));
+        return false;
+    }
+
+    filter->seen.slots = slots;
+    return true;
+}
+
+/* Stay on the file system of `path` */
+bool traversal_filter_add_root(TraversalFilter *filter, const char *path) {
+    if (filter == NULL || path == NULL) return false;
+
+    struct stat status;
+    if (stat(path, &status) != 0 || filter->num_root_devices >= MAX_ROOT_DEVICES) return false;
+
+    filter->is_one_filesystem = true;
+    for (size_t i = 0; i < filter->num_root_devices; i++) {
+        if (filter->root_devices[i] == status.st_dev) return true; // Several roots on the same file system
+    }
+    filter->root_devices[filter->num_root_devices++] = status.st_dev;
+    return true;
+}
+
+/* Mix (dev, ino) into the first slot to probe */
+static inline size_t inode_hash(uint64_t dev, uint64_t ino) {
+    uint64_t hash = ino * 0x9e3779b97f4a7c15ULL ^ dev * 0xc2b2ae3d27d4eb4fULL;
+    hash ^= hash >> 29;
+    return (size_t)hash & (INODE_SET_SLOTS - 1);
+}
+
+/* Insert (dev, ino) into the InodeSet */
+/*
+  * @return
+  * `true` if it's new (or the set is full), `false` if it was already inserted
+*/
+static bool inode_set_insert(InodeSet *set, dev_t dev, ino_t ino) {
+    const uint64_t key_ino = (uint64_t)ino + 1;
+    const uint64_t key_dev = (uint64_t)dev + 1;
+    const size_t start = inode_hash(key_dev, key_ino);
+
+    for (size_t i = 0; i < INODE_SET_SLOTS; i++) {
+        InodeSlot *slot = &set->slots[(start + i) & (INODE_SET_SLOTS - 1)];
+        uint64_t current = atomic_load_explicit(&slot->ino, memory_order_acquire);
+
+        if (current == 0) {
+            if (atomic_load_explicit(&set->count, memory_order_relaxed) >= INODE_SET_MAX_COUNT) {
+                if (!atomic_exchange(&set->is_full, true)) fprintf(stderr, "[WARNING] traversal_filter: The inode set is full, the hard links are no longer deduplicated\n");
+                return true;
+            }
+
+            if (atomic_compare_exchange_strong(&slot->ino, &current, key_ino)) { // Claim the slot, then publish the device
+                atomic_store_explicit(&slot->dev, key_dev, memory_order_release);
+                atomic_fetch_add_explicit(&set->count, 1, memory_order_relaxed);
+                return true;
+            }
+            /* Another process claimed the slot, `current` is its inode now */
+        }
+
+        if (current != key_ino) continue;
+
+        /* Same inode number, wait until the device is published */
+        uint64_t current_dev = 0;
+        for (int spin = 0; spin < PUBLISH_SPIN_LIMIT && (current_dev = atomic_load_explicit(&slot->dev, memory_order_acquire)) == 0; spin++) {
+            if ((spin & 1023) == 1023) sched_yield();
+        }
+        if (current_dev == 0) return true; // Never published, scan it rather than risk skipping it
+        if (current_dev == key_dev) return false;
+    }
+
+    return true;
+}
+
+/* Check whether files on the device should be traversed, cached per process */
+static bool is_device_allowed(const TraversalFilter *filter, int dir_fd, dev_t dev) {
+    for (size_t i = 0; i < device_cache_count; i++) {
+        if (device_cache[i].dev == dev) return device_cache[i].is_allowed;
+    }
+
+    bool is_allowed = true;
+    if (filter->is_one_filesystem) {
+        is_allowed = false;
+        for (size_t i = 0; i < filter->num_root_devices; i++) {
+            if (filter->root_devices[i] == dev) is_allowed = true;
+        }
+    }
+
+#ifdef __linux__
+    struct statfs status;
+    if (is_allowed && fstatfs(dir_fd, &status) == 0) {
+        for (size_t i = 0; i < sizeof(pseudo_filesystems) / sizeof(pseudo_filesystems[0]); i++) {
+            if ((unsigned long)status.f_type == pseudo_filesystems[i]) is_allowed = false;
+        }
+    }
+#endif
+
+    DeviceVerdict verdict = { .dev = dev, .is_allowed = is_allowed };
+    if (device_cache_count < DEVICE_CACHE_SIZE) device_cache[device_cache_count++] = verdict;
+    else {
+        device_cache[device_cache_next] = verdict;
+        device_cache_next = (device_cache_next + 1) % DEVICE_CACHE_SIZE;
+    }
+    return is_allowed;
+}
+
+/* Check whether an opened directory should be traversed */
+bool traversal_filter_enter_directory(TraversalFilter *filter, int dir_fd) {
+    if (filter == NULL) return true;
+
+    struct stat status;
+    if (fstat(dir_fd, &status) != 0) return true; // Let the traversal report the error
+
+    bool is_allowed = is_device_allowed(filter, dir_fd, status.st_dev) &&
+                      (filter->seen.slots == NULL || inode_set_insert(&filter->seen, status.st_dev, status.st_ino)); // Bind mounts can reach a directory again, even loop over it
+    if (!is_allowed) stats_add(STAT_DIRS_SKIPPED, 1);
+    return is_allowed;
+}
+
+/* Check whether a regular file should be scanned */
+bool traversal_filter_accept_file(TraversalFilter *filter, const struct stat *status) {
+    if (filter == NULL || status == NULL) return true;
+
+    if (filter->is_one_filesystem) {
+        bool is_on_root = false;
+        for (size_t i = 0; i < filter->num_root_devices; i++) {
+            if (filter->root_devices[i] == status->st_dev) is_on_root = true;
+        }
+        if (!is_on_root) return false; // A bind mounted file
+    }
+
+    if (filter->seen.slots != NULL && status->st_nlink > 1 && !inode_set_insert(&filter->seen, status->st_dev, status->st_ino)) {
+        stats_add(STAT_HARDLINKS_SKIPPED, 1);
+        return false;
+    }
+    return true;
+}
+
+/* Check whether an entry is excluded by the rules */
+bool traversal_filter_is_excluded(TraversalFilter *filter, const char *dir, const char *name, bool is_dir, uint64_t size) {
+    if (filter == NULL || filter->exclusions == NULL) return false;
+
+    const ExclusionRules *rules = filter->exclusions;
+    bool is_excluded = (!is_dir && exclusion_rules_exceeds_size(rules, size)) ||
+                       exclusion_rules_match(rules, dir, strlen(dir), name, is_dir);
+    if (is_excluded) stats_add(STAT_EXCLUDED, 1);
+    return is_excluded;
+}
+
+/* Check whether a regular file was finished by the resumed scan */
+bool traversal_filter_is_completed(TraversalFilter *filter, const char *dir, const char *name) {
+    if (filter == NULL || filter->checkpoint == NULL) return false;
+
+    bool is_completed = checkpoint_is_completed(filter->checkpoint, dir, name);
+    if (is_completed) stats_add(STAT_RESUMED, 1);
+    return is_completed;
+}
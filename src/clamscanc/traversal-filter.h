@@ -0,0 +1,152 @@
+/* traversal-filter.h
+ *
+ * Copyright 2025 EricLin
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+*/
+
+/* Traversal filter */
+/*
+  * Decides which directories and files found by the traversal are worth a task
+  * The pseudo file systems (`/proc`, `/sys`, ...) are never entered, they only hold the kernel's state and some of their files never end
+  * With `is_one_filesystem`, the traversal stays on the file systems of the roots, like `find -xdev`
+  * With the seen-set, every directory and every file with several hard links is only taken once, so the same bytes are never scanned twice
+  * With the exclusion rules, the excluded entries never get a task, an excluded directory is never opened
+  * With a resumed checkpoint, the files finished by the interrupted scan never get a task
+*/
+
+#ifndef TRAVERSAL_FILTER_H
+#define TRAVERSAL_FILTER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include "checkpoint.h"
+#include "exclusion.h"
+
+#define INODE_SET_SLOTS ((size_t)1 << 22) // Reserved address space, pages are only backed when they are used
+#define INODE_SET_MAX_COUNT (INODE_SET_SLOTS / 4 * 3) // Stop inserting beyond this load, the probes would get too long
+#define MAX_ROOT_DEVICES 16
+
+_Static_assert((INODE_SET_SLOTS & (INODE_SET_SLOTS - 1)) == 0, "INODE_SET_SLOTS must be power of 2");
+
+/* Slot of the InodeSet */
+/*
+  * `ino` is claimed first, then `dev` is published, both are stored plus 1 so 0 means empty
+*/
+typedef struct {
+	_Atomic uint64_t ino;
+	_Atomic uint64_t dev;
+} InodeSlot;
+
+/* Lock-free set of (dev, ino) pairs */
+/*
+  * Lives in a separate shared mapping like the PathArena, open addressing with linear probing
+  * Entries are never removed, the set is only used for one scan
+*/
+typedef struct {
+	InodeSlot *slots; // NULL if the set isn't used
+	_Atomic size_t count;
+	_Atomic bool is_full; // Reported once, the later inodes are taken without checking
+} InodeSet;
+
+typedef struct {
+	bool is_one_filesystem;
+	size_t num_root_devices;
+	dev_t root_devices[MAX_ROOT_DEVICES];
+	InodeSet seen;
+	const ExclusionRules *exclusions; // Compiled before forking, read-only during the scan, NULL for no rule
+	const Checkpoint *checkpoint; // Loaded before forking, read-only during the scan, NULL unless resuming
+} TraversalFilter;
+
+/* Initialize the TraversalFilter, only skipping the pseudo file systems */
+void traversal_filter_init(TraversalFilter *filter);
+
+/* Clear the TraversalFilter */
+void traversal_filter_clear(TraversalFilter *filter);
+
+/* Map the seen-set of the inodes */
+/*
+  * @return
+  * `true` if the seen-set is mapped, `false` otherwise (the traversal still works, without deduplication)
+  *
+  * @warning
+  * This function MUST be called before forking, the mapping is shared with the child processes
+  * Only use it for a single scan, a taken inode is never taken again
+*/
+bool traversal_filter_enable_dedup(TraversalFilter *filter);
+
+/* Stay on the file system of `path` */
+/*
+  * @return
+  * `true` if the file system is added, `false` if `path` can't be stated or there are too many roots
+  *
+  * @note
+  * Call it for every root before the scan starts, the traversal stays on the file systems of the added roots
+*/
+bool traversal_filter_add_root(TraversalFilter *filter, const char *path);
+
+/* Check whether an opened directory should be traversed */
+/*
+  * @param dir_fd
+  * The directory, opened by the traversal
+  *
+  * @return
+  * `false` if it's on a pseudo file system, on another file system in the one-filesystem mode, or already traversed
+*/
+bool traversal_filter_enter_directory(TraversalFilter *filter, int dir_fd);
+
+/* Check whether a regular file should be scanned */
+/*
+  * @param status
+  * The `lstat()` of the file, already taken by the traversal
+  *
+  * @return
+  * `false` if it's on another file system in the one-filesystem mode, or another hard link of a taken file
+*/
+bool traversal_filter_accept_file(TraversalFilter *filter, const struct stat *status);
+
+/* Check whether an entry is excluded by the rules */
+/*
+  * @param dir
+  * The directory being traversed
+  *
+  * @param name
+  * The name of the entry in `dir`
+  *
+  * @param is_dir
+  * `true` for a directory, its whole subtree is skipped
+  *
+  * @param size
+  * The size of a regular file, 0 if it isn't known yet
+  *
+  * @return
+  * `true` if the entry should be skipped
+*/
+bool traversal_filter_is_excluded(TraversalFilter *filter, const char *dir, const char *name, bool is_dir, uint64_t size);
+
+/* Check whether a regular file was finished by the resumed scan */
+/*
+  * @return
+  * `true` if the file should be skipped
+*/
+bool traversal_filter_is_completed(TraversalFilter *filter, const char *dir, const char *name);
+
+#endif // TRAVERSAL_FILTER_H
@@ -18,6 +18,7 @@
  * SPDX-License-Identifier: GPL-3.0-or-later
 */
 
+#define _GNU_SOURCE // For `ppoll()`
 #include <string.h>
 #include <errno.h>
 #include <stdio.h>
@@ -90,6 +91,11 @@ bool observer_init(Observer *observer, size_t num_of_processes, int exit_conditi
     }
 
     observer->num_of_processes = num_of_processes;
+    observer_set_tick(observer, 0, NULL, NULL);
+    observer->mission = NULL;
+    observer->mission_args = NULL;
+    memset(observer->heartbeats, 0, sizeof(observer->heartbeats));
+    observer_set_placement(observer, NULL, 0);
 
     if (condition_signal_handler != NULL && exit_condition_signal != 0) {
         observer->exit_condition_signal = exit_condition_signal;
@@ -108,6 +114,31 @@ void observer_clear(Observer *observer) {
     observer->num_of_processes = 0;
     observer->exit_condition_signal = 0;
     observer->condition_signal_handler = NULL;
+    observer_set_tick(observer, 0, NULL, NULL);
+    observer_set_placement(observer, NULL, 0);
+}
+
+/* Call `tick` periodically while the watchdog is waiting for the processes */
+void observer_set_tick(Observer *observer, int interval_ms, tick_callback tick, void *args) {
+    if (observer == NULL) return;
+
+    bool is_enabled = interval_ms > 0 && tick != NULL;
+    observer->tick_interval_ms = is_enabled ? interval_ms : 0;
+    observer->tick = is_enabled ? tick : NULL;
+    observer->tick_args = is_enabled ? args : NULL;
+}
+
+/* Pin the processes spawned from now on */
+void observer_set_placement(Observer *observer, const CpuPlacement *placement, size_t cpu_offset) {
+    if (observer == NULL) return;
+
+    observer->placement = placement;
+    observer->placement_offset = cpu_offset;
+}
+
+/* Pin the child process before it starts the mission */
+static void place_process(Observer *observer, size_t index) {
+    if (observer->placement != NULL) cpu_placement_pin(observer->placement, index, observer->placement_offset);
 }
 
 /* Spawn a new process */
@@ -115,10 +146,10 @@ void observer_clear(Observer *observer) {
   * @param observer
   * the observer to be used for spawning the processes
   * 
-  * @param mission_callback
+  * @param mission
   * the function to be executed in the child process
   * @param mission_callback_args
-  * the arguments to be passed to the `mission_callback` [OPTIONAL]
+  * the arguments to be passed to the `mission` [OPTIONAL]
   * 
   * @return
   * `true` if the process is spawned successfully, `false` otherwise
@@ -127,9 +158,9 @@ void observer_clear(Observer *observer) {
   * This function will also try to register the signal handler which store in the `observer` struct
 */
 bool spawn_new_process(Observer *observer,
-                     mission_callback mission_callback, void *mission_callback_args) {
-    if (mission_callback == NULL || observer == NULL) {
-        fprintf(stderr, "[ERROR] spawn_new_process: Invalid arguments mission_callback=%p observer=%p\n", mission_callback, observer);
+                     mission_callback mission, void *mission_callback_args) {
+    if (mission == NULL || observer == NULL) {
+        fprintf(stderr, "[ERROR] spawn_new_process: Invalid arguments mission_callback=%p observer=%p\n", mission, observer);
         return false;
     }
 
@@ -140,6 +171,9 @@ bool spawn_new_process(Observer *observer,
         return false;
     }
 
+    observer->mission = mission;
+    observer->mission_args = mission_callback_args;
+
     /* Spawn the processes */
     for (size_t i = 0; i < observer->num_of_processes; i++) {
         pid_t *current_pid_ptr = observer->pids + i; // Get the current pid pointer
@@ -151,7 +185,8 @@ bool spawn_new_process(Observer *observer,
 
         if (*current_pid_ptr == 0) { // Child process (run the function)
             register_signal_handler(observer->exit_condition_signal, observer->condition_signal_handler); // Register the signal handler for the exit condition signal
-            mission_callback(mission_callback_args);
+            place_process(observer, i);
+            mission(mission_callback_args, i);
             _exit(0); // Exit the child process
         }
     }
@@ -159,6 +194,72 @@ bool spawn_new_process(Observer *observer,
     return true;
 }
 
+/* Check whether a process has exited, without waiting */
+bool reap_process(Observer *observer, size_t index, int *status) {
+    if (observer == NULL || index >= observer->num_of_processes || observer->pids[index] <= 0) return false;
+
+    int wait_status;
+    if (waitpid(observer->pids[index], &wait_status, WNOHANG) != observer->pids[index]) return false;
+
+    observer->pids[index] = 0;
+    if (status != NULL) *status = wait_status;
+    return true;
+}
+
+/* Stop a process and wait until it's stopped */
+bool stop_process(Observer *observer, size_t index) {
+    if (observer == NULL || index >= observer->num_of_processes || observer->pids[index] <= 0) return false;
+    if (kill(observer->pids[index], SIGSTOP) != 0) return false;
+
+    siginfo_t info;
+    info.si_pid = 0;
+    while (waitid(P_PID, (id_t)observer->pids[index], &info, WSTOPPED | WEXITED | WNOWAIT) == -1 && errno == EINTR); // Left waitable for `reap_process()`
+    return info.si_pid == observer->pids[index] && info.si_code == CLD_STOPPED;
+}
+
+/* Let a process stopped by `stop_process()` continue */
+void continue_process(Observer *observer, size_t index) {
+    if (observer == NULL || index >= observer->num_of_processes || observer->pids[index] <= 0) return;
+
+    kill(observer->pids[index], SIGCONT);
+}
+
+/* Kill a process immediately and wait for it to exit */
+void kill_process(Observer *observer, size_t index) {
+    if (observer == NULL || index >= observer->num_of_processes || observer->pids[index] <= 0) return;
+
+    kill(observer->pids[index], SIGKILL);
+    while (waitpid(observer->pids[index], NULL, 0) == -1 && errno == EINTR);
+    observer->pids[index] = 0;
+}
+
+/* Spawn a new process in the place of an exited one */
+bool respawn_process(Observer *observer, size_t index) {
+    if (observer == NULL || index >= observer->num_of_processes || observer->mission == NULL || observer->pids[index] > 0) return false;
+
+    atomic_store(&observer->heartbeats[index].busy_since_ns, 0);
+    fflush(stdout); // Don't let the child inherit the pending output
+
+    pid_t pid = fork();
+    if (pid == -1) {
+        fprintf(stderr, "[ERROR] respawn_process: Failed to fork process: %s\n", strerror(errno));
+        return false;
+    }
+
+    if (pid == 0) {
+        sigset_t empty_mask;
+        sigemptyset(&empty_mask);
+        sigprocmask(SIG_SETMASK, &empty_mask, NULL); // The watchdog forks with the termination signals blocked
+        register_signal_handler(observer->exit_condition_signal, observer->condition_signal_handler);
+        place_process(observer, index); // The same CPU as the replaced process
+        observer->mission(observer->mission_args, index);
+        _exit(0);
+    }
+
+    observer->pids[index] = pid;
+    return true;
+}
+
 /* Notify the watchdog that the child process has finished */
 /*
   * @param observer
@@ -187,17 +288,14 @@ static bool get_message_from_pipe(int *pipe_fd) {
 } 
 
 /* Send the signal to the target process to exit */
-static void send_signal_to_all_processes(Observer *observer) {
+void send_signal_to_all_processes(Observer *observer) {
 	if (observer == NULL || observer->exit_condition_signal <= 0) return; // No need to send the signal if there is no exit condition signal
 
 	for (size_t i = 0; i < observer->num_of_processes; i++) {
 		if (observer->pids[i] == 0) continue; // Skip the invaild pid (0)
 
         kill(observer->pids[i], observer->exit_condition_signal); // Send the exit condition signal to the child process
-        if (waitpid(observer->pids[i], NULL, WNOHANG) == 0) {
-            i -= 1; // The child process is still running, keep this index for the next iteration
-            continue;
-        }
+        while (waitpid(observer->pids[i], NULL, 0) == -1 && errno == EINTR); // Wait for the child process to exit instead of spinning
 
         observer->pids[i] = 0; // Set the pid to 0 to indicate that the child process has been terminated
 	}
@@ -210,6 +308,9 @@ static void send_signal_to_all_processes(Observer *observer) {
   * The observer object to be check
   * @param current_status
   * The current status of the scanning process, if `STATUS_FORCE_QUIT` is set, the scanning process will be terminated immediately
+  *
+  * @note
+  * The watchdog sleeps until the child processes notify it or a signal (e.g. `SIGINT`) arrives, so it does not use any CPU while waiting
 */
 void watchdog_main(Observer *observer, _Atomic CurrentStatus *current_status, CurrentStatus target_status) {
     if (observer == NULL || current_status == NULL) return; // Skip invalid parameters
@@ -219,10 +320,21 @@ void watchdog_main(Observer *observer, _Atomic CurrentStatus *current_status, Cu
        .events = POLLIN,
     };
 
-    int timeout = 100; // 100ms timeout for the poll function
+    /* Block the termination signals while checking the status, `ppoll()` unblocks them atomically so no signal can be missed */
+    sigset_t blocked_mask, orig_mask;
+    sigemptyset(&blocked_mask);
+    sigaddset(&blocked_mask, SIGINT);
+    sigaddset(&blocked_mask, SIGTERM);
+    sigprocmask(SIG_BLOCK, &blocked_mask, &orig_mask);
+
+    struct timespec tick_interval = {
+        .tv_sec = observer->tick_interval_ms / 1000,
+        .tv_nsec = (long)(observer->tick_interval_ms % 1000) * 1000000,
+    };
+    const struct timespec *timeout = observer->tick != NULL ? &tick_interval : NULL; // Sleep until notified if there is no tick
 
     while (get_status(current_status) < target_status) {
-        int poll_result = poll(&fds, 1, timeout);
+        int poll_result = ppoll(&fds, 1, timeout, &orig_mask);
 
         if (poll_result == -1 && errno != EINTR) {
             fprintf(stderr, "[ERROR] watchdog_main: Failed to poll the pipe: %s\n", strerror(errno));
@@ -230,9 +342,12 @@ void watchdog_main(Observer *observer, _Atomic CurrentStatus *current_status, Cu
             close(observer->pipe_fd[1]); // close the write end of the pipe
             break;
         }
-        else if (poll_result == 0) continue; // Timeout, continue the loop
+        else if (poll_result == 0) observer->tick(observer->tick_args); // Timed out, only possible with a tick
         else if (poll_result > 0 && get_message_from_pipe(observer->pipe_fd)) break; // Message received, break the loop
+        // Otherwise interrupted by a signal, recheck the status
     }
 
+    sigprocmask(SIG_SETMASK, &orig_mask, NULL); // Restore the signal mask
+
     send_signal_to_all_processes(observer); // Send the exit condition signal to all the child processes
 }
\ No newline at end of file
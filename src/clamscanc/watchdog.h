@@ -22,14 +22,19 @@
 #define WATCHDOG_H
 
 #include <stdbool.h>
+#include <stdint.h>
 #include <signal.h>
+#include <time.h>
 #include <sys/types.h>
 #include <stdatomic.h>
 
+#include "placement.h"
+
 #define MAX_PROCESSES 64 // maximum number of processes can be used for scanning
 
-typedef void (*mission_callback)(void *args); // The mission callback function type
+typedef void (*mission_callback)(void *args, size_t process_index); // The mission callback function type, `process_index` is the index of the process in its observer
 typedef void (*signal_handler)(int signal); // The signal handler callback function type
+typedef void (*tick_callback)(void *args); // Called periodically by the watchdog
 
 /* Current status */
 /*
@@ -61,6 +66,37 @@ void set_status(_Atomic CurrentStatus *status, CurrentStatus new_status);
 */
 void register_signal_handler(int signal, signal_handler handler);
 
+/* Heartbeat of a child process */
+/*
+  * The child marks the start and the end of each unit of work (a `cl_scandesc()` call for the workers), the parent reads it
+  * `busy_since_ns` is the `CLOCK_MONOTONIC` time the current unit started, 0 while the child is between the units
+  * `beats` counts the finished units
+*/
+typedef struct {
+    _Atomic uint64_t busy_since_ns;
+    _Atomic uint64_t beats;
+} ProcessHeartbeat;
+
+/* Get the `CLOCK_MONOTONIC` time in nanoseconds */
+static inline uint64_t monotonic_ns(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000ULL + (uint64_t)now.tv_nsec;
+}
+
+/* Mark the start of a unit of work */
+static inline void process_heartbeat_begin(ProcessHeartbeat *heartbeat) {
+    if (heartbeat != NULL) atomic_store_explicit(&heartbeat->busy_since_ns, monotonic_ns(), memory_order_release);
+}
+
+/* Mark the end of a unit of work */
+static inline void process_heartbeat_end(ProcessHeartbeat *heartbeat) {
+    if (heartbeat == NULL) return;
+
+    atomic_store_explicit(&heartbeat->busy_since_ns, 0, memory_order_release);
+    atomic_fetch_add_explicit(&heartbeat->beats, 1, memory_order_relaxed);
+}
+
 /* Observer */
 /*
   * `num_of_processes` is the number of processes to be created
@@ -69,6 +105,10 @@ void register_signal_handler(int signal, signal_handler handler);
   * `pipe_fd` is the pipe file descriptor for watchdog to communicate with the parent process
   * `exit_condition_signal` is the signal to be sent to the processes to exit
   * `condition_signal_handler` is the signal handler for the exit condition signal
+  * `tick` is called every `tick_interval_ms` while the watchdog is waiting [OPTIONAL]
+  * `mission` is kept so a single process can be replaced by `respawn_process()`
+  * `heartbeats` has a slot per process, it's only visible to the parent if the Observer lives in shared memory
+  * `placement` pins the process `i` to the CPU of the slot `i` when it's spawned, see `placement.h` [OPTIONAL]
 */
 typedef struct {
     size_t num_of_processes;
@@ -78,6 +118,21 @@ typedef struct {
     int pipe_fd[2];
     int exit_condition_signal;
     signal_handler condition_signal_handler;
+
+    /* The periodic callback */
+    int tick_interval_ms;
+    tick_callback tick;
+    void *tick_args;
+
+    /* The mission of the processes */
+    mission_callback mission;
+    void *mission_args;
+
+    ProcessHeartbeat heartbeats[MAX_PROCESSES];
+
+    /* The CPUs of the processes */
+    const CpuPlacement *placement;
+    size_t placement_offset;
 } Observer;
 
 /* Initialize the observer */
@@ -98,15 +153,35 @@ bool observer_init(Observer *observer, size_t num_of_processes, int exit_conditi
 /* Clear the observer */
 void observer_clear(Observer *observer);
 
+/* Call `tick` periodically while the watchdog is waiting for the processes */
+/*
+  * @param interval_ms
+  * The interval between the calls, 0 to stop calling
+  *
+  * @note
+  * `tick` is called by the parent process with the termination signals blocked, so keep it short
+*/
+void observer_set_tick(Observer *observer, int interval_ms, tick_callback tick, void *args);
+
+/* Pin the processes spawned from now on */
+/*
+  * @param placement
+  * The CPUs to pin the processes to, NULL to let them run anywhere, it must outlive the observer
+  *
+  * @param cpu_offset
+  * The CPUs of each node taken by another observer, see `cpu_placement_pin()`
+*/
+void observer_set_placement(Observer *observer, const CpuPlacement *placement, size_t cpu_offset);
+
 /* Spawn a new process */
 /*
   * @param observer
   * the observer to be used for spawning the processes
   * 
-  * @param mission_callback
+  * @param mission
   * the function to be executed in the child process
   * @param mission_callback_args
-  * the arguments to be passed to the `mission_callback` [OPTIONAL]
+  * the arguments to be passed to the `mission` [OPTIONAL]
   * 
   * @return
   * `true` if the process is spawned successfully, `false` otherwise
@@ -115,7 +190,57 @@ void observer_clear(Observer *observer);
   * This function will also try to register the signal handler which store in the `observer` struct
 */
 bool spawn_new_process(Observer *observer,
-                    mission_callback mission_callback, void *mission_callback_args);
+                    mission_callback mission, void *mission_callback_args);
+
+/* Check whether a process has exited, without waiting */
+/*
+  * @param status
+  * The wait status of the exited process [OUT]
+  *
+  * @return
+  * `true` if the process has exited and is reaped, its pid is set to 0
+*/
+bool reap_process(Observer *observer, size_t index, int *status);
+
+/* Stop a process and wait until it's stopped */
+/*
+  * @note
+  * Used to check the state of a process in the shared memory while it can't change it
+  *
+  * @return
+  * `false` if the process can't be stopped or has exited in between (it's still to be reaped)
+*/
+bool stop_process(Observer *observer, size_t index);
+
+/* Let a process stopped by `stop_process()` continue */
+void continue_process(Observer *observer, size_t index);
+
+/* Kill a process immediately and wait for it to exit */
+/*
+  * @note
+  * `SIGKILL` is used since a stuck process may never return to the point where it handles the exit condition signal
+*/
+void kill_process(Observer *observer, size_t index);
+
+/* Spawn a new process in the place of an exited one */
+/*
+  * @return
+  * `true` if the process is spawned, `false` if forking failed or `spawn_new_process()` was never called
+  *
+  * @warning
+  * The old process MUST have been reaped, see `reap_process()` and `kill_process()`
+*/
+bool respawn_process(Observer *observer, size_t index);
+
+/* Send the exit condition signal to all the processes and wait for them to exit */
+/*
+  * @param observer
+  * The observer whose processes are terminated, the processes can be spawned again with `spawn_new_process()`
+  *
+  * @warning
+  * This function should be called in the main process (parent process)
+*/
+void send_signal_to_all_processes(Observer *observer);
 
 /* Notify the watchdog that the child process has finished */
 /*
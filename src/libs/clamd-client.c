@@ -0,0 +1,458 @@
+/* clamd-client.c
+ *
+ * Copyright 2025 EricLin
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+/* A native client of the ClamAV daemon */
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/stat.h>
+
+#include "clamd-client.h"
+
+#define CLAMD_DEFAULT_SOCKET "/var/run/clamav/clamd.ctl"
+#define CLAMD_DEFAULT_MAX_THREADS 10 // Same as clamd
+#define CLAMD_REPLY_SIZE 4096
+
+/* The commands are prefixed with 'z' so they are terminated by '\0', and so are the replies */
+#define CLAMD_COMMAND_SESSION "zIDSESSION"
+#define CLAMD_COMMAND_FILDES "zFILDES"
+#define CLAMD_COMMAND_END "zEND"
+
+static const char *clamd_config_paths[] = {
+    "/etc/clamav/clamd.conf", // Debian, Ubuntu, Arch
+    "/etc/clamd.d/scan.conf", // Fedora
+    NULL
+};
+
+typedef enum {
+    CLAMD_REPLY_CLEAN,
+    CLAMD_REPLY_FOUND,
+    CLAMD_REPLY_FILE_ERROR, // The file can't be scanned, the session is still usable
+    CLAMD_REPLY_INVALID // The session is broken
+} ClamdReply;
+
+typedef struct ClamdConnection {
+    ClamdClient *client;
+    int sockfd;
+    GThread *thread;
+    char reply[CLAMD_REPLY_SIZE];
+} ClamdConnection;
+
+struct ClamdClient {
+    /* Protected by mutex */
+    GMutex mutex;
+    GCond not_empty; // Signaled when a file is pushed or the input is finished
+    GCond not_full; // Signaled when a file is taken or a connection is finished
+    GQueue queue; // The files waiting to be scanned, shared by all connections
+    gboolean is_input_finished;
+    gboolean is_cancelled;
+    gboolean has_failed; // A connection was lost before the input is finished
+    guint active_connections;
+
+    /* No need to protect these fields because they always same after initialize */
+    ClamdConnection connections[CLAMD_CLIENT_MAX_CONNECTIONS];
+    guint num_connections;
+    ClamdResultCallback callback;
+    gpointer user_data;
+};
+
+/* Read `LocalSocket` and `MaxThreads` from the clamd configuration */
+static void
+read_clamd_config(char **socket_path, guint *max_threads)
+{
+    *socket_path = NULL;
+    *max_threads = CLAMD_DEFAULT_MAX_THREADS;
+
+    for (int i = 0; clamd_config_paths[i] != NULL; i++)
+    {
+        FILE *config = fopen(clamd_config_paths[i], "r");
+        if (config == NULL) continue;
+
+        char line[512];
+        while (fgets(line, sizeof(line), config) != NULL)
+        {
+            g_strstrip(line);
+            if (line[0] == '#') continue; // Comment
+
+            if (g_str_has_prefix(line, "LocalSocket ") && *socket_path == NULL)
+            {
+                *socket_path = g_strdup(g_strchug(line + strlen("LocalSocket ")));
+            }
+            else if (g_str_has_prefix(line, "MaxThreads "))
+            {
+                guint64 value = g_ascii_strtoull(line + strlen("MaxThreads "), NULL, 10);
+                if (value > 0) *max_threads = (guint)MIN(value, G_MAXUINT);
+            }
+        }
+
+        fclose(config);
+        break; // Only read the first configuration found
+    }
+
+    if (*socket_path == NULL) *socket_path = g_strdup(CLAMD_DEFAULT_SOCKET);
+}
+
+/* Connect to the clamd socket */
+static int
+connect_clamd(const char *socket_path)
+{
+    struct sockaddr_un address = { .sun_family = AF_UNIX };
+    if (strlen(socket_path) >= sizeof(address.sun_path)) return -1;
+    strcpy(address.sun_path, socket_path);
+
+    int sockfd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (sockfd == -1) return -1;
+
+    if (connect(sockfd, (struct sockaddr *)&address, sizeof(address)) == -1 ||
+        send(sockfd, CLAMD_COMMAND_SESSION, sizeof(CLAMD_COMMAND_SESSION), MSG_NOSIGNAL) != sizeof(CLAMD_COMMAND_SESSION))
+    {
+        close(sockfd);
+        return -1;
+    }
+
+    return sockfd;
+}
+
+/* Send the `FILDES` command with the fd attached */
+static gboolean
+send_file_descriptor(int sockfd, int fd)
+{
+    char command[] = CLAMD_COMMAND_FILDES;
+    struct iovec iov = { .iov_base = command, .iov_len = sizeof(command) };
+
+    union {
+        char buffer[CMSG_SPACE(sizeof(int))];
+        struct cmsghdr align;
+    } control;
+    memset(&control, 0, sizeof(control));
+
+    struct msghdr message = {
+        .msg_iov = &iov,
+        .msg_iovlen = 1,
+        .msg_control = control.buffer,
+        .msg_controllen = sizeof(control.buffer),
+    };
+
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&message);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+
+    ssize_t sent;
+    while ((sent = sendmsg(sockfd, &message, MSG_NOSIGNAL)) == -1 && errno == EINTR);
+
+    return sent == (ssize_t)sizeof(command);
+}
+
+/* Receive a reply terminated by '\0' */
+static gboolean
+receive_reply(ClamdConnection *connection)
+{
+    size_t length = 0;
+
+    while (length < sizeof(connection->reply))
+    {
+        ssize_t n = recv(connection->sockfd, connection->reply + length, sizeof(connection->reply) - length, 0);
+        if (n == -1 && errno == EINTR) continue;
+        if (n <= 0) return FALSE; // Closed by clamd or by `clamd_client_cancel()`
+
+        /* Only one command is in flight, so the reply always ends at the end of the received data */
+        length += n;
+        if (connection->reply[length - 1] == '\0') return TRUE;
+    }
+
+    return FALSE; // The reply is too long
+}
+
+/* Parse a reply like "1: fd[10]: Eicar-Signature FOUND" */
+// virname: point into the reply if it's `CLAMD_REPLY_FOUND`
+static ClamdReply
+parse_reply(char *reply, const char **virname)
+{
+    char *result = reply;
+    char *separator = NULL;
+
+    if ((separator = strstr(result, ": ")) == NULL) return CLAMD_REPLY_INVALID; // Not a reply of the session (e.g. "UNKNOWN COMMAND")
+    result = separator + 2; // Skip the request id
+
+    if (g_str_has_prefix(result, "fd[") && (separator = strstr(result, "]: ")) != NULL) result = separator + 3; // Skip the fd
+
+    if (g_str_has_suffix(result, " FOUND"))
+    {
+        result[strlen(result) - strlen(" FOUND")] = '\0';
+        *virname = result;
+        return CLAMD_REPLY_FOUND;
+    }
+
+    if (strcmp(result, "OK") == 0) return CLAMD_REPLY_CLEAN;
+
+    if (g_str_has_suffix(result, " ERROR")) return CLAMD_REPLY_FILE_ERROR;
+
+    return CLAMD_REPLY_INVALID;
+}
+
+/* Take a file from the queue, NULL if there is no more file */
+static char *
+clamd_client_pop(ClamdClient *client)
+{
+    g_mutex_lock(&client->mutex);
+
+    while (g_queue_is_empty(&client->queue) && !client->is_input_finished && !client->is_cancelled)
+    {
+        g_cond_wait(&client->not_empty, &client->mutex);
+    }
+
+    char *path = client->is_cancelled ? NULL : g_queue_pop_head(&client->queue);
+    if (path != NULL) g_cond_signal(&client->not_full);
+
+    g_mutex_unlock(&client->mutex);
+
+    return path;
+}
+
+static gpointer
+clamd_connection_thread(gpointer user_data)
+{
+    ClamdConnection *connection = user_data;
+    ClamdClient *client = connection->client;
+    gboolean is_broken = FALSE;
+
+    char *path;
+    while ((path = clamd_client_pop(client)) != NULL)
+    {
+        int fd = open(path, O_RDONLY | O_NOCTTY | O_CLOEXEC);
+        if (fd == -1) // Same as clamdscan, the files that can't be opened are skipped
+        {
+            g_debug("[INFO] Cannot open %s: %s", path, strerror(errno));
+            g_free(path);
+            continue;
+        }
+
+        struct stat st;
+        const guint64 size = (fstat(fd, &st) == 0) ? (guint64)st.st_size : 0; // Only for the progress
+
+        gboolean is_sent = send_file_descriptor(connection->sockfd, fd);
+        close(fd); // clamd has its own copy now
+
+        const char *virname = NULL;
+        ClamdReply reply = (is_sent && receive_reply(connection)) ? parse_reply(connection->reply, &virname) : CLAMD_REPLY_INVALID;
+        switch (reply)
+        {
+            case CLAMD_REPLY_CLEAN:
+                client->callback(path, NULL, FALSE, size, client->user_data);
+                break;
+            case CLAMD_REPLY_FOUND:
+                client->callback(path, virname, TRUE, size, client->user_data);
+                break;
+            case CLAMD_REPLY_FILE_ERROR:
+                g_debug("[INFO] clamd cannot scan %s: %s", path, connection->reply);
+                break;
+            case CLAMD_REPLY_INVALID:
+            default:
+                is_broken = TRUE;
+                break;
+        }
+
+        g_free(path);
+        if (is_broken) break;
+    }
+
+    if (!is_broken) send(connection->sockfd, CLAMD_COMMAND_END, sizeof(CLAMD_COMMAND_END), MSG_NOSIGNAL);
+
+    g_mutex_lock(&client->mutex);
+    if (is_broken && !client->is_cancelled)
+    {
+        g_warning("[WARNING] Lost a connection to clamd");
+        client->has_failed = TRUE;
+    }
+    client->active_connections--;
+    g_cond_broadcast(&client->not_full); // Let `clamd_client_push()` know if there is no connection left
+    g_mutex_unlock(&client->mutex);
+
+    return NULL;
+}
+
+/* Connect to the ClamAV daemon */
+/*
+  * The socket and the number of connections are read from the clamd configuration (`LocalSocket` and `MaxThreads`)
+  * @return
+  * the new client, or NULL if the daemon can't be reached through a local socket
+*/
+ClamdClient *
+clamd_client_new(ClamdResultCallback callback, gpointer user_data)
+{
+    g_return_val_if_fail(callback != NULL, NULL);
+
+    g_autofree char *socket_path = NULL;
+    guint max_threads = 0;
+    read_clamd_config(&socket_path, &max_threads);
+
+    /* One connection per clamd thread, so every thread is kept busy */
+    const guint num_connections = CLAMP(max_threads, 1, CLAMD_CLIENT_MAX_CONNECTIONS);
+
+    ClamdClient *client = g_new0(ClamdClient, 1);
+    g_mutex_init(&client->mutex);
+    g_cond_init(&client->not_empty);
+    g_cond_init(&client->not_full);
+    g_queue_init(&client->queue);
+    client->callback = callback;
+    client->user_data = user_data;
+
+    for (guint i = 0; i < num_connections; i++)
+    {
+        int sockfd = connect_clamd(socket_path);
+        if (sockfd == -1) break; // Use the connections already made
+
+        client->connections[i].client = client;
+        client->connections[i].sockfd = sockfd;
+        client->num_connections++;
+    }
+
+    if (client->num_connections == 0)
+    {
+        g_message("[INFO] Cannot connect to clamd at %s: %s", socket_path, strerror(errno));
+        clamd_client_free(client);
+        return NULL;
+    }
+
+    client->active_connections = client->num_connections;
+    for (guint i = 0; i < client->num_connections; i++)
+    {
+        client->connections[i].thread = g_thread_new("clamd-connection", clamd_connection_thread, &client->connections[i]);
+    }
+
+    g_debug("[INFO] Connected to clamd at %s with %u connections", socket_path, client->num_connections);
+
+    return client;
+}
+
+/* Add a file to be scanned */
+gboolean
+clamd_client_push(ClamdClient *client, char *path)
+{
+    g_return_val_if_fail(client != NULL && path != NULL, FALSE);
+
+    g_mutex_lock(&client->mutex);
+
+    while (g_queue_get_length(&client->queue) >= CLAMD_CLIENT_QUEUE_SIZE &&
+           !client->is_cancelled && client->active_connections > 0)
+    {
+        g_cond_wait(&client->not_full, &client->mutex);
+    }
+
+    gboolean is_accepted = !client->is_cancelled && client->active_connections > 0;
+    if (is_accepted)
+    {
+        g_queue_push_tail(&client->queue, path);
+        g_cond_signal(&client->not_empty);
+    }
+
+    g_mutex_unlock(&client->mutex);
+
+    if (!is_accepted) g_free(path);
+
+    return is_accepted;
+}
+
+/* Tell the client no more files will be pushed */
+void
+clamd_client_finish_input(ClamdClient *client)
+{
+    g_return_if_fail(client != NULL);
+
+    g_mutex_lock(&client->mutex);
+    client->is_input_finished = TRUE;
+    g_cond_broadcast(&client->not_empty);
+    g_mutex_unlock(&client->mutex);
+}
+
+/* Stop scanning, the waiting files are dropped */
+void
+clamd_client_cancel(ClamdClient *client)
+{
+    g_return_if_fail(client != NULL);
+
+    g_mutex_lock(&client->mutex);
+    client->is_cancelled = TRUE;
+    g_queue_clear_full(&client->queue, g_free);
+    g_cond_broadcast(&client->not_empty);
+    g_cond_broadcast(&client->not_full);
+    g_mutex_unlock(&client->mutex);
+
+    /* Wake up the connections waiting for a reply, the sockets are closed by `clamd_client_free()` */
+    for (guint i = 0; i < client->num_connections; i++)
+    {
+        shutdown(client->connections[i].sockfd, SHUT_RDWR);
+    }
+}
+
+/* Whether all the connections are finished */
+gboolean
+clamd_client_is_finished(ClamdClient *client)
+{
+    g_return_val_if_fail(client != NULL, TRUE);
+
+    g_mutex_lock(&client->mutex);
+    gboolean is_finished = client->active_connections == 0;
+    g_mutex_unlock(&client->mutex);
+
+    return is_finished;
+}
+
+/* Whether all the files are scanned without losing any connection */
+gboolean
+clamd_client_is_success(ClamdClient *client)
+{
+    g_return_val_if_fail(client != NULL, FALSE);
+
+    g_mutex_lock(&client->mutex);
+    gboolean is_success = !client->has_failed && !client->is_cancelled;
+    g_mutex_unlock(&client->mutex);
+
+    return is_success;
+}
+
+/* Close the connections and free the client */
+void
+clamd_client_free(ClamdClient *client)
+{
+    g_return_if_fail(client != NULL);
+
+    if (!clamd_client_is_finished(client)) clamd_client_cancel(client);
+
+    for (guint i = 0; i < client->num_connections; i++)
+    {
+        g_clear_pointer(&client->connections[i].thread, g_thread_join);
+        close(client->connections[i].sockfd);
+    }
+
+    g_queue_clear_full(&client->queue, g_free);
+    g_cond_clear(&client->not_full);
+    g_cond_clear(&client->not_empty);
+    g_mutex_clear(&client->mutex);
+
+    g_free(client);
+}
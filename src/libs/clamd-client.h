@@ -0,0 +1,85 @@
+/* clamd-client.h
+ *
+ * Copyright 2025 EricLin
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+/* A native client of the ClamAV daemon */
+/*
+  * The files are shared by several connections to the clamd socket, so clamd scans them in parallel
+  * The files are passed by fd (`FILDES`), so clamd can scan the files it has no permission to open
+*/
+
+#pragma once
+
+#include <glib.h>
+
+#define CLAMD_CLIENT_MAX_CONNECTIONS 32
+#define CLAMD_CLIENT_QUEUE_SIZE 4096 // `clamd_client_push()` blocks when this many files are waiting
+
+typedef struct ClamdClient ClamdClient;
+
+/* Called for each scanned file */
+/*
+  * path: the scanned file
+  * virname: the signature name if `is_threat` is TRUE, otherwise NULL
+  * size: the size of the file, 0 if unknown
+  * user_data: the data passed to `clamd_client_new()`
+  * @warning
+  * This is called by the connection threads, not by the main thread
+*/
+typedef void (*ClamdResultCallback)(const char *path, const char *virname, gboolean is_threat, guint64 size, gpointer user_data);
+
+/* Connect to the ClamAV daemon */
+/*
+  * The socket and the number of connections are read from the clamd configuration (`LocalSocket` and `MaxThreads`)
+  * @return
+  * the new client, or NULL if the daemon can't be reached through a local socket
+*/
+ClamdClient *
+clamd_client_new(ClamdResultCallback callback, gpointer user_data);
+
+/* Add a file to be scanned */
+/*
+  * path: the file to scan, the client takes the ownership
+  * @return
+  * FALSE if the client can't accept more files (cancelled or all connections are lost)
+  * @note
+  * This blocks while `CLAMD_CLIENT_QUEUE_SIZE` files are waiting, so the producer never runs far ahead
+*/
+gboolean
+clamd_client_push(ClamdClient *client, char *path);
+
+/* Tell the client no more files will be pushed */
+void
+clamd_client_finish_input(ClamdClient *client);
+
+/* Stop scanning, the waiting files are dropped */
+void
+clamd_client_cancel(ClamdClient *client);
+
+/* Whether all the connections are finished */
+gboolean
+clamd_client_is_finished(ClamdClient *client);
+
+/* Whether all the files are scanned without losing any connection */
+gboolean
+clamd_client_is_success(ClamdClient *client);
+
+/* Close the connections and free the client */
+void
+clamd_client_free(ClamdClient *client);
@@ -21,6 +21,7 @@
  /* This file contains the implementation of the delete-file action */
 
 #include <glib/gi18n.h>
+#include <string.h>
 #include <syslog.h>
 #include <inttypes.h>
 #include <fcntl.h>
@@ -35,106 +36,198 @@
 #include "subprocess-components.h"
 
 #define PKEXEC_PATH "/usr/bin/pkexec" // Path to the `pkexec` binary
+#define ELEVATED_ARENA_MIN_CAPACITY 64 // Slots of the elevated arena
+#define ELEVATED_ARENA_PATH_SIZE 256 // Average bytes reserved for a path in the elevated arena
+#define DIR_FD_CACHE_MAX 512 // Keep far below the usual `RLIMIT_NOFILE` (1024), the other directories are opened on demand
 
-typedef struct DeleteFileData {
-    const char *path;
-    GtkWidget *expander_row;
+/* Directory fd cache */
+/*
+  * The threats usually cluster in a few directories, so the directories are opened once and shared by their threats
+  * An entry is referenced by each `DeleteFileData` in the directory, so the fds are kept open while the threats are listed
+  * The snapshots and the deletes are taken through the fd, a hit only checks that the path still points to the same directory
+*/
+typedef struct {
+    dev_t dev;
+    ino_t ino;
+    int fd; // Opened by `file_security_open_dir()`
+    guint ref_count;
+    char *dir_name; // The path used for finding the entry
+} DirFdEntry;
+
+static GMutex dir_fd_cache_mutex;
+static GHashTable *dir_fd_by_path; // `dir_name` -> DirFdEntry, the latest entry of each path
+static GHashTable *dir_fd_by_inode; // (dev, ino) -> DirFdEntry
+
+static guint
+dir_fd_entry_hash(gconstpointer key)
+{
+    const DirFdEntry *entry = key;
 
-    FileSecurityContext *security_context; // Security context for the file
-} DeleteFileData; // Data structure to store the information of a file to be deleted
+    const guint64 ino = entry->ino;
 
-/* Clear the delete file data structure */
-// Tips: this also clears the security context for the file
-static void
-delete_file_data_clear(DeleteFileData **data)
+    return (guint)(ino ^ (ino >> 32)) ^ (guint)entry->dev;
+}
+
+static gboolean
+dir_fd_entry_equal(gconstpointer a, gconstpointer b)
+{
+    const DirFdEntry *entry_a = a;
+    const DirFdEntry *entry_b = b;
+
+    return entry_a->dev == entry_b->dev && entry_a->ino == entry_b->ino;
+}
+
+/* Get the entry of the directory, call `dir_fd_cache_release()` when it's no longer used */
+// @return NULL if the directory can't be opened or the cache is full
+static DirFdEntry *
+dir_fd_cache_acquire(const char *dir_name)
 {
-    g_return_if_fail(data != NULL && *data != NULL);
+    struct stat dir_stat;
+    DirFdEntry *entry = NULL;
+
+    g_mutex_lock(&dir_fd_cache_mutex);
 
-    g_clear_pointer((void **)(&(*data)->path), g_free);
-    g_free(*data);
+    if (dir_fd_by_path == NULL)
+    {
+        dir_fd_by_path = g_hash_table_new(g_str_hash, g_str_equal);
+        dir_fd_by_inode = g_hash_table_new(dir_fd_entry_hash, dir_fd_entry_equal);
+    }
+
+    /* The path may point to another directory now, then it's a miss */
+    entry = g_hash_table_lookup(dir_fd_by_path, dir_name);
+    if (entry != NULL &&
+        fstatat(AT_FDCWD, dir_name, &dir_stat, AT_SYMLINK_NOFOLLOW) == 0 &&
+        dir_stat.st_dev == entry->dev && dir_stat.st_ino == entry->ino)
+    {
+        entry->ref_count++;
+        g_mutex_unlock(&dir_fd_cache_mutex);
+        return entry;
+    }
+
+    int fd = file_security_open_dir(dir_name);
+    if (fd == -1 || fstat(fd, &dir_stat) == -1)
+    {
+        if (fd != -1) close(fd);
+        g_mutex_unlock(&dir_fd_cache_mutex);
+        return NULL;
+    }
+
+    /* Reached by another path (e.g. a bind mount), share the same fd */
+    const DirFdEntry key = { .dev = dir_stat.st_dev, .ino = dir_stat.st_ino };
+    entry = g_hash_table_lookup(dir_fd_by_inode, &key);
+    if (entry != NULL)
+    {
+        close(fd);
+        entry->ref_count++;
+        g_mutex_unlock(&dir_fd_cache_mutex);
+        return entry;
+    }
 
-    *data = NULL;
+    if (g_hash_table_size(dir_fd_by_inode) >= DIR_FD_CACHE_MAX)
+    {
+        close(fd);
+        g_mutex_unlock(&dir_fd_cache_mutex);
+        return NULL;
+    }
+
+    entry = g_new0(DirFdEntry, 1);
+    entry->dev = dir_stat.st_dev;
+    entry->ino = dir_stat.st_ino;
+    entry->fd = fd;
+    entry->ref_count = 1;
+    entry->dir_name = g_strdup(dir_name);
+
+    g_hash_table_insert(dir_fd_by_inode, entry, entry);
+    g_hash_table_replace(dir_fd_by_path, entry->dir_name, entry); // Replace the entry of the old directory at this path, the key too since the old entry frees its name
+
+    g_mutex_unlock(&dir_fd_cache_mutex);
+
+    return entry;
 }
 
-/* The GDestroyNotify function to clear the DeleteFileData structure */
-static inline void
-clear_hash_table_element(gpointer data)
+static void
+dir_fd_cache_release(DirFdEntry *entry)
 {
-    DeleteFileData *delete_file_data = (DeleteFileData *)data;
+    g_mutex_lock(&dir_fd_cache_mutex);
 
-    if (!delete_file_data) return; // Check if the data is valid
+    if (--entry->ref_count > 0)
+    {
+        g_mutex_unlock(&dir_fd_cache_mutex);
+        return;
+    }
+
+    g_hash_table_remove(dir_fd_by_inode, entry);
+    if (g_hash_table_lookup(dir_fd_by_path, entry->dir_name) == entry) g_hash_table_remove(dir_fd_by_path, entry->dir_name);
 
-    delete_file_data_clear(&delete_file_data);
+    g_mutex_unlock(&dir_fd_cache_mutex);
+
+    close(entry->fd);
+    g_free(entry->dir_name);
+    g_free(entry);
 }
 
-/* Create a new delete file data structure hash table */
-GHashTable *
-delete_file_data_table_new(void)
+typedef struct DeleteFileData {
+    char *path;
+    const char *file_name; // Points into `path`
+    DirFdEntry *dir; // The directory of the file, NULL if not cached, then the path is resolved again when deleting
+
+    FileSecurityContext *security_context; // Security context for the file
+} DeleteFileData; // Data structure to store the information of a file to be deleted
+
+/* Free the delete file data structure */
+// Tips: this also clears the security context for the file
+void
+delete_file_data_free(DeleteFileData *data)
 {
-        return g_hash_table_new_full(
-                            g_direct_hash,
-                            g_direct_equal,
-                            NULL,
-                            (GDestroyNotify) clear_hash_table_element);
+    g_return_if_fail(data != NULL);
+
+    if (data->security_context) file_security_context_clear(&data->security_context, NULL, NULL);
+    g_clear_pointer(&data->dir, dir_fd_cache_release);
+    g_clear_pointer(&data->path, g_free);
+    g_free(data);
 }
 
 /* Create a new delete file data structure */
-// Tips: this also creates a new security context for the file
-// @warning the `path` string must be malloced
-static DeleteFileData *
-delete_file_data_new(const char *path, GtkWidget *expander_row)
+// Tips: this also creates a new security context for the file, so it should be created as soon as the threat is found
+// @return NULL if the security context can't be created
+DeleteFileData *
+delete_file_data_new(const char *path)
 {
     g_return_val_if_fail(path != NULL, NULL);
 
     DeleteFileData *data = g_new0(DeleteFileData, 1);
-    data->path = path;
-    data->expander_row = expander_row;
-    data->security_context = file_security_context_new(path, FALSE, NULL, NULL);
+    data->path = g_strdup(path);
 
-    if (!data->security_context)
+    /* Take the snapshot through the cached directory if possible */
+    const char *last_slash = strrchr(data->path, '/');
+    if (last_slash != NULL && last_slash[1] != '\0')
     {
-        g_critical("[ERROR] Failed to create new security context for file");
-        delete_file_data_clear(&data);
-    }
+        g_autofree char *dir_name = g_strndup(data->path, MAX(last_slash - data->path, 1)); // Keep the root directory as "/"
 
-    return data;
-}
+        data->file_name = last_slash + 1;
+        data->dir = dir_fd_cache_acquire(dir_name);
+    }
 
-/* Insert a new delete file data structure to the hash table */
-// @return a new created DeleteFileData structure
-DeleteFileData *
-delete_file_data_table_insert(GHashTable *delete_file_table, const char *path, GtkWidget *expander_row)
-{
-    g_return_val_if_fail(delete_file_table != NULL, NULL);
+    data->security_context = data->dir ?
+                             file_security_context_new_at(data->dir->fd, data->file_name) :
+                             file_security_context_new(path, FALSE, NULL, NULL);
 
-    DeleteFileData *data = delete_file_data_new(path, expander_row);
-    if (!data)
+    if (!data->security_context)
     {
-        g_critical("[ERROR] Failed to create new delete file data structure");
-        return data;
+        g_critical("[ERROR] Failed to create new security context for file");
+        g_clear_pointer(&data, delete_file_data_free);
     }
 
-    g_hash_table_insert(delete_file_table, data, data); // Insert the data structure to the hash table
-
     return data;
 }
 
-/* Get expander_row from DeleteFileData structure */
-GtkWidget *
-delete_file_data_get_expander_row(DeleteFileData *data)
+/* Get the path from DeleteFileData structure */
+const char *
+delete_file_data_get_path(DeleteFileData *data)
 {
     g_return_val_if_fail(data != NULL, NULL);
 
-    return data->expander_row;
-}
-
-/* Remove a delete file data structure from the hash table */
-static void
-delete_file_data_table_remove(GHashTable *delete_file_table, DeleteFileData *data)
-{
-    g_return_if_fail(data != NULL && delete_file_table != NULL);
-
-    g_hash_table_remove(delete_file_table, data); // This also clears the delete file data structure and the security context
+    return data->path;
 }
 
 /* Add audit log for if user attempted to delete a file */
@@ -149,30 +242,80 @@ log_deletion_attempt(const char *path)
     g_free(log_entry);
 }
 
+/* The shared memory passed to the helper, reused across the requests */
+/*
+  * A request takes the whole arena, so it's protected by `elevated_arena_mutex` until the helper exits
+  * It grows when a request doesn't fit, and it's destroyed by `delete_file_release_resources()`
+*/
+static GMutex elevated_arena_mutex;
+static FileSecurityArena *elevated_arena;
+static char *elevated_arena_name;
+
+/* Get an empty arena with room for the files */
+// Call it with `elevated_arena_mutex` locked
+static FileSecurityArena *
+acquire_elevated_arena(guint count, size_t paths_size)
+{
+    file_security_arena_reset(elevated_arena);
+    if (file_security_arena_has_room(elevated_arena, count, paths_size)) return elevated_arena;
+
+    file_security_arena_clear(&elevated_arena, &elevated_arena_name);
+
+    /* Leave room for the next requests, so it doesn't grow on every request */
+    size_t capacity = ELEVATED_ARENA_MIN_CAPACITY;
+    while (capacity < count) capacity *= 2;
+    const size_t paths_capacity = MAX(capacity * ELEVATED_ARENA_PATH_SIZE, paths_size);
+
+    elevated_arena = file_security_arena_new(capacity, paths_capacity, &elevated_arena_name);
+
+    return elevated_arena;
+}
+
+void
+delete_file_release_resources(void)
+{
+    g_mutex_lock(&elevated_arena_mutex);
+    file_security_arena_clear(&elevated_arena, &elevated_arena_name);
+    g_mutex_unlock(&elevated_arena_mutex);
+}
+
 /* Delete threat files in elevated mode */
-static FileSecurityStatus
-delete_threat_file_elevated(GHashTable *delete_file_table, DeleteFileData *data)
+/*
+  * All the files are passed to a single helper process through the arena, so the user is only asked once
+  * indices: the positions of the files in `data` and `statuses`
+*/
+static void
+delete_threat_files_elevated(DeleteFileData *const *data, const guint *indices, guint count, FileSecurityStatus *statuses)
 {
-    g_return_val_if_fail(delete_file_table, FILE_SECURITY_OPERATION_FAILED);
-    g_return_val_if_fail(data && data->security_context, FILE_SECURITY_OPERATION_FAILED);
+    size_t paths_size = 0;
+    for (guint i = 0; i < count; i++)
+    {
+        paths_size += strlen(data[indices[i]]->path) + 1;
+        statuses[indices[i]] = FILE_SECURITY_OPERATION_FAILED; // Until the helper reports it
+    }
+
+    g_mutex_lock(&elevated_arena_mutex);
 
-    char *shm_name = NULL;
-    FileSecurityContext *copied_context = file_security_context_copy(data->security_context, TRUE, &shm_name); // Copy the security context to shared memory
-    if (!copied_context)
+    FileSecurityArena *arena = acquire_elevated_arena(count, paths_size);
+    if (!arena)
     {
-        g_critical("[ERROR] Failed to copy security context to shared memory");
-        return FILE_SECURITY_OPERATION_FAILED;
+        g_critical("[ERROR] Failed to create shared memory for security contexts");
+        g_mutex_unlock(&elevated_arena_mutex);
+        return;
     }
 
+    for (guint i = 0; i < count; i++) // Copy the security contexts to shared memory, the arena has room for all of them
+        file_security_arena_add(arena, data[indices[i]]->security_context, data[indices[i]]->path);
+
     pid_t pid = 0;
 
     if (!spawn_new_process_no_pipes(&pid, PKEXEC_PATH, "pkexec", HELPER_PATH, // `HELPER_PATH` is defined in `meson.build`
-                                    shm_name, data->path, NULL)) // Spawn the helper process
+                                    elevated_arena_name, NULL)) // Spawn the helper process
     {
         /* Process spawn failed */
         g_critical("[ERROR] Failed to spawn helper process");
-        file_security_context_clear(&copied_context, &shm_name, NULL);
-        return FILE_SECURITY_OPERATION_FAILED;
+        g_mutex_unlock(&elevated_arena_mutex);
+        return;
     }
 
     int exit_status = wait_for_process(pid, 0); // Wait for the helper process to finish
@@ -180,52 +323,84 @@ delete_threat_file_elevated(GHashTable *delete_file_table, DeleteFileData *data)
     if (exit_status == 126) // Pkexec user request dismiss
     {
         g_warning("[WARNING] User dismissed the elevation request");
-        file_security_context_clear(&copied_context, &shm_name, NULL);
-        return FILE_SECURITY_OPERATION_SKIPPED;
+        for (guint i = 0; i < count; i++) statuses[indices[i]] = FILE_SECURITY_OPERATION_SKIPPED;
+        g_mutex_unlock(&elevated_arena_mutex);
+        return;
     }
 
-    exit_status = (exit_status < FILE_SECURITY_OK || exit_status > FILE_SECURITY_OPERATION_FAILED) ? FILE_SECURITY_OPERATION_FAILED : exit_status; // Check if the exit status is valid
+    if (exit_status != FILE_SECURITY_OK) g_critical("[ERROR] Helper process returned error: %d", exit_status);
 
-    if ((FileSecurityStatus)exit_status != FILE_SECURITY_OK) g_critical("[ERROR] Helper process returned error: %d", exit_status);
+    /* The helper reports the status of each file through the arena */
+    for (guint i = 0; i < count; i++)
+    {
+        statuses[indices[i]] = file_security_arena_get_status(arena, i);
+        log_deletion_attempt(data[indices[i]]->path);
+    }
 
-    // Clean up
-    file_security_context_clear(&copied_context, &shm_name, NULL);
-    log_deletion_attempt(data->path);
-    delete_file_data_table_remove(delete_file_table, data); // Remove the data structure from the list
-    return (FileSecurityStatus)exit_status;
+    file_security_arena_reset(arena);
+    g_mutex_unlock(&elevated_arena_mutex);
 }
 
 /* Delete threat files */
 /*
-  * Delete a threat file and remove the delete file data structure from the hash table
+  * The files need privileges are deleted by a single elevated helper run after the others
+  * The delete file data structures are still owned by the caller
 */
-FileSecurityStatus
-delete_threat_file(GHashTable *delete_file_table, DeleteFileData *data)
+void
+delete_threat_files(DeleteFileData *const *data, guint count, FileSecurityStatus *statuses)
 {
-    g_return_val_if_fail(data != NULL, FILE_SECURITY_OPERATION_FAILED);
-    g_return_val_if_fail(data->security_context != NULL, FILE_SECURITY_OPERATION_FAILED);
+    g_return_if_fail(data != NULL && statuses != NULL);
 
-    /* Delete file */
-    FileSecurityStatus result = file_security_secure_delete(data->security_context, data->path, 0);
-    if (result != FILE_SECURITY_OK)
+    g_autofree guint *elevated = g_new(guint, MAX(count, 1)); // The files failed with `EACCES`
+    guint num_elevated = 0;
+
+    for (guint i = 0; i < count; i++)
     {
-        switch (errno)
+        if (data[i] == NULL || data[i]->security_context == NULL)
         {
-            case EACCES:
-                g_warning("[WARNING] Permission denied, use elevated mode to delete the file");
-                return delete_threat_file_elevated(delete_file_table, data);
-                break;
-            default:
-                break;
+            statuses[i] = FILE_SECURITY_OPERATION_FAILED;
+            continue;
+        }
+
+        /* Delete file */
+        statuses[i] = data[i]->dir ?
+                      file_security_secure_delete_at(data[i]->security_context, data[i]->dir->fd, data[i]->file_name, 0) :
+                      file_security_secure_delete(data[i]->security_context, data[i]->path, 0);
+        if (statuses[i] != FILE_SECURITY_OK)
+        {
+            switch (errno)
+            {
+                case EACCES:
+                    elevated[num_elevated++] = i;
+                    break;
+                default:
+                    break;
+            }
+        }
+        else // If the file is deleted successfully, show the success message and add audit log
+        {
+            g_print("[INFO] File deleted: %s\n", data[i]->path);
+            log_deletion_attempt(data[i]->path);
         }
     }
-    else // If the file is deleted successfully, show the success message and add audit log
-    {
-        g_print("[INFO] File deleted: %s\n", data->path);
-        log_deletion_attempt(data->path);
-        delete_file_data_table_remove(delete_file_table, data);
-    }
 
-    return result;
+    if (num_elevated == 0) return;
+
+    g_warning("[WARNING] Permission denied, use elevated mode to delete %u files", num_elevated);
+    delete_threat_files_elevated(data, elevated, num_elevated, statuses);
 }
 
+/* Delete threat files */
+/*
+  * Delete a threat file, the delete file data structure is still owned by the caller
+*/
+FileSecurityStatus
+delete_threat_file(DeleteFileData *data)
+{
+    g_return_val_if_fail(data != NULL, FILE_SECURITY_OPERATION_FAILED);
+
+    FileSecurityStatus status = FILE_SECURITY_OPERATION_FAILED;
+    delete_threat_files(&data, 1, &status);
+
+    return status;
+}
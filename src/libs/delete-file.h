@@ -28,23 +28,39 @@
 
 typedef struct DeleteFileData DeleteFileData;
 
-/* Create a new delete file data structure hash table */
-GHashTable *
-delete_file_data_table_new(void);
-
-/* Insert a new delete file data structure to the hash table */
-// @return a new created DeleteFileData structure
-// @warning the `path` string must be malloced
+/* Create a new delete file data structure */
+// Tips: this also creates a new security context for the file, so it should be created as soon as the threat is found
+// @return NULL if the security context can't be created
 DeleteFileData *
-delete_file_data_table_insert(GHashTable *delete_file_table, const char *path, GtkWidget *expander_row);
+delete_file_data_new(const char *path);
+
+/* Free the delete file data structure */
+// Tips: this also clears the security context for the file
+void
+delete_file_data_free(DeleteFileData *data);
 
-/* Get expander_row from DeleteFileData structure */
-GtkWidget *
-delete_file_data_get_expander_row(DeleteFileData *data);
+/* Get the path from DeleteFileData structure */
+const char *
+delete_file_data_get_path(DeleteFileData *data);
 
 /* Delete threat files */
 /*
-  * Delete a threat file and remove the delete file data structure from the hash table
+  * Delete a threat file, the delete file data structure is still owned by the caller
 */
 FileSecurityStatus
-delete_threat_file(GHashTable *delete_file_table, DeleteFileData *data);
\ No newline at end of file
+delete_threat_file(DeleteFileData *data);
+
+/* Delete several threat files at once */
+/*
+  * The files need privileges are deleted together, so there is only one authorization and one helper process
+  * statuses: the status of each file [OUT], in the same order as `data`
+  * @warning
+  * This blocks until the helper process exits, call it in a worker thread
+*/
+void
+delete_threat_files(DeleteFileData *const *data, guint count, FileSecurityStatus *statuses);
+
+/* Destroy the shared memory kept for the elevated deletes */
+// Call it when the application is shutting down
+void
+delete_file_release_resources(void);
@@ -21,6 +21,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
 #include <unistd.h>
 #include <inttypes.h>
 #include <fcntl.h>
@@ -37,7 +38,9 @@
 #endif
 
 #define SHARED_MEM_FALLBACK_RANDOM_NUM 4519921969881885362 // Fallback random number for shared memory if getrandom() is failed
-#define SHARED_MEM_FILE_PATH_LEN 44 // 23 ("/file_security_context") + (20 random number) + (null terminator)
+#define SHARED_MEM_FILE_PATH_LEN 44 // 23 ("/file_security_context_") + (20 random number) + (null terminator)
+#define SHARED_MEM_CONTEXT_PREFIX "/file_security_context"
+#define SHARED_MEM_ARENA_PREFIX "/file_security_arena" // Shorter than `SHARED_MEM_CONTEXT_PREFIX`, so `SHARED_MEM_FILE_PATH_LEN` is enough
 
 // Use `O_NOFOLLOW` to avoid following symlinks
 #define DIRECTORY_OPEN_FLAGS (O_PATH | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC)
@@ -50,6 +53,38 @@ typedef struct FileSecurityContext {
     bool is_shared_memory; // Indicate whether is shared memory
 } FileSecurityContext;
 
+/* Take the snapshot of the directory and file status through an opened directory */
+static bool file_security_context_take_snapshot_at(FileSecurityContext *context, int dir_fd, const char *file_name)
+{
+    if (context == NULL || dir_fd < 0 || file_name == NULL || *file_name == '\0' || strchr(file_name, '/') != NULL) return false;
+
+    /* Get directory status */
+    if (fstat(dir_fd, &context->dir_stat) == -1)
+    {
+        fprintf(stderr, "[ERROR] Failed to get directory status\n");
+        return false;
+    }
+
+    /* Get file status */
+    int file_fd = openat(dir_fd, file_name, FILE_OPEN_FLAGS);
+    if (file_fd == -1)
+    {
+        fprintf(stderr, "[ERROR] Failed to open file: %s\n", file_name);
+        return false;
+    }
+
+    bool is_operation_success = true;
+    if (fstat(file_fd, &context->file_stat) == -1)
+    {
+        fprintf(stderr, "[ERROR] Failed to get file status: %s\n", file_name);
+        is_operation_success = false;
+    }
+
+    close(file_fd);
+
+    return is_operation_success;
+}
+
 /* Take the snapshot of the directory and file status */
 static bool file_security_context_take_snapshot(FileSecurityContext *context, const char *path, int *need_dir_fd)
 {
@@ -61,7 +96,6 @@ static bool file_security_context_take_snapshot(FileSecurityContext *context, co
     bool is_operation_success = true;
 
     int dir_fd = -1;
-    int file_fd = -1;
 
     if (is_operation_success && !get_file_dir_name(path, &file_name, &dir_name))
     {
@@ -69,29 +103,14 @@ static bool file_security_context_take_snapshot(FileSecurityContext *context, co
         is_operation_success = false;
     }
 
-    if (is_operation_success && (dir_fd = open(dir_name, DIRECTORY_OPEN_FLAGS)) == -1)
+    if (is_operation_success && (dir_fd = file_security_open_dir(dir_name)) == -1)
     {
         fprintf(stderr, "[ERROR] Failed to open directory: %s\n", dir_name);
         is_operation_success = false;
     }
-    
-    /* Get directory status */
-    if (is_operation_success && fstat(dir_fd, &context->dir_stat) == -1)
-    {
-        fprintf(stderr, "[ERROR] Failed to get directory status: %s\n", dir_name);
-        is_operation_success = false;
-    }
 
-    /* Get file status */
-    if (is_operation_success && (file_fd = openat(dir_fd, file_name, FILE_OPEN_FLAGS)) == -1)
+    if (is_operation_success && !file_security_context_take_snapshot_at(context, dir_fd, file_name))
     {
-        fprintf(stderr, "[ERROR] Failed to open file: %s\n", file_name);
-        is_operation_success = false;
-    }
-
-    if (is_operation_success && fstat(file_fd, &context->file_stat) == -1)
-    {
-        fprintf(stderr, "[ERROR] Failed to get file status: %s\n", file_name);
         is_operation_success = false;
     }
 
@@ -101,11 +120,6 @@ static bool file_security_context_take_snapshot(FileSecurityContext *context, co
     dir_fd = -1; // Reset the file descriptor
 
     /* Clean up */
-    if (file_fd != -1)
-    {
-        close(file_fd);
-        file_fd = -1;
-    }
     if (dir_name != NULL)
     {
         free(dir_name);
@@ -135,13 +149,11 @@ static FileSecurityContext *file_security_context_create_memory(void)
     return context;
 }
 
-/* Create a new shared memory */
-static FileSecurityContext *file_security_context_create_shared_memory(char **shared_mem_filepath)
+/* Create and map a new shared memory named `<prefix>_<random number>` */
+static void *shared_mem_create(const char *prefix, size_t size, char **shared_mem_filepath)
 {
     if (shared_mem_filepath == NULL) return NULL;
 
-    FileSecurityContext *context = NULL;
-
     /* Create a new random number */
     uint64_t secure_rand;
     if (getrandom(&secure_rand, sizeof(secure_rand), 0) != sizeof(secure_rand)) // Create a random number for the shared memory name
@@ -151,7 +163,7 @@ static FileSecurityContext *file_security_context_create_shared_memory(char **sh
     }
 
     *shared_mem_filepath = calloc(SHARED_MEM_FILE_PATH_LEN, sizeof(char));
-    snprintf(*shared_mem_filepath, SHARED_MEM_FILE_PATH_LEN, "/file_security_context_%" PRIu64, secure_rand);
+    snprintf(*shared_mem_filepath, SHARED_MEM_FILE_PATH_LEN, "%s_%" PRIu64, prefix, secure_rand);
 
     /* Create the shared memory */
     int shm_fd = shm_open(*shared_mem_filepath, O_CREAT | O_EXCL | O_RDWR, 0600);
@@ -159,40 +171,47 @@ static FileSecurityContext *file_security_context_create_shared_memory(char **sh
     {
         fprintf(stderr, "[ERROR] Failed to create shared memory\n");
         free(*shared_mem_filepath);
+        *shared_mem_filepath = NULL;
         return NULL;
     }
 
+    void *mapping = MAP_FAILED;
+
     /* Set the secure flags for shm_fd */
     if (fcntl(shm_fd, F_SETFD, FD_CLOEXEC) == -1)
     {
         fprintf(stderr, "[ERROR] Failed to set secure flags for shared memory\n");
-        close(shm_fd);
-        shm_unlink(*shared_mem_filepath);
-        free(*shared_mem_filepath);
-        return NULL;
     }
-
     /* Set the size of the shared memory */
-    if (ftruncate(shm_fd, sizeof(FileSecurityContext)) == -1)
+    else if (ftruncate(shm_fd, size) == -1)
     {
         fprintf(stderr, "[ERROR] Failed to set size of shared memory\n");
-        close(shm_fd);
-        shm_unlink(*shared_mem_filepath);
-        free(*shared_mem_filepath);
-        return NULL;
     }
-
     /* Map the shared memory */
-    context = mmap(NULL, sizeof(FileSecurityContext), PROT_READ | PROT_WRITE, MAP_SHARED, shm_fd, 0);
-    if (context == MAP_FAILED)
+    else if ((mapping = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, shm_fd, 0)) == MAP_FAILED)
     {
         fprintf(stderr, "[ERROR] Failed to map shared memory\n");
-        close(shm_fd);
+    }
+
+    close(shm_fd);
+
+    if (mapping == MAP_FAILED)
+    {
         shm_unlink(*shared_mem_filepath);
         free(*shared_mem_filepath);
+        *shared_mem_filepath = NULL;
         return NULL;
     }
 
+    return mapping;
+}
+
+/* Create a new shared memory */
+static FileSecurityContext *file_security_context_create_shared_memory(char **shared_mem_filepath)
+{
+    FileSecurityContext *context = shared_mem_create(SHARED_MEM_CONTEXT_PREFIX, sizeof(FileSecurityContext), shared_mem_filepath);
+    if (context == NULL) return NULL;
+
     /* Mark the context as shared memory */
     context->is_shared_memory = true;
 
@@ -270,6 +289,29 @@ FileSecurityContext *file_security_context_new(const char *path, bool need_share
     return new_context;
 }
 
+/* Open a directory for the `*_at()` functions */
+int file_security_open_dir(const char *dir_name)
+{
+    if (dir_name == NULL || *dir_name == '\0') return -1;
+
+    return open(dir_name, DIRECTORY_OPEN_FLAGS);
+}
+
+/* Initialize the file security context through an opened directory */
+FileSecurityContext *file_security_context_new_at(int dir_fd, const char *file_name)
+{
+    FileSecurityContext *new_context = file_security_context_create_memory();
+    if (new_context == NULL) return NULL; // Check if the context is allocated successfully
+
+    /* Snapshot the directory and file status */
+    if (!file_security_context_take_snapshot_at(new_context, dir_fd, file_name))
+    {
+        file_security_context_clear(&new_context, NULL, NULL);
+    }
+
+    return new_context;
+}
+
 /* Copy the file security context to a new space */
 /*
   * @param context
@@ -467,27 +509,28 @@ FileSecurityStatus file_security_validate(FileSecurityContext *orig_context, Fil
     return status;
 }
 
-/* Secure delete the file */
+/* Secure delete the file through an opened directory */
 /*
  * @param orig_context
  * The original file security context to be used for validation
- * @param path
- * The path of the file or directory to be deleted
+ * @param dir_fd
+ * The directory containing the file, opened by `file_security_open_dir()`
+ * @param file_name
+ * The name of the file in the directory
  * @param flags
  * The validation flags
  * @return
  * File security status code
 */
-FileSecurityStatus file_security_secure_delete(FileSecurityContext *orig_context, const char *path, int flags)
+FileSecurityStatus file_security_secure_delete_at(FileSecurityContext *orig_context, int dir_fd, const char *file_name, int flags)
 {
-    if (orig_context == NULL || path == NULL || *path == '\0') return FILE_SECURITY_INVALID_CONTEXT;
+    if (orig_context == NULL || dir_fd < 0 || file_name == NULL || *file_name == '\0') return FILE_SECURITY_INVALID_CONTEXT;
 
     bool is_valid = true; // Check if the file is valid
     FileSecurityStatus status = FILE_SECURITY_OK; // The validation status code
 
-    /* Create a new context for the file or directory to be deleted */
-    int dir_fd = -1; // Store the file descriptor for `unlinkat`
-    FileSecurityContext *new_context = file_security_context_new(path, false, NULL, &dir_fd);
+    /* Create a new context for the file to be deleted */
+    FileSecurityContext *new_context = file_security_context_new_at(dir_fd, file_name);
 
     if (new_context == NULL) return FILE_SECURITY_INVALID_PATH; // Failed to take a new snapshot of the directory and file status
 
@@ -495,17 +538,332 @@ FileSecurityStatus file_security_secure_delete(FileSecurityContext *orig_context
     status =  file_security_validate(orig_context, new_context, NULL, flags);
     if (is_valid && status != FILE_SECURITY_OK)
     {
-        fprintf(stderr, "[SECURITY] Failed to validate the file: %s\n", path);
+        fprintf(stderr, "[SECURITY] Failed to validate the file: %s\n", file_name);
         is_valid = false;
     }
 
-    if (is_valid && unlinkat(dir_fd, path, 0) == -1)
+    /* Unlink the name in the validated directory, not the path which may be resolved to another directory now */
+    int saved_errno = 0;
+    if (is_valid && unlinkat(dir_fd, file_name, 0) == -1)
     {
-        fprintf(stderr, "[SECURITY] Failed to delete the file: %s\n", path);
+        saved_errno = errno;
+        fprintf(stderr, "[SECURITY] Failed to delete the file: %s\n", file_name);
         status = FILE_SECURITY_OPERATION_FAILED;
         is_valid = false;
     }
 
-    file_security_context_clear(&new_context, NULL, &dir_fd); // Free the new context and the file descriptor
+    file_security_context_clear(&new_context, NULL, NULL); // Free the new context
+    if (saved_errno != 0) errno = saved_errno; // The caller checks `EACCES`
+    return status;
+}
+
+/* Secure delete the file */
+/*
+ * @param orig_context
+ * The original file security context to be used for validation
+ * @param path
+ * The path of the file or directory to be deleted
+ * @param flags
+ * The validation flags
+ * @return
+ * File security status code
+*/
+FileSecurityStatus file_security_secure_delete(FileSecurityContext *orig_context, const char *path, int flags)
+{
+    if (orig_context == NULL || path == NULL || *path == '\0') return FILE_SECURITY_INVALID_CONTEXT;
+
+    char *dir_name = NULL;
+    char *file_name = NULL;
+    if (!get_file_dir_name(path, &file_name, &dir_name))
+    {
+        fprintf(stderr, "[ERROR] Failed to get file and directory name\n");
+        return FILE_SECURITY_INVALID_PATH;
+    }
+
+    FileSecurityStatus status = FILE_SECURITY_INVALID_PATH;
+    int saved_errno = 0;
+
+    int dir_fd = file_security_open_dir(dir_name);
+    if (dir_fd != -1)
+    {
+        status = file_security_secure_delete_at(orig_context, dir_fd, file_name, flags);
+        saved_errno = errno;
+        close(dir_fd);
+    }
+    else fprintf(stderr, "[ERROR] Failed to open directory: %s\n", dir_name);
+
+    free(dir_name);
+    free(file_name);
+
+    if (saved_errno != 0) errno = saved_errno; // The caller checks `EACCES`
     return status;
-}
\ No newline at end of file
+}
+
+/* File security arena */
+/*
+  * The shared memory layout: [FileSecurityArenaHeader][FileSecurityArenaSlot * capacity][paths (paths_capacity bytes)]
+  * The slots are taken in order by `file_security_arena_add()` and all of them are returned by `file_security_arena_reset()`
+  * Each path is terminated by '\0', `path_offset` is relative to the start of the paths
+  * The helper runs with elevated privileges, so every slot is checked against the mapped size before using it
+*/
+#define FILE_SECURITY_ARENA_MAX_CAPACITY (1 << 20)
+
+typedef struct {
+    uint64_t capacity;
+    uint64_t paths_capacity;
+    uint64_t count; // The slots in use
+    uint64_t paths_used;
+} FileSecurityArenaHeader;
+
+typedef struct {
+    FileSecurityContext context;
+    uint64_t path_offset;
+    uint64_t path_length; // Without the '\0'
+    int32_t status; // FileSecurityStatus, written by `file_security_arena_secure_delete()`
+    int32_t reserved;
+} FileSecurityArenaSlot;
+
+typedef struct FileSecurityArena {
+    void *mapping;
+    size_t mapping_size;
+    size_t capacity; // Read once when mapping, so they can't be changed later through the shared memory
+    size_t paths_capacity;
+} FileSecurityArena;
+
+static FileSecurityArenaHeader *file_security_arena_header(const FileSecurityArena *arena)
+{
+    return arena->mapping;
+}
+
+static FileSecurityArenaSlot *file_security_arena_slots(const FileSecurityArena *arena)
+{
+    return (FileSecurityArenaSlot *)((char *)arena->mapping + sizeof(FileSecurityArenaHeader));
+}
+
+static char *file_security_arena_paths(const FileSecurityArena *arena)
+{
+    return (char *)(file_security_arena_slots(arena) + arena->capacity);
+}
+
+/* Create an arena of file security contexts in shared memory */
+/*
+  * @param capacity
+  * The number of the slots
+  * @param paths_capacity
+  * The bytes for the paths, including the '\0's
+  * @param shared_mem_filepath [OUT]
+  * The shared memory file path, pass it to `file_security_arena_open_shared_mem()` in another process
+  * @return
+  * The newly created arena, or `NULL` if an error occurred
+*/
+FileSecurityArena *file_security_arena_new(size_t capacity, size_t paths_capacity, char **shared_mem_filepath)
+{
+    if (capacity == 0 || capacity > FILE_SECURITY_ARENA_MAX_CAPACITY || paths_capacity == 0) return NULL;
+
+    FileSecurityArena *arena = calloc(1, sizeof(FileSecurityArena));
+    if (arena == NULL)
+    {
+        fprintf(stderr, "[ERROR] Failed to allocate memory for file security arena\n");
+        return NULL;
+    }
+
+    arena->capacity = capacity;
+    arena->paths_capacity = paths_capacity;
+    arena->mapping_size = sizeof(FileSecurityArenaHeader) + capacity * sizeof(FileSecurityArenaSlot) + paths_capacity;
+    arena->mapping = shared_mem_create(SHARED_MEM_ARENA_PREFIX, arena->mapping_size, shared_mem_filepath);
+    if (arena->mapping == NULL)
+    {
+        free(arena);
+        return NULL;
+    }
+
+    FileSecurityArenaHeader *header = file_security_arena_header(arena);
+    header->capacity = capacity;
+    header->paths_capacity = paths_capacity;
+    file_security_arena_reset(arena);
+
+    return arena;
+}
+
+/* Open an arena created by another process */
+FileSecurityArena *file_security_arena_open_shared_mem(const char *shared_mem_filepath)
+{
+    if (shared_mem_filepath == NULL) return NULL;
+
+    int shm_fd = shm_open(shared_mem_filepath, O_RDWR, 0600); // Open shared memory
+    if (shm_fd == -1)
+    {
+        fprintf(stderr, "[SECURITY] Failed to open shared memory: %s\n", shared_mem_filepath);
+        return NULL;
+    }
+
+    struct stat shm_stat;
+    if (fstat(shm_fd, &shm_stat) == -1 || shm_stat.st_size < (off_t)sizeof(FileSecurityArenaHeader))
+    {
+        fprintf(stderr, "[SECURITY] Invalid shared memory: %s\n", shared_mem_filepath);
+        close(shm_fd);
+        return NULL;
+    }
+
+    void *mapping = mmap(NULL, shm_stat.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, shm_fd, 0);
+    close(shm_fd); // Close the shared memory file descriptor
+    if (mapping == MAP_FAILED)
+    {
+        fprintf(stderr, "[SECURITY] Failed to map shared memory: %s\n", shared_mem_filepath);
+        return NULL;
+    }
+
+    /* Check the header against the mapped size */
+    const FileSecurityArenaHeader header = *(const FileSecurityArenaHeader *)mapping;
+    const size_t slots_size = sizeof(FileSecurityArenaHeader) + header.capacity * sizeof(FileSecurityArenaSlot);
+    if (header.capacity == 0 || header.capacity > FILE_SECURITY_ARENA_MAX_CAPACITY ||
+        slots_size > (size_t)shm_stat.st_size || header.paths_capacity != (size_t)shm_stat.st_size - slots_size)
+    {
+        fprintf(stderr, "[SECURITY] Corrupted file security arena: %s\n", shared_mem_filepath);
+        munmap(mapping, shm_stat.st_size);
+        return NULL;
+    }
+
+    FileSecurityArena *arena = calloc(1, sizeof(FileSecurityArena));
+    if (arena == NULL)
+    {
+        munmap(mapping, shm_stat.st_size);
+        return NULL;
+    }
+
+    arena->mapping = mapping;
+    arena->mapping_size = shm_stat.st_size;
+    arena->capacity = header.capacity;
+    arena->paths_capacity = header.paths_capacity;
+
+    return arena;
+}
+
+/* Return all the slots, the arena can be reused for the next request */
+void file_security_arena_reset(FileSecurityArena *arena)
+{
+    if (arena == NULL) return;
+
+    FileSecurityArenaHeader *header = file_security_arena_header(arena);
+    header->count = 0;
+    header->paths_used = 0;
+}
+
+/* Whether the arena has room for more contexts */
+bool file_security_arena_has_room(const FileSecurityArena *arena, size_t count, size_t paths_size)
+{
+    if (arena == NULL) return false;
+
+    const FileSecurityArenaHeader *header = file_security_arena_header(arena);
+
+    return count <= arena->capacity - header->count && paths_size <= arena->paths_capacity - header->paths_used;
+}
+
+/* Copy a file security context with its path into the next slot */
+/*
+  * @return
+  * The index of the slot, or -1 if the arena is full
+*/
+ssize_t file_security_arena_add(FileSecurityArena *arena, const FileSecurityContext *context, const char *path)
+{
+    if (arena == NULL || context == NULL || path == NULL) return -1;
+
+    const size_t length = strlen(path);
+    if (!file_security_arena_has_room(arena, 1, length + 1)) return -1;
+
+    FileSecurityArenaHeader *header = file_security_arena_header(arena);
+    const size_t index = header->count;
+    FileSecurityArenaSlot *slot = &file_security_arena_slots(arena)[index];
+
+    slot->context = *context;
+    slot->context.is_shared_memory = true; // Never freed on its own
+    slot->path_offset = header->paths_used;
+    slot->path_length = length;
+    slot->status = FILE_SECURITY_OPERATION_FAILED; // Until the helper reports it
+    memcpy(file_security_arena_paths(arena) + slot->path_offset, path, length + 1);
+
+    header->paths_used += length + 1;
+    header->count++;
+
+    return (ssize_t)index;
+}
+
+/* Get the number of the slots in use */
+size_t file_security_arena_get_count(const FileSecurityArena *arena)
+{
+    if (arena == NULL) return 0;
+
+    const size_t count = file_security_arena_header(arena)->count;
+
+    return count > arena->capacity ? arena->capacity : count;
+}
+
+/* Get the status of a slot reported by `file_security_arena_secure_delete()` */
+FileSecurityStatus file_security_arena_get_status(const FileSecurityArena *arena, size_t index)
+{
+    if (arena == NULL || index >= file_security_arena_get_count(arena)) return FILE_SECURITY_INVALID_CONTEXT;
+
+    const int32_t status = file_security_arena_slots(arena)[index].status;
+
+    return (status < FILE_SECURITY_OK || status > FILE_SECURITY_OPERATION_SKIPPED) ? FILE_SECURITY_OPERATION_FAILED : (FileSecurityStatus)status;
+}
+
+/* Secure delete the files of all the slots in use */
+/*
+  * The status of each slot is written back to the shared memory
+  * @return
+  * `FILE_SECURITY_OK` if all the files are deleted, otherwise the status of the first failed file
+*/
+FileSecurityStatus file_security_arena_secure_delete(FileSecurityArena *arena, int flags)
+{
+    if (arena == NULL) return FILE_SECURITY_INVALID_CONTEXT;
+
+    FileSecurityStatus result = FILE_SECURITY_OK;
+    FileSecurityArenaSlot *slots = file_security_arena_slots(arena);
+    const char *path_area = file_security_arena_paths(arena);
+    const size_t count = file_security_arena_get_count(arena);
+
+    for (size_t i = 0; i < count; i++)
+    {
+        /* Take a private copy, the shared memory is writable by the creator */
+        FileSecurityArenaSlot slot = slots[i];
+
+        FileSecurityStatus status = FILE_SECURITY_INVALID_PATH;
+        if (slot.path_offset < arena->paths_capacity && slot.path_length < arena->paths_capacity - slot.path_offset)
+        {
+            char *path = strndup(path_area + slot.path_offset, slot.path_length);
+
+            if (path != NULL && strlen(path) == slot.path_length) status = file_security_secure_delete(&slot.context, path, flags);
+            free(path);
+        }
+
+        slots[i].status = status;
+        if (status != FILE_SECURITY_OK && result == FILE_SECURITY_OK) result = status;
+    }
+
+    return result;
+}
+
+/* Unmap the arena opened by `file_security_arena_open_shared_mem()` */
+void file_security_arena_close_shared_mem(FileSecurityArena **arena)
+{
+    if (arena == NULL || *arena == NULL) return;
+
+    munmap((*arena)->mapping, (*arena)->mapping_size);
+    free(*arena);
+    *arena = NULL;
+}
+
+/* Free the arena created by `file_security_arena_new()` and destroy the shared memory */
+void file_security_arena_clear(FileSecurityArena **arena, char **shared_mem_filepath)
+{
+    if (arena == NULL || *arena == NULL) return;
+
+    file_security_arena_close_shared_mem(arena);
+
+    if (shared_mem_filepath == NULL || *shared_mem_filepath == NULL) return;
+
+    shm_unlink(*shared_mem_filepath); // Destroy the shared memory
+    free(*shared_mem_filepath);
+    *shared_mem_filepath = NULL;
+}
@@ -23,12 +23,14 @@
 
 #include <stdbool.h>
 #include <sys/stat.h>
+#include <sys/types.h>
 
 #include "file-security-status.h"
 
 #define FILE_SECURITY_VALIDATE_STRICT 0x10 // Validate the file integrity strictly
 
 typedef struct FileSecurityContext FileSecurityContext;
+typedef struct FileSecurityArena FileSecurityArena; // Many file security contexts with their paths, in a single shared memory
 
 /* Initialize the file security context */
 /*
@@ -45,6 +47,26 @@ typedef struct FileSecurityContext FileSecurityContext;
 */
 FileSecurityContext *file_security_context_new(const char *path, bool need_shared, char **shared_mem_filepath, int *need_dir_fd);
 
+/* Open a directory for the `*_at()` functions */
+/*
+  * The directory is opened with `O_PATH` and without following symlinks, so it can be kept as an anchor for the files inside
+  * @return
+  * The file descriptor, or -1 if an error occurred
+*/
+int file_security_open_dir(const char *dir_name);
+
+/* Initialize the file security context through an opened directory */
+/*
+  * Same as `file_security_context_new()`, but the directory is not resolved again
+  * @param dir_fd
+  * The directory containing the file, opened by `file_security_open_dir()`
+  * @param file_name
+  * The name of the file in the directory, it can't contain '/'
+  * @return
+  * The newly allocated file security context, or `NULL` if an error occurred
+*/
+FileSecurityContext *file_security_context_new_at(int dir_fd, const char *file_name);
+
 /* Copy the file security context to a new space */
 /*
   * @param context
@@ -104,4 +126,81 @@ FileSecurityStatus file_security_validate(FileSecurityContext *orig_context, Fil
 */
 FileSecurityStatus file_security_secure_delete(FileSecurityContext *orig_context, const char *path, int flags);
 
+/* Secure delete the file through an opened directory */
+/*
+ * The file is validated and unlinked in `dir_fd`, even if the path of the directory is changed since it was opened
+ * @param orig_context
+ * The original file security context to be used for validation
+ * @param dir_fd
+ * The directory containing the file, opened by `file_security_open_dir()`
+ * @param file_name
+ * The name of the file in the directory, it can't contain '/'
+ * @return
+ * File security status code
+*/
+FileSecurityStatus file_security_secure_delete_at(FileSecurityContext *orig_context, int dir_fd, const char *file_name, int flags);
+
+/* Create an arena of file security contexts in shared memory */
+/*
+  * A single segment holds many contexts, so bulk operations don't create a shared memory per file
+  * The arena can be reused across requests, see `file_security_arena_reset()`
+  * @param capacity
+  * The number of the slots
+  * @param paths_capacity
+  * The bytes for the paths, including the '\0's
+  * @param shared_mem_filepath [OUT]
+  * The shared memory file path, pass it to `file_security_arena_open_shared_mem()` in another process
+  * @return
+  * The newly created arena, or `NULL` if an error occurred
+*/
+FileSecurityArena *file_security_arena_new(size_t capacity, size_t paths_capacity, char **shared_mem_filepath);
+
+/* Open an arena created by another process */
+/*
+  * @return
+  * The arena, or `NULL` if the shared memory can't be opened or is corrupted
+*/
+FileSecurityArena *file_security_arena_open_shared_mem(const char *shared_mem_filepath);
+
+/* Return all the slots, the arena can be reused for the next request */
+void file_security_arena_reset(FileSecurityArena *arena);
+
+/* Whether the arena has room for `count` more contexts with `paths_size` bytes of paths (including the '\0's) */
+bool file_security_arena_has_room(const FileSecurityArena *arena, size_t count, size_t paths_size);
+
+/* Copy a file security context with its path into the next slot */
+/*
+  * @return
+  * The index of the slot, or -1 if the arena is full
+*/
+ssize_t file_security_arena_add(FileSecurityArena *arena, const FileSecurityContext *context, const char *path);
+
+/* Get the number of the slots in use */
+size_t file_security_arena_get_count(const FileSecurityArena *arena);
+
+/* Get the status of a slot reported by `file_security_arena_secure_delete()` */
+/*
+  * @note
+  * `FILE_SECURITY_OPERATION_FAILED` if the slot hasn't been processed
+*/
+FileSecurityStatus file_security_arena_get_status(const FileSecurityArena *arena, size_t index);
+
+/* Secure delete the files of all the slots in use */
+/*
+  * The status of each slot is written back to the shared memory, so the creator can read it by `file_security_arena_get_status()`
+  * @return
+  * `FILE_SECURITY_OK` if all the files are deleted, otherwise the status of the first failed file
+*/
+FileSecurityStatus file_security_arena_secure_delete(FileSecurityArena *arena, int flags);
+
+/* Unmap the arena opened by `file_security_arena_open_shared_mem()` */
+void file_security_arena_close_shared_mem(FileSecurityArena **arena);
+
+/* Free the arena created by `file_security_arena_new()` */
+/*
+  * @param shared_mem_filepath [OPTIONAL]
+  * The shared memory file path to be destroyed and freed, if it is not `NULL`
+*/
+void file_security_arena_clear(FileSecurityArena **arena, char **shared_mem_filepath);
+
 #endif // FILE_SECURITY_H
\ No newline at end of file
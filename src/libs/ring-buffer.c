@@ -22,8 +22,6 @@
 #include <assert.h>
 #include "ring-buffer.h"
 
-#define MAX_LINE_LENGTH 2048 // Maximum length of a line
-
 #define ring_buffer_full(r) ((r)->count == RING_BUFFER_SIZE) // Check whether the buffer is full
 #define ring_buffer_empty(r) ((r)->count == 0) // Check whether the buffer is empty
 #define calculate_pos(pos) ((pos) & (RING_BUFFER_SIZE - 1)) // calculate the pointer position with modulo operation
@@ -91,6 +89,33 @@ ring_buffer_write(RingBuffer *ring, const char *src, size_t len)
     return to_write;
 }
 
+/* Get the contiguous free space at the write position, so the data can be read into the ring buffer directly */
+/*
+  * @param length
+  * the length of the free space [OUT], 0 if the buffer is full
+  * @note
+  * Call `ring_buffer_commit()` with the number of the bytes actually written
+*/
+char *
+ring_buffer_write_space(RingBuffer *ring, size_t *length)
+{
+    const size_t tail_pos = calculate_pos(ring->tail);
+
+    *length = MIN(ring_buffer_available(ring), RING_BUFFER_SIZE - tail_pos); // Stop at the end of the buffer
+
+    return ring->data + tail_pos;
+}
+
+/* Mark the bytes written into `ring_buffer_write_space()` as data */
+void
+ring_buffer_commit(RingBuffer *ring, size_t length)
+{
+    assert(length <= ring_buffer_available(ring)); // check whether the length is valid
+
+    ring->tail += length;
+    ring->count += length;
+}
+
 /* Read data from the ring buffer */
 size_t
 ring_buffer_read(RingBuffer *ring, char *dest, size_t len)
@@ -152,53 +177,72 @@ ring_buffer_memchr(RingBuffer *ring, char target, size_t max_search_size)
     return found;
 }
 
-/* Find a new line in the ring buffer */
+/* Take the complete lines from the ring buffer */
 /*
   * @param ring
-  * the ring buffer to search
+  * the ring buffer to take from
+  * @param lines
+  * the taken lines [OUT]
+  * @param max_lines
+  * the capacity of `lines`
   * @return
-  * a allocated string containing the new line, or NULL if no new line is found
-  * @warning
-  * The returned string is allocated on the heap and must be freed by the caller
+  * the number of the taken lines
+  * @note
+  * The lines are NOT copied, except the one crossing the buffer boundary
+  * So call this function again only after the lines are used
 */
-char *
-ring_buffer_find_new_line(RingBuffer *ring)
+size_t
+ring_buffer_take_lines(RingBuffer *ring, RingBufferLine *lines, size_t max_lines)
 {
-    g_return_val_if_fail(ring != NULL, NULL);
-
-    /* Initialize some varibles */
-    char *line = NULL;
-    char *newline_pos = NULL;
-    size_t line_length = 0;
-    const size_t head_pos = calculate_pos(ring->head);
+    g_return_val_if_fail(ring != NULL && lines != NULL, 0);
 
-    /* Find the first newline character in the ring buffer */
-    newline_pos = ring_buffer_memchr(ring, '\n', MIN(ring->count, MAX_LINE_LENGTH));
+    size_t num_lines = 0;
+    gboolean has_wrapped_line = FALSE; // Only one line can cross the boundary, the taken bytes are less than `RING_BUFFER_SIZE`
 
-    /* Calculate the actual length of the new line */
-    if (!newline_pos) return NULL; // No new line found
-    else if (ring->count >= MAX_LINE_LENGTH) line_length = MAX_LINE_LENGTH; // The new line is too long
-
-    /* The new line is not wrapped */
-    if (newline_pos >= ring->data + head_pos) line_length = (newline_pos - (ring->data + head_pos)) + 1; // +1 for the newline character
-    /* The new line is wrapped */
-    else line_length = (RING_BUFFER_SIZE - head_pos) + (newline_pos - ring->data) + 1; // +1 for the newline character
-
-    /* Allocate memory for the new line */
-    line = g_new0(char, line_length);
-    if (!line) return NULL;
-
-    /* Copy the new line to the allocated memory */
-    size_t actual_read = ring_buffer_read(ring, line, line_length);
-
-    if (actual_read != line_length)
+    while (num_lines < max_lines && !ring_buffer_empty(ring))
     {
-        g_free(line);
-        return NULL;
+        const size_t head_pos = calculate_pos(ring->head);
+        char *newline_pos = ring_buffer_memchr(ring, '\n', MIN(ring->count, RING_BUFFER_MAX_LINE_LENGTH));
+        size_t line_length = 0; // Including the newline character
+
+        if (newline_pos == NULL)
+        {
+            if (ring->count < RING_BUFFER_MAX_LINE_LENGTH) break; // Wait for the rest of the line
+            line_length = RING_BUFFER_MAX_LINE_LENGTH; // The line is too long, split it
+        }
+        else if (newline_pos >= ring->data + head_pos) line_length = (newline_pos - (ring->data + head_pos)) + 1; // The new line is not wrapped
+        else line_length = (RING_BUFFER_SIZE - head_pos) + (newline_pos - ring->data) + 1; // The new line is wrapped
+
+        const size_t text_length = newline_pos != NULL ? line_length - 1 : line_length; // Without the newline character
+        RingBufferLine *line = &lines[num_lines];
+
+        if (newline_pos != NULL && head_pos + line_length <= RING_BUFFER_SIZE)
+        {
+            /* The line is contiguous, use it in place */
+            line->data = ring->data + head_pos;
+            line->data[text_length] = '\0'; // Replace the newline character with a null terminator
+        }
+        else
+        {
+            /* The line crosses the boundary or has no newline character to be replaced, copy it */
+            if (has_wrapped_line) break; // The copy is still in use
+            has_wrapped_line = TRUE;
+
+            const size_t first_chunk = MIN(text_length, RING_BUFFER_SIZE - head_pos);
+            memcpy(ring->wrapped_line, ring->data + head_pos, first_chunk);
+            memcpy(ring->wrapped_line + first_chunk, ring->data, text_length - first_chunk);
+            ring->wrapped_line[text_length] = '\0';
+            line->data = ring->wrapped_line;
+        }
+
+        line->length = text_length;
+        num_lines++;
+
+        ring->head += line_length;
+        ring->count -= line_length;
     }
 
-    /* Add a null terminator to the new line */
-    line[line_length-1] = '\0'; // Replace the newline character with a null terminator
+    assert(ring->count <= RING_BUFFER_SIZE); // check whether the counter is valid
 
-    return line;
-}
\ No newline at end of file
+    return num_lines;
+}
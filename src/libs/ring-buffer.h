@@ -20,17 +20,32 @@
 
 #pragma once
 
+#include <stddef.h>
+
 
 /* the buffer size MUST be a power of 2 */
 #define RING_BUFFER_SIZE 8192
+#define RING_BUFFER_MAX_LINE_LENGTH 2048 // Longer lines are split
 
 typedef struct RingBuffer {
     char data[RING_BUFFER_SIZE];
     size_t head;  // Read
     size_t tail;  // Write
     size_t count; // current data length
+
+    char wrapped_line[RING_BUFFER_MAX_LINE_LENGTH + 1]; // The line crossing the buffer boundary is copied here
 } RingBuffer;
 
+/* A line taken from the ring buffer */
+/*
+  * `data` is terminated by '\0' instead of the newline character, and it can be modified in place
+  * It points into the ring buffer, so it's only valid until the next `ring_buffer_write()`
+*/
+typedef struct RingBufferLine {
+    char *data;
+    size_t length; // Without the terminator
+} RingBufferLine;
+
 /* Initialize the ring buffer */
 /*
   * @param ring
@@ -47,18 +62,37 @@ ring_buffer_available(const RingBuffer *ring);
 size_t
 ring_buffer_write(RingBuffer *ring, const char *src, size_t len);
 
+/* Get the contiguous free space at the write position, so the data can be read into the ring buffer directly */
+/*
+  * @param length
+  * the length of the free space [OUT], 0 if the buffer is full
+  * @note
+  * Call `ring_buffer_commit()` with the number of the bytes actually written
+*/
+char *
+ring_buffer_write_space(RingBuffer *ring, size_t *length);
+
+/* Mark the bytes written into `ring_buffer_write_space()` as data */
+void
+ring_buffer_commit(RingBuffer *ring, size_t length);
+
 /* Read data from the ring buffer */
 size_t
 ring_buffer_read(RingBuffer *ring, char *dest, size_t len);
 
-/* Find a new line in the ring buffer */
+/* Take the complete lines from the ring buffer */
 /*
   * @param ring
-  * the ring buffer to search
+  * the ring buffer to take from
+  * @param lines
+  * the taken lines [OUT]
+  * @param max_lines
+  * the capacity of `lines`
   * @return
-  * a allocated string containing the new line, or NULL if no new line is found
-  * @warning
-  * The returned string is allocated on the heap and must be freed by the caller
+  * the number of the taken lines
+  * @note
+  * The lines are NOT copied, except the one crossing the buffer boundary
+  * So call this function again only after the lines are used
 */
-char *
-ring_buffer_find_new_line(RingBuffer *ring);
+size_t
+ring_buffer_take_lines(RingBuffer *ring, RingBufferLine *lines, size_t max_lines);
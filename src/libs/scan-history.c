@@ -0,0 +1,492 @@
+/* scan-history.c
+ *
+ * Copyright 2025 EricLin
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <glib/gstdio.h>
+#include <sys/stat.h>
+
+#include "scan-history.h"
+
+#define SCAN_HISTORY_MAGIC "WMHIST01" // The header of the log
+#define SCAN_HISTORY_MAGIC_SIZE 8
+#define SCAN_HISTORY_RECORD_MAGIC 0x52434857u
+#define SCAN_HISTORY_MAX_RECORD_SIZE ((gsize)64 << 20) // Anything larger is a corrupted length
+
+/* The header of a record, followed by the NUL-terminated roots, then the NUL-terminated path and virname ("" if unknown) of each hit */
+/*
+  * The records are padded to 8 bytes, so the headers in the mapping are always aligned
+  * `checksum` covers the payload, a record torn by a crash is dropped with everything after it
+*/
+typedef struct {
+    guint32 magic;
+    guint32 length; // The whole record, including the padding
+    gint64 time;
+    gint64 duration;
+    guint64 files;
+    guint64 threats;
+    guint64 bytes;
+    guint32 flags;
+    guint32 num_roots;
+    guint32 num_hits;
+    guint32 checksum;
+} RecordHeader;
+
+G_STATIC_ASSERT(sizeof(RecordHeader) % 8 == 0);
+
+struct ScanHistory {
+    char *path;
+    char *temp_path; // The compacted log is written here, then renamed over `path`
+
+    /* Only used by the main thread */
+    GMappedFile *mapped; // NULL if the log is empty or can't be read
+    GArray *offsets; // The offsets of the records in `mapped`, by time
+    gsize valid_end; // The end of the last valid record, a torn tail is truncated before the next append
+
+    /* Protected by mutex, the log is only written while holding it */
+    GMutex mutex;
+    GThread *compaction;
+    guint compaction_source_id; // The idle source reloading the compacted log
+    gboolean is_replaced; // The log was compacted, `valid_end` doesn't belong to it until it's reloaded
+};
+
+static guint32
+compute_checksum(const guint8 *data, gsize length)
+{
+    guint32 hash = 2166136261u; // FNV-1a
+    for (gsize i = 0; i < length; i++)
+    {
+        hash ^= data[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+/* Get the record at `offset` of a log of `size` bytes, NULL if it's torn or corrupted */
+static const RecordHeader *
+get_valid_record(const char *data, gsize size, gsize offset)
+{
+    if (size - offset < sizeof(RecordHeader)) return NULL;
+
+    const RecordHeader *header = (const RecordHeader *)(data + offset);
+    if (header->magic != SCAN_HISTORY_RECORD_MAGIC || header->length < sizeof(RecordHeader) || header->length % 8 != 0 ||
+        header->length > SCAN_HISTORY_MAX_RECORD_SIZE || header->length > size - offset) return NULL;
+
+    const guint8 *payload = (const guint8 *)(header + 1);
+    gsize payload_length = header->length - sizeof(RecordHeader);
+    if (compute_checksum(payload, payload_length) != header->checksum) return NULL;
+
+    /* The strings must be terminated within the record */
+    gsize num_strings = (gsize)header->num_roots + (gsize)header->num_hits * 2;
+    gsize position = 0;
+    for (gsize i = 0; i < num_strings; i++)
+    {
+        const void *end = memchr(payload + position, '\0', payload_length - position);
+        if (end == NULL) return NULL;
+        position = (const guint8 *)end - payload + 1;
+    }
+
+    return header;
+}
+
+/* Walk the records from `valid_end` of the mapped log and add them to the index */
+static void
+scan_history_index(ScanHistory *history)
+{
+    if (history->mapped == NULL) return;
+
+    const char *data = g_mapped_file_get_contents(history->mapped);
+    gsize size = g_mapped_file_get_length(history->mapped);
+
+    if (history->valid_end == 0)
+    {
+        if (size < SCAN_HISTORY_MAGIC_SIZE || memcmp(data, SCAN_HISTORY_MAGIC, SCAN_HISTORY_MAGIC_SIZE) != 0)
+        {
+            g_warning("[WARNING] Unknown scan history format: %s", history->path);
+            return; // Left as it is, the next append starts a new log
+        }
+        history->valid_end = SCAN_HISTORY_MAGIC_SIZE;
+    }
+
+    const RecordHeader *header;
+    while ((header = get_valid_record(data, size, history->valid_end)) != NULL)
+    {
+        gsize offset = history->valid_end;
+        g_array_append_val(history->offsets, offset);
+        history->valid_end += header->length;
+    }
+}
+
+/* Map the log again after it's changed */
+/*
+  * is_replaced: the log is a new file (compacted), the index is built again
+*/
+static void
+scan_history_reload(ScanHistory *history, gboolean is_replaced)
+{
+    if (is_replaced)
+    {
+        g_array_set_size(history->offsets, 0);
+        history->valid_end = 0;
+    }
+    g_clear_pointer(&history->mapped, g_mapped_file_unref);
+
+    g_autoptr(GError) error = NULL;
+    history->mapped = g_mapped_file_new(history->path, FALSE, &error);
+    if (history->mapped == NULL)
+    {
+        if (!g_error_matches(error, G_FILE_ERROR, G_FILE_ERROR_NOENT)) g_warning("[WARNING] Failed to map the scan history: %s", error->message);
+        g_array_set_size(history->offsets, 0);
+        history->valid_end = 0;
+        return;
+    }
+
+    if (g_mapped_file_get_length(history->mapped) < history->valid_end) // Replaced behind our back, start over
+    {
+        g_array_set_size(history->offsets, 0);
+        history->valid_end = 0;
+    }
+
+    scan_history_index(history);
+}
+
+/* Open the history of the user */
+ScanHistory *
+scan_history_open(void)
+{
+    ScanHistory *history = g_new0(ScanHistory, 1);
+
+    g_autofree char *directory = g_build_filename(g_get_user_data_dir(), "wuming", NULL);
+    history->path = g_build_filename(directory, "scan-history", NULL);
+    history->temp_path = g_build_filename(directory, "scan-history.tmp", NULL);
+    history->offsets = g_array_new(FALSE, FALSE, sizeof(gsize));
+    g_mutex_init(&history->mutex);
+
+    scan_history_reload(history, TRUE);
+
+    return history;
+}
+
+/* Close the history, wait for the compaction if it's running */
+void
+scan_history_close(ScanHistory **history)
+{
+    g_return_if_fail(history != NULL && *history != NULL);
+
+    if ((*history)->compaction != NULL) g_thread_join((*history)->compaction);
+    if ((*history)->compaction_source_id != 0) g_source_remove((*history)->compaction_source_id);
+
+    g_clear_pointer(&(*history)->mapped, g_mapped_file_unref);
+    g_array_unref((*history)->offsets);
+    g_mutex_clear(&(*history)->mutex);
+    g_free((*history)->path);
+    g_free((*history)->temp_path);
+
+    g_clear_pointer(history, g_free);
+}
+
+/* Write the whole buffer, retry if interrupted by a signal */
+static gboolean
+write_buffer(int fd, const void *buffer, gsize size)
+{
+    const char *data = buffer;
+    while (size > 0)
+    {
+        ssize_t written = write(fd, data, size);
+        if (written == -1 && errno == EINTR) continue;
+        if (written <= 0) return FALSE;
+
+        data += written;
+        size -= written;
+    }
+    return TRUE;
+}
+
+/* Copy the log from `offset` to the end, for the records appended while compacting */
+static gboolean
+copy_log_tail(int source_fd, int destination_fd, off_t offset)
+{
+    char buffer[65536];
+    while (TRUE)
+    {
+        ssize_t bytes = pread(source_fd, buffer, sizeof(buffer), offset);
+        if (bytes == -1 && errno == EINTR) continue;
+        if (bytes < 0) return FALSE;
+        if (bytes == 0) return TRUE;
+
+        if (!write_buffer(destination_fd, buffer, bytes)) return FALSE;
+        offset += bytes;
+    }
+}
+
+/* Called by the main loop when the compaction is finished */
+static gboolean
+on_compaction_finished(gpointer user_data)
+{
+    ScanHistory *history = user_data;
+
+    g_mutex_lock(&history->mutex);
+    g_thread_join(history->compaction);
+    history->compaction = NULL;
+    history->compaction_source_id = 0;
+    history->is_replaced = FALSE; // Reloaded right below, the main thread doesn't append meanwhile
+    g_mutex_unlock(&history->mutex);
+
+    scan_history_reload(history, TRUE);
+
+    return G_SOURCE_REMOVE;
+}
+
+/* Rewrite the log with the newest records, in the background */
+/*
+  * The records are read from a mapping of its own, the main thread may append while it runs
+  * The log is only locked at the end, to copy the records appended meanwhile and rename the new log over it
+*/
+static gpointer
+compaction_thread(gpointer user_data)
+{
+    ScanHistory *history = user_data;
+    gboolean is_compacted = FALSE;
+    int temp_fd = -1;
+    int log_fd = -1;
+
+    g_autoptr(GError) error = NULL;
+    g_autoptr(GMappedFile) mapped = g_mapped_file_new(history->path, FALSE, &error);
+    if (mapped == NULL) goto finish;
+
+    const char *data = g_mapped_file_get_contents(mapped);
+    gsize size = g_mapped_file_get_length(mapped);
+    if (size < SCAN_HISTORY_MAGIC_SIZE || memcmp(data, SCAN_HISTORY_MAGIC, SCAN_HISTORY_MAGIC_SIZE) != 0) goto finish;
+
+    /* Count the records, then skip the oldest ones */
+    gsize num_records = 0;
+    gsize end = SCAN_HISTORY_MAGIC_SIZE;
+    const RecordHeader *header;
+    while ((header = get_valid_record(data, size, end)) != NULL)
+    {
+        num_records++;
+        end += header->length;
+    }
+
+    gsize start = SCAN_HISTORY_MAGIC_SIZE;
+    for (gsize i = 0; i + SCAN_HISTORY_KEEP_RECORDS < num_records; i++) start += get_valid_record(data, size, start)->length;
+
+    temp_fd = open(history->temp_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (temp_fd == -1 || !write_buffer(temp_fd, SCAN_HISTORY_MAGIC, SCAN_HISTORY_MAGIC_SIZE) ||
+        !write_buffer(temp_fd, data + start, end - start)) goto finish;
+
+    g_mutex_lock(&history->mutex);
+    log_fd = open(history->path, O_RDONLY | O_CLOEXEC);
+    is_compacted = log_fd != -1 && copy_log_tail(log_fd, temp_fd, (off_t)end) && fsync(temp_fd) == 0 &&
+                   rename(history->temp_path, history->path) == 0;
+    if (is_compacted) history->is_replaced = TRUE;
+    g_mutex_unlock(&history->mutex);
+
+finish:
+    if (!is_compacted) g_warning("[WARNING] Failed to compact the scan history: %s", error != NULL ? error->message : g_strerror(errno));
+    if (temp_fd != -1) close(temp_fd);
+    if (log_fd != -1) close(log_fd);
+    if (!is_compacted) g_unlink(history->temp_path);
+
+    g_mutex_lock(&history->mutex);
+    history->compaction_source_id = g_idle_add(on_compaction_finished, history);
+    g_mutex_unlock(&history->mutex);
+
+    return NULL;
+}
+
+/* Append the strings with their terminators */
+static void
+append_string(GByteArray *record, const char *string)
+{
+    g_byte_array_append(record, (const guint8 *)(string != NULL ? string : ""), strlen(string != NULL ? string : "") + 1);
+}
+
+/* Append a record of a scan */
+gboolean
+scan_history_append(ScanHistory *history, const ScanHistorySummary *summary, const char *const *roots, const ScanHistoryHit *hits, gsize num_hits)
+{
+    g_return_val_if_fail(history != NULL && summary != NULL, FALSE);
+
+    num_hits = MIN(num_hits, SCAN_HISTORY_MAX_HITS);
+
+    RecordHeader header = {
+        .magic = SCAN_HISTORY_RECORD_MAGIC,
+        .time = summary->time,
+        .duration = summary->duration,
+        .files = summary->files,
+        .threats = summary->threats,
+        .bytes = summary->bytes,
+        .flags = summary->flags,
+        .num_roots = roots != NULL ? g_strv_length((char **)roots) : 0,
+        .num_hits = (guint32)num_hits,
+    };
+
+    g_autoptr(GByteArray) record = g_byte_array_new();
+    g_byte_array_append(record, (const guint8 *)&header, sizeof(header));
+    for (guint32 i = 0; i < header.num_roots; i++) append_string(record, roots[i]);
+    for (gsize i = 0; i < num_hits; i++)
+    {
+        append_string(record, hits[i].path);
+        append_string(record, hits[i].virname);
+    }
+    while (record->len % 8 != 0) g_byte_array_append(record, (const guint8 *)"", 1);
+
+    if (record->len > SCAN_HISTORY_MAX_RECORD_SIZE) return FALSE;
+
+    RecordHeader *written_header = (RecordHeader *)record->data;
+    written_header->length = record->len;
+    written_header->checksum = compute_checksum(record->data + sizeof(header), record->len - sizeof(header));
+
+    g_autofree char *directory = g_path_get_dirname(history->path);
+    if (g_mkdir_with_parents(directory, 0700) == -1)
+    {
+        g_warning("[WARNING] Failed to create %s: %s", directory, g_strerror(errno));
+        return FALSE;
+    }
+
+    g_mutex_lock(&history->mutex);
+
+    gboolean is_success = FALSE;
+    gboolean is_replaced = history->is_replaced;
+    history->is_replaced = FALSE;
+    int fd = open(history->path, O_WRONLY | O_CREAT | O_CLOEXEC, 0600);
+    struct stat status;
+    if (fd != -1 && fstat(fd, &status) == 0)
+    {
+        /* A torn or unknown tail is dropped, a log without a valid header starts over */
+        /* The compacted log only has whole records, it's appended at its end */
+        off_t end = is_replaced ? status.st_size : (history->valid_end >= SCAN_HISTORY_MAGIC_SIZE ? (off_t)history->valid_end : 0);
+        is_success = ftruncate(fd, end) == 0 && lseek(fd, end, SEEK_SET) == end &&
+                     (end > 0 || write_buffer(fd, SCAN_HISTORY_MAGIC, SCAN_HISTORY_MAGIC_SIZE)) &&
+                     write_buffer(fd, record->data, record->len);
+    }
+    if (fd != -1) close(fd);
+    if (!is_success) g_warning("[WARNING] Failed to write the scan history: %s", g_strerror(errno));
+
+    gboolean needs_compaction = is_success && history->compaction == NULL && history->offsets->len + 1 > SCAN_HISTORY_COMPACT_THRESHOLD;
+    if (needs_compaction) history->compaction = g_thread_new("scan-history-compaction", compaction_thread, history);
+
+    g_mutex_unlock(&history->mutex);
+
+    scan_history_reload(history, is_replaced);
+
+    return is_success;
+}
+
+/* Get the number of records, the oldest one is at index 0 */
+gsize
+scan_history_get_count(ScanHistory *history)
+{
+    g_return_val_if_fail(history != NULL, 0);
+
+    return history->offsets->len;
+}
+
+/* Get the header of a record in the mapping */
+static const RecordHeader *
+get_record(ScanHistory *history, gsize index)
+{
+    if (history == NULL || index >= history->offsets->len) return NULL;
+
+    const char *data = g_mapped_file_get_contents(history->mapped);
+    return (const RecordHeader *)(data + g_array_index(history->offsets, gsize, index));
+}
+
+/* Get the summary of a record */
+gboolean
+scan_history_get_summary(ScanHistory *history, gsize index, ScanHistorySummary *summary)
+{
+    g_return_val_if_fail(summary != NULL, FALSE);
+
+    const RecordHeader *header = get_record(history, index);
+    if (header == NULL) return FALSE;
+
+    *summary = (ScanHistorySummary){
+        .time = header->time,
+        .duration = header->duration,
+        .files = header->files,
+        .threats = header->threats,
+        .bytes = header->bytes,
+        .flags = header->flags,
+    };
+    return TRUE;
+}
+
+/* Find the first record that was finished at or after `time` */
+// The records are appended in the order they are finished, so they are sorted by time unless the clock has been set back
+gsize
+scan_history_find(ScanHistory *history, gint64 time)
+{
+    g_return_val_if_fail(history != NULL, 0);
+
+    gsize low = 0;
+    gsize high = history->offsets->len;
+    while (low < high)
+    {
+        gsize middle = low + (high - low) / 2;
+        if (get_record(history, middle)->time < time) low = middle + 1;
+        else high = middle;
+    }
+    return low;
+}
+
+/* Summarize the scans finished at or after `since` */
+void
+scan_history_get_trend(ScanHistory *history, gint64 since, ScanHistoryTrend *trend)
+{
+    g_return_if_fail(history != NULL && trend != NULL);
+
+    *trend = (ScanHistoryTrend){0};
+    for (gsize i = scan_history_find(history, since); i < history->offsets->len; i++)
+    {
+        const RecordHeader *header = get_record(history, i);
+        trend->scans++;
+        if ((header->flags & (SCAN_HISTORY_SUCCESS | SCAN_HISTORY_CANCELED)) == 0) trend->failed_scans++;
+        trend->files += header->files;
+        trend->threats += header->threats;
+    }
+}
+
+/* Call `func` for each threat of a record */
+gboolean
+scan_history_foreach_hit(ScanHistory *history, gsize index, ScanHistoryHitFunc func, gpointer user_data)
+{
+    g_return_val_if_fail(func != NULL, FALSE);
+
+    const RecordHeader *header = get_record(history, index);
+    if (header == NULL) return FALSE;
+
+    const char *string = (const char *)(header + 1);
+    for (guint32 i = 0; i < header->num_roots; i++) string += strlen(string) + 1; // Validated by `get_valid_record()`
+
+    for (guint32 i = 0; i < header->num_hits; i++)
+    {
+        const char *path = string;
+        const char *virname = path + strlen(path) + 1;
+        string = virname + strlen(virname) + 1;
+
+        func(path, virname[0] != '\0' ? virname : NULL, user_data);
+    }
+    return TRUE;
+}
@@ -0,0 +1,120 @@
+/* scan-history.h
+ *
+ * Copyright 2025 EricLin
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+/* The history of the scans */
+/*
+  * Every finished scan appends a record to a log under the user data directory: the summary, the scanned paths and the threats found
+  * The log is memory-mapped and indexed by the time of the records, so the summaries and the past reports are read without copying
+  * The log only grows, when it has too many records the oldest ones are dropped by rewriting it in a background thread
+*/
+
+#pragma once
+
+#include <glib.h>
+
+#define SCAN_HISTORY_COMPACT_THRESHOLD 1024 // Compact the log when it has more records
+#define SCAN_HISTORY_KEEP_RECORDS 512 // The newest records kept by the compaction
+#define SCAN_HISTORY_TREND_DAYS 30 // The period of the trend on the security overview page
+#define SCAN_HISTORY_MAX_HITS 10000 // The threats recorded per scan, the summary still counts all of them
+
+/* The flags of a scan */
+#define SCAN_HISTORY_SUCCESS 0x01 // The scan has finished without an error
+#define SCAN_HISTORY_CANCELED 0x02 // The scan was canceled by the user
+
+typedef struct ScanHistory ScanHistory;
+
+/* The summary of a scan */
+typedef struct {
+    gint64 time; // When the scan has finished, in microseconds since the epoch (see `g_get_real_time()`)
+    gint64 duration; // In microseconds
+    guint64 files;
+    guint64 threats;
+    guint64 bytes;
+    guint32 flags; // `SCAN_HISTORY_*`
+} ScanHistorySummary;
+
+/* The summary of the scans in a period */
+typedef struct {
+    guint scans;
+    guint failed_scans; // Neither successful nor canceled
+    guint64 files;
+    guint64 threats;
+} ScanHistoryTrend;
+
+/* A threat found by a scan */
+typedef struct {
+    const char *path;
+    const char *virname; // NULL if unknown
+} ScanHistoryHit;
+
+/* Called for each threat of a record */
+typedef void (*ScanHistoryHitFunc)(const char *path, const char *virname, gpointer user_data);
+
+/* Open the history of the user */
+/*
+  * @return
+  * The history, it's empty if the log can't be read (a new log is created by the first record)
+*/
+ScanHistory *
+scan_history_open(void);
+
+/* Close the history, wait for the compaction if it's running */
+void
+scan_history_close(ScanHistory **history);
+
+/* Append a record of a scan */
+/*
+  * roots: the scanned paths, NULL-terminated
+  * hits: the threats found, only the first `SCAN_HISTORY_MAX_HITS` are recorded
+  * @return
+  * FALSE if the record can't be written
+  * @note
+  * This may start the compaction in the background
+*/
+gboolean
+scan_history_append(ScanHistory *history, const ScanHistorySummary *summary, const char *const *roots, const ScanHistoryHit *hits, gsize num_hits);
+
+/* Get the number of records, the oldest one is at index 0 */
+gsize
+scan_history_get_count(ScanHistory *history);
+
+/* Get the summary of a record */
+gboolean
+scan_history_get_summary(ScanHistory *history, gsize index, ScanHistorySummary *summary);
+
+/* Find the first record that was finished at or after `time` */
+/*
+  * @return
+  * The index of the record, or the count of the records if there is none
+*/
+gsize
+scan_history_find(ScanHistory *history, gint64 time);
+
+/* Summarize the scans finished at or after `since` */
+void
+scan_history_get_trend(ScanHistory *history, gint64 since, ScanHistoryTrend *trend);
+
+/* Call `func` for each threat of a record */
+/*
+  * @return
+  * FALSE if the index is out of range
+*/
+gboolean
+scan_history_foreach_hit(ScanHistory *history, gsize index, ScanHistoryHitFunc func, gpointer user_data);
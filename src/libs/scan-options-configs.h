@@ -20,12 +20,6 @@
 
 #pragma once
 
-#define SCAN_OPTIONS_N_ELEMENTS 6
+#include "../clamscanc/profile.h" // The bits of the scan options are shared with the profiles of clamscanc
 
-/* The bitmask of scan options */
-#define SCAN_OPTIONS_ENABLE_LARGE_FILE 0x01
-#define SCAN_OPTIONS_ENABLE_PUA 0x02
-#define SCAN_OPTIONS_SCAN_ARCHIVE 0x04
-#define SCAN_OPTIONS_SCAN_MAIL 0x08
-#define SCAN_OPTIONS_ALERT_EXCEED_MAX 0x10
-#define SCAN_OPTIONS_ALERT_ENCRYPTED 0x20
\ No newline at end of file
+#define SCAN_OPTIONS_N_ELEMENTS 6
@@ -18,13 +18,16 @@
  * SPDX-License-Identifier: GPL-3.0-or-later
  */
 
-#define _XOPEN_SOURCE 500
+#define _GNU_SOURCE // For `FTW_ACTIONRETVAL` of `nftw()`
 #include <glib/gi18n.h>
 #include <gio/gio.h>
+#include <glib-unix.h>
 #include <limits.h>
 #include <fcntl.h>
 #include <stdbool.h>
 #include <signal.h>
+#include <pthread.h>
+#include <sys/stat.h>
 #include <sys/wait.h>
 #include <ftw.h>
 #include <stdio.h>
@@ -32,6 +35,17 @@
 #include <unistd.h>
 
 #include "subprocess-components.h"
+#include "clamd-client.h"
+#include "scan-history.h"
+#include "../clamscanc/result-protocol.h"
+#include "../clamscanc/exclusion.h"
+#include "../clamscanc/json-lines.h"
+#include "../clamscanc/background.h"
+#include "../clamscanc/checkpoint.h"
+#include "../clamscanc/priority.h"
+#include "../clamscanc/profile.h"
+#include "../clamscanc/roots.h"
+#include "../clamscanc/trace.h"
 #include "scan-options-configs.h"
 #include "systemd-control.h"
 #include "../wuming-window.h"
@@ -42,6 +56,23 @@
 
 #define CLAMDSCAN_PATH "/usr/bin/clamdscan"
 #define CLAMSCAN_PATH_FALLBACK "/usr/bin/clamscan"
+#define SYSTEMD_RUN_PATH "/usr/bin/systemd-run"
+#define BACKGROUND_IO_WEIGHT "IOWeight=10" // A tenth of the default weight (100), the idle I/O class does the rest
+#define THROTTLE_POLL_US (100 * 1000) // The enumerator rechecks the cancellation this often while it waits for the throttle
+
+#ifndef CLAMSCANC_PATH
+#define CLAMSCANC_PATH "/usr/bin/clamscanc"
+#endif
+
+#define CLAMSCANC_READ_SIZE 65536 // Read the binary stream in chunks of this size
+#define CLAMSCANC_PROGRESS_INTERVAL_MS "100" // How often `clamscanc` reports the counts when the clean files aren't output
+
+typedef enum {
+  SCAN_BACKEND_CLAMD, // ClamAV daemon is running, talk to it through several connections
+  SCAN_BACKEND_CLAMDSCAN, // ClamAV daemon is running but can't be reached through the local socket
+  SCAN_BACKEND_CLAMSCANC, // Parallel scan processes, output the binary result stream
+  SCAN_BACKEND_CLAMSCAN // Single process fallback
+} ScanBackend;
 
 typedef struct ScanContext {
   /* Protected by mutex */
@@ -52,11 +83,17 @@ typedef struct ScanContext {
   int pipefd[2];
   pid_t pid;
   RingBuffer ring_buffer; // Ring buffer to store the output of the scan process
+  guint output_source_id; // The watch reading `pipefd[0]`, 0 if the output is finished
+  ScanBackend backend; // The scanner used by the current scan
+  GByteArray *frames; // The incomplete frames from `clamscanc`
+  gboolean has_magic; // Whether the stream magic of `clamscanc` has been checked
+  gboolean is_infected_only; // The scanner only outputs the threats and the errors, the files are counted by its progress or the enumerator
 
   /* Protected by atomic operation */
   gboolean should_cancel; // Whether the scan should be cancelled
   gint total_files; // Total files scanned
   gint total_threats; // Total threats found during scan
+  gsize total_bytes; // Total bytes scanned, 0 if the scanner doesn't report it
 
   GMutex threats_mutex; // Only protect "ThreatPage" fields
   ThreatPage *threat_page; // The threat page
@@ -67,21 +104,48 @@ typedef struct ScanContext {
   SecurityOverviewPage *security_overview_page; // The security overview page
   ScanPage *scan_page; // The scan page
   ScanningPage *scanning_page; // The scanning page
-  char *path; // file/folder path
-  char *temp_file_path; // path to the temporary file for file list
+  char **paths; // file/folder paths, the roots of the scan (`NULL` terminated)
+  char *temp_dir_path; // path to the temporary directory holding the file list FIFO
+  char *file_list_path; // path to the FIFO read by `clamdscan -f`
 
-} ScanContext;
+  GThread *enumerator; // The thread writing the file list while clamd is scanning
+  ClamdClient *clamd_client; // The native clamd client, NULL if not using `SCAN_BACKEND_CLAMD`
 
-static FILE *temp_file_fp;
+  GMutex results_mutex; // Only protect "pending_results" and "flush_source_id" fields
+  GPtrArray *pending_results; // The results from the clamd connections, waiting to be handled in the main thread
+  guint flush_source_id; // The idle source handling "pending_results", 0 if not scheduled
+  gint stop_enumerator; // Protected by atomic operation, stop the enumerator when the scan is finished
 
-static int
-collect_file_path(const char *fpath, const struct stat *sb, int tflag, struct FTW *ftwbuf)
-{
-  if (tflag == FTW_F) {
-    fprintf(temp_file_fp, "%s\n", fpath);
-  }
-  return 0;
-}
+  ExclusionRules exclusions; // Loaded when a scan starts, only read by the enumerator while it's running
+  GPtrArray *exclusion_args; // The same rules as the options of `clamscanc`
+
+  gboolean is_background; // Run the local scanners at the idle priority, loaded when a scan starts
+  char *cpu_quota_property; // The `CPUQuota=` of the systemd scope, NULL for no scope
+  ScanThrottle throttle; // Limits the files handed to the ClamAV daemon by the enumerator
+  GPtrArray *background_args; // The same limits as the options of `clamscanc`
+
+  char *profile_arg; // The scan profile of `clamscanc`, loaded when a scan starts
+  GPtrArray *clamscan_profile_args; // The same profile as the options of `clamscan`
+  GPtrArray *database_args; // The excluded databases as the options of `clamscanc`
+
+  FILE *export_file; // The results exported as JSON Lines, NULL if the export is disabled
+
+  ScanTrace trace; // The spans of the main loop, only mapped if `TRACE_ENV` is set when a scan starts
+  char *trace_path; // Where the spans are exported, after the ones of `clamscanc`, NULL if not tracing
+
+  ScanHistory *history; // The records of the finished scans
+  gint64 start_time; // When the current scan was started, for its record
+  GArray *history_hits; // ScanHistoryHit, the threats of the current scan (protected by "threats_mutex")
+  gboolean is_report_open; // The threat page shows a past report instead of the current scan
+  gboolean is_finish_deferred; // The scan is complete, but some threats are still waiting for their snapshots
+  const char *deferred_message; // The final message of the deferred completion
+  int deferred_exit_status; // The exit status of the deferred completion
+
+  gboolean is_resume; // Continue the interrupted scan of `path` from its checkpoint
+  char *checkpoint_path; // The checkpoint of the folder scans of `clamscanc`
+  gboolean is_checkpointed; // Whether the current scan writes the checkpoint
+
+} ScanContext;
 
 /* thread-safe method to get/set states */
 static void
@@ -128,11 +192,11 @@ reset_cancel_scan(ScanContext *ctx)
   g_atomic_int_set(&ctx->should_cancel, FALSE);
 }
 
-/* thread-safe method to inc/get/reset total threats */
+/* thread-safe method to add/get/reset total threats */
 static void
-inc_total_threats(ScanContext *ctx)
+add_total_threats(ScanContext *ctx, guint num_threats)
 {
-  g_atomic_int_inc(&ctx->total_threats);
+  g_atomic_int_add(&ctx->total_threats, (gint)num_threats);
 }
 
 static void
@@ -160,12 +224,43 @@ get_total_files(ScanContext *ctx)
   return g_atomic_int_get(&ctx->total_files);
 }
 
+static void
+set_total_files(ScanContext *ctx, guint64 files)
+{
+  g_atomic_int_set(&ctx->total_files, (gint)MIN(files, G_MAXINT));
+}
+
 static void
 reset_total_files(ScanContext *ctx)
 {
   g_atomic_int_set(&ctx->total_files, 0);
 }
 
+/* thread-safe method to add/get/reset total bytes */
+static void
+add_total_bytes(ScanContext *ctx, guint64 bytes)
+{
+  g_atomic_pointer_add(&ctx->total_bytes, (gssize)bytes);
+}
+
+static gsize
+get_total_bytes(ScanContext *ctx)
+{
+  return (gsize)g_atomic_pointer_get(&ctx->total_bytes);
+}
+
+static void
+set_total_bytes(ScanContext *ctx, guint64 bytes)
+{
+  g_atomic_pointer_set(&ctx->total_bytes, (gsize)bytes);
+}
+
+static void
+reset_total_bytes(ScanContext *ctx)
+{
+  g_atomic_pointer_set(&ctx->total_bytes, 0);
+}
+
 static char *
 get_status_text(ScanContext *ctx)
 {
@@ -179,62 +274,770 @@ get_status_text(ScanContext *ctx)
   return g_steal_pointer(&status_text);
 }
 
-/* The ui callback function for `process_output_lines()` */
+/* Only one scan runs at a time, so the `nftw()` callback reaches the enumerator state through these */
+static FILE *file_list_fp;
+static ScanContext *enumerating_ctx;
+
+/* Check whether the entry matches the exclusion rules, the root is checked with its parent directories */
 static gboolean
-scan_ui_callback(gpointer user_data)
+is_path_excluded(const ExclusionRules *rules, const char *fpath, const struct stat *sb, int tflag, struct FTW *ftwbuf)
 {
-  IdleData *data = (IdleData *)user_data;
-  ScanContext *ctx = (ScanContext *)get_idle_context(data);
+  if (rules->is_empty) return FALSE;
 
-  g_return_val_if_fail(data && ctx, G_SOURCE_REMOVE);
+  gboolean is_dir = (tflag == FTW_D);
+  if (!is_dir && exclusion_rules_exceeds_size(rules, (uint64_t)sb->st_size)) return TRUE;
+  if (ftwbuf->level == 0) return exclusion_rules_match_path(rules, fpath, is_dir);
+
+  return exclusion_rules_match(rules, fpath, (size_t)ftwbuf->base - 1, fpath + ftwbuf->base, is_dir);
+}
+
+/* Wait for the turn of a file of `size` bytes, still noticing a cancellation */
+/*
+  * @return
+  * FALSE if the scan is stopped while waiting
+*/
+static gboolean
+wait_for_throttle(ScanContext *ctx, guint64 size)
+{
+  guint64 start = scan_throttle_reserve(&ctx->throttle, size);
+
+  while (start > 0)
+  {
+    if (g_atomic_int_get(&ctx->stop_enumerator) || get_cancel_scan(ctx)) return FALSE;
+
+    guint64 now = (guint64)g_get_monotonic_time() * 1000; // `CLOCK_MONOTONIC` as well, in microseconds
+    if (now >= start) break;
+
+    g_usleep(MIN((start - now) / 1000, THROTTLE_POLL_US));
+  }
+
+  return TRUE;
+}
+
+static int
+collect_file_path(const char *fpath, const struct stat *sb, int tflag, struct FTW *ftwbuf)
+{
+  if (g_atomic_int_get(&enumerating_ctx->stop_enumerator) || get_cancel_scan(enumerating_ctx)) return FTW_STOP; // Stop walking
+
+  if (tflag == FTW_D && is_path_excluded(&enumerating_ctx->exclusions, fpath, sb, tflag, ftwbuf))
+    return FTW_SKIP_SUBTREE; // Never opened
 
-  const char *message = get_idle_message(data); // Get the message from the ring buffer
-  char *status_marker = NULL; // Check file is OK or FOUND
+  if (tflag == FTW_F && !is_path_excluded(&enumerating_ctx->exclusions, fpath, sb, tflag, ftwbuf)) {
+    if (!wait_for_throttle(enumerating_ctx, (guint64)sb->st_size)) return FTW_STOP;
+
+    if (enumerating_ctx->clamd_client != NULL) {
+      if (!clamd_client_push(enumerating_ctx->clamd_client, g_strdup(fpath))) return FTW_STOP; // Cancelled or all connections are lost
+    }
+    else if (fprintf(file_list_fp, "%s\n", fpath) < 0) return FTW_STOP; // clamdscan has exited (`EPIPE`)
+    else if (enumerating_ctx->is_infected_only) inc_total_files(enumerating_ctx); // clamdscan doesn't output the clean files, at most a FIFO ahead of it
+  }
+  return FTW_CONTINUE;
+}
 
-  if ((status_marker = strstr(message, " FOUND")) != NULL)
+/* Open the file list FIFO for writing, wait until clamdscan opens it for reading */
+static FILE *
+open_file_list(ScanContext *ctx)
+{
+  int fd;
+  while ((fd = open(ctx->file_list_path, O_WRONLY | O_NONBLOCK)) == -1)
   {
-    /* Add threat path to the list */
-    char *colon = strrchr(message, ':'); // Find the last colon separator
-    char *virname = NULL;
-    if (colon == NULL || colon >= status_marker) return G_SOURCE_REMOVE; // Handle the case where the colon is missing or after the `FOUND` string
+    /* `ENXIO` means there is no reader yet, don't block in `open()` in case clamdscan never opens it */
+    if (errno != ENXIO || g_atomic_int_get(&ctx->stop_enumerator) || get_cancel_scan(ctx)) return NULL;
 
-    *colon = '\0'; // Replace the colon with null terminator
-    *status_marker = '\0'; // Replace the last space with null terminator
-    virname = colon + 2 < status_marker ? colon + 2 : NULL; // Get the virname from the message
+    g_usleep(10 * 1000);
+  }
+
+  int curr_flags = fcntl(fd, F_GETFL, 0);
+  fcntl(fd, F_SETFL, curr_flags & ~O_NONBLOCK); // Block when the FIFO is full, so the walk never runs far ahead of the scan
+
+  FILE *fp = fdopen(fd, "w");
+  if (fp == NULL) close(fd);
+
+  return fp;
+}
+
+/* Walk the roots one after another, the files of all of them go to the same scan */
+static void
+walk_scan_roots(ScanContext *ctx)
+{
+  enumerating_ctx = ctx;
+  for (char **path = ctx->paths; *path != NULL; path++)
+  {
+    if (g_atomic_int_get(&ctx->stop_enumerator) || get_cancel_scan(ctx)) break;
+    nftw(*path, collect_file_path, 20, FTW_PHYS | FTW_ACTIONRETVAL);
+  }
+  enumerating_ctx = NULL;
+}
+
+/* Walk the paths and stream the files to the native clamd client */
+static gpointer
+enumerate_files_to_clamd_thread(gpointer user_data)
+{
+  ScanContext *ctx = user_data;
+
+  walk_scan_roots(ctx);
+
+  clamd_client_finish_input(ctx->clamd_client);
+
+  return NULL;
+}
+
+/* Walk the paths and stream the files to clamdscan */
+/*
+  * This runs in its own thread, so the main loop keeps responsive and clamdscan starts scanning while the walk is going on
+  * Closing the FIFO tells clamdscan that the list is finished
+*/
+static gpointer
+enumerate_files_thread(gpointer user_data)
+{
+  ScanContext *ctx = user_data;
+
+  /* Get `EPIPE` instead of being killed if clamdscan exits early */
+  sigset_t sigpipe_mask;
+  sigemptyset(&sigpipe_mask);
+  sigaddset(&sigpipe_mask, SIGPIPE);
+  pthread_sigmask(SIG_BLOCK, &sigpipe_mask, NULL);
+
+  file_list_fp = open_file_list(ctx);
+  if (file_list_fp == NULL)
+  {
+    if (!g_atomic_int_get(&ctx->stop_enumerator) && !get_cancel_scan(ctx))
+      g_critical("[ERROR] Failed to open the file list %s: %s", ctx->file_list_path, strerror(errno));
+    return NULL;
+  }
+
+  setvbuf(file_list_fp, NULL, _IOFBF, 64 * 1024); // Same as the FIFO capacity
+
+  walk_scan_roots(ctx);
+
+  fclose(file_list_fp); // Also flush the last paths
+  file_list_fp = NULL;
+
+  return NULL;
+}
+
+/* Stop the enumerator thread, close the clamd connections and remove the file list FIFO */
+static void
+scan_context_stop_enumerator(ScanContext *ctx)
+{
+  g_atomic_int_set(&ctx->stop_enumerator, TRUE);
+  if (ctx->clamd_client) clamd_client_cancel(ctx->clamd_client); // Wake up the enumerator if it's waiting for the queue, no-op if finished
+  g_clear_pointer(&ctx->enumerator, g_thread_join); // The scanner has exited, so the thread can't be blocked by the FIFO
+  g_clear_pointer(&ctx->clamd_client, clamd_client_free);
+
+  if (ctx->file_list_path) {
+      unlink(ctx->file_list_path);
+      g_clear_pointer(&ctx->file_list_path, g_free);
+  }
+
+  if (ctx->temp_dir_path) {
+      rmdir(ctx->temp_dir_path);
+      g_clear_pointer(&ctx->temp_dir_path, g_free);
+  }
+}
+
+/* Open the JSON Lines export of the results, appended to the file set in the settings */
+static void
+scan_context_open_export(ScanContext *ctx)
+{
+  GSettings *settings = g_settings_new("com.ericlin.wuming");
+  g_autofree char *export_path = g_settings_get_string(settings, "result-export-path");
+  g_object_unref(settings);
+
+  if (export_path[0] == '\0') return;
+
+  ctx->export_file = fopen(export_path, "ae");
+  if (ctx->export_file == NULL) g_warning("Failed to open the result export %s: %s", export_path, strerror(errno));
+}
+
+/* Close the JSON Lines export of the results */
+static void
+scan_context_close_export(ScanContext *ctx)
+{
+  if (ctx->export_file == NULL) return;
 
+  if (fclose(ctx->export_file) != 0) g_warning("Failed to write the result export: %s", strerror(errno));
+  ctx->export_file = NULL;
+}
+
+/* Start tracing the current scan if `TRACE_ENV` is set */
+static void
+scan_context_open_trace(ScanContext *ctx)
+{
+  const char *trace_path = g_getenv(TRACE_ENV);
+  if (trace_path == NULL || trace_path[0] == '\0') return;
+
+  if (!scan_trace_enable(&ctx->trace, 1))
+  {
+    g_warning("Scanning without tracing");
+    return;
+  }
+  scan_trace_attach(&ctx->trace, 0, "main loop", 0);
+  ctx->trace_path = g_strdup(trace_path);
+}
+
+/* Export the spans of the main loop and stop tracing */
+// is_append: `clamscanc` has written its spans to the same file
+static void
+scan_context_close_trace(ScanContext *ctx, gboolean is_append)
+{
+  if (ctx->trace_path == NULL) return;
+
+  if (!scan_trace_export(&ctx->trace, ctx->trace_path, (int)getpid(), "wuming", is_append))
+    g_warning("Failed to write the trace %s", ctx->trace_path);
+
+  scan_trace_clear(&ctx->trace);
+  g_clear_pointer(&ctx->trace_path, g_free);
+}
+
+/* Append a result to the JSON Lines export */
+// The lines go through the buffer of the `FILE`, nothing is kept per result. Called by the main loop only
+// path_length: the path isn't NUL-terminated in a frame, bytes_scanned, duration_ns: -1 if unknown
+static void
+export_scan_result(ScanContext *ctx, const char *path, size_t path_length, const char *verdict, const char *detail, size_t detail_length,
+                   gint64 bytes_scanned, gint64 duration_ns)
+{
+  static char line[JSON_RESULT_LINE_SIZE(PATH_MAX, SCAN_RESULT_MAX_VIRNAME)];
+
+  if (ctx->export_file == NULL) return;
+
+  gboolean is_error = g_strcmp0(verdict, JSON_VERDICT_ERROR) == 0;
+  JsonResult result = {
+    .path = path,
+    .path_length = path_length,
+    .verdict = verdict,
+    .virus = is_error ? NULL : detail,
+    .virus_length = detail_length,
+    .error = is_error ? detail : NULL,
+    .error_length = detail_length,
+    .size = -1, // Only the bytes scanned are reported by the backends
+    .bytes_scanned = bytes_scanned,
+    .duration_ns = duration_ns,
+    .worker = -1,
+  };
+
+  size_t length = json_result_format(&result, line, sizeof(line));
+  if (length > 0) fwrite(line, 1, length, ctx->export_file);
+}
+
+/* Count the scan result and add the threat to the threat page */
+// virname: NULL if unknown, bytes: 0 if unknown
+// If the scanner only outputs the threats, the files and the bytes are counted elsewhere
+static void
+handle_scan_result(ScanContext *ctx, const char *path, const char *virname, gboolean is_threat, guint64 bytes)
+{
+  const guint64 trace_start = trace_begin(TRACE_HANDLE_RESULT);
+  if (!ctx->is_infected_only) add_total_bytes(ctx, bytes);
+
+  if (is_threat)
+  {
     g_mutex_lock(&ctx->threats_mutex);
 
     if (virname != NULL && g_strcmp0(virname, "Heuristics.Structured.CreditCardNumber") == 0)
     {
       g_mutex_unlock(&ctx->threats_mutex);
-      return G_SOURCE_REMOVE;
+      trace_end(TRACE_HANDLE_RESULT, trace_start);
+      return;
     }
 
-    if (threat_page_add_threat(ctx->threat_page, message, virname)) // Ensure the threat path can be added to the list
+    if (threat_page_add_threat(ctx->threat_page, path, virname)) // The threat is counted once a worker of the threat page has taken its snapshot
     {
-      inc_total_files(ctx);
-      inc_total_threats(ctx);
+      if (!ctx->is_infected_only) inc_total_files(ctx);
+
+      if (ctx->history_hits->len < SCAN_HISTORY_MAX_HITS)
+      {
+        ScanHistoryHit hit = { .path = g_strdup(path), .virname = g_strdup(virname) };
+        g_array_append_val(ctx->history_hits, hit);
+      }
     }
 
     g_mutex_unlock(&ctx->threats_mutex);
   }
-  else if ((status_marker = strstr(message, " OK")) != NULL) inc_total_files(ctx);
-  else return G_SOURCE_REMOVE; // Ignore the message if it is not a threat or OK message
+  else if (!ctx->is_infected_only) inc_total_files(ctx);
 
-  g_autofree char *status_text = get_status_text(ctx);
-  scanning_page_set_progress(ctx->scanning_page, status_text);
+  trace_end(TRACE_HANDLE_RESULT, trace_start);
+}
+
+/* The progress function of the scanning page, only reads the counters so it's cheap enough for every frame */
+static void
+get_scan_progress(gpointer user_data, ScanningPageProgress *progress)
+{
+  ScanContext *ctx = user_data;
+
+  progress->files = get_total_files(ctx);
+  progress->threats = get_total_threats(ctx);
+  progress->bytes = get_total_bytes(ctx);
+}
+
+typedef struct ClamdResult {
+  char *path;
+  char *virname;
+  gboolean is_threat;
+  guint64 size;
+} ClamdResult;
+
+static void
+clamd_result_free(gpointer user_data)
+{
+  ClamdResult *result = user_data;
+
+  g_free(result->path);
+  g_free(result->virname);
+  g_free(result);
+}
+
+/* Handle the results queued by the connection threads */
+static void
+flush_clamd_results(ScanContext *ctx)
+{
+  g_mutex_lock(&ctx->results_mutex);
+  GPtrArray *results = g_steal_pointer(&ctx->pending_results);
+  ctx->pending_results = g_ptr_array_new_with_free_func(clamd_result_free);
+  ctx->flush_source_id = 0;
+  g_mutex_unlock(&ctx->results_mutex);
+
+  for (guint i = 0; i < results->len; i++)
+  {
+    ClamdResult *result = g_ptr_array_index(results, i);
+    export_scan_result(ctx, result->path, strlen(result->path), result->is_threat ? JSON_VERDICT_INFECTED : JSON_VERDICT_CLEAN,
+                       result->virname, result->virname != NULL ? strlen(result->virname) : 0, result->size > 0 ? (gint64)result->size : -1, -1);
+    handle_scan_result(ctx, result->path, result->virname, result->is_threat, result->size);
+  }
+
+  g_ptr_array_unref(results);
+}
+
+static gboolean
+clamd_results_ui_callback(gpointer user_data)
+{
+  flush_clamd_results(user_data);
 
   return G_SOURCE_REMOVE;
 }
 
+/* The result callback of the native clamd client, called by the connection threads */
+// The results are queued and handled in a single idle callback, so the main loop isn't woken up for every file
+static void
+on_clamd_result(const char *path, const char *virname, gboolean is_threat, guint64 size, gpointer user_data)
+{
+  ScanContext *ctx = user_data;
+
+  ClamdResult *result = g_new0(ClamdResult, 1);
+  result->path = g_strdup(path);
+  result->virname = g_strdup(virname);
+  result->is_threat = is_threat;
+  result->size = size;
+
+  g_mutex_lock(&ctx->results_mutex);
+  g_ptr_array_add(ctx->pending_results, result);
+  if (ctx->flush_source_id == 0) ctx->flush_source_id = g_idle_add_full(G_PRIORITY_HIGH_IDLE, clamd_results_ui_callback, ctx, NULL);
+  g_mutex_unlock(&ctx->results_mutex);
+}
+
+/* The ui callback function for `process_output_lines()` */
+static void
+scan_output_callback(gpointer context, RingBufferLine *lines, size_t num_lines)
+{
+  ScanContext *ctx = context;
+
+  for (size_t i = 0; i < num_lines; i++)
+  {
+    char *message = lines[i].data; // The line can be modified in place
+    char *status_marker = NULL; // Check file is OK or FOUND
+
+    if ((status_marker = strstr(message, " FOUND")) != NULL)
+    {
+      /* Add threat path to the list */
+      char *colon = strrchr(message, ':'); // Find the last colon separator
+      char *virname = NULL;
+      if (colon == NULL || colon >= status_marker) continue; // Handle the case where the colon is missing or after the `FOUND` string
+
+      *colon = '\0'; // Replace the colon with null terminator
+      *status_marker = '\0'; // Replace the last space with null terminator
+      virname = colon + 2 < status_marker ? colon + 2 : NULL; // Get the virname from the message
+
+      export_scan_result(ctx, message, strlen(message), JSON_VERDICT_INFECTED, virname, virname != NULL ? strlen(virname) : 0, -1, -1);
+      handle_scan_result(ctx, message, virname, TRUE, 0);
+    }
+    else if ((status_marker = strstr(message, " OK")) != NULL)
+    {
+      *status_marker = '\0'; // Drop the `: OK` from the path
+      if (status_marker > message && status_marker[-1] == ':') status_marker[-1] = '\0';
+
+      export_scan_result(ctx, message, strlen(message), JSON_VERDICT_CLEAN, NULL, 0, -1, -1);
+      handle_scan_result(ctx, message, NULL, FALSE, 0);
+    }
+    // Ignore the message if it is not a threat or OK message
+  }
+}
+
+/* Read and decode the binary result stream from `clamscanc` */
+/*
+  * Unlike the text output, the path is length-prefixed so it may contain ':' or newlines
+  * This function is called by the main loop, so the results are handled directly
+  *
+  * @return
+  * `OUTPUT_STATUS_CLOSED` if the stream is finished or invalid, otherwise `OUTPUT_STATUS_OPEN`
+*/
+static OutputStatus
+process_result_frames(ScanContext *ctx)
+{
+  /* Drain the pipe into the frame buffer, same as `process_output_lines()` */
+  size_t total_read = 0;
+  ssize_t n = 0;
+  while (total_read < OUTPUT_DRAIN_LIMIT)
+  {
+    const guint old_length = ctx->frames->len;
+    g_byte_array_set_size(ctx->frames, old_length + CLAMSCANC_READ_SIZE);
+
+    while ((n = read(ctx->pipefd[0], ctx->frames->data + old_length, CLAMSCANC_READ_SIZE)) == -1 && errno == EINTR);
+    g_byte_array_set_size(ctx->frames, old_length + MAX(n, 0));
+
+    if (n <= 0) break;
+    total_read += n;
+  }
+
+  const OutputStatus output_status = (n == 0 || (n == -1 && errno != EAGAIN && errno != EWOULDBLOCK)) ?
+                                     OUTPUT_STATUS_CLOSED : OUTPUT_STATUS_OPEN;
+
+  if (!ctx->has_magic)
+  {
+    if (ctx->frames->len < SCAN_RESULT_STREAM_MAGIC_SIZE) return output_status; // Wait for the rest of the magic
+
+    if (!scan_result_check_magic(ctx->frames->data, ctx->frames->len))
+    {
+      g_critical("[ERROR] Unknown clamscanc output format");
+      set_cancel_scan(ctx);
+      return OUTPUT_STATUS_CLOSED;
+    }
+
+    g_byte_array_remove_range(ctx->frames, 0, SCAN_RESULT_STREAM_MAGIC_SIZE);
+    ctx->has_magic = TRUE;
+  }
+
+  size_t offset = 0;
+  ScanResult result;
+  size_t consumed = 0;
+  int status;
+  while ((status = scan_result_parse(ctx->frames->data + offset, ctx->frames->len - offset, &result, &consumed)) == 1)
+  {
+    offset += consumed;
+
+    if (result.status == SCAN_RESULT_PROGRESS) // The totals so far, only sent if the clean files aren't output
+    {
+      set_total_files(ctx, result.files_scanned);
+      set_total_bytes(ctx, result.bytes_scanned);
+      continue;
+    }
+
+    const char *verdict = result.status == SCAN_RESULT_INFECTED ? JSON_VERDICT_INFECTED : (result.status == SCAN_RESULT_ERROR ? JSON_VERDICT_ERROR : JSON_VERDICT_CLEAN);
+    export_scan_result(ctx, result.path, result.path_length, verdict, result.virname, result.virname != NULL ? result.virname_length : 0,
+                       (gint64)result.bytes_scanned, (gint64)result.scan_time_ns);
+    if (result.status == SCAN_RESULT_ERROR) continue; // Same as the text output, the files which can't be scanned are not counted
+
+    g_autofree char *path = g_strndup(result.path, result.path_length);
+    g_autofree char *virname = result.virname ? g_strndup(result.virname, result.virname_length) : NULL;
+    handle_scan_result(ctx, path, virname, result.status == SCAN_RESULT_INFECTED, result.bytes_scanned);
+  }
+
+  g_byte_array_remove_range(ctx->frames, 0, offset); // Keep the incomplete frame for the next read
+
+  if (status == -1)
+  {
+    g_critical("[ERROR] Corrupted clamscanc output");
+    set_cancel_scan(ctx);
+    return OUTPUT_STATUS_CLOSED;
+  }
+
+  return output_status;
+}
+
+/* Read the output of the scan process, whichever format it is */
+static OutputStatus
+read_scan_output(ScanContext *ctx)
+{
+  return ctx->backend == SCAN_BACKEND_CLAMSCANC ?
+         process_result_frames(ctx) :
+         process_output_lines(&ctx->ring_buffer, ctx->pipefd[0], ctx, scan_output_callback);
+}
+
+/* Called whenever the output pipe is readable, so the scan process is never blocked by a full pipe */
 static gboolean
-scan_complete_callback(gpointer user_data)
+on_scan_output(gint fd, GIOCondition condition, gpointer user_data)
 {
-  IdleData *data = user_data;
-  ScanContext *ctx = (ScanContext *)get_idle_context(data);
+  ScanContext *ctx = user_data;
 
-  g_return_val_if_fail(data && ctx, G_SOURCE_REMOVE);
+  const guint64 trace_start = trace_begin(TRACE_READ_OUTPUT);
+  const OutputStatus output_status = read_scan_output(ctx);
+  trace_end(TRACE_READ_OUTPUT, trace_start);
 
+  if (output_status == OUTPUT_STATUS_OPEN) return G_SOURCE_CONTINUE;
+
+  ctx->output_source_id = 0; // EOF, wait for the process to exit in `scan_sync_callback()`
+  return G_SOURCE_REMOVE;
+}
+
+/* Stop watching the output pipe and close it */
+static void
+scan_context_stop_output(ScanContext *ctx)
+{
+  if (ctx->output_source_id != 0)
+  {
+    g_source_remove(ctx->output_source_id);
+    ctx->output_source_id = 0;
+  }
+
+  if (ctx->pipefd[0] != -1)
+  {
+    close(ctx->pipefd[0]); // The write end is closed right after spawning
+    ctx->pipefd[0] = -1;
+  }
+}
+
+/* Whether `clamscanc` should scan the risky and recent files first */
+/*
+  * The enumerator of the clamd backends keeps the traversal order, it streams the files without holding them
+*/
+static gboolean
+is_priority_scan(void)
+{
+  GSettings *settings = g_settings_new("com.ericlin.wuming");
+  gboolean is_prioritized = g_settings_get_boolean(settings, "priority-scan");
+  g_object_unref(settings);
+
+  return is_prioritized;
+}
+
+/* Get the number of `clamscanc` processes from the settings, 0 means the number of processors */
+static char *
+get_num_of_workers(void)
+{
+  GSettings *settings = g_settings_new("com.ericlin.wuming");
+  int num_workers = g_settings_get_int(settings, "scan-workers");
+  g_object_unref(settings);
+
+  if (num_workers <= 0) return g_strdup("auto"); /* clamscanc sizes the pools from the CPU budget and the queue pressure */
+
+  return g_strdup_printf("%d", num_workers);
+}
+
+/* Load the exclusion rules and the size limit from the settings */
+/*
+  * The enumerator applies them for the clamd backends, `clamscanc` gets them through `exclusion_args`
+  * `clamscan` doesn't take them, its `--exclude` options are regular expressions
+*/
+static void
+scan_context_load_exclusions(ScanContext *ctx)
+{
+  exclusion_rules_clear(&ctx->exclusions);
+  g_ptr_array_set_size(ctx->exclusion_args, 0);
+
+  GSettings *settings = g_settings_new("com.ericlin.wuming");
+  g_auto(GStrv) rules = g_settings_get_strv(settings, "scan-exclusions");
+  int max_file_size = g_settings_get_int(settings, "scan-max-file-size");
+  g_object_unref(settings);
+
+  for (int i = 0; rules[i] != NULL; i++)
+  {
+    if (!exclusion_rules_add(&ctx->exclusions, rules[i]))
+    {
+      g_warning("[WARNING] Ignored the invalid exclusion rule: %s", rules[i]);
+      continue;
+    }
+    g_ptr_array_add(ctx->exclusion_args, g_strconcat(EXCLUSION_OPTION, rules[i], NULL));
+  }
+
+  if (max_file_size > 0)
+  {
+    ctx->exclusions.max_file_size = (uint64_t)max_file_size << 20; // MiB
+    g_ptr_array_add(ctx->exclusion_args, g_strdup_printf("%s%dM", MAX_FILE_SIZE_OPTION, max_file_size));
+  }
+
+  exclusion_rules_compile(&ctx->exclusions);
+}
+
+/* Load the priority and the rate limits of the scan from the settings */
+/*
+  * The enumerator throttles the files handed to the ClamAV daemon, `clamscanc` gets the limits through `background_args`
+  * The priority only applies to the scanners spawned by us, the daemon keeps its own
+*/
+static void
+scan_context_load_background(ScanContext *ctx)
+{
+  g_ptr_array_set_size(ctx->background_args, 0);
+  g_clear_pointer(&ctx->cpu_quota_property, g_free);
+
+  GSettings *settings = g_settings_new("com.ericlin.wuming");
+  ctx->is_background = g_settings_get_boolean(settings, "background-scan");
+  int cpu_quota = g_settings_get_int(settings, "background-cpu-quota");
+  int max_rate = g_settings_get_int(settings, "scan-max-rate");
+  int max_files_rate = g_settings_get_int(settings, "scan-max-files-rate");
+  g_object_unref(settings);
+
+  if (ctx->is_background)
+  {
+    g_ptr_array_add(ctx->background_args, g_strdup(BACKGROUND_OPTION));
+    if (cpu_quota > 0) ctx->cpu_quota_property = g_strdup_printf("CPUQuota=%d%%", cpu_quota);
+  }
+  if (max_rate > 0) g_ptr_array_add(ctx->background_args, g_strdup_printf("%s%dM", MAX_RATE_OPTION, max_rate));
+  if (max_files_rate > 0) g_ptr_array_add(ctx->background_args, g_strdup_printf("%s%d", MAX_FILES_RATE_OPTION, max_files_rate));
+
+  scan_throttle_init(&ctx->throttle, (uint64_t)MAX(max_rate, 0) << 20, (uint64_t)MAX(max_files_rate, 0));
+}
+
+/* Load the scan profile and its extra options from the settings */
+/*
+  * `clamscanc` prepares its engine from the profile, `clamscan` gets the nearest options
+  * The ClamAV daemon scans with its own configuration, the profile doesn't apply
+  * Only `clamscanc` can leave databases out, `clamscan` always loads the whole database directory
+*/
+static void
+scan_context_load_profile(ScanContext *ctx)
+{
+  /* In the order of the `SCAN_OPTIONS_*` bits */
+  static const char *const extra_args[SCAN_OPTIONS_N_ELEMENTS] = { "--max-filesize=2048M", "--detect-pua=yes", "--scan-archive=yes", "--scan-mail=yes", "--alert-exceeds-max=yes", "--alert-encrypted=yes" };
+  static const struct {
+    const char *name;
+    const char *args[7];
+  } clamscan_profiles[] = {
+    { SCAN_PROFILE_QUICK, { "--scan-archive=no", "--scan-mail=no", "--max-filesize=25M", "--max-scansize=100M", "--max-recursion=4", "--max-files=1000", NULL } },
+    { SCAN_PROFILE_ARCHIVE_DEEP, { "--max-filesize=512M", "--max-scansize=4000M", "--max-recursion=32", "--max-files=100000", NULL } },
+    { SCAN_PROFILE_PUA, { "--detect-pua=yes", NULL } },
+  };
+
+  g_clear_pointer(&ctx->profile_arg, g_free);
+  g_ptr_array_set_size(ctx->clamscan_profile_args, 0);
+  g_ptr_array_set_size(ctx->database_args, 0);
+
+  GSettings *settings = g_settings_new("com.ericlin.wuming");
+  g_autofree char *profile = g_settings_get_string(settings, "scan-profile");
+  int bitmask = g_settings_get_int(settings, "scan-options-bitmask") & SCAN_OPTIONS_ALL;
+  g_auto(GStrv) excluded_databases = g_settings_get_strv(settings, "excluded-databases");
+  g_object_unref(settings);
+
+  for (int i = 0; excluded_databases[i] != NULL; i++)
+  {
+    if (excluded_databases[i][0] == '\0') continue;
+    g_ptr_array_add(ctx->database_args, g_strconcat(EXCLUDE_DB_OPTION, excluded_databases[i], NULL));
+  }
+
+  ctx->profile_arg = g_strdup_printf("%s%s:%d", PROFILE_OPTION, profile, bitmask);
+
+  for (guint i = 0; i < G_N_ELEMENTS(clamscan_profiles); i++)
+  {
+    if (g_strcmp0(clamscan_profiles[i].name, profile) != 0) continue;
+    for (int j = 0; clamscan_profiles[i].args[j] != NULL; j++) g_ptr_array_add(ctx->clamscan_profile_args, (gpointer)clamscan_profiles[i].args[j]);
+  }
+
+  /* The extra options come last, `clamscan` takes the last value of a repeated option */
+  for (int i = 0; i < SCAN_OPTIONS_N_ELEMENTS; i++)
+  {
+    if (bitmask & (1 << i)) g_ptr_array_add(ctx->clamscan_profile_args, (gpointer)extra_args[i]);
+  }
+}
+
+/* Remember the paths whose scan can be resumed, NULL if there is none */
+static void
+scan_context_set_resumable_paths(const char *const *paths)
+{
+  static const char *const no_paths[] = { NULL };
+
+  GSettings *settings = g_settings_new("com.ericlin.wuming");
+  g_settings_set_strv(settings, "resume-scan-paths", paths != NULL ? paths : no_paths);
+  g_object_unref(settings);
+}
+
+/* Get the checkpoint option of a `clamscanc` scan */
+/*
+  * Only the folder scans and the scans of several paths are checkpointed, a single file is scanned at once
+  * A resume without the checkpoint (e.g. the cache was cleaned) starts over
+  * `clamscanc` creates the directory of the checkpoint
+  * @return
+  * NULL if the scan isn't checkpointed
+*/
+static char *
+scan_context_get_checkpoint_arg(ScanContext *ctx)
+{
+  ctx->is_checkpointed = ctx->paths[1] != NULL || g_file_test(ctx->paths[0], G_FILE_TEST_IS_DIR);
+  if (!ctx->is_checkpointed) return NULL;
+
+  gboolean is_resume = ctx->is_resume && g_file_test(ctx->checkpoint_path, G_FILE_TEST_IS_REGULAR);
+  scan_context_set_resumable_paths((const char *const *)ctx->paths);
+
+  return g_strconcat(is_resume ? RESUME_OPTION : CHECKPOINT_OPTION, ctx->checkpoint_path, NULL);
+}
+
+/* Start the arguments of a local scanner */
+/*
+  * A low priority scan with a CPU quota runs in a transient systemd scope, so the quota covers all its processes
+  * `systemd-run --scope` executes the scanner itself, so the pid stays the scanner's
+  * @return
+  * the path to be executed
+*/
+static const char *
+scan_argv_begin(ScanContext *ctx, GPtrArray *argv, const char *path, const char *command)
+{
+  if (ctx->is_background && ctx->cpu_quota_property != NULL)
+  {
+    if (access(SYSTEMD_RUN_PATH, X_OK) == 0)
+    {
+      g_ptr_array_add(argv, "systemd-run");
+      g_ptr_array_add(argv, "--user");
+      g_ptr_array_add(argv, "--scope");
+      g_ptr_array_add(argv, "--quiet");
+      g_ptr_array_add(argv, "-p");
+      g_ptr_array_add(argv, ctx->cpu_quota_property);
+      g_ptr_array_add(argv, "-p");
+      g_ptr_array_add(argv, BACKGROUND_IO_WEIGHT);
+      g_ptr_array_add(argv, "--");
+      g_ptr_array_add(argv, (gpointer)path);
+      return SYSTEMD_RUN_PATH;
+    }
+    g_warning("[WARNING] %s is not available, scanning without the CPU quota", SYSTEMD_RUN_PATH);
+  }
+
+  g_ptr_array_add(argv, (gpointer)command);
+  return path;
+}
+
+/* Show the trend of the recent scans on the security overview page */
+static void
+scan_context_show_history(ScanContext *ctx)
+{
+  ScanHistoryTrend trend;
+  scan_history_get_trend(ctx->history, g_get_real_time() - (gint64)SCAN_HISTORY_TREND_DAYS * G_USEC_PER_SEC * 60 * 60 * 24, &trend);
+  security_overview_page_show_scan_history(ctx->security_overview_page, &trend);
+}
+
+/* Append the record of the finished scan to the history */
+static void
+scan_context_record_history(ScanContext *ctx, gboolean is_success)
+{
+  if (ctx->history == NULL) ctx->history = scan_history_open(); // Finished before the startup task
+
+  const gint64 now = g_get_real_time();
+  ScanHistorySummary summary = {
+    .time = now,
+    .duration = MAX(now - ctx->start_time, 0),
+    .files = get_total_files(ctx),
+    .threats = get_total_threats(ctx),
+    .bytes = get_total_bytes(ctx),
+    .flags = (is_success ? SCAN_HISTORY_SUCCESS : 0) | (get_cancel_scan(ctx) ? SCAN_HISTORY_CANCELED : 0),
+  };
+
+  g_mutex_lock(&ctx->threats_mutex); // The threats are only added by the main loop, but keep it consistent
+  scan_history_append(ctx->history, &summary, (const char *const *)ctx->paths,
+                      (const ScanHistoryHit *)ctx->history_hits->data, ctx->history_hits->len);
+  g_mutex_unlock(&ctx->threats_mutex);
+
+  if (ctx->security_overview_page != NULL) scan_context_show_history(ctx);
+}
+
+/* Show the final result of the scan and record it */
+// message: a static string, exit_status: the exit status of the scanner
+static void
+scan_context_finish(ScanContext *ctx, const char *message, int exit_status)
+{
   gboolean is_success = FALSE;
   get_completion_state(ctx, NULL, &is_success); // Get the completion state for thread-safe access
 
@@ -243,19 +1046,18 @@ scan_complete_callback(gpointer user_data)
   char *status_text = get_status_text(ctx);
 
   const char *icon_name = has_threat ? "status-warning-symbolic" : (is_success ? "status-ok-symbolic" : "status-error-symbolic");
-  const char *message = get_idle_message(data); // Get the message
-
   scanning_page_set_final_result(ctx->scanning_page, has_threat, message, status_text, icon_name);
 
-  if (ctx->temp_file_path) {
-      unlink(ctx->temp_file_path);
-      g_free(ctx->temp_file_path);
-      ctx->temp_file_path = NULL;
-  }
+  scan_context_stop_enumerator(ctx);
+  scan_context_close_export(ctx); // Every result is handled before the final message
+  scan_context_close_trace(ctx, ctx->backend == SCAN_BACKEND_CLAMSCANC); // `clamscanc` has exited, its spans are written
+  scan_context_record_history(ctx, is_success);
+
+  /* `clamscanc` removes the checkpoint of a finished scan, a canceled or failed one stays resumable */
+  if (is_success && ctx->backend == SCAN_BACKEND_CLAMSCANC && ctx->is_checkpointed) scan_context_set_resumable_paths(NULL);
 
   if (!is_success)
   {
-    int exit_status = get_idle_exit_status(data);
     g_autofree char *error_message = g_strdup_printf(gettext("Scan failed with exit status %d"), exit_status);
     wuming_window_send_toast_notification(ctx->window, error_message, 10);
   }
@@ -273,38 +1075,40 @@ scan_complete_callback(gpointer user_data)
   g_clear_pointer(&status_text, g_free);
 
   wuming_window_set_hide_on_close(ctx->window, FALSE, NULL); // Allow the window to be closed when the scan is complete
-
-  return G_SOURCE_REMOVE;
 }
 
-static void
-get_extra_args(char *extra_args[SCAN_OPTIONS_N_ELEMENTS])
+static gboolean
+scan_complete_callback(gpointer user_data)
 {
-  const char *args_list[SCAN_OPTIONS_N_ELEMENTS] = { "--max-filesize=2048M", "--detect-pua=yes", "--scan-archive=yes", "--scan-mail=yes", "--alert-exceeds-max=yes", "--alert-encrypted=yes" };
-
-  GSettings *settings = g_settings_new("com.ericlin.wuming");
-  int bitmask = g_settings_get_int(settings, "scan-options-bitmask");
-  g_object_unref(settings);
+  IdleData *data = user_data;
+  ScanContext *ctx = (ScanContext *)get_idle_context(data);
 
-  int index = 0;
-  int options_bit = 1;
+  g_return_val_if_fail(data && ctx, G_SOURCE_REMOVE);
 
-  for (int i = 0; i < SCAN_OPTIONS_N_ELEMENTS &&
-                  index < SCAN_OPTIONS_N_ELEMENTS &&
-                  options_bit <= bitmask; i++)
+  if (threat_page_is_snapshotting(ctx->threat_page)) // Finished by `on_threats_added()`, so the last threats are counted
   {
-    if (bitmask & options_bit) extra_args[index++] = g_strdup(args_list[i]);
-
-    options_bit <<= 1; // Move to the next bit
+    ctx->is_finish_deferred = TRUE;
+    ctx->deferred_message = get_idle_message(data);
+    ctx->deferred_exit_status = get_idle_exit_status(data);
+    return G_SOURCE_REMOVE;
   }
+
+  scan_context_finish(ctx, get_idle_message(data), get_idle_exit_status(data));
+  return G_SOURCE_REMOVE;
 }
 
+/* Count the threats listed by the threat page */
 static void
-extra_args_free(char *extra_args[SCAN_OPTIONS_N_ELEMENTS])
+on_threats_added(gpointer user_data, guint num_added)
 {
-  for (int i = 0; i < SCAN_OPTIONS_N_ELEMENTS; i++)
+  ScanContext *ctx = user_data;
+
+  if (!ctx->is_report_open) add_total_threats(ctx, num_added); // The threats of a past report are already counted
+
+  if (ctx->is_finish_deferred && !threat_page_is_snapshotting(ctx->threat_page))
   {
-    g_clear_pointer(&extra_args[i], g_free);
+    ctx->is_finish_deferred = FALSE;
+    scan_context_finish(ctx, ctx->deferred_message, ctx->deferred_exit_status);
   }
 }
 
@@ -316,63 +1120,148 @@ scan_sync_callback(gpointer user_data)
   if (get_cancel_scan(ctx)) // Check if the scan has been cancelled
   {
       g_message("[INFO] User cancelled the scan");
-      kill(ctx->pid, SIGTERM);
-      wait_for_process(ctx->pid, 0); // Update the exit status
+      if (ctx->backend != SCAN_BACKEND_CLAMD)
+      {
+        kill(ctx->pid, SIGTERM);
+        wait_for_process(ctx->pid, 0); // Update the exit status
+        scan_context_stop_output(ctx);
+      }
+      scan_context_stop_enumerator(ctx);
       send_final_message((void *)ctx, gettext("Scan Canceled"), FALSE, SIGTERM, scan_complete_callback);
       return G_SOURCE_REMOVE;
   }
 
-  if (process_output_lines(&ctx->ring_buffer, ctx->pipefd[0], ctx, scan_ui_callback)) return G_SOURCE_CONTINUE; // Has more output to read
+  if (ctx->backend == SCAN_BACKEND_CLAMD) // No process to wait for, check the connections instead
+  {
+      if (!clamd_client_is_finished(ctx->clamd_client)) return G_SOURCE_CONTINUE;
+
+      gboolean success = clamd_client_is_success(ctx->clamd_client);
+      scan_context_stop_enumerator(ctx);
+      flush_clamd_results(ctx); // Don't miss the results of the last files
+      set_completion_state(ctx, TRUE, success);
+
+      send_final_message((void *)ctx, success ? gettext("Scan Complete") : gettext("Scan Failed"),
+                         success, success ? 0 : 2, scan_complete_callback); // Same as clamdscan, 2 means an error occurred
+      return G_SOURCE_REMOVE;
+  }
 
+  /* The output is read by `on_scan_output()`, this only waits for the process to exit */
   const int exit_status = wait_for_process(ctx->pid, WNOHANG);
 
   if (exit_status == -1) return G_SOURCE_CONTINUE; // The process is still running
 
-  gboolean success = (exit_status == 0) || (exit_status == 1);
+  if (ctx->output_source_id != 0) read_scan_output(ctx); // Take the output written right before exiting
+  scan_context_stop_output(ctx);
+  scan_context_stop_enumerator(ctx);
+
+  /* `clamscan` and `clamdscan` exit with 1 if threats are found, `clamscanc` only exits with 1 on failure */
+  gboolean success = (exit_status == 0) || (exit_status == 1 && ctx->backend != SCAN_BACKEND_CLAMSCANC);
   set_completion_state(ctx, TRUE, success);
 
   const char *status_text = success ? gettext("Scan Complete") : gettext("Scan Failed");
 
   send_final_message((void *)ctx, status_text, success, exit_status, scan_complete_callback);
 
-  close(ctx->pipefd[0]);
-  close(ctx->pipefd[1]);
-
   return G_SOURCE_REMOVE;
 }
 
 static void
 start_scan_async(ScanContext *ctx)
 {
-    if (is_service_enabled("clamav-daemon.service") == 1)
+    scan_context_load_exclusions(ctx); // The enumerator of the previous scan is already stopped
+    scan_context_load_background(ctx);
+    scan_context_load_profile(ctx);
+    scan_context_open_export(ctx);
+    scan_context_open_trace(ctx);
+    SpawnFlags background_flag = ctx->is_background ? SPAWN_BACKGROUND : SPAWN_FLAGS_NONE;
+    ctx->is_infected_only = FALSE;
+
+    /* The states are cached by the service monitor, so this never blocks */
+    const gboolean is_daemon_enabled = (is_service_enabled("clamav-daemon.service") == 1 ||
+                                        is_service_active("clamav-daemon.service") == 1);
+
+    if (is_daemon_enabled &&
+        (ctx->clamd_client = clamd_client_new(on_clamd_result, ctx)) != NULL)
+    {
+        /* Use the native clamd client */
+        ctx->backend = SCAN_BACKEND_CLAMD;
+
+        g_atomic_int_set(&ctx->stop_enumerator, FALSE);
+        ctx->enumerator = g_thread_new("file-enumerator", enumerate_files_to_clamd_thread, ctx);
+    }
+    else if (is_daemon_enabled)
     {
         /* Use clamdscan */
-        /* Create temporary file for file list */
+        ctx->backend = SCAN_BACKEND_CLAMDSCAN;
+
+        /* Create a FIFO for the file list, in a private directory so no one else can open it */
         char *temp_template = g_strdup("/tmp/wuming_scan_XXXXXX");
-        int fd = mkstemp(temp_template);
-        if (fd == -1) {
-            g_critical("Failed to create temporary file");
-            send_final_message((void *)ctx, gettext("Scan Failed"), FALSE, -1, scan_complete_callback);
+        if (g_mkdtemp(temp_template) == NULL) {
+            g_critical("Failed to create temporary directory: %s", strerror(errno));
             g_free(temp_template);
+            send_final_message((void *)ctx, gettext("Scan Failed"), FALSE, -1, scan_complete_callback);
             return;
         }
-        ctx->temp_file_path = temp_template;
-        temp_file_fp = fdopen(fd, "w");
-        if (temp_file_fp) {
-            nftw(ctx->path, collect_file_path, 20, FTW_PHYS);
-            fclose(temp_file_fp);
-        } else {
-            g_critical("Failed to open temporary file for writing");
-            close(fd);
+        ctx->temp_dir_path = temp_template;
+        ctx->file_list_path = g_build_filename(ctx->temp_dir_path, "files", NULL);
+        if (mkfifo(ctx->file_list_path, 0600) == -1) {
+            g_critical("Failed to create the file list FIFO: %s", strerror(errno));
+            g_clear_pointer(&ctx->file_list_path, g_free);
+            scan_context_stop_enumerator(ctx);
             send_final_message((void *)ctx, gettext("Scan Failed"), FALSE, -1, scan_complete_callback);
             return;
         }
 
-        /* Spawn scan process */
+        /* The clean files are only needed by the export, otherwise the enumerator counts them */
+        ctx->is_infected_only = ctx->export_file == NULL;
+
+        /* Spawn scan process, it reads the file list while it's being written */
         if (!spawn_new_process(ctx->pipefd, &ctx->pid,
-            CLAMDSCAN_PATH, "clamdscan", "-f", ctx->temp_file_path, NULL))
+            CLAMDSCAN_PATH, "clamdscan", "-f", ctx->file_list_path, ctx->is_infected_only ? "--infected" : NULL, NULL)) // NULL ends the arguments earlier
         {
               g_critical("Failed to spawn clamdscan process");
+              scan_context_stop_enumerator(ctx);
+              send_final_message((void *)ctx, gettext("Scan Failed"), FALSE, -1, scan_complete_callback);
+              return;
+        }
+
+        g_atomic_int_set(&ctx->stop_enumerator, FALSE);
+        ctx->enumerator = g_thread_new("file-enumerator", enumerate_files_thread, ctx);
+    }
+    else if (access(CLAMSCANC_PATH, X_OK) == 0)
+    {
+        /* Use clamscanc, its stderr is not redirected so the binary stream keeps intact */
+        ctx->backend = SCAN_BACKEND_CLAMSCANC;
+        ctx->has_magic = FALSE;
+        g_byte_array_set_size(ctx->frames, 0);
+        g_autofree char *num_workers = get_num_of_workers();
+        g_autofree char *checkpoint_arg = scan_context_get_checkpoint_arg(ctx);
+        g_autofree char *trace_arg = ctx->trace_path != NULL ? g_strconcat(TRACE_OPTION, ctx->trace_path, NULL) : NULL;
+        ctx->is_infected_only = ctx->export_file == NULL; // The clean files are only needed by the export, otherwise the progress has the counts
+
+        /* The options come before the positional arguments */
+        g_autoptr(GPtrArray) argv = g_ptr_array_new();
+        const char *exec_path = scan_argv_begin(ctx, argv, CLAMSCANC_PATH, "clamscanc");
+        g_ptr_array_add(argv, "--binary");
+        if (ctx->is_infected_only)
+        {
+          g_ptr_array_add(argv, INFECTED_ONLY_OPTION);
+          g_ptr_array_add(argv, PROGRESS_OPTION CLAMSCANC_PROGRESS_INTERVAL_MS);
+        }
+        for (guint i = 0; i < ctx->exclusion_args->len; i++) g_ptr_array_add(argv, g_ptr_array_index(ctx->exclusion_args, i));
+        for (guint i = 0; i < ctx->background_args->len; i++) g_ptr_array_add(argv, g_ptr_array_index(ctx->background_args, i));
+        if (checkpoint_arg != NULL) g_ptr_array_add(argv, checkpoint_arg);
+        if (trace_arg != NULL) g_ptr_array_add(argv, trace_arg);
+        if (is_priority_scan()) g_ptr_array_add(argv, PRIORITY_OPTION);
+        g_ptr_array_add(argv, ctx->profile_arg);
+        for (guint i = 0; i < ctx->database_args->len; i++) g_ptr_array_add(argv, g_ptr_array_index(ctx->database_args, i));
+        for (char **path = ctx->paths; *path != NULL; path++) g_ptr_array_add(argv, *path);
+        g_ptr_array_add(argv, num_workers);
+        g_ptr_array_add(argv, NULL);
+
+        if (!spawn_new_process_argv(ctx->pipefd, &ctx->pid, background_flag, exec_path, argv))
+        {
+              g_critical("Failed to spawn clamscanc process");
               send_final_message((void *)ctx, gettext("Scan Failed"), FALSE, -1, scan_complete_callback);
               return;
         }
@@ -380,10 +1269,17 @@ start_scan_async(ScanContext *ctx)
     else
     {
         /* Use clamscan fallback */
+        ctx->backend = SCAN_BACKEND_CLAMSCAN;
         wuming_window_send_toast_notification(ctx->window, gettext("ClamAV daemon is not running. Using clamscan fallback (slower)."), 10);
         
-        if (!spawn_new_process(ctx->pipefd, &ctx->pid,
-            CLAMSCAN_PATH_FALLBACK, "clamscan", ctx->path, NULL))
+        /* clamscan has no rate limit, only the priority and the CPU quota apply */
+        g_autoptr(GPtrArray) argv = g_ptr_array_new();
+        const char *exec_path = scan_argv_begin(ctx, argv, CLAMSCAN_PATH_FALLBACK, "clamscan");
+        for (guint i = 0; i < ctx->clamscan_profile_args->len; i++) g_ptr_array_add(argv, g_ptr_array_index(ctx->clamscan_profile_args, i));
+        for (char **path = ctx->paths; *path != NULL; path++) g_ptr_array_add(argv, *path);
+        g_ptr_array_add(argv, NULL);
+
+        if (!spawn_new_process_argv(ctx->pipefd, &ctx->pid, SPAWN_MERGE_STDERR | background_flag, exec_path, argv))
         {
               g_critical("Failed to spawn clamscan process");
               send_final_message((void *)ctx, gettext("Scan Failed"), FALSE, -1, scan_complete_callback);
@@ -393,6 +1289,13 @@ start_scan_async(ScanContext *ctx)
 
     ring_buffer_init(&ctx->ring_buffer);
 
+    /* The counters are shown once per frame, however fast the results arrive */
+    scanning_page_start_progress(ctx->scanning_page, get_scan_progress, ctx);
+
+    /* Read the output as soon as it arrives, except the native clamd client which has no pipe */
+    if (ctx->backend != SCAN_BACKEND_CLAMD)
+      ctx->output_source_id = g_unix_fd_add(ctx->pipefd[0], G_IO_IN | G_IO_HUP | G_IO_ERR, on_scan_output, ctx);
+
     /* Use Async I/O to check the progress of the scan */
     GSource *source = g_timeout_source_new(BASE_TIMEOUT_MS);
     g_source_set_callback(source, (GSourceFunc) scan_sync_callback, ctx, NULL);
@@ -400,21 +1303,35 @@ start_scan_async(ScanContext *ctx)
 }
 
 static void
-scan_context_clear_path(ScanContext *ctx)
+scan_context_clear_paths(ScanContext *ctx)
 {
   g_return_if_fail(ctx);
 
-  g_clear_pointer(&ctx->path, g_free);
+  g_clear_pointer(&ctx->paths, g_strfreev);
 }
 
+/* Set the roots of the scan */
+/*
+  * The paths are resolved, the repeated ones and the ones inside another path are dropped, so no file is scanned twice
+  * A path which can't be resolved is kept as it is, the scanner reports it
+*/
 static void
-scan_context_add_path(ScanContext *ctx, const char *path)
+scan_context_set_paths(ScanContext *ctx, const char *const *paths)
 {
-  g_return_if_fail(ctx && path);
+  g_return_if_fail(ctx && paths);
+
+  if (ctx->paths) scan_context_clear_paths(ctx); // If have paths, clear them first
 
-  if (ctx->path) scan_context_clear_path(ctx); // If have a path, clear it first
+  guint num_paths = g_strv_length((char **)paths);
+  ctx->paths = g_new0(char *, num_paths + 1);
+  for (guint i = 0; i < num_paths; i++)
+  {
+    char *real_path = realpath(paths[i], NULL);
+    ctx->paths[i] = real_path != NULL ? real_path : g_strdup(paths[i]); // Both are freed by `g_free()`
+  }
 
-  ctx->path = g_strdup(path); // Add the new path to the context
+  size_t num_kept = scan_roots_normalize(ctx->paths, num_paths);
+  for (guint i = num_kept; i < num_paths; i++) g_clear_pointer(&ctx->paths[i], g_free);
 }
 
 /* Clear `ScanContext` */
@@ -431,15 +1348,33 @@ scan_context_clear(ScanContext **ctx)
   /* Revoke the signal */
   wuming_window_revoke_popped_signal((*ctx)->window, (*ctx)->popped_signal_id);
   scanning_page_revoke_cancel_signal((*ctx)->scanning_page);
+  threat_page_set_added_func((*ctx)->threat_page, NULL, NULL);
+  scanning_page_stop_progress((*ctx)->scanning_page);
+
+  scan_context_stop_output(*ctx);
+  scan_context_stop_enumerator(*ctx); // The enumerator is using the path and the connections are using the mutexes
+  scan_context_close_export(*ctx);
+  scan_context_close_trace(*ctx, FALSE);
+
+  if ((*ctx)->flush_source_id != 0) g_source_remove((*ctx)->flush_source_id);
+  g_clear_pointer(&(*ctx)->pending_results, g_ptr_array_unref);
 
   g_mutex_clear(&(*ctx)->mutex);
   g_mutex_clear(&(*ctx)->threats_mutex);
-
-  if ((*ctx)->path) scan_context_clear_path(*ctx); // Clear the path if have one
-  if ((*ctx)->temp_file_path) {
-      unlink((*ctx)->temp_file_path);
-      g_free((*ctx)->temp_file_path);
-  }
+  g_mutex_clear(&(*ctx)->results_mutex);
+
+  if ((*ctx)->paths) scan_context_clear_paths(*ctx); // Clear the paths if have any
+  g_clear_pointer(&(*ctx)->frames, g_byte_array_unref);
+  exclusion_rules_clear(&(*ctx)->exclusions);
+  g_clear_pointer(&(*ctx)->exclusion_args, g_ptr_array_unref);
+  g_clear_pointer(&(*ctx)->background_args, g_ptr_array_unref);
+  g_clear_pointer(&(*ctx)->profile_arg, g_free);
+  g_clear_pointer(&(*ctx)->clamscan_profile_args, g_ptr_array_unref);
+  g_clear_pointer(&(*ctx)->database_args, g_ptr_array_unref);
+  if ((*ctx)->history != NULL) scan_history_close(&(*ctx)->history); // Waits for the compaction
+  g_clear_pointer(&(*ctx)->history_hits, g_array_unref);
+  g_clear_pointer(&(*ctx)->cpu_quota_property, g_free);
+  g_clear_pointer(&(*ctx)->checkpoint_path, g_free);
 
   g_clear_pointer(ctx, g_free);
 }
@@ -459,7 +1394,13 @@ scan_context_reset(ScanContext *ctx)
   reset_cancel_scan(ctx); // Reset the cancel scan flag
   reset_total_files(ctx); // Reset the total files
   reset_total_threats(ctx); // Reset the total threats
+  reset_total_bytes(ctx); // Reset the total bytes
   set_completion_state(ctx, FALSE, FALSE); // Reset the completion state
+  ctx->is_finish_deferred = FALSE; // The threats are cleared below
+
+  g_mutex_lock(&ctx->threats_mutex);
+  g_array_set_size(ctx->history_hits, 0);
+  g_mutex_unlock(&ctx->threats_mutex);
 
   /* Reset Widgets */
   threat_page_clear_threats(ctx->threat_page);
@@ -476,6 +1417,20 @@ on_page_popped(AdwNavigationView* self, AdwNavigationPage* page, gpointer user_d
 
   if (g_strcmp0(tag, "scanning_nav_page") == 0)
     scan_context_reset(ctx); // Reset the `ScanContext` when the scanning page is popped
+  else if (g_strcmp0(tag, "threat_nav_page") == 0 && ctx->is_report_open)
+  {
+    threat_page_clear_threats(ctx->threat_page); // The past report is closed
+    ctx->is_report_open = FALSE;
+  }
+}
+
+static void
+clear_history_hit(gpointer data)
+{
+  ScanHistoryHit *hit = data;
+
+  g_free((char *)hit->path);
+  g_free((char *)hit->virname);
 }
 
 ScanContext *
@@ -486,24 +1441,61 @@ scan_context_new(WumingWindow *window, SecurityOverviewPage *security_overview_p
   ScanContext *ctx = g_new0(ScanContext, 1);
   g_mutex_init(&ctx->mutex);
   g_mutex_init(&ctx->threats_mutex);
+  g_mutex_init(&ctx->results_mutex);
 
   ctx->completed = FALSE;
   ctx->success = FALSE;
   ctx->total_files = 0;
   ctx->total_threats = 0;
+  ctx->total_bytes = 0;
   ctx->window = window;
   ctx->security_overview_page = security_overview_page;
   ctx->scan_page = scan_page;
   ctx->scanning_page = scanning_page;
   ctx->threat_page = threat_page;
-  ctx->path = NULL;
-  ctx->temp_file_path = NULL;
+  ctx->paths = NULL;
+  ctx->temp_dir_path = NULL;
+  ctx->file_list_path = NULL;
+  ctx->enumerator = NULL;
+  ctx->clamd_client = NULL;
+  ctx->stop_enumerator = FALSE;
+  ctx->frames = g_byte_array_new();
+  ctx->pipefd[0] = -1;
+  ctx->pipefd[1] = -1;
+  ctx->output_source_id = 0;
+  ctx->pending_results = g_ptr_array_new_with_free_func(clamd_result_free);
+  ctx->flush_source_id = 0;
+  ctx->has_magic = FALSE;
+  exclusion_rules_init(&ctx->exclusions);
+  ctx->exclusion_args = g_ptr_array_new_with_free_func(g_free);
+  ctx->is_background = FALSE;
+  ctx->cpu_quota_property = NULL;
+  scan_throttle_init(&ctx->throttle, 0, 0);
+  ctx->background_args = g_ptr_array_new_with_free_func(g_free);
+  ctx->profile_arg = NULL;
+  ctx->clamscan_profile_args = g_ptr_array_new(); // Holds the static strings
+  ctx->database_args = g_ptr_array_new_with_free_func(g_free);
+  ctx->export_file = NULL;
+  scan_trace_init(&ctx->trace);
+  ctx->trace_path = NULL;
+  ctx->history = NULL; // Opened by the startup task, see `scan_context_set_history()`
+  ctx->start_time = 0;
+  ctx->history_hits = g_array_new(FALSE, FALSE, sizeof(ScanHistoryHit));
+  g_array_set_clear_func(ctx->history_hits, clear_history_hit);
+  ctx->is_report_open = FALSE;
+  ctx->is_finish_deferred = FALSE;
+  ctx->deferred_message = NULL;
+  ctx->deferred_exit_status = 0;
+  ctx->is_resume = FALSE;
+  ctx->is_checkpointed = FALSE;
+  ctx->checkpoint_path = g_build_filename(g_get_user_cache_dir(), "wuming", "scan-checkpoint", NULL);
 
   ctx->should_cancel = FALSE;
 
   /* Bind the signal */
   ctx->popped_signal_id = wuming_window_connect_popped_signal(window, (GCallback) on_page_popped, ctx);
   scanning_page_set_cancel_signal(scanning_page, (GCallback) set_cancel_scan, ctx);
+  threat_page_set_added_func(threat_page, on_threats_added, ctx);
 
   return ctx;
 }
@@ -523,12 +1515,13 @@ save_last_scan_time (void)
   return g_steal_pointer(&timestamp);
 }
 
-void
-start_scan(ScanContext *ctx, const char *path)
+static void
+scan_paths(ScanContext *ctx, const char *const *paths, gboolean is_resume)
 {
-  g_return_if_fail(ctx && path);
-
-  scan_context_add_path(ctx, path);
+  scan_context_set_paths(ctx, paths);
+  ctx->is_resume = is_resume;
+  ctx->is_checkpointed = FALSE;
+  ctx->start_time = g_get_real_time();
 
   g_autofree gchar *timestamp = save_last_scan_time();
   scan_page_show_last_scan_time_status(ctx->scan_page, timestamp, FALSE);
@@ -541,3 +1534,85 @@ start_scan(ScanContext *ctx, const char *path)
   start_scan_async(ctx);
 }
 
+/* Scan several files and folders in one session */
+/*
+  * All of them share the engine and the workers, the threats are listed together
+*/
+void
+start_scan_paths(ScanContext *ctx, const char *const *paths)
+{
+  g_return_if_fail(ctx && paths && paths[0]);
+
+  scan_paths(ctx, paths, FALSE);
+}
+
+/* Resume the interrupted folder scan */
+/*
+  * The files finished before the interruption are skipped by `clamscanc`
+  * The other backends have no checkpoint, they scan the whole folder again
+*/
+void
+resume_scan(ScanContext *ctx)
+{
+  g_return_if_fail(ctx);
+
+  GSettings *settings = g_settings_new("com.ericlin.wuming");
+  g_auto(GStrv) paths = g_settings_get_strv(settings, "resume-scan-paths");
+  g_object_unref(settings);
+
+  if (paths[0] == NULL) return; // Nothing to resume
+
+  scan_paths(ctx, (const char *const *)paths, TRUE);
+}
+
+static void
+add_report_threat(const char *path, const char *virname, gpointer user_data)
+{
+  ScanContext *ctx = user_data;
+
+  threat_page_add_threat(ctx->threat_page, path, virname);
+}
+
+/* Take the history opened by the startup task */
+void
+scan_context_set_history(ScanContext *ctx, ScanHistory *history, const ScanHistoryTrend *trend)
+{
+  g_return_if_fail(ctx && history && trend);
+
+  if (ctx->history != NULL) // A scan has finished first, it has opened the history and shown the trend
+  {
+    scan_history_close(&history);
+    return;
+  }
+
+  ctx->history = history;
+  if (ctx->security_overview_page != NULL) security_overview_page_show_scan_history(ctx->security_overview_page, trend);
+}
+
+/* Show the threats of the last scan, read from the history instead of scanning again */
+void
+open_last_scan_report(ScanContext *ctx)
+{
+  g_return_if_fail(ctx);
+
+  const gsize count = ctx->history != NULL ? scan_history_get_count(ctx->history) : 0;
+  if (count == 0)
+  {
+    wuming_window_send_toast_notification(ctx->window, gettext("No scan has been recorded yet"), 5);
+    return;
+  }
+
+  ScanHistorySummary summary;
+  scan_history_get_summary(ctx->history, count - 1, &summary);
+  if (summary.threats == 0)
+  {
+    wuming_window_send_toast_notification(ctx->window, gettext("No threat was found by the last scan"), 5);
+    return;
+  }
+
+  threat_page_clear_threats(ctx->threat_page);
+  scan_history_foreach_hit(ctx->history, count - 1, add_report_threat, ctx);
+  ctx->is_report_open = TRUE;
+
+  wuming_window_push_page_by_tag(ctx->window, "threat_nav_page");
+}
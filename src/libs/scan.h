@@ -27,6 +27,7 @@
 #include "scan-page.h"
 #include "scanning-page.h"
 #include "threat-page.h"
+#include "scan-history.h"
 
 typedef struct ScanContext ScanContext;
 
@@ -36,5 +37,16 @@ scan_context_new(WumingWindow *window, SecurityOverviewPage *security_overview_p
 void
 scan_context_clear(ScanContext **ctx);
 
+/* Take the history opened by the startup task, and show its trend */
 void
-start_scan(ScanContext *ctx, const char *path);
+scan_context_set_history(ScanContext *ctx, ScanHistory *history, const ScanHistoryTrend *trend);
+
+void
+start_scan_paths(ScanContext *ctx, const char *const *paths);
+
+void
+resume_scan(ScanContext *ctx);
+
+/* Show the threats of the last scan on the threat page, from the scan history */
+void
+open_last_scan_report(ScanContext *ctx);
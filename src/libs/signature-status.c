@@ -19,14 +19,15 @@
 */
 
 #include <glib.h>
+#include <gio/gio.h>
 #include <stdio.h>
 #include <stdbool.h>
+#include <stdlib.h>
 #include <string.h>
 #include <errno.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include <sys/stat.h>
-#include <sys/mman.h>
 
 #include "date-to-days.h"
 #include "signature-status.h"
@@ -40,28 +41,62 @@
 
 #define CLAMAV_CVD_PATH "/var/lib/clamav"
 
+#define HEADER_SIZE 512 // The header is padded to 512 bytes, the signatures follow it
+#define HEADER_MAGIC "ClamAV-VDB:"
 #define HEADER_COLON_COUNT 8 // The header format is `ClamAV-VDB:time:version:sigs:fl:md5:dsig:builder:stime`, so there are 8 colons
+#define DATABASE_CHANGE_DELAY_MS 1000 // freshclam writes several files in a row, wait for the last one
 
-typedef struct signature_status {
+/* The database files, in the order they are looked up */
+typedef enum {
+    DATABASE_DAILY_CVD,
+    DATABASE_DAILY_CLD,
+    DATABASE_MAIN_CVD,
+    DATABASE_MAIN_CLD,
+    DATABASE_FILE_COUNT
+} database_file;
+
+static const char *database_file_names[DATABASE_FILE_COUNT] = { "daily.cvd", "daily.cld", "main.cvd", "main.cld" };
+
+typedef struct {
+    gboolean is_valid; // Whether the header is parsed
     int year;
     int month;
     int day;
     int hour;
     int minute;
-    int signature_day_diff;
-    int expiration_day;
-    unsigned short status;
-} signature_status;
+    char month_str[4];
+    unsigned int version;
+    unsigned int signature_count;
+
+    /* The file when it was parsed, it isn't parsed again until it's changed */
+    gboolean has_stat;
+    dev_t dev;
+    ino_t ino;
+    off_t size;
+    struct timespec mtime;
+} database_file_params;
 
-typedef struct {
-    char *date_string;
+typedef struct signature_status {
     int year;
     int month;
     int day;
     int hour;
     int minute;
-    char month_str[4];
-} database_file_params;
+    int signature_day_diff;
+    int expiration_day;
+    unsigned short status;
+
+    /* Cache */
+    database_file_params files[DATABASE_FILE_COUNT];
+    guint64 database_version; // (main version << 32) | daily version
+    unsigned int signature_count;
+
+    /* Monitor */
+    GFileMonitor *monitor; // Watch `CLAMAV_CVD_PATH`, NULL if not watching
+    guint change_timeout_id;
+    SignatureStatusChangedFunc changed_callback;
+    gpointer changed_user_data;
+} signature_status;
 
 /* Clear the file descriptor */
 static inline void
@@ -103,63 +138,37 @@ month_str_to_num(const char *str)
     }
 }
 
-/* Parse the CVD header time */
+/* Parse the CVD header */
 /*
+  * Only the fixed size header is read, the signatures after it are never touched
   * @note
   * Due to the header format is `ClamAV-VDB:time:version:sigs:fl:md5:dsig:builder:stime`, we can parse the header by using sliding window algorithm.
 */
-static char *
-parse_cvd_header_time(int dirfd, const char *filename)
+static gboolean
+parse_cvd_header(database_file_params *params, int filefd, const char *filename)
 {
-    g_return_val_if_fail(dirfd != -1 && filename != NULL, NULL);
-
-    char *result = NULL;
-
-    int filefd = openat(dirfd, filename, FILE_OPEN_FLAGS);
-    if (filefd == -1)
-    {
-        if (errno == ENOENT) g_warning("File not found: %s", filename); // File not found
-        else g_critical("Failed to open %s: %s", filename, strerror(errno));
-        return NULL;
-    }
-
-    struct stat file_stat;
-    if (fstat(filefd, &file_stat) == -1) // Get the file stat
-    {
-        g_critical("Failed to stat %s: %s", filename, strerror(errno));
-        clear_fd(filefd);
-        return NULL;
-    }
-
-    if (!S_ISREG(file_stat.st_mode)) // Check whether it is a regular file
-    {
-        g_critical("Not a regular file: %s", filename);
-        clear_fd(filefd);
-        return NULL;
-    }
+    char header[HEADER_SIZE + 1];
 
-    const size_t file_size = (size_t)file_stat.st_size;
-    if (file_size < 48) // Check whether the file size is valid
+    ssize_t header_size;
+    while ((header_size = pread(filefd, header, HEADER_SIZE, 0)) == -1 && errno == EINTR);
+    if (header_size == -1)
     {
-        g_critical("Invalid file size: %s, size: %zu", filename, file_size);
-        clear_fd(filefd);
-        return NULL;
+        g_critical("Failed to read %s: %s", filename, strerror(errno));
+        return FALSE;
     }
+    header[header_size] = '\0';
 
-    char *header = mmap(NULL, file_size, PROT_READ, MAP_PRIVATE, filefd, 0);
-    if (header == MAP_FAILED)
+    if (header_size < 48 || strncmp(header, HEADER_MAGIC, strlen(HEADER_MAGIC)) != 0) // Check whether the header is valid
     {
-        g_critical("Failed to mmap %s: %s", filename, strerror(errno));
-        clear_fd(filefd);
-        return NULL;
+        g_critical("Invalid header: %s, size: %zd", filename, header_size);
+        return FALSE;
     }
-    clear_fd(filefd);
 
     /* Parse the header */
     int colons_pos[HEADER_COLON_COUNT] = {-1, -1, -1, -1, -1, -1, -1, -1}; // Position of the colons in the header
     int colon_count = 0;
 
-    for (size_t i = 0; i < file_size && colon_count < HEADER_COLON_COUNT; i++)
+    for (ssize_t i = 0; i < header_size && colon_count < HEADER_COLON_COUNT; i++)
     {
         if (header[i] == ':') colons_pos[colon_count++] = i; // Find the colons in the header
     }
@@ -167,65 +176,123 @@ parse_cvd_header_time(int dirfd, const char *filename)
     if (colon_count < HEADER_COLON_COUNT)
     {
         g_critical("Invalid header: %s", filename);
-        munmap(header, file_size);
-        return NULL;
+        return FALSE;
     }
 
-    /* Only take the first two colons as the time string */
-    char *str_start = header + colons_pos[0] + 1;
-    int size = colons_pos[1] - colons_pos[0] - 1;
+    /* Terminate the fields, the first two colons are the time string, then the version and the number of signatures */
+    header[colons_pos[1]] = '\0';
+    header[colons_pos[2]] = '\0';
+    header[colons_pos[3]] = '\0';
 
-    result = g_strndup(str_start, size);
+    const char *date_string = header + colons_pos[0] + 1;
+    if (sscanf(date_string, "%d %3s %d %d-%d",
+               &params->day, params->month_str, &params->year, &params->hour, &params->minute) != 5)
+    {
+        g_warning("Failed to parse: '%s'", date_string);
+        g_warning("Invalid date format in %s", filename);
+        return FALSE;
+    }
 
-    munmap(header, file_size);
-    header = NULL;
+    params->month = month_str_to_num(params->month_str);
+    params->version = (unsigned int)strtoul(header + colons_pos[1] + 1, NULL, 10);
+    params->signature_count = (unsigned int)strtoul(header + colons_pos[2] + 1, NULL, 10);
 
-    return result;
+    return TRUE;
 }
 
 /*Get database date*/
+/*
+  * The header is only parsed again if the file is changed
+  * @return
+  * TRUE if the file has a valid header
+*/
 static gboolean
 parse_database_file(database_file_params *params, int dirfd, const char *filename)
 {
     g_return_val_if_fail(params != NULL && dirfd != -1 && filename != NULL, FALSE);
 
-    params->date_string = parse_cvd_header_time(dirfd, filename);
-    if (params->date_string == NULL) return FALSE;
+    int filefd = openat(dirfd, filename, FILE_OPEN_FLAGS);
+    if (filefd == -1)
+    {
+        if (errno != ENOENT) g_critical("Failed to open %s: %s", filename, strerror(errno)); // The `.cvd` and the `.cld` are usually not both present
+        params->is_valid = FALSE;
+        params->has_stat = FALSE;
+        return FALSE;
+    }
 
-    if (sscanf(params->date_string, "%d %3s %d %d-%d",
-               &params->day, params->month_str, &params->year, &params->hour, &params->minute) != 5)
+    struct stat file_stat;
+    if (fstat(filefd, &file_stat) == -1) // Get the file stat
     {
-        g_warning("Failed to parse: '%s'", params->date_string);
-        g_warning("Invalid date format in %s", filename);
-        g_free(params->date_string);
-        params->date_string = NULL;
+        g_critical("Failed to stat %s: %s", filename, strerror(errno));
+        clear_fd(filefd);
+        params->is_valid = FALSE;
+        params->has_stat = FALSE;
         return FALSE;
     }
 
-    params->month = month_str_to_num(params->month_str);
-    g_free(params->date_string);
-    params->date_string = NULL;
-    return TRUE;
+    if (!S_ISREG(file_stat.st_mode)) // Check whether it is a regular file
+    {
+        g_critical("Not a regular file: %s", filename);
+        clear_fd(filefd);
+        params->is_valid = FALSE;
+        params->has_stat = FALSE;
+        return FALSE;
+    }
+
+    /* Same file as the last time, use the cached header */
+    if (params->has_stat && params->dev == file_stat.st_dev && params->ino == file_stat.st_ino &&
+        params->size == file_stat.st_size &&
+        params->mtime.tv_sec == file_stat.st_mtim.tv_sec && params->mtime.tv_nsec == file_stat.st_mtim.tv_nsec)
+    {
+        clear_fd(filefd);
+        return params->is_valid;
+    }
+
+    params->is_valid = parse_cvd_header(params, filefd, filename);
+    params->has_stat = TRUE;
+    params->dev = file_stat.st_dev;
+    params->ino = file_stat.st_ino;
+    params->size = file_stat.st_size;
+    params->mtime = file_stat.st_mtim;
+
+    clear_fd(filefd);
+
+    return params->is_valid;
+}
+
+/* Get the latest one of two database files, NULL if neither is valid */
+static database_file_params *
+get_latest_database_file(database_file_params *cvd, database_file_params *cld)
+{
+    const int cvd_days = cvd->is_valid ? date_to_days(cvd->year, cvd->month, cvd->day) : 0;
+    const int cld_days = cld->is_valid ? date_to_days(cld->year, cld->month, cld->day) : 0;
+
+    if (!(cvd_days > 0 || cld_days > 0)) return NULL;
+
+    return (cvd_days >= cld_days) ? cvd : cld;
 }
 
 /*Choose the latest date*/
 static void
-update_scan_result(signature_status *result, database_file_params *cvd, database_file_params *cld)
+update_scan_result(signature_status *result)
 {
-    g_return_if_fail(result != NULL && cvd != NULL && cld != NULL);
-    if (result->status & SIGNATURE_STATUS_NOT_FOUND) return; // Signature not found, no need to choose
+    g_return_if_fail(result != NULL);
+
+    database_file_params *daily = get_latest_database_file(&result->files[DATABASE_DAILY_CVD], &result->files[DATABASE_DAILY_CLD]);
+    database_file_params *main = get_latest_database_file(&result->files[DATABASE_MAIN_CVD], &result->files[DATABASE_MAIN_CLD]);
 
-    int cvd_days = date_to_days(cvd->year, cvd->month, cvd->day);
-    int cld_days = date_to_days(cld->year, cld->month, cld->day);
+    result->database_version = ((guint64)(main ? main->version : 0) << 32) | (daily ? daily->version : 0);
+    result->signature_count = (main ? main->signature_count : 0) + (daily ? daily->signature_count : 0);
 
-    if (!(cvd_days > 0 || cld_days > 0))
+    /* If no daily database found, use main database */
+    database_file_params *latest = daily ? daily : main;
+    if (latest == NULL)
     {
         result->status |= SIGNATURE_STATUS_NOT_FOUND;
         g_warning("No valid signature dates found");
         return;
     }
 
-    database_file_params* latest = (cvd_days >= cld_days) ? cvd : cld;
     result->year = latest->year;
     result->month = latest->month;
     result->day = latest->day;
@@ -241,8 +308,6 @@ scan_signature_date(signature_status *result)
 
     result->status &= ~SIGNATURE_STATUS_NOT_FOUND; // Reset the status
 
-    gboolean has_daily = FALSE;
-
     const char *database_dir = CLAMAV_CVD_PATH;
     int dirfd = open(database_dir, DIRECTORY_OPEN_FLAGS);
     if (dirfd == -1)
@@ -252,29 +317,23 @@ scan_signature_date(signature_status *result)
         return;
     }
 
-    /*First try daily.cvd*/
-    database_file_params *cvd_date = g_new0(database_file_params, 1);
-    has_daily = parse_database_file (cvd_date, dirfd, "daily.cvd");
+    /* Only the headers are read, so all the files are checked */
+    gboolean has_database = FALSE;
+    for (int i = 0; i < DATABASE_FILE_COUNT; i++)
+        has_database |= parse_database_file(&result->files[i], dirfd, database_file_names[i]);
 
-    /*Try daily.cld*/
-    database_file_params *cld_date = g_new0(database_file_params, 1);
-    has_daily |= parse_database_file (cld_date, dirfd, "daily.cld");
+    clear_fd(dirfd);
 
-    /*If no daily database found, try main.cvd*/
-    if (!has_daily && !parse_database_file (cvd_date, dirfd, "main.cvd"))
+    if (!has_database)
     {
-        clear_fd(dirfd);
-        g_free (cvd_date);
-        g_free (cld_date);
+        g_warning("No database found in %s", database_dir);
+        result->database_version = 0;
+        result->signature_count = 0;
         result->status |= SIGNATURE_STATUS_NOT_FOUND;
         return;
     }
-    clear_fd(dirfd);
 
-    update_scan_result(result, cvd_date, cld_date);
-
-    g_free (cvd_date);
-    g_free (cld_date);
+    update_scan_result(result);
 }
 
 /*Check whether the signature is up to date*/
@@ -304,6 +363,60 @@ is_signature_uptodate(signature_status *result, gboolean need_calculate_day_diff
     result->status |= SIGNATURE_STATUS_UPTODATE;
 }
 
+/* Database monitor */
+
+static gboolean
+on_database_change_timeout(gpointer user_data)
+{
+    signature_status *status = user_data;
+
+    status->change_timeout_id = 0;
+
+    if (status->changed_callback) status->changed_callback(status, status->changed_user_data);
+
+    return G_SOURCE_REMOVE;
+}
+
+static void
+on_database_changed(GFileMonitor *monitor, GFile *file, GFile *other_file, GFileMonitorEvent event_type, gpointer user_data)
+{
+    signature_status *status = user_data;
+
+    switch (event_type)
+    {
+        case G_FILE_MONITOR_EVENT_CHANGES_DONE_HINT:
+        case G_FILE_MONITOR_EVENT_CREATED:
+        case G_FILE_MONITOR_EVENT_DELETED:
+        case G_FILE_MONITOR_EVENT_RENAMED:
+        case G_FILE_MONITOR_EVENT_MOVED_IN:
+        case G_FILE_MONITOR_EVENT_MOVED_OUT:
+            break;
+        default:
+            return; // Wait for the writes to be finished
+    }
+
+    /* Notify once after freshclam finishes all the files */
+    if (status->change_timeout_id != 0) g_source_remove(status->change_timeout_id);
+    status->change_timeout_id = g_timeout_add(DATABASE_CHANGE_DELAY_MS, on_database_change_timeout, status);
+}
+
+/* Watch the database directory, so the database is only rescanned when it's changed */
+static void
+start_database_monitor(signature_status *status)
+{
+    g_autoptr(GFile) database_dir = g_file_new_for_path(CLAMAV_CVD_PATH);
+    g_autoptr(GError) error = NULL;
+
+    status->monitor = g_file_monitor_directory(database_dir, G_FILE_MONITOR_WATCH_MOVES, NULL, &error);
+    if (status->monitor == NULL)
+    {
+        g_warning("[WARNING] Failed to watch %s: %s", CLAMAV_CVD_PATH, error->message);
+        return;
+    }
+
+    g_signal_connect(status->monitor, "changed", G_CALLBACK(on_database_changed), status);
+}
+
 signature_status *
 signature_status_new(gint signature_expiration_time)
 {
@@ -311,8 +424,6 @@ signature_status_new(gint signature_expiration_time)
 
     status->expiration_day = signature_expiration_time > 0 ? signature_expiration_time : 5; // Default expiration time is 5 days
 
-    gint temp_status = 0;
-
     scan_signature_date(status);
     is_signature_uptodate(status, TRUE);
 
@@ -338,10 +449,9 @@ signature_status_update(signature_status *status, gboolean need_rescan_database,
 {
     g_return_if_fail(status != NULL);
 
-    gint temp_status = 0;
-
     if (signature_expiration_time > 0) status->expiration_day = signature_expiration_time;
 
+    /* Only the changed files are parsed again, so rescanning is cheap */
     if (need_rescan_database)
     {
         scan_signature_date(status);
@@ -350,10 +460,31 @@ signature_status_update(signature_status *status, gboolean need_rescan_database,
     is_signature_uptodate(status, need_rescan_database);
 }
 
+void
+signature_status_set_changed_callback(signature_status *status, SignatureStatusChangedFunc callback, gpointer user_data)
+{
+    g_return_if_fail(status != NULL);
+
+    status->changed_callback = callback;
+    status->changed_user_data = user_data;
+
+    /* The monitor is bound to the main context of the calling thread, so it isn't started by `signature_status_new()` */
+    if (callback != NULL && status->monitor == NULL) start_database_monitor(status);
+}
+
 void
 signature_status_clear(signature_status **status)
 {
     g_return_if_fail(status != NULL && *status != NULL);
+
+    if ((*status)->change_timeout_id != 0) g_source_remove((*status)->change_timeout_id);
+    if ((*status)->monitor != NULL)
+    {
+        g_signal_handlers_disconnect_by_data((*status)->monitor, *status);
+        g_file_monitor_cancel((*status)->monitor);
+        g_clear_object(&(*status)->monitor);
+    }
+
     g_free(*status);
 
     *status = NULL;
@@ -403,4 +534,22 @@ signature_status_get_date(const signature_status *status, int *year, int *month,
     *day = status->day;
     *hour = status->hour;
     *minute = status->minute;
-}
\ No newline at end of file
+}
+
+/* Get the version of the database */
+guint64
+signature_status_get_database_version(const signature_status *status)
+{
+    g_return_val_if_fail(status != NULL, 0);
+
+    return status->database_version;
+}
+
+/* Get the number of the signatures */
+unsigned int
+signature_status_get_signature_count(const signature_status *status)
+{
+    g_return_val_if_fail(status != NULL, 0);
+
+    return status->signature_count;
+}
@@ -29,6 +29,14 @@
 
 typedef struct signature_status signature_status;
 
+/* Called when the database is changed (e.g. updated by freshclam) */
+// The status isn't rescanned yet, call `signature_status_update()` with `need_rescan_database`
+typedef void (*SignatureStatusChangedFunc)(signature_status *status, gpointer user_data);
+
+/* Scan the database */
+/*
+  * Only the file headers are read, so it can be called in a worker thread
+*/
 signature_status *
 signature_status_new(gint signature_expiration_time);
 
@@ -49,6 +57,15 @@ signature_status_new(gint signature_expiration_time);
 void
 signature_status_update(signature_status *status, gboolean need_rescan_database, gint signature_expiration_time);
 
+/* Set the callback for the database changes */
+/*
+  * The database directory is watched once a callback is set, the callback is called once after a batch of changes
+  * @note
+  * Call it in the main thread, the changes are reported in its main context
+*/
+void
+signature_status_set_changed_callback(signature_status *status, SignatureStatusChangedFunc callback, gpointer user_data);
+
 void
 signature_status_clear(signature_status **status);
 
@@ -85,3 +102,17 @@ signature_status_get_status(const signature_status *status);
 */
 void
 signature_status_get_date(const signature_status *status, int *year, int *month, int *day, int *hour, int *minute);
+
+/* Get the version of the database */
+/*
+  * @return
+  * `(main version << 32) | daily version`, 0 if no database found
+  * @note
+  * This changes whenever any database is updated, so it can be used as a cache key for the scan results
+*/
+guint64
+signature_status_get_database_version(const signature_status *status);
+
+/* Get the number of the signatures in the main and the daily database */
+unsigned int
+signature_status_get_signature_count(const signature_status *status);
@@ -0,0 +1,116 @@
+/* startup-state.c
+ *
+ * Copyright 2025 EricLin
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+*/
+
+#include "check-scan-time.h"
+#include "startup-state.h"
+
+static gint64 startup_time = 0; // Written once by the first stage, before the worker is started
+
+typedef struct {
+    char *last_scan_time;
+    gint signature_expiration_time;
+} StartupTaskData;
+
+void
+startup_log_stage (const char *stage)
+{
+    const gint64 now = g_get_monotonic_time();
+    if (startup_time == 0) startup_time = now;
+
+    g_debug("[STARTUP] %s: %.1f ms", stage, (now - startup_time) / 1000.0);
+}
+
+static void
+startup_task_data_free (gpointer user_data)
+{
+    StartupTaskData *task_data = user_data;
+
+    g_free(task_data->last_scan_time);
+    g_free(task_data);
+}
+
+void
+startup_state_free (StartupState *state)
+{
+    if (state == NULL) return;
+
+    if (state->status != NULL) signature_status_clear(&state->status);
+    if (state->history != NULL) scan_history_close(&state->history);
+    g_free(state->last_scan_time);
+
+    g_free(state);
+}
+
+/* Log a stage of the worker with its own duration */
+static gint64
+log_worker_stage (const char *stage, gint64 stage_start)
+{
+    const gint64 now = g_get_monotonic_time();
+
+    g_debug("[STARTUP] %s: %.1f ms (took %.1f ms)", stage, (now - startup_time) / 1000.0, (now - stage_start) / 1000.0);
+
+    return now;
+}
+
+static void
+load_startup_state_thread (GTask *task, gpointer source_object, gpointer user_data, GCancellable *cancellable)
+{
+    StartupTaskData *task_data = user_data;
+    StartupState *state = g_new0(StartupState, 1);
+    gint64 stage_start = g_get_monotonic_time();
+
+    /* Only the headers are read, but they may be on a slow disk */
+    state->status = signature_status_new(task_data->signature_expiration_time);
+    stage_start = log_worker_stage("signature status", stage_start);
+
+    state->last_scan_time = g_strdup(task_data->last_scan_time);
+    state->is_scan_expired = is_scan_time_expired(state->last_scan_time);
+    stage_start = log_worker_stage("last scan time", stage_start);
+
+    state->history = scan_history_open();
+    scan_history_get_trend(state->history, g_get_real_time() - (gint64)SCAN_HISTORY_TREND_DAYS * G_USEC_PER_SEC * 60 * 60 * 24, &state->trend);
+    log_worker_stage("scan history", stage_start);
+
+    g_task_return_pointer(task, state, (GDestroyNotify) startup_state_free); // Freed if the task is cancelled
+}
+
+void
+startup_state_load_async (const char *last_scan_time, gint signature_expiration_time,
+                          GCancellable *cancellable, GAsyncReadyCallback callback, gpointer user_data)
+{
+    g_return_if_fail(last_scan_time != NULL);
+
+    StartupTaskData *task_data = g_new0(StartupTaskData, 1);
+    task_data->last_scan_time = g_strdup(last_scan_time);
+    task_data->signature_expiration_time = signature_expiration_time;
+
+    g_autoptr(GTask) task = g_task_new(NULL, cancellable, callback, user_data);
+    g_task_set_source_tag(task, startup_state_load_async);
+    g_task_set_task_data(task, task_data, startup_task_data_free);
+    g_task_run_in_thread(task, load_startup_state_thread);
+}
+
+StartupState *
+startup_state_load_finish (GAsyncResult *result, GError **error)
+{
+    g_return_val_if_fail(g_task_is_valid(result, NULL), NULL);
+
+    return g_task_propagate_pointer(G_TASK(result), error);
+}
@@ -0,0 +1,72 @@
+/* startup-state.h
+ *
+ * Copyright 2025 EricLin
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+*/
+
+/* The state shown when the window is opened */
+/*
+  * The signature headers, the last scan time and the scan history are read in a worker thread (`GTask`),
+  * so the window is presented before the disk is touched, the pages show the state once it's ready
+  * The stages are logged with `G_MESSAGES_DEBUG=all`, relative to the first logged stage
+*/
+
+#pragma once
+
+#include <gio/gio.h>
+
+#include "signature-status.h"
+#include "scan-history.h"
+
+typedef struct {
+    signature_status *status; // Not watched yet, set the changed callback in the main thread
+    char *last_scan_time; // The checked "last-scan-time"
+    gboolean is_scan_expired;
+    ScanHistory *history;
+    ScanHistoryTrend trend; // The scans of the last `SCAN_HISTORY_TREND_DAYS` days
+} StartupState;
+
+/* Log the time since the startup */
+/*
+  * The first call is the start, call it in the main thread before any worker is started
+*/
+void
+startup_log_stage (const char *stage);
+
+/* Read the startup state in a worker thread */
+/*
+  * @param last_scan_time
+  * The "last-scan-time" setting, it's copied.
+  *
+  * @param signature_expiration_time
+  * The "signature-expiration-time" setting.
+*/
+void
+startup_state_load_async (const char *last_scan_time, gint signature_expiration_time,
+                          GCancellable *cancellable, GAsyncReadyCallback callback, gpointer user_data);
+
+/* Get the startup state */
+/*
+  * @return
+  * The state, free it with `startup_state_free()`, or NULL if the load was cancelled
+*/
+StartupState *
+startup_state_load_finish (GAsyncResult *result, GError **error);
+
+/* Free the state and the parts that weren't taken (set to NULL) */
+void
+startup_state_free (StartupState *state);
@@ -30,6 +30,7 @@
 
 #include "subprocess-components.h"
 #include "ring-buffer.h"
+#include "../clamscanc/background.h"
 
 typedef struct IdleData {
     gpointer context; // context that store some GTKWidgets or other data (e.g. some GTKWidgets you want to control it)
@@ -111,59 +112,67 @@ wait_for_process(pid_t pid, int flags)
     return exit_status;
 }
 
-/* Handle the input event */
-static gboolean
+/* Read the pipe into the free space of the ring buffer */
+/*
+  * @return
+  * the number of the bytes read, 0 on EOF or error, -1 if there is nothing to read for now
+*/
+static ssize_t
 handle_output_event(RingBuffer *ring_buf, int pipefd)
 {
-    const size_t free_space = ring_buffer_available(ring_buf);
-    const size_t buf_size = MIN(free_space, 4096); // Set the buffer size up to 4096 bytes
+    size_t free_space = 0;
+    char *write_pos = ring_buffer_write_space(ring_buf, &free_space);
+    assert(free_space > 0); // The complete lines are always taken before reading, so the buffer can't be full
 
-    char read_buf[buf_size];
-    ssize_t n = 0;
-
-    if ((n = read(pipefd, read_buf, buf_size)) <= 0) return FALSE; // Read from the pipe
+    ssize_t n;
+    while ((n = read(pipefd, write_pos, free_space)) == -1 && errno == EINTR);
 
-    size_t written = ring_buffer_write(ring_buf, read_buf, n); // Write to the ring buffer
-    if (written < (size_t)n)
+    if (n > 0) ring_buffer_commit(ring_buf, n);
+    else if (n == -1 && errno != EAGAIN && errno != EWOULDBLOCK)
     {
-        g_warning("Ring buffer overflow, lost %zd bytes", n - written);
+        g_warning("Failed to read the output: %s", strerror(errno));
+        return 0; // Same as EOF, the pipe can't be used anymore
     }
 
-    return TRUE;
+    return n;
 }
 
 /* Process the subprocess stdout message */
 /*
+  * The pipe is drained until it's empty or `OUTPUT_DRAIN_LIMIT` bytes are read, so the subprocess is never blocked by a full pipe
   * ring_buf: the ring buffer to store the output messages
   * pipefd: the pipe file descriptor to read the output messages
   * context: the context data for the callback function
-  * callback_function: the callback function to process the output lines
+  * callback_function: the callback function to process a batch of the output lines
+  * @return
+  * OUTPUT_STATUS_CLOSED if the pipe reaches EOF or fails, otherwise OUTPUT_STATUS_OPEN
+  * @warning
+  * This function MUST be called in the main context, the lines are passed without copying so they can't be sent to another thread
 */
-gboolean
+OutputStatus
 process_output_lines(RingBuffer *ring_buf, int pipefd, gpointer context,
-                      GSourceFunc callback_function)
+                      OutputLinesFunc callback_function)
 {
-    g_return_val_if_fail(ring_buf != NULL, FALSE);
-    g_return_val_if_fail(callback_function != NULL, FALSE);
-    g_return_val_if_fail(context != NULL, FALSE);
+    g_return_val_if_fail(ring_buf != NULL, OUTPUT_STATUS_CLOSED);
+    g_return_val_if_fail(callback_function != NULL, OUTPUT_STATUS_CLOSED);
+    g_return_val_if_fail(context != NULL, OUTPUT_STATUS_CLOSED);
 
-    if (!handle_output_event(ring_buf, pipefd)) return FALSE; // Check if there is any output event
+    RingBufferLine lines[OUTPUT_LINES_BATCH_SIZE];
+    size_t total_read = 0;
+    ssize_t n = 0;
 
-    char *line;
-    while ((line = ring_buffer_find_new_line(ring_buf)) != NULL)
+    while (total_read < OUTPUT_DRAIN_LIMIT && (n = handle_output_event(ring_buf, pipefd)) > 0)
     {
-        IdleData *data = idle_data_new(context, line, 0);
-
-        /* Send the message to the main process */
-        g_main_context_invoke_full( // Invoke the callback function in the main context
-                       g_main_context_default(),
-                       G_PRIORITY_HIGH_IDLE,
-                       (GSourceFunc) callback_function,
-                       data,
-                       (GDestroyNotify)idle_data_clear);
+        total_read += n;
+
+        size_t num_lines;
+        while ((num_lines = ring_buffer_take_lines(ring_buf, lines, G_N_ELEMENTS(lines))) > 0)
+        {
+            callback_function(context, lines, num_lines); // A single call for the whole batch
+        }
     }
 
-    return TRUE;
+    return n == 0 ? OUTPUT_STATUS_CLOSED : OUTPUT_STATUS_OPEN;
 }
 
 /* Send the final message from the subprocess to the main process */
@@ -213,12 +222,15 @@ build_command_args(const char *command, va_list args)
     return argv;
 }
 
-/* Spawn a new process */
-// path & command: use for `execv()`
-// This function MUST end with a NULL argument to indicate the end of the arguments list
-gboolean
-spawn_new_process(int pipefd[2], pid_t *pid, const char *path, const char *command, ...)
+/* Spawn a new process with its output redirected to the pipe */
+// flags: see `SpawnFlags`
+// argv: built before forking, the child of a multi-threaded process shouldn't allocate memory
+static gboolean
+spawn_process_with_pipe(int pipefd[2], pid_t *pid, SpawnFlags flags,
+                        const char *path, GPtrArray *argv)
 {
+    assert(g_ptr_array_index(argv, argv->len-1) == NULL); // Check whether the last argument is NULL
+
     if (access(path, X_OK) == -1) // First check if the path is valid
     {
         g_critical("[ERROR] Cannot execute %s: %s", path, strerror(errno));
@@ -250,18 +262,12 @@ spawn_new_process(int pipefd[2], pid_t *pid, const char *path, const char *comma
         prctl(PR_SET_PDEATHSIG, SIGTERM); // Ensure the child process can be terminated when the parent process dies
         close(pipefd[0]);
         dup2(pipefd[1], STDOUT_FILENO);
-        dup2(pipefd[1], STDERR_FILENO);
-
-        va_list args;
-        va_start(args, command);
-        GPtrArray *argv = build_command_args(command, args);
-        va_end(args);
-        assert(g_ptr_array_index(argv, argv->len-1) == NULL); // Check whether the last argument is NULL
+        if (flags & SPAWN_MERGE_STDERR) dup2(pipefd[1], STDERR_FILENO);
+        if (flags & SPAWN_BACKGROUND) apply_background_priority(); // Inherited across `execv()`, best effort
 
         execv(path, (char **)argv->pdata);
 
-        g_ptr_array_free(argv, TRUE);
-        exit(EXIT_FAILURE);
+        _exit(EXIT_FAILURE);
     }
     
     close(pipefd[1]);
@@ -270,9 +276,57 @@ spawn_new_process(int pipefd[2], pid_t *pid, const char *path, const char *comma
 error_clean_up:
     close(pipefd[0]);
     close(pipefd[1]);
+    pipefd[0] = pipefd[1] = -1; // Don't let the caller close them again
     return FALSE;
 }
 
+/* Spawn a new process */
+// path & command: use for `execv()`
+// This function MUST end with a NULL argument to indicate the end of the arguments list
+gboolean
+spawn_new_process(int pipefd[2], pid_t *pid, const char *path, const char *command, ...)
+{
+    va_list args;
+    va_start(args, command);
+    GPtrArray *argv = build_command_args(command, args);
+    va_end(args);
+
+    gboolean is_success = spawn_process_with_pipe(pipefd, pid, SPAWN_MERGE_STDERR, path, argv);
+    g_ptr_array_free(argv, TRUE);
+
+    return is_success;
+}
+
+/* Spawn a new process but only its stdout is redirected to the pipe */
+// stderr is inherited from the parent process, so the diagnostic messages never mix into the output
+// It's useful when the output is a binary stream
+// path & command: use for `execv()`
+// This function MUST end with a NULL argument to indicate the end of the arguments list
+gboolean
+spawn_new_process_stdout_only(int pipefd[2], pid_t *pid, const char *path, const char *command, ...)
+{
+    va_list args;
+    va_start(args, command);
+    GPtrArray *argv = build_command_args(command, args);
+    va_end(args);
+
+    gboolean is_success = spawn_process_with_pipe(pipefd, pid, SPAWN_FLAGS_NONE, path, argv);
+    g_ptr_array_free(argv, TRUE);
+
+    return is_success;
+}
+
+/* Spawn a new process with the arguments in an array */
+// It's useful when the number of arguments is only known at runtime
+// argv: starts with the command and ends with NULL, it's borrowed
+gboolean
+spawn_new_process_argv(int pipefd[2], pid_t *pid, SpawnFlags flags, const char *path, GPtrArray *argv)
+{
+    g_return_val_if_fail(argv != NULL && argv->len > 0, FALSE);
+
+    return spawn_process_with_pipe(pipefd, pid, flags, path, argv);
+}
+
 /* Spawn a new process but with no pipes */
 // No pipes means you can pass `FIFO` or `Unix Socket` as input/output
 // But this function won't provide any parameters to pass `FIFO` or `Unix Socket` , you need to pass directly in the command line
@@ -288,27 +342,30 @@ spawn_new_process_no_pipes(pid_t *pid, const char *path, const char *command, ..
         return FALSE;
     }
 
+    /* Build the arguments before forking, the child of a multi-threaded process shouldn't allocate memory */
+    va_list args;
+    va_start(args, command);
+    GPtrArray *argv = build_command_args(command, args);
+    va_end(args);
+    assert(g_ptr_array_index(argv, argv->len-1) == NULL); // Check whether the last argument is NULL
+
     if ((*pid = fork()) == -1) // Fork a new process
     {
         g_critical("[ERROR] Failed to fork: %s", strerror(errno));
+        g_ptr_array_free(argv, TRUE);
         return FALSE;
     }
 
     if (*pid == 0) // Child process
     {
-        prctl(PR_SET_PDEATHSIG, SIGTERM); // Ensure the child process can be terminated when the parent process dies
-
-        va_list args;
-        va_start(args, command);
-        GPtrArray *argv = build_command_args(command, args);
-        va_end(args);
-        assert(g_ptr_array_index(argv, argv->len-1) == NULL); // Check whether the last argument is NULL
+        prctl(PR_SET_PDEATHSIG, SIGTERM); // Ensure the child process can be terminated when the parent process (thread) dies
 
         execv(path, (char **)argv->pdata);
 
-        g_ptr_array_free(argv, TRUE);
-        exit(EXIT_FAILURE);
+        _exit(EXIT_FAILURE);
     }
 
+    g_ptr_array_free(argv, TRUE);
+
     return TRUE;
 }
@@ -28,9 +28,18 @@
 #include "ring-buffer.h"
 
 #define BASE_TIMEOUT_MS 100
+#define OUTPUT_LINES_BATCH_SIZE 256 // The maximum number of lines passed to `OutputLinesFunc` at a time
+#define OUTPUT_DRAIN_LIMIT (1024 * 1024) // Return to the main loop after reading this many bytes, the watch is dispatched again if there is more
 
 typedef struct IdleData IdleData;
 
+/* How a new process is spawned */
+typedef enum {
+    SPAWN_FLAGS_NONE = 0,
+    SPAWN_MERGE_STDERR = 1 << 0, // stderr is redirected to the pipe too, otherwise it's inherited from the parent process
+    SPAWN_BACKGROUND = 1 << 1, // Run with the idle CPU and I/O priority, see `clamscanc/background.h`
+} SpawnFlags;
+
 /* Get the context from the `IdleData` */
 gpointer
 get_idle_context(IdleData *idle_data);
@@ -47,16 +56,34 @@ get_idle_exit_status(IdleData *idle_data);
 gint
 wait_for_process(pid_t pid, int flags);
 
+/* Process a batch of the output lines */
+/*
+  * context: the context data passed to `process_output_lines()`
+  * lines: the output lines, only valid during the call
+  * num_lines: the number of the lines
+*/
+typedef void (*OutputLinesFunc)(gpointer context, RingBufferLine *lines, size_t num_lines);
+
+typedef enum {
+    OUTPUT_STATUS_OPEN, // Nothing more to read for now
+    OUTPUT_STATUS_CLOSED // EOF or error, remove the watch
+} OutputStatus;
+
 /* Process the subprocess stdout message */
 /*
+  * The pipe is drained until it's empty or `OUTPUT_DRAIN_LIMIT` bytes are read, so the subprocess is never blocked by a full pipe
   * ring_buf: the ring buffer to store the output messages
   * pipefd: the pipe file descriptor to read the output messages
   * context: the context data for the callback function
-  * callback_function: the callback function to process the output lines
+  * callback_function: the callback function to process a batch of the output lines
+  * @return
+  * OUTPUT_STATUS_CLOSED if the pipe reaches EOF or fails, otherwise OUTPUT_STATUS_OPEN
+  * @warning
+  * This function MUST be called in the main context, the lines are passed without copying so they can't be sent to another thread
 */
-gboolean
+OutputStatus
 process_output_lines(RingBuffer *ring_buf, int pipefd, gpointer context,
-                      GSourceFunc callback_function);
+                      OutputLinesFunc callback_function);
 
 /* Send the final message from the subprocess to the main process */
 /*
@@ -74,6 +101,22 @@ send_final_message(gpointer context, const char *message, gboolean is_success, i
 gboolean
 spawn_new_process(int pipefd[2], pid_t *pid, const char *path, const char *command, ...);
 
+/* Spawn a new process but only its stdout is redirected to the pipe */
+// stderr is inherited from the parent process, so the diagnostic messages never mix into the output
+// It's useful when the output is a binary stream
+// path & command: use for `execv()`
+// This function MUST end with a NULL argument to indicate the end of the arguments list
+gboolean
+spawn_new_process_stdout_only(int pipefd[2], pid_t *pid, const char *path, const char *command, ...);
+
+/* Spawn a new process with the arguments in an array */
+// It's useful when the number of arguments is only known at runtime
+// flags: see `SpawnFlags`
+// path: use for `execv()`
+// argv: starts with the command and MUST end with a NULL element, it's borrowed
+gboolean
+spawn_new_process_argv(int pipefd[2], pid_t *pid, SpawnFlags flags, const char *path, GPtrArray *argv);
+
 /* Spawn a new process but with no pipes */
 // No pipes means you can pass `FIFO` or `Unix Socket` as input/output
 // But this function won't provide any parameters to pass `FIFO` or `Unix Socket` , you need to pass directly in the command line
@@ -1,64 +1,418 @@
 #include <glib.h>
-#include <dbus/dbus.h>
+#include <gio/gio.h>
 
 #include "systemd-control.h"
 
-int is_service_enabled(const char *service_name)
+#define SYSTEMD_BUS_NAME "org.freedesktop.systemd1"
+#define SYSTEMD_OBJECT_PATH "/org/freedesktop/systemd1"
+#define SYSTEMD_MANAGER_INTERFACE "org.freedesktop.systemd1.Manager"
+#define SYSTEMD_UNIT_INTERFACE "org.freedesktop.systemd1.Unit"
+#define DBUS_PROPERTIES_INTERFACE "org.freedesktop.DBus.Properties"
+
+#define SYSTEMD_CALL_TIMEOUT_MS 5000
+#define SERVICE_MONITOR_MAX_SERVICES 8
+
+#define SERVICE_STATE_PENDING -2 // Not queried yet, reported as -1
+
+/* A watched service */
+/*
+  * `name` is interned, so it can be read without any lock
+  * `unit_file_state` and `active_state` are written by the main thread and read by any thread
+*/
+typedef struct {
+    const char *name;
+    char *object_path; // The unit object, NULL before `LoadUnit` is replied
+    gint unit_file_state;
+    gint active_state;
+    guint properties_changed_id;
+
+    ServiceStateChangedFunc callback;
+    gpointer user_data;
+} WatchedService;
+
+typedef struct {
+    GDBusConnection *connection; // NULL before the bus is connected
+    GCancellable *cancellable;
+    gboolean is_connecting;
+    guint unit_files_changed_id;
+
+    WatchedService services[SERVICE_MONITOR_MAX_SERVICES];
+    gint num_services; // The entries are only appended, so the readers never see a half written entry
+} ServiceMonitor;
+
+static ServiceMonitor monitor = {0};
+
+/* Find the watched service, -1 if not found */
+static int
+find_service(const char *service_name)
+{
+    const int num_services = g_atomic_int_get(&monitor.num_services);
+
+    for (int i = 0; i < num_services; i++)
+    {
+        if (g_strcmp0(monitor.services[i].name, service_name) == 0) return i;
+    }
+
+    return -1;
+}
+
+static void
+notify_service(WatchedService *service)
+{
+    if (service->callback == NULL) return;
+
+    const int unit_file_state = g_atomic_int_get(&service->unit_file_state);
+    const int active_state = g_atomic_int_get(&service->active_state);
+
+    service->callback(service->name,
+                      unit_file_state == SERVICE_STATE_PENDING ? -1 : unit_file_state,
+                      active_state == SERVICE_STATE_PENDING ? -1 : active_state,
+                      service->user_data);
+}
+
+/* Set the state and notify if it's changed */
+static void
+set_service_state(WatchedService *service, gint *state, int new_state)
+{
+    if (g_atomic_int_get(state) == new_state) return;
+
+    g_atomic_int_set(state, new_state);
+    notify_service(service);
+}
+
+static void
+set_active_state(WatchedService *service, const char *active_state)
+{
+    /* "reloading" and "activating" are still treated as running */
+    const gboolean is_active = g_str_equal(active_state, "active") ||
+                               g_str_equal(active_state, "reloading") ||
+                               g_str_equal(active_state, "activating");
+
+    set_service_state(service, &service->active_state, is_active ? 1 : 0);
+}
+
+static gboolean
+is_cancelled(GError *error)
+{
+    return g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED);
+}
+
+/* Queries */
+
+static void
+on_unit_file_state_ready(GObject *source_object, GAsyncResult *res, gpointer user_data)
+{
+    WatchedService *service = &monitor.services[GPOINTER_TO_INT(user_data)];
+    g_autoptr(GError) error = NULL;
+
+    g_autoptr(GVariant) reply = g_dbus_connection_call_finish(G_DBUS_CONNECTION(source_object), res, &error);
+    if (reply == NULL)
+    {
+        if (is_cancelled(error)) return;
+
+        g_warning("Failed to get the unit file state of %s: %s", service->name, error->message);
+        set_service_state(service, &service->unit_file_state, -1);
+        return;
+    }
+
+    const char *state = NULL;
+    g_variant_get(reply, "(&s)", &state);
+
+    set_service_state(service, &service->unit_file_state, g_str_equal(state, "enabled") ? 1 : 0);
+}
+
+static void
+query_unit_file_state(int index)
 {
-    DBusError err;
-    DBusConnection *conn = NULL;
-    DBusMessage *msg = NULL, *reply = NULL;
-    int ret = -1;
+    g_dbus_connection_call(monitor.connection,
+                           SYSTEMD_BUS_NAME, SYSTEMD_OBJECT_PATH, SYSTEMD_MANAGER_INTERFACE,
+                           "GetUnitFileState", g_variant_new("(s)", monitor.services[index].name),
+                           G_VARIANT_TYPE("(s)"), G_DBUS_CALL_FLAGS_NONE, SYSTEMD_CALL_TIMEOUT_MS,
+                           monitor.cancellable, on_unit_file_state_ready, GINT_TO_POINTER(index));
+}
 
-    dbus_error_init(&err);
+static void
+on_active_state_ready(GObject *source_object, GAsyncResult *res, gpointer user_data)
+{
+    WatchedService *service = &monitor.services[GPOINTER_TO_INT(user_data)];
+    g_autoptr(GError) error = NULL;
 
-    /*Connect to the system bus and request a name on it*/
-    conn = dbus_bus_get(DBUS_BUS_SYSTEM, &err);
-    if (dbus_error_is_set(&err))
+    g_autoptr(GVariant) reply = g_dbus_connection_call_finish(G_DBUS_CONNECTION(source_object), res, &error);
+    if (reply == NULL)
     {
-        g_warning("Can't connect to the system bus: %s\n", err.message);
-        goto cleanup;
+        if (is_cancelled(error)) return;
+
+        g_warning("Failed to get the active state of %s: %s", service->name, error->message);
+        set_service_state(service, &service->active_state, -1);
+        return;
     }
 
-    /*Create a method call message*/
-    msg = dbus_message_new_method_call(
-        "org.freedesktop.systemd1",           // Target service
-        "/org/freedesktop/systemd1",          // Object path
-        "org.freedesktop.systemd1.Manager",   // Interface name
-        "GetUnitFileState"                    // Method name
-    );
-
-    /*Add the service name argument*/
-    const char *unit = service_name;
-    if (!dbus_message_append_args(msg, DBUS_TYPE_STRING, &unit, DBUS_TYPE_INVALID))
+    g_autoptr(GVariant) value = NULL;
+    g_variant_get(reply, "(v)", &value);
+
+    if (!g_variant_is_of_type(value, G_VARIANT_TYPE_STRING)) return;
+
+    set_active_state(service, g_variant_get_string(value, NULL));
+}
+
+static void
+query_active_state(int index)
+{
+    g_dbus_connection_call(monitor.connection,
+                           SYSTEMD_BUS_NAME, monitor.services[index].object_path, DBUS_PROPERTIES_INTERFACE,
+                           "Get", g_variant_new("(ss)", SYSTEMD_UNIT_INTERFACE, "ActiveState"),
+                           G_VARIANT_TYPE("(v)"), G_DBUS_CALL_FLAGS_NONE, SYSTEMD_CALL_TIMEOUT_MS,
+                           monitor.cancellable, on_active_state_ready, GINT_TO_POINTER(index));
+}
+
+/* Signals */
+
+static void
+on_properties_changed(GDBusConnection *connection, const char *sender_name, const char *object_path,
+                      const char *interface_name, const char *signal_name, GVariant *parameters, gpointer user_data)
+{
+    const int index = GPOINTER_TO_INT(user_data);
+    WatchedService *service = &monitor.services[index];
+
+    const char *changed_interface = NULL;
+    g_autoptr(GVariant) changed = NULL;
+    g_autofree const char **invalidated = NULL;
+    g_variant_get(parameters, "(&s@a{sv}^a&s)", &changed_interface, &changed, &invalidated);
+
+    const char *active_state = NULL;
+    if (g_variant_lookup(changed, "ActiveState", "&s", &active_state))
+    {
+        set_active_state(service, active_state);
+    }
+    else if (invalidated != NULL && g_strv_contains(invalidated, "ActiveState"))
     {
-        g_warning("Can't add argument to message\n");
-        goto cleanup;
+        query_active_state(index);
     }
 
-    /*Send the message and wait for a reply (5000ms timeout)*/
-    reply = dbus_connection_send_with_reply_and_block(conn, msg, 5000, &err);
-    if (dbus_error_is_set(&err))
+    if (g_variant_lookup(changed, "UnitFileState", "&s", NULL) ||
+        (invalidated != NULL && g_strv_contains(invalidated, "UnitFileState")))
     {
-        g_warning("Method call failed: %s\n", err.message);
-        goto cleanup;
+        query_unit_file_state(index);
     }
+}
 
-    /*Parse the returned string*/
-    const char *state;
-    if (!dbus_message_get_args(reply, &err, DBUS_TYPE_STRING, &state, DBUS_TYPE_INVALID))
+/* Enabling or disabling any service emits this */
+static void
+on_unit_files_changed(GDBusConnection *connection, const char *sender_name, const char *object_path,
+                      const char *interface_name, const char *signal_name, GVariant *parameters, gpointer user_data)
+{
+    const int num_services = g_atomic_int_get(&monitor.num_services);
+
+    for (int i = 0; i < num_services; i++) query_unit_file_state(i);
+}
+
+static void
+on_unit_loaded(GObject *source_object, GAsyncResult *res, gpointer user_data)
+{
+    const int index = GPOINTER_TO_INT(user_data);
+    WatchedService *service = &monitor.services[index];
+    g_autoptr(GError) error = NULL;
+
+    g_autoptr(GVariant) reply = g_dbus_connection_call_finish(G_DBUS_CONNECTION(source_object), res, &error);
+    if (reply == NULL)
     {
-        g_warning("Can't parse arguments: %s\n", err.message);
-        goto cleanup;
+        if (is_cancelled(error)) return;
+
+        g_warning("Failed to load the unit %s: %s", service->name, error->message);
+        set_service_state(service, &service->active_state, -1);
+        return;
     }
 
-    /*Check the state and return the result*/
-    ret = strcmp(state, "enabled") == 0 ? 1 : 0;
+    g_variant_get(reply, "(o)", &service->object_path);
+
+    /* Subscribe before querying, so no change is missed */
+    service->properties_changed_id = g_dbus_connection_signal_subscribe(monitor.connection,
+                                                                        SYSTEMD_BUS_NAME, DBUS_PROPERTIES_INTERFACE,
+                                                                        "PropertiesChanged", service->object_path,
+                                                                        SYSTEMD_UNIT_INTERFACE, G_DBUS_SIGNAL_FLAGS_NONE,
+                                                                        on_properties_changed, GINT_TO_POINTER(index), NULL);
+
+    query_active_state(index);
+}
+
+/* Start querying the service, the connection MUST be ready */
+static void
+start_service(int index)
+{
+    query_unit_file_state(index);
+
+    g_dbus_connection_call(monitor.connection,
+                           SYSTEMD_BUS_NAME, SYSTEMD_OBJECT_PATH, SYSTEMD_MANAGER_INTERFACE,
+                           "LoadUnit", g_variant_new("(s)", monitor.services[index].name),
+                           G_VARIANT_TYPE("(o)"), G_DBUS_CALL_FLAGS_NONE, SYSTEMD_CALL_TIMEOUT_MS,
+                           monitor.cancellable, on_unit_loaded, GINT_TO_POINTER(index));
+}
 
-cleanup:
-    if (msg) dbus_message_unref(msg);
-    if (reply) dbus_message_unref(reply);
-    if (conn) dbus_connection_unref(conn);
-    dbus_error_free(&err);
-    return ret;
-}
\ No newline at end of file
+/* Connection */
+
+static void
+on_bus_ready(GObject *source_object, GAsyncResult *res, gpointer user_data)
+{
+    g_autoptr(GError) error = NULL;
+
+    GDBusConnection *connection = g_bus_get_finish(res, &error);
+    if (connection == NULL)
+    {
+        if (is_cancelled(error)) return;
+
+        monitor.is_connecting = FALSE;
+
+        g_warning("Can't connect to the system bus: %s", error->message);
+
+        /* Report the failure, so the pages won't wait forever */
+        const int num_services = g_atomic_int_get(&monitor.num_services);
+        for (int i = 0; i < num_services; i++)
+        {
+            g_atomic_int_set(&monitor.services[i].unit_file_state, -1);
+            g_atomic_int_set(&monitor.services[i].active_state, -1);
+            notify_service(&monitor.services[i]);
+        }
+        return;
+    }
+
+    monitor.connection = connection;
+    monitor.is_connecting = FALSE;
+
+    monitor.unit_files_changed_id = g_dbus_connection_signal_subscribe(monitor.connection,
+                                                                       SYSTEMD_BUS_NAME, SYSTEMD_MANAGER_INTERFACE,
+                                                                       "UnitFilesChanged", SYSTEMD_OBJECT_PATH,
+                                                                       NULL, G_DBUS_SIGNAL_FLAGS_NONE,
+                                                                       on_unit_files_changed, NULL, NULL);
+
+    /* systemd only emits the signals to the subscribed clients */
+    g_dbus_connection_call(monitor.connection,
+                           SYSTEMD_BUS_NAME, SYSTEMD_OBJECT_PATH, SYSTEMD_MANAGER_INTERFACE,
+                           "Subscribe", NULL, NULL, G_DBUS_CALL_FLAGS_NONE, SYSTEMD_CALL_TIMEOUT_MS,
+                           monitor.cancellable, NULL, NULL);
+
+    const int num_services = g_atomic_int_get(&monitor.num_services);
+    for (int i = 0; i < num_services; i++) start_service(i);
+}
+
+void
+service_monitor_watch(const char *service_name, ServiceStateChangedFunc callback, gpointer user_data)
+{
+    g_return_if_fail(service_name != NULL);
+
+    int index = find_service(service_name);
+    if (index != -1) // Already watched, only replace the callback
+    {
+        monitor.services[index].callback = callback;
+        monitor.services[index].user_data = user_data;
+
+        /* Report the known state */
+        if (g_atomic_int_get(&monitor.services[index].unit_file_state) != SERVICE_STATE_PENDING)
+            notify_service(&monitor.services[index]);
+        return;
+    }
+
+    index = g_atomic_int_get(&monitor.num_services);
+    if (index >= SERVICE_MONITOR_MAX_SERVICES)
+    {
+        g_critical("[ERROR] Too many services are watched, %s is ignored", service_name);
+        return;
+    }
+
+    WatchedService *service = &monitor.services[index];
+    service->name = g_intern_string(service_name);
+    service->object_path = NULL;
+    service->unit_file_state = SERVICE_STATE_PENDING;
+    service->active_state = SERVICE_STATE_PENDING;
+    service->properties_changed_id = 0;
+    service->callback = callback;
+    service->user_data = user_data;
+
+    g_atomic_int_set(&monitor.num_services, index + 1); // Publish the entry
+
+    if (monitor.connection != NULL)
+    {
+        start_service(index);
+        return;
+    }
+
+    if (monitor.is_connecting) return; // Queried after the bus is connected
+
+    if (monitor.cancellable == NULL) monitor.cancellable = g_cancellable_new();
+    monitor.is_connecting = TRUE;
+    g_bus_get(G_BUS_TYPE_SYSTEM, monitor.cancellable, on_bus_ready, NULL);
+}
+
+void
+service_monitor_remove_callbacks(gpointer user_data)
+{
+    const int num_services = g_atomic_int_get(&monitor.num_services);
+
+    for (int i = 0; i < num_services; i++)
+    {
+        if (monitor.services[i].user_data != user_data) continue;
+
+        monitor.services[i].callback = NULL;
+        monitor.services[i].user_data = NULL;
+    }
+}
+
+void
+service_monitor_shutdown(void)
+{
+    if (monitor.cancellable != NULL)
+    {
+        g_cancellable_cancel(monitor.cancellable);
+        g_clear_object(&monitor.cancellable);
+    }
+
+    const int num_services = g_atomic_int_get(&monitor.num_services);
+    g_atomic_int_set(&monitor.num_services, 0);
+
+    for (int i = 0; i < num_services; i++)
+    {
+        WatchedService *service = &monitor.services[i];
+
+        if (service->properties_changed_id != 0)
+            g_dbus_connection_signal_unsubscribe(monitor.connection, service->properties_changed_id);
+
+        g_clear_pointer(&service->object_path, g_free);
+        service->properties_changed_id = 0;
+        service->callback = NULL;
+        service->user_data = NULL;
+    }
+
+    if (monitor.connection != NULL)
+    {
+        if (monitor.unit_files_changed_id != 0)
+            g_dbus_connection_signal_unsubscribe(monitor.connection, monitor.unit_files_changed_id);
+        monitor.unit_files_changed_id = 0;
+
+        g_clear_object(&monitor.connection);
+    }
+
+    monitor.is_connecting = FALSE;
+}
+
+static int
+get_service_state(const char *service_name, gboolean is_unit_file_state)
+{
+    g_return_val_if_fail(service_name != NULL, -1);
+
+    const int index = find_service(service_name);
+    if (index == -1) return -1;
+
+    const WatchedService *service = &monitor.services[index];
+    const int state = g_atomic_int_get(is_unit_file_state ? &service->unit_file_state : &service->active_state);
+
+    return state == SERVICE_STATE_PENDING ? -1 : state;
+}
+
+int is_service_enabled(const char *service_name)
+{
+    return get_service_state(service_name, TRUE);
+}
+
+int is_service_active(const char *service_name)
+{
+    return get_service_state(service_name, FALSE);
+}
@@ -1,4 +1,53 @@
 #pragma once
 
+#include <glib.h>
+
+/* A cached monitor of the systemd services */
+/*
+  * A single system bus connection is shared by all the services, the states are updated by the systemd signals
+  * The states are read without blocking (and without any lock), so they can be read from any thread
+*/
+
+/* Called when the state of a watched service is changed */
+/*
+  * unit_file_state: 1 if the service is enabled, 0 if not, -1 if the state can't be got
+  * active_state: 1 if the service is running, 0 if not, -1 if the state can't be got
+  * @note
+  * This is called by the main thread, the first call is made after the first query
+*/
+typedef void (*ServiceStateChangedFunc)(const char *service_name, int unit_file_state, int active_state, gpointer user_data);
+
+/* Start watching a service */
+/*
+  * @param callback
+  * Called when the state is changed, can be NULL
+  *
+  * @warning
+  * This function MUST be called by the main thread
+*/
+void
+service_monitor_watch(const char *service_name, ServiceStateChangedFunc callback, gpointer user_data);
+
+/* Stop calling the callbacks with this `user_data`, the services are still watched */
+void
+service_monitor_remove_callbacks(gpointer user_data);
+
+/* Close the connection and stop watching all services */
+void
+service_monitor_shutdown(void);
+
+/* Whether the service is enabled */
+/*
+  * @return
+  * 1 if enabled, 0 if not, -1 if the service isn't watched or its state isn't known yet
+*/
+int
+is_service_enabled(const char *service_name);
+
+/* Whether the service is running */
+/*
+  * @return
+  * 1 if running, 0 if not, -1 if the service isn't watched or its state isn't known yet
+*/
 int
-is_service_enabled(const char *service_name);
\ No newline at end of file
+is_service_active(const char *service_name);
@@ -21,6 +21,7 @@
 #include <glib/gi18n.h>
 #include <fcntl.h>
 #include <poll.h>
+#include <sys/wait.h>
 
 #include "subprocess-components.h"
 #include "update-signature.h"
@@ -105,14 +106,14 @@ update_complete_callback(gpointer user_data)
   return G_SOURCE_REMOVE;
 }
 
-static gboolean
-update_sync_callback(gpointer user_data)
+/* Called by the main loop when the update process exits, instead of polling it */
+static void
+update_exit_callback(GPid pid, gint wait_status, gpointer user_data)
 {
   UpdateContext *ctx = user_data;
-  pid_t pid = ctx->pid;
 
-  const gint exit_status = wait_for_process(pid, WNOHANG);
-  if (exit_status == -1) return G_SOURCE_CONTINUE; // Process is still running
+  const gint exit_status = WIFEXITED(wait_status) ? WEXITSTATUS(wait_status) : -1; // -1 if killed by a signal
+  g_spawn_close_pid(pid);
 
   gboolean success = exit_status == 0;
   set_completion_state(ctx, TRUE, success);
@@ -121,8 +122,6 @@ update_sync_callback(gpointer user_data)
       gettext("Signature Update Complete") : gettext("Signature Update Failed");
 
   send_final_message((void *)ctx, status_text, success, exit_status, update_complete_callback);
-
-  return G_SOURCE_REMOVE;
 }
 
 static void
@@ -137,10 +136,8 @@ start_update_async(UpdateContext *ctx)
       return;
   }
 
-  /* Use Async I/O to check the update status */
-  GSource *source = g_timeout_source_new(BASE_TIMEOUT_MS);
-  g_source_set_callback(source, (GSourceFunc)update_sync_callback, ctx, NULL);
-  g_source_attach(source, g_main_context_default());
+  /* Get notified when the update process exits */
+  g_child_watch_add(ctx->pid, update_exit_callback, ctx);
 }
 
 void
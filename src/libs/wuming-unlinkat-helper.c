@@ -59,34 +59,36 @@ command_line_handler(GApplication* self, GApplicationCommandLine* command_line,
     gchar **argv = g_application_command_line_get_arguments(command_line, &argc); // Get the command line arguments;
 
     // Check the number of command line arguments
-    if (argc != 3)
+    if (argc != 2)
     {
         g_critical("[ERROR] Invalid arguments");
-        g_critical("Usage: %s <shm_name> <file_path>", argv[0]);
+        g_critical("Usage: %s <arena_shm_name>", argv[0]);
         return FILE_SECURITY_INVALID_PATH;
     }
 
-    // Get the shm name and file path from the command line arguments
+    // Get the shm name of the arena from the command line arguments
+    // The arena holds the security contexts and the paths of all the files, so it's mapped once and a single authorization covers them
     const char *shm_name = argv[1];
-    const char *file_path = argv[2];
 
-    FileSecurityContext *security_context = file_security_context_open_shared_mem(shm_name);
-    if (security_context == NULL)
+    FileSecurityArena *arena = file_security_arena_open_shared_mem(shm_name);
+    if (arena == NULL)
     {
         g_critical("[ERROR] Failed to open shared memory: %s", shm_name);
         return FILE_SECURITY_OPERATION_FAILED;
     }
 
-    /* Delete file */
-    status = file_security_secure_delete(security_context, file_path, 0); // Delete the file with elevated privileges
-    file_security_context_close_shared_mem(&security_context); // Close the shared memory
+    /* Delete files */
+    // The status of each file is written back to the arena, the exit status is only the first failure
+    status = file_security_arena_secure_delete(arena, 0); // Delete the files with elevated privileges
+    const size_t count = file_security_arena_get_count(arena);
+    file_security_arena_close_shared_mem(&arena); // Close the shared memory
     if (status != FILE_SECURITY_OK)
     {
-        g_critical("[ERROR] Failed to unlink the file: %s", file_path);
+        g_critical("[ERROR] Failed to unlink some of the %zu files", count);
     }
     else
     {
-        g_print("[INFO] The file has been unlinked successfully with elevated privileges.\n");
+        g_print("[INFO] %zu files have been unlinked successfully with elevated privileges.\n", count);
     }
 
     return status;
@@ -23,6 +23,7 @@
 #include <glib/gi18n.h>
 
 #include "wuming-application.h"
+#include "libs/startup-state.h"
 
 int
 main (int   argc,
@@ -31,6 +32,8 @@ main (int   argc,
 	g_autoptr(WumingApplication) app = NULL;
 	int ret;
 
+	startup_log_stage ("main"); // The start of the startup timing
+
 	bindtextdomain (GETTEXT_PACKAGE, LOCALEDIR);
 	bind_textdomain_codeset (GETTEXT_PACKAGE, "UTF-8");
 	textdomain (GETTEXT_PACKAGE);
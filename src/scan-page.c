@@ -31,6 +31,7 @@ struct _ScanPage {
   GtkBox             *box_main;
   GtkButton          *scan_a_file_button;
   GtkButton          *scan_a_folder_button;
+  GtkButton          *resume_scan_button;
 };
 
 enum {
@@ -149,6 +150,34 @@ scan_page_show_last_scan_time_status (ScanPage *self, const gchar *timestamp, gb
   adw_status_page_set_icon_name (self->status_page, icon_name);
 }
 
+static gboolean
+is_paths_set_mapping (GValue *value, GVariant *variant, gpointer user_data)
+{
+  g_value_set_boolean (value, g_variant_n_children (variant) > 0);
+
+  return TRUE;
+}
+
+/* Show the resume button while an interrupted scan can be resumed */
+/*
+  * @param self
+  * `ScanPage` object
+  *
+  * @param settings
+  * `GSettings` holding the "resume-scan-paths" key
+*/
+void
+scan_page_bind_resumable_scan (ScanPage *self, GSettings *settings)
+{
+  g_return_if_fail (SCAN_IS_PAGE (self) && settings != NULL);
+
+  g_settings_bind_with_mapping (settings, "resume-scan-paths",
+                                self->resume_scan_button, "visible",
+                                G_SETTINGS_BIND_GET,
+                                is_paths_set_mapping, NULL,
+                                NULL, NULL);
+}
+
 /*GObject Essential Functions */
 
 static void
@@ -171,6 +200,7 @@ scan_page_finalize(GObject *gobject)
   self->status_page = NULL;
   self->scan_a_file_button = NULL;
   self->scan_a_folder_button = NULL;
+  self->resume_scan_button = NULL;
 
   G_OBJECT_CLASS(scan_page_parent_class)->finalize(gobject);
 }
@@ -227,6 +257,7 @@ scan_page_class_init (ScanPageClass *klass)
   gtk_widget_class_bind_template_child (widget_class, ScanPage, box_main);
   gtk_widget_class_bind_template_child (widget_class, ScanPage, scan_a_file_button);
   gtk_widget_class_bind_template_child (widget_class, ScanPage, scan_a_folder_button);
+  gtk_widget_class_bind_template_child (widget_class, ScanPage, resume_scan_button);
 }
 
 GtkWidget *
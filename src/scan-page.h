@@ -45,6 +45,17 @@ G_DECLARE_FINAL_TYPE (ScanPage, scan_page, SCAN, PAGE, AdwBin)
 void
 scan_page_show_last_scan_time_status (ScanPage *self, const gchar *timestamp, gboolean is_expired);
 
+/* Show the resume button while an interrupted scan can be resumed */
+/*
+  * @param self
+  * `ScanPage` object
+  *
+  * @param settings
+  * `GSettings` holding the "resume-scan-paths" key
+*/
+void
+scan_page_bind_resumable_scan (ScanPage *self, GSettings *settings);
+
 GtkWidget *
 scan_page_new(void);
 
@@ -32,13 +32,132 @@ struct _ScanningPage {
     AdwStatusPage *status_page;
     GtkButton *threat_button;
     GtkButton *close_button;
+    GtkLabel *throughput_label;
 
     /* Private */
     AdwSpinnerPaintable *spinner;
+
+    /* Progress */
+    guint tick_id; // The tick callback polling the counters, 0 if not running
+    ScanningPageProgressFunc progress_func;
+    gpointer progress_data;
+    ScanningPageProgress progress; // The counters shown on the page
+    ScanningPageProgress sample; // The counters at the start of the throughput window
+    gint64 sample_time; // Frame time at the start of the throughput window, in microseconds
+    gint64 start_time; // Frame time of the first tick, in microseconds
 };
 
 G_DEFINE_FINAL_TYPE(ScanningPage, scanning_page, GTK_TYPE_WIDGET)
 
+#define THROUGHPUT_WINDOW_US (500 * G_USEC_PER_SEC / 1000) // The throughput is measured over this window, otherwise it jitters on every frame
+
+/* Format "N files/s" with "N MB/s" if the bytes are known */
+static char *
+format_rate (double files_per_sec, double bytes_per_sec, gboolean has_bytes)
+{
+    if (!has_bytes) return g_strdup_printf(gettext("%.0f files/s"), files_per_sec);
+
+    g_autofree char *bytes_text = g_format_size((guint64) bytes_per_sec);
+    return g_strdup_printf(gettext("%.0f files/s, %s/s"), files_per_sec, bytes_text);
+}
+
+/* Show the throughput in the last window and since the scan started */
+static void
+update_throughput_label (ScanningPage *self, double files_per_sec, double bytes_per_sec, gint64 now)
+{
+    const gboolean has_bytes = self->progress.bytes > 0;
+    const double total_seconds = (now - self->start_time) / (double) G_USEC_PER_SEC;
+
+    g_autofree char *current = format_rate(files_per_sec, bytes_per_sec, has_bytes);
+    g_autofree char *average = format_rate(self->progress.files / total_seconds, self->progress.bytes / total_seconds, has_bytes);
+    g_autofree char *text = NULL;
+
+    if (has_bytes)
+    {
+        g_autofree char *total_bytes = g_format_size(self->progress.bytes);
+        text = g_strdup_printf(gettext("Current: %s\nAverage: %s\n%s scanned"), current, average, total_bytes);
+    }
+    else text = g_strdup_printf(gettext("Current: %s\nAverage: %s"), current, average);
+
+    gtk_label_set_text(self->throughput_label, text);
+    gtk_widget_set_visible(GTK_WIDGET(self->throughput_label), TRUE);
+}
+
+static gboolean
+on_progress_tick (GtkWidget *widget, GdkFrameClock *frame_clock, gpointer user_data)
+{
+    ScanningPage *self = SCANNING_PAGE(widget);
+    const gint64 now = gdk_frame_clock_get_frame_time(frame_clock);
+
+    ScanningPageProgress progress = { 0 };
+    self->progress_func(self->progress_data, &progress);
+
+    /* Only relayout the description when the counters are changed */
+    if (progress.files != self->progress.files || progress.threats != self->progress.threats)
+    {
+        g_autofree char *status_text = g_strdup_printf(gettext("%d files scanned\n%d threats found"), progress.files, progress.threats);
+        adw_status_page_set_description(self->status_page, status_text);
+    }
+    self->progress = progress;
+
+    if (self->start_time == 0) // First frame, start the throughput window
+    {
+        self->start_time = now;
+        self->sample_time = now;
+        self->sample = progress;
+        return G_SOURCE_CONTINUE;
+    }
+
+    const gint64 elapsed = now - self->sample_time;
+    if (elapsed < THROUGHPUT_WINDOW_US) return G_SOURCE_CONTINUE;
+
+    const double seconds = elapsed / (double) G_USEC_PER_SEC;
+    update_throughput_label(self, (progress.files - self->sample.files) / seconds,
+                            (progress.bytes - self->sample.bytes) / seconds, now);
+
+    self->sample = progress;
+    self->sample_time = now;
+
+    return G_SOURCE_CONTINUE;
+}
+
+void
+scanning_page_start_progress (ScanningPage *self, ScanningPageProgressFunc progress_func, gpointer user_data)
+{
+    g_return_if_fail(SCANNING_IS_PAGE(self) && progress_func != NULL);
+
+    scanning_page_stop_progress(self);
+    gtk_widget_set_visible(GTK_WIDGET(self->throughput_label), FALSE);
+
+    self->progress_func = progress_func;
+    self->progress_data = user_data;
+    self->progress = (ScanningPageProgress) { -1, -1, 0 }; // Always show the counters on the first frame
+    self->start_time = 0;
+    self->tick_id = gtk_widget_add_tick_callback(GTK_WIDGET(self), on_progress_tick, NULL, NULL);
+}
+
+void
+scanning_page_stop_progress (ScanningPage *self)
+{
+    g_return_if_fail(SCANNING_IS_PAGE(self));
+
+    if (self->tick_id == 0) return; // Not running
+
+    gtk_widget_remove_tick_callback(GTK_WIDGET(self), self->tick_id);
+    self->tick_id = 0;
+    self->progress_func = NULL;
+    self->progress_data = NULL;
+
+    /* Keep the average only, the current throughput is meaningless after the scan */
+    if (self->start_time == 0 || self->sample_time == self->start_time) return; // Not enough frames to measure
+
+    const double total_seconds = (self->sample_time - self->start_time) / (double) G_USEC_PER_SEC;
+    const gboolean has_bytes = self->sample.bytes > 0;
+    g_autofree char *average = format_rate(self->sample.files / total_seconds, self->sample.bytes / total_seconds, has_bytes);
+    g_autofree char *text = g_strdup_printf(gettext("Average: %s"), average);
+    gtk_label_set_text(self->throughput_label, text);
+}
+
 void
 scanning_page_disable_threat_button (ScanningPage *self)
 {
@@ -49,6 +168,9 @@ scanning_page_disable_threat_button (ScanningPage *self)
 void
 scanning_page_reset (ScanningPage *self)
 {
+    scanning_page_stop_progress(self);
+    gtk_widget_set_visible(GTK_WIDGET(self->throughput_label), FALSE);
+
     adw_status_page_set_title(self->status_page, gettext("Scanning..."));
     adw_status_page_set_description(self->status_page, gettext("Preparing..."));
     adw_status_page_set_paintable(self->status_page, GDK_PAINTABLE(self->spinner));
@@ -78,6 +200,8 @@ scanning_page_set_progress (ScanningPage *self, const char *progress)
 void
 scanning_page_set_final_result (ScanningPage *self, gboolean has_threat, const char *result, const char *detail, const char *icon_name)
 {
+    scanning_page_stop_progress(self); // Don't overwrite the final result
+
     if (result) adw_status_page_set_title(self->status_page, result);
     if (detail) adw_status_page_set_description(self->status_page, detail);
     if (icon_name) adw_status_page_set_icon_name(self->status_page, icon_name);
@@ -123,6 +247,7 @@ scanning_page_dispose(GObject *object)
     ScanningPage *self = SCANNING_PAGE(object);
 
     scanning_page_revoke_cancel_signal(self);
+    scanning_page_stop_progress(self);
 
     GtkWidget *toolbar_view = GTK_WIDGET(self->toolbar_view);
 
@@ -143,6 +268,7 @@ scanning_page_finalize(GObject *object)
     self->status_page = NULL;
     self->threat_button = NULL;
     self->close_button = NULL;
+    self->throughput_label = NULL;
     self->spinner = NULL;
 
     G_OBJECT_CLASS(scanning_page_parent_class)->finalize(object);
@@ -166,6 +292,7 @@ scanning_page_class_init(ScanningPageClass *klass)
     gtk_widget_class_bind_template_child (widget_class, ScanningPage, status_page);
     gtk_widget_class_bind_template_child (widget_class, ScanningPage, threat_button);
     gtk_widget_class_bind_template_child (widget_class, ScanningPage, close_button);
+    gtk_widget_class_bind_template_child (widget_class, ScanningPage, throughput_label);
 }
 
 static void
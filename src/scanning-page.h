@@ -28,6 +28,16 @@ G_BEGIN_DECLS
 
 G_DECLARE_FINAL_TYPE (ScanningPage, scanning_page, SCANNING, PAGE, GtkWidget)
 
+/* The counters of the running scan */
+typedef struct {
+  gint files; // Files scanned
+  gint threats; // Threats found
+  guint64 bytes; // Bytes scanned, 0 if the scanner doesn't report it
+} ScanningPageProgress;
+
+/* Fill the current counters, must be cheap because it's called once per frame */
+typedef void (*ScanningPageProgressFunc) (gpointer user_data, ScanningPageProgress *progress);
+
 void
 scanning_page_disable_threat_button (ScanningPage *self);
 
@@ -37,6 +47,18 @@ scanning_page_reset (ScanningPage *self);
 void
 scanning_page_set_progress (ScanningPage *self, const char *progress);
 
+/* Poll the counters on every frame and show them with the throughput */
+/*
+  * The page is only updated when it's drawn, so the scanner can update the counters as often as it wants
+  * Stopped by `scanning_page_stop_progress()`, `scanning_page_set_final_result()` or `scanning_page_reset()`
+*/
+void
+scanning_page_start_progress (ScanningPage *self, ScanningPageProgressFunc progress_func, gpointer user_data);
+
+/* Stop polling the counters, the average throughput is kept on the page */
+void
+scanning_page_stop_progress (ScanningPage *self);
+
 void
 scanning_page_set_final_result (ScanningPage *self, gboolean has_threat, const char *result, const char *detail, const char *icon_name);
 
@@ -35,6 +35,8 @@ struct _SecurityOverviewPage {
     GtkImage *scan_overview_icon;
     AdwActionRow *signature_overview_row;
     GtkImage *signature_overview_icon;
+    AdwActionRow *history_overview_row;
+    GtkImage *history_overview_icon;
     AdwActionRow *service_overview_row;
     GtkImage *service_overview_icon;
 
@@ -185,6 +187,39 @@ security_overview_page_show_signature_status (SecurityOverviewPage *self, const
     security_overview_page_set_row_status (self->signature_overview_row, self->signature_overview_icon, label, icon_name, style);
 }
 
+/* Show the trend of the recent scans on the security overview page. */
+/*
+  * @param self
+  * `SecurityOverviewPage` object.
+  *
+  * @param trend
+  * The scans of the last `SCAN_HISTORY_TREND_DAYS` days.
+*/
+void
+security_overview_page_show_scan_history (SecurityOverviewPage *self, const ScanHistoryTrend *trend)
+{
+    g_return_if_fail(self != NULL && trend != NULL);
+
+    g_autofree gchar *label = NULL;
+    const gchar *icon_name = NULL;
+    const gchar *style = NULL;
+
+    if (trend->scans == 0)
+    {
+        label = g_strdup (gettext ("No Scan In The Last 30 Days"));
+        icon_name = "status-warning-symbolic";
+        style = "warning";
+    }
+    else
+    {
+        label = g_strdup_printf (gettext ("%u Scans And %u Threats In The Last 30 Days"), trend->scans, (guint) MIN (trend->threats, G_MAXUINT));
+        icon_name = trend->threats > 0 || trend->failed_scans > 0 ? "status-warning-symbolic" : "status-ok-symbolic";
+        style = trend->threats > 0 || trend->failed_scans > 0 ? "warning" : "success";
+    }
+
+    security_overview_page_set_row_status (self->history_overview_row, self->history_overview_icon, label, icon_name, style);
+}
+
 void
 security_overview_page_show_servicestat (SecurityOverviewPage *self, int service_status)
 {
@@ -258,6 +293,17 @@ security_overview_page_show_health_level (SecurityOverviewPage *self)
     adw_status_page_set_icon_name (self->status_page, icon_name);
 }
 
+/* Show that the status is being checked, until the health level is shown */
+void
+security_overview_page_show_checking (SecurityOverviewPage *self)
+{
+    g_return_if_fail(self != NULL);
+
+    adw_status_page_set_title (self->status_page, gettext ("Checking Status"));
+    adw_status_page_set_description (self->status_page, gettext ("Reading the signature and the scan history"));
+    adw_status_page_set_icon_name (self->status_page, "content-loading-symbolic");
+}
+
 /* GObject essential functions */
 
 static void
@@ -282,6 +328,8 @@ security_overview_page_finalize (GObject *object)
     self->scan_overview_icon = NULL;
     self->signature_overview_row = NULL;
     self->signature_overview_icon = NULL;
+    self->history_overview_row = NULL;
+    self->history_overview_icon = NULL;
     self->service_overview_row = NULL;
     self->service_overview_icon = NULL;
 
@@ -324,6 +372,8 @@ security_overview_page_class_init (SecurityOverviewPageClass *klass)
     gtk_widget_class_bind_template_child (widget_class, SecurityOverviewPage, scan_overview_icon);
     gtk_widget_class_bind_template_child (widget_class, SecurityOverviewPage, signature_overview_row);
     gtk_widget_class_bind_template_child (widget_class, SecurityOverviewPage, signature_overview_icon);
+    gtk_widget_class_bind_template_child (widget_class, SecurityOverviewPage, history_overview_row);
+    gtk_widget_class_bind_template_child (widget_class, SecurityOverviewPage, history_overview_icon);
     gtk_widget_class_bind_template_child (widget_class, SecurityOverviewPage, service_overview_row);
     gtk_widget_class_bind_template_child (widget_class, SecurityOverviewPage, service_overview_icon);
 }
@@ -22,6 +22,7 @@
 
 #include <adwaita.h>
 
+#include "libs/scan-history.h"
 #include "libs/signature-status.h"
 
 G_BEGIN_DECLS
@@ -55,6 +56,17 @@ security_overview_page_show_last_scan_time_status (SecurityOverviewPage *self, g
 void
 security_overview_page_show_signature_status (SecurityOverviewPage *self, const signature_status *result);
 
+/* Show the trend of the recent scans on the security overview page. */
+/*
+  * @param self
+  * `SecurityOverviewPage` object.
+  *
+  * @param trend
+  * The scans of the last `SCAN_HISTORY_TREND_DAYS` days.
+*/
+void
+security_overview_page_show_scan_history (SecurityOverviewPage *self, const ScanHistoryTrend *trend);
+
 /* Show the freshclam serivce is enabled or not */
 void
 security_overview_page_show_servicestat (SecurityOverviewPage *self, int service_status);
@@ -63,6 +75,10 @@ security_overview_page_show_servicestat (SecurityOverviewPage *self, int service
 void
 security_overview_page_show_health_level (SecurityOverviewPage *self);
 
+/* Show that the status is being checked, until the health level is shown */
+void
+security_overview_page_show_checking (SecurityOverviewPage *self);
+
 GtkWidget *
 security_overview_page_new (void);
 
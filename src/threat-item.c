@@ -0,0 +1,354 @@
+/* threat-item.c
+ *
+ * Copyright 2025 EricLin
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include <string.h>
+
+#include "libs/delete-file.h"
+
+#include "threat-item.h"
+
+// Warning: this macro should be started and ended with a space, otherwise may cause comparison error
+#define SYSTEM_DIRECTORIES " /usr /lib /lib64 /etc /opt /var /sys /proc " // System directories that should be warned before deleting
+
+struct _ThreatItem {
+    GObject parent_instance;
+
+    DeleteFileData *delete_data; // Also owns the path
+    const char *path;
+    const char *virname; // Interned, the same signature is usually found many times
+    FileSecurityStatus status;
+    gboolean is_system_file;
+};
+
+enum {
+  PROP_0,
+  PROP_STATUS,
+  N_PROPS
+};
+
+G_DEFINE_FINAL_TYPE (ThreatItem, threat_item, G_TYPE_OBJECT)
+
+static GParamSpec *properties [N_PROPS];
+
+/* Check whether the first directory of the absolute path is a system directory */
+static gboolean
+is_system_path (const char *path)
+{
+    if (!path || path[0] != '/') return FALSE;
+
+    /* Get the first directory name in the path */
+    // Because all the paths should be absolute, the first character should be a slash
+    const char *second_slash = strchr (path + 1, '/');
+    const size_t length = second_slash ? (size_t)(second_slash - path) : strlen (path);
+
+    g_autofree gchar *query = g_strdup_printf (" %.*s ", (int)length, path); // Use for searching in the `SYSTEM_DIRECTORIES`
+
+    return strstr (SYSTEM_DIRECTORIES, query) != NULL;
+}
+
+const char *
+threat_item_get_path (ThreatItem *self)
+{
+    g_return_val_if_fail (THREAT_IS_ITEM (self), NULL);
+
+    return self->path;
+}
+
+const char *
+threat_item_get_virname (ThreatItem *self)
+{
+    g_return_val_if_fail (THREAT_IS_ITEM (self), NULL);
+
+    return self->virname;
+}
+
+gboolean
+threat_item_is_system_file (ThreatItem *self)
+{
+    g_return_val_if_fail (THREAT_IS_ITEM (self), FALSE);
+
+    return self->is_system_file;
+}
+
+FileSecurityStatus
+threat_item_get_status (ThreatItem *self)
+{
+    g_return_val_if_fail (THREAT_IS_ITEM (self), FILE_SECURITY_INVALID_CONTEXT);
+
+    return self->status;
+}
+
+/* Create threats in a worker thread */
+
+typedef struct {
+    GPtrArray *paths;
+    GPtrArray *virnames;
+    ThreatItem **items; // Same order as `paths`, NULL for the failed ones
+} NewBatchTaskData;
+
+static void
+new_batch_task_data_free (gpointer user_data)
+{
+    NewBatchTaskData *task_data = user_data;
+
+    for (guint i = 0; task_data->items && i < task_data->paths->len; i++) g_clear_object (&task_data->items[i]);
+
+    g_ptr_array_unref (task_data->paths);
+    g_ptr_array_unref (task_data->virnames);
+    g_free (task_data->items);
+    g_free (task_data);
+}
+
+/* The length of the directory part of the path, the root directory is kept as "/" */
+static gsize
+get_dir_length (const char *path)
+{
+    const char *last_slash = strrchr (path, '/');
+
+    return last_slash ? MAX ((gsize)(last_slash - path), 1) : 0;
+}
+
+static gint
+compare_by_directory (gconstpointer a, gconstpointer b, gpointer user_data)
+{
+    GPtrArray *paths = user_data;
+    const guint index_a = *(const guint *)a;
+    const guint index_b = *(const guint *)b;
+    const char *path_a = g_ptr_array_index (paths, index_a);
+    const char *path_b = g_ptr_array_index (paths, index_b);
+    const gsize length_a = get_dir_length (path_a);
+    const gsize length_b = get_dir_length (path_b);
+
+    const int result = strncmp (path_a, path_b, MIN (length_a, length_b));
+    if (result != 0) return result;
+    if (length_a != length_b) return length_a < length_b ? -1 : 1;
+
+    return index_a < index_b ? -1 : (index_a > index_b); // Keep the order in a directory
+}
+
+static void
+new_batch_thread (GTask *task, gpointer source_object, gpointer user_data, GCancellable *cancellable)
+{
+    NewBatchTaskData *task_data = user_data;
+    const guint n_paths = task_data->paths->len;
+
+    /* The threats of a directory are snapshotted together, so its fd is taken once and then hit in the cache */
+    g_autoptr (GArray) order = g_array_sized_new (FALSE, FALSE, sizeof (guint), n_paths);
+    for (guint i = 0; i < n_paths; i++) g_array_append_val (order, i);
+    g_array_sort_with_data (order, compare_by_directory, task_data->paths);
+
+    for (guint i = 0; i < n_paths; i++)
+    {
+        if (g_task_return_error_if_cancelled (task)) return; // Cleared, the rest is dropped
+
+        const guint index = g_array_index (order, guint, i);
+        task_data->items[index] = threat_item_new (g_ptr_array_index (task_data->paths, index),
+                                                   g_ptr_array_index (task_data->virnames, index));
+    }
+
+    g_task_return_boolean (task, TRUE);
+}
+
+void
+threat_item_new_batch_async (GPtrArray *paths, GPtrArray *virnames, GCancellable *cancellable,
+                             gpointer source_object, GAsyncReadyCallback callback, gpointer user_data)
+{
+    g_return_if_fail (paths != NULL && virnames != NULL);
+    g_return_if_fail (paths->len == virnames->len);
+
+    NewBatchTaskData *task_data = g_new0 (NewBatchTaskData, 1);
+    task_data->paths = g_ptr_array_ref (paths);
+    task_data->virnames = g_ptr_array_ref (virnames);
+    task_data->items = g_new0 (ThreatItem *, MAX (paths->len, 1));
+
+    g_autoptr (GTask) task = g_task_new (source_object, cancellable, callback, user_data);
+    g_task_set_source_tag (task, threat_item_new_batch_async);
+    g_task_set_task_data (task, task_data, new_batch_task_data_free);
+    g_task_run_in_thread (task, new_batch_thread);
+}
+
+GPtrArray *
+threat_item_new_batch_finish (GAsyncResult *result, guint *failed, GError **error)
+{
+    g_return_val_if_fail (g_task_is_valid (result, NULL), NULL);
+
+    GTask *task = G_TASK (result);
+    if (!g_task_propagate_boolean (task, error)) return NULL;
+
+    NewBatchTaskData *task_data = g_task_get_task_data (task);
+    const guint n_paths = task_data->paths->len;
+    GPtrArray *items = g_ptr_array_new_full (n_paths, g_object_unref);
+
+    for (guint i = 0; i < n_paths; i++)
+        if (task_data->items[i] != NULL) g_ptr_array_add (items, g_steal_pointer (&task_data->items[i])); // The failed ones are skipped
+
+    if (failed) *failed = n_paths - items->len;
+
+    return items;
+}
+
+/* Delete threats in a worker thread */
+
+typedef struct {
+    GPtrArray *items; // The `ThreatItem`s to delete
+    FileSecurityStatus *statuses;
+} DeleteTaskData;
+
+static void
+delete_task_data_free (gpointer user_data)
+{
+    DeleteTaskData *task_data = user_data;
+
+    g_ptr_array_unref (task_data->items);
+    g_free (task_data->statuses);
+    g_free (task_data);
+}
+
+static void
+delete_threats_thread (GTask *task, gpointer source_object, gpointer user_data, GCancellable *cancellable)
+{
+    DeleteTaskData *task_data = user_data;
+    const guint n_items = task_data->items->len;
+
+    /* Only the delete data is used here, it isn't changed while the task is running */
+    g_autofree DeleteFileData **data = g_new (DeleteFileData *, MAX (n_items, 1));
+    for (guint i = 0; i < n_items; i++)
+        data[i] = THREAT_ITEM (g_ptr_array_index (task_data->items, i))->delete_data;
+
+    delete_threat_files (data, n_items, task_data->statuses);
+
+    g_task_return_boolean (task, TRUE);
+}
+
+void
+threat_item_delete_async (GPtrArray *items, gpointer source_object, GAsyncReadyCallback callback, gpointer user_data)
+{
+    g_return_if_fail (items != NULL);
+
+    DeleteTaskData *task_data = g_new0 (DeleteTaskData, 1);
+    task_data->items = g_ptr_array_new_with_free_func (g_object_unref);
+    for (guint i = 0; i < items->len; i++)
+        g_ptr_array_add (task_data->items, g_object_ref (g_ptr_array_index (items, i)));
+    task_data->statuses = g_new (FileSecurityStatus, MAX (items->len, 1));
+
+    g_autoptr (GTask) task = g_task_new (source_object, NULL, callback, user_data);
+    g_task_set_source_tag (task, threat_item_delete_async);
+    g_task_set_task_data (task, task_data, delete_task_data_free);
+    g_task_run_in_thread (task, delete_threats_thread);
+}
+
+GPtrArray *
+threat_item_delete_finish (GAsyncResult *result, GError **error)
+{
+    g_return_val_if_fail (g_task_is_valid (result, NULL), NULL);
+
+    GTask *task = G_TASK (result);
+    if (!g_task_propagate_boolean (task, error)) return NULL;
+
+    DeleteTaskData *task_data = g_task_get_task_data (task);
+    GPtrArray *deleted = g_ptr_array_new_with_free_func (g_object_unref);
+
+    /* Update the statuses in the main thread, so the rows are notified here */
+    for (guint i = 0; i < task_data->items->len; i++)
+    {
+        ThreatItem *self = g_ptr_array_index (task_data->items, i);
+        const FileSecurityStatus status = task_data->statuses[i];
+
+        if (status == FILE_SECURITY_OK) g_ptr_array_add (deleted, g_object_ref (self));
+        if (status == FILE_SECURITY_OK || status == FILE_SECURITY_OPERATION_SKIPPED) continue; // Nothing changed for the rows
+
+        self->status = status;
+        g_object_notify_by_pspec (G_OBJECT (self), properties[PROP_STATUS]);
+    }
+
+    return deleted;
+}
+
+/* GObject essential functions */
+
+static void
+threat_item_get_property (GObject *object,
+                          guint prop_id,
+                          GValue *value,
+                          GParamSpec *pspec)
+{
+    ThreatItem *self = THREAT_ITEM (object);
+
+    switch (prop_id)
+    {
+        case PROP_STATUS:
+            g_value_set_int (value, self->status);
+            break;
+        default:
+            G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+    }
+}
+
+static void
+threat_item_finalize (GObject *object)
+{
+    ThreatItem *self = THREAT_ITEM (object);
+
+    g_clear_pointer (&self->delete_data, delete_file_data_free);
+    self->path = NULL;
+
+    G_OBJECT_CLASS (threat_item_parent_class)->finalize (object);
+}
+
+static void
+threat_item_class_init (ThreatItemClass *klass)
+{
+    GObjectClass *object_class = G_OBJECT_CLASS (klass);
+
+    object_class->get_property = threat_item_get_property;
+    object_class->finalize = threat_item_finalize;
+
+    properties [PROP_STATUS] =
+    g_param_spec_int ("status",
+                      "Status",
+                      "The result of the last delete attempt",
+                      FILE_SECURITY_OK, FILE_SECURITY_OPERATION_SKIPPED, FILE_SECURITY_OK,
+                      (G_PARAM_READABLE | G_PARAM_EXPLICIT_NOTIFY | G_PARAM_STATIC_STRINGS));
+
+    g_object_class_install_properties (object_class, N_PROPS, properties);
+}
+
+static void
+threat_item_init (ThreatItem *self)
+{
+    self->status = FILE_SECURITY_OK;
+}
+
+ThreatItem *
+threat_item_new (const char *path, const char *virname)
+{
+    g_return_val_if_fail (path != NULL, NULL);
+
+    DeleteFileData *delete_data = delete_file_data_new (path); // Capture the file state as soon as it's found
+    if (delete_data == NULL) return NULL;
+
+    ThreatItem *self = g_object_new (THREAT_TYPE_ITEM, NULL);
+    self->delete_data = delete_data;
+    self->path = delete_file_data_get_path (delete_data);
+    self->virname = virname ? g_intern_string (virname) : NULL;
+    self->is_system_file = is_system_path (path);
+
+    return self;
+}
@@ -0,0 +1,99 @@
+/* threat-item.h
+ *
+ * Copyright 2025 EricLin
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#pragma once
+
+#include <gio/gio.h>
+
+#include "libs/file-security-status.h"
+
+G_BEGIN_DECLS
+
+#define THREAT_TYPE_ITEM (threat_item_get_type ())
+
+G_DECLARE_FINAL_TYPE (ThreatItem, threat_item, THREAT, ITEM, GObject)
+
+/* A threat found by the scan, the item of the threat page model */
+/*
+  * Only the data is kept here, the rows are created for the visible items only
+  * @return
+  * NULL if the file can't be prepared for deleting
+*/
+ThreatItem *
+threat_item_new (const char *path, const char *virname);
+
+/* Create the items of a batch of threats in a worker thread */
+/*
+  * The security snapshots and the system file checks are done in the worker, the threats are grouped by directory
+  * so each directory is opened once for its threats
+  * paths: the paths of the threats, referenced until the task is finished
+  * virnames: the signature names (NULL if unknown) in the same order, referenced until the task is finished
+  * source_object: the source object of the task, it's kept alive until `callback` is called
+*/
+void
+threat_item_new_batch_async (GPtrArray *paths, GPtrArray *virnames, GCancellable *cancellable,
+                             gpointer source_object, GAsyncReadyCallback callback, gpointer user_data);
+
+/* Finish creating the batch */
+/*
+  * @return
+  * the items in the order of the paths, the ones can't be prepared for deleting are skipped
+  * free it with `g_ptr_array_unref()`, NULL if failed or cancelled
+  * failed: the number of the skipped threats
+*/
+GPtrArray *
+threat_item_new_batch_finish (GAsyncResult *result, guint *failed, GError **error);
+
+const char *
+threat_item_get_path (ThreatItem *self);
+
+/* The signature name, NULL if unknown */
+const char *
+threat_item_get_virname (ThreatItem *self);
+
+/* Whether the file is under a system directory, it should be deleted with caution */
+gboolean
+threat_item_is_system_file (ThreatItem *self);
+
+/* The result of the last delete attempt, `FILE_SECURITY_OK` if not attempted */
+/*
+  * Changes are notified by "notify::status"
+*/
+FileSecurityStatus
+threat_item_get_status (ThreatItem *self);
+
+/* Delete the files of the items in a worker thread */
+/*
+  * The files need privileges are deleted together, so the user is only asked once
+  * items: the `ThreatItem`s to delete, they are referenced until the task is finished
+  * source_object: the source object of the task, it's kept alive until `callback` is called
+*/
+void
+threat_item_delete_async (GPtrArray *items, gpointer source_object, GAsyncReadyCallback callback, gpointer user_data);
+
+/* Finish deleting, the statuses of the failed items are updated and notified */
+/*
+  * @return
+  * the deleted items, free it with `g_ptr_array_unref()`
+*/
+GPtrArray *
+threat_item_delete_finish (GAsyncResult *result, GError **error);
+
+G_END_DECLS
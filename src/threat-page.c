@@ -20,67 +20,41 @@
 
 #include <glib/gi18n.h>
 
-#include "libs/delete-file.h"
-
 #include "wuming-window.h"
 #include "scanning-page.h"
+#include "threat-item.h"
 #include "threat-page.h"
 
-// Warning: this macro should be started and ended with a space, otherwise may cause comparison error
-#define SYSTEM_DIRECTORIES " /usr /lib /lib64 /etc /opt /var /sys /proc " // System directories that should be warned before deleting
-
 struct _ThreatPage {
     GtkWidget parent_instance;
 
     AdwToolbarView *toolbar_view;
     GtkButton *delete_all_button;
-    GtkListBox *threat_list;
+    GtkListView *threat_list;
 
     /* Private */
     AdwDialog *alert_dialog;
-    GHashTable *delete_file_table;
+    GListStore *threats; // The `ThreatItem`s, the rows are only created for the visible ones
+    gboolean is_deleting; // Whether a delete task is running
+
+    /* The threats waiting for their snapshots, they're taken by the next batch */
+    GPtrArray *pending_paths;
+    GPtrArray *pending_virnames; // Interned
+    gboolean is_snapshotting; // Whether a batch is running, only one at a time so the batches are listed in order
+    GCancellable *snapshot_cancellable; // Cancelled when the threats are cleared
+    ThreatPageAddedFunc added_func; // Told about every finished batch, NULL if unset
+    gpointer added_user_data;
 };
 
 G_DEFINE_FINAL_TYPE(ThreatPage, threat_page, GTK_TYPE_WIDGET)
 
-static void
-set_file_properties(GtkWidget *expander_row, const char *path)
-{
-    if (!path || !*path || path[0] != '/') // Check if the path is valid and is absolute
-    {
-        g_warning("Invalid absolute path: %s", path ? path : "(null)");
-        return;
-    }
-
-    /* Get the first directory name in the path */
-    // Because all the paths should be absolute, the first character should be a slash
-    char *second_slash = strchr(path + 1, '/');
-
-    if (second_slash) *second_slash = '\0'; // Cut the path to the first directory name temporarily
-
-    gchar *query = g_strdup_printf(" %s ", path); // Use for searching in the `SYSTEM_DIRECTORIES`
-    gboolean is_system_direcotry = (strstr(SYSTEM_DIRECTORIES, query) != NULL);
-
-    adw_preferences_row_set_title(
-        ADW_PREFERENCES_ROW(expander_row),
-        is_system_direcotry ?
-            gettext("Maybe a system file, delete it with caution!") :
-            gettext("Normal file")
-    );
-
-    g_free(query);
-
-    if (second_slash) *second_slash = '/'; // Restore the path
-}
-
 /* Create a new `AdwExpanderRow` for the threat list view */
+// The path and the virname are set when the row is bound to an item
 static GtkWidget *
-create_threat_expander_row (GtkWidget **delete_button, const char *path, const char *virname)
+create_threat_expander_row (GtkWidget **delete_button, GtkWidget **vir_row)
 {
     GtkWidget *expander_row = adw_expander_row_new (); // Create the action row for the list view
     gtk_widget_add_css_class (expander_row, "property"); // Add property syle class to the action row
-    set_file_properties(expander_row, path); // Set the file properties for the expander row
-    adw_expander_row_set_subtitle (ADW_EXPANDER_ROW (expander_row), path);
 
     /* Delete button for the action row */
     *delete_button = gtk_button_new ();
@@ -96,78 +70,74 @@ create_threat_expander_row (GtkWidget **delete_button, const char *path, const c
 
     adw_expander_row_add_suffix (ADW_EXPANDER_ROW (expander_row), *delete_button); // Add the delete button to the action row
 
-    GtkWidget *vir_row = adw_action_row_new (); // Create the virname row
-    gtk_widget_add_css_class (vir_row, "property"); // Add property style class to the virname row
+    *vir_row = adw_action_row_new (); // Create the virname row
+    gtk_widget_add_css_class (*vir_row, "property"); // Add property style class to the virname row
 
-    adw_preferences_row_set_title (ADW_PREFERENCES_ROW (vir_row), gettext ("Threat Identity"));
-    adw_action_row_set_subtitle (ADW_ACTION_ROW (vir_row), virname);
+    adw_preferences_row_set_title (ADW_PREFERENCES_ROW (*vir_row), gettext ("Threat Identity"));
 
-    adw_expander_row_add_row (ADW_EXPANDER_ROW (expander_row), vir_row); // Add the virname row to the expander row
+    adw_expander_row_add_row (ADW_EXPANDER_ROW (expander_row), *vir_row); // Add the virname row to the expander row
 
     return expander_row;
 }
 
-/* error operation */
-static void
-delete_error_operation(GtkWidget *expander_row, FileSecurityStatus status)
+/* Get the row title for the delete status */
+static const char *
+get_status_title (ThreatItem *item)
 {
-    g_return_if_fail(expander_row != NULL);
-
-    gtk_widget_set_sensitive(expander_row, FALSE);
-    switch (status)
+    switch (threat_item_get_status (item))
     {
         case FILE_SECURITY_OK:
         case FILE_SECURITY_OPERATION_SKIPPED:
-            break;
+            return threat_item_is_system_file (item) ?
+                        gettext("Maybe a system file, delete it with caution!") :
+                        gettext("Normal file");
         case FILE_SECURITY_DIR_MODIFIED:
-            adw_preferences_row_set_title(ADW_PREFERENCES_ROW(expander_row), gettext("Directory modified, try removing it manually!"));
-            break;
+            return gettext("Directory modified, try removing it manually!");
         case FILE_SECURITY_FILE_MODIFIED:
-            adw_preferences_row_set_title(ADW_PREFERENCES_ROW(expander_row), gettext("File may compromised, try removing it manually!"));
-            break;
+            return gettext("File may compromised, try removing it manually!");
         case FILE_SECURITY_DIR_NOT_FOUND:
-            adw_preferences_row_set_title(ADW_PREFERENCES_ROW(expander_row), gettext("Directory not found!"));
-            break;
+            return gettext("Directory not found!");
         case FILE_SECURITY_FILE_NOT_FOUND:
-            adw_preferences_row_set_title(ADW_PREFERENCES_ROW(expander_row), gettext("File not found!"));
-            break;
+            return gettext("File not found!");
         case FILE_SECURITY_INVALID_PATH:
-            adw_preferences_row_set_title(ADW_PREFERENCES_ROW(expander_row), gettext("Invalid path!"));
-            break;
+            return gettext("Invalid path!");
         case FILE_SECURITY_PERMISSION_DENIED:
-            adw_preferences_row_set_title(ADW_PREFERENCES_ROW(expander_row), gettext("Permission denied!"));
-            break;
+            return gettext("Permission denied!");
         case FILE_SECURITY_OPERATION_FAILED:
-            adw_preferences_row_set_title(ADW_PREFERENCES_ROW(expander_row), gettext("Operation failed!"));
-            break;
+            return gettext("Operation failed!");
+        case FILE_SECURITY_INVALID_CONTEXT:
         default:
-            adw_preferences_row_set_title(ADW_PREFERENCES_ROW(expander_row), gettext("Unknown error!"));
-            break;
+            return gettext("Unknown error!");
     }
 }
 
+/* Show the delete status of the item on the row */
 static void
-threat_page_remove_threat (ThreatPage *self, GtkWidget *row, FileSecurityStatus status)
+update_row_status (GtkWidget *expander_row, ThreatItem *item)
 {
-    g_return_if_fail (THREAT_IS_PAGE (self) && GTK_IS_WIDGET (row));
+    adw_preferences_row_set_title (ADW_PREFERENCES_ROW (expander_row), get_status_title (item));
 
-    switch (status)
-    {
-        case FILE_SECURITY_OK:
-            break;
-        case FILE_SECURITY_OPERATION_SKIPPED:
-            return; // Skip the delete operation, do nothing
-        default: // Delete failed, show the error message
-            delete_error_operation(row, status);
-            return;
-    }
+    /* A failed item can't be deleted again */
+    gtk_widget_set_sensitive (expander_row, threat_item_get_status (item) == FILE_SECURITY_OK);
+}
+
+static void
+on_threat_status_changed (ThreatItem *item, GParamSpec *pspec, GtkWidget *expander_row)
+{
+    update_row_status (expander_row, item);
+}
 
-    gtk_list_box_remove (self->threat_list, row);
+/* If has no more threats, pop the page and show the final result */
+static void
+threat_page_check_all_clear (ThreatPage *self)
+{
+    if (g_list_model_get_n_items (G_LIST_MODEL (self->threats)) > 0) return;
+    if (self->is_snapshotting || (self->pending_paths && self->pending_paths->len > 0)) return; // More threats are coming
 
-    if (gtk_list_box_get_row_at_index (self->threat_list, 0) != NULL) return;
+    GtkWidget *window_widget = gtk_widget_get_ancestor (GTK_WIDGET (self), WUMING_TYPE_WINDOW);
+    if (window_widget == NULL) return; // The window is closed while deleting
 
-    /* If has no more threats, pop the page and show the final result */
-    WumingWindow *window = WUMING_WINDOW (gtk_widget_get_ancestor (GTK_WIDGET (self), WUMING_TYPE_WINDOW));
+    WumingWindow *window = WUMING_WINDOW (window_widget);
     wuming_window_pop_page (window);
 
     ScanningPage *scanning_page = wuming_window_get_component (window, "scanning_page");
@@ -175,15 +145,189 @@ threat_page_remove_threat (ThreatPage *self, GtkWidget *row, FileSecurityStatus
     scanning_page_set_final_result (scanning_page, FALSE, gettext("All Clear"), gettext("All threats have been removed!"), "status-ok-symbolic");
 }
 
+/* Remove the deleted items from the list */
+static void
+threat_page_remove_threats (ThreatPage *self, GPtrArray *deleted)
+{
+    guint position = 0;
+
+    if (deleted->len == 1) // Usually deleted by the row button
+    {
+        if (g_list_store_find (self->threats, g_ptr_array_index (deleted, 0), &position))
+            g_list_store_remove (self->threats, position);
+        return;
+    }
+
+    GListModel *model = G_LIST_MODEL (self->threats);
+    const guint n_items = g_list_model_get_n_items (model);
+    g_autoptr (GHashTable) deleted_set = g_hash_table_new (NULL, NULL);
+    GPtrArray *remaining = g_ptr_array_new_with_free_func (g_object_unref);
+
+    for (guint i = 0; i < deleted->len; i++) g_hash_table_add (deleted_set, g_ptr_array_index (deleted, i));
+
+    for (guint i = 0; i < n_items; i++)
+    {
+        ThreatItem *item = g_list_model_get_item (model, i);
+
+        if (g_hash_table_contains (deleted_set, item)) g_object_unref (item);
+        else g_ptr_array_add (remaining, item); // Keep the failed or skipped ones
+    }
+
+    /* Replace all the items at once, so the list view is only updated once */
+    g_list_store_splice (self->threats, 0, n_items, remaining->pdata, remaining->len);
+    g_ptr_array_unref (remaining);
+}
+
+/* The list can't be changed by the user while deleting */
+static void
+threat_page_set_busy (ThreatPage *self, gboolean is_busy)
+{
+    self->is_deleting = is_busy;
+    gtk_widget_set_sensitive (GTK_WIDGET (self->threat_list), !is_busy);
+    gtk_widget_set_sensitive (GTK_WIDGET (self->delete_all_button), !is_busy);
+}
+
+static void
+on_threats_deleted (GObject *source_object, GAsyncResult *result, gpointer user_data)
+{
+    ThreatPage *self = THREAT_PAGE (source_object);
+
+    g_autoptr (GError) error = NULL;
+    g_autoptr (GPtrArray) deleted = threat_item_delete_finish (result, &error);
+
+    threat_page_set_busy (self, FALSE);
+
+    if (deleted == NULL)
+    {
+        g_critical ("[ERROR] Failed to delete the threats: %s", error ? error->message : "unknown error");
+        return;
+    }
+
+    if (deleted->len == 0) return; // Failed or skipped, the rows show the errors
+
+    threat_page_remove_threats (self, deleted);
+    threat_page_check_all_clear (self);
+}
+
+/* Delete the threats in a worker thread, the user is asked at most once for all the files need privileges */
+static void
+threat_page_delete_threats (ThreatPage *self, GPtrArray *items)
+{
+    g_return_if_fail (THREAT_IS_PAGE (self));
+
+    if (self->is_deleting || items->len == 0) return;
+
+    threat_page_set_busy (self, TRUE);
+    threat_item_delete_async (items, self, on_threats_deleted, NULL);
+}
+
 static void
-on_delete_button_clicked (DeleteFileData *data)
+on_delete_button_clicked (GtkListItem *list_item)
 {
-    g_return_if_fail (data != NULL);
-    GtkWidget *expander_row = delete_file_data_get_expander_row (data);
+    g_return_if_fail (GTK_IS_LIST_ITEM (list_item));
+
+    ThreatItem *item = gtk_list_item_get_item (list_item);
+    g_return_if_fail (item != NULL);
+
+    GtkWidget *expander_row = gtk_list_item_get_child (list_item);
     ThreatPage *page = THREAT_PAGE (gtk_widget_get_ancestor (expander_row, THREAT_TYPE_PAGE));
 
-    FileSecurityStatus status = delete_threat_file (page->delete_file_table, data);
-    threat_page_remove_threat (page, expander_row, status);
+    g_autoptr (GPtrArray) items = g_ptr_array_new ();
+    g_ptr_array_add (items, item);
+
+    threat_page_delete_threats (page, items);
+}
+
+/* List item factory */
+
+static void
+setup_threat_row (GtkSignalListItemFactory *factory, GtkListItem *list_item, gpointer user_data)
+{
+    GtkWidget *delete_button = NULL;
+    GtkWidget *vir_row = NULL;
+    GtkWidget *expander_row = create_threat_expander_row (&delete_button, &vir_row);
+
+    g_object_set_data (G_OBJECT (expander_row), "vir-row", vir_row);
+    g_signal_connect_swapped (delete_button, "clicked", G_CALLBACK (on_delete_button_clicked), list_item); // The button follows whatever item the row is bound to
+
+    gtk_list_item_set_activatable (list_item, FALSE);
+    gtk_list_item_set_child (list_item, expander_row);
+}
+
+static void
+bind_threat_row (GtkSignalListItemFactory *factory, GtkListItem *list_item, gpointer user_data)
+{
+    ThreatItem *item = gtk_list_item_get_item (list_item);
+    GtkWidget *expander_row = gtk_list_item_get_child (list_item);
+    GtkWidget *vir_row = g_object_get_data (G_OBJECT (expander_row), "vir-row");
+
+    adw_expander_row_set_subtitle (ADW_EXPANDER_ROW (expander_row), threat_item_get_path (item));
+    adw_expander_row_set_expanded (ADW_EXPANDER_ROW (expander_row), FALSE); // The row may be recycled from an expanded one
+    adw_action_row_set_subtitle (ADW_ACTION_ROW (vir_row), threat_item_get_virname (item));
+    update_row_status (expander_row, item);
+
+    g_signal_connect (item, "notify::status", G_CALLBACK (on_threat_status_changed), expander_row);
+}
+
+static void
+unbind_threat_row (GtkSignalListItemFactory *factory, GtkListItem *list_item, gpointer user_data)
+{
+    ThreatItem *item = gtk_list_item_get_item (list_item);
+    GtkWidget *expander_row = gtk_list_item_get_child (list_item);
+
+    g_signal_handlers_disconnect_by_func (item, on_threat_status_changed, expander_row);
+}
+
+static void threat_page_start_snapshot (ThreatPage *self);
+
+static void
+on_threats_snapshotted (GObject *source_object, GAsyncResult *result, gpointer user_data)
+{
+    ThreatPage *self = THREAT_PAGE (source_object);
+
+    guint failed = 0;
+    g_autoptr (GError) error = NULL;
+    g_autoptr (GPtrArray) items = threat_item_new_batch_finish (result, &failed, &error);
+
+    self->is_snapshotting = FALSE;
+    if (self->threats == NULL) return; // Disposed
+
+    guint num_added = 0;
+    if (items == NULL)
+    {
+        if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+            g_critical ("[ERROR] Failed to prepare the threats: %s", error ? error->message : "unknown error");
+    }
+    else
+    {
+        if (failed > 0) g_critical ("[ERROR] Failed to add %u threats to the list", failed);
+
+        /* The latest threat is shown first, the whole batch is inserted at once so the list view is only updated once */
+        g_autofree gpointer *latest_first = g_new (gpointer, MAX (items->len, 1));
+        for (guint i = 0; i < items->len; i++) latest_first[i] = g_ptr_array_index (items, items->len - 1 - i);
+
+        g_list_store_splice (self->threats, 0, 0, latest_first, items->len);
+        num_added = items->len;
+    }
+
+    threat_page_start_snapshot (self); // The threats found meanwhile
+
+    if (self->added_func) self->added_func (self->added_user_data, num_added); // After the next batch is started, so it sees whether more threats are coming
+}
+
+/* Hand the pending threats to a worker, unless a batch is running */
+static void
+threat_page_start_snapshot (ThreatPage *self)
+{
+    if (self->is_snapshotting || self->pending_paths->len == 0) return;
+
+    g_autoptr (GPtrArray) paths = g_steal_pointer (&self->pending_paths);
+    g_autoptr (GPtrArray) virnames = g_steal_pointer (&self->pending_virnames);
+    self->pending_paths = g_ptr_array_new_with_free_func (g_free);
+    self->pending_virnames = g_ptr_array_new ();
+
+    self->is_snapshotting = TRUE;
+    threat_item_new_batch_async (paths, virnames, self->snapshot_cancellable, self, on_threats_snapshotted, NULL);
 }
 
 gboolean
@@ -192,18 +336,11 @@ threat_page_add_threat (ThreatPage *self, const char *threat_path, const char *t
     g_return_val_if_fail (THREAT_IS_PAGE (self), FALSE);
     g_return_val_if_fail (threat_path != NULL, FALSE);
 
-    GtkWidget *delete_button = NULL;
-    GtkWidget *expander_row = create_threat_expander_row (&delete_button, threat_path, threat_name);
-    gtk_list_box_prepend (self->threat_list, expander_row); // Add the expander row to the list
-
-    DeleteFileData *delete_data = delete_file_data_table_insert (self->delete_file_table, threat_path, expander_row); // Add the delete data to the list
-    if (delete_data == NULL)
-    {
-        g_critical ("Failed to add delete data to the table");
-        return FALSE;
-    }
+    /* The snapshot opens and stats the file, keep it off the main loop */
+    g_ptr_array_add (self->pending_paths, g_strdup (threat_path));
+    g_ptr_array_add (self->pending_virnames, (gpointer) (threat_name ? g_intern_string (threat_name) : NULL));
 
-    g_signal_connect_swapped (delete_button, "clicked", G_CALLBACK(on_delete_button_clicked), delete_data); // Connect the delete button signal to the `delete_threat_file` function
+    threat_page_start_snapshot (self); // Otherwise taken when the running batch is finished
 
     return TRUE;
 }
@@ -213,8 +350,31 @@ threat_page_clear_threats (ThreatPage *self)
 {
     g_return_if_fail (THREAT_IS_PAGE (self));
 
-    gtk_list_box_remove_all (self->threat_list); // Remove all items from the list
-    g_hash_table_remove_all (self->delete_file_table); // Remove all delete data from the table
+    /* Drop the threats still waiting for their snapshots, the running batch isn't listed */
+    g_ptr_array_set_size (self->pending_paths, 0);
+    g_ptr_array_set_size (self->pending_virnames, 0);
+    g_cancellable_cancel (self->snapshot_cancellable);
+    g_object_unref (self->snapshot_cancellable);
+    self->snapshot_cancellable = g_cancellable_new ();
+
+    g_list_store_remove_all (self->threats); // Remove all items from the list
+}
+
+void
+threat_page_set_added_func (ThreatPage *self, ThreatPageAddedFunc added_func, gpointer user_data)
+{
+    g_return_if_fail (THREAT_IS_PAGE (self));
+
+    self->added_func = added_func;
+    self->added_user_data = user_data;
+}
+
+gboolean
+threat_page_is_snapshotting (ThreatPage *self)
+{
+    g_return_val_if_fail (THREAT_IS_PAGE (self), FALSE);
+
+    return self->is_snapshotting || self->pending_paths->len > 0;
 }
 
 static void
@@ -222,25 +382,19 @@ delete_all_threat_files(ThreatPage *self)
 {
     g_return_if_fail(THREAT_IS_PAGE(self));
 
-    GList *keys = NULL;
-    GHashTableIter iter;
-    gpointer key;
-    g_hash_table_iter_init(&iter, self->delete_file_table);
+    GListModel *model = G_LIST_MODEL (self->threats);
+    const guint n_items = g_list_model_get_n_items (model);
+    g_autoptr (GPtrArray) items = g_ptr_array_new_with_free_func (g_object_unref);
 
-    while (g_hash_table_iter_next(&iter, &key, NULL))
+    for (guint i = 0; i < n_items; i++)
     {
-        keys = g_list_prepend(keys, key);
-    }
+        ThreatItem *item = g_list_model_get_item (model, i);
 
-    for (GList *elements = keys; elements != NULL; elements = elements->next)
-    {
-        DeleteFileData *data = (DeleteFileData *)elements->data;
-        GtkWidget *expander_row = delete_file_data_get_expander_row(data);
-        FileSecurityStatus status = delete_threat_file(self->delete_file_table, data);
-        threat_page_remove_threat(self, expander_row, status);
+        if (threat_item_get_status (item) == FILE_SECURITY_OK) g_ptr_array_add (items, item);
+        else g_object_unref (item); // Failed before, same as the insensitive rows
     }
 
-    g_list_free(keys);
+    threat_page_delete_threats (self, items);
 }
 
 static void
@@ -270,8 +424,11 @@ threat_page_dispose (GObject *object)
 
     GtkWidget *toolbar_view = GTK_WIDGET (self->toolbar_view);
 
-    threat_page_clear_threats (self);
-    g_hash_table_unref (self->delete_file_table); // Unref the delete data table
+    if (self->threats) threat_page_clear_threats (self);
+    g_clear_object (&self->threats);
+    g_clear_object (&self->snapshot_cancellable);
+    g_clear_pointer (&self->pending_paths, g_ptr_array_unref);
+    g_clear_pointer (&self->pending_virnames, g_ptr_array_unref);
     g_clear_object (&self->alert_dialog);
     g_clear_pointer (&toolbar_view, gtk_widget_unparent);
 
@@ -338,7 +495,23 @@ threat_page_init (ThreatPage *self)
     self->alert_dialog = build_alert_dialog ();
     g_object_ref_sink (self->alert_dialog);
 
-    self->delete_file_table = delete_file_data_table_new();
+    /* Only the visible rows are created and they are recycled while scrolling */
+    self->threats = g_list_store_new (THREAT_TYPE_ITEM);
+    self->pending_paths = g_ptr_array_new_with_free_func (g_free);
+    self->pending_virnames = g_ptr_array_new ();
+    self->snapshot_cancellable = g_cancellable_new ();
+
+    GtkListItemFactory *factory = gtk_signal_list_item_factory_new ();
+    g_signal_connect (factory, "setup", G_CALLBACK (setup_threat_row), NULL);
+    g_signal_connect (factory, "bind", G_CALLBACK (bind_threat_row), NULL);
+    g_signal_connect (factory, "unbind", G_CALLBACK (unbind_threat_row), NULL);
+
+    GtkNoSelection *selection = gtk_no_selection_new (G_LIST_MODEL (g_object_ref (self->threats)));
+    gtk_list_view_set_model (self->threat_list, GTK_SELECTION_MODEL (selection));
+    gtk_list_view_set_factory (self->threat_list, factory);
+
+    g_object_unref (selection);
+    g_object_unref (factory);
 
     g_signal_connect_swapped (self->delete_all_button, "clicked", G_CALLBACK (show_alert_dialog), self);
 }
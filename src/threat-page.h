@@ -28,12 +28,32 @@ G_BEGIN_DECLS
 
 G_DECLARE_FINAL_TYPE (ThreatPage, threat_page, THREAT, PAGE, GtkWidget)
 
+/* Called on the main loop when a batch of threats is listed */
+/*
+  * num_added: the number of the threats listed by the batch, 0 if it failed or was cancelled
+*/
+typedef void (*ThreatPageAddedFunc) (gpointer user_data, guint num_added);
+
+/* Add a threat to the list */
+/*
+  * The threat is snapshotted in a worker thread and listed with the other threats of its batch
+  * @return
+  * FALSE if the path is invalid
+*/
 gboolean
 threat_page_add_threat (ThreatPage *self, const char *threat_path, const char *threat_name);
 
 void
 threat_page_clear_threats (ThreatPage *self);
 
+/* Set the function told about the listed threats, a threat only counts once its snapshot is taken */
+void
+threat_page_set_added_func (ThreatPage *self, ThreatPageAddedFunc added_func, gpointer user_data);
+
+/* Whether some threats are still waiting for their snapshots */
+gboolean
+threat_page_is_snapshotting (ThreatPage *self);
+
 GtkWidget *
 threat_page_new (void);
 
@@ -23,6 +23,9 @@
 
 #include "wuming-application.h"
 #include "wuming-window.h"
+#include "libs/delete-file.h"
+#include "libs/systemd-control.h"
+#include "libs/startup-state.h"
 
 struct _WumingApplication
 {
@@ -59,6 +62,16 @@ wuming_application_activate (GApplication *app)
 		                       NULL);
 
 	gtk_window_present (window);
+	startup_log_stage ("window presented");
+}
+
+static void
+wuming_application_shutdown (GApplication *app)
+{
+	delete_file_release_resources ();
+	service_monitor_shutdown ();
+
+	G_APPLICATION_CLASS (wuming_application_parent_class)->shutdown (app);
 }
 
 static void
@@ -67,6 +80,7 @@ wuming_application_class_init (WumingApplicationClass *klass)
 	GApplicationClass *app_class = G_APPLICATION_CLASS (klass);
 
 	app_class->activate = wuming_application_activate;
+	app_class->shutdown = wuming_application_shutdown;
 }
 
 static void
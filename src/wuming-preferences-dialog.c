@@ -26,12 +26,23 @@
 struct _WumingPreferencesDialog {
     GtkWidget parent_instance;
 
+    AdwComboRow *scan_profile;
     AdwSwitchRow *enable_large_file;
     AdwSwitchRow *enable_pua;
     AdwSwitchRow *scan_archives;
     AdwSwitchRow *scan_mail;
     AdwSwitchRow *alert_exceeds_max;
     AdwSwitchRow *alert_encrypted;
+    GtkAdjustment *scan_workers;
+    AdwSwitchRow *priority_scan;
+
+    AdwEntryRow *scan_exclusions;
+    GtkAdjustment *scan_max_file_size;
+
+    AdwSwitchRow *background_scan;
+    GtkAdjustment *background_cpu_quota;
+    GtkAdjustment *scan_max_rate;
+    GtkAdjustment *scan_max_files_rate;
 
     GtkAdjustment *signature_expiry_days;
 
@@ -99,6 +110,37 @@ on_scan_options_changed (AdwSwitchRow *row, GParamSpec *pspec, WumingPreferences
     g_settings_set_int (self->settings, "scan-options-bitmask", bitmask);
 }
 
+/* The exclusion rules are edited as one comma separated line */
+static void
+on_scan_exclusions_applied (AdwEntryRow *row, WumingPreferencesDialog *self)
+{
+    g_return_if_fail (self->settings != NULL);
+
+    g_auto(GStrv) items = g_strsplit (gtk_editable_get_text (GTK_EDITABLE (row)), ",", -1);
+    g_autoptr(GStrvBuilder) builder = g_strv_builder_new ();
+
+    for (int i = 0; items[i] != NULL; i++)
+    {
+        g_strstrip (items[i]);
+        if (items[i][0] != '\0') g_strv_builder_add (builder, items[i]);
+    }
+
+    g_auto(GStrv) rules = g_strv_builder_end (builder);
+    g_settings_set_strv (self->settings, "scan-exclusions", (const char * const *) rules);
+}
+
+static void
+wuming_preferences_dialog_init_exclusions (WumingPreferencesDialog *self)
+{
+    g_return_if_fail (self->settings != NULL);
+
+    g_auto(GStrv) rules = g_settings_get_strv (self->settings, "scan-exclusions");
+    g_autofree char *text = g_strjoinv (", ", rules);
+    gtk_editable_set_text (GTK_EDITABLE (self->scan_exclusions), text);
+
+    g_signal_connect (self->scan_exclusions, "apply", G_CALLBACK (on_scan_exclusions_applied), self);
+}
+
 GSettings *
 wuming_preferences_dialog_get_settings (WumingPreferencesDialog *self)
 {
@@ -180,12 +222,21 @@ wuming_preferences_dialog_class_init (WumingPreferencesDialogClass *klass)
 
     gtk_widget_class_set_template_from_resource (widget_class, "/com/ericlin/wuming/wuming-preferences-dialog.ui");
 
+    gtk_widget_class_bind_template_child (widget_class, WumingPreferencesDialog, scan_profile);
     gtk_widget_class_bind_template_child (widget_class, WumingPreferencesDialog, enable_large_file);
     gtk_widget_class_bind_template_child (widget_class, WumingPreferencesDialog, enable_pua);
     gtk_widget_class_bind_template_child (widget_class, WumingPreferencesDialog, scan_archives);
     gtk_widget_class_bind_template_child (widget_class, WumingPreferencesDialog, scan_mail);
     gtk_widget_class_bind_template_child (widget_class, WumingPreferencesDialog, alert_exceeds_max);
     gtk_widget_class_bind_template_child (widget_class, WumingPreferencesDialog, alert_encrypted);
+    gtk_widget_class_bind_template_child (widget_class, WumingPreferencesDialog, scan_workers);
+    gtk_widget_class_bind_template_child (widget_class, WumingPreferencesDialog, priority_scan);
+    gtk_widget_class_bind_template_child (widget_class, WumingPreferencesDialog, scan_exclusions);
+    gtk_widget_class_bind_template_child (widget_class, WumingPreferencesDialog, scan_max_file_size);
+    gtk_widget_class_bind_template_child (widget_class, WumingPreferencesDialog, background_scan);
+    gtk_widget_class_bind_template_child (widget_class, WumingPreferencesDialog, background_cpu_quota);
+    gtk_widget_class_bind_template_child (widget_class, WumingPreferencesDialog, scan_max_rate);
+    gtk_widget_class_bind_template_child (widget_class, WumingPreferencesDialog, scan_max_files_rate);
 
     gtk_widget_class_bind_template_child (widget_class, WumingPreferencesDialog, signature_expiry_days);
 }
@@ -200,6 +251,35 @@ wuming_preferences_dialog_new (WumingWindow *window)
     return self;
 }
 
+/* In the order of the items of `scan_profile` */
+static const char *const scan_profiles[] = { SCAN_PROFILE_QUICK, SCAN_PROFILE_FULL, SCAN_PROFILE_ARCHIVE_DEEP, SCAN_PROFILE_PUA };
+
+static gboolean
+scan_profile_get_mapping (GValue *value, GVariant *variant, gpointer user_data)
+{
+    const gchar *profile = g_variant_get_string (variant, NULL);
+
+    for (guint i = 0; i < G_N_ELEMENTS (scan_profiles); i++)
+    {
+        if (g_strcmp0 (scan_profiles[i], profile) != 0) continue;
+
+        g_value_set_uint (value, i);
+        return TRUE;
+    }
+
+    return FALSE;
+}
+
+static GVariant *
+scan_profile_set_mapping (const GValue *value, const GVariantType *expected_type, gpointer user_data)
+{
+    guint index = g_value_get_uint (value);
+
+    if (index >= G_N_ELEMENTS (scan_profiles)) return NULL;
+
+    return g_variant_new_string (scan_profiles[index]);
+}
+
 static void
 wuming_preferences_dialog_init_scan_options (WumingPreferencesDialog *self)
 {
@@ -233,8 +313,24 @@ wuming_preferences_dialog_init (WumingPreferencesDialog *self)
 
     self->settings = g_settings_new ("com.ericlin.wuming");
 
+    g_settings_bind_with_mapping (self->settings, "scan-profile",
+                                  self->scan_profile, "selected",
+                                  G_SETTINGS_BIND_DEFAULT,
+                                  scan_profile_get_mapping, scan_profile_set_mapping,
+                                  NULL, NULL);
     wuming_preferences_dialog_init_scan_options (self);
 
+    g_settings_bind (self->settings, "scan-workers", self->scan_workers, "value", G_SETTINGS_BIND_DEFAULT);
+    g_settings_bind (self->settings, "priority-scan", self->priority_scan, "active", G_SETTINGS_BIND_DEFAULT);
+
+    wuming_preferences_dialog_init_exclusions (self);
+    g_settings_bind (self->settings, "scan-max-file-size", self->scan_max_file_size, "value", G_SETTINGS_BIND_DEFAULT);
+
+    g_settings_bind (self->settings, "background-scan", self->background_scan, "active", G_SETTINGS_BIND_DEFAULT);
+    g_settings_bind (self->settings, "background-cpu-quota", self->background_cpu_quota, "value", G_SETTINGS_BIND_DEFAULT);
+    g_settings_bind (self->settings, "scan-max-rate", self->scan_max_rate, "value", G_SETTINGS_BIND_DEFAULT);
+    g_settings_bind (self->settings, "scan-max-files-rate", self->scan_max_files_rate, "value", G_SETTINGS_BIND_DEFAULT);
+
     g_settings_bind (self->settings, "signature-expiration-time", self->signature_expiry_days, "value", G_SETTINGS_BIND_DEFAULT);
 
     g_signal_connect (self->signature_expiry_days, "value-changed", G_CALLBACK (on_signature_expiration_changed), self);
@@ -25,8 +25,8 @@
 
 #include "libs/systemd-control.h"
 #include "libs/update-signature.h"
-#include "libs/check-scan-time.h"
 #include "libs/scan.h"
+#include "libs/startup-state.h"
 
 #include "wuming-window.h"
 #include "wuming-preferences-dialog.h"
@@ -87,7 +87,9 @@ struct _WumingWindow
     gboolean            is_hidden;
     gulong              close_request_signal_id;
     gulong              show_signal_id;
-    signature_status      *status;
+    signature_status      *status; // NULL until the startup state is loaded
+    GCancellable        *startup_cancellable;
+    gboolean            has_service_state; // Whether the state of freshclam has been replied
     UpdateContext       *update_context;
     ScanContext         *scan_context;
 };
@@ -289,6 +291,8 @@ wuming_window_update_signature_status (WumingWindow *self, gboolean need_rescan_
 {
     g_return_if_fail (self != NULL); // Check if the object is valid
 
+    if (self->status == NULL) return; // Still loading, the current settings are applied when it's loaded
+
     signature_status_update (self->status, need_rescan_signature, signature_expiration_time);
 
     update_signature_page_show_isuptodate (self->update_signature_page, self->status);
@@ -296,8 +300,48 @@ wuming_window_update_signature_status (WumingWindow *self, gboolean need_rescan_
     security_overview_page_show_health_level (self->security_overview_page);
 }
 
+/* Show the state of freshclam */
+static void
+on_freshclam_state_changed (const char *service_name, int unit_file_state, int active_state, gpointer user_data)
+{
+    WumingWindow *self = WUMING_WINDOW (user_data);
+
+    if (!self->has_service_state) startup_log_stage ("freshclam state");
+    self->has_service_state = TRUE;
+
+    security_overview_page_show_servicestat (self->security_overview_page, unit_file_state);
+    update_signature_page_show_servicestat (self->update_signature_page, unit_file_state);
+}
+
+/* Refresh the signature status when the database is updated (e.g. by freshclam) */
+static void
+on_signature_database_changed (signature_status *status, gpointer user_data)
+{
+    WumingWindow *self = WUMING_WINDOW (user_data);
+
+    wuming_window_update_signature_status (self, TRUE, -1);
+}
+
 /* GObject essential functions */
 
+/* Scan the local ones of the files in one session */
+static void
+start_scan_files (ScanContext *context, GSList *files)
+{
+    g_autoptr (GPtrArray) paths = g_ptr_array_new_with_free_func (g_free);
+
+    for (GSList *node = files; node != NULL; node = node->next)
+    {
+        char *path = g_file_get_path (G_FILE (node->data));
+        if (path != NULL) g_ptr_array_add (paths, path); // Skip the files without a local path
+    }
+
+    if (paths->len == 0) return;
+
+    g_ptr_array_add (paths, NULL);
+    start_scan_paths (context, (const char *const *) paths->pdata);
+}
+
 static void
 wuming_window_on_drag_drop (GtkDropTarget* self, const GValue* value, gdouble x, gdouble y, gpointer user_data)
 {
@@ -305,15 +349,29 @@ wuming_window_on_drag_drop (GtkDropTarget* self, const GValue* value, gdouble x,
 
     if (!wuming_window_is_in_main_page(window)) return; // Prevent multiple tasks running at the same time
 
-    GFile *file = g_value_get_object (value);
+    GdkFileList *file_list = g_value_get_boxed (value);
 
-    if (file == NULL) return;
+    if (file_list == NULL) return;
 
-    g_autofree char *path = g_file_get_path (file);
+    GSList *files = gdk_file_list_get_files (file_list); // The files are owned by the list
 
-    if (path == NULL) return;
+    start_scan_files (window->scan_context, files);
 
-    start_scan (window->scan_context, path);
+    g_slist_free (files);
+}
+
+/* Scan the selected files or folders */
+static void
+start_scan_selection (ScanContext *context, GListModel *selection)
+{
+    GSList *files = NULL;
+    guint num_files = g_list_model_get_n_items (selection);
+
+    for (guint i = num_files; i > 0; i--) files = g_slist_prepend (files, g_list_model_get_item (selection, i - 1));
+
+    start_scan_files (context, files);
+
+    g_slist_free_full (files, g_object_unref);
 }
 
 static void
@@ -321,12 +379,12 @@ start_scan_file (GObject *source_object, GAsyncResult *res, gpointer data)
 {
     GtkFileDialog *file_dialog = GTK_FILE_DIALOG (source_object);
     ScanContext *context = data;
-    GFile *file = NULL;
+    GListModel *files = NULL;
     GError *error = NULL;
 
-    file = gtk_file_dialog_open_finish (file_dialog, res, &error);
+    files = gtk_file_dialog_open_multiple_finish (file_dialog, res, &error);
 
-    if (file == NULL)
+    if (files == NULL)
     {
         if (error->code == GTK_DIALOG_ERROR_DISMISSED)
             g_warning ("[INFO] User canceled the file selection!");
@@ -337,12 +395,10 @@ start_scan_file (GObject *source_object, GAsyncResult *res, gpointer data)
         return;
     }
 
-    g_autofree char *filepath = g_file_get_path (file);
-
-    start_scan (context, filepath);
+    start_scan_selection (context, files);
 
     g_clear_error (&error);
-    g_object_unref (file); // Only unref the file if it is successfully opened
+    g_object_unref (files); // Only unref the files if they are successfully opened
 }
 
 static void
@@ -350,12 +406,12 @@ start_scan_folder (GObject *source_object, GAsyncResult *res, gpointer data)
 {
     GtkFileDialog *file_dialog = GTK_FILE_DIALOG (source_object);
     ScanContext *context = data;
-    GFile *file = NULL;
+    GListModel *folders = NULL;
     GError *error = NULL;
 
-    file = gtk_file_dialog_select_folder_finish (file_dialog, res, &error);
+    folders = gtk_file_dialog_select_multiple_folders_finish (file_dialog, res, &error);
 
-    if (file == NULL)
+    if (folders == NULL)
     {
         if (error->code == GTK_DIALOG_ERROR_DISMISSED)
             g_warning ("[INFO] User canceled the folder selection!");
@@ -366,12 +422,10 @@ start_scan_folder (GObject *source_object, GAsyncResult *res, gpointer data)
         return;
     }
 
-    g_autofree char *folderpath = g_file_get_path (file);
-
-    start_scan (context, folderpath);
+    start_scan_selection (context, folders);
 
     g_clear_error (&error);
-    g_object_unref (file); // Only unref the file if it is successfully opened
+    g_object_unref (folders); // Only unref the folders if they are successfully opened
 }
 
 static void
@@ -385,7 +439,7 @@ scan_file_action (GSimpleAction *action,
 
   g_print("[INFO] Choose a file\n");
 
-  gtk_file_dialog_open (window->file_dialog, GTK_WINDOW (window), NULL, start_scan_file, window->scan_context); // Select a file
+  gtk_file_dialog_open_multiple (window->file_dialog, GTK_WINDOW (window), NULL, start_scan_file, window->scan_context); // Select the files
 }
 
 static void
@@ -399,7 +453,33 @@ scan_folder_action (GSimpleAction *action,
 
   g_print("[INFO] Choose a folder\n");
 
-  gtk_file_dialog_select_folder (window->file_dialog, GTK_WINDOW (window), NULL, start_scan_folder, window->scan_context); // Select a folder
+  gtk_file_dialog_select_multiple_folders (window->file_dialog, GTK_WINDOW (window), NULL, start_scan_folder, window->scan_context); // Select the folders
+}
+
+static void
+resume_scan_action (GSimpleAction *action,
+                                GVariant      *parameter,
+                                gpointer       user_data)
+{
+  WumingWindow *window = user_data;
+
+  if (!wuming_window_is_in_main_page(window)) return; // Prevent multiple tasks running at the same time
+
+  g_print("[INFO] Resume the last scan\n");
+
+  resume_scan (window->scan_context);
+}
+
+static void
+open_last_report_action (GSimpleAction *action,
+                                GVariant      *parameter,
+                                gpointer       user_data)
+{
+  WumingWindow *window = user_data;
+
+  if (!wuming_window_is_in_main_page (window)) return; // The threat page may belong to a running scan
+
+  open_last_scan_report (window->scan_context);
 }
 
 static void
@@ -432,6 +512,8 @@ static const GActionEntry window_actions[] = {
   { .name = "goto-scan-page", .activate = goto_scan_page_action },
   { .name = "scan-file", .activate = scan_file_action },
   { .name = "scan-folder", .activate = scan_folder_action },
+  { .name = "resume-scan", .activate = resume_scan_action },
+  { .name = "open-last-report", .activate = open_last_report_action },
   { .name = "update", .activate = update_signature_action }
 };
 
@@ -444,7 +526,14 @@ wuming_window_dispose (GObject *object)
 	                                 window_actions,
 	                                 G_N_ELEMENTS (window_actions));
 
-    signature_status_clear (&self->status);
+    if (self->startup_cancellable != NULL)
+    {
+        g_cancellable_cancel (self->startup_cancellable); // The state is freed by the task
+        g_clear_object (&self->startup_cancellable);
+    }
+
+    service_monitor_remove_callbacks (self);
+    if (self->status != NULL) signature_status_clear (&self->status);
     update_context_clear (&self->update_context);
     scan_context_clear (&self->scan_context);
 
@@ -536,6 +625,46 @@ wuming_window_class_init (WumingWindowClass *klass)
     g_type_ensure (UPDATING_TYPE_PAGE);
 }
 
+/* Show the state read by the startup task */
+static void
+on_startup_state_loaded (GObject *source_object, GAsyncResult *result, gpointer user_data)
+{
+    g_autoptr (GError) error = NULL;
+
+    StartupState *state = startup_state_load_finish (result, &error);
+    if (state == NULL) return; // Only fails when the window is disposed
+
+    WumingWindow *self = WUMING_WINDOW (user_data);
+    g_clear_object (&self->startup_cancellable);
+
+    GSettings *settings = wuming_preferences_dialog_get_settings (self->prefrences_dialog);
+
+    /* Show last scan time, unless a scan has finished while loading and shown its own */
+    g_autofree gchar *last_scan_time = g_settings_get_string (settings, "last-scan-time");
+    if (g_strcmp0 (last_scan_time, state->last_scan_time) == 0)
+    {
+        security_overview_page_show_last_scan_time_status (self->security_overview_page, state->is_scan_expired);
+        scan_page_show_last_scan_time_status (self->scan_page, state->last_scan_time, state->is_scan_expired);
+    }
+
+    /* The expiration time may be changed while loading */
+    self->status = g_steal_pointer (&state->status);
+    signature_status_update (self->status, FALSE, g_settings_get_int (settings, "signature-expiration-time"));
+    signature_status_set_changed_callback (self->status, on_signature_database_changed, self);
+
+    /* Show the signature status */
+    security_overview_page_show_signature_status (self->security_overview_page, self->status);
+    update_signature_page_show_isuptodate (self->update_signature_page, self->status);
+
+    scan_context_set_history (self->scan_context, g_steal_pointer (&state->history), &state->trend);
+
+    /* Update the `SecurityOverviewPage` */
+    security_overview_page_show_health_level (self->security_overview_page);
+
+    startup_state_free (state);
+    startup_log_stage ("startup state shown");
+}
+
 static void
 wuming_window_init_settings (WumingWindow *self, GSettings *settings)
 {
@@ -556,32 +685,20 @@ wuming_window_init_settings (WumingWindow *self, GSettings *settings)
                      self, "fullscreened",
                      G_SETTINGS_BIND_DEFAULT);
 
-    /* Check last scan time */
-    g_autofree gchar *last_scan_time = g_settings_get_string (settings, "last-scan-time");
-    gboolean is_expired = is_scan_time_expired(last_scan_time);
+    scan_page_bind_resumable_scan (self->scan_page, settings);
 
-    /* Show last scan time */
-    security_overview_page_show_last_scan_time_status (self->security_overview_page, is_expired);
-    scan_page_show_last_scan_time_status (self->scan_page, last_scan_time, is_expired);
+    /* Watch systemd services, the state is shown when it's replied */
+    service_monitor_watch ("clamav-freshclam.service", on_freshclam_state_changed, self);
+    service_monitor_watch ("clamav-daemon.service", NULL, NULL); // Used for choosing the scan backend
 
+    /* Read the signature, the last scan time and the history in a worker, the window is shown first */
+    g_autofree gchar *last_scan_time = g_settings_get_string (settings, "last-scan-time");
     gint signature_expiration_time = g_settings_get_int (settings, "signature-expiration-time");
 
-    /* Scan the Database */
-    self->status = signature_status_new (signature_expiration_time);
-
-    /* Show the signature status */
-    security_overview_page_show_signature_status (self->security_overview_page, self->status);
-    update_signature_page_show_isuptodate (self->update_signature_page, self->status);
-
-    /* Check systemd service status */
-    int service_status = is_service_enabled ("clamav-freshclam.service");
-
-    /* Show systemd service status */
-    security_overview_page_show_servicestat (self->security_overview_page, service_status);
-    update_signature_page_show_servicestat (self->update_signature_page, service_status);
+    security_overview_page_show_checking (self->security_overview_page);
 
-    /* Update the `SecurityOverviewPage` */
-    security_overview_page_show_health_level (self->security_overview_page);
+    self->startup_cancellable = g_cancellable_new ();
+    startup_state_load_async (last_scan_time, signature_expiration_time, self->startup_cancellable, on_startup_state_loaded, self);
 }
 
 static void
@@ -606,7 +723,7 @@ wuming_window_init (WumingWindow *self)
     /* Initialize the settings */
     wuming_window_init_settings (self, settings);
 
-    self->drop_target = gtk_drop_target_new (G_TYPE_FILE, GDK_ACTION_COPY);
+    self->drop_target = gtk_drop_target_new (GDK_TYPE_FILE_LIST, GDK_ACTION_COPY); // Several files and folders can be dropped at once
     g_signal_connect (self->drop_target, "drop", G_CALLBACK (wuming_window_on_drag_drop), self);
     gtk_widget_add_controller (GTK_WIDGET (self), GTK_EVENT_CONTROLLER (self->drop_target));
 
@@ -618,4 +735,6 @@ wuming_window_init (WumingWindow *self)
 	                                 self);
 
     self->app = g_application_get_default ();
+
+    startup_log_stage ("window initialized");
 }